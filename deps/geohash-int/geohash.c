@@ -109,6 +109,56 @@ static inline uint64_t deinterleave64(uint64_t interleaved) {
     return x | (y << 32);
 }
 
+/* On x86-64 CPUs with BMI2 the interleaving is a single PDEP per coordinate
+ * and the deinterleaving a single PEXT. These are selected at runtime, so
+ * that the library is still built for the baseline instruction set. */
+#if defined(__x86_64__) && (defined(__clang__) || \
+    (defined(__GNUC__) && __GNUC__ >= 5))
+#define GEOHASH_HAVE_BMI2 1
+#include <immintrin.h>
+
+__attribute__((target("bmi2")))
+static uint64_t interleave64BMI2(uint32_t xlo, uint32_t ylo) {
+    return _pdep_u64(xlo, 0x5555555555555555ULL) |
+           _pdep_u64(ylo, 0xaaaaaaaaaaaaaaaaULL);
+}
+
+__attribute__((target("bmi2")))
+static uint64_t deinterleave64BMI2(uint64_t interleaved) {
+    return _pext_u64(interleaved, 0x5555555555555555ULL) |
+           (_pext_u64(interleaved, 0xaaaaaaaaaaaaaaaaULL) << 32);
+}
+#endif
+
+static int geohash_bmi2 = 0;
+
+/* Use the BMI2 interleaving if 'enable' is true, otherwise the portable
+ * code, that is the default. The library does not probe the CPU itself:
+ * the caller must only enable BMI2 if the CPU supports it. Returns 1 if
+ * BMI2 is now used, that is never the case if it was not compiled in. */
+int geohashSelectBMI2(int enable) {
+#ifdef GEOHASH_HAVE_BMI2
+    geohash_bmi2 = enable != 0;
+#else
+    (void)enable;
+#endif
+    return geohash_bmi2;
+}
+
+static inline uint64_t geohashInterleave(uint32_t xlo, uint32_t ylo) {
+#ifdef GEOHASH_HAVE_BMI2
+    if (geohash_bmi2) return interleave64BMI2(xlo, ylo);
+#endif
+    return interleave64(xlo, ylo);
+}
+
+static inline uint64_t geohashDeinterleave(uint64_t interleaved) {
+#ifdef GEOHASH_HAVE_BMI2
+    if (geohash_bmi2) return deinterleave64BMI2(interleaved);
+#endif
+    return deinterleave64(interleaved);
+}
+
 void geohashGetCoordRange(GeoHashRange *long_range, GeoHashRange *lat_range) {
     /* These are constraints from EPSG:900913 / EPSG:3785 / OSGEO:41001 */
     /* We can't geocode at the north/south pole. */
@@ -146,7 +196,7 @@ int geohashEncode(const GeoHashRange *long_range, const GeoHashRange *lat_range,
     /* convert to fixed point based on the step size */
     lat_offset *= (1 << step);
     long_offset *= (1 << step);
-    hash->bits = interleave64(lat_offset, long_offset);
+    hash->bits = geohashInterleave(lat_offset, long_offset);
     return 1;
 }
 
@@ -170,7 +220,7 @@ int geohashDecode(const GeoHashRange long_range, const GeoHashRange lat_range,
 
     area->hash = hash;
     uint8_t step = hash.step;
-    uint64_t hash_sep = deinterleave64(hash.bits); /* hash = [LAT][LONG] */
+    uint64_t hash_sep = geohashDeinterleave(hash.bits); /* hash = [LAT][LONG] */
 
     double lat_scale = lat_range.max - lat_range.min;
     double long_scale = long_range.max - long_range.min;
@@ -221,6 +271,33 @@ int geohashDecodeToLongLatWGS84(const GeoHashBits hash, double *xy) {
     return geohashDecodeToLongLatType(hash, xy);
 }
 
+/* Decode 'count' hashes of GEO_STEP_MAX steps (as stored in the sorted set
+ * scores) to the longitude and latitude of the center of their areas, that
+ * are stored in lon[] and lat[]. The result is exactly the same returned
+ * by geohashDecodeToLongLatWGS84(), but the ranges and scales are only
+ * computed once. */
+void geohashDecodeToLongLatBatchWGS84(const uint64_t *bits, double *lon,
+                                      double *lat, size_t count) {
+    GeoHashRange long_range, lat_range;
+    double lat_scale, long_scale, cells = 1ull << GEO_STEP_MAX;
+    size_t j;
+
+    geohashGetCoordRange(&long_range,&lat_range);
+    lat_scale = lat_range.max - lat_range.min;
+    long_scale = long_range.max - long_range.min;
+    for (j = 0; j < count; j++) {
+        uint64_t hash_sep = geohashDeinterleave(bits[j]);
+        uint32_t ilato = hash_sep;
+        uint32_t ilono = hash_sep >> 32;
+        double latmin = lat_range.min + (ilato * 1.0 / cells) * lat_scale;
+        double latmax = lat_range.min + ((ilato + 1) * 1.0 / cells) * lat_scale;
+        double lonmin = long_range.min + (ilono * 1.0 / cells) * long_scale;
+        double lonmax = long_range.min + ((ilono + 1) * 1.0 / cells) * long_scale;
+        lon[j] = (lonmin + lonmax) / 2;
+        lat[j] = (latmin + latmax) / 2;
+    }
+}
+
 static void geohash_move_x(GeoHashBits *hash, int8_t d) {
     if (d == 0)
         return;
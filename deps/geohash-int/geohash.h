@@ -110,6 +110,9 @@ int geohashDecodeAreaToLongLat(const GeoHashArea *area, double *xy);
 int geohashDecodeToLongLatType(const GeoHashBits hash, double *xy);
 int geohashDecodeToLongLatWGS84(const GeoHashBits hash, double *xy);
 int geohashDecodeToLongLatMercator(const GeoHashBits hash, double *xy);
+void geohashDecodeToLongLatBatchWGS84(const uint64_t *bits, double *lon,
+                                      double *lat, size_t count);
+int geohashSelectBMI2(int enable);
 void geohashNeighbors(const GeoHashBits *hash, GeoHashNeighbors *neighbors);
 
 #if defined(__cplusplus)
@@ -80,97 +80,190 @@ uint8_t geohashEstimateStepsByRadius(double range_meters, double lat) {
     return step;
 }
 
-/* Return the bounding box of the search area centered at latitude,longitude
- * having a radius of radius_meter. bounds[0] - bounds[2] is the minimum
- * and maxium longitude, while bounds[1] - bounds[3] is the minimum and
- * maximum latitude. */
-int geohashBoundingBox(double longitude, double latitude, double radius_meters,
-                       double *bounds) {
+/* Return the bounding box of the search area 'shape'. bounds[0] - bounds[2]
+ * is the minimum and maximum longitude, while bounds[1] - bounds[3] is the
+ * minimum and maximum latitude. The longitude bounds may exceed the
+ * -180,180 range when the area crosses the antimeridian, and are set to
+ * span the whole globe when the area is too near to a pole.
+ *
+ * The bounds are exact (not approximated at the center latitude) since they
+ * are used to discard the search boxes not intersecting the area. */
+int geohashBoundingBox(GeoShape *shape, double *bounds) {
+    double longitude = shape->xy[0], latitude = shape->xy[1];
+    double lat_delta, lon_delta = 360, s;
+
     if (!bounds) return 0;
 
-    bounds[0] = longitude - rad_deg(radius_meters/EARTH_RADIUS_IN_METERS/cos(deg_rad(latitude)));
-    bounds[2] = longitude + rad_deg(radius_meters/EARTH_RADIUS_IN_METERS/cos(deg_rad(latitude)));
-    bounds[1] = latitude - rad_deg(radius_meters/EARTH_RADIUS_IN_METERS);
-    bounds[3] = latitude + rad_deg(radius_meters/EARTH_RADIUS_IN_METERS);
+    if (shape->type == GEO_SHAPE_CIRCLE) {
+        double d = shape->radius / EARTH_RADIUS_IN_METERS;
+
+        /* The points of a spherical cap of angular radius 'd' span at most
+         * asin(sin(d)/cos(lat)) in longitude, unless the cap contains a
+         * pole. */
+        lat_delta = rad_deg(d);
+        if (d < M_PI/2 && latitude + lat_delta < 90 &&
+            latitude - lat_delta > -90)
+        {
+            s = sin(d) / cos(deg_rad(latitude));
+            if (s < 1) lon_delta = rad_deg(asin(s));
+        }
+    } else {
+        double d = shape->width / 4 / EARTH_RADIUS_IN_METERS;
+        double maxlat;
+
+        /* A point is inside the rectangle if it is at most height/2 meters
+         * north or south of the center, and at most width/2 meters east or
+         * west of the center along its own parallel. The longitude span is
+         * larger on the parallel nearest to the pole. */
+        lat_delta = rad_deg(shape->height / 2 / EARTH_RADIUS_IN_METERS);
+        maxlat = fabs(latitude) + lat_delta;
+        if (d < M_PI/2 && maxlat < 90) {
+            s = sin(d) / cos(deg_rad(maxlat));
+            if (s < 1) lon_delta = rad_deg(2 * asin(s));
+        }
+    }
+
+    bounds[0] = longitude - lon_delta;
+    bounds[2] = longitude + lon_delta;
+    bounds[1] = latitude - lat_delta;
+    bounds[3] = latitude + lat_delta;
     return 1;
 }
 
+/* Normalize a longitude difference to the -180,180 range. */
+static double geohashLongitudeDelta(double delta) {
+    while (delta > 180) delta -= 360;
+    while (delta < -180) delta += 360;
+    return delta;
+}
+
+/* Return 0 if no point of 'area' can be inside the search area 'shape',
+ * whose bounds must be already computed, otherwise 1 is returned. This is
+ * used to discard the neighbor boxes that are not worth scanning, so the
+ * function is exact or conservative, but never wrong. */
+int geohashAreaIntersectsShape(GeoShape *shape, const GeoHashArea *area) {
+    double longitude = shape->xy[0], latitude = shape->xy[1];
+    double *bounds = shape->bounds;
+
+    /* Every point in the area must be within the bounding box. */
+    if (area->latitude.max < bounds[1] || area->latitude.min > bounds[3])
+        return 0;
+    if (bounds[0] >= -180 && bounds[2] <= 180 &&
+        (area->longitude.max < bounds[0] || area->longitude.min > bounds[2]))
+        return 0;
+    if (shape->type != GEO_SHAPE_CIRCLE) return 1;
+
+    /* For circles, compute the distance between the center and the nearest
+     * point of the area. If the center longitude is within the area, this
+     * is the distance to the nearest parallel bounding the area. Otherwise
+     * it is the distance to the nearest point of the meridian bounding the
+     * area on the side of the center, since along a parallel the distance
+     * grows with the longitude difference. */
+    double dmin = geohashLongitudeDelta(area->longitude.min - longitude);
+    double dmax = geohashLongitudeDelta(area->longitude.max - longitude);
+    double lat_nearest, lon_delta, distance;
+
+    if (dmin <= 0 && dmax >= 0) {
+        if (latitude >= area->latitude.min && latitude <= area->latitude.max)
+            return 1;
+        lat_nearest = latitude < area->latitude.min ? area->latitude.min :
+                                                      area->latitude.max;
+        distance = geohashGetLatDistance(latitude, lat_nearest);
+        return distance <= shape->radius;
+    }
+
+    lon_delta = fabs(dmin) < fabs(dmax) ? dmin : dmax;
+    if (fabs(lon_delta) >= 90) return 1; /* Not worth handling. */
+
+    /* The point of a meridian nearest to the center is at latitude
+     * atan(tan(lat)/cos(lon_delta)), and the distance grows moving away
+     * from it, so clamp it into the area latitude range. */
+    lat_nearest = rad_deg(atan(tan(deg_rad(latitude)) /
+                               cos(deg_rad(lon_delta))));
+    if (lat_nearest < area->latitude.min) lat_nearest = area->latitude.min;
+    if (lat_nearest > area->latitude.max) lat_nearest = area->latitude.max;
+    distance = geohashGetDistance(longitude, latitude,
+                                  longitude + lon_delta, lat_nearest);
+    /* Allow for some floating point error, since we must never discard a
+     * box containing points inside the circle. */
+    return distance <= shape->radius * (1 + 1e-9) + 1e-6;
+}
+
 /* Return a set of areas (center + 8) that are able to cover a range query
- * for the specified position and radius. */
-GeoHashRadius geohashGetAreasByRadius(double longitude, double latitude, double radius_meters) {
+ * for the specified search area. The bounds of the shape are computed as
+ * a side effect. */
+GeoHashRadius geohashGetAreasByShapeWGS84(GeoShape *shape) {
     GeoHashRange long_range, lat_range;
     GeoHashRadius radius;
     GeoHashBits hash;
     GeoHashNeighbors neighbors;
     GeoHashArea area;
-    double min_lon, max_lon, min_lat, max_lat;
-    double bounds[4];
+    double longitude = shape->xy[0], latitude = shape->xy[1];
+    double *bounds = shape->bounds;
+    double radius_meters;
     int steps;
 
-    geohashBoundingBox(longitude, latitude, radius_meters, bounds);
-    min_lon = bounds[0];
-    min_lat = bounds[1];
-    max_lon = bounds[2];
-    max_lat = bounds[3];
-
+    geohashBoundingBox(shape, bounds);
+    if (shape->type == GEO_SHAPE_CIRCLE) {
+        radius_meters = shape->radius;
+    } else {
+        radius_meters = shape->width > shape->height ?
+                        shape->width / 2 : shape->height / 2;
+    }
     steps = geohashEstimateStepsByRadius(radius_meters,latitude);
 
     geohashGetCoordRange(&long_range,&lat_range);
-    geohashEncode(&long_range,&lat_range,longitude,latitude,steps,&hash);
-    geohashNeighbors(&hash,&neighbors);
-    geohashDecode(long_range,lat_range,hash,&area);
-
-    /* Check if the step is enough at the limits of the covered area.
-     * Sometimes when the search area is near an edge of the
-     * area, the estimated step is not small enough, since one of the
-     * north / south / west / east square is too near to the search area
-     * to cover everything. */
-    int decrease_step = 0;
-    {
+    while (1) {
         GeoHashArea north, south, east, west;
 
+        geohashEncode(&long_range,&lat_range,longitude,latitude,steps,&hash);
+        geohashNeighbors(&hash,&neighbors);
+        geohashDecode(long_range,lat_range,hash,&area);
+        if (steps == 1) break;
+
+        /* Check if the step is enough at the limits of the covered area.
+         * Sometimes when the search area is near an edge of the
+         * area, the estimated step is not small enough, since one of the
+         * north / south / west / east square is too near to the search area
+         * to cover everything. */
         geohashDecode(long_range, lat_range, neighbors.north, &north);
         geohashDecode(long_range, lat_range, neighbors.south, &south);
         geohashDecode(long_range, lat_range, neighbors.east, &east);
         geohashDecode(long_range, lat_range, neighbors.west, &west);
 
-        if (geohashGetDistance(longitude,latitude,longitude,north.latitude.max)
-            < radius_meters) decrease_step = 1;
-        if (geohashGetDistance(longitude,latitude,longitude,south.latitude.min)
-            < radius_meters) decrease_step = 1;
-        if (geohashGetDistance(longitude,latitude,east.longitude.max,latitude)
-            < radius_meters) decrease_step = 1;
-        if (geohashGetDistance(longitude,latitude,west.longitude.min,latitude)
-            < radius_meters) decrease_step = 1;
-    }
+        /* Neighbors wrap around at the edges of the map: in that case the
+         * center area already reaches the edge, so nothing is missed on
+         * that side in latitude, while in longitude the neighbor is just
+         * on the other side of the antimeridian. */
+        double east_max = east.longitude.max, west_min = west.longitude.min;
+        if (east_max < area.longitude.max) east_max += 360;
+        if (west_min > area.longitude.min) west_min -= 360;
 
-    if (steps > 1 && decrease_step) {
-        steps--;
-        geohashEncode(&long_range,&lat_range,longitude,latitude,steps,&hash);
-        geohashNeighbors(&hash,&neighbors);
-        geohashDecode(long_range,lat_range,hash,&area);
+        if ((north.latitude.max > area.latitude.max &&
+             north.latitude.max < bounds[3]) ||
+            (south.latitude.min < area.latitude.min &&
+             south.latitude.min > bounds[1]) ||
+            (bounds[2] - bounds[0] < 360 &&
+             (east_max < bounds[2] || west_min > bounds[0])))
+        {
+            steps--;
+            continue;
+        }
+        break;
     }
 
     /* Exclude the search areas that are useless. */
-    if (area.latitude.min < min_lat) {
-        GZERO(neighbors.south);
-        GZERO(neighbors.south_west);
-        GZERO(neighbors.south_east);
-    }
-    if (area.latitude.max > max_lat) {
-        GZERO(neighbors.north);
-        GZERO(neighbors.north_east);
-        GZERO(neighbors.north_west);
-    }
-    if (area.longitude.min < min_lon) {
-        GZERO(neighbors.west);
-        GZERO(neighbors.south_west);
-        GZERO(neighbors.north_west);
-    }
-    if (area.longitude.max > max_lon) {
-        GZERO(neighbors.east);
-        GZERO(neighbors.south_east);
-        GZERO(neighbors.north_east);
+    GeoHashBits *boxes[8] = {
+        &neighbors.north, &neighbors.south, &neighbors.east,
+        &neighbors.west, &neighbors.north_east, &neighbors.north_west,
+        &neighbors.south_east, &neighbors.south_west
+    };
+    for (int j = 0; j < 8; j++) {
+        GeoHashArea box;
+
+        if (GISZERO((*boxes[j]))) continue;
+        geohashDecode(long_range, lat_range, *boxes[j], &box);
+        if (!geohashAreaIntersectsShape(shape, &box)) GZERO((*boxes[j]));
     }
     radius.hash = hash;
     radius.neighbors = neighbors;
@@ -178,11 +271,6 @@ GeoHashRadius geohashGetAreasByRadius(double longitude, double latitude, double
     return radius;
 }
 
-GeoHashRadius geohashGetAreasByRadiusWGS84(double longitude, double latitude,
-                                           double radius_meters) {
-    return geohashGetAreasByRadius(longitude, latitude, radius_meters);
-}
-
 GeoHashFix52Bits geohashAlign52Bits(const GeoHashBits hash) {
     uint64_t bits = hash.bits;
     bits <<= (52 - hash.step * 2);
@@ -202,6 +290,11 @@ double geohashGetDistance(double lon1d, double lat1d, double lon2d, double lat2d
            asin(sqrt(u * u + cos(lat1r) * cos(lat2r) * v * v));
 }
 
+/* Distance along a meridian between two latitudes. */
+double geohashGetLatDistance(double lat1d, double lat2d) {
+    return EARTH_RADIUS_IN_METERS * fabs(deg_rad(lat2d) - deg_rad(lat1d));
+}
+
 int geohashGetDistanceIfInRadius(double x1, double y1,
                                  double x2, double y2, double radius,
                                  double *distance) {
@@ -215,3 +308,19 @@ int geohashGetDistanceIfInRadiusWGS84(double x1, double y1, double x2,
                                       double *distance) {
     return geohashGetDistanceIfInRadius(x1, y1, x2, y2, radius, distance);
 }
+
+/* Check if the point x2,y2 is inside the rectangle of the specified width
+ * and height (in meters) centered at x1,y1, that is, if it is at most
+ * height/2 meters north or south of the center, and at most width/2
+ * meters east or west of the center along its own parallel. If so, the
+ * distance between the two points is stored in *distance and 1 is
+ * returned, otherwise 0 is returned. */
+int geohashGetDistanceIfInRectangle(double width_m, double height_m,
+                                    double x1, double y1,
+                                    double x2, double y2, double *distance) {
+    /* The latitude distance is cheaper to compute, so check it first. */
+    if (geohashGetLatDistance(y1, y2) > height_m / 2) return 0;
+    if (geohashGetDistance(x1, y2, x2, y2) > width_m / 2) return 0;
+    *distance = geohashGetDistance(x1, y1, x2, y2);
+    return 1;
+}
@@ -48,24 +48,40 @@ typedef struct {
     GeoHashNeighbors neighbors;
 } GeoHashRadius;
 
+/* The area of a search: a circle, or a rectangle aligned to the meridians
+ * and parallels, centered at xy (longitude, latitude). */
+#define GEO_SHAPE_CIRCLE 1
+#define GEO_SHAPE_RECTANGLE 2
+
+typedef struct {
+    int type;           /* GEO_SHAPE_CIRCLE or GEO_SHAPE_RECTANGLE. */
+    double xy[2];       /* Center longitude and latitude. */
+    double radius;      /* Circle radius, in meters. */
+    double width;       /* Rectangle width, in meters. */
+    double height;      /* Rectangle height, in meters. */
+    double conversion;  /* Meters to the unit used in the query. */
+    double bounds[4];   /* Bounding box, see geohashBoundingBox(). */
+} GeoShape;
+
+extern const double EARTH_RADIUS_IN_METERS;
+
 int GeoHashBitsComparator(const GeoHashBits *a, const GeoHashBits *b);
 uint8_t geohashEstimateStepsByRadius(double range_meters, double lat);
-int geohashBoundingBox(double longitude, double latitude, double radius_meters,
-                        double *bounds);
-GeoHashRadius geohashGetAreasByRadius(double longitude,
-                                      double latitude, double radius_meters);
-GeoHashRadius geohashGetAreasByRadiusWGS84(double longitude, double latitude,
-                                           double radius_meters);
-GeoHashRadius geohashGetAreasByRadiusMercator(double longitude, double latitude,
-                                              double radius_meters);
+int geohashBoundingBox(GeoShape *shape, double *bounds);
+int geohashAreaIntersectsShape(GeoShape *shape, const GeoHashArea *area);
+GeoHashRadius geohashGetAreasByShapeWGS84(GeoShape *shape);
 GeoHashFix52Bits geohashAlign52Bits(const GeoHashBits hash);
 double geohashGetDistance(double lon1d, double lat1d,
                           double lon2d, double lat2d);
+double geohashGetLatDistance(double lat1d, double lat2d);
 int geohashGetDistanceIfInRadius(double x1, double y1,
                                  double x2, double y2, double radius,
                                  double *distance);
 int geohashGetDistanceIfInRadiusWGS84(double x1, double y1, double x2,
                                       double y2, double radius,
                                       double *distance);
+int geohashGetDistanceIfInRectangle(double width_m, double height_m,
+                                    double x1, double y1,
+                                    double x2, double y2, double *distance);
 
 #endif /* GEOHASH_HELPER_HPP_ */
@@ -31,6 +31,7 @@
 #include "bio.h"
 #include "rio.h"
 
+#include <ctype.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -41,156 +42,380 @@
 #include <sys/param.h>
 
 void aofUpdateCurrentSize(void);
-void aofClosePipes(void);
 
 /* ----------------------------------------------------------------------------
- * AOF rewrite buffer implementation.
+ * AOF manifest implementation.
  *
- * The following code implement a simple buffer used in order to accumulate
- * changes while the background process is rewriting the AOF file.
+ * The AOF is split into a base file, produced by the last rewrite, and a
+ * list of INCR files the commands are appended to. When a rewrite starts
+ * the parent just switches to a new INCR file: the child rewrites the
+ * dataset as it was at fork time into a new base file, and once it is done
+ * the new base and the INCR files created from the fork on replace the old
+ * files. This way there is no need to accumulate the writes performed
+ * during the rewrite and to send them to the child.
  *
- * We only need to append, but can't just use realloc with a large block
- * because 'huge' reallocs are not always handled as one could expect
- * (via remapping of pages at OS level) but may involve copying data.
+ * The manifest, a text file named after appendfilename, lists the files
+ * in loading order, one per line:
  *
- * For this reason we use a list of blocks, every block is
- * AOF_RW_BUF_BLOCK_SIZE bytes.
+ *   file appendonly.aof.3.base.aof seq 3 type b
+ *   file appendonly.aof.5.incr.aof seq 5 type i
+ *   file appendonly.aof.6.incr.aof seq 6 type i
+ *
+ * An AOF written by older versions, with no manifest, is used as the base
+ * file of a new manifest.
  * ------------------------------------------------------------------------- */
 
-#define AOF_RW_BUF_BLOCK_SIZE (1024*1024*10)    /* 10 MB per block */
+static aofInfo *aofInfoCreate(sds name, long long seq) {
+    aofInfo *ai = zmalloc(sizeof(*ai));
+
+    ai->name = name;
+    ai->seq = seq;
+    return ai;
+}
+
+static void aofInfoFree(void *ptr) {
+    aofInfo *ai = ptr;
+
+    sdsfree(ai->name);
+    zfree(ai);
+}
+
+static void *aofInfoDup(void *ptr) {
+    aofInfo *ai = ptr;
+
+    return aofInfoCreate(sdsdup(ai->name),ai->seq);
+}
+
+aofManifest *aofManifestCreate(void) {
+    aofManifest *am = zcalloc(sizeof(*am));
 
-typedef struct aofrwblock {
-    unsigned long used, free;
-    char buf[AOF_RW_BUF_BLOCK_SIZE];
-} aofrwblock;
+    am->incr = listCreate();
+    listSetFreeMethod(am->incr,aofInfoFree);
+    listSetDupMethod(am->incr,aofInfoDup);
+    return am;
+}
+
+static void aofManifestFree(aofManifest *am) {
+    if (am->base) aofInfoFree(am->base);
+    listRelease(am->incr);
+    zfree(am);
+}
+
+static aofManifest *aofManifestDup(aofManifest *am) {
+    aofManifest *dup = zmalloc(sizeof(*dup));
+
+    dup->base = am->base ? aofInfoDup(am->base) : NULL;
+    dup->incr = listDup(am->incr);
+    dup->base_seq = am->base_seq;
+    dup->incr_seq = am->incr_seq;
+    return dup;
+}
 
-/* This function free the old AOF rewrite buffer if needed, and initialize
- * a fresh new one. It tests for server.aof_rewrite_buf_blocks equal to NULL
- * so can be used for the first initialization as well. */
-void aofRewriteBufferReset(void) {
-    if (server.aof_rewrite_buf_blocks)
-        listRelease(server.aof_rewrite_buf_blocks);
+static sds aofManifestFilename(void) {
+    return sdscatprintf(sdsempty(),"%s.manifest",server.aof_filename);
+}
 
-    server.aof_rewrite_buf_blocks = listCreate();
-    listSetFreeMethod(server.aof_rewrite_buf_blocks,zfree);
+static sds aofBaseFilename(long long seq) {
+    return sdscatprintf(sdsempty(),"%s.%lld.base.aof",server.aof_filename,seq);
 }
 
-/* Return the current size of the AOF rewrite buffer. */
-unsigned long aofRewriteBufferSize(void) {
+static sds aofIncrFilename(long long seq) {
+    return sdscatprintf(sdsempty(),"%s.%lld.incr.aof",server.aof_filename,seq);
+}
+
+/* The INCR file written while the AOF is being turned on: it has no base
+ * until the first rewrite completes, so it is not listed in the manifest. */
+static sds aofTempIncrFilename(void) {
+    return sdscatprintf(sdsempty(),"temp-%s.incr",server.aof_filename);
+}
+
+/* Add to 'files' the files of the manifest, in loading order. The names
+ * are not duplicated. */
+static void aofManifestFiles(aofManifest *am, list *files) {
     listNode *ln;
     listIter li;
-    unsigned long size = 0;
 
-    listRewind(server.aof_rewrite_buf_blocks,&li);
-    while((ln = listNext(&li))) {
-        aofrwblock *block = listNodeValue(ln);
-        size += block->used;
-    }
-    return size;
+    if (am->base) listAddNodeTail(files,am->base);
+    listRewind(am->incr,&li);
+    while((ln = listNext(&li)) != NULL)
+        listAddNodeTail(files,listNodeValue(ln));
 }
 
-/* Event handler used to send data to the child process doing the AOF
- * rewrite. We send pieces of our AOF differences buffer so that the final
- * write when the child finishes the rewrite will be small. */
-void aofChildWriteDiffData(aeEventLoop *el, int fd, void *privdata, int mask) {
+/* Write the manifest 'am' on disk, replacing the old one atomically. */
+static int aofManifestPersist(aofManifest *am) {
+    sds filename = aofManifestFilename();
+    sds tmpfile = sdscatprintf(sdsempty(),"temp-%s",filename);
+    list *files = listCreate();
     listNode *ln;
-    aofrwblock *block;
-    ssize_t nwritten;
-    UNUSED(el);
-    UNUSED(fd);
-    UNUSED(privdata);
-    UNUSED(mask);
+    listIter li;
+    FILE *fp;
 
-    while(1) {
-        ln = listFirst(server.aof_rewrite_buf_blocks);
-        block = ln ? ln->value : NULL;
-        if (server.aof_stop_sending_diff || !block) {
-            aeDeleteFileEvent(server.el,server.aof_pipe_write_data_to_child,
-                              AE_WRITABLE);
-            return;
+    fp = fopen(tmpfile,"w");
+    if (!fp) goto werr;
+    aofManifestFiles(am,files);
+    listRewind(files,&li);
+    while((ln = listNext(&li)) != NULL) {
+        aofInfo *ai = listNodeValue(ln);
+        sds line = sdsnew("file ");
+        size_t j;
+
+        /* Quote the names that can't be split back as they are. */
+        for (j = 0; j < sdslen(ai->name); j++) {
+            char c = ai->name[j];
+            if (!isprint(c) || isspace(c) || c == '"' || c == '\'') break;
         }
-        if (block->used > 0) {
-            nwritten = write(server.aof_pipe_write_data_to_child,
-                             block->buf,block->used);
-            if (nwritten <= 0) return;
-            memmove(block->buf,block->buf+nwritten,block->used-nwritten);
-            block->used -= nwritten;
-            block->free += nwritten;
+        if (j == sdslen(ai->name) && j != 0)
+            line = sdscatsds(line,ai->name);
+        else
+            line = sdscatrepr(line,ai->name,sdslen(ai->name));
+        line = sdscatprintf(line," seq %lld type %c\n",
+            ai->seq, ai == am->base ? 'b' : 'i');
+        if (fwrite(line,sdslen(line),1,fp) != 1) {
+            sdsfree(line);
+            goto werr;
         }
-        if (block->used == 0) listDelNode(server.aof_rewrite_buf_blocks,ln);
+        sdsfree(line);
+    }
+    if (fflush(fp) == EOF || fsync(fileno(fp)) == -1) goto werr;
+    if (fclose(fp) == EOF) {
+        fp = NULL;
+        goto werr;
     }
+    fp = NULL;
+    if (rename(tmpfile,filename) == -1) goto werr;
+    listRelease(files);
+    sdsfree(tmpfile);
+    sdsfree(filename);
+    return C_OK;
+
+werr:
+    serverLog(LL_WARNING,"Error writing the AOF manifest %s: %s",
+        filename, strerror(errno));
+    if (fp) fclose(fp);
+    unlink(tmpfile);
+    listRelease(files);
+    sdsfree(tmpfile);
+    sdsfree(filename);
+    return C_ERR;
 }
 
-/* Append data to the AOF rewrite buffer, allocating new blocks if needed. */
-void aofRewriteBufferAppend(unsigned char *s, unsigned long len) {
-    listNode *ln = listLast(server.aof_rewrite_buf_blocks);
-    aofrwblock *block = ln ? ln->value : NULL;
-
-    while(len) {
-        /* If we already got at least an allocated block, try appending
-         * at least some piece into it. */
-        if (block) {
-            unsigned long thislen = (block->free < len) ? block->free : len;
-            if (thislen) {  /* The current block is not already full. */
-                memcpy(block->buf+block->used, s, thislen);
-                block->used += thislen;
-                block->free -= thislen;
-                s += thislen;
-                len -= thislen;
-            }
-        }
+/* Load the manifest of the AOF in server.aof_manifest. Without a manifest
+ * an existing appendfilename, written by older versions, is used as base.
+ * A broken manifest is a fatal error if the AOF is enabled. */
+void aofLoadManifestFromDisk(void) {
+    sds filename = aofManifestFilename();
+    aofManifest *am = aofManifestCreate();
+    char buf[CONFIG_MAX_LINE+1];
+    struct redis_stat sb;
+    int linenum = 0;
+    char *err = NULL;
+    FILE *fp;
 
-        if (len) { /* First block to allocate, or need another block. */
-            int numblocks;
-
-            block = zmalloc(sizeof(*block));
-            block->free = AOF_RW_BUF_BLOCK_SIZE;
-            block->used = 0;
-            listAddNodeTail(server.aof_rewrite_buf_blocks,block);
-
-            /* Log every time we cross more 10 or 100 blocks, respectively
-             * as a notice or warning. */
-            numblocks = listLength(server.aof_rewrite_buf_blocks);
-            if (((numblocks+1) % 10) == 0) {
-                int level = ((numblocks+1) % 100) == 0 ? LL_WARNING :
-                                                         LL_NOTICE;
-                serverLog(level,"Background AOF buffer size: %lu MB",
-                    aofRewriteBufferSize()/(1024*1024));
+    if ((fp = fopen(filename,"r")) == NULL) {
+        if (errno != ENOENT) {
+            err = strerror(errno);
+            goto loaderr;
+        }
+        if (redis_stat(server.aof_filename,&sb) == 0)
+            am->base = aofInfoCreate(sdsnew(server.aof_filename),0);
+        goto loaded;
+    }
+    while(fgets(buf,sizeof(buf),fp) != NULL) {
+        sds *argv;
+        int argc;
+        long long seq;
+
+        linenum++;
+        argv = sdssplitargs(buf,&argc);
+        if (argv == NULL) {
+            err = "Unbalanced quotes";
+            goto loaderr;
+        }
+        if (argc == 0) {
+            sdsfreesplitres(argv,argc);
+            continue;
+        }
+        if (argc != 6 || strcasecmp(argv[0],"file") ||
+            strcasecmp(argv[2],"seq") || strcasecmp(argv[4],"type") ||
+            string2ll(argv[3],sdslen(argv[3]),&seq) == 0 || seq < 0 ||
+            sdslen(argv[5]) != 1 || (argv[5][0] != 'b' && argv[5][0] != 'i'))
+        {
+            sdsfreesplitres(argv,argc);
+            err = "Invalid file line";
+            goto loaderr;
+        }
+        if (argv[5][0] == 'b') {
+            if (am->base || listLength(am->incr)) {
+                sdsfreesplitres(argv,argc);
+                err = "Unexpected base file";
+                goto loaderr;
             }
+            am->base = aofInfoCreate(sdsdup(argv[1]),seq);
+            am->base_seq = seq;
+        } else {
+            if (seq <= am->incr_seq && listLength(am->incr)) {
+                sdsfreesplitres(argv,argc);
+                err = "INCR files out of order";
+                goto loaderr;
+            }
+            listAddNodeTail(am->incr,aofInfoCreate(sdsdup(argv[1]),seq));
+            am->incr_seq = seq;
         }
+        sdsfreesplitres(argv,argc);
+    }
+    if (ferror(fp)) {
+        err = strerror(errno);
+        goto loaderr;
     }
+    fclose(fp);
 
-    /* Install a file event to send data to the rewrite child if there is
-     * not one already. */
-    if (aeGetFileEvents(server.el,server.aof_pipe_write_data_to_child) == 0) {
-        aeCreateFileEvent(server.el, server.aof_pipe_write_data_to_child,
-            AE_WRITABLE, aofChildWriteDiffData, NULL);
+loaded:
+    aofManifestFree(server.aof_manifest);
+    server.aof_manifest = am;
+    sdsfree(filename);
+    return;
+
+loaderr:
+    if (fp) fclose(fp);
+    aofManifestFree(am);
+    if (linenum) {
+        serverLog(LL_WARNING,"Bad AOF manifest %s at line %d: %s",
+            filename, linenum, err);
+    } else {
+        serverLog(LL_WARNING,"Can't read the AOF manifest %s: %s",
+            filename, err);
     }
+    sdsfree(filename);
+    if (server.aof_state == AOF_ON) exit(1);
+    serverLog(LL_WARNING,"The AOF is disabled: ignoring its manifest.");
 }
 
-/* Write the buffer (possibly composed of multiple blocks) into the specified
- * fd. If a short write or any other error happens -1 is returned,
- * otherwise the number of bytes written is returned. */
-ssize_t aofRewriteBufferWrite(int fd) {
-    listNode *ln;
-    listIter li;
-    ssize_t count = 0;
-
-    listRewind(server.aof_rewrite_buf_blocks,&li);
-    while((ln = listNext(&li))) {
-        aofrwblock *block = listNodeValue(ln);
-        ssize_t nwritten;
-
-        if (block->used) {
-            nwritten = write(fd,block->buf,block->used);
-            if (nwritten != (ssize_t)block->used) {
-                if (nwritten == 0) errno = EIO;
-                return -1;
-            }
-            count += nwritten;
+/* Delete a file of the AOF that is no longer needed. The file is unlinked
+ * while still open, so that the actual deletion happens closing it in a
+ * background thread. */
+static void aofDelFile(char *filename) {
+    int fd = open(filename,O_RDONLY|O_NONBLOCK);
+
+    if (unlink(filename) == -1 && errno != ENOENT) {
+        serverLog(LL_WARNING,"Can't remove the old AOF file %s: %s",
+            filename, strerror(errno));
+    }
+    if (fd != -1) bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)fd,NULL,NULL);
+}
+
+/* Close the AOF file descriptor in a background thread, after it is synced
+ * on disk, and set it to -1. */
+static void aofCloseFd(void) {
+    if (server.aof_fd == -1) return;
+    bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)server.aof_fd,
+        (void*)1,NULL);
+    server.aof_fd = -1;
+}
+
+/* Open the last INCR file of the AOF at startup, creating a new one if
+ * the manifest has none, as when upgrading an AOF of older versions. */
+void aofOpenIfNeededOnServerStart(void) {
+    aofManifest *am = server.aof_manifest;
+    aofInfo *ai;
+    struct redis_stat sb;
+
+    if (server.aof_state != AOF_ON) return;
+    if (listLength(am->incr) == 0) {
+        long long seq = am->incr_seq+1;
+
+        listAddNodeTail(am->incr,aofInfoCreate(aofIncrFilename(seq),seq));
+        am->incr_seq = seq;
+        if (aofManifestPersist(am) == C_ERR) exit(1);
+    }
+    ai = listNodeValue(listLast(am->incr));
+    server.aof_fd = open(ai->name,O_WRONLY|O_APPEND|O_CREAT,0644);
+    if (server.aof_fd == -1) {
+        serverLog(LL_WARNING, "Can't open the append-only file %s: %s",
+            ai->name, strerror(errno));
+        exit(1);
+    }
+    server.aof_last_incr_size =
+        redis_fstat(server.aof_fd,&sb) == -1 ? 0 : sb.st_size;
+}
+
+/* Switch the AOF to a new INCR file, called before forking a rewrite
+ * child: the commands written to the old files are all part of the
+ * dataset the child is going to rewrite. While the AOF is being turned
+ * on the new file is a temp one, listed in the manifest only once the
+ * first rewrite completes. */
+static int aofOpenNewIncr(void) {
+    aofManifest *am = server.aof_manifest;
+    long long seq = am->incr_seq+1;
+    sds filename;
+    int fd;
+
+    if (server.aof_state == AOF_OFF) return C_OK;
+    if (server.aof_state == AOF_ON) {
+        /* What is still in the AOF buffer belongs to the old file. */
+        flushAppendOnlyFile(1);
+        if (sdslen(server.aof_buf)) {
+            serverLog(LL_WARNING,"Can't switch to a new AOF file: the "
+                                 "AOF buffer can't be written.");
+            return C_ERR;
         }
+        filename = aofIncrFilename(seq);
+    } else {
+        /* The child will rewrite what was written to a previous temp
+         * file as well. */
+        sdsclear(server.aof_buf);
+        filename = aofTempIncrFilename();
     }
-    return count;
+    fd = open(filename,O_WRONLY|O_APPEND|O_CREAT|O_TRUNC,0644);
+    if (fd == -1) {
+        serverLog(LL_WARNING,"Can't open the new append-only file %s: %s",
+            filename, strerror(errno));
+        sdsfree(filename);
+        return C_ERR;
+    }
+    if (server.aof_state == AOF_ON) {
+        listAddNodeTail(am->incr,aofInfoCreate(sdsdup(filename),seq));
+        am->incr_seq = seq;
+        if (aofManifestPersist(am) == C_ERR) {
+            listDelNode(am->incr,listLast(am->incr));
+            am->incr_seq = seq-1;
+            close(fd);
+            unlink(filename);
+            sdsfree(filename);
+            return C_ERR;
+        }
+    }
+    sdsfree(filename);
+    aofCloseFd();
+    server.aof_fd = fd;
+    server.aof_last_incr_size = 0;
+    server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+    return C_OK;
+}
+
+/* Return true if the command being executed is part of a MULTI/EXEC block
+ * or of a script. The AOF buffer may then hold a MULTI whose EXEC was not
+ * propagated yet, so the AOF can't switch to a new INCR file: every file is
+ * loaded on its own, and the transaction would be split across two files.
+ * The rewrite is scheduled instead, and started by serverCron(). */
+static int aofInTransaction(void) {
+    return server.lua_caller != NULL ||
+           (server.current_client != NULL &&
+            server.current_client->flags & CLIENT_MULTI);
+}
+
+/* Drop the temp INCR file of an AOF being turned on, when the rewrite
+ * that should have produced its base is aborted. */
+static void aofDiscardTempIncr(void) {
+    sds filename = aofTempIncrFilename();
+
+    if (server.aof_fd != -1) {
+        bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)server.aof_fd,
+            NULL,NULL);
+        server.aof_fd = -1;
+    }
+    unlink(filename);
+    sdsfree(filename);
+    sdsclear(server.aof_buf);
 }
 
 /* ----------------------------------------------------------------------------
@@ -207,11 +432,16 @@ void aof_background_fsync(int fd) {
  * at runtime using the CONFIG command. */
 void stopAppendOnly(void) {
     serverAssert(server.aof_state != AOF_OFF);
-    flushAppendOnlyFile(1);
-    aof_fsync(server.aof_fd);
-    close(server.aof_fd);
+    if (server.aof_state == AOF_WAIT_REWRITE) {
+        /* Nothing was written to the AOF yet. */
+        aofDiscardTempIncr();
+    } else {
+        flushAppendOnlyFile(1);
+        aof_fsync(server.aof_fd);
+        close(server.aof_fd);
+        server.aof_fd = -1;
+    }
 
-    server.aof_fd = -1;
     server.aof_selected_db = -1;
     server.aof_state = AOF_OFF;
     /* rewrite operation in progress? kill it, wait child exit */
@@ -223,46 +453,33 @@ void stopAppendOnly(void) {
         if (kill(server.aof_child_pid,SIGUSR1) != -1) {
             while(wait3(&statloc,0,NULL) != server.aof_child_pid);
         }
-        /* reset the buffer accumulating changes while the child saves */
-        aofRewriteBufferReset();
         aofRemoveTempFile(server.aof_child_pid);
         server.aof_child_pid = -1;
         server.aof_rewrite_time_start = -1;
-        /* close pipes used for IPC between the two processes. */
-        aofClosePipes();
+        closeChildInfoPipe();
     }
 }
 
 /* Called when the user switches from "appendonly no" to "appendonly yes"
  * at runtime using the CONFIG command. */
 int startAppendOnly(void) {
-    char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
-
-    server.aof_last_fsync = server.unixtime;
-    server.aof_fd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
     serverAssert(server.aof_state == AOF_OFF);
-    if (server.aof_fd == -1) {
-        char *cwdp = getcwd(cwd,MAXPATHLEN);
-
-        serverLog(LL_WARNING,
-            "Redis needs to enable the AOF but can't open the "
-            "append only file %s (in server root dir %s): %s",
-            server.aof_filename,
-            cwdp ? cwdp : "unknown",
-            strerror(errno));
-        return C_ERR;
-    }
-    if (server.rdb_child_pid != -1) {
+    server.aof_last_fsync = server.unixtime;
+    /* The rewrite writes the base of the AOF, and switches to the file
+     * the new commands are appended to. Until it completes the AOF is not
+     * usable yet. */
+    server.aof_state = AOF_WAIT_REWRITE;
+    if (rdbBgsaveInProgress()) {
         server.aof_rewrite_scheduled = 1;
         serverLog(LL_WARNING,"AOF was enabled but there is already a child process saving an RDB file on disk. An AOF background was scheduled to start when possible.");
+    } else if (aofInTransaction()) {
+        server.aof_rewrite_scheduled = 1;
     } else if (rewriteAppendOnlyFileBackground() == C_ERR) {
-        close(server.aof_fd);
+        aofDiscardTempIncr();
+        server.aof_state = AOF_OFF;
         serverLog(LL_WARNING,"Redis needs to enable the AOF but can't trigger a background AOF rewrite operation. Check the above logs for more info about the error.");
         return C_ERR;
     }
-    /* We correctly switched on AOF, now wait for the rewrite to be complete
-     * in order to append data on disk. */
-    server.aof_state = AOF_WAIT_REWRITE;
     return C_OK;
 }
 
@@ -332,7 +549,7 @@ void flushAppendOnlyFile(int force) {
      * useful for graphing / monitoring purposes. */
     if (sync_in_progress) {
         latencyAddSampleIfNeeded("aof-write-pending-fsync",latency);
-    } else if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) {
+    } else if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) {
         latencyAddSampleIfNeeded("aof-write-active-child",latency);
     } else {
         latencyAddSampleIfNeeded("aof-write-alone",latency);
@@ -368,7 +585,7 @@ void flushAppendOnlyFile(int force) {
                                        (long long)sdslen(server.aof_buf));
             }
 
-            if (ftruncate(server.aof_fd, server.aof_current_size) == -1) {
+            if (ftruncate(server.aof_fd, server.aof_last_incr_size) == -1) {
                 if (can_log) {
                     serverLog(LL_WARNING, "Could not remove short write "
                              "from the append-only file.  Redis may refuse "
@@ -401,6 +618,7 @@ void flushAppendOnlyFile(int force) {
              * was no way to undo it with ftruncate(2). */
             if (nwritten > 0) {
                 server.aof_current_size += nwritten;
+                server.aof_last_incr_size += nwritten;
                 sdsrange(server.aof_buf,nwritten,-1);
             }
             return; /* We'll try again on the next call... */
@@ -415,6 +633,7 @@ void flushAppendOnlyFile(int force) {
         }
     }
     server.aof_current_size += nwritten;
+    server.aof_last_incr_size += nwritten;
 
     /* Re-use AOF buffer when it is small enough. The maximum comes from the
      * arena size of 4k minus some overhead (but is otherwise arbitrary). */
@@ -428,7 +647,7 @@ void flushAppendOnlyFile(int force) {
     /* Don't fsync if no-appendfsync-on-rewrite is set to yes and there are
      * children doing I/O in the background. */
     if (server.aof_no_fsync_on_rewrite &&
-        (server.aof_child_pid != -1 || server.rdb_child_pid != -1))
+        (server.aof_child_pid != -1 || rdbBgsaveInProgress()))
             return;
 
     /* Perform the fsync if needed. */
@@ -561,17 +780,14 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
 
     /* Append to the AOF buffer. This will be flushed on disk just before
      * of re-entering the event loop, so before the client will get a
-     * positive reply about the operation performed. */
-    if (server.aof_state == AOF_ON)
+     * positive reply about the operation performed.
+     *
+     * While the AOF is being turned on the commands are appended to the
+     * temp INCR file that will follow the base the child is writing. */
+    if (server.aof_state == AOF_ON ||
+        (server.aof_state == AOF_WAIT_REWRITE && server.aof_child_pid != -1))
         server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
 
-    /* If a background append only file rewriting is in progress we want to
-     * accumulate the differences between the child DB and the current one
-     * in a buffer, so that when the child process will do its work we
-     * can append the differences to the new append only file. */
-    if (server.aof_child_pid != -1)
-        aofRewriteBufferAppend((unsigned char*)buf,sdslen(buf));
-
     sdsfree(buf);
 }
 
@@ -624,34 +840,48 @@ void freeFakeClient(struct client *c) {
     zfree(c);
 }
 
-/* Replay the append log file. On success C_OK is returned. On non fatal
- * error (the append only file is zero-length) C_ERR is returned. On
+/* Replay a file of the AOF. 'loaded' is the amount of bytes of the AOF
+ * loaded before this file, used to report the loading progress. The file
+ * may be truncated only if 'can_truncate' is true, that is, if it is the
+ * last file of the AOF with some data. On success C_OK is returned. On
  * fatal error an error message is logged and the program exists. */
-int loadAppendOnlyFile(char *filename) {
+static int loadAppendOnlyFile(char *filename, off_t loaded, int can_truncate) {
     struct client *fakeClient;
     FILE *fp = fopen(filename,"r");
-    struct redis_stat sb;
-    int old_aof_state = server.aof_state;
     long loops = 0;
     off_t valid_up_to = 0; /* Offset of the latest well-formed command loaded. */
 
-    if (fp && redis_fstat(fileno(fp),&sb) != -1 && sb.st_size == 0) {
-        server.aof_current_size = 0;
-        fclose(fp);
-        return C_ERR;
-    }
-
     if (fp == NULL) {
-        serverLog(LL_WARNING,"Fatal error: can't open the append log file for reading: %s",strerror(errno));
+        serverLog(LL_WARNING,"Fatal error: can't open the append log file %s for reading: %s",filename,strerror(errno));
         exit(1);
     }
 
-    /* Temporarily disable AOF, to prevent EXEC from feeding a MULTI
-     * to the same file we're about to read. */
-    server.aof_state = AOF_OFF;
-
     fakeClient = createFakeClient();
-    startLoading(fp);
+
+    /* Check if this AOF file starts with the "REDIS" signature: in that
+     * case the dataset is stored in the RDB format as a preamble, followed
+     * by the commands of the AOF tail, if any. */
+    {
+        char sig[5];
+        if (fread(sig,sizeof(sig),1,fp) == 1 &&
+            memcmp(sig,"REDIS",sizeof(sig)) == 0)
+        {
+            rio rdb;
+
+            serverLog(LL_NOTICE,"Reading RDB preamble from AOF file %s...",
+                filename);
+            if (fseek(fp,0,SEEK_SET) == -1) goto readerr;
+            rioInitWithFile(&rdb,fp);
+            if (rdbLoadRio(&rdb,server.db,RDB_LOAD_AOF) != C_OK) {
+                serverLog(LL_WARNING,"Error reading the RDB preamble of the AOF file %s, AOF loading aborted", filename);
+                exit(1);
+            }
+            serverLog(LL_NOTICE,"Reading the remaining AOF tail...");
+            valid_up_to = ftello(fp);
+        } else {
+            if (fseek(fp,0,SEEK_SET) == -1) goto readerr;
+        }
+    }
 
     while(1) {
         int argc, j;
@@ -663,7 +893,7 @@ int loadAppendOnlyFile(char *filename) {
 
         /* Serve the clients from time to time */
         if (!(loops++ % 1000)) {
-            loadingProgress(ftello(fp));
+            loadingProgress(loaded+ftello(fp));
             processEventsWhileBlocked();
         }
 
@@ -708,7 +938,7 @@ int loadAppendOnlyFile(char *filename) {
         /* Command lookup */
         cmd = lookupCommand(argv[0]->ptr);
         if (!cmd) {
-            serverLog(LL_WARNING,"Unknown command '%s' reading the append only file", (char*)argv[0]->ptr);
+            serverLog(LL_WARNING,"Unknown command '%s' reading the append only file %s", (char*)argv[0]->ptr, filename);
             exit(1);
         }
 
@@ -723,7 +953,8 @@ int loadAppendOnlyFile(char *filename) {
         /* Clean up. Command code may have changed argv/argc so we use the
          * argv/argc of the client instead of the local variables. */
         freeFakeClientArgv(fakeClient);
-        if (server.aof_load_truncated) valid_up_to = ftello(fp);
+        if (server.aof_load_truncated && can_truncate)
+            valid_up_to = ftello(fp);
     }
 
     /* This point can only be reached when EOF is reached without errors.
@@ -733,30 +964,26 @@ int loadAppendOnlyFile(char *filename) {
 loaded_ok: /* DB loaded, cleanup and return C_OK to the caller. */
     fclose(fp);
     freeFakeClient(fakeClient);
-    server.aof_state = old_aof_state;
-    stopLoading();
-    aofUpdateCurrentSize();
-    server.aof_rewrite_base_size = server.aof_current_size;
     return C_OK;
 
 readerr: /* Read error. If feof(fp) is true, fall through to unexpected EOF. */
     if (!feof(fp)) {
         if (fakeClient) freeFakeClient(fakeClient); /* avoid valgrind warning */
-        serverLog(LL_WARNING,"Unrecoverable error reading the append only file: %s", strerror(errno));
+        serverLog(LL_WARNING,"Unrecoverable error reading the append only file %s: %s", filename, strerror(errno));
         exit(1);
     }
 
 uxeof: /* Unexpected AOF end of file. */
-    if (server.aof_load_truncated) {
-        serverLog(LL_WARNING,"!!! Warning: short read while loading the AOF file !!!");
-        serverLog(LL_WARNING,"!!! Truncating the AOF at offset %llu !!!",
-            (unsigned long long) valid_up_to);
+    if (server.aof_load_truncated && can_truncate) {
+        serverLog(LL_WARNING,"!!! Warning: short read while loading the AOF file %s !!!",filename);
+        serverLog(LL_WARNING,"!!! Truncating the AOF file %s at offset %llu !!!",
+            filename,(unsigned long long) valid_up_to);
         if (valid_up_to == -1 || truncate(filename,valid_up_to) == -1) {
             if (valid_up_to == -1) {
                 serverLog(LL_WARNING,"Last valid command offset is invalid");
             } else {
-                serverLog(LL_WARNING,"Error truncating the AOF file: %s",
-                    strerror(errno));
+                serverLog(LL_WARNING,"Error truncating the AOF file %s: %s",
+                    filename,strerror(errno));
             }
         } else {
             /* Make sure the AOF file descriptor points to the end of the
@@ -772,15 +999,76 @@ uxeof: /* Unexpected AOF end of file. */
         }
     }
     if (fakeClient) freeFakeClient(fakeClient); /* avoid valgrind warning */
-    serverLog(LL_WARNING,"Unexpected end of file reading the append only file. You can: 1) Make a backup of your AOF file, then use ./redis-check-aof --fix <filename>. 2) Alternatively you can set the 'aof-load-truncated' configuration option to yes and restart the server.");
+    if (can_truncate) {
+        serverLog(LL_WARNING,"Unexpected end of file reading the append only file %s. You can: 1) Make a backup of your AOF files, then use ./redis-check-aof --fix %s. 2) Alternatively you can set the 'aof-load-truncated' configuration option to yes and restart the server.", filename, filename);
+    } else {
+        /* Only the last file of the AOF may be truncated: the following
+         * files would be replayed on top of a partial dataset. */
+        serverLog(LL_WARNING,"Unexpected end of file reading the append only file %s, that is not the last file of the AOF: make a backup of your AOF files, then use ./redis-check-aof %s to find the corrupted part.", filename, filename);
+    }
     exit(1);
 
 fmterr: /* Format error. */
     if (fakeClient) freeFakeClient(fakeClient); /* avoid valgrind warning */
-    serverLog(LL_WARNING,"Bad file format reading the append only file: make a backup of your AOF file, then use ./redis-check-aof --fix <filename>");
+    serverLog(LL_WARNING,"Bad file format reading the append only file %s: make a backup of your AOF files, then use ./redis-check-aof --fix %s", filename, filename);
     exit(1);
 }
 
+/* Replay the files of the AOF listed in the manifest 'am', in order. On
+ * success C_OK is returned. On non fatal error (all the files are
+ * zero-length, or there are none) C_ERR is returned. On fatal error an
+ * error message is logged and the program exists. */
+int loadAppendOnlyFiles(aofManifest *am) {
+    list *files = listCreate();
+    int old_aof_state = server.aof_state;
+    aofInfo *last = NULL;
+    off_t total = 0, loaded = 0;
+    struct redis_stat sb;
+    listNode *ln;
+    listIter li;
+
+    aofManifestFiles(am,files);
+    listRewind(files,&li);
+    while((ln = listNext(&li)) != NULL) {
+        aofInfo *ai = listNodeValue(ln);
+
+        if (redis_stat(ai->name,&sb) == -1) {
+            serverLog(LL_WARNING,"Fatal error: can't open the append log file %s for reading: %s",ai->name,strerror(errno));
+            exit(1);
+        }
+        if (sb.st_size == 0) continue;
+        total += sb.st_size;
+        last = ai;
+    }
+    if (total == 0) {
+        listRelease(files);
+        aofUpdateCurrentSize();
+        server.aof_rewrite_base_size = server.aof_current_size;
+        return C_ERR;
+    }
+
+    /* Temporarily disable AOF, to prevent EXEC from feeding a MULTI
+     * to the same file we're about to read. */
+    server.aof_state = AOF_OFF;
+    startLoadingSize(total);
+
+    listRewind(files,&li);
+    while((ln = listNext(&li)) != NULL) {
+        aofInfo *ai = listNodeValue(ln);
+
+        if (redis_stat(ai->name,&sb) == -1 || sb.st_size == 0) continue;
+        loadAppendOnlyFile(ai->name,loaded,ai == last);
+        loaded += sb.st_size;
+    }
+
+    listRelease(files);
+    server.aof_state = old_aof_state;
+    stopLoading();
+    aofUpdateCurrentSize();
+    server.aof_rewrite_base_size = server.aof_current_size;
+    return C_OK;
+}
+
 /* ----------------------------------------------------------------------------
  * AOF rewrite
  * ------------------------------------------------------------------------- */
@@ -794,11 +1082,41 @@ int rioWriteBulkObject(rio *r, robj *obj) {
         return rioWriteBulkLongLong(r,(long)obj->ptr);
     } else if (sdsEncodedObject(obj)) {
         return rioWriteBulkString(r,obj->ptr,sdslen(obj->ptr));
+    } else if (obj->encoding == OBJ_ENCODING_LZF ||
+               obj->encoding == OBJ_ENCODING_ROARING)
+    {
+        size_t written;
+
+        obj = getDecodedObject(obj);
+        written = rioWriteBulkString(r,obj->ptr,sdslen(obj->ptr));
+        decrRefCount(obj);
+        return written;
     } else {
         serverPanic("Unknown string encoding");
     }
 }
 
+/* Emit the commands needed to rebuild a string stored as a roaring bitmap:
+ * a first SETBIT creates the string with the right length, then every bit
+ * set is restored with a SETBIT, so that the string is never materialized.
+ * The function returns 0 on error, 1 on success. */
+int rewriteRoaringStringObject(rio *r, robj *key, robj *o) {
+    roaring *rb = o->ptr;
+    int64_t bit = rb->len*8-1;
+    int value = 0;
+
+    while (bit != -1) {
+        char cmd[]="*4\r\n$6\r\nSETBIT\r\n";
+        if (rioWrite(r,cmd,sizeof(cmd)-1) == 0) return 0;
+        if (rioWriteBulkObject(r,key) == 0) return 0;
+        if (rioWriteBulkLongLong(r,bit) == 0) return 0;
+        if (rioWriteBulkLongLong(r,value) == 0) return 0;
+        bit = roaringFirst(rb,1,value ? bit+1 : 0,rb->len*8-1);
+        value = 1;
+    }
+    return 1;
+}
+
 /* Emit the commands needed to rebuild a list object.
  * The function returns 0 on error, 1 on success. */
 int rewriteListObject(rio *r, robj *key, robj *o) {
@@ -943,6 +1261,26 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
             items--;
         }
         dictReleaseIterator(di);
+    } else if (o->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = o->ptr;
+        zbtreeCursor cur;
+
+        zbtFirst(zs->zbt,&cur);
+        while(cur.leaf) {
+            if (count == 0) {
+                int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
+                    AOF_REWRITE_ITEMS_PER_CMD : items;
+
+                if (rioWriteBulkCount(r,'*',2+cmd_items*2) == 0) return 0;
+                if (rioWriteBulkString(r,"ZADD",4) == 0) return 0;
+                if (rioWriteBulkObject(r,key) == 0) return 0;
+            }
+            if (rioWriteBulkDouble(r,zbtCursorScore(&cur)) == 0) return 0;
+            if (rioWriteBulkObject(r,zbtCursorObj(&cur)) == 0) return 0;
+            if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+            items--;
+            zbtNext(&cur);
+        }
     } else {
         serverPanic("Unknown sorted zset encoding");
     }
@@ -1007,71 +1345,233 @@ int rewriteHashObject(rio *r, robj *key, robj *o) {
     return 1;
 }
 
-/* This function is called by the child rewriting the AOF file to read
- * the difference accumulated from the parent into a buffer, that is
- * concatenated at the end of the rewrite. */
-ssize_t aofReadDiffFromParent(void) {
-    char buf[65536]; /* Default pipe buffer size on most Linux systems. */
-    ssize_t nread, total = 0;
-
-    while ((nread =
-            read(server.aof_pipe_read_data_from_parent,buf,sizeof(buf))) > 0) {
-        server.aof_child_diff = sdscatlen(server.aof_child_diff,buf,nread);
-        total += nread;
+/* Emit an HPEXPIREAT for every volatile field of the hash at 'key'.
+ * The function returns 0 on error, 1 on success. */
+int rewriteHashFieldExpires(rio *r, robj *key, hashFieldExpires *hfe) {
+    dictIterator *di = dictGetIterator(hfe->fields);
+    dictEntry *de;
+
+    while((de = dictNext(di)) != NULL) {
+        sds field = dictGetKey(de);
+
+        if (rioWriteBulkCount(r,'*',6) == 0 ||
+            rioWriteBulkString(r,"HPEXPIREAT",10) == 0 ||
+            rioWriteBulkObject(r,key) == 0 ||
+            rioWriteBulkLongLong(r,dictGetSignedIntegerVal(de)) == 0 ||
+            rioWriteBulkString(r,"FIELDS",6) == 0 ||
+            rioWriteBulkLongLong(r,1) == 0 ||
+            rioWriteBulkString(r,field,sdslen(field)) == 0)
+        {
+            dictReleaseIterator(di);
+            return 0;
+        }
+    }
+    dictReleaseIterator(di);
+    return 1;
+}
+
+/* Emit a stream ID as a bulk string in the <ms>-<seq> form.
+ * The function returns 0 on error, non-zero on success. */
+static int rioWriteBulkStreamID(rio *r, streamID *id) {
+    int retval;
+
+    sds replyid = sdscatfmt(sdsempty(),"%U-%U",id->ms,id->seq);
+    retval = rioWriteBulkString(r,replyid,sdslen(replyid));
+    sdsfree(replyid);
+    return retval;
+}
+
+/* Emit the XCLAIM needed to recreate a pending entry of a consumer group,
+ * assigned to its consumer with the same delivery time and count.
+ * The function returns 0 on error, non-zero on success. */
+static int rioWriteStreamPendingEntry(rio *r, robj *key, const char *groupname, size_t groupname_len, streamConsumer *consumer, unsigned char *rawid, streamNACK *nack) {
+    /* XCLAIM <key> <group> <consumer> 0 <id> TIME <milliseconds-unix-time>
+     *        RETRYCOUNT <count> JUSTID FORCE. */
+    streamID id;
+    streamDecodeID(rawid,&id);
+    if (rioWriteBulkCount(r,'*',12) == 0) return 0;
+    if (rioWriteBulkString(r,"XCLAIM",6) == 0) return 0;
+    if (rioWriteBulkObject(r,key) == 0) return 0;
+    if (rioWriteBulkString(r,groupname,groupname_len) == 0) return 0;
+    if (rioWriteBulkString(r,consumer->name,sdslen(consumer->name)) == 0) return 0;
+    if (rioWriteBulkString(r,"0",1) == 0) return 0;
+    if (rioWriteBulkStreamID(r,&id) == 0) return 0;
+    if (rioWriteBulkString(r,"TIME",4) == 0) return 0;
+    if (rioWriteBulkLongLong(r,nack->delivery_time) == 0) return 0;
+    if (rioWriteBulkString(r,"RETRYCOUNT",10) == 0) return 0;
+    if (rioWriteBulkLongLong(r,nack->delivery_count) == 0) return 0;
+    if (rioWriteBulkString(r,"JUSTID",6) == 0) return 0;
+    if (rioWriteBulkString(r,"FORCE",5) == 0) return 0;
+    return 1;
+}
+
+/* Emit the commands needed to rebuild a stream object: an XADD for every
+ * entry, XSETID to restore the last ID, and XGROUP CREATE plus an XCLAIM
+ * for every pending entry of the consumer groups.
+ * The function returns 0 on error, 1 on success. */
+int rewriteStreamObject(rio *r, robj *key, robj *o) {
+    stream *s = o->ptr;
+    streamIterator si;
+    streamID id;
+    int64_t numfields;
+
+    streamIteratorStart(&si,s,NULL,NULL,0);
+    if (s->length) {
+        /* Reconstruct the stream data using XADD commands. */
+        while(streamIteratorGetID(&si,&id,&numfields)) {
+            /* Emit a two elements array for each item. The first is
+             * the ID, the second is an array of field-value pairs. */
+
+            /* Emit the XADD <key> <id> ...fields... command. */
+            if (rioWriteBulkCount(r,'*',3+numfields*2) == 0 ||
+                rioWriteBulkString(r,"XADD",4) == 0 ||
+                rioWriteBulkObject(r,key) == 0 ||
+                rioWriteBulkStreamID(r,&id) == 0)
+            {
+                streamIteratorStop(&si);
+                return 0;
+            }
+            while(numfields--) {
+                unsigned char *field, *value;
+                int64_t field_len, value_len;
+                streamIteratorGetField(&si,&field,&value,&field_len,&value_len);
+                if (rioWriteBulkString(r,(char*)field,field_len) == 0 ||
+                    rioWriteBulkString(r,(char*)value,value_len) == 0)
+                {
+                    streamIteratorStop(&si);
+                    return 0;
+                }
+            }
+        }
+    } else {
+        /* Use the XADD MAXLEN 0 trick to generate an empty stream if
+         * the key we are serializing is an empty string, which is possible
+         * for the Stream type. The ID must be greater than 0-0. */
+        id = s->last_id;
+        if (id.ms == 0 && id.seq == 0) id.seq = 1;
+        if (rioWriteBulkCount(r,'*',7) == 0 ||
+            rioWriteBulkString(r,"XADD",4) == 0 ||
+            rioWriteBulkObject(r,key) == 0 ||
+            rioWriteBulkString(r,"MAXLEN",6) == 0 ||
+            rioWriteBulkString(r,"0",1) == 0 ||
+            rioWriteBulkStreamID(r,&id) == 0 ||
+            rioWriteBulkString(r,"x",1) == 0 ||
+            rioWriteBulkString(r,"y",1) == 0)
+        {
+            streamIteratorStop(&si);
+            return 0;
+        }
+    }
+    streamIteratorStop(&si);
+
+    /* Append XSETID after XADD, make sure lastid is correct,
+     * in case of XDEL lastid. */
+    if (rioWriteBulkCount(r,'*',3) == 0 ||
+        rioWriteBulkString(r,"XSETID",6) == 0 ||
+        rioWriteBulkObject(r,key) == 0 ||
+        rioWriteBulkStreamID(r,&s->last_id) == 0) return 0;
+
+    /* Create all the stream consumer groups. */
+    if (s->cgroups) {
+        raxIterator ri;
+        raxStart(&ri,s->cgroups);
+        raxSeek(&ri,"^",NULL,0);
+        while(raxNext(&ri)) {
+            streamCG *group = ri.data;
+            /* Emit the XGROUP CREATE in order to create the group. */
+            if (rioWriteBulkCount(r,'*',5) == 0 ||
+                rioWriteBulkString(r,"XGROUP",6) == 0 ||
+                rioWriteBulkString(r,"CREATE",6) == 0 ||
+                rioWriteBulkObject(r,key) == 0 ||
+                rioWriteBulkString(r,(char*)ri.key,ri.key_len) == 0 ||
+                rioWriteBulkStreamID(r,&group->last_id) == 0)
+            {
+                raxStop(&ri);
+                return 0;
+            }
+
+            /* Generate XCLAIMs for each consumer that happens to
+             * have pending entries. Empty consumers have no semantical
+             * value so they are discarded. */
+            raxIterator ri_cons;
+            raxStart(&ri_cons,group->consumers);
+            raxSeek(&ri_cons,"^",NULL,0);
+            while(raxNext(&ri_cons)) {
+                streamConsumer *consumer = ri_cons.data;
+                /* For the current consumer, iterate all the PEL entries
+                 * to emit the XCLAIM protocol. */
+                raxIterator ri_pel;
+                raxStart(&ri_pel,consumer->pel);
+                raxSeek(&ri_pel,"^",NULL,0);
+                while(raxNext(&ri_pel)) {
+                    streamNACK *nack = ri_pel.data;
+                    if (rioWriteStreamPendingEntry(r,key,(char*)ri.key,
+                                                   ri.key_len,consumer,
+                                                   ri_pel.key,nack) == 0)
+                    {
+                        raxStop(&ri_pel);
+                        raxStop(&ri_cons);
+                        raxStop(&ri);
+                        return 0;
+                    }
+                }
+                raxStop(&ri_pel);
+            }
+            raxStop(&ri_cons);
+        }
+        raxStop(&ri);
     }
-    return total;
+    return 1;
+}
+
+/* Emit a RESTORE command to rebuild a filter or a sketch: they don't
+ * remember the items that were added, so the only way to rebuild them is
+ * from their serialized form, that is the DUMP payload.
+ * The function returns 0 on error, 1 on success. */
+int rewriteBlobObject(rio *r, robj *key, robj *o) {
+    rio payload;
+    int retval;
+
+    createDumpPayload(&payload,o);
+    retval = rioWriteBulkCount(r,'*',4) &&
+             rioWriteBulkString(r,"RESTORE",7) &&
+             rioWriteBulkObject(r,key) &&
+             rioWriteBulkLongLong(r,0) &&
+             rioWriteBulkString(r,payload.io.buffer.ptr,
+                                sdslen(payload.io.buffer.ptr));
+    sdsfree(payload.io.buffer.ptr);
+    return retval;
 }
 
 /* Write a sequence of commands able to fully rebuild the dataset into
- * "filename". Used both by REWRITEAOF and BGREWRITEAOF.
- *
- * In order to minimize the number of commands needed in the rewritten
- * log Redis uses variadic commands when possible, such as RPUSH, SADD
- * and ZADD. However at max AOF_REWRITE_ITEMS_PER_CMD items per time
- * are inserted using a single command. */
-int rewriteAppendOnlyFile(char *filename) {
+ * the rio stream 'aof'. In order to minimize the number of commands needed
+ * in the rewritten log Redis uses variadic commands when possible, such as
+ * RPUSH, SADD and ZADD. However at max AOF_REWRITE_ITEMS_PER_CMD items per
+ * time are inserted using a single command. */
+int rewriteAppendOnlyFileRio(rio *aof) {
     dictIterator *di = NULL;
     dictEntry *de;
-    rio aof;
-    FILE *fp;
-    char tmpfile[256];
     int j;
     long long now = mstime();
-    char byte;
-    size_t processed = 0;
+    long long keys = 0;
 
-    /* Note that we have to use a different temp name here compared to the
-     * one used by rewriteAppendOnlyFileBackground() function. */
-    snprintf(tmpfile,256,"temp-rewriteaof-%d.aof", (int) getpid());
-    fp = fopen(tmpfile,"w");
-    if (!fp) {
-        serverLog(LL_WARNING, "Opening the temp file for AOF rewrite in rewriteAppendOnlyFile(): %s", strerror(errno));
-        return C_ERR;
-    }
-
-    server.aof_child_diff = sdsempty();
-    rioInitWithFile(&aof,fp);
-    if (server.aof_rewrite_incremental_fsync)
-        rioSetAutoSync(&aof,AOF_AUTOSYNC_BYTES);
     for (j = 0; j < server.dbnum; j++) {
         char selectcmd[] = "*2\r\n$6\r\nSELECT\r\n";
         redisDb *db = server.db+j;
         dict *d = db->dict;
         if (dictSize(d) == 0) continue;
         di = dictGetSafeIterator(d);
-        if (!di) {
-            fclose(fp);
-            return C_ERR;
-        }
+        if (!di) return C_ERR;
 
         /* SELECT the new DB */
-        if (rioWrite(&aof,selectcmd,sizeof(selectcmd)-1) == 0) goto werr;
-        if (rioWriteBulkLongLong(&aof,j) == 0) goto werr;
+        if (rioWrite(aof,selectcmd,sizeof(selectcmd)-1) == 0) goto werr;
+        if (rioWriteBulkLongLong(aof,j) == 0) goto werr;
 
         /* Iterate this DB writing every entry */
         while((de = dictNext(di)) != NULL) {
             sds keystr;
             robj key, *o;
+            hashFieldExpires *hfe;
             long long expiretime;
 
             keystr = dictGetKey(de);
@@ -1084,85 +1584,92 @@ int rewriteAppendOnlyFile(char *filename) {
             if (expiretime != -1 && expiretime < now) continue;
 
             /* Save the key and associated value */
-            if (o->type == OBJ_STRING) {
+            if (o->type == OBJ_STRING &&
+                o->encoding == OBJ_ENCODING_ROARING)
+            {
+                if (rewriteRoaringStringObject(aof,&key,o) == 0) goto werr;
+            } else if (o->type == OBJ_STRING) {
                 /* Emit a SET command */
                 char cmd[]="*3\r\n$3\r\nSET\r\n";
-                if (rioWrite(&aof,cmd,sizeof(cmd)-1) == 0) goto werr;
+                if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) goto werr;
                 /* Key and value */
-                if (rioWriteBulkObject(&aof,&key) == 0) goto werr;
-                if (rioWriteBulkObject(&aof,o) == 0) goto werr;
+                if (rioWriteBulkObject(aof,&key) == 0) goto werr;
+                if (rioWriteBulkObject(aof,o) == 0) goto werr;
             } else if (o->type == OBJ_LIST) {
-                if (rewriteListObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteListObject(aof,&key,o) == 0) goto werr;
             } else if (o->type == OBJ_SET) {
-                if (rewriteSetObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteSetObject(aof,&key,o) == 0) goto werr;
             } else if (o->type == OBJ_ZSET) {
-                if (rewriteSortedSetObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteSortedSetObject(aof,&key,o) == 0) goto werr;
             } else if (o->type == OBJ_HASH) {
-                if (rewriteHashObject(&aof,&key,o) == 0) goto werr;
+                if (rewriteHashObject(aof,&key,o) == 0) goto werr;
+            } else if (o->type == OBJ_STREAM) {
+                if (rewriteStreamObject(aof,&key,o) == 0) goto werr;
+            } else if (OBJ_TYPE_IS_BLOB(o->type)) {
+                if (rewriteBlobObject(aof,&key,o) == 0) goto werr;
             } else {
                 serverPanic("Unknown object type");
             }
             /* Save the expire time */
             if (expiretime != -1) {
                 char cmd[]="*3\r\n$9\r\nPEXPIREAT\r\n";
-                if (rioWrite(&aof,cmd,sizeof(cmd)-1) == 0) goto werr;
-                if (rioWriteBulkObject(&aof,&key) == 0) goto werr;
-                if (rioWriteBulkLongLong(&aof,expiretime) == 0) goto werr;
+                if (rioWrite(aof,cmd,sizeof(cmd)-1) == 0) goto werr;
+                if (rioWriteBulkObject(aof,&key) == 0) goto werr;
+                if (rioWriteBulkLongLong(aof,expiretime) == 0) goto werr;
             }
-            /* Read some diff from the parent process from time to time. */
-            if (aof.processed_bytes > processed+1024*10) {
-                processed = aof.processed_bytes;
-                aofReadDiffFromParent();
+            /* Save the expire times of the hash fields */
+            if (o->type == OBJ_HASH &&
+                (hfe = hashGetFieldExpires(db,&key)) != NULL)
+            {
+                if (rewriteHashFieldExpires(aof,&key,hfe) == 0) goto werr;
             }
+            /* Report the progress to the parent. */
+            if ((++keys & 1023) == 0)
+                childInfoUpdate(keys,aof->processed_bytes);
         }
         dictReleaseIterator(di);
         di = NULL;
     }
+    childInfoUpdate(keys,aof->processed_bytes);
+    return C_OK;
 
-    /* Do an initial slow fsync here while the parent is still sending
-     * data, in order to make the next final fsync faster. */
-    if (fflush(fp) == EOF) goto werr;
-    if (fsync(fileno(fp)) == -1) goto werr;
+werr:
+    if (di) dictReleaseIterator(di);
+    return C_ERR;
+}
 
-    /* Read again a few times to get more data from the parent.
-     * We can't read forever (the server may receive data from clients
-     * faster than it is able to send data to the child), so we try to read
-     * some more data in a loop as soon as there is a good chance more data
-     * will come. If it looks like we are wasting time, we abort (this
-     * happens after 20 ms without new data). */
-    int nodata = 0;
-    mstime_t start = mstime();
-    while(mstime()-start < 1000 && nodata < 20) {
-        if (aeWait(server.aof_pipe_read_data_from_parent, AE_READABLE, 1) <= 0)
-        {
-            nodata++;
-            continue;
-        }
-        nodata = 0; /* Start counting from zero, we stop on N *contiguous*
-                       timeouts. */
-        aofReadDiffFromParent();
+/* Rewrite the append only file into "filename". Used both by REWRITEAOF and
+ * BGREWRITEAOF. When aof-use-rdb-preamble is enabled the dataset is written
+ * in the RDB format, that is both faster to produce and to load, otherwise
+ * as a sequence of commands (see rewriteAppendOnlyFileRio()). */
+int rewriteAppendOnlyFile(char *filename) {
+    rio aof;
+    FILE *fp;
+    char tmpfile[256];
+
+    /* Note that we have to use a different temp name here compared to the
+     * one used by rewriteAppendOnlyFileBackground() function. */
+    snprintf(tmpfile,256,"temp-rewriteaof-%d.aof", (int) getpid());
+    fp = fopen(tmpfile,"w");
+    if (!fp) {
+        serverLog(LL_WARNING, "Opening the temp file for AOF rewrite in rewriteAppendOnlyFile(): %s", strerror(errno));
+        return C_ERR;
     }
 
-    /* Ask the master to stop sending diffs. */
-    if (write(server.aof_pipe_write_ack_to_parent,"!",1) != 1) goto werr;
-    if (anetNonBlock(NULL,server.aof_pipe_read_ack_from_parent) != ANET_OK)
-        goto werr;
-    /* We read the ACK from the server using a 10 seconds timeout. Normally
-     * it should reply ASAP, but just in case we lose its reply, we are sure
-     * the child will eventually get terminated. */
-    if (syncRead(server.aof_pipe_read_ack_from_parent,&byte,1,5000) != 1 ||
-        byte != '!') goto werr;
-    serverLog(LL_NOTICE,"Parent agreed to stop sending diffs. Finalizing AOF...");
-
-    /* Read the final diff if any. */
-    aofReadDiffFromParent();
-
-    /* Write the received diff to the file. */
-    serverLog(LL_NOTICE,
-        "Concatenating %.2f MB of AOF diff received from parent.",
-        (double) sdslen(server.aof_child_diff) / (1024*1024));
-    if (rioWrite(&aof,server.aof_child_diff,sdslen(server.aof_child_diff)) == 0)
-        goto werr;
+    rioInitWithFile(&aof,fp);
+    if (server.aof_rewrite_incremental_fsync)
+        rioSetAutoSync(&aof,AOF_AUTOSYNC_BYTES);
+    if (server.in_fork_child && server.child_max_write_rate)
+        rioSetRateLimit(&aof,server.child_max_write_rate);
+    if (server.aof_use_rdb_preamble) {
+        int error;
+        if (rdbSaveRio(&aof,&error,RDB_SAVE_AOF_PREAMBLE) == C_ERR) {
+            errno = error;
+            goto werr;
+        }
+    } else {
+        if (rewriteAppendOnlyFileRio(&aof) == C_ERR) goto werr;
+    }
 
     /* Make sure data will not remain on the OS's output buffers */
     if (fflush(fp) == EOF) goto werr;
@@ -1183,84 +1690,9 @@ werr:
     serverLog(LL_WARNING,"Write error writing append only file on disk: %s", strerror(errno));
     fclose(fp);
     unlink(tmpfile);
-    if (di) dictReleaseIterator(di);
-    return C_ERR;
-}
-
-/* ----------------------------------------------------------------------------
- * AOF rewrite pipes for IPC
- * -------------------------------------------------------------------------- */
-
-/* This event handler is called when the AOF rewriting child sends us a
- * single '!' char to signal we should stop sending buffer diffs. The
- * parent sends a '!' as well to acknowledge. */
-void aofChildPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask) {
-    char byte;
-    UNUSED(el);
-    UNUSED(privdata);
-    UNUSED(mask);
-
-    if (read(fd,&byte,1) == 1 && byte == '!') {
-        serverLog(LL_NOTICE,"AOF rewrite child asks to stop sending diffs.");
-        server.aof_stop_sending_diff = 1;
-        if (write(server.aof_pipe_write_ack_to_child,"!",1) != 1) {
-            /* If we can't send the ack, inform the user, but don't try again
-             * since in the other side the children will use a timeout if the
-             * kernel can't buffer our write, or, the children was
-             * terminated. */
-            serverLog(LL_WARNING,"Can't send ACK to AOF child: %s",
-                strerror(errno));
-        }
-    }
-    /* Remove the handler since this can be called only one time during a
-     * rewrite. */
-    aeDeleteFileEvent(server.el,server.aof_pipe_read_ack_from_child,AE_READABLE);
-}
-
-/* Create the pipes used for parent - child process IPC during rewrite.
- * We have a data pipe used to send AOF incremental diffs to the child,
- * and two other pipes used by the children to signal it finished with
- * the rewrite so no more data should be written, and another for the
- * parent to acknowledge it understood this new condition. */
-int aofCreatePipes(void) {
-    int fds[6] = {-1, -1, -1, -1, -1, -1};
-    int j;
-
-    if (pipe(fds) == -1) goto error; /* parent -> children data. */
-    if (pipe(fds+2) == -1) goto error; /* children -> parent ack. */
-    if (pipe(fds+4) == -1) goto error; /* children -> parent ack. */
-    /* Parent -> children data is non blocking. */
-    if (anetNonBlock(NULL,fds[0]) != ANET_OK) goto error;
-    if (anetNonBlock(NULL,fds[1]) != ANET_OK) goto error;
-    if (aeCreateFileEvent(server.el, fds[2], AE_READABLE, aofChildPipeReadable, NULL) == AE_ERR) goto error;
-
-    server.aof_pipe_write_data_to_child = fds[1];
-    server.aof_pipe_read_data_from_parent = fds[0];
-    server.aof_pipe_write_ack_to_parent = fds[3];
-    server.aof_pipe_read_ack_from_child = fds[2];
-    server.aof_pipe_write_ack_to_child = fds[5];
-    server.aof_pipe_read_ack_from_parent = fds[4];
-    server.aof_stop_sending_diff = 0;
-    return C_OK;
-
-error:
-    serverLog(LL_WARNING,"Error opening /setting AOF rewrite IPC pipes: %s",
-        strerror(errno));
-    for (j = 0; j < 6; j++) if(fds[j] != -1) close(fds[j]);
     return C_ERR;
 }
 
-void aofClosePipes(void) {
-    aeDeleteFileEvent(server.el,server.aof_pipe_read_ack_from_child,AE_READABLE);
-    aeDeleteFileEvent(server.el,server.aof_pipe_write_data_to_child,AE_WRITABLE);
-    close(server.aof_pipe_write_data_to_child);
-    close(server.aof_pipe_read_data_from_parent);
-    close(server.aof_pipe_write_ack_to_parent);
-    close(server.aof_pipe_read_ack_from_child);
-    close(server.aof_pipe_write_ack_to_child);
-    close(server.aof_pipe_read_ack_from_parent);
-}
-
 /* ----------------------------------------------------------------------------
  * AOF background rewrite
  * ------------------------------------------------------------------------- */
@@ -1268,31 +1700,36 @@ void aofClosePipes(void) {
 /* This is how rewriting of the append only file in background works:
  *
  * 1) The user calls BGREWRITEAOF
- * 2) Redis calls this function, that forks():
- *    2a) the child rewrite the append only file in a temp file.
- *    2b) the parent accumulates differences in server.aof_rewrite_buf.
+ * 2) Redis calls this function, that switches the AOF to a new INCR file
+ *    and forks():
+ *    2a) the child rewrites the dataset in a temp file.
+ *    2b) the parent appends the new commands to the new INCR file.
  * 3) When the child finished '2a' exists.
- * 4) The parent will trap the exit code, if it's OK, will append the
- *    data accumulated into server.aof_rewrite_buf into the temp file, and
- *    finally will rename(2) the temp file in the actual file name.
- *    The the new file is reopened as the new append only file. Profit!
+ * 4) The parent will trap the exit code, if it's OK, will rename(2) the
+ *    temp file into the new base file, and will write a new manifest
+ *    listing the new base followed by the INCR files created from step 2
+ *    on. The old base and INCR files are then deleted. Profit!
  */
 int rewriteAppendOnlyFileBackground(void) {
     pid_t childpid;
     long long start;
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
-    if (aofCreatePipes() != C_OK) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) return C_ERR;
+    if (aofOpenNewIncr() != C_OK) return C_ERR;
+    server.aof_rewrite_incr_seq = server.aof_manifest->incr_seq;
+    openChildInfoPipe(CHILD_INFO_TYPE_AOF);
     start = ustime();
     if ((childpid = fork()) == 0) {
         char tmpfile[256];
 
         /* Child */
+        server.in_fork_child = 1;
         closeListeningSockets(0);
         redisSetProcTitle("redis-aof-rewrite");
+        setChildIOClass();
         snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof", (int) getpid());
         if (rewriteAppendOnlyFile(tmpfile) == C_OK) {
-            size_t private_dirty = zmalloc_get_private_dirty();
+            size_t private_dirty = sendChildInfo(1);
 
             if (private_dirty) {
                 serverLog(LL_NOTICE,
@@ -1312,7 +1749,7 @@ int rewriteAppendOnlyFileBackground(void) {
             serverLog(LL_WARNING,
                 "Can't rewrite append only file in background: fork: %s",
                 strerror(errno));
-            aofClosePipes();
+            closeChildInfoPipe();
             return C_ERR;
         }
         serverLog(LL_NOTICE,
@@ -1321,11 +1758,6 @@ int rewriteAppendOnlyFileBackground(void) {
         server.aof_rewrite_time_start = time(NULL);
         server.aof_child_pid = childpid;
         updateDictResizePolicy();
-        /* We set appendseldb to -1 in order to force the next call to the
-         * feedAppendOnlyFile() to issue a SELECT command, so the differences
-         * accumulated by the parent into server.aof_rewrite_buf will start
-         * with a SELECT statement and it will be safe to merge. */
-        server.aof_selected_db = -1;
         replicationScriptCacheFlush();
         return C_OK;
     }
@@ -1335,7 +1767,7 @@ int rewriteAppendOnlyFileBackground(void) {
 void bgrewriteaofCommand(client *c) {
     if (server.aof_child_pid != -1) {
         addReplyError(c,"Background append only file rewriting already in progress");
-    } else if (server.rdb_child_pid != -1) {
+    } else if (rdbBgsaveInProgress() || aofInTransaction()) {
         server.aof_rewrite_scheduled = 1;
         addReplyStatus(c,"Background append only file rewriting scheduled");
     } else if (rewriteAppendOnlyFileBackground() == C_OK) {
@@ -1353,19 +1785,39 @@ void aofRemoveTempFile(pid_t childpid) {
 }
 
 /* Update the server.aof_current_size field explicitly using stat(2)
- * to check the size of the file. This is useful after a rewrite or after
- * a restart, normally the size is updated just adding the write length
- * to the current length, that is much faster. */
+ * to check the size of the files of the AOF. This is useful after a
+ * rewrite or after a restart, normally the size is updated just adding
+ * the write length to the current length, that is much faster. */
 void aofUpdateCurrentSize(void) {
+    list *files = listCreate();
     struct redis_stat sb;
+    off_t size = 0;
     mstime_t latency;
+    listNode *ln;
+    listIter li;
 
     latencyStartMonitor(latency);
-    if (redis_fstat(server.aof_fd,&sb) == -1) {
-        serverLog(LL_WARNING,"Unable to obtain the AOF file length. stat: %s",
-            strerror(errno));
-    } else {
-        server.aof_current_size = sb.st_size;
+    aofManifestFiles(server.aof_manifest,files);
+    listRewind(files,&li);
+    while((ln = listNext(&li)) != NULL) {
+        aofInfo *ai = listNodeValue(ln);
+
+        if (redis_stat(ai->name,&sb) == -1) {
+            serverLog(LL_WARNING,"Unable to obtain the length of the AOF "
+                "file %s. stat: %s", ai->name, strerror(errno));
+        } else {
+            size += sb.st_size;
+        }
+    }
+    listRelease(files);
+    server.aof_current_size = size;
+    if (server.aof_fd != -1) {
+        if (redis_fstat(server.aof_fd,&sb) == -1) {
+            serverLog(LL_WARNING,"Unable to obtain the AOF file length. "
+                "stat: %s", strerror(errno));
+        } else {
+            server.aof_last_incr_size = sb.st_size;
+        }
     }
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("aof-fstat",latency);
@@ -1375,115 +1827,93 @@ void aofUpdateCurrentSize(void) {
  * Handle this. */
 void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
     if (!bysignal && exitcode == 0) {
-        int newfd, oldfd;
+        aofManifest *am = server.aof_manifest, *newam;
         char tmpfile[256];
+        sds basefile, incrfile = NULL, tmpincr = NULL;
+        list *oldfiles = listCreate();
         long long now = ustime();
         mstime_t latency;
+        listNode *ln;
+        listIter li;
 
         serverLog(LL_NOTICE,
             "Background AOF rewrite terminated with success");
 
-        /* Flush the differences accumulated by the parent to the
-         * rewritten AOF. */
-        latencyStartMonitor(latency);
-        snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
-            (int)server.aof_child_pid);
-        newfd = open(tmpfile,O_WRONLY|O_APPEND);
-        if (newfd == -1) {
-            serverLog(LL_WARNING,
-                "Unable to open the temporary AOF produced by the child: %s", strerror(errno));
-            goto cleanup;
-        }
-
-        if (aofRewriteBufferWrite(newfd) == -1) {
-            serverLog(LL_WARNING,
-                "Error trying to flush the parent diff to the rewritten AOF: %s", strerror(errno));
-            close(newfd);
-            goto cleanup;
+        /* Build the new manifest: the new base, followed by the INCR files
+         * written from the fork on. With the AOF disabled there are none,
+         * and while the AOF is being turned on the temp INCR file gets its
+         * final name. */
+        newam = aofManifestDup(am);
+        newam->base_seq++;
+        basefile = aofBaseFilename(newam->base_seq);
+        if (newam->base) listAddNodeTail(oldfiles,newam->base);
+        newam->base = aofInfoCreate(sdsdup(basefile),newam->base_seq);
+        listRewind(newam->incr,&li);
+        while((ln = listNext(&li)) != NULL) {
+            aofInfo *ai = listNodeValue(ln);
+
+            if (server.aof_state == AOF_ON &&
+                ai->seq >= server.aof_rewrite_incr_seq) continue;
+            listAddNodeTail(oldfiles,aofInfoDup(ai));
+            listDelNode(newam->incr,ln);
         }
-        latencyEndMonitor(latency);
-        latencyAddSampleIfNeeded("aof-rewrite-diff-write",latency);
-
-        serverLog(LL_NOTICE,
-            "Residual parent diff successfully flushed to the rewritten AOF (%.2f MB)", (double) aofRewriteBufferSize() / (1024*1024));
-
-        /* The only remaining thing to do is to rename the temporary file to
-         * the configured file and switch the file descriptor used to do AOF
-         * writes. We don't want close(2) or rename(2) calls to block the
-         * server on old file deletion.
-         *
-         * There are two possible scenarios:
-         *
-         * 1) AOF is DISABLED and this was a one time rewrite. The temporary
-         * file will be renamed to the configured file. When this file already
-         * exists, it will be unlinked, which may block the server.
-         *
-         * 2) AOF is ENABLED and the rewritten AOF will immediately start
-         * receiving writes. After the temporary file is renamed to the
-         * configured file, the original AOF file descriptor will be closed.
-         * Since this will be the last reference to that file, closing it
-         * causes the underlying file to be unlinked, which may block the
-         * server.
-         *
-         * To mitigate the blocking effect of the unlink operation (either
-         * caused by rename(2) in scenario 1, or by close(2) in scenario 2), we
-         * use a background thread to take care of this. First, we
-         * make scenario 1 identical to scenario 2 by opening the target file
-         * when it exists. The unlink operation after the rename(2) will then
-         * be executed upon calling close(2) for its descriptor. Everything to
-         * guarantee atomicity for this switch has already happened by then, so
-         * we don't care what the outcome or duration of that close operation
-         * is, as long as the file descriptor is released again. */
-        if (server.aof_fd == -1) {
-            /* AOF disabled */
-
-             /* Don't care if this fails: oldfd will be -1 and we handle that.
-              * One notable case of -1 return is if the old file does
-              * not exist. */
-             oldfd = open(server.aof_filename,O_RDONLY|O_NONBLOCK);
-        } else {
-            /* AOF enabled */
-            oldfd = -1; /* We'll set this to the current AOF filedes later. */
+        if (server.aof_state == AOF_WAIT_REWRITE) {
+            newam->incr_seq++;
+            incrfile = aofIncrFilename(newam->incr_seq);
+            tmpincr = aofTempIncrFilename();
+            listAddNodeTail(newam->incr,
+                aofInfoCreate(sdsdup(incrfile),newam->incr_seq));
         }
 
-        /* Rename the temporary file. This will not unlink the target file if
-         * it exists, because we reference it with "oldfd". */
+        /* Rename the temp files, and replace the manifest. The files the
+         * old manifest refers to are untouched until this point, so on
+         * errors the AOF stays the old one. */
         latencyStartMonitor(latency);
-        if (rename(tmpfile,server.aof_filename) == -1) {
+        snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
+            (int)server.aof_child_pid);
+        if (rename(tmpfile,basefile) == -1) {
             serverLog(LL_WARNING,
                 "Error trying to rename the temporary AOF file %s into %s: %s",
                 tmpfile,
-                server.aof_filename,
+                basefile,
                 strerror(errno));
-            close(newfd);
-            if (oldfd != -1) close(oldfd);
-            goto cleanup;
+            goto rwerr;
+        }
+        if (incrfile && rename(tmpincr,incrfile) == -1) {
+            serverLog(LL_WARNING,
+                "Error trying to rename the temporary AOF file %s into %s: %s",
+                tmpincr,
+                incrfile,
+                strerror(errno));
+            unlink(basefile);
+            goto rwerr;
+        }
+        if (aofManifestPersist(newam) == C_ERR) {
+            unlink(basefile);
+            if (incrfile && rename(incrfile,tmpincr) == -1) {
+                serverLog(LL_WARNING,
+                    "Error trying to rename back the AOF file %s: %s",
+                    incrfile, strerror(errno));
+            }
+            goto rwerr;
         }
         latencyEndMonitor(latency);
         latencyAddSampleIfNeeded("aof-rename",latency);
 
-        if (server.aof_fd == -1) {
-            /* AOF disabled, we don't need to set the AOF file descriptor
-             * to this new file, so we can close it. */
-            close(newfd);
-        } else {
-            /* AOF enabled, replace the old fd with the new one. */
-            oldfd = server.aof_fd;
-            server.aof_fd = newfd;
-            if (server.aof_fsync == AOF_FSYNC_ALWAYS)
-                aof_fsync(newfd);
-            else if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
-                aof_background_fsync(newfd);
-            server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
-            aofUpdateCurrentSize();
-            server.aof_rewrite_base_size = server.aof_current_size;
-
-            /* Clear regular AOF buffer since its contents was just written to
-             * the new AOF from the background rewrite buffer. */
-            sdsfree(server.aof_buf);
-            server.aof_buf = sdsempty();
+        aofManifestFree(am);
+        server.aof_manifest = newam;
+        newam = NULL;
+
+        /* Delete the old files in background. */
+        listRewind(oldfiles,&li);
+        while((ln = listNext(&li)) != NULL) {
+            aofInfo *ai = listNodeValue(ln);
+
+            aofDelFile(ai->name);
         }
 
+        aofUpdateCurrentSize();
+        server.aof_rewrite_base_size = server.aof_current_size;
         server.aof_lastbgrewrite_status = C_OK;
 
         serverLog(LL_NOTICE, "Background AOF rewrite finished successfully");
@@ -1491,9 +1921,13 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
         if (server.aof_state == AOF_WAIT_REWRITE)
             server.aof_state = AOF_ON;
 
-        /* Asynchronously close the overwritten AOF. */
-        if (oldfd != -1) bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)oldfd,NULL,NULL);
-
+rwerr:
+        if (newam) aofManifestFree(newam);
+        listSetFreeMethod(oldfiles,aofInfoFree);
+        listRelease(oldfiles);
+        sdsfree(basefile);
+        sdsfree(incrfile);
+        sdsfree(tmpincr);
         serverLog(LL_VERBOSE,
             "Background AOF rewrite signal handler took %lldus", ustime()-now);
     } else if (!bysignal && exitcode != 0) {
@@ -1510,14 +1944,15 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
             "Background AOF rewrite terminated by signal %d", bysignal);
     }
 
-cleanup:
-    aofClosePipes();
-    aofRewriteBufferReset();
     aofRemoveTempFile(server.aof_child_pid);
     server.aof_child_pid = -1;
     server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
     server.aof_rewrite_time_start = -1;
-    /* Schedule a new rewrite if we are waiting for it to switch the AOF ON. */
-    if (server.aof_state == AOF_WAIT_REWRITE)
+    /* Schedule a new rewrite if we are waiting for it to switch the AOF ON.
+     * The commands appended so far to the temp INCR file will be part of
+     * the dataset rewritten by the next child. */
+    if (server.aof_state == AOF_WAIT_REWRITE) {
+        aofDiscardTempIncr();
         server.aof_rewrite_scheduled = 1;
+    }
 }
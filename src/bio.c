@@ -180,6 +180,8 @@ void *bioProcessBackgroundJobs(void *arg) {
 
         /* Process the job accordingly to its type. */
         if (type == BIO_CLOSE_FILE) {
+            /* A non NULL arg2 asks to fsync the file before closing it. */
+            if (job->arg2) aof_fsync((long)job->arg1);
             close((long)job->arg1);
         } else if (type == BIO_AOF_FSYNC) {
             aof_fsync((long)job->arg1);
@@ -34,10 +34,18 @@
  * Helpers and low level bit functions.
  * -------------------------------------------------------------------------- */
 
+#define BITOP_AND   0
+#define BITOP_OR    1
+#define BITOP_XOR   2
+#define BITOP_NOT   3
+
 /* Count number of bits set in the binary array pointed by 's' and long
  * 'count' bytes. The implementation of this function is required to
- * work with a input string length up to 512 MB. */
-size_t redisPopcount(void *s, long count) {
+ * work with a input string length up to 512 MB.
+ *
+ * This is the portable implementation, see redisPopcount() for the
+ * function actually used by the commands. */
+static size_t redisPopcountScalar(void *s, long count) {
     size_t bits = 0;
     unsigned char *p = s;
     uint32_t *p4;
@@ -91,6 +99,332 @@ size_t redisPopcount(void *s, long count) {
     return bits;
 }
 
+/* -----------------------------------------------------------------------------
+ * SIMD kernels for BITCOUNT, BITPOS and BITOP.
+ *
+ * On x86-64 the kernels are compiled for POPCNT, AVX2 and AVX-512 using the
+ * target function attribute, so that the rest of the server is still built
+ * for the baseline instruction set. The best kernel supported by the CPU is
+ * selected the first time a bit operation is performed. Every kernel must
+ * return exactly the same result as the portable code.
+ * -------------------------------------------------------------------------- */
+
+#define BITOPS_KERNEL_SCALAR 0
+#define BITOPS_KERNEL_POPCNT 1
+#define BITOPS_KERNEL_AVX2 2
+#define BITOPS_KERNEL_AVX512 3
+
+/* The vectorized BITOP kernel is only used when the common prefix of the
+ * input strings is at least this number of bytes. */
+#define BITOP_SIMD_MIN_LEN 256
+
+static struct {
+    int level;  /* BITOPS_KERNEL_* in use, -1 if not selected yet. */
+    /* Count the bits set in 'count' bytes starting at 's'. */
+    size_t (*popcount)(void *s, long count);
+    /* Return how many bytes starting at 'p', up to 'count', are all zero
+     * (if 'bit' is 1) or all ones (if 'bit' is 0), in steps of the vector
+     * size. The caller processes the remaining bytes. */
+    unsigned long (*bitposskip)(unsigned char *p, unsigned long count,
+                                int bit);
+    /* Store in 'res' the result of 'op' applied to the first 'len' bytes
+     * of the 'numkeys' strings in 'src'. Returns the number of bytes
+     * actually processed (a multiple of the vector size), the caller
+     * processes the remaining bytes. */
+    unsigned long (*bitop)(int op, unsigned char *res, unsigned char **src,
+                           unsigned long numkeys, unsigned long len);
+} bitopsKernels = {-1, NULL, NULL, NULL};
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+#include <immintrin.h>
+
+__attribute__((target("popcnt")))
+static size_t redisPopcountPopcnt(void *s, long count) {
+    unsigned char *p = s;
+    size_t bits = 0;
+    uint64_t w[4];
+
+    while (count >= 32) {
+        memcpy(w,p,sizeof(w));
+        bits += __builtin_popcountll(w[0]) + __builtin_popcountll(w[1]) +
+                __builtin_popcountll(w[2]) + __builtin_popcountll(w[3]);
+        p += 32;
+        count -= 32;
+    }
+    while (count >= 8) {
+        memcpy(w,p,sizeof(w[0]));
+        bits += __builtin_popcountll(w[0]);
+        p += 8;
+        count -= 8;
+    }
+    while (count--) bits += __builtin_popcount(*p++);
+    return bits;
+}
+
+/* Population count using the nibble lookup table approach: PSHUFB maps every
+ * 4 bits to their popcount, the per byte counts are accumulated for a few
+ * iterations (so that they can't overflow) and then summed into 64 bit
+ * lanes with PSADBW. */
+__attribute__((target("avx2,popcnt")))
+static size_t redisPopcountAVX2(void *s, long count) {
+    unsigned char *p = s;
+    const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                            0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i lowmask = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t lanes[4];
+    int j;
+
+    while (count >= 32*8) {
+        __m256i local = _mm256_setzero_si256();
+        for (j = 0; j < 8; j++) {
+            __m256i v = _mm256_loadu_si256((__m256i*)p);
+            __m256i lo = _mm256_and_si256(v,lowmask);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v,4),lowmask);
+            local = _mm256_add_epi8(local,_mm256_shuffle_epi8(lookup,lo));
+            local = _mm256_add_epi8(local,_mm256_shuffle_epi8(lookup,hi));
+            p += 32;
+        }
+        acc = _mm256_add_epi64(acc,_mm256_sad_epu8(local,zero));
+        count -= 32*8;
+    }
+    _mm256_storeu_si256((__m256i*)lanes,acc);
+    /* GCC does not always clear the upper state before calling another
+     * local function: do it explicitly, otherwise the SSE code executed
+     * after we return pays the AVX transition penalty. */
+    _mm256_zeroupper();
+    return lanes[0]+lanes[1]+lanes[2]+lanes[3]+redisPopcountPopcnt(p,count);
+}
+
+/* Same as the AVX2 version, but with 512 bit registers (needs AVX512BW for
+ * the byte shuffle). */
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static size_t redisPopcountAVX512(void *s, long count) {
+    unsigned char *p = s;
+    const __m512i lookup = _mm512_set4_epi32(0x04030302,0x03020201,
+                                             0x03020201,0x02010100);
+    const __m512i lowmask = _mm512_set1_epi8(0x0f);
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i acc = _mm512_setzero_si512();
+    int j;
+
+    while (count >= 64*8) {
+        __m512i local = _mm512_setzero_si512();
+        for (j = 0; j < 8; j++) {
+            __m512i v = _mm512_loadu_si512((void*)p);
+            __m512i lo = _mm512_and_si512(v,lowmask);
+            __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v,4),lowmask);
+            local = _mm512_add_epi8(local,_mm512_shuffle_epi8(lookup,lo));
+            local = _mm512_add_epi8(local,_mm512_shuffle_epi8(lookup,hi));
+            p += 64;
+        }
+        acc = _mm512_add_epi64(acc,_mm512_sad_epu8(local,zero));
+        count -= 64*8;
+    }
+    size_t bits = _mm512_reduce_add_epi64(acc);
+    _mm256_zeroupper(); /* See redisPopcountAVX2(). */
+    return bits+redisPopcountPopcnt(p,count);
+}
+
+__attribute__((target("avx2")))
+static unsigned long redisBitposSkipAVX2(unsigned char *p,
+                                         unsigned long count, int bit)
+{
+    const __m256i skipval = _mm256_set1_epi8(bit ? 0 : -1);
+    unsigned long skipped = 0;
+
+    while (count-skipped >= 32*4) {
+        __m256i x = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_xor_si256(_mm256_loadu_si256((__m256i*)p),skipval),
+                _mm256_xor_si256(_mm256_loadu_si256((__m256i*)(p+32)),skipval)),
+            _mm256_or_si256(
+                _mm256_xor_si256(_mm256_loadu_si256((__m256i*)(p+64)),skipval),
+                _mm256_xor_si256(_mm256_loadu_si256((__m256i*)(p+96)),skipval)));
+        if (!_mm256_testz_si256(x,x)) break;
+        p += 32*4;
+        skipped += 32*4;
+    }
+    while (count-skipped >= 32) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((__m256i*)p),skipval);
+        if (!_mm256_testz_si256(x,x)) break;
+        p += 32;
+        skipped += 32;
+    }
+    return skipped;
+}
+
+__attribute__((target("avx512f")))
+static unsigned long redisBitposSkipAVX512(unsigned char *p,
+                                           unsigned long count, int bit)
+{
+    const __m512i skipval = _mm512_set1_epi32(bit ? 0 : -1);
+    unsigned long skipped = 0;
+
+    while (count-skipped >= 64*4) {
+        __m512i x = _mm512_or_si512(
+            _mm512_or_si512(
+                _mm512_xor_si512(_mm512_loadu_si512((void*)p),skipval),
+                _mm512_xor_si512(_mm512_loadu_si512((void*)(p+64)),skipval)),
+            _mm512_or_si512(
+                _mm512_xor_si512(_mm512_loadu_si512((void*)(p+128)),skipval),
+                _mm512_xor_si512(_mm512_loadu_si512((void*)(p+192)),skipval)));
+        if (_mm512_test_epi64_mask(x,x)) break;
+        p += 64*4;
+        skipped += 64*4;
+    }
+    while (count-skipped >= 64) {
+        __m512i x = _mm512_xor_si512(_mm512_loadu_si512((void*)p),skipval);
+        if (_mm512_test_epi64_mask(x,x)) break;
+        p += 64;
+        skipped += 64;
+    }
+    return skipped;
+}
+
+/* The BITOP kernels compute 128 (AVX2) or 256 (AVX-512) bytes of output per
+ * step, combining the same block of every source string in registers, so the
+ * result is written only once whatever the number of keys. */
+#define BITOP_AVX2_STEP(opfunc) do { \
+    for (i = 1; i < numkeys; i++) { \
+        unsigned char *s = src[i]+j; \
+        r0 = opfunc(r0,_mm256_loadu_si256((__m256i*)s)); \
+        r1 = opfunc(r1,_mm256_loadu_si256((__m256i*)(s+32))); \
+        r2 = opfunc(r2,_mm256_loadu_si256((__m256i*)(s+64))); \
+        r3 = opfunc(r3,_mm256_loadu_si256((__m256i*)(s+96))); \
+    } \
+} while(0)
+
+__attribute__((target("avx2")))
+static unsigned long bitopAVX2(int op, unsigned char *res, unsigned char **src,
+                               unsigned long numkeys, unsigned long len)
+{
+    const __m256i ones = _mm256_set1_epi8(-1);
+    unsigned long i, j = 0;
+
+    while (len-j >= 32*4) {
+        __m256i r0 = _mm256_loadu_si256((__m256i*)(src[0]+j));
+        __m256i r1 = _mm256_loadu_si256((__m256i*)(src[0]+j+32));
+        __m256i r2 = _mm256_loadu_si256((__m256i*)(src[0]+j+64));
+        __m256i r3 = _mm256_loadu_si256((__m256i*)(src[0]+j+96));
+
+        switch(op) {
+        case BITOP_AND: BITOP_AVX2_STEP(_mm256_and_si256); break;
+        case BITOP_OR:  BITOP_AVX2_STEP(_mm256_or_si256); break;
+        case BITOP_XOR: BITOP_AVX2_STEP(_mm256_xor_si256); break;
+        case BITOP_NOT:
+            r0 = _mm256_xor_si256(r0,ones);
+            r1 = _mm256_xor_si256(r1,ones);
+            r2 = _mm256_xor_si256(r2,ones);
+            r3 = _mm256_xor_si256(r3,ones);
+            break;
+        }
+        _mm256_storeu_si256((__m256i*)(res+j),r0);
+        _mm256_storeu_si256((__m256i*)(res+j+32),r1);
+        _mm256_storeu_si256((__m256i*)(res+j+64),r2);
+        _mm256_storeu_si256((__m256i*)(res+j+96),r3);
+        j += 32*4;
+    }
+    return j;
+}
+
+#define BITOP_AVX512_STEP(opfunc) do { \
+    for (i = 1; i < numkeys; i++) { \
+        unsigned char *s = src[i]+j; \
+        r0 = opfunc(r0,_mm512_loadu_si512((void*)s)); \
+        r1 = opfunc(r1,_mm512_loadu_si512((void*)(s+64))); \
+        r2 = opfunc(r2,_mm512_loadu_si512((void*)(s+128))); \
+        r3 = opfunc(r3,_mm512_loadu_si512((void*)(s+192))); \
+    } \
+} while(0)
+
+__attribute__((target("avx512f")))
+static unsigned long bitopAVX512(int op, unsigned char *res,
+                                 unsigned char **src, unsigned long numkeys,
+                                 unsigned long len)
+{
+    const __m512i ones = _mm512_set1_epi32(-1);
+    unsigned long i, j = 0;
+
+    while (len-j >= 64*4) {
+        __m512i r0 = _mm512_loadu_si512((void*)(src[0]+j));
+        __m512i r1 = _mm512_loadu_si512((void*)(src[0]+j+64));
+        __m512i r2 = _mm512_loadu_si512((void*)(src[0]+j+128));
+        __m512i r3 = _mm512_loadu_si512((void*)(src[0]+j+192));
+
+        switch(op) {
+        case BITOP_AND: BITOP_AVX512_STEP(_mm512_and_si512); break;
+        case BITOP_OR:  BITOP_AVX512_STEP(_mm512_or_si512); break;
+        case BITOP_XOR: BITOP_AVX512_STEP(_mm512_xor_si512); break;
+        case BITOP_NOT:
+            r0 = _mm512_xor_si512(r0,ones);
+            r1 = _mm512_xor_si512(r1,ones);
+            r2 = _mm512_xor_si512(r2,ones);
+            r3 = _mm512_xor_si512(r3,ones);
+            break;
+        }
+        _mm512_storeu_si512((void*)(res+j),r0);
+        _mm512_storeu_si512((void*)(res+j+64),r1);
+        _mm512_storeu_si512((void*)(res+j+128),r2);
+        _mm512_storeu_si512((void*)(res+j+192),r3);
+        j += 64*4;
+    }
+    return j;
+}
+#endif /* HAVE_X86_SIMD_DISPATCH */
+
+/* Return the best kernel level supported by this CPU. */
+static int bitopsMaxKernelLevel(void) {
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (cpuHasFeatures(CPU_FEATURE_AVX512F|CPU_FEATURE_AVX512BW|
+                       CPU_FEATURE_POPCNT)) return BITOPS_KERNEL_AVX512;
+    if (cpuHasFeatures(CPU_FEATURE_AVX2|CPU_FEATURE_POPCNT))
+        return BITOPS_KERNEL_AVX2;
+    if (cpuHasFeatures(CPU_FEATURE_POPCNT)) return BITOPS_KERNEL_POPCNT;
+#endif
+    return BITOPS_KERNEL_SCALAR;
+}
+
+/* Point bitopsKernels to the implementations of 'level', capped to the best
+ * level of this CPU: the tests force the lower levels to compare them.
+ * Returns the level actually selected. */
+static int bitopsSelectKernels(int level) {
+    int max = bitopsMaxKernelLevel();
+
+    if (level > max) level = max;
+    bitopsKernels.level = level;
+    bitopsKernels.popcount = redisPopcountScalar;
+    bitopsKernels.bitposskip = NULL;
+    bitopsKernels.bitop = NULL;
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (level == BITOPS_KERNEL_POPCNT) {
+        bitopsKernels.popcount = redisPopcountPopcnt;
+    } else if (level == BITOPS_KERNEL_AVX2) {
+        bitopsKernels.popcount = redisPopcountAVX2;
+        bitopsKernels.bitposskip = redisBitposSkipAVX2;
+        bitopsKernels.bitop = bitopAVX2;
+    } else if (level == BITOPS_KERNEL_AVX512) {
+        bitopsKernels.popcount = redisPopcountAVX512;
+        bitopsKernels.bitposskip = redisBitposSkipAVX512;
+        bitopsKernels.bitop = bitopAVX512;
+    }
+#endif
+    return level;
+}
+
+#define bitopsInitKernels() do { \
+    if (bitopsKernels.level == -1) \
+        bitopsSelectKernels(BITOPS_KERNEL_AVX512); \
+} while(0)
+
+/* Count number of bits set in the binary array pointed by 's' and long
+ * 'count' bytes, using the fastest implementation available. */
+size_t redisPopcount(void *s, long count) {
+    bitopsInitKernels();
+    return bitopsKernels.popcount(s,count);
+}
+
 /* Return the position of the first bit set to one (if 'bit' is 1) or
  * zero (if 'bit' is 0) in the bitmap starting at 's' and long 'count' bytes.
  *
@@ -124,6 +458,15 @@ long redisBitpos(void *s, unsigned long count, int bit) {
         pos += 8;
     }
 
+    /* Skip large blocks with the vectorized kernel if available. */
+    bitopsInitKernels();
+    if (bitopsKernels.bitposskip) {
+        unsigned long skipped = bitopsKernels.bitposskip(c,count,bit);
+        c += skipped;
+        count -= skipped;
+        pos += skipped*8;
+    }
+
     /* Skip bits with full word step. */
     skipval = bit ? 0 : ULONG_MAX;
     l = (unsigned long*) c;
@@ -385,11 +728,6 @@ void printBits(unsigned char *p, unsigned long count) {
  * Bits related string commands: GETBIT, SETBIT, BITCOUNT, BITOP.
  * -------------------------------------------------------------------------- */
 
-#define BITOP_AND   0
-#define BITOP_OR    1
-#define BITOP_XOR   2
-#define BITOP_NOT   3
-
 #define BITFIELDOP_GET 0
 #define BITFIELDOP_SET 1
 #define BITFIELDOP_INCRBY 2
@@ -483,6 +821,50 @@ robj *lookupStringForBitCommand(client *c, size_t maxbit) {
     return o;
 }
 
+/* Return true if a bitmap of 'len' bytes should be stored as a roaring
+ * bitmap according to the configuration. */
+#define bitmapWantsRoaring(len) (server.bitmap_roaring_min_bytes && \
+                                 (len) >= server.bitmap_roaring_min_bytes)
+
+/* Roaring bitmaps using as much memory as the equivalent string are better
+ * stored as plain strings. */
+#define roaringIsDense(r) (roaringMemory(r) >= (r)->len)
+
+/* Like lookupStringForBitCommand() but for SETBIT, that is able to operate
+ * on roaring bitmaps: a new key addressing a large enough offset is created
+ * as a roaring bitmap, and a sparse plain string is converted when the
+ * offset would make it at least twice as big (so that the cost of the
+ * conversion is amortized). Roaring bitmaps are returned as they are. */
+robj *lookupBitmapForSetbitCommand(client *c, size_t maxbit) {
+    size_t byte = maxbit >> 3;
+    robj *o = lookupKeyWrite(c->db,c->argv[1]);
+
+    if (o == NULL) {
+        if (bitmapWantsRoaring(byte+1)) {
+            o = createRoaringStringObject(roaringNew(byte+1));
+            dbAdd(c->db,c->argv[1],o);
+            return o;
+        }
+    } else {
+        if (checkType(c,o,OBJ_STRING)) return NULL;
+        if (o->encoding == OBJ_ENCODING_ROARING) return o;
+        if (sdsEncodedObject(o) && bitmapWantsRoaring(byte+1) &&
+            byte+1 > sdslen(o->ptr)*2)
+        {
+            roaring *r = roaringFromBuffer(o->ptr,sdslen(o->ptr));
+
+            r->len = byte+1;
+            if (!roaringIsDense(r)) {
+                o = createRoaringStringObject(r);
+                dbOverwrite(c->db,c->argv[1],o);
+                return o;
+            }
+            roaringFree(r);
+        }
+    }
+    return lookupStringForBitCommand(c,maxbit);
+}
+
 /* Return a pointer to the string object content, and stores its length
  * in 'len'. The user is required to pass (likely stack allocated) buffer
  * 'llbuf' of at least LONG_STR_SIZE bytes. Such a buffer is used in the case
@@ -535,18 +917,24 @@ void setbitCommand(client *c) {
         return;
     }
 
-    if ((o = lookupStringForBitCommand(c,bitoffset)) == NULL) return;
+    if ((o = lookupBitmapForSetbitCommand(c,bitoffset)) == NULL) return;
 
-    /* Get current values */
-    byte = bitoffset >> 3;
-    byteval = ((uint8_t*)o->ptr)[byte];
-    bit = 7 - (bitoffset & 0x7);
-    bitval = byteval & (1 << bit);
+    if (o->encoding == OBJ_ENCODING_ROARING) {
+        bitval = roaringSetBit(o->ptr,bitoffset,on);
+        if (roaringIsDense((roaring*)o->ptr))
+            dbDecompressStringValue(c->db,c->argv[1],o);
+    } else {
+        /* Get current values */
+        byte = bitoffset >> 3;
+        byteval = ((uint8_t*)o->ptr)[byte];
+        bit = 7 - (bitoffset & 0x7);
+        bitval = byteval & (1 << bit);
 
-    /* Update byte with new bit value and return original value */
-    byteval &= ~(1 << bit);
-    byteval |= ((on & 0x1) << bit);
-    ((uint8_t*)o->ptr)[byte] = byteval;
+        /* Update byte with new bit value and return original value */
+        byteval &= ~(1 << bit);
+        byteval |= ((on & 0x1) << bit);
+        ((uint8_t*)o->ptr)[byte] = byteval;
+    }
     signalModifiedKey(c->db,c->argv[1]);
     notifyKeyspaceEvent(NOTIFY_STRING,"setbit",c->argv[1],c->db->id);
     server.dirty++;
@@ -560,12 +948,20 @@ void getbitCommand(client *c) {
     size_t bitoffset;
     size_t byte, bit;
     size_t bitval = 0;
+    robj *decoded = NULL;
 
     if (getBitOffsetFromArgument(c,c->argv[2],&bitoffset,0,0) != C_OK)
         return;
 
     if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,o,OBJ_STRING)) return;
+    if (o->encoding == OBJ_ENCODING_ROARING) {
+        bitval = roaringGetBit(o->ptr,bitoffset);
+        addReply(c, bitval ? shared.cone : shared.czero);
+        return;
+    }
+    /* Compressed strings are decompressed in a temporary object. */
+    if (o->encoding == OBJ_ENCODING_LZF) o = decoded = getDecodedObject(o);
 
     byte = bitoffset >> 3;
     bit = 7 - (bitoffset & 0x7);
@@ -578,6 +974,38 @@ void getbitCommand(client *c) {
     }
 
     addReply(c, bitval ? shared.cone : shared.czero);
+    if (decoded) decrRefCount(decoded);
+}
+
+/* Compute AND, OR or XOR of the 'numkeys' objects, that are roaring bitmaps
+ * or NULL for missing keys, setting 'maxlen' to the length of the result.
+ * The result is returned as a roaring bitmap, or as a plain string if it is
+ * too dense. */
+static robj *bitopRoaring(int op, robj **objects, unsigned long numkeys,
+                          unsigned long *maxlen)
+{
+    roaring **src = zmalloc(sizeof(roaring*)*numkeys);
+    unsigned long j;
+    robj *o;
+
+    *maxlen = 0;
+    for (j = 0; j < numkeys; j++) {
+        src[j] = objects[j] ? objects[j]->ptr : NULL;
+        if (src[j] && src[j]->len > *maxlen) *maxlen = src[j]->len;
+    }
+    switch(op) {
+    case BITOP_AND: op = ROARING_AND; break;
+    case BITOP_OR: op = ROARING_OR; break;
+    case BITOP_XOR: op = ROARING_XOR; break;
+    }
+    o = createRoaringStringObject(roaringOp(op,src,numkeys,*maxlen));
+    zfree(src);
+    if (roaringIsDense((roaring*)o->ptr)) {
+        robj *dec = getDecodedObject(o);
+        decrRefCount(o);
+        o = dec;
+    }
+    return o;
 }
 
 /* BITOP op_name target_key src_key1 src_key2 src_key3 ... src_keyN */
@@ -591,6 +1019,8 @@ void bitopCommand(client *c) {
                                        and max len. */
     unsigned long minlen = 0;    /* Min len among the input keys. */
     unsigned char *res = NULL; /* Resulting string. */
+    robj *result = NULL; /* Resulting object, when computed natively. */
+    unsigned long found = 0, roaringkeys = 0; /* Existing / roaring keys. */
 
     /* Parse the operation name. */
     if ((opname[0] == 'a' || opname[0] == 'A') && !strcasecmp(opname,"and"))
@@ -639,15 +1069,36 @@ void bitopCommand(client *c) {
             zfree(objects);
             return;
         }
-        objects[j] = getDecodedObject(o);
-        src[j] = objects[j]->ptr;
-        len[j] = sdslen(objects[j]->ptr);
-        if (len[j] > maxlen) maxlen = len[j];
-        if (j == 0 || len[j] < minlen) minlen = len[j];
+        incrRefCount(o);
+        objects[j] = o;
+        found++;
+        if (o->encoding == OBJ_ENCODING_ROARING) roaringkeys++;
+    }
+
+    /* AND, OR and XOR of roaring bitmaps are computed without materializing
+     * the strings. Otherwise every source is decoded into a plain string. */
+    if (op != BITOP_NOT && roaringkeys && roaringkeys == found) {
+        result = bitopRoaring(op,objects,numkeys,&maxlen);
+    } else {
+        for (j = 0; j < numkeys; j++) {
+            if (objects[j] == NULL) {
+                src[j] = NULL;
+                len[j] = 0;
+                minlen = 0;
+                continue;
+            }
+            o = getDecodedObject(objects[j]);
+            decrRefCount(objects[j]);
+            objects[j] = o;
+            src[j] = objects[j]->ptr;
+            len[j] = sdslen(objects[j]->ptr);
+            if (len[j] > maxlen) maxlen = len[j];
+            if (j == 0 || len[j] < minlen) minlen = len[j];
+        }
     }
 
     /* Compute the bit operation, if at least one string is not empty. */
-    if (maxlen) {
+    if (maxlen && result == NULL) {
         res = (unsigned char*) sdsnewlen(NULL,maxlen);
         unsigned char output, byte;
         unsigned long i;
@@ -656,13 +1107,19 @@ void bitopCommand(client *c) {
          * can take a fast path that performs much better than the
          * vanilla algorithm. */
         j = 0;
+        bitopsInitKernels();
+        if (bitopsKernels.bitop && minlen >= BITOP_SIMD_MIN_LEN) {
+            j = bitopsKernels.bitop(op,res,src,numkeys,minlen);
+            minlen -= j;
+        }
         if (minlen >= sizeof(unsigned long)*4 && numkeys <= 16) {
             unsigned long *lp[16];
-            unsigned long *lres = (unsigned long*) res;
+            unsigned long *lres = (unsigned long*) (res+j);
 
             /* Note: sds pointer is always aligned to 8 byte boundary. */
-            memcpy(lp,src,sizeof(unsigned long*)*numkeys);
-            memcpy(res,src[0],minlen);
+            for (i = 0; i < numkeys; i++)
+                lp[i] = (unsigned long*) (src[i]+j);
+            memcpy(res+j,src[0]+j,minlen);
 
             /* Different branches per different operations for speed (sorry). */
             if (op == BITOP_AND) {
@@ -742,7 +1199,7 @@ void bitopCommand(client *c) {
 
     /* Store the computed value into the target key */
     if (maxlen) {
-        o = createObject(OBJ_STRING,res);
+        o = result ? result : createObject(OBJ_STRING,res);
         setKey(c->db,targetkey,o);
         notifyKeyspaceEvent(NOTIFY_STRING,"set",targetkey,c->db->id);
         decrRefCount(o);
@@ -764,7 +1221,16 @@ void bitcountCommand(client *c) {
     /* Lookup, check for type, and return 0 for non existing keys. */
     if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
         checkType(c,o,OBJ_STRING)) return;
-    p = getObjectReadOnlyString(o,&strlen,llbuf);
+    if (o->encoding == OBJ_ENCODING_ROARING ||
+        o->encoding == OBJ_ENCODING_LZF)
+    {
+        /* Roaring bitmaps are counted natively, and compressed strings
+         * are decompressed once the range is known, see below. */
+        p = NULL;
+        strlen = stringObjectLen(o);
+    } else {
+        p = getObjectReadOnlyString(o,&strlen,llbuf);
+    }
 
     /* Parse start/end range if any. */
     if (c->argc == 4) {
@@ -799,7 +1265,16 @@ void bitcountCommand(client *c) {
     } else {
         long bytes = end-start+1;
 
-        addReplyLongLong(c,redisPopcount(p+start,bytes));
+        if (o->encoding == OBJ_ENCODING_ROARING) {
+            addReplyLongLong(c,roaringCount(o->ptr,start*8,end*8+7));
+        } else if (o->encoding == OBJ_ENCODING_LZF) {
+            robj *decoded = getDecodedObject(o);
+            p = (unsigned char*)decoded->ptr;
+            addReplyLongLong(c,redisPopcount(p+start,bytes));
+            decrRefCount(decoded);
+        } else {
+            addReplyLongLong(c,redisPopcount(p+start,bytes));
+        }
     }
 }
 
@@ -828,7 +1303,16 @@ void bitposCommand(client *c) {
         return;
     }
     if (checkType(c,o,OBJ_STRING)) return;
-    p = getObjectReadOnlyString(o,&strlen,llbuf);
+    if (o->encoding == OBJ_ENCODING_ROARING ||
+        o->encoding == OBJ_ENCODING_LZF)
+    {
+        /* Roaring bitmaps are scanned natively, and compressed strings
+         * are decompressed once the range is known, see below. */
+        p = NULL;
+        strlen = stringObjectLen(o);
+    } else {
+        p = getObjectReadOnlyString(o,&strlen,llbuf);
+    }
 
     /* Parse start/end range if any. */
     if (c->argc == 4 || c->argc == 5) {
@@ -863,7 +1347,22 @@ void bitposCommand(client *c) {
         addReplyLongLong(c, -1);
     } else {
         long bytes = end-start+1;
-        long pos = redisBitpos(p+start,bytes,bit);
+        long pos;
+
+        if (o->encoding == OBJ_ENCODING_ROARING) {
+            /* Like redisBitpos(), return the bit just after the range if
+             * there are no clear bits, as the string is zero padded. */
+            pos = roaringFirst(o->ptr,bit,start*8,end*8+7);
+            if (pos != -1) pos -= start*8;
+            else if (bit == 0) pos = bytes*8;
+        } else if (o->encoding == OBJ_ENCODING_LZF) {
+            robj *decoded = getDecodedObject(o);
+            p = (unsigned char*)decoded->ptr;
+            pos = redisBitpos(p+start,bytes,bit);
+            decrRefCount(decoded);
+        } else {
+            pos = redisBitpos(p+start,bytes,bit);
+        }
 
         /* If we are looking for clear bits, and the user specified an exact
          * range with start-end, we can't consider the right of the range as
@@ -908,6 +1407,7 @@ void bitfieldCommand(client *c) {
     int owtype = BFOVERFLOW_WRAP; /* Overflow type. */
     int readonly = 1;
     size_t higest_write_offset = 0;
+    robj *decoded = NULL;
 
     for (j = 2; j < c->argc; j++) {
         int remargs = c->argc-j-1; /* Remaining args other than current. */
@@ -984,6 +1484,13 @@ void bitfieldCommand(client *c) {
          * if it's not a string. */
         o = lookupKeyRead(c->db,c->argv[1]);
         if (o != NULL && checkType(c,o,OBJ_STRING)) return;
+        /* Compressed strings and roaring bitmaps are read from a temporary
+         * decoded copy, the stored value is left as it is. */
+        if (o != NULL && (o->encoding == OBJ_ENCODING_LZF ||
+                          o->encoding == OBJ_ENCODING_ROARING))
+        {
+            o = decoded = getDecodedObject(o);
+        }
     } else {
         /* Lookup by making room up to the farest bit reached by
          * this operation. */
@@ -1110,5 +1617,133 @@ void bitfieldCommand(client *c) {
         notifyKeyspaceEvent(NOTIFY_STRING,"setbit",c->argv[1],c->db->id);
         server.dirty += changes;
     }
+    if (decoded) decrRefCount(decoded);
     zfree(ops);
 }
+
+#ifdef REDIS_TEST
+static const char *bitopsKernelName[] = {"scalar","popcnt","avx2","avx512"};
+
+/* Byte by byte BITOP used as reference for the kernels. */
+static void bitopReference(int op, unsigned char *res, unsigned char **src,
+                           unsigned long numkeys, unsigned long len)
+{
+    unsigned long i, j;
+
+    for (j = 0; j < len; j++) {
+        unsigned char output = src[0][j];
+        if (op == BITOP_NOT) output = ~output;
+        for (i = 1; i < numkeys; i++) {
+            switch(op) {
+            case BITOP_AND: output &= src[i][j]; break;
+            case BITOP_OR:  output |= src[i][j]; break;
+            case BITOP_XOR: output ^= src[i][j]; break;
+            }
+        }
+        res[j] = output;
+    }
+}
+
+/* Check every kernel level supported by this CPU against the portable
+ * code, then print a few throughput numbers. */
+int bitopsTest(int argc, char *argv[]) {
+    int level, maxlevel, iter, err = 0;
+    unsigned long j, bufsize = 1024*1024*64;
+    unsigned char *buf = zmalloc(bufsize+64);
+    unsigned char *res = zmalloc(bufsize+64);
+    unsigned char *ref = zmalloc(bufsize+64);
+    unsigned char *src[24];
+    long long start;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(1234);
+    for (j = 0; j < bufsize+64; j++) buf[j] = rand();
+    maxlevel = bitopsMaxKernelLevel();
+
+    for (level = BITOPS_KERNEL_SCALAR; level <= maxlevel; level++) {
+        bitopsSelectKernels(level);
+        printf("Testing %s kernels: ", bitopsKernelName[level]);
+
+        /* BITCOUNT: random lengths and alignments. */
+        for (iter = 0; iter < 2000; iter++) {
+            unsigned long off = rand() % 64;
+            long len = (iter < 1000) ? rand() % 4096 : rand() % (1024*1024);
+            if (redisPopcount(buf+off,len) != redisPopcountScalar(buf+off,len))
+                err++;
+        }
+
+        /* BITPOS: runs of skipped bytes followed by a random byte. */
+        for (iter = 0; iter < 2000; iter++) {
+            int bit = iter & 1;
+            unsigned long off = rand() % 64;
+            unsigned long len = rand() % 8192;
+            unsigned long run = len ? rand() % (len+1) : 0;
+            long pos, expected = -1;
+
+            memcpy(res,buf,len+off);
+            memset(res+off,bit ? 0 : 0xff,run);
+            for (j = 0; j < len*8; j++) {
+                int b = (res[off+j/8] >> (7-(j&7))) & 1;
+                if (b == bit) {
+                    expected = j;
+                    break;
+                }
+            }
+            if (expected == -1 && bit == 0) expected = len*8;
+            pos = redisBitpos(res+off,len,bit);
+            if (pos != expected) err++;
+        }
+
+        /* BITOP: every operation with a few keys and lengths. */
+        for (iter = 0; iter < 400; iter++) {
+            int op = iter % 4;
+            unsigned long numkeys = (op == BITOP_NOT) ? 1 : 1+rand()%24;
+            unsigned long len = rand() % 16384;
+            unsigned long done = 0;
+
+            for (j = 0; j < numkeys; j++)
+                src[j] = buf+(rand()%(bufsize-len));
+            if (bitopsKernels.bitop)
+                done = bitopsKernels.bitop(op,res,src,numkeys,len);
+            bitopReference(op,ref,src,numkeys,len);
+            if (done > len || memcmp(res,ref,done) != 0) err++;
+        }
+        printf("%s\n", err ? "ERR" : "OK");
+    }
+
+    /* Benchmarks. */
+    for (level = BITOPS_KERNEL_SCALAR; level <= maxlevel; level++) {
+        size_t bits = 0;
+
+        bitopsSelectKernels(level);
+        /* Use a buffer fitting the cache, so that we measure the kernel
+         * and not the memory bandwidth. */
+        start = ustime();
+        for (iter = 0; iter < 10000; iter++)
+            bits += redisPopcount(buf,1024*64);
+        printf("%-7s BITCOUNT: %.2f GB/s (%zu)\n", bitopsKernelName[level],
+            (double)1024*64*10000/(ustime()-start)/1000, bits);
+
+        memset(res,0,bufsize);
+        start = ustime();
+        for (iter = 0; iter < 10; iter++) bits += redisBitpos(res,bufsize,1);
+        printf("%-7s BITPOS:   %.2f GB/s\n", bitopsKernelName[level],
+            (double)bufsize*10/(ustime()-start)/1000);
+
+        if (bitopsKernels.bitop == NULL) continue;
+        for (j = 0; j < 8; j++) src[j] = buf+j*(bufsize/8);
+        start = ustime();
+        for (iter = 0; iter < 10; iter++)
+            bitopsKernels.bitop(BITOP_AND,res,src,8,bufsize/8);
+        printf("%-7s BITOP AND 8 keys: %.2f GB/s\n", bitopsKernelName[level],
+            (double)bufsize*10/(ustime()-start)/1000);
+    }
+
+    zfree(buf);
+    zfree(res);
+    zfree(ref);
+    bitopsKernels.level = -1;
+    return err ? 1 : 0;
+}
+#endif
@@ -0,0 +1,517 @@
+/* Scalable Bloom filters made of split block layers, the implementation of
+ * the Bloom filter type (see t_bloom.c).
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bloom.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+#include "config.h"
+#include "cpufeatures.h"
+
+/* Serialized format: 8 bytes error rate, 8 bytes number of items, 4 bytes
+ * expansion, 4 bytes number of layers, then for every layer 8 bytes
+ * capacity, 8 bytes number of items, 8 bytes number of blocks, 8 bytes
+ * error rate, followed by the blocks. Error rates are stored as the bits
+ * of the IEEE 754 double. All the integers are little endian. */
+#define BLOOM_HDR_LEN 24
+#define BLOOM_LAYER_HDR_LEN 32
+
+/* Every word of a block uses the hash multiplied by a different odd
+ * constant to select its bit (the salts of the Parquet split block Bloom
+ * filter). */
+static const uint32_t bloomSalt[BLOOM_BLOCK_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+/* ----------------------------- Helpers ------------------------------------ */
+
+/* Every layer uses a different hash derived from the item hash, so that
+ * an item colliding with another one in a layer is unlikely to collide in
+ * the next layers as well. This is the splitmix64 finalizer. */
+static inline uint64_t bloomLayerHash(uint64_t hash, uint32_t layer) {
+    uint64_t h = hash + (uint64_t)layer*0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/* Map the high 32 bits of the hash to a block, without a division. */
+static inline uint32_t *bloomBlock(bloomLayer *l, uint64_t h) {
+    uint64_t idx = ((h >> 32) * l->nblocks) >> 32;
+    return l->blocks + idx*BLOOM_BLOCK_WORDS;
+}
+
+/* False positive rate of a blocked filter using 'bits' bits per item. The
+ * number of items hashed to a block follows a Poisson distribution, and a
+ * block with i items has (1-(31/32)^i)^8 false positive rate, so the rate
+ * is higher than the one of a standard Bloom filter with the same size,
+ * (1-e^(-8n/m))^8, because of the overloaded blocks. */
+static double bloomBlockedError(double bits) {
+    double lambda = BLOOM_BLOCK_BYTES*8/bits; /* Average items per block. */
+    double p = exp(-lambda), error = 0;
+    int i, max = lambda+20*sqrt(lambda)+50;
+
+    for (i = 0; i < max; i++) {
+        if (i) p *= lambda/i;
+        error += p*pow(1-pow(31.0/32,i),BLOOM_BLOCK_WORDS);
+    }
+    return error;
+}
+
+/* Number of blocks needed to store 'capacity' items with the specified
+ * false positive rate. Returns 0 if too many blocks would be needed. */
+static uint64_t bloomBlocksFor(uint64_t capacity, double error) {
+    double lo = 1, hi = 1024, bits, blocks;
+    int j;
+
+    /* The error decreases with the bits per item: binary search the
+     * smallest number of bits giving the requested error (capped to 1024
+     * bits per item, where the error is about 2e-11). */
+    for (j = 0; j < 40; j++) {
+        bits = (lo+hi)/2;
+        if (bloomBlockedError(bits) > error) lo = bits; else hi = bits;
+    }
+    blocks = ceil(hi*capacity/(BLOOM_BLOCK_BYTES*8));
+    if (blocks < 1) blocks = 1;
+    if (blocks > (double)BLOOM_MAX_BLOCKS) return 0;
+    return blocks;
+}
+
+/* Allocate the blocks of a layer, zeroed and aligned to the block size so
+ * that a block never crosses a cache line. */
+static void bloomLayerAlloc(bloomLayer *l) {
+    size_t bytes = l->nblocks*BLOOM_BLOCK_BYTES;
+    uintptr_t p;
+
+    l->alloc = zcalloc(bytes+BLOOM_BLOCK_BYTES-1);
+    p = (uintptr_t)l->alloc;
+    p = (p+BLOOM_BLOCK_BYTES-1) & ~(uintptr_t)(BLOOM_BLOCK_BYTES-1);
+    l->blocks = (uint32_t*)p;
+}
+
+/* Append a new empty layer. Returns 0 if the layer would be too large. */
+static int bloomAddLayer(bloom *b, uint64_t capacity, double error) {
+    uint64_t nblocks = bloomBlocksFor(capacity,error);
+    bloomLayer *l;
+
+    if (nblocks == 0) return 0;
+    b->layers = zrealloc(b->layers,sizeof(bloomLayer)*(b->numlayers+1));
+    l = b->layers+b->numlayers;
+    l->capacity = capacity;
+    l->items = 0;
+    l->nblocks = nblocks;
+    l->error = error;
+    bloomLayerAlloc(l);
+    b->numlayers++;
+    return 1;
+}
+
+/* ------------------------------ Kernels ----------------------------------- */
+
+/* Test / set the bits of 'lo' in the block. The portable version is a
+ * fixed eight iterations loop, the AVX2 version processes the whole block
+ * with a single 256 bit load. Both must give exactly the same results. */
+static int bloomBlockCheckScalar(const uint32_t *block, uint32_t lo) {
+    int j;
+
+    for (j = 0; j < BLOOM_BLOCK_WORDS; j++) {
+        uint32_t mask = (uint32_t)1 << ((lo*bloomSalt[j]) >> 27);
+        if ((block[j] & mask) == 0) return 0;
+    }
+    return 1;
+}
+
+static void bloomBlockSetScalar(uint32_t *block, uint32_t lo) {
+    int j;
+
+    for (j = 0; j < BLOOM_BLOCK_WORDS; j++)
+        block[j] |= (uint32_t)1 << ((lo*bloomSalt[j]) >> 27);
+}
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline __m256i bloomBlockMaskAVX2(uint32_t lo) {
+    __m256i salt = _mm256_loadu_si256((const __m256i*)bloomSalt);
+    __m256i h = _mm256_mullo_epi32(_mm256_set1_epi32(lo),salt);
+    return _mm256_sllv_epi32(_mm256_set1_epi32(1),_mm256_srli_epi32(h,27));
+}
+
+__attribute__((target("avx2")))
+static int bloomBlockCheckAVX2(const uint32_t *block, uint32_t lo) {
+    __m256i blk = _mm256_load_si256((const __m256i*)block);
+    return _mm256_testc_si256(blk,bloomBlockMaskAVX2(lo));
+}
+
+__attribute__((target("avx2")))
+static void bloomBlockSetAVX2(uint32_t *block, uint32_t lo) {
+    __m256i blk = _mm256_load_si256((const __m256i*)block);
+    blk = _mm256_or_si256(blk,bloomBlockMaskAVX2(lo));
+    _mm256_store_si256((__m256i*)block,blk);
+}
+#endif /* HAVE_X86_SIMD_DISPATCH */
+
+static int (*bloomBlockCheck)(const uint32_t *block, uint32_t lo) = NULL;
+static void (*bloomBlockSet)(uint32_t *block, uint32_t lo) = NULL;
+
+/* Select the AVX2 kernels if 'avx2' is true and the CPU supports them,
+ * otherwise the portable ones. Returns 1 if the AVX2 kernels are used. */
+static int bloomSelectKernels(int avx2) {
+    bloomBlockCheck = bloomBlockCheckScalar;
+    bloomBlockSet = bloomBlockSetScalar;
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (avx2 && cpuHasFeatures(CPU_FEATURE_AVX2)) {
+        bloomBlockCheck = bloomBlockCheckAVX2;
+        bloomBlockSet = bloomBlockSetAVX2;
+        return 1;
+    }
+#else
+    (void)avx2;
+#endif
+    return 0;
+}
+
+/* --------------------------------- API ------------------------------------ */
+
+/* Create a filter for 'capacity' items with the false positive rate
+ * 'error'. If 'expansion' is zero the filter will refuse new items once
+ * full, otherwise it grows as described in bloom.h. Returns NULL if the
+ * filter would be too large. */
+bloom *bloomNew(uint64_t capacity, double error, uint32_t expansion) {
+    bloom *b = zmalloc(sizeof(*b));
+
+    if (bloomBlockCheck == NULL) bloomSelectKernels(1);
+    b->error = error;
+    b->items = 0;
+    b->expansion = expansion;
+    b->numlayers = 0;
+    b->layers = NULL;
+    if (!bloomAddLayer(b,capacity,error)) {
+        zfree(b);
+        return NULL;
+    }
+    return b;
+}
+
+void bloomFree(bloom *b) {
+    uint32_t j;
+
+    for (j = 0; j < b->numlayers; j++) zfree(b->layers[j].alloc);
+    zfree(b->layers);
+    zfree(b);
+}
+
+bloom *bloomDup(bloom *b) {
+    bloom *d = zmalloc(sizeof(*d));
+    uint32_t j;
+
+    *d = *b;
+    d->layers = zmalloc(sizeof(bloomLayer)*b->numlayers);
+    for (j = 0; j < b->numlayers; j++) {
+        d->layers[j] = b->layers[j];
+        bloomLayerAlloc(d->layers+j);
+        memcpy(d->layers[j].blocks,b->layers[j].blocks,
+               b->layers[j].nblocks*BLOOM_BLOCK_BYTES);
+    }
+    return d;
+}
+
+/* Return 1 if the item with the specified 64 bit hash may have been added
+ * to the filter, 0 if it was certainly not added. */
+int bloomExists(bloom *b, uint64_t hash) {
+    uint32_t j;
+
+    /* The newest layer is the largest one and holds most of the items. */
+    for (j = b->numlayers; j > 0; j--) {
+        bloomLayer *l = b->layers+j-1;
+        uint64_t h = bloomLayerHash(hash,j-1);
+
+        if (bloomBlockCheck(bloomBlock(l,h),(uint32_t)h)) return 1;
+    }
+    return 0;
+}
+
+/* Add the item with the specified 64 bit hash. Returns 1 if the item was
+ * added, 0 if it may already be in the filter (so nothing was done), and
+ * -1 if the filter is full and can't grow. */
+int bloomAdd(bloom *b, uint64_t hash) {
+    bloomLayer *l;
+    uint64_t h;
+
+    if (bloomExists(b,hash)) return 0;
+    l = b->layers+b->numlayers-1;
+    if (l->items >= l->capacity) {
+        uint64_t capacity = l->capacity*b->expansion;
+
+        if (b->expansion == 0 || b->numlayers == BLOOM_MAX_LAYERS ||
+            capacity/b->expansion != l->capacity ||
+            !bloomAddLayer(b,capacity,l->error/2)) return -1;
+        l = b->layers+b->numlayers-1;
+    }
+    h = bloomLayerHash(hash,b->numlayers-1);
+    bloomBlockSet(bloomBlock(l,h),(uint32_t)h);
+    l->items++;
+    b->items++;
+    return 1;
+}
+
+/* Total number of items the filter can hold without adding layers. */
+uint64_t bloomCapacity(bloom *b) {
+    uint64_t capacity = 0;
+    uint32_t j;
+
+    for (j = 0; j < b->numlayers; j++) capacity += b->layers[j].capacity;
+    return capacity;
+}
+
+size_t bloomMemory(bloom *b) {
+    size_t bytes = sizeof(*b)+sizeof(bloomLayer)*b->numlayers;
+    uint32_t j;
+
+    for (j = 0; j < b->numlayers; j++)
+        bytes += b->layers[j].nblocks*BLOOM_BLOCK_BYTES+BLOOM_BLOCK_BYTES-1;
+    return bytes;
+}
+
+/* ---------------------------- Serialization ------------------------------- */
+
+static unsigned char *bloomPutU64(unsigned char *p, uint64_t v) {
+    v = intrev64ifbe(v);
+    memcpy(p,&v,8);
+    return p+8;
+}
+
+static unsigned char *bloomPutDouble(unsigned char *p, double d) {
+    uint64_t v;
+
+    memcpy(&v,&d,8);
+    return bloomPutU64(p,v);
+}
+
+static unsigned char *bloomGetU64(unsigned char *p, uint64_t *v) {
+    memcpy(v,p,8);
+    *v = intrev64ifbe(*v);
+    return p+8;
+}
+
+static unsigned char *bloomGetDouble(unsigned char *p, double *d) {
+    uint64_t v;
+
+    p = bloomGetU64(p,&v);
+    memcpy(d,&v,8);
+    return p;
+}
+
+/* Serialize the filter into a newly allocated buffer, setting 'len' to its
+ * length. See BLOOM_HDR_LEN for the format. */
+unsigned char *bloomSerialize(bloom *b, size_t *len) {
+    size_t bloblen = BLOOM_HDR_LEN;
+    unsigned char *blob, *p;
+    uint32_t u32, j;
+
+    for (j = 0; j < b->numlayers; j++)
+        bloblen += BLOOM_LAYER_HDR_LEN+b->layers[j].nblocks*BLOOM_BLOCK_BYTES;
+    p = blob = zmalloc(bloblen);
+    p = bloomPutDouble(p,b->error);
+    p = bloomPutU64(p,b->items);
+    u32 = intrev32ifbe(b->expansion);
+    memcpy(p,&u32,4); p += 4;
+    u32 = intrev32ifbe(b->numlayers);
+    memcpy(p,&u32,4); p += 4;
+    for (j = 0; j < b->numlayers; j++) {
+        bloomLayer *l = b->layers+j;
+        uint64_t words = l->nblocks*BLOOM_BLOCK_WORDS, k;
+
+        p = bloomPutU64(p,l->capacity);
+        p = bloomPutU64(p,l->items);
+        p = bloomPutU64(p,l->nblocks);
+        p = bloomPutDouble(p,l->error);
+        memcpy(p,l->blocks,words*4);
+        for (k = 0; k < words; k++) memrev32ifbe(p+k*4);
+        p += words*4;
+    }
+    *len = bloblen;
+    return blob;
+}
+
+/* Create a filter from its serialized version. The input is fully
+ * validated, so NULL is returned if it is not a valid serialized filter. */
+bloom *bloomDeserialize(unsigned char *buf, size_t len) {
+    unsigned char *p = buf, *end = buf+len;
+    uint64_t items = 0;
+    uint32_t u32, j;
+    bloom *b;
+
+    if (len < BLOOM_HDR_LEN) return NULL;
+    if (bloomBlockCheck == NULL) bloomSelectKernels(1);
+    b = zmalloc(sizeof(*b));
+    p = bloomGetDouble(p,&b->error);
+    p = bloomGetU64(p,&b->items);
+    memcpy(&u32,p,4); p += 4;
+    b->expansion = intrev32ifbe(u32);
+    memcpy(&u32,p,4); p += 4;
+    u32 = intrev32ifbe(u32);
+    b->numlayers = 0;
+    b->layers = NULL;
+    if (!(b->error > 0 && b->error < 1) || u32 == 0 ||
+        u32 > BLOOM_MAX_LAYERS) goto invalid;
+    b->layers = zmalloc(sizeof(bloomLayer)*u32);
+
+    for (j = 0; j < u32; j++) {
+        bloomLayer *l = b->layers+j;
+        uint64_t words, k;
+
+        if (end-p < BLOOM_LAYER_HDR_LEN) goto invalid;
+        p = bloomGetU64(p,&l->capacity);
+        p = bloomGetU64(p,&l->items);
+        p = bloomGetU64(p,&l->nblocks);
+        p = bloomGetDouble(p,&l->error);
+        if (l->capacity == 0 || l->nblocks == 0 ||
+            l->nblocks > BLOOM_MAX_BLOCKS ||
+            l->nblocks > (uint64_t)(end-p)/BLOOM_BLOCK_BYTES ||
+            !(l->error > 0 && l->error < 1) ||
+            l->items > l->capacity || items+l->items < items) goto invalid;
+        items += l->items;
+        bloomLayerAlloc(l);
+        b->numlayers++;
+        words = l->nblocks*BLOOM_BLOCK_WORDS;
+        memcpy(l->blocks,p,words*4);
+        for (k = 0; k < words; k++) memrev32ifbe(l->blocks+k);
+        p += words*4;
+    }
+    if (p != end || items != b->items) goto invalid;
+    return b;
+
+invalid:
+    bloomFree(b);
+    return NULL;
+}
+
+/* -------------------------------- Tests ----------------------------------- */
+
+#ifdef REDIS_TEST
+#include "testhelp.h"
+
+int bloomTest(int argc, char *argv[]) {
+    int avx2, ok;
+    uint64_t j, fp;
+    unsigned char *blob;
+    size_t bloblen;
+    bloom *b, *d;
+
+    (void)argc;
+    (void)argv;
+
+    avx2 = bloomSelectKernels(1);
+    printf("AVX2 kernels: %s\n", avx2 ? "available" : "not available");
+
+    b = bloomNew(10000,0.01,0);
+    test_cond("Blocks are aligned to the block size",
+        ((uintptr_t)b->layers[0].blocks % BLOOM_BLOCK_BYTES) == 0);
+    ok = 1;
+    for (j = 0; j < 10000; j++)
+        if (bloomAdd(b,test_hash(j)) == -1) ok = 0;
+    test_cond("Adding up to the capacity works", ok && b->numlayers == 1);
+    ok = 1;
+    for (j = 0; j < 10000; j++)
+        if (!bloomExists(b,test_hash(j))) ok = 0;
+    test_cond("No false negatives", ok);
+    fp = 0;
+    for (j = 10000; j < 110000; j++) fp += bloomExists(b,test_hash(j));
+    printf("False positive rate at capacity: %.4f\n", (double)fp/100000);
+    test_cond("False positive rate is close to the target",
+        fp < 100000*0.0125);
+
+    for (j = 10000; j < 20000 && bloomAdd(b,test_hash(j)) != -1; j++);
+    test_cond("Non scaling filter refuses items once full", j < 20000);
+
+    /* The portable and the AVX2 kernels must see the same bits. */
+    if (avx2) {
+        uint64_t found = 0;
+
+        bloomSelectKernels(0);
+        for (j = 0; j < 110000; j++) found += bloomExists(b,test_hash(j));
+        bloomSelectKernels(1);
+        for (j = 0; j < 110000; j++) found -= bloomExists(b,test_hash(j));
+        test_cond("Scalar and AVX2 kernels agree", found == 0);
+    }
+    bloomFree(b);
+
+    b = bloomNew(100,0.01,2);
+    ok = 1;
+    for (j = 0; j < 5000; j++)
+        if (bloomAdd(b,test_hash(j)) == -1) ok = 0;
+    for (j = 0; j < 5000; j++)
+        if (!bloomExists(b,test_hash(j))) ok = 0;
+    test_cond("Scalable filter grows without false negatives",
+        ok && b->numlayers > 1 && bloomCapacity(b) >= b->items);
+    fp = 0;
+    for (j = 5000; j < 105000; j++) fp += bloomExists(b,test_hash(j));
+    printf("False positive rate with %u layers: %.4f\n", b->numlayers,
+        (double)fp/100000);
+    test_cond("False positive rate of the chain stays bounded",
+        fp < 100000*0.02*1.5);
+
+    blob = bloomSerialize(b,&bloblen);
+    d = bloomDeserialize(blob,bloblen);
+    ok = d && d->numlayers == b->numlayers && d->items == b->items;
+    for (j = 0; ok && j < 105000; j++)
+        if (bloomExists(d,test_hash(j)) != bloomExists(b,test_hash(j)))
+            ok = 0;
+    test_cond("Serialize and deserialize", ok);
+    if (d) bloomFree(d);
+    test_cond("Deserialize rejects truncated input",
+        bloomDeserialize(blob,bloblen-1) == NULL);
+    blob[BLOOM_HDR_LEN+8] ^= 1; /* Layer items. */
+    test_cond("Deserialize rejects inconsistent counters",
+        bloomDeserialize(blob,bloblen) == NULL);
+    zfree(blob);
+
+    d = bloomDup(b);
+    ok = 1;
+    for (j = 0; j < 5000; j++)
+        if (!bloomExists(d,test_hash(j))) ok = 0;
+    test_cond("Duplicated filter has the same items", ok);
+    bloomFree(d);
+    bloomFree(b);
+
+    test_cond("Too large filters are refused",
+        bloomNew(1ULL<<40,0.0001,0) == NULL);
+
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BLOOM_H
+#define __BLOOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A blocked (split block) Bloom filter: the bit array is divided into
+ * blocks of 256 bits, each made of eight 32 bit words. An item hashes to a
+ * single block, where it sets exactly one bit in every word. Blocks are 32
+ * bytes aligned, so testing or adding an item touches a single cache line,
+ * and the eight words map directly to the lanes of a 256 bit vector.
+ *
+ * A scalable filter is a chain of such filters (layers). When the last
+ * layer reaches its capacity a new one is added, 'expansion' times larger
+ * and with an error rate half the previous one, so that the false positive
+ * rate of the whole chain stays bounded. */
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BYTES (BLOOM_BLOCK_WORDS*4)
+#define BLOOM_MAX_LAYERS 64
+
+/* Layers are limited to 512MB, the max size of a string value. */
+#define BLOOM_MAX_BLOCKS ((512ULL*1024*1024)/BLOOM_BLOCK_BYTES)
+
+typedef struct bloomLayer {
+    uint64_t capacity;  /* Number of items this layer is sized for. */
+    uint64_t items;     /* Number of items added to this layer. */
+    uint64_t nblocks;   /* Number of blocks. */
+    double error;       /* False positive rate at capacity. */
+    uint32_t *blocks;   /* nblocks*BLOOM_BLOCK_WORDS words, aligned. */
+    void *alloc;        /* Allocation 'blocks' points into. */
+} bloomLayer;
+
+typedef struct bloom {
+    double error;           /* Error rate requested for the filter. */
+    uint64_t items;         /* Items added to all the layers. */
+    uint32_t expansion;     /* Growth factor of new layers, 0 if the
+                               filter is non scaling. */
+    uint32_t numlayers;     /* Number of layers, at least one. */
+    bloomLayer *layers;
+} bloom;
+
+bloom *bloomNew(uint64_t capacity, double error, uint32_t expansion);
+void bloomFree(bloom *b);
+bloom *bloomDup(bloom *b);
+int bloomExists(bloom *b, uint64_t hash);
+int bloomAdd(bloom *b, uint64_t hash);
+uint64_t bloomCapacity(bloom *b);
+size_t bloomMemory(bloom *b);
+unsigned char *bloomSerialize(bloom *b, size_t *len);
+bloom *bloomDeserialize(unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int bloomTest(int argc, char *argv[]);
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+/* Child info: progress and copy-on-write reports of persistence children.
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include <unistd.h>
+
+/* The RDB and AOF children measure the memory they duplicated because of
+ * copy-on-write, reading the private dirty pages from /proc/self/smaps, and
+ * send it to the parent together with their progress and the achieved
+ * write throughput. Reading smaps is not free with large heaps, so the
+ * child sends a report at most once every CHILD_INFO_INTERVAL milliseconds,
+ * plus a final one before exiting.
+ *
+ * Messages are smaller than PIPE_BUF, so every write() is atomic and the
+ * parent always reads whole messages. Both ends of the pipe are non
+ * blocking: the child never waits for the parent, and when the pipe is
+ * full the report is just dropped. */
+
+typedef struct childInfoData {
+    unsigned long long magic;
+    int process_type;
+    int final;              /* Last report, the child is about to exit. */
+    size_t cow_size;        /* Private dirty memory of the child. */
+    long long keys;         /* Keys processed so far. */
+    size_t bytes;           /* Bytes written so far. */
+    long long write_rate;   /* Bytes written per second since the fork. */
+} childInfoData;
+
+/* Child side: progress recorded by childInfoUpdate(). */
+static long long child_keys;
+static size_t child_bytes;
+static mstime_t child_last_report;
+
+/* Open the child info pipe and reset the stats of the current child. It is
+ * called by the parent just before forking a child of type 'ptype'. If the
+ * pipe can't be created the child just runs without sending reports. */
+void openChildInfoPipe(int ptype) {
+    int j;
+
+    closeChildInfoPipe();
+    if (pipe(server.child_info_pipe) == -1) {
+        server.child_info_pipe[0] = server.child_info_pipe[1] = -1;
+    } else if (anetNonBlock(NULL,server.child_info_pipe[0]) != ANET_OK ||
+               anetNonBlock(NULL,server.child_info_pipe[1]) != ANET_OK)
+    {
+        closeChildInfoPipe();
+    }
+    server.child_info_type = ptype;
+    server.child_info_start = ustime();
+    server.stat_current_cow_bytes = 0;
+    server.stat_current_cow_peak = 0;
+    server.stat_current_save_keys_processed = 0;
+    server.stat_current_save_bytes = 0;
+    server.stat_current_save_write_rate = 0;
+    server.stat_current_save_keys_total = 0;
+    for (j = 0; j < server.dbnum; j++)
+        server.stat_current_save_keys_total += dictSize(server.db[j].dict);
+}
+
+/* Close the child info pipe and reset the stats of the current child.
+ * Called by the parent when the child is gone, or if the fork failed. */
+void closeChildInfoPipe(void) {
+    if (server.child_info_pipe[0] != -1) {
+        close(server.child_info_pipe[0]);
+        close(server.child_info_pipe[1]);
+        server.child_info_pipe[0] = server.child_info_pipe[1] = -1;
+    }
+    server.stat_current_cow_bytes = 0;
+    server.stat_current_cow_peak = 0;
+    server.stat_current_save_keys_processed = 0;
+    server.stat_current_save_keys_total = 0;
+    server.stat_current_save_bytes = 0;
+    server.stat_current_save_write_rate = 0;
+}
+
+/* Record the progress of the child, sending a report to the parent if the
+ * last one is older than CHILD_INFO_INTERVAL. Does nothing when called in
+ * the parent process, for instance by SAVE. */
+void childInfoUpdate(long long keys, size_t bytes) {
+    mstime_t now;
+
+    if (!server.in_fork_child) return;
+    child_keys = keys;
+    child_bytes = bytes;
+    now = mstime();
+    if (now-child_last_report >= CHILD_INFO_INTERVAL) {
+        child_last_report = now;
+        sendChildInfo(0);
+    }
+}
+
+/* Send a report to the parent. 'final' is true for the last report, sent
+ * after the child completed its job successfully. Returns the copy-on-write
+ * size so that the child can log it. */
+size_t sendChildInfo(int final) {
+    childInfoData data;
+    long long elapsed = ustime()-server.child_info_start;
+
+    data.magic = CHILD_INFO_MAGIC;
+    data.process_type = server.child_info_type;
+    data.final = final;
+    data.cow_size = zmalloc_get_private_dirty();
+    data.keys = child_keys;
+    data.bytes = child_bytes;
+    data.write_rate = (elapsed > 0) ?
+        (long long)((double)child_bytes*1000000/elapsed) : 0;
+    if (server.child_info_pipe[1] != -1 &&
+        write(server.child_info_pipe[1],&data,sizeof(data)) != sizeof(data))
+    {
+        /* Nothing to do, the parent will just miss this report. */
+    }
+    return data.cow_size;
+}
+
+/* Read the reports sent by the child, updating the stats of the current
+ * child. When the final report is received the copy-on-write peak becomes
+ * the one of the last RDB or AOF child, and is also added to the latency
+ * monitor as the "fork-cow" event, measured in megabytes. */
+void receiveChildInfo(void) {
+    childInfoData data;
+
+    if (server.child_info_pipe[0] == -1) return;
+    while (read(server.child_info_pipe[0],&data,sizeof(data)) == sizeof(data)) {
+        if (data.magic != CHILD_INFO_MAGIC ||
+            data.process_type != server.child_info_type) continue;
+
+        server.stat_current_cow_bytes = data.cow_size;
+        if (data.cow_size > server.stat_current_cow_peak)
+            server.stat_current_cow_peak = data.cow_size;
+        server.stat_current_save_keys_processed = data.keys;
+        server.stat_current_save_bytes = data.bytes;
+        server.stat_current_save_write_rate = data.write_rate;
+        if (!data.final) continue;
+
+        if (server.child_info_type == CHILD_INFO_TYPE_RDB) {
+            server.stat_rdb_cow_bytes = server.stat_current_cow_peak;
+            server.stat_rdb_write_rate = data.write_rate;
+        } else {
+            server.stat_aof_cow_bytes = server.stat_current_cow_peak;
+            server.stat_aof_write_rate = data.write_rate;
+        }
+        if (server.latency_monitor_threshold &&
+            server.stat_current_cow_peak >= 1024*1024)
+        {
+            latencyAddSample("fork-cow",
+                server.stat_current_cow_peak/(1024*1024));
+        }
+    }
+}
@@ -0,0 +1,308 @@
+/* Count-min sketch, the implementation of the count-min sketch type
+ * (see t_sketch.c).
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cms.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+/* Serialized format: 4 bytes width, 4 bytes depth, 8 bytes count, then the
+ * counters, 4 bytes each. All the integers are little endian. */
+#define CMS_HDR_LEN 16
+
+/* ----------------------------- Helpers ------------------------------------ */
+
+/* The counter of row 'row' for the item: the row hash functions are derived
+ * from the two halves of the 64 bit item hash (double hashing), and mapped
+ * to a counter without a division. */
+static inline uint32_t *cmsCounter(cms *s, uint64_t hash, uint32_t row) {
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+    uint32_t h = h1+row*h2;
+
+    return s->counters+(size_t)row*s->width+(((uint64_t)h*s->width) >> 32);
+}
+
+/* --------------------------------- API ------------------------------------ */
+
+/* Create an empty sketch. Returns NULL if the sketch would be too large. */
+cms *cmsNew(uint32_t width, uint32_t depth) {
+    cms *s;
+
+    if (width == 0 || depth == 0 ||
+        (uint64_t)width*depth > CMS_MAX_COUNTERS) return NULL;
+    s = zmalloc(sizeof(*s));
+    s->width = width;
+    s->depth = depth;
+    s->count = 0;
+    s->counters = zcalloc(sizeof(uint32_t)*width*depth);
+    return s;
+}
+
+void cmsFree(cms *s) {
+    zfree(s->counters);
+    zfree(s);
+}
+
+cms *cmsDup(cms *s) {
+    cms *d = cmsNew(s->width,s->depth);
+
+    d->count = s->count;
+    memcpy(d->counters,s->counters,sizeof(uint32_t)*s->width*s->depth);
+    return d;
+}
+
+/* Increment the counters of the item with the specified 64 bit hash by
+ * 'incr', and set 'count' to the new estimate of the item count. Returns 0
+ * without changing the sketch if a counter would overflow. */
+int cmsIncrBy(cms *s, uint64_t hash, uint32_t incr, uint32_t *count) {
+    uint32_t row, min = UINT32_MAX;
+
+    for (row = 0; row < s->depth; row++)
+        if (*cmsCounter(s,hash,row) > UINT32_MAX-incr) return 0;
+    for (row = 0; row < s->depth; row++) {
+        uint32_t *c = cmsCounter(s,hash,row);
+
+        *c += incr;
+        if (*c < min) min = *c;
+    }
+    s->count += incr;
+    if (count) *count = min;
+    return 1;
+}
+
+/* Return the estimated count of the item with the specified hash. */
+uint32_t cmsQuery(cms *s, uint64_t hash) {
+    uint32_t row, min = UINT32_MAX;
+
+    for (row = 0; row < s->depth; row++) {
+        uint32_t c = *cmsCounter(s,hash,row);
+        if (c < min) min = c;
+    }
+    return min;
+}
+
+/* Set the counters of 'dst' to the weighted sum of the counters of the
+ * 'numsrc' sketches in 'src', that must have the same dimensions of 'dst'
+ * ('dst' itself may be one of them). If 'weights' is NULL all the weights
+ * are 1. Returns 0 without changing 'dst' if the dimensions don't match
+ * or if a counter would overflow. */
+int cmsMerge(cms *dst, cms **src, uint32_t *weights, int numsrc) {
+    size_t j, numcounters = (size_t)dst->width*dst->depth;
+    uint32_t *counters;
+    uint64_t count = 0;
+    int k;
+
+    for (k = 0; k < numsrc; k++) {
+        uint64_t w = weights ? weights[k] : 1;
+
+        if (src[k]->width != dst->width || src[k]->depth != dst->depth)
+            return 0;
+        count += src[k]->count*w;
+    }
+    counters = zmalloc(sizeof(uint32_t)*numcounters);
+    for (j = 0; j < numcounters; j++) {
+        uint64_t sum = 0;
+
+        for (k = 0; k < numsrc; k++)
+            sum += (uint64_t)src[k]->counters[j]*(weights ? weights[k] : 1);
+        if (sum > UINT32_MAX) {
+            zfree(counters);
+            return 0;
+        }
+        counters[j] = sum;
+    }
+    zfree(dst->counters);
+    dst->counters = counters;
+    dst->count = count;
+    return 1;
+}
+
+size_t cmsMemory(cms *s) {
+    return sizeof(*s)+sizeof(uint32_t)*s->width*s->depth;
+}
+
+/* ---------------------------- Serialization ------------------------------- */
+
+size_t cmsSerializedLen(cms *s) {
+    return CMS_HDR_LEN+sizeof(uint32_t)*s->width*s->depth;
+}
+
+/* Serialize the sketch at 'p', that must have room for cmsSerializedLen()
+ * bytes. Returns the pointer to the byte after the serialized sketch. */
+unsigned char *cmsSerializeTo(cms *s, unsigned char *p) {
+    size_t j, numcounters = (size_t)s->width*s->depth;
+    uint64_t u64;
+    uint32_t u32;
+
+    u32 = intrev32ifbe(s->width);
+    memcpy(p,&u32,4); p += 4;
+    u32 = intrev32ifbe(s->depth);
+    memcpy(p,&u32,4); p += 4;
+    u64 = intrev64ifbe(s->count);
+    memcpy(p,&u64,8); p += 8;
+    memcpy(p,s->counters,numcounters*4);
+    for (j = 0; j < numcounters; j++) memrev32ifbe(p+j*4);
+    return p+numcounters*4;
+}
+
+/* Load a sketch serialized at '*pp', advancing '*pp' past it. The input is
+ * validated: NULL is returned if it is not a valid serialized sketch. */
+cms *cmsDeserializeFrom(unsigned char **pp, unsigned char *end) {
+    unsigned char *p = *pp;
+    uint32_t width, depth;
+    uint64_t count, total = 0;
+    size_t j, numcounters;
+    cms *s;
+
+    if (end-p < CMS_HDR_LEN) return NULL;
+    memcpy(&width,p,4); p += 4;
+    memcpy(&depth,p,4); p += 4;
+    memcpy(&count,p,8); p += 8;
+    width = intrev32ifbe(width);
+    depth = intrev32ifbe(depth);
+    count = intrev64ifbe(count);
+    if ((s = cmsNew(width,depth)) == NULL) return NULL;
+    numcounters = (size_t)width*depth;
+    if ((size_t)(end-p)/4 < numcounters) goto invalid;
+    s->count = count;
+    memcpy(s->counters,p,numcounters*4);
+    p += numcounters*4;
+    /* Every increment adds to one counter per row, so every row sums to
+     * the total count. */
+    for (j = 0; j < numcounters; j++) {
+        memrev32ifbe(s->counters+j);
+        total += s->counters[j];
+        if ((j+1) % width == 0) {
+            if (total != count) goto invalid;
+            total = 0;
+        }
+    }
+    *pp = p;
+    return s;
+
+invalid:
+    cmsFree(s);
+    return NULL;
+}
+
+/* Serialize the sketch into a newly allocated buffer, setting 'len' to its
+ * length. */
+unsigned char *cmsSerialize(cms *s, size_t *len) {
+    unsigned char *blob;
+
+    *len = cmsSerializedLen(s);
+    blob = zmalloc(*len);
+    cmsSerializeTo(s,blob);
+    return blob;
+}
+
+cms *cmsDeserialize(unsigned char *buf, size_t len) {
+    unsigned char *p = buf;
+    cms *s = cmsDeserializeFrom(&p,buf+len);
+
+    if (s && p != buf+len) {
+        cmsFree(s);
+        return NULL;
+    }
+    return s;
+}
+
+/* -------------------------------- Tests ----------------------------------- */
+
+#ifdef REDIS_TEST
+#include "testhelp.h"
+
+int cmsTest(int argc, char *argv[]) {
+    int ok, over;
+    uint32_t count, weights[2] = {1,3};
+    uint64_t j, real, total = 0;
+    unsigned char *blob;
+    size_t bloblen;
+    cms *s, *d, *src[2];
+
+    (void)argc;
+    (void)argv;
+
+    /* Zipf-like stream: item j is added 10000/(j+1) times. */
+    s = cmsNew(2000,7);
+    for (j = 0; j < 5000; j++) {
+        cmsIncrBy(s,test_hash(j),10000/(j+1)+1,NULL);
+        total += 10000/(j+1)+1;
+    }
+    test_cond("Count is the sum of the increments", s->count == total);
+    ok = 1;
+    over = 0;
+    for (j = 0; j < 5000; j++) {
+        real = 10000/(j+1)+1;
+        count = cmsQuery(s,test_hash(j));
+        if (count < real) ok = 0;
+        if (count > real+total*2/2000) over++;
+    }
+    test_cond("Estimates are never lower than the real count", ok);
+    printf("Estimates over the error bound: %d/5000\n", over);
+    test_cond("Estimates are within the error bound", over < 5000/100);
+
+    test_cond("Increments overflowing a counter are refused",
+        cmsIncrBy(s,test_hash(0),UINT32_MAX,NULL) == 0 &&
+        s->count == total);
+
+    d = cmsNew(2000,7);
+    src[0] = s;
+    src[1] = s;
+    test_cond("Weighted merge",
+        cmsMerge(d,src,weights,2) && d->count == total*4 &&
+        cmsQuery(d,test_hash(1)) == cmsQuery(s,test_hash(1))*4);
+    cmsFree(d);
+    d = cmsNew(1000,7);
+    test_cond("Merging sketches of different size fails",
+        cmsMerge(d,src,NULL,2) == 0);
+    cmsFree(d);
+
+    blob = cmsSerialize(s,&bloblen);
+    d = cmsDeserialize(blob,bloblen);
+    test_cond("Serialize and deserialize",
+        d && d->count == s->count &&
+        !memcmp(d->counters,s->counters,sizeof(uint32_t)*2000*7));
+    if (d) cmsFree(d);
+    test_cond("Deserialize rejects truncated input",
+        cmsDeserialize(blob,bloblen-1) == NULL);
+    blob[CMS_HDR_LEN] ^= 1;
+    test_cond("Deserialize rejects inconsistent counters",
+        cmsDeserialize(blob,bloblen) == NULL);
+    zfree(blob);
+    cmsFree(s);
+
+    test_report();
+    return 0;
+}
+#endif
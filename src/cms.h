@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CMS_H
+#define __CMS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A count-min sketch is a matrix of 'depth' rows of 'width' counters. Every
+ * row uses a different hash function to map an item to one of its counters:
+ * incrementing an item increments one counter per row, and the count of an
+ * item is estimated as the minimum of its counters, that is never lower
+ * than the real count. With width = ceil(2/error) and depth =
+ * ceil(log2(1/probability)) the estimate exceeds the real count by more
+ * than error*total with the specified probability at most.
+ *
+ * Sketches with the same dimensions are merged summing their counters. */
+#define CMS_MAX_COUNTERS ((512ULL*1024*1024)/4)
+
+typedef struct cms {
+    uint32_t width;         /* Counters per row. */
+    uint32_t depth;         /* Number of rows. */
+    uint64_t count;         /* Sum of all the increments. */
+    uint32_t *counters;     /* depth*width counters, row by row. */
+} cms;
+
+cms *cmsNew(uint32_t width, uint32_t depth);
+void cmsFree(cms *s);
+cms *cmsDup(cms *s);
+int cmsIncrBy(cms *s, uint64_t hash, uint32_t incr, uint32_t *count);
+uint32_t cmsQuery(cms *s, uint64_t hash);
+int cmsMerge(cms *dst, cms **src, uint32_t *weights, int numsrc);
+size_t cmsMemory(cms *s);
+size_t cmsSerializedLen(cms *s);
+unsigned char *cmsSerializeTo(cms *s, unsigned char *p);
+cms *cmsDeserializeFrom(unsigned char **pp, unsigned char *end);
+unsigned char *cmsSerialize(cms *s, size_t *len);
+cms *cmsDeserialize(unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int cmsTest(int argc, char *argv[]);
+#endif
+
+#endif
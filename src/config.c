@@ -89,6 +89,33 @@ configEnum aof_fsync_enum[] = {
     {NULL, 0}
 };
 
+configEnum rdb_compression_codec_enum[] = {
+    {"lzf", RDB_CODEC_LZF},
+    {"lz4", RDB_CODEC_LZ4},
+    {"lz4hc", RDB_CODEC_LZ4HC},
+    {NULL, 0}
+};
+
+configEnum child_io_class_enum[] = {
+    {"default", CHILD_IO_CLASS_DEFAULT},
+    {"best-effort", CHILD_IO_CLASS_BEST_EFFORT},
+    {"idle", CHILD_IO_CLASS_IDLE},
+    {NULL, 0}
+};
+
+configEnum repl_diskless_load_enum[] = {
+    {"disabled", REPL_DISKLESS_LOAD_DISABLED},
+    {"on-empty-db", REPL_DISKLESS_LOAD_ON_EMPTY_DB},
+    {"swapdb", REPL_DISKLESS_LOAD_SWAPDB},
+    {NULL, 0}
+};
+
+configEnum zset_large_encoding_enum[] = {
+    {"skiplist", OBJ_ENCODING_SKIPLIST},
+    {"btree", OBJ_ENCODING_BTREE},
+    {NULL, 0}
+};
+
 /* Output buffer limits presets. */
 clientBufferLimitsConfig clientBufferLimitsDefaults[CLIENT_TYPE_OBUF_COUNT] = {
     {0, 0, 0}, /* normal */
@@ -333,6 +360,17 @@ void loadServerConfigFromString(char *config) {
             if ((server.repl_diskless_sync = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"repl-diskless-load") && argc==2) {
+            server.repl_diskless_load =
+                configEnumGetValue(repl_diskless_load_enum,argv[1]);
+            if (server.repl_diskless_load == INT_MIN) {
+                err = "argument must be 'disabled', 'on-empty-db' or 'swapdb'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"repl-forkless-sync") && argc==2) {
+            if ((server.repl_forkless_sync = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"repl-diskless-sync-delay") && argc==2) {
             server.repl_diskless_sync_delay = atoi(argv[1]);
             if (server.repl_diskless_sync_delay < 0) {
@@ -367,10 +405,33 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_compression = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdbcompression-codec") && argc == 2) {
+            server.rdb_compression_codec =
+                configEnumGetValue(rdb_compression_codec_enum,argv[1]);
+            if (server.rdb_compression_codec == INT_MIN) {
+                err = "argument must be 'lzf', 'lz4' or 'lz4hc'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"rdbchecksum") && argc == 2) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-load-threads") && argc == 2) {
+            server.rdb_load_threads = atoi(argv[1]);
+            if (server.rdb_load_threads < 0 ||
+                server.rdb_load_threads > CONFIG_MAX_RDB_LOAD_THREADS)
+            {
+                err = "Invalid number of RDB load threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-delta") && argc == 2) {
+            if ((server.rdb_delta = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-delta-max-chain") && argc == 2) {
+            server.rdb_delta_max_chain = atoi(argv[1]);
+            if (server.rdb_delta_max_chain < 0) {
+                err = "Invalid RDB delta chain length"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"activerehashing") && argc == 2) {
             if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -427,10 +488,26 @@ void loadServerConfigFromString(char *config) {
                  yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"child-max-write-rate") && argc == 2) {
+            server.child_max_write_rate = memtoll(argv[1],NULL);
+            if (server.child_max_write_rate < 0) {
+                err = "Invalid negative child-max-write-rate"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"child-io-class") && argc == 2) {
+            server.child_io_class =
+                configEnumGetValue(child_io_class_enum,argv[1]);
+            if (server.child_io_class == INT_MIN) {
+                err = "argument must be 'default', 'best-effort' or 'idle'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"aof-load-truncated") && argc == 2) {
             if ((server.aof_load_truncated = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"aof-use-rdb-preamble") && argc == 2) {
+            if ((server.aof_use_rdb_preamble = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"requirepass") && argc == 2) {
             if (strlen(argv[1]) > CONFIG_AUTHPASS_MAX_LEN) {
                 err = "Password is longer than CONFIG_AUTHPASS_MAX_LEN";
@@ -465,8 +542,29 @@ void loadServerConfigFromString(char *config) {
             server.zset_max_ziplist_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"zset-max-ziplist-value") && argc == 2) {
             server.zset_max_ziplist_value = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"zset-large-encoding") && argc == 2) {
+            server.zset_large_encoding =
+                configEnumGetValue(zset_large_encoding_enum,argv[1]);
+            if (server.zset_large_encoding == INT_MIN) {
+                err = "argument must be 'skiplist' or 'btree'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"stream-node-max-bytes") && argc == 2) {
+            server.stream_node_max_bytes = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"stream-node-max-entries") &&
+                   argc == 2) {
+            server.stream_node_max_entries = atoi(argv[1]);
         } else if (!strcasecmp(argv[0],"hll-sparse-max-bytes") && argc == 2) {
             server.hll_sparse_max_bytes = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"pfcount-cache-max-memory") &&
+                   argc == 2) {
+            server.pfcount_cache_max_memory = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"string-compress-threshold") &&
+                   argc == 2) {
+            server.string_compress_threshold = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"bitmap-roaring-min-bytes") &&
+                   argc == 2) {
+            server.bitmap_roaring_min_bytes = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"rename-command") && argc == 3) {
             struct redisCommand *cmd = lookupCommand(argv[1]);
             int retval;
@@ -595,7 +693,7 @@ void loadServerConfigFromString(char *config) {
             int flags = keyspaceEventsStringToFlags(argv[1]);
 
             if (flags == -1) {
-                err = "Invalid event class character. Use 'g$lshzxeA'.";
+                err = "Invalid event class character. Use 'g$lshzxetA'.";
                 goto loaderr;
             }
             server.notify_keyspace_events = flags;
@@ -881,12 +979,16 @@ void configSetCommand(client *c) {
       "repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay) {
     } config_set_bool_field(
       "repl-diskless-sync",server.repl_diskless_sync) {
+    } config_set_bool_field(
+      "repl-forkless-sync",server.repl_forkless_sync) {
     } config_set_bool_field(
       "cluster-require-full-coverage",server.cluster_require_full_coverage) {
     } config_set_bool_field(
       "aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync) {
     } config_set_bool_field(
       "aof-load-truncated",server.aof_load_truncated) {
+    } config_set_bool_field(
+      "aof-use-rdb-preamble",server.aof_use_rdb_preamble) {
     } config_set_bool_field(
       "slave-serve-stale-data",server.repl_serve_stale_data) {
     } config_set_bool_field(
@@ -899,6 +1001,9 @@ void configSetCommand(client *c) {
       "stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err) {
     } config_set_bool_field(
       "no-appendfsync-on-rewrite",server.aof_no_fsync_on_rewrite) {
+    } config_set_bool_field(
+      "rdb-delta",server.rdb_delta) {
+        rdbDeltaReset();
 
     /* Numerical fields.
      * config_set_numerical_field(name,var,min,max) */
@@ -924,8 +1029,16 @@ void configSetCommand(client *c) {
       "zset-max-ziplist-entries",server.zset_max_ziplist_entries,0,LLONG_MAX) {
     } config_set_numerical_field(
       "zset-max-ziplist-value",server.zset_max_ziplist_value,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "stream-node-max-bytes",server.stream_node_max_bytes,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "stream-node-max-entries",server.stream_node_max_entries,0,LLONG_MAX) {
     } config_set_numerical_field(
       "hll-sparse-max-bytes",server.hll_sparse_max_bytes,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "string-compress-threshold",server.string_compress_threshold,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "bitmap-roaring-min-bytes",server.bitmap_roaring_min_bytes,0,LLONG_MAX) {
     } config_set_numerical_field(
       "lua-time-limit",server.lua_time_limit,0,LLONG_MAX) {
     } config_set_numerical_field(
@@ -960,6 +1073,10 @@ void configSetCommand(client *c) {
       "cluster-migration-barrier",server.cluster_migration_barrier,0,LLONG_MAX){
     } config_set_numerical_field(
       "cluster-slave-validity-factor",server.cluster_slave_validity_factor,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "rdb-load-threads",server.rdb_load_threads,0,CONFIG_MAX_RDB_LOAD_THREADS) {
+    } config_set_numerical_field(
+      "rdb-delta-max-chain",server.rdb_delta_max_chain,0,INT_MAX) {
     } config_set_numerical_field(
       "hz",server.hz,0,LLONG_MAX) {
         /* Hz is more an hint from the user, so we accept values out of range
@@ -986,6 +1103,11 @@ void configSetCommand(client *c) {
         resizeReplicationBacklog(ll);
     } config_set_memory_field("auto-aof-rewrite-min-size",ll) {
         server.aof_rewrite_min_size = ll;
+    } config_set_memory_field(
+      "child-max-write-rate",server.child_max_write_rate) {
+    } config_set_memory_field(
+      "pfcount-cache-max-memory",server.pfcount_cache_max_memory) {
+        pfcountCacheTrim();
 
     /* Enumeration fields.
      * config_set_enum_field(name,var,enum_var) */
@@ -995,6 +1117,14 @@ void configSetCommand(client *c) {
       "maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum) {
     } config_set_enum_field(
       "appendfsync",server.aof_fsync,aof_fsync_enum) {
+    } config_set_enum_field(
+      "zset-large-encoding",server.zset_large_encoding,zset_large_encoding_enum) {
+    } config_set_enum_field(
+      "rdbcompression-codec",server.rdb_compression_codec,rdb_compression_codec_enum) {
+    } config_set_enum_field(
+      "child-io-class",server.child_io_class,child_io_class_enum) {
+    } config_set_enum_field(
+      "repl-diskless-load",server.repl_diskless_load,repl_diskless_load_enum) {
 
     /* Everyhing else is an error... */
     } config_set_else {
@@ -1075,6 +1205,8 @@ void configGetCommand(client *c) {
             server.aof_rewrite_perc);
     config_get_numerical_field("auto-aof-rewrite-min-size",
             server.aof_rewrite_min_size);
+    config_get_numerical_field("child-max-write-rate",
+            server.child_max_write_rate);
     config_get_numerical_field("hash-max-ziplist-entries",
             server.hash_max_ziplist_entries);
     config_get_numerical_field("hash-max-ziplist-value",
@@ -1089,8 +1221,18 @@ void configGetCommand(client *c) {
             server.zset_max_ziplist_entries);
     config_get_numerical_field("zset-max-ziplist-value",
             server.zset_max_ziplist_value);
+    config_get_numerical_field("stream-node-max-bytes",
+            server.stream_node_max_bytes);
+    config_get_numerical_field("stream-node-max-entries",
+            server.stream_node_max_entries);
     config_get_numerical_field("hll-sparse-max-bytes",
             server.hll_sparse_max_bytes);
+    config_get_numerical_field("pfcount-cache-max-memory",
+            server.pfcount_cache_max_memory);
+    config_get_numerical_field("string-compress-threshold",
+            server.string_compress_threshold);
+    config_get_numerical_field("bitmap-roaring-min-bytes",
+            server.bitmap_roaring_min_bytes);
     config_get_numerical_field("lua-time-limit",server.lua_time_limit);
     config_get_numerical_field("slowlog-log-slower-than",
             server.slowlog_log_slower_than);
@@ -1112,6 +1254,8 @@ void configGetCommand(client *c) {
     config_get_numerical_field("min-slaves-to-write",server.repl_min_slaves_to_write);
     config_get_numerical_field("min-slaves-max-lag",server.repl_min_slaves_max_lag);
     config_get_numerical_field("hz",server.hz);
+    config_get_numerical_field("rdb-load-threads",server.rdb_load_threads);
+    config_get_numerical_field("rdb-delta-max-chain",server.rdb_delta_max_chain);
     config_get_numerical_field("cluster-node-timeout",server.cluster_node_timeout);
     config_get_numerical_field("cluster-migration-barrier",server.cluster_migration_barrier);
     config_get_numerical_field("cluster-slave-validity-factor",server.cluster_slave_validity_factor);
@@ -1132,16 +1276,21 @@ void configGetCommand(client *c) {
     config_get_bool_field("daemonize", server.daemonize);
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
+    config_get_bool_field("rdb-delta", server.rdb_delta);
     config_get_bool_field("activerehashing", server.activerehashing);
     config_get_bool_field("protected-mode", server.protected_mode);
     config_get_bool_field("repl-disable-tcp-nodelay",
             server.repl_disable_tcp_nodelay);
     config_get_bool_field("repl-diskless-sync",
             server.repl_diskless_sync);
+    config_get_bool_field("repl-forkless-sync",
+            server.repl_forkless_sync);
     config_get_bool_field("aof-rewrite-incremental-fsync",
             server.aof_rewrite_incremental_fsync);
     config_get_bool_field("aof-load-truncated",
             server.aof_load_truncated);
+    config_get_bool_field("aof-use-rdb-preamble",
+            server.aof_use_rdb_preamble);
 
     /* Enum values */
     config_get_enum_field("maxmemory-policy",
@@ -1152,6 +1301,14 @@ void configGetCommand(client *c) {
             server.supervised_mode,supervised_mode_enum);
     config_get_enum_field("appendfsync",
             server.aof_fsync,aof_fsync_enum);
+    config_get_enum_field("zset-large-encoding",
+            server.zset_large_encoding,zset_large_encoding_enum);
+    config_get_enum_field("rdbcompression-codec",
+            server.rdb_compression_codec,rdb_compression_codec_enum);
+    config_get_enum_field("child-io-class",
+            server.child_io_class,child_io_class_enum);
+    config_get_enum_field("repl-diskless-load",
+            server.repl_diskless_load,repl_diskless_load_enum);
     config_get_enum_field("syslog-facility",
             server.syslog_facility,syslog_facility_enum);
 
@@ -1797,8 +1954,12 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"databases",server.dbnum,CONFIG_DEFAULT_DBNUM);
     rewriteConfigYesNoOption(state,"stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err,CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR);
     rewriteConfigYesNoOption(state,"rdbcompression",server.rdb_compression,CONFIG_DEFAULT_RDB_COMPRESSION);
+    rewriteConfigEnumOption(state,"rdbcompression-codec",server.rdb_compression_codec,rdb_compression_codec_enum,CONFIG_DEFAULT_RDB_COMPRESSION_CODEC);
     rewriteConfigYesNoOption(state,"rdbchecksum",server.rdb_checksum,CONFIG_DEFAULT_RDB_CHECKSUM);
     rewriteConfigStringOption(state,"dbfilename",server.rdb_filename,CONFIG_DEFAULT_RDB_FILENAME);
+    rewriteConfigNumericalOption(state,"rdb-load-threads",server.rdb_load_threads,CONFIG_DEFAULT_RDB_LOAD_THREADS);
+    rewriteConfigYesNoOption(state,"rdb-delta",server.rdb_delta,CONFIG_DEFAULT_RDB_DELTA);
+    rewriteConfigNumericalOption(state,"rdb-delta-max-chain",server.rdb_delta_max_chain,CONFIG_DEFAULT_RDB_DELTA_MAX_CHAIN);
     rewriteConfigDirOption(state);
     rewriteConfigSlaveofOption(state);
     rewriteConfigStringOption(state,"slave-announce-ip",server.slave_announce_ip,CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP);
@@ -1811,6 +1972,8 @@ int rewriteConfig(char *path) {
     rewriteConfigBytesOption(state,"repl-backlog-ttl",server.repl_backlog_time_limit,CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT);
     rewriteConfigYesNoOption(state,"repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay,CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY);
     rewriteConfigYesNoOption(state,"repl-diskless-sync",server.repl_diskless_sync,CONFIG_DEFAULT_REPL_DISKLESS_SYNC);
+    rewriteConfigYesNoOption(state,"repl-forkless-sync",server.repl_forkless_sync,CONFIG_DEFAULT_REPL_FORKLESS_SYNC);
+    rewriteConfigEnumOption(state,"repl-diskless-load",server.repl_diskless_load,repl_diskless_load_enum,CONFIG_DEFAULT_REPL_DISKLESS_LOAD);
     rewriteConfigNumericalOption(state,"repl-diskless-sync-delay",server.repl_diskless_sync_delay,CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY);
     rewriteConfigNumericalOption(state,"slave-priority",server.slave_priority,CONFIG_DEFAULT_SLAVE_PRIORITY);
     rewriteConfigNumericalOption(state,"min-slaves-to-write",server.repl_min_slaves_to_write,CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE);
@@ -1826,6 +1989,8 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"no-appendfsync-on-rewrite",server.aof_no_fsync_on_rewrite,CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE);
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",server.aof_rewrite_perc,AOF_REWRITE_PERC);
     rewriteConfigBytesOption(state,"auto-aof-rewrite-min-size",server.aof_rewrite_min_size,AOF_REWRITE_MIN_SIZE);
+    rewriteConfigBytesOption(state,"child-max-write-rate",server.child_max_write_rate,CONFIG_DEFAULT_CHILD_MAX_WRITE_RATE);
+    rewriteConfigEnumOption(state,"child-io-class",server.child_io_class,child_io_class_enum,CONFIG_DEFAULT_CHILD_IO_CLASS);
     rewriteConfigNumericalOption(state,"lua-time-limit",server.lua_time_limit,LUA_SCRIPT_TIME_LIMIT);
     rewriteConfigYesNoOption(state,"cluster-enabled",server.cluster_enabled,0);
     rewriteConfigStringOption(state,"cluster-config-file",server.cluster_configfile,CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
@@ -1844,13 +2009,20 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"set-max-intset-entries",server.set_max_intset_entries,OBJ_SET_MAX_INTSET_ENTRIES);
     rewriteConfigNumericalOption(state,"zset-max-ziplist-entries",server.zset_max_ziplist_entries,OBJ_ZSET_MAX_ZIPLIST_ENTRIES);
     rewriteConfigNumericalOption(state,"zset-max-ziplist-value",server.zset_max_ziplist_value,OBJ_ZSET_MAX_ZIPLIST_VALUE);
+    rewriteConfigEnumOption(state,"zset-large-encoding",server.zset_large_encoding,zset_large_encoding_enum,OBJ_ZSET_LARGE_ENCODING);
+    rewriteConfigBytesOption(state,"stream-node-max-bytes",server.stream_node_max_bytes,OBJ_STREAM_NODE_MAX_BYTES);
+    rewriteConfigNumericalOption(state,"stream-node-max-entries",server.stream_node_max_entries,OBJ_STREAM_NODE_MAX_ENTRIES);
     rewriteConfigNumericalOption(state,"hll-sparse-max-bytes",server.hll_sparse_max_bytes,CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES);
+    rewriteConfigBytesOption(state,"pfcount-cache-max-memory",server.pfcount_cache_max_memory,CONFIG_DEFAULT_PFCOUNT_CACHE_MAX_MEMORY);
+    rewriteConfigNumericalOption(state,"string-compress-threshold",server.string_compress_threshold,OBJ_STRING_COMPRESS_THRESHOLD);
+    rewriteConfigNumericalOption(state,"bitmap-roaring-min-bytes",server.bitmap_roaring_min_bytes,OBJ_BITMAP_ROARING_MIN_BYTES);
     rewriteConfigYesNoOption(state,"activerehashing",server.activerehashing,CONFIG_DEFAULT_ACTIVE_REHASHING);
     rewriteConfigYesNoOption(state,"protected-mode",server.protected_mode,CONFIG_DEFAULT_PROTECTED_MODE);
     rewriteConfigClientoutputbufferlimitOption(state);
     rewriteConfigNumericalOption(state,"hz",server.hz,CONFIG_DEFAULT_HZ);
     rewriteConfigYesNoOption(state,"aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync,CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC);
     rewriteConfigYesNoOption(state,"aof-load-truncated",server.aof_load_truncated,CONFIG_DEFAULT_AOF_LOAD_TRUNCATED);
+    rewriteConfigYesNoOption(state,"aof-use-rdb-preamble",server.aof_use_rdb_preamble,CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE);
     rewriteConfigEnumOption(state,"supervised",server.supervised_mode,supervised_mode_enum,SUPERVISED_NONE);
 
     /* Rewrite Sentinel config if in Sentinel mode. */
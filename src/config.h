@@ -66,6 +66,11 @@
 #define HAVE_BACKTRACE 1
 #endif
 
+/* Test for ioprio_set() */
+#ifdef __linux__
+#define HAVE_IOPRIO 1
+#endif
+
 /* MSG_NOSIGNAL. */
 #ifdef __linux__
 #define HAVE_MSG_NOSIGNAL 1
@@ -87,6 +92,14 @@
 #endif
 #endif
 
+/* Test for x86-64 with a compiler able to build functions for a specific
+ * instruction set (target attribute), so that SIMD code paths can be
+ * selected at runtime according to the CPU features. */
+#if defined(__x86_64__) && (defined(__clang__) || \
+    (defined(__GNUC__) && __GNUC__ >= 5))
+#define HAVE_X86_SIMD_DISPATCH 1
+#endif
+
 /* Define aof_fsync to fdatasync() in Linux and fsync() for all the rest */
 #ifdef __linux__
 #define aof_fsync fdatasync
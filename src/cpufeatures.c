@@ -0,0 +1,55 @@
+/* CPU features detection, used to select the SIMD code paths at runtime.
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+#include "cpufeatures.h"
+
+/* Return the CPU_FEATURE_* flags of the instruction set extensions this
+ * CPU supports, among the ones used by the SIMD code paths. The CPU is only
+ * probed by the first call, that main() performs before any thread is
+ * started, so that every module selects its kernels from the same answer. */
+int cpuFeatures(void) {
+    static int features = -1;
+
+    if (features != -1) return features;
+    features = 0;
+#ifdef HAVE_X86_SIMD_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("popcnt")) features |= CPU_FEATURE_POPCNT;
+    if (__builtin_cpu_supports("pclmul")) features |= CPU_FEATURE_PCLMUL;
+    if (__builtin_cpu_supports("bmi2")) features |= CPU_FEATURE_BMI2;
+    if (__builtin_cpu_supports("avx2")) features |= CPU_FEATURE_AVX2;
+    if (__builtin_cpu_supports("avx512f")) features |= CPU_FEATURE_AVX512F;
+    if (__builtin_cpu_supports("avx512bw")) features |= CPU_FEATURE_AVX512BW;
+    if (__builtin_cpu_supports("avx512vbmi"))
+        features |= CPU_FEATURE_AVX512VBMI;
+#endif
+    return features;
+}
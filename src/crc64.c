@@ -38,6 +38,13 @@
  * POSSIBILITY OF SUCH DAMAGE. */
 
 #include <stdint.h>
+#include <string.h>
+#include "crc64.h"
+#include "config.h"
+#include "cpufeatures.h"
+
+/* The polynomial with the bits reflected, like the CRC itself. */
+#define CRC64_POLY UINT64_C(0x95ac9329ac4bc9b5)
 
 static const uint64_t crc64_tab[256] = {
     UINT64_C(0x0000000000000000), UINT64_C(0x7ad870c830358979),
@@ -170,7 +177,25 @@ static const uint64_t crc64_tab[256] = {
     UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
-uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+/* crc64_table[k][b] is the CRC of the byte 'b' followed by 'k' zero bytes,
+ * so that 16 bytes can be processed with independent lookups. Filled by
+ * crc64_init(), until then crc64() processes a byte at a time. */
+static uint64_t crc64_table[16][256];
+
+/* Constants of the carry-less multiplication path: x^k mod P for the
+ * distances data is folded across (see crc64Clmul()). */
+static uint64_t crc64_k127, crc64_k191, crc64_k511, crc64_k575;
+
+static uint64_t crc64Bytewise(uint64_t crc, const unsigned char *s,
+                              uint64_t l);
+static uint64_t (*crc64_impl)(uint64_t crc, const unsigned char *s,
+                              uint64_t l) = crc64Bytewise;
+
+/* ----------------------------- Helpers ------------------------------------ */
+
+static uint64_t crc64Bytewise(uint64_t crc, const unsigned char *s,
+                              uint64_t l)
+{
     uint64_t j;
 
     for (j = 0; j < l; j++) {
@@ -180,16 +205,255 @@ uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
     return crc;
 }
 
+/* Slice-by-16: the CRC is XORed into the first 8 bytes of every 16 bytes
+ * block, then every byte of the block is looked up in the table matching
+ * its distance from the end of the block. */
+static uint64_t crc64Slice16(uint64_t crc, const unsigned char *s,
+                             uint64_t l)
+{
+#if BYTE_ORDER == LITTLE_ENDIAN
+    uint64_t (*t)[256] = crc64_table;
+
+    while (l >= 16) {
+        uint64_t a, b;
+
+        memcpy(&a,s,sizeof(a));
+        memcpy(&b,s+8,sizeof(b));
+        a ^= crc;
+        crc = t[15][a & 0xff] ^ t[14][(a >> 8) & 0xff] ^
+              t[13][(a >> 16) & 0xff] ^ t[12][(a >> 24) & 0xff] ^
+              t[11][(a >> 32) & 0xff] ^ t[10][(a >> 40) & 0xff] ^
+              t[9][(a >> 48) & 0xff] ^ t[8][a >> 56] ^
+              t[7][b & 0xff] ^ t[6][(b >> 8) & 0xff] ^
+              t[5][(b >> 16) & 0xff] ^ t[4][(b >> 24) & 0xff] ^
+              t[3][(b >> 32) & 0xff] ^ t[2][(b >> 40) & 0xff] ^
+              t[1][(b >> 48) & 0xff] ^ t[0][b >> 56];
+        s += 16;
+        l -= 16;
+    }
+#endif
+    return crc64Bytewise(crc,s,l);
+}
+
+/* Multiply the polynomials 'a' and 'b' modulo P. Like the CRC they are
+ * reflected: the most significant bit is the coefficient of x^0. */
+static uint64_t crc64MulModP(uint64_t a, uint64_t b) {
+    uint64_t m = (uint64_t)1 << 63, p = 0;
+
+    if (a == 0) return 0;
+    while (1) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m-1)) == 0) break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC64_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* x^n mod P, reflected. */
+static uint64_t crc64XPowModP(uint64_t n) {
+    uint64_t p = (uint64_t)1 << 63, sq = (uint64_t)1 << 62;
+
+    while (n) {
+        if (n & 1) p = crc64MulModP(sq,p);
+        sq = crc64MulModP(sq,sq);
+        n >>= 1;
+    }
+    return p;
+}
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+#include <immintrin.h>
+
+/* Multiply the two halves of 'x' by the two constants of 'k' and add the
+ * products. */
+__attribute__((target("pclmul,sse2")))
+static inline __m128i crc64Fold(__m128i x, __m128i k) {
+    return _mm_xor_si128(_mm_clmulepi64_si128(x,k,0x00),
+                         _mm_clmulepi64_si128(x,k,0x11));
+}
+
+/* Folding with carry-less multiplications. A 16 bytes block is the
+ * polynomial H*x^64 + L, where H is the first half (low quadword, since
+ * the data is reflected). Moving it 'd' bytes forward in the stream
+ * multiplies it by x^(8d), and H*x^(8d+64) + L*x^(8d) mod P fits again in
+ * 16 bytes, that are XORed with the data found there. The constants lack
+ * a factor of x because the product of two reflected 64 bits values comes
+ * out shifted by one bit.
+ *
+ * Four blocks are folded 64 bytes at a time to hide the multiplication
+ * latency, then combined, and the last block is reduced by the tables. */
+__attribute__((target("pclmul,sse2")))
+static uint64_t crc64Clmul(uint64_t crc, const unsigned char *s, uint64_t l) {
+    __m128i k64, k16, x0, x1, x2, x3;
+    unsigned char last[16];
+
+    if (l < 64) return crc64Slice16(crc,s,l);
+    k64 = _mm_set_epi64x(crc64_k511,crc64_k575);
+    k16 = _mm_set_epi64x(crc64_k127,crc64_k191);
+    x0 = _mm_loadu_si128((const __m128i*)s);
+    x0 = _mm_xor_si128(x0,_mm_cvtsi64_si128(crc));
+    x1 = _mm_loadu_si128((const __m128i*)(s+16));
+    x2 = _mm_loadu_si128((const __m128i*)(s+32));
+    x3 = _mm_loadu_si128((const __m128i*)(s+48));
+    s += 64;
+    l -= 64;
+    while (l >= 64) {
+        x0 = _mm_xor_si128(crc64Fold(x0,k64),
+                           _mm_loadu_si128((const __m128i*)s));
+        x1 = _mm_xor_si128(crc64Fold(x1,k64),
+                           _mm_loadu_si128((const __m128i*)(s+16)));
+        x2 = _mm_xor_si128(crc64Fold(x2,k64),
+                           _mm_loadu_si128((const __m128i*)(s+32)));
+        x3 = _mm_xor_si128(crc64Fold(x3,k64),
+                           _mm_loadu_si128((const __m128i*)(s+48)));
+        s += 64;
+        l -= 64;
+    }
+    x0 = _mm_xor_si128(crc64Fold(x0,k16),x1);
+    x0 = _mm_xor_si128(crc64Fold(x0,k16),x2);
+    x0 = _mm_xor_si128(crc64Fold(x0,k16),x3);
+    while (l >= 16) {
+        x0 = _mm_xor_si128(crc64Fold(x0,k16),
+                           _mm_loadu_si128((const __m128i*)s));
+        s += 16;
+        l -= 16;
+    }
+    _mm_storeu_si128((__m128i*)last,x0);
+    crc = crc64Slice16(0,last,16);
+    return crc64Slice16(crc,s,l);
+}
+#endif /* HAVE_X86_SIMD_DISPATCH */
+
+/* Use the carry-less multiplication path if 'clmul' is true and the CPU
+ * supports it, otherwise slice-by-16. Returns 1 if the former is used. */
+static int crc64SelectImpl(int clmul) {
+    crc64_impl = crc64Slice16;
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (clmul && cpuHasFeatures(CPU_FEATURE_PCLMUL)) {
+        crc64_impl = crc64Clmul;
+        return 1;
+    }
+#else
+    (void)clmul;
+#endif
+    return 0;
+}
+
+/* --------------------------------- API ------------------------------------ */
+
+/* Build the tables and select the fastest implementation. Must be called
+ * before any thread is started. */
+void crc64_init(void) {
+    int j, k;
+
+    for (j = 0; j < 256; j++) {
+        crc64_table[0][j] = crc64_tab[j];
+        for (k = 1; k < 16; k++) {
+            uint64_t c = crc64_table[k-1][j];
+            crc64_table[k][j] = crc64_tab[c & 0xff] ^ (c >> 8);
+        }
+    }
+    crc64_k127 = crc64XPowModP(127);
+    crc64_k191 = crc64XPowModP(191);
+    crc64_k511 = crc64XPowModP(511);
+    crc64_k575 = crc64XPowModP(575);
+    crc64SelectImpl(1);
+}
+
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+    return crc64_impl(crc,s,l);
+}
+
+/* Return the CRC of the concatenation of A and B, given the CRC 'crc1' of A
+ * and the CRC 'crc2' of B, that is 'len2' bytes long. Since the CRC has no
+ * initial or final XOR this is just crc1*x^(8*len2) + crc2 mod P, so parts
+ * of a buffer can be checksummed in parallel and then combined. */
+uint64_t crc64_combine(uint64_t crc1, uint64_t crc2, uint64_t len2) {
+    return crc64MulModP(crc64XPowModP(len2*8),crc1) ^ crc2;
+}
+
 /* Test main */
 #ifdef REDIS_TEST
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "zmalloc.h"
+#include "testhelp.h"
 
 #define UNUSED(x) (void)(x)
+
+static long long crc64TestUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (long long)tv.tv_sec*1000000+tv.tv_usec;
+}
+
+static void crc64TestBench(const char *name,
+    uint64_t (*impl)(uint64_t, const unsigned char *, uint64_t),
+    unsigned char *buf, uint64_t len)
+{
+    long long start = crc64TestUstime(), elapsed;
+    uint64_t crc = impl(0,buf,len);
+
+    elapsed = crc64TestUstime()-start;
+    printf("%-10s %016llx %8.1f MB/s\n", name, (unsigned long long)crc,
+        elapsed ? (double)len/elapsed : 0);
+}
+
 int crc64Test(int argc, char *argv[]) {
+    uint64_t len = 64*1024*1024, j, a, b, expected;
+    unsigned char *buf = zmalloc(len);
+    int clmul;
+
     UNUSED(argc);
     UNUSED(argv);
+    crc64_init();
     printf("e9c6d914c4b8d9ca == %016llx\n",
         (unsigned long long) crc64(0,(unsigned char*)"123456789",9));
+    test_cond("crc64 of \"123456789\"",
+        crc64(0,(unsigned char*)"123456789",9) == UINT64_C(0xe9c6d914c4b8d9ca));
+
+    srand(1234);
+    for (j = 0; j < len; j++) buf[j] = rand();
+
+    /* Every implementation must match the byte at a time one, for every
+     * length and alignment. */
+    for (clmul = 0; clmul < 2; clmul++) {
+        int ok = 1;
+
+        if (clmul && !crc64SelectImpl(1)) break;
+        if (!clmul) crc64SelectImpl(0);
+        for (a = 0; a < 32; a++) {
+            for (b = 0; b < 600; b++) {
+                expected = crc64Bytewise(a,buf+a,b);
+                if (crc64(a,buf+a,b) != expected) ok = 0;
+            }
+        }
+        test_cond(clmul ? "clmul matches the reference" :
+                          "slice-by-16 matches the reference", ok);
+    }
+    crc64SelectImpl(1);
+
+    expected = crc64Bytewise(0,buf,100000);
+    a = crc64(0,buf,33333);
+    b = crc64(0,buf+33333,100000-33333);
+    j = crc64_combine(a,b,100000-33333) == expected &&
+        crc64_combine(expected,0,0) == expected &&
+        crc64_combine(0,expected,100000) == expected;
+    test_cond("crc64_combine",j);
+
+    crc64TestBench("bytewise",crc64Bytewise,buf,len);
+    crc64TestBench("slice16",crc64Slice16,buf,len);
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (cpuHasFeatures(CPU_FEATURE_PCLMUL))
+        crc64TestBench("clmul",crc64Clmul,buf,len);
+#endif
+    zfree(buf);
+    test_report();
     return 0;
 }
 #endif
@@ -0,0 +1,534 @@
+/* Scalable cuckoo filters with 16 bit fingerprints, the implementation of
+ * the cuckoo filter type (see t_bloom.c).
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cuckoo.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+/* Serialized format: 8 bytes number of items, 8 bytes number of deleted
+ * items, 4 bytes expansion, 4 bytes max iterations, 4 bytes number of
+ * layers, then for every layer 8 bytes number of buckets, 8 bytes number
+ * of items, followed by the buckets as 64 bit words. All the integers are
+ * little endian. */
+#define CUCKOO_HDR_LEN 28
+#define CUCKOO_LAYER_HDR_LEN 16
+
+#define CUCKOO_LO 0x0001000100010001ULL
+#define CUCKOO_HI 0x8000800080008000ULL
+
+/* ----------------------------- Helpers ------------------------------------ */
+
+/* The fingerprint is taken from the high bits of the hash, the bucket from
+ * the low bits, so they are independent. Zero means empty slot, so it is
+ * never used as a fingerprint. */
+static inline uint16_t cuckooFingerprint(uint64_t hash) {
+    uint16_t fp = hash >> 48;
+    return fp ? fp : 1;
+}
+
+/* The alternate bucket of a fingerprint: applying it twice gives back the
+ * original bucket, since the number of buckets is a power of two. */
+static inline uint64_t cuckooAltBucket(cuckooLayer *l, uint64_t i,
+                                       uint16_t fp)
+{
+    return (i ^ ((uint64_t)fp*0x5bd1e995)) & (l->nbuckets-1);
+}
+
+/* Return a mask with the high bit of every slot of 'bucket' holding 'fp'
+ * set. Only the lowest bit of the mask is exact, since a borrow may set the
+ * bits of the next slots, but the mask is zero only if no slot matches. */
+static inline uint64_t cuckooBucketMatch(uint64_t bucket, uint16_t fp) {
+    uint64_t x = bucket ^ (CUCKOO_LO*fp);
+    return (x - CUCKOO_LO) & ~x & CUCKOO_HI;
+}
+
+/* Return the first slot of 'bucket' holding 'fp', or -1. */
+static inline int cuckooBucketFind(uint64_t bucket, uint16_t fp) {
+    uint64_t m = cuckooBucketMatch(bucket,fp);
+    return m ? __builtin_ctzll(m) >> 4 : -1;
+}
+
+static inline uint16_t cuckooSlotGet(uint64_t *bucket, int slot) {
+    return (*bucket >> (slot*16)) & 0xffff;
+}
+
+static inline void cuckooSlotSet(uint64_t *bucket, int slot, uint16_t fp) {
+    *bucket &= ~(0xffffULL << (slot*16));
+    *bucket |= (uint64_t)fp << (slot*16);
+}
+
+/* Store 'fp' in a free slot of the bucket. Returns 0 if the bucket is full. */
+static int cuckooBucketInsert(uint64_t *bucket, uint16_t fp) {
+    int slot = cuckooBucketFind(*bucket,0);
+
+    if (slot == -1) return 0;
+    cuckooSlotSet(bucket,slot,fp);
+    return 1;
+}
+
+static int cuckooAddLayer(cuckoo *cf, uint64_t nbuckets) {
+    cuckooLayer *l;
+
+    if (nbuckets > CUCKOO_MAX_BUCKETS) return 0;
+    cf->layers = zrealloc(cf->layers,sizeof(cuckooLayer)*(cf->numlayers+1));
+    l = cf->layers+cf->numlayers;
+    l->nbuckets = nbuckets;
+    l->items = 0;
+    l->buckets = zcalloc(sizeof(uint64_t)*nbuckets);
+    cf->numlayers++;
+    return 1;
+}
+
+/* Store the fingerprint in the layer relocating up to 'maxiterations'
+ * other fingerprints. The relocations only depend on the content of the
+ * filter and on the hash, so that replicas and the AOF reach the same
+ * state. If no place is found the relocations are undone, so that no
+ * fingerprint is lost, and 0 is returned. */
+static int cuckooLayerKick(cuckoo *cf, cuckooLayer *l, uint64_t hash,
+                           uint64_t i, uint16_t fp)
+{
+    struct { uint64_t bucket; int slot; } *path;
+    uint64_t rnd = hash;
+    uint32_t n, j;
+
+    if (cf->maxiterations == 0) return 0;
+    path = zmalloc(sizeof(*path)*cf->maxiterations);
+    for (n = 0; n < cf->maxiterations; n++) {
+        uint16_t victim;
+
+        rnd = rnd*6364136223846793005ULL+1442695040888963407ULL;
+        path[n].bucket = i;
+        path[n].slot = rnd >> 62;
+        victim = cuckooSlotGet(l->buckets+i,path[n].slot);
+        cuckooSlotSet(l->buckets+i,path[n].slot,fp);
+        fp = victim;
+        i = cuckooAltBucket(l,i,fp);
+        if (cuckooBucketInsert(l->buckets+i,fp)) {
+            zfree(path);
+            return 1;
+        }
+    }
+    /* Swap back in reverse order. */
+    for (j = n; j > 0; j--) {
+        uint64_t *bucket = l->buckets+path[j-1].bucket;
+        uint16_t victim = cuckooSlotGet(bucket,path[j-1].slot);
+
+        cuckooSlotSet(bucket,path[j-1].slot,fp);
+        fp = victim;
+    }
+    zfree(path);
+    return 0;
+}
+
+/* --------------------------------- API ------------------------------------ */
+
+/* Create a filter able to hold about 'capacity' items. See cuckoo.h for
+ * the meaning of 'expansion'. Returns NULL if the filter would be too
+ * large. */
+cuckoo *cuckooNew(uint64_t capacity, uint32_t expansion,
+                  uint32_t maxiterations)
+{
+    cuckoo *cf = zmalloc(sizeof(*cf));
+    uint64_t nbuckets = 1;
+
+    while (nbuckets*CUCKOO_BUCKET_SLOTS < capacity &&
+           nbuckets <= CUCKOO_MAX_BUCKETS) nbuckets <<= 1;
+    cf->items = 0;
+    cf->deleted = 0;
+    cf->expansion = expansion;
+    cf->maxiterations = maxiterations;
+    cf->numlayers = 0;
+    cf->layers = NULL;
+    if (!cuckooAddLayer(cf,nbuckets)) {
+        zfree(cf);
+        return NULL;
+    }
+    return cf;
+}
+
+void cuckooFree(cuckoo *cf) {
+    uint32_t j;
+
+    for (j = 0; j < cf->numlayers; j++) zfree(cf->layers[j].buckets);
+    zfree(cf->layers);
+    zfree(cf);
+}
+
+cuckoo *cuckooDup(cuckoo *cf) {
+    cuckoo *d = zmalloc(sizeof(*d));
+    uint32_t j;
+
+    *d = *cf;
+    d->layers = zmalloc(sizeof(cuckooLayer)*cf->numlayers);
+    for (j = 0; j < cf->numlayers; j++) {
+        size_t bytes = sizeof(uint64_t)*cf->layers[j].nbuckets;
+
+        d->layers[j] = cf->layers[j];
+        d->layers[j].buckets = zmalloc(bytes);
+        memcpy(d->layers[j].buckets,cf->layers[j].buckets,bytes);
+    }
+    return d;
+}
+
+/* Add the item with the specified 64 bit hash. The same item can be added
+ * multiple times. Returns 1 on success, or -1 if the filter is full and
+ * can't grow. */
+int cuckooAdd(cuckoo *cf, uint64_t hash) {
+    uint16_t fp = cuckooFingerprint(hash);
+    cuckooLayer *l;
+    uint64_t i1, nbuckets;
+    uint32_t j;
+
+    /* Use a free slot in any layer if possible, so that space freed by
+     * deletions in older layers is reused. */
+    for (j = 0; j < cf->numlayers; j++) {
+        l = cf->layers+j;
+        i1 = hash & (l->nbuckets-1);
+        if (cuckooBucketInsert(l->buckets+i1,fp) ||
+            cuckooBucketInsert(l->buckets+cuckooAltBucket(l,i1,fp),fp))
+            goto added;
+    }
+
+    /* Relocate fingerprints in the newest layer, starting from one of the
+     * two buckets. */
+    l = cf->layers+cf->numlayers-1;
+    i1 = hash & (l->nbuckets-1);
+    if ((hash >> 32) & 1) i1 = cuckooAltBucket(l,i1,fp);
+    if (cuckooLayerKick(cf,l,hash,i1,fp)) goto added;
+
+    /* Grow: the new layer is empty, so the first bucket has room. */
+    nbuckets = l->nbuckets*cf->expansion;
+    if (cf->expansion == 0 || cf->numlayers == CUCKOO_MAX_LAYERS ||
+        nbuckets/cf->expansion != l->nbuckets) return -1;
+    while (nbuckets & (nbuckets-1)) nbuckets &= nbuckets-1;
+    if (!cuckooAddLayer(cf,nbuckets)) return -1;
+    l = cf->layers+cf->numlayers-1;
+    cuckooBucketInsert(l->buckets+(hash & (l->nbuckets-1)),fp);
+
+added:
+    l->items++;
+    cf->items++;
+    return 1;
+}
+
+/* Return the number of times the item with the specified hash may have been
+ * added (and not deleted). Like the membership test, this is an upper
+ * bound, because of fingerprint collisions. */
+uint64_t cuckooCount(cuckoo *cf, uint64_t hash) {
+    uint16_t fp = cuckooFingerprint(hash);
+    uint64_t count = 0;
+    uint32_t j;
+    int s;
+
+    for (j = 0; j < cf->numlayers; j++) {
+        cuckooLayer *l = cf->layers+j;
+        uint64_t i1 = hash & (l->nbuckets-1);
+        uint64_t i2 = cuckooAltBucket(l,i1,fp);
+
+        for (s = 0; s < CUCKOO_BUCKET_SLOTS; s++) {
+            if (cuckooSlotGet(l->buckets+i1,s) == fp) count++;
+            if (i2 != i1 && cuckooSlotGet(l->buckets+i2,s) == fp) count++;
+        }
+    }
+    return count;
+}
+
+/* Return 1 if the item with the specified hash may be in the filter, 0 if
+ * it is certainly not. */
+int cuckooExists(cuckoo *cf, uint64_t hash) {
+    uint16_t fp = cuckooFingerprint(hash);
+    uint32_t j;
+
+    for (j = cf->numlayers; j > 0; j--) {
+        cuckooLayer *l = cf->layers+j-1;
+        uint64_t i1 = hash & (l->nbuckets-1);
+
+        if (cuckooBucketMatch(l->buckets[i1],fp) ||
+            cuckooBucketMatch(l->buckets[cuckooAltBucket(l,i1,fp)],fp))
+            return 1;
+    }
+    return 0;
+}
+
+/* Remove one copy of the item with the specified hash. Returns 1 if a
+ * fingerprint was removed, 0 if the item is not in the filter. Deleting an
+ * item that was never added may remove the fingerprint of another item. */
+int cuckooDelete(cuckoo *cf, uint64_t hash) {
+    uint16_t fp = cuckooFingerprint(hash);
+    uint32_t j;
+
+    for (j = cf->numlayers; j > 0; j--) {
+        cuckooLayer *l = cf->layers+j-1;
+        uint64_t i[2];
+        int k, slot;
+
+        i[0] = hash & (l->nbuckets-1);
+        i[1] = cuckooAltBucket(l,i[0],fp);
+        for (k = 0; k < 2; k++) {
+            if ((slot = cuckooBucketFind(l->buckets[i[k]],fp)) == -1)
+                continue;
+            cuckooSlotSet(l->buckets+i[k],slot,0);
+            l->items--;
+            cf->items--;
+            cf->deleted++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Total number of buckets of all the layers. */
+uint64_t cuckooBuckets(cuckoo *cf) {
+    uint64_t nbuckets = 0;
+    uint32_t j;
+
+    for (j = 0; j < cf->numlayers; j++) nbuckets += cf->layers[j].nbuckets;
+    return nbuckets;
+}
+
+size_t cuckooMemory(cuckoo *cf) {
+    return sizeof(*cf)+sizeof(cuckooLayer)*cf->numlayers+
+           sizeof(uint64_t)*cuckooBuckets(cf);
+}
+
+/* ---------------------------- Serialization ------------------------------- */
+
+/* Serialize the filter into a newly allocated buffer, setting 'len' to its
+ * length. See CUCKOO_HDR_LEN for the format. */
+unsigned char *cuckooSerialize(cuckoo *cf, size_t *len) {
+    size_t bloblen = CUCKOO_HDR_LEN;
+    unsigned char *blob, *p;
+    uint64_t u64, k;
+    uint32_t u32, j;
+
+    for (j = 0; j < cf->numlayers; j++)
+        bloblen += CUCKOO_LAYER_HDR_LEN+cf->layers[j].nbuckets*8;
+    p = blob = zmalloc(bloblen);
+    u64 = intrev64ifbe(cf->items);
+    memcpy(p,&u64,8); p += 8;
+    u64 = intrev64ifbe(cf->deleted);
+    memcpy(p,&u64,8); p += 8;
+    u32 = intrev32ifbe(cf->expansion);
+    memcpy(p,&u32,4); p += 4;
+    u32 = intrev32ifbe(cf->maxiterations);
+    memcpy(p,&u32,4); p += 4;
+    u32 = intrev32ifbe(cf->numlayers);
+    memcpy(p,&u32,4); p += 4;
+    for (j = 0; j < cf->numlayers; j++) {
+        cuckooLayer *l = cf->layers+j;
+
+        u64 = intrev64ifbe(l->nbuckets);
+        memcpy(p,&u64,8); p += 8;
+        u64 = intrev64ifbe(l->items);
+        memcpy(p,&u64,8); p += 8;
+        memcpy(p,l->buckets,l->nbuckets*8);
+        for (k = 0; k < l->nbuckets; k++) memrev64ifbe(p+k*8);
+        p += l->nbuckets*8;
+    }
+    *len = bloblen;
+    return blob;
+}
+
+/* Create a filter from its serialized version. The input is fully
+ * validated, so NULL is returned if it is not a valid serialized filter. */
+cuckoo *cuckooDeserialize(unsigned char *buf, size_t len) {
+    unsigned char *p = buf, *end = buf+len;
+    uint64_t items = 0, u64, k;
+    uint32_t numlayers, j;
+    cuckoo *cf;
+
+    if (len < CUCKOO_HDR_LEN) return NULL;
+    cf = zmalloc(sizeof(*cf));
+    memcpy(&u64,p,8); p += 8;
+    cf->items = intrev64ifbe(u64);
+    memcpy(&u64,p,8); p += 8;
+    cf->deleted = intrev64ifbe(u64);
+    memcpy(&cf->expansion,p,4); p += 4;
+    cf->expansion = intrev32ifbe(cf->expansion);
+    memcpy(&cf->maxiterations,p,4); p += 4;
+    cf->maxiterations = intrev32ifbe(cf->maxiterations);
+    memcpy(&numlayers,p,4); p += 4;
+    numlayers = intrev32ifbe(numlayers);
+    cf->numlayers = 0;
+    cf->layers = NULL;
+    if (numlayers == 0 || numlayers > CUCKOO_MAX_LAYERS) goto invalid;
+    cf->layers = zmalloc(sizeof(cuckooLayer)*numlayers);
+
+    for (j = 0; j < numlayers; j++) {
+        cuckooLayer *l = cf->layers+j;
+
+        if (end-p < CUCKOO_LAYER_HDR_LEN) goto invalid;
+        memcpy(&u64,p,8); p += 8;
+        l->nbuckets = intrev64ifbe(u64);
+        memcpy(&u64,p,8); p += 8;
+        l->items = intrev64ifbe(u64);
+        if (l->nbuckets == 0 || (l->nbuckets & (l->nbuckets-1)) ||
+            l->nbuckets > CUCKOO_MAX_BUCKETS ||
+            l->nbuckets > (uint64_t)(end-p)/8 ||
+            l->items > l->nbuckets*CUCKOO_BUCKET_SLOTS) goto invalid;
+        items += l->items;
+        l->buckets = zmalloc(l->nbuckets*8);
+        cf->numlayers++;
+        memcpy(l->buckets,p,l->nbuckets*8);
+        for (k = 0; k < l->nbuckets; k++) memrev64ifbe(l->buckets+k);
+        p += l->nbuckets*8;
+    }
+    if (p != end || items != cf->items) goto invalid;
+    return cf;
+
+invalid:
+    cuckooFree(cf);
+    return NULL;
+}
+
+/* -------------------------------- Tests ----------------------------------- */
+
+#ifdef REDIS_TEST
+#include "testhelp.h"
+
+/* Count the fingerprints actually stored in the filter. */
+static uint64_t cuckooTestStored(cuckoo *cf) {
+    uint64_t count = 0, k;
+    uint32_t j;
+    int s;
+
+    for (j = 0; j < cf->numlayers; j++)
+        for (k = 0; k < cf->layers[j].nbuckets; k++)
+            for (s = 0; s < CUCKOO_BUCKET_SLOTS; s++)
+                count += cuckooSlotGet(cf->layers[j].buckets+k,s) != 0;
+    return count;
+}
+
+int cuckooTest(int argc, char *argv[]) {
+    int ok;
+    uint64_t j, fp, added;
+    unsigned char *blob;
+    size_t bloblen;
+    cuckoo *cf, *d;
+
+    (void)argc;
+    (void)argv;
+
+    ok = 1;
+    for (j = 0; j < 100000; j++) {
+        uint64_t bucket = test_hash(j);
+        uint16_t f = cuckooFingerprint(test_hash(j+1)), s;
+        int expected = -1;
+
+        for (s = 0; s < CUCKOO_BUCKET_SLOTS; s++) {
+            if (cuckooSlotGet(&bucket,s) == f) {
+                expected = s;
+                break;
+            }
+        }
+        if (j % 7 == 0) {
+            expected = j % 4;
+            cuckooSlotSet(&bucket,expected,f);
+            for (s = 0; s < (uint16_t)expected; s++)
+                if (cuckooSlotGet(&bucket,s) == f) expected = s;
+        }
+        if (cuckooBucketFind(bucket,f) != expected) ok = 0;
+    }
+    test_cond("Bucket search finds the first matching slot", ok);
+
+    cf = cuckooNew(10000,0,500);
+    added = 0;
+    while (cuckooAdd(cf,test_hash(added)) == 1) added++;
+    printf("Load factor of a non scaling filter: %.3f\n",
+        (double)added/(cuckooBuckets(cf)*CUCKOO_BUCKET_SLOTS));
+    test_cond("Non scaling filter is filled above 90%",
+        added > cuckooBuckets(cf)*CUCKOO_BUCKET_SLOTS*0.9);
+    ok = 1;
+    for (j = 0; j < added; j++)
+        if (!cuckooExists(cf,test_hash(j))) ok = 0;
+    test_cond("Failed insertions don't lose fingerprints",
+        ok && cuckooTestStored(cf) == added && cf->items == added);
+    fp = 0;
+    for (j = added+1; j < added+100001; j++)
+        fp += cuckooExists(cf,test_hash(j));
+    printf("False positive rate when full: %.5f\n", (double)fp/100000);
+    test_cond("False positive rate is low", fp < 100000*0.001);
+
+    ok = 1;
+    for (j = 0; j < added; j += 2)
+        if (!cuckooDelete(cf,test_hash(j))) ok = 0;
+    for (j = 1; j < added; j += 2)
+        if (!cuckooExists(cf,test_hash(j))) ok = 0;
+    test_cond("Deleting items keeps the other ones",
+        ok && cf->items == added/2 && cuckooTestStored(cf) == added/2);
+    cuckooFree(cf);
+
+    cf = cuckooNew(1000,2,20);
+    for (j = 0; j < 3; j++) cuckooAdd(cf,test_hash(0));
+    test_cond("Count of an item added multiple times",
+        cuckooCount(cf,test_hash(0)) == 3);
+    cuckooDelete(cf,test_hash(0));
+    test_cond("Delete removes a single copy",
+        cuckooCount(cf,test_hash(0)) == 2);
+    ok = 1;
+    for (j = 1; j < 20000; j++)
+        if (cuckooAdd(cf,test_hash(j)) != 1) ok = 0;
+    for (j = 1; j < 20000; j++)
+        if (!cuckooExists(cf,test_hash(j))) ok = 0;
+    test_cond("Scalable filter grows without false negatives",
+        ok && cf->numlayers > 1 && cuckooTestStored(cf) == cf->items);
+
+    blob = cuckooSerialize(cf,&bloblen);
+    d = cuckooDeserialize(blob,bloblen);
+    ok = d && d->numlayers == cf->numlayers && d->items == cf->items &&
+         d->deleted == cf->deleted;
+    for (j = 0; ok && j < d->numlayers; j++)
+        if (memcmp(d->layers[j].buckets,cf->layers[j].buckets,
+                   d->layers[j].nbuckets*8)) ok = 0;
+    test_cond("Serialize and deserialize", ok);
+    if (d) cuckooFree(d);
+    test_cond("Deserialize rejects truncated input",
+        cuckooDeserialize(blob,bloblen-1) == NULL);
+    blob[CUCKOO_HDR_LEN] ^= 1; /* Number of buckets of the first layer. */
+    test_cond("Deserialize rejects a bad number of buckets",
+        cuckooDeserialize(blob,bloblen) == NULL);
+    zfree(blob);
+
+    d = cuckooDup(cf);
+    ok = 1;
+    for (j = 1; j < 20000; j++)
+        if (!cuckooExists(d,test_hash(j))) ok = 0;
+    test_cond("Duplicated filter has the same items", ok);
+    cuckooFree(d);
+    cuckooFree(cf);
+
+    test_report();
+    return 0;
+}
+#endif
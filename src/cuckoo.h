@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CUCKOO_H
+#define __CUCKOO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A cuckoo filter stores a 16 bit fingerprint of every item in one of two
+ * candidate buckets, the second obtained from the first one and from the
+ * fingerprint alone, so that items can be relocated (and deleted) without
+ * knowing the original item. A bucket has four slots packed in a 64 bit
+ * word, so that a bucket is searched with a few word operations. A zero
+ * fingerprint marks an empty slot.
+ *
+ * When an item can't be stored even relocating other items, a new filter
+ * (layer) 'expansion' times larger is added, and the item is stored there.
+ * Lookups check all the layers. */
+#define CUCKOO_BUCKET_SLOTS 4
+#define CUCKOO_MAX_LAYERS 64
+
+/* Layers are limited to 512MB, the max size of a string value. */
+#define CUCKOO_MAX_BUCKETS ((512ULL*1024*1024)/8)
+
+typedef struct cuckooLayer {
+    uint64_t nbuckets;  /* Number of buckets, a power of two. */
+    uint64_t items;     /* Number of fingerprints in this layer. */
+    uint64_t *buckets;
+} cuckooLayer;
+
+typedef struct cuckoo {
+    uint64_t items;         /* Fingerprints stored in all the layers. */
+    uint64_t deleted;       /* Items deleted since the filter creation. */
+    uint32_t expansion;     /* Growth factor of new layers, 0 if the
+                               filter is non scaling. */
+    uint32_t maxiterations; /* Max relocations before adding a layer. */
+    uint32_t numlayers;     /* Number of layers, at least one. */
+    cuckooLayer *layers;
+} cuckoo;
+
+cuckoo *cuckooNew(uint64_t capacity, uint32_t expansion,
+                  uint32_t maxiterations);
+void cuckooFree(cuckoo *cf);
+cuckoo *cuckooDup(cuckoo *cf);
+int cuckooAdd(cuckoo *cf, uint64_t hash);
+int cuckooExists(cuckoo *cf, uint64_t hash);
+uint64_t cuckooCount(cuckoo *cf, uint64_t hash);
+int cuckooDelete(cuckoo *cf, uint64_t hash);
+uint64_t cuckooBuckets(cuckoo *cf);
+size_t cuckooMemory(cuckoo *cf);
+unsigned char *cuckooSerialize(cuckoo *cf, size_t *len);
+cuckoo *cuckooDeserialize(unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int cuckooTest(int argc, char *argv[]);
+#endif
+
+#endif
@@ -51,9 +51,11 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
 
         /* Update the access time for the ageing algorithm.
          * Don't do it if we have a saving child, as this will trigger
-         * a copy on write madness. */
+         * a copy on write madness, nor while a forkless BGSAVE may be
+         * reading the same object from another thread. */
         if (server.rdb_child_pid == -1 &&
             server.aof_child_pid == -1 &&
+            !server.rdb_snapshot_active &&
             !(flags & LOOKUP_NOTOUCH))
         {
             val->lru = LRU_CLOCK();
@@ -88,6 +90,7 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
     robj *val;
 
+    if (server.rdb_snapshot_active) rdbSnapshotTouchKey(db,key,0);
     if (expireIfNeeded(db,key) == 1) {
         /* Key expired. If we are in the context of a master, expireIfNeeded()
          * returns 0 only when the key does not exist at all, so it's safe
@@ -114,6 +117,7 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
             return NULL;
         }
     }
+    expireHashFieldsIfNeeded(db,key);
     val = lookupKey(db,key,flags);
     if (val == NULL)
         server.stat_keyspace_misses++;
@@ -134,7 +138,9 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
+    if (server.rdb_snapshot_active) rdbSnapshotTouchKey(db,key,1);
     expireIfNeeded(db,key);
+    expireHashFieldsIfNeeded(db,key);
     return lookupKey(db,key,LOOKUP_NONE);
 }
 
@@ -159,8 +165,12 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
     int retval = dictAdd(db->dict, copy, val);
 
     serverAssertWithInfo(NULL,key,retval == DICT_OK);
-    if (val->type == OBJ_LIST) signalListAsReady(db, key);
+    if (val->type == OBJ_LIST || val->type == OBJ_STREAM)
+        signalKeyAsReady(db, key);
     if (server.cluster_enabled) slotToKeyAdd(key);
+    if (server.rdb_snapshot_active) rdbSnapshotKeyAdded(db,key);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
+    pfcountCacheInvalidateKey(db,key);
  }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -172,22 +182,33 @@ void dbOverwrite(redisDb *db, robj *key, robj *val) {
     dictEntry *de = dictFind(db->dict,key->ptr);
 
     serverAssertWithInfo(NULL,key,de != NULL);
+    if (server.rdb_snapshot_active) rdbSnapshotTouchKey(db,key,1);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
+    if (dictSize(db->hexpires) > 0) dictDelete(db->hexpires,key->ptr);
     dictReplace(db->dict, key->ptr, val);
+    pfcountCacheInvalidateKey(db,key);
 }
 
 /* High level Set operation. This function can be used in order to set
  * a key, whatever it was existing or not, to a new object.
  *
- * 1) The ref count of the value object is incremented.
+ * 1) The ref count of the value object is incremented. Large string values
+ *    may be stored as a compressed copy instead, see tryObjectCompression().
  * 2) clients WATCHing for the destination key notified.
  * 3) The expire time of the key is reset (the key is made persistent). */
 void setKey(redisDb *db, robj *key, robj *val) {
+    robj *compressed = NULL;
+
+    if (val->type == OBJ_STRING) compressed = tryObjectCompression(val);
+    if (compressed)
+        val = compressed;
+    else
+        incrRefCount(val);
     if (lookupKeyWrite(db,key) == NULL) {
         dbAdd(db,key,val);
     } else {
         dbOverwrite(db,key,val);
     }
-    incrRefCount(val);
     removeExpire(db,key);
     signalModifiedKey(db,key);
 }
@@ -224,11 +245,15 @@ robj *dbRandomKey(redisDb *db) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbDelete(redisDb *db, robj *key) {
+    if (server.rdb_snapshot_active) rdbSnapshotTouchKey(db,key,1);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
+    if (dictSize(db->hexpires) > 0) dictDelete(db->hexpires,key->ptr);
     if (dictDelete(db->dict,key->ptr) == DICT_OK) {
         if (server.cluster_enabled) slotToKeyDel(key);
+        pfcountCacheInvalidateKey(db,key);
         return 1;
     } else {
         return 0;
@@ -273,16 +298,42 @@ robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) {
     return o;
 }
 
+/* Replace an LZF compressed string value, or a string stored as a roaring
+ * bitmap, with its plain version, for write commands that need direct
+ * access to the bytes of the string, like SETBIT. The value does not
+ * change so the key is not signaled as modified. Read only commands should
+ * use a temporary getDecodedObject() copy instead, so that a read does not
+ * replace the stored value. Returns the value to use: the usage pattern is
+ * the following:
+ *
+ * o = dbDecompressStringValue(db,key,o);
+ */
+robj *dbDecompressStringValue(redisDb *db, robj *key, robj *o) {
+    serverAssert(o->type == OBJ_STRING);
+    if (o->encoding == OBJ_ENCODING_LZF ||
+        o->encoding == OBJ_ENCODING_ROARING)
+    {
+        o = getDecodedObject(o);
+        dbOverwrite(db,key,o);
+    }
+    return o;
+}
+
 long long emptyDb(void(callback)(void*)) {
     int j;
     long long removed = 0;
 
     for (j = 0; j < server.dbnum; j++) {
         removed += dictSize(server.db[j].dict);
+        /* A forkless BGSAVE may still need the flushed keys. */
+        if (server.rdb_snapshot_active &&
+            rdbSnapshotDetachDb(server.db+j)) continue;
+        dictEmpty(server.db[j].hexpires,callback);
         dictEmpty(server.db[j].dict,callback);
         dictEmpty(server.db[j].expires,callback);
     }
     if (server.cluster_enabled) slotToKeyFlush();
+    pfcountCacheFlush();
     return removed;
 }
 
@@ -304,10 +355,14 @@ int selectDb(client *c, int id) {
 
 void signalModifiedKey(redisDb *db, robj *key) {
     touchWatchedKey(db,key);
+    pfcountCacheInvalidateKey(db,key);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
 }
 
 void signalFlushedDb(int dbid) {
     touchWatchedKeysOnFlush(dbid);
+    pfcountCacheFlush();
+    if (server.rdb_delta) rdbDeltaTrackFlush(dbid);
 }
 
 /*-----------------------------------------------------------------------------
@@ -317,8 +372,11 @@ void signalFlushedDb(int dbid) {
 void flushdbCommand(client *c) {
     server.dirty += dictSize(c->db->dict);
     signalFlushedDb(c->db->id);
-    dictEmpty(c->db->dict,NULL);
-    dictEmpty(c->db->expires,NULL);
+    if (!server.rdb_snapshot_active || !rdbSnapshotDetachDb(c->db)) {
+        dictEmpty(c->db->hexpires,NULL);
+        dictEmpty(c->db->dict,NULL);
+        dictEmpty(c->db->expires,NULL);
+    }
     if (server.cluster_enabled) slotToKeyFlush();
     addReply(c,shared.ok);
 }
@@ -331,6 +389,7 @@ void flushallCommand(client *c) {
         kill(server.rdb_child_pid,SIGUSR1);
         rdbRemoveTempFile(server.rdb_child_pid);
     }
+    rdbSnapshotAbort();
     if (server.saveparamslen > 0) {
         /* Normally rdbSave() will reset dirty, but we don't want this here
          * as otherwise FLUSHALL will not be replicated nor put into the AOF. */
@@ -365,6 +424,7 @@ void existsCommand(client *c) {
 
     for (j = 1; j < c->argc; j++) {
         expireIfNeeded(c->db,c->argv[j]);
+        expireHashFieldsIfNeeded(c->db,c->argv[j]);
         if (dbExists(c->db,c->argv[j])) count++;
     }
     addReplyLongLong(c,count);
@@ -447,9 +507,17 @@ void scanCallback(void *privdata, const dictEntry *de) {
         val = dictGetVal(de);
         incrRefCount(val);
     } else if (o->type == OBJ_ZSET) {
+        double score;
+
         key = dictGetKey(de);
         incrRefCount(key);
-        val = createStringObjectFromLongDouble(*(double*)dictGetVal(de),0);
+        /* The score is stored inline in the dictionary for B+tree encoded
+         * sorted sets, while it points to the skiplist node otherwise. */
+        if (o->encoding == OBJ_ENCODING_BTREE)
+            score = dictGetDoubleVal(de);
+        else
+            score = *(double*)dictGetVal(de);
+        val = createStringObjectFromLongDouble(score,0);
     } else {
         serverPanic("Type not handled in SCAN callback.");
     }
@@ -553,7 +621,8 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
         ht = o->ptr;
         count *= 2; /* We return key / value for this type. */
-    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->type == OBJ_ZSET && (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                                       o->encoding == OBJ_ENCODING_BTREE)) {
         zset *zs = o->ptr;
         ht = zs->dict;
         count *= 2; /* We return key / value for this type. */
@@ -694,6 +763,12 @@ void typeCommand(client *c) {
         case OBJ_SET: type = "set"; break;
         case OBJ_ZSET: type = "zset"; break;
         case OBJ_HASH: type = "hash"; break;
+        case OBJ_STREAM: type = "stream"; break;
+        case OBJ_BLOOM: type = "bloom"; break;
+        case OBJ_CUCKOO: type = "cuckoo"; break;
+        case OBJ_CMS: type = "cms"; break;
+        case OBJ_TOPK: type = "topk"; break;
+        case OBJ_TIMESERIES: type = "timeseries"; break;
         default: type = "unknown"; break;
         }
     }
@@ -759,6 +834,7 @@ void renameGenericCommand(client *c, int nx) {
     }
     dbAdd(c->db,c->argv[2],o);
     if (expire != -1) setExpire(c->db,c->argv[2],expire);
+    moveHashFieldExpires(c->db,c->argv[1],c->db,c->argv[2]);
     dbDelete(c->db,c->argv[1]);
     signalModifiedKey(c->db,c->argv[1]);
     signalModifiedKey(c->db,c->argv[2]);
@@ -825,6 +901,7 @@ void moveCommand(client *c) {
     }
     dbAdd(dst,c->argv[1],o);
     if (expire != -1) setExpire(dst,c->argv[1],expire);
+    moveHashFieldExpires(src,c->argv[1],dst,c->argv[1]);
     incrRefCount(o);
 
     /* OK! key moved, free the entry in the source DB */
@@ -841,6 +918,8 @@ int removeExpire(redisDb *db, robj *key) {
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
     serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
+    if (server.rdb_snapshot_active) rdbSnapshotTouchKey(db,key,1);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
     return dictDelete(db->expires,key->ptr) == DICT_OK;
 }
 
@@ -850,6 +929,8 @@ void setExpire(redisDb *db, robj *key, long long when) {
     /* Reuse the sds from the main dict in the expire dict */
     kde = dictFind(db->dict,key->ptr);
     serverAssertWithInfo(NULL,key,kde != NULL);
+    if (server.rdb_snapshot_active) rdbSnapshotTouchKey(db,key,1);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
     de = dictReplaceRaw(db->expires,dictGetKey(kde));
     dictSetSignedIntegerVal(de,when);
 }
@@ -929,6 +1010,60 @@ int expireIfNeeded(redisDb *db, robj *key) {
     return dbDelete(db,key);
 }
 
+/* Propagate the expiration of a hash field to slaves and the AOF as an
+ * explicit HDEL, for the same reasons explained in propagateExpire(). */
+void propagateHashFieldExpire(redisDb *db, robj *key, robj *field) {
+    robj *argv[3];
+
+    argv[0] = createStringObject("HDEL",4);
+    argv[1] = key;
+    argv[2] = field;
+    incrRefCount(argv[1]);
+    incrRefCount(argv[2]);
+
+    if (server.aof_state != AOF_OFF)
+        feedAppendOnlyFile(server.hdelCommand,db->id,argv,3);
+    replicationFeedSlaves(server.slaves,db->id,argv,3);
+
+    decrRefCount(argv[0]);
+    decrRefCount(argv[1]);
+    decrRefCount(argv[2]);
+}
+
+/* Lazily delete the expired fields of the hash stored at 'key', if any.
+ * Like for keys, slaves wait for the HDELs sent by the master. */
+void expireHashFieldsIfNeeded(redisDb *db, robj *key) {
+    hashFieldExpires *hfe;
+    mstime_t now;
+
+    if (dictSize(db->hexpires) == 0) return;
+    if (server.loading || server.masterhost != NULL) return;
+    if ((hfe = hashGetFieldExpires(db,key)) == NULL) return;
+
+    /* See expireIfNeeded() for why the Lua start time is used. */
+    now = server.lua_caller ? server.lua_time_start : mstime();
+    if (hfe->next > now) return;
+    hashExpireFields(db,key,hfe,now);
+}
+
+/* Transfer the volatile fields of 'srckey' in 'src' to 'dstkey' in 'dst'.
+ * The destination key must already exist. The source hexpires entry is
+ * dropped without releasing the structure now owned by the destination. */
+void moveHashFieldExpires(redisDb *src, robj *srckey, redisDb *dst, robj *dstkey) {
+    dictEntry *de, *kde;
+    hashFieldExpires *hfe;
+
+    if (dictSize(src->hexpires) == 0 ||
+        (de = dictFind(src->hexpires,srckey->ptr)) == NULL) return;
+    hfe = dictGetVal(de);
+    dictSetVal(src->hexpires,de,NULL);
+    dictDelete(src->hexpires,srckey->ptr);
+
+    kde = dictFind(dst->dict,dstkey->ptr);
+    serverAssertWithInfo(NULL,dstkey,kde != NULL);
+    dictAdd(dst->hexpires,dictGetKey(kde),hfe);
+}
+
 /*-----------------------------------------------------------------------------
  * Expires Commands
  *----------------------------------------------------------------------------*/
@@ -1071,7 +1206,15 @@ int *getKeysUsingCommandTable(struct redisCommand *cmd,robj **argv, int argc, in
     if (last < 0) last = argc+last;
     keys = zmalloc(sizeof(int)*((last - cmd->firstkey)+1));
     for (j = cmd->firstkey; j <= last; j += cmd->keystep) {
-        serverAssert(j < argc);
+        if (j >= argc) {
+            /* Commands with a variable number of arguments, such as
+             * XGROUP HELP, may be called without the key argument: the
+             * arity check can't catch it, so we just report no keys. */
+            serverAssert(cmd->arity < 0);
+            zfree(keys);
+            *numkeys = 0;
+            return NULL;
+        }
         keys[i++] = j;
     }
     *numkeys = i;
@@ -1269,6 +1412,50 @@ int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numk
     return keys;
 }
 
+/* XREAD [BLOCK <milliseconds>] [COUNT <count>] [GROUP <groupname> <ttl>]
+ *       STREAMS key_1 key_2 ... key_N ID_1 ID_2 ... ID_N */
+int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num = 0, *keys;
+    UNUSED(cmd);
+
+    /* We need to parse the options of the command in order to seek the first
+     * "STREAMS" string which is actually the option. This is needed because
+     * "STREAMS" could also be the name of the consumer group and even the
+     * name of the stream key. */
+    int streams_pos = -1;
+    for (i = 1; i < argc; i++) {
+        char *arg = argv[i]->ptr;
+        if (!strcasecmp(arg, "block")) {
+            i++; /* Skip option argument. */
+        } else if (!strcasecmp(arg, "count")) {
+            i++; /* Skip option argument. */
+        } else if (!strcasecmp(arg, "group")) {
+            i += 2; /* Skip option argument. */
+        } else if (!strcasecmp(arg, "noack")) {
+            /* Nothing to do. */
+        } else if (!strcasecmp(arg, "streams")) {
+            streams_pos = i;
+            break;
+        } else {
+            break; /* Syntax error. */
+        }
+    }
+    if (streams_pos != -1) num = argc - streams_pos - 1;
+
+    /* Syntax error. */
+    if (streams_pos == -1 || num == 0 || num % 2 != 0) {
+        *numkeys = 0;
+        return NULL;
+    }
+    num /= 2; /* We have half the keys as there are arguments because
+                 there are also the IDs, one per key. */
+
+    keys = zmalloc(sizeof(int) * num);
+    for (i = streams_pos+1; i < argc-num; i++) keys[i-streams_pos-1] = i;
+    *numkeys = num;
+    return keys;
+}
+
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
  * while rehashing the cluster. */
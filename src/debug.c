@@ -137,6 +137,7 @@ void computeDatasetDigest(unsigned char *final) {
         while((de = dictNext(di)) != NULL) {
             sds key;
             robj *keyobj, *o;
+            hashFieldExpires *hfe;
             long long expiretime;
 
             memset(digest,0,20); /* This key-val digest */
@@ -220,6 +221,19 @@ void computeDatasetDigest(unsigned char *final) {
                         xorDigest(digest,eledigest,20);
                     }
                     dictReleaseIterator(di);
+                } else if (o->encoding == OBJ_ENCODING_BTREE) {
+                    zset *zs = o->ptr;
+                    zbtreeCursor cur;
+
+                    zbtFirst(zs->zbt,&cur);
+                    while(cur.leaf) {
+                        snprintf(buf,sizeof(buf),"%.17g",zbtCursorScore(&cur));
+                        memset(eledigest,0,20);
+                        mixObjectDigest(eledigest,zbtCursorObj(&cur));
+                        mixDigest(eledigest,buf,strlen(buf));
+                        xorDigest(digest,eledigest,20);
+                        zbtNext(&cur);
+                    }
                 } else {
                     serverPanic("Unknown sorted set encoding");
                 }
@@ -241,11 +255,79 @@ void computeDatasetDigest(unsigned char *final) {
                     xorDigest(digest,eledigest,20);
                 }
                 hashTypeReleaseIterator(hi);
+            } else if (o->type == OBJ_STREAM) {
+                /* Digest the entries and the consumer groups, but not
+                 * the way entries are split among the radix tree nodes,
+                 * that is not the same after AOF loading or compaction. */
+                stream *s = o->ptr;
+                streamIterator si;
+                streamID id;
+                int64_t numfields;
+
+                streamIteratorStart(&si,s,NULL,NULL,0);
+                while(streamIteratorGetID(&si,&id,&numfields)) {
+                    mixDigest(digest,&id,sizeof(id));
+                    while(numfields--) {
+                        unsigned char *field, *value;
+                        int64_t field_len, value_len;
+                        streamIteratorGetField(&si,&field,&value,
+                                               &field_len,&value_len);
+                        mixDigest(digest,field,field_len);
+                        mixDigest(digest,value,value_len);
+                    }
+                }
+                streamIteratorStop(&si);
+                mixDigest(digest,&s->last_id,sizeof(s->last_id));
+
+                if (s->cgroups) {
+                    raxIterator ri, pi;
+                    raxStart(&ri,s->cgroups);
+                    raxSeek(&ri,"^",NULL,0);
+                    while(raxNext(&ri)) {
+                        streamCG *cg = ri.data;
+                        mixDigest(digest,ri.key,ri.key_len);
+                        mixDigest(digest,&cg->last_id,sizeof(cg->last_id));
+                        raxStart(&pi,cg->pel);
+                        raxSeek(&pi,"^",NULL,0);
+                        while(raxNext(&pi)) {
+                            streamNACK *nack = pi.data;
+                            mixDigest(digest,pi.key,pi.key_len);
+                            mixDigest(digest,nack->consumer->name,
+                                      sdslen(nack->consumer->name));
+                        }
+                        raxStop(&pi);
+                    }
+                    raxStop(&ri);
+                }
+            } else if (OBJ_TYPE_IS_BLOB(o->type)) {
+                /* The serialized blob has all the state. */
+                size_t len;
+                unsigned char *blob = serializeBlobObject(o,&len);
+                mixDigest(digest,blob,len);
+                zfree(blob);
             } else {
                 serverPanic("Unknown object type");
             }
             /* If the key has an expire, add it to the mix */
             if (expiretime != -1) xorDigest(digest,"!!expire!!",10);
+            /* Same for the volatile fields of hashes. */
+            if (o->type == OBJ_HASH &&
+                (hfe = hashGetFieldExpires(db,keyobj)) != NULL)
+            {
+                dictIterator *fdi = dictGetIterator(hfe->fields);
+                dictEntry *fde;
+
+                while((fde = dictNext(fdi)) != NULL) {
+                    sds field = dictGetKey(fde);
+                    unsigned char eledigest[20];
+
+                    memset(eledigest,0,20);
+                    mixDigest(eledigest,"!!fexpire!!",11);
+                    mixDigest(eledigest,field,sdslen(field));
+                    xorDigest(digest,eledigest,20);
+                }
+                dictReleaseIterator(fdi);
+            }
             /* We can finally xor the key-val digest to the final digest */
             xorDigest(final,digest,20);
             decrRefCount(keyobj);
@@ -268,6 +350,10 @@ void debugCommand(client *c) {
         return;
     }
 
+    /* Many subcommands access the values directly, and some like DIGEST
+     * modify them while iterating: don't race with a forkless BGSAVE. */
+    if (server.rdb_snapshot_active) rdbSnapshotWait();
+
     if (!strcasecmp(c->argv[1]->ptr,"help")) {
         void *blenp = addDeferredMultiBulkLength(c);
         int blen = 0;
@@ -348,7 +434,7 @@ void debugCommand(client *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"loadaof")) {
         if (server.aof_state == AOF_ON) flushAppendOnlyFile(1);
         emptyDb(NULL);
-        if (loadAppendOnlyFile(server.aof_filename) != C_OK) {
+        if (loadAppendOnlyFiles(server.aof_manifest) != C_OK) {
             addReply(c,shared.err);
             return;
         }
@@ -612,6 +698,9 @@ void serverLogObjectDebugInfo(robj *o) {
         serverLog(LL_WARNING,"Sorted set size: %d", (int) zsetLength(o));
         if (o->encoding == OBJ_ENCODING_SKIPLIST)
             serverLog(LL_WARNING,"Skiplist level: %d", (int) ((zset*)o->ptr)->zsl->level);
+        else if (o->encoding == OBJ_ENCODING_BTREE)
+            serverLog(LL_WARNING,"B+tree height: %d",
+                zbtHeight(((zset*)o->ptr)->zbt));
     }
 }
 
@@ -0,0 +1,391 @@
+/* Incremental (delta) RDB snapshots.
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* How it works
+ * ------------
+ *
+ * When rdb-delta is enabled the server tracks the names of the keys added,
+ * modified or deleted in every DB since the last save started, plus a flag
+ * for the DBs that were flushed. A full save (SAVE, BGSAVE, save points...)
+ * writes the base RDB file as usual. A delta save (BGSAVE DELTA, or the
+ * save points when the chain is not too long) forks a child that only
+ * writes the tracked keys to <dbfilename>.delta.<n>: the current value of
+ * the keys that still exist, and a DELKEY record for the other ones. The
+ * FLUSHDB record of a flushed DB comes before its keys.
+ *
+ * Every RDB file carries a random "snapshot-id" AUX field, and every delta
+ * also the "delta-base" AUX field, with the id of the file it applies on
+ * top of (the base or the previous delta). At startup the base is loaded,
+ * then the deltas 1, 2, ... are applied in order, stopping at the first
+ * one missing or not matching the chain. A successful full save removes
+ * the deltas of the previous base.
+ *
+ * When a save starts the tracked keys become the pending keys, the ones a
+ * delta child writes, and the keys changed from now on are tracked in a
+ * fresh set. If the save fails the pending keys are merged back, so that
+ * they are part of the next delta. */
+
+#include "server.h"
+
+typedef struct deltaDb {
+    dict *keys;         /* Set of the changed keys (sds). */
+    int flushed;        /* True if the DB was flushed. */
+} deltaDb;
+
+static deltaDb *tracked;    /* Changes since the last save started. */
+static deltaDb *pending;    /* Changes saved by the running save, if any. */
+static int saving;          /* True between SaveStart and SaveDone. */
+
+static deltaDb *deltaCreateDbs(void) {
+    deltaDb *dbs = zmalloc(sizeof(deltaDb)*server.dbnum);
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        dbs[j].keys = dictCreate(&sdsSetDictType,NULL);
+        dbs[j].flushed = 0;
+    }
+    return dbs;
+}
+
+static void deltaReleaseDbs(deltaDb *dbs) {
+    int j;
+
+    if (dbs == NULL) return;
+    for (j = 0; j < server.dbnum; j++) dictRelease(dbs[j].keys);
+    zfree(dbs);
+}
+
+/* Merge the older changes 'old' into 'dbs', releasing 'old'. A DB flushed
+ * in 'dbs' does not need the older changes. */
+static void deltaMergeDbs(deltaDb *dbs, deltaDb *old) {
+    dictIterator *di;
+    dictEntry *de;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (dbs[j].flushed) continue;
+        dbs[j].flushed = old[j].flushed;
+        di = dictGetIterator(old[j].keys);
+        while((de = dictNext(di)) != NULL) {
+            sds key = dictGetKey(de);
+
+            if (dictFind(dbs[j].keys,key) == NULL)
+                dictAdd(dbs[j].keys,sdsdup(key),NULL);
+        }
+        dictReleaseIterator(di);
+    }
+    deltaReleaseDbs(old);
+}
+
+/* Track a change of 'key'. The keys loaded from disk or from the master
+ * are not tracked: the dataset then matches the loaded file. */
+void rdbDeltaTrackKey(redisDb *db, robj *key) {
+    dict *keys;
+
+    if (tracked == NULL || server.loading || !isMainDb(db)) return;
+    keys = tracked[db->id].keys;
+    if (dictFind(keys,key->ptr) == NULL)
+        dictAdd(keys,sdsdup(key->ptr),NULL);
+}
+
+/* Track the flush of the DB 'dbid', or of all the DBs if it is -1. */
+void rdbDeltaTrackFlush(int dbid) {
+    int j;
+
+    if (tracked == NULL || server.loading) return;
+    for (j = 0; j < server.dbnum; j++) {
+        if (dbid != -1 && dbid != j) continue;
+        dictEmpty(tracked[j].keys,NULL);
+        tracked[j].flushed = 1;
+    }
+}
+
+/* Number of keys changed since the last save started. */
+unsigned long long rdbDeltaTrackedKeys(void) {
+    unsigned long long keys = 0;
+    int j;
+
+    if (tracked == NULL) return 0;
+    for (j = 0; j < server.dbnum; j++) keys += dictSize(tracked[j].keys);
+    return keys;
+}
+
+/* Start or stop tracking the changes according to rdb-delta, forgetting
+ * the changes tracked so far. The files on disk can't be extended with a
+ * delta until the next full save. */
+void rdbDeltaReset(void) {
+    deltaReleaseDbs(tracked);
+    deltaReleaseDbs(pending);
+    tracked = server.rdb_delta ? deltaCreateDbs() : NULL;
+    pending = NULL;
+    saving = 0;
+    server.rdb_delta_seq = -1;
+}
+
+/* The dataset no longer derives from the files on disk, for instance after
+ * a full resynchronization with the master: the next save must be a full
+ * one. */
+void rdbDeltaInvalidate(void) {
+    server.rdb_delta_seq = -1;
+}
+
+/* Return true if the next save can be a delta. */
+int rdbDeltaCanSave(void) {
+    return tracked != NULL && server.rdb_delta_seq >= 0 &&
+           server.rdb_delta_seq < server.rdb_delta_max_chain;
+}
+
+/* Called before a full or delta save starts: assign the id of the new file
+ * and start tracking the changes from now on in a new set. */
+void rdbDeltaSaveStart(void) {
+    getRandomHexChars(server.rdb_save_snapshot_id,CONFIG_RUN_ID_SIZE);
+    /* A save still running (a killed child not yet collected) failed. */
+    if (pending) deltaMergeDbs(tracked,pending);
+    pending = NULL;
+    if (tracked) {
+        pending = tracked;
+        tracked = deltaCreateDbs();
+    }
+    saving = 1;
+}
+
+/* Called when the save started by rdbDeltaSaveStart() terminated. */
+void rdbDeltaSaveDone(int ok, int isdelta) {
+    if (!saving) return;
+    saving = 0;
+    if (!ok) {
+        if (pending) deltaMergeDbs(tracked,pending);
+        pending = NULL;
+        return;
+    }
+    deltaReleaseDbs(pending);
+    pending = NULL;
+    memcpy(server.rdb_snapshot_id,server.rdb_save_snapshot_id,
+        sizeof(server.rdb_snapshot_id));
+    if (isdelta) {
+        server.rdb_delta_seq++;
+    } else {
+        char filename[1024];
+        int seq = 1;
+
+        /* Remove the deltas of the previous base. */
+        while(1) {
+            rdbDeltaFilename(filename,sizeof(filename),server.rdb_filename,
+                seq++);
+            if (unlink(filename) == -1) break;
+        }
+        server.rdb_delta_seq = tracked ? 0 : -1;
+    }
+}
+
+/* Name of the delta number 'seq' of the base RDB file 'filename'. */
+void rdbDeltaFilename(char *buf, size_t len, char *filename, int seq) {
+    snprintf(buf,len,"%s.delta.%d",filename,seq);
+}
+
+/* Write the delta to 'rdb', using the same layout of rdbSaveRio(). Only
+ * called by the delta child, where 'pending' holds the keys to write. */
+int rdbSaveDeltaRio(rio *rdb, int *error) {
+    dictIterator *di = NULL;
+    dictEntry *de;
+    char magic[10];
+    int j;
+    long long now = mstime(), keys = 0;
+    uint64_t cksum;
+
+    if (server.rdb_checksum)
+        rdb->update_cksum = rioGenericUpdateChecksum;
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    if (rioWrite(rdb,magic,9) == 0) goto werr;
+    if (rdbSaveInfoAuxFields(rdb,RDB_SAVE_NONE) == -1) goto werr;
+    if (rdbSaveAuxFieldStrStr(rdb,"delta-base",server.rdb_snapshot_id) == -1)
+        goto werr;
+    if (rdbSaveAuxFieldStrInt(rdb,"delta-seq",server.rdb_delta_seq+1) == -1)
+        goto werr;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        deltaDb *ddb = pending+j;
+
+        if (!ddb->flushed && dictSize(ddb->keys) == 0) continue;
+        if (rdbSaveType(rdb,RDB_OPCODE_SELECTDB) == -1) goto werr;
+        if (rdbSaveLen(rdb,j) == -1) goto werr;
+        if (ddb->flushed && rdbSaveType(rdb,RDB_OPCODE_FLUSHDB) == -1)
+            goto werr;
+
+        di = dictGetIterator(ddb->keys);
+        while((de = dictNext(di)) != NULL) {
+            sds keystr = dictGetKey(de);
+            dictEntry *kde = dictFind(db->dict,keystr);
+            robj key;
+            int saved = 0;
+
+            initStaticStringObject(key,keystr);
+            if (kde) {
+                saved = rdbSaveKeyValuePair(rdb,&key,dictGetVal(kde),
+                    getExpire(db,&key),hashGetFieldExpires(db,&key),now);
+                if (saved == -1) goto werr;
+            }
+            /* Deleted or already expired. */
+            if (!saved) {
+                if (rdbSaveType(rdb,RDB_OPCODE_DELKEY) == -1) goto werr;
+                if (rdbSaveRawString(rdb,(unsigned char*)keystr,
+                    sdslen(keystr)) == -1) goto werr;
+            }
+            if ((++keys & 1023) == 0)
+                childInfoUpdate(keys,rdb->processed_bytes);
+        }
+        dictReleaseIterator(di);
+        di = NULL;
+    }
+    childInfoUpdate(keys,rdb->processed_bytes);
+
+    if (rdbSaveType(rdb,RDB_OPCODE_EOF) == -1) goto werr;
+    cksum = rdb->cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(rdb,&cksum,8) == 0) goto werr;
+    return C_OK;
+
+werr:
+    if (error) *error = errno;
+    if (di) dictReleaseIterator(di);
+    return C_ERR;
+}
+
+/* Save a delta in background, or a full RDB if the chain can't be extended
+ * (no base yet, or rdb-delta-max-chain deltas already). */
+int rdbSaveDeltaBackground(void) {
+    pid_t childpid;
+    long long start;
+
+    if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) return C_ERR;
+    if (!rdbDeltaCanSave()) return rdbSaveBackground(server.rdb_filename);
+
+    server.dirty_before_bgsave = server.dirty;
+    server.lastbgsave_try = time(NULL);
+    rdbDeltaSaveStart();
+
+    openChildInfoPipe(CHILD_INFO_TYPE_RDB);
+    start = ustime();
+    if ((childpid = fork()) == 0) {
+        char filename[1024];
+        int retval;
+
+        /* Child */
+        server.in_fork_child = 1;
+        closeListeningSockets(0);
+        redisSetProcTitle("redis-rdb-delta");
+        setChildIOClass();
+        rdbDeltaFilename(filename,sizeof(filename),server.rdb_filename,
+            server.rdb_delta_seq+1);
+        retval = rdbSaveDelta(filename);
+        if (retval == C_OK) {
+            size_t private_dirty = sendChildInfo(1);
+
+            if (private_dirty) {
+                serverLog(LL_NOTICE,
+                    "RDB delta: %zu MB of memory used by copy-on-write",
+                    private_dirty/(1024*1024));
+            }
+        }
+        exitFromChild((retval == C_OK) ? 0 : 1);
+    } else {
+        /* Parent */
+        server.stat_fork_time = ustime()-start;
+        server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
+        latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
+        if (childpid == -1) {
+            closeChildInfoPipe();
+            rdbDeltaSaveDone(0,1);
+            server.lastbgsave_status = C_ERR;
+            serverLog(LL_WARNING,"Can't save delta in background: fork: %s",
+                strerror(errno));
+            return C_ERR;
+        }
+        serverLog(LL_NOTICE,"Background delta saving started by pid %d",
+            childpid);
+        server.rdb_save_time_start = time(NULL);
+        server.rdb_child_pid = childpid;
+        server.rdb_child_type = RDB_CHILD_TYPE_DELTA;
+        updateDictResizePolicy();
+        return C_OK;
+    }
+    return C_OK; /* unreached */
+}
+
+/* The delta child terminated. */
+void backgroundDeltaDoneHandler(int exitcode, int bysignal) {
+    int ok = (!bysignal && exitcode == 0);
+
+    if (ok) {
+        serverLog(LL_NOTICE,"Background delta saving terminated with success");
+        server.dirty = server.dirty - server.dirty_before_bgsave;
+        server.lastsave = time(NULL);
+        server.lastbgsave_status = C_OK;
+    } else if (!bysignal) {
+        serverLog(LL_WARNING,"Background delta saving error");
+        server.lastbgsave_status = C_ERR;
+    } else {
+        serverLog(LL_WARNING,
+            "Background delta saving terminated by signal %d", bysignal);
+        rdbRemoveTempFile(server.rdb_child_pid);
+        if (bysignal != SIGUSR1)
+            server.lastbgsave_status = C_ERR;
+    }
+    rdbDeltaSaveDone(ok,1);
+    server.rdb_child_pid = -1;
+    server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+    server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
+    server.rdb_save_time_start = -1;
+    /* Slaves waiting for a BGSAVE can't use a delta, start a full one. */
+    updateSlavesWaitingBgsave(ok ? C_OK : C_ERR, RDB_CHILD_TYPE_DELTA);
+}
+
+/* Apply the deltas of the base RDB file 'filename' just loaded, in order.
+ * Returns the number of deltas applied. */
+int rdbLoadDeltas(char *filename) {
+    char deltafile[1024];
+    int seq = 0;
+
+    while(1) {
+        rdbDeltaFilename(deltafile,sizeof(deltafile),filename,seq+1);
+        if (access(deltafile,R_OK) == -1) break;
+        if (rdbLoadDelta(deltafile) != C_OK) {
+            serverLog(LL_WARNING,
+                "The RDB delta %s is not part of the chain of %s, ignoring "
+                "it and the following ones", deltafile, filename);
+            break;
+        }
+        seq++;
+    }
+    if (seq) serverLog(LL_NOTICE,"%d RDB deltas applied",seq);
+    if (tracked) server.rdb_delta_seq = seq;
+    return seq;
+}
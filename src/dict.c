@@ -576,6 +576,46 @@ void *dictFetchValue(dict *d, const void *key) {
     return he ? dictGetVal(he) : NULL;
 }
 
+/* Prefetch the bucket 'key' hashes to, in both the tables if we are
+ * rehashing. Callers looking up many keys in a row can prefetch a batch of
+ * keys first, so that the cache misses of the following dictFind() calls
+ * overlap instead of being paid one after the other. */
+void dictPrefetch(dict *d, const void *key) {
+    unsigned int h;
+
+    if (dictSize(d) == 0) return;
+    h = dictHashKey(d, key);
+    __builtin_prefetch(&d->ht[0].table[h & d->ht[0].sizemask]);
+    if (dictIsRehashing(d))
+        __builtin_prefetch(&d->ht[1].table[h & d->ht[1].sizemask]);
+}
+
+/* Find the bucket holding 'key', storing the table and the bucket index in
+ * '*table' and '*idx'. Unlike dictFind() no rehashing step is performed, so
+ * the position stays valid as long as rehashing is paused.
+ * Returns DICT_ERR if the key is not in the dictionary. */
+int dictGetKeyPosition(dict *d, const void *key, int *table, unsigned long *idx) {
+    dictEntry *he;
+    unsigned int h;
+    int t;
+
+    if (dictSize(d) == 0) return DICT_ERR;
+    h = dictHashKey(d, key);
+    for (t = 0; t <= 1; t++) {
+        he = d->ht[t].table[h & d->ht[t].sizemask];
+        while(he) {
+            if (key==he->key || dictCompareKeys(d, key, he->key)) {
+                *table = t;
+                *idx = h & d->ht[t].sizemask;
+                return DICT_OK;
+            }
+            he = he->next;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return DICT_ERR;
+}
+
 /* A fingerprint is a 64 bit number that represents the state of the dictionary
  * at a given time, it's just a few dict properties xored together.
  * When an unsafe iterator is initialized, we get the dict fingerprint, and check
@@ -159,6 +159,8 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
 #define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)      // hash表桶数量
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)       // hash表元素数量
 #define dictIsRehashing(d) ((d)->rehashidx != -1)           // 是否正在分步resh操作
+#define dictPauseRehashing(d) ((d)->iterators++)            // 暂停分步rehash，与安全迭代器的效果相同
+#define dictResumeRehashing(d) ((d)->iterators--)           // 恢复分步rehash
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);                            // 创建一个空的hash表
@@ -172,6 +174,8 @@ int dictDeleteNoFree(dict *d, const void *key);
 void dictRelease(dict *d);                                                      // 释放并清除整个hash表的所有内存
 dictEntry * dictFind(dict *d, const void *key);                                 // hash表中查找key对应的entry，如果找不到返回NULL
 void *dictFetchValue(dict *d, const void *key);                                 // hash表中查找key对应的value，如果找不到返回NULL
+void dictPrefetch(dict *d, const void *key);                                    // 预取key所在的bucket到CPU缓存，用于批量查找前隐藏内存访问延迟
+int dictGetKeyPosition(dict *d, const void *key, int *table, unsigned long *idx); // 获取key所在的table和桶下标，不触发rehash，key不存在返回DICT_ERR
 int dictResize(dict *d);                                                        // 将hash表的大小减少到能容纳里面元素的最小值，最小不能小过DICT_HT_INITIAL_SIZE，如果当前禁止resize操作或者当前正在rehash，返回出错
 dictIterator *dictGetIterator(dict *d);                                         // 获取遍历该hash表的迭代器，遍历过程中应该确保该hash表不能被改变
 dictIterator *dictGetSafeIterator(dict *d);                                     // 获取遍历该hash表的安全迭代器，遍历过程中能确保不会触发rehash操作，但遍历过程中新加的元素可能会不被遍历
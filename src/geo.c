@@ -31,6 +31,7 @@
 #include "geo.h"
 #include "geohash_helper.h"
 #include "debugmacro.h"
+#include "pqsort.h" /* Partial qsort for COUNT top-k */
 
 /* Things exported from t_zset.c only for geo.c, since it is the only other
  * part of Redis that requires close zset introspection. */
@@ -43,6 +44,8 @@ int zslValueLteMax(double value, zrangespec *spec);
  *   - geoadd - add coordinates for value to geoset
  *   - georadius - search radius by coordinates in geoset
  *   - georadiusbymember - search radius based on geoset member position
+ *   - geosearch - search radius or box by coordinates or member in geoset
+ *   - geosearchstore - like geosearch, storing the result in a key
  * ==================================================================== */
 
 /* ====================================================================
@@ -171,6 +174,39 @@ double extractDistanceOrReply(client *c, robj **argv,
     return distance * to_meters;
 }
 
+/* Input Argument Helper.
+ * Extract the width and height of a box from the three arguments starting
+ * at 'argv', that should be in the form: <width> <height> <unit>. The
+ * width and height are returned in meters, while *conversion is populated
+ * with the coefficient to use in order to convert meters to the unit.
+ *
+ * On error C_ERR is returned and an error is sent to the client. */
+int extractBoxOrReply(client *c, robj **argv, double *width, double *height,
+                      double *conversion) {
+    double w, h;
+
+    if (getDoubleFromObjectOrReply(c, argv[0], &w,
+                                   "need numeric width") != C_OK ||
+        getDoubleFromObjectOrReply(c, argv[1], &h,
+                                   "need numeric height") != C_OK)
+    {
+        return C_ERR;
+    }
+
+    if (w < 0 || h < 0) {
+        addReplyError(c,"height or width cannot be negative");
+        return C_ERR;
+    }
+
+    double to_meters = extractUnitOrReply(c,argv[2]);
+    if (to_meters < 0) return C_ERR;
+
+    *width = w * to_meters;
+    *height = h * to_meters;
+    *conversion = to_meters;
+    return C_OK;
+}
+
 /* The default addReplyDouble has too much accuracy.  We use this
  * for returning location distances. "5.2145 meters away" is nicer
  * than "5.2144992818115 meters away." We provide 4 digits after the dot
@@ -182,59 +218,307 @@ void addReplyDoubleDistance(client *c, double d) {
     addReplyBulkCBuffer(c, dbuf, dlen);
 }
 
-/* Helper function for geoGetPointsInRange(): given a sorted set score
- * representing a point, and another point (the center of our search) and
- * a radius, appends this entry as a geoPoint into the specified geoArray
- * only if the point is within the search area.
+/* ====================================================================
+ * Batched distance kernels
+ * ==================================================================== */
+
+/* The points found in the sorted set ranges are not tested one after the
+ * other: their scores are collected in batches of GEO_BATCH_SIZE elements,
+ * that are decoded together, and then tested against the search area by
+ * a kernel processing arrays of coordinates. Instead of calling the libm
+ * trigonometric functions per point, the kernels compute the haversine of
+ * the distance using a polynomial approximation of sin() that is accurate
+ * to a few ULPs in [-PI/2,PI/2], so that the same code is vectorized with
+ * AVX2 on x86-64. The distance itself (that needs asin()) is only computed
+ * for the points inside the area.
  *
- * returns C_OK if the point is included, or REIDS_ERR if it is outside. */
-int geoAppendIfWithinRadius(geoArray *ga, double lon, double lat, double radius, double score, sds member) {
-    double distance, xy[2];
-
-    if (!decodeGeohash(score,xy)) return C_ERR; /* Can't decode. */
-    /* Note that geohashGetDistanceIfInRadiusWGS84() takes arguments in
-     * reverse order: longitude first, latitude later. */
-    if (!geohashGetDistanceIfInRadiusWGS84(lon,lat, xy[0], xy[1],
-                                           radius, &distance))
-    {
-        return C_ERR;
+ * Like in bitops.c, every kernel must return exactly the same result as
+ * the portable code: the AVX2 kernel performs the same operations in the
+ * same order, without fused multiply-add. */
+
+#define GEO_KERNEL_SCALAR 0
+#define GEO_KERNEL_AVX2 1
+
+#define GEO_BATCH_SIZE 64
+#define GEO_D_R (M_PI / 180.0)
+
+/* The search area in the form used by the kernels. */
+typedef struct geoShapeParams {
+    int type;           /* GEO_SHAPE_CIRCLE or GEO_SHAPE_RECTANGLE. */
+    double lon, lat;    /* Center of the search, in radians. */
+    double coslat;      /* Cosine of the center latitude. */
+    double maxa;        /* Circle: max haversine of the distance. */
+    double maxdlat;     /* Rectangle: max latitude difference, in radians. */
+    double maxlona;     /* Rectangle: max haversine along the parallel. */
+} geoShapeParams;
+
+/* Candidates collected while scanning the sorted set. */
+typedef struct geoBatch {
+    int count;
+    uint64_t bits[GEO_BATCH_SIZE];  /* Geohashes. */
+    double score[GEO_BATCH_SIZE];
+    void *ele[GEO_BATCH_SIZE];      /* Ziplist entry or member object. */
+    double lon[GEO_BATCH_SIZE];
+    double lat[GEO_BATCH_SIZE];
+    double a[GEO_BATCH_SIZE];       /* Haversine of the distance. */
+    unsigned char inside[GEO_BATCH_SIZE];
+} geoBatch;
+
+static struct {
+    int level;  /* GEO_KERNEL_* in use, -1 if not selected yet. */
+    /* Set inside[j] to 1 if lon[j],lat[j] (in degrees) is inside the area
+     * described by 'p', and a[j] to the haversine of the distance between
+     * the point and the center of the search, for 'count' points. */
+    void (*within)(geoShapeParams *p, const double *lon, const double *lat,
+                   double *a, unsigned char *inside, int count);
+} geoKernels = {-1, NULL};
+
+/* Taylor coefficients of sin(x)/x in x^2, enough terms for an error
+ * smaller than 1e-18 in [-PI/2,PI/2]. */
+#define GEO_SIN_TERMS 11
+static const double geoSinCoeff[GEO_SIN_TERMS] = {
+    1.0, -1.0/6, 1.0/120, -1.0/5040, 1.0/362880, -1.0/39916800,
+    1.0/6227020800.0, -1.0/1307674368000.0, 1.0/355687428096000.0,
+    -1.0/121645100408832000.0, 1.0/51090942171709440000.0
+};
+
+/* sin(x) for x in [-PI/2,PI/2]. */
+static inline double geoSin(double x) {
+    double x2 = x*x, p = geoSinCoeff[GEO_SIN_TERMS-1];
+    int k;
+
+    for (k = GEO_SIN_TERMS-2; k >= 0; k--) p = p*x2 + geoSinCoeff[k];
+    return x*p;
+}
+
+/* Populate the kernel parameters for the search area 'shape'. */
+static void geoShapeParamsInit(GeoShape *shape, geoShapeParams *p) {
+    double d;
+
+    p->type = shape->type;
+    p->lon = shape->xy[0] * GEO_D_R;
+    p->lat = shape->xy[1] * GEO_D_R;
+    p->coslat = cos(p->lat);
+    p->maxa = p->maxdlat = p->maxlona = 0;
+    if (shape->type == GEO_SHAPE_CIRCLE) {
+        /* distance <= radius if hav(distance/R) <= hav(radius/R). Areas
+         * larger than half the circumference include everything. */
+        d = shape->radius / EARTH_RADIUS_IN_METERS / 2;
+        p->maxa = d < M_PI/2 ? sin(d)*sin(d) : 2;
+    } else {
+        p->maxdlat = shape->height / 2 / EARTH_RADIUS_IN_METERS;
+        d = shape->width / 4 / EARTH_RADIUS_IN_METERS;
+        p->maxlona = d < M_PI/2 ? sin(d)*sin(d) : 2;
     }
+}
 
-    /* Append the new element. */
-    geoPoint *gp = geoArrayAppend(ga);
-    gp->longitude = xy[0];
-    gp->latitude = xy[1];
-    gp->dist = distance;
-    gp->member = member;
-    gp->score = score;
-    return C_OK;
+static void geoWithinScalar(geoShapeParams *p, const double *lon,
+                            const double *lat, double *a,
+                            unsigned char *inside, int count)
+{
+    int j;
+
+    for (j = 0; j < count; j++) {
+        double lat2r = lat[j] * GEO_D_R, lon2r = lon[j] * GEO_D_R;
+        double dlat = (lat2r - p->lat) / 2;
+        double dlon = fabs((lon2r - p->lon) / 2);
+        double u, v, c2;
+
+        /* sin(x)^2 == sin(PI-x)^2, so fold the longitude difference
+         * into the range of geoSin(). Same for cos(lat) == sin(PI/2-lat). */
+        if (dlon > M_PI/2) dlon = M_PI - dlon;
+        u = geoSin(dlat);
+        v = geoSin(dlon);
+        c2 = geoSin(M_PI/2 - fabs(lat2r));
+        a[j] = u*u + p->coslat*c2*v*v;
+        if (p->type == GEO_SHAPE_CIRCLE) {
+            inside[j] = a[j] <= p->maxa;
+        } else {
+            inside[j] = fabs(lat2r - p->lat) <= p->maxdlat &&
+                        c2*c2*v*v <= p->maxlona;
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline __m256d geoSinAVX2(__m256d x) {
+    __m256d x2 = _mm256_mul_pd(x,x);
+    __m256d p = _mm256_set1_pd(geoSinCoeff[GEO_SIN_TERMS-1]);
+    int k;
+
+    for (k = GEO_SIN_TERMS-2; k >= 0; k--)
+        p = _mm256_add_pd(_mm256_mul_pd(p,x2),_mm256_set1_pd(geoSinCoeff[k]));
+    return _mm256_mul_pd(x,p);
+}
+
+__attribute__((target("avx2")))
+static void geoWithinAVX2(geoShapeParams *p, const double *lon,
+                          const double *lat, double *a,
+                          unsigned char *inside, int count)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d d_r = _mm256_set1_pd(GEO_D_R);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d pi = _mm256_set1_pd(M_PI);
+    const __m256d pi2 = _mm256_set1_pd(M_PI/2);
+    const __m256d clon = _mm256_set1_pd(p->lon);
+    const __m256d clat = _mm256_set1_pd(p->lat);
+    const __m256d coslat = _mm256_set1_pd(p->coslat);
+    int j;
+
+    for (j = 0; j+4 <= count; j += 4) {
+        __m256d lat2r = _mm256_mul_pd(_mm256_loadu_pd(lat+j),d_r);
+        __m256d lon2r = _mm256_mul_pd(_mm256_loadu_pd(lon+j),d_r);
+        __m256d dlat = _mm256_mul_pd(_mm256_sub_pd(lat2r,clat),half);
+        __m256d dlon = _mm256_andnot_pd(sign,
+            _mm256_mul_pd(_mm256_sub_pd(lon2r,clon),half));
+        __m256d u, v, c2, va, in;
+        int mask, k;
+
+        dlon = _mm256_blendv_pd(dlon,_mm256_sub_pd(pi,dlon),
+                                _mm256_cmp_pd(dlon,pi2,_CMP_GT_OQ));
+        u = geoSinAVX2(dlat);
+        v = geoSinAVX2(dlon);
+        c2 = geoSinAVX2(_mm256_sub_pd(pi2,_mm256_andnot_pd(sign,lat2r)));
+        va = _mm256_add_pd(_mm256_mul_pd(u,u),
+             _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(coslat,c2),v),v));
+        _mm256_storeu_pd(a+j,va);
+        if (p->type == GEO_SHAPE_CIRCLE) {
+            in = _mm256_cmp_pd(va,_mm256_set1_pd(p->maxa),_CMP_LE_OQ);
+        } else {
+            __m256d dl = _mm256_andnot_pd(sign,_mm256_sub_pd(lat2r,clat));
+            __m256d la = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(c2,c2),v),v);
+            in = _mm256_and_pd(
+                _mm256_cmp_pd(dl,_mm256_set1_pd(p->maxdlat),_CMP_LE_OQ),
+                _mm256_cmp_pd(la,_mm256_set1_pd(p->maxlona),_CMP_LE_OQ));
+        }
+        mask = _mm256_movemask_pd(in);
+        for (k = 0; k < 4; k++) inside[j+k] = (mask >> k) & 1;
+    }
+    _mm256_zeroupper(); /* See redisPopcountAVX2() in bitops.c. */
+    geoWithinScalar(p,lon+j,lat+j,a+j,inside+j,count-j);
+}
+#endif /* HAVE_X86_SIMD_DISPATCH */
+
+/* Return the best kernel level supported by this CPU. */
+static int geoMaxKernelLevel(void) {
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (cpuHasFeatures(CPU_FEATURE_AVX2)) return GEO_KERNEL_AVX2;
+#endif
+    return GEO_KERNEL_SCALAR;
+}
+
+/* Use the distance kernel of 'level' to filter the search candidates, if
+ * this CPU supports it, otherwise the scalar one. Returns the level used. */
+static int geoSelectKernels(int level) {
+    int max = geoMaxKernelLevel();
+
+    if (level > max) level = max;
+    geoKernels.level = level;
+    geoKernels.within = geoWithinScalar;
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (level == GEO_KERNEL_AVX2) geoKernels.within = geoWithinAVX2;
+#endif
+    return level;
+}
+
+#define geoInitKernels() do { \
+    if (geoKernels.level == -1) \
+        geoSelectKernels(GEO_KERNEL_AVX2); \
+} while(0)
+
+/* Test the candidates in the batch, appending the ones inside the search
+ * area to the geoArray. Only at this point the member strings are created.
+ * Returns 1 if the array reached 'limit' elements (when not zero),
+ * otherwise 0. The batch is emptied. */
+static int geoBatchFlush(robj *zobj, geoBatch *b, geoShapeParams *p,
+                         geoArray *ga, unsigned long limit)
+{
+    int j;
+
+    if (b->count) {
+        geohashDecodeToLongLatBatchWGS84(b->bits,b->lon,b->lat,b->count);
+        geoInitKernels();
+        geoKernels.within(p,b->lon,b->lat,b->a,b->inside,b->count);
+    }
+
+    for (j = 0; j < b->count; j++) {
+        sds member;
+
+        if (!b->inside[j]) continue;
+        if (limit && ga->used >= limit) break;
+        if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+            unsigned char *vstr = NULL;
+            unsigned int vlen = 0;
+            long long vlong = 0;
+
+            /* We know the element exists. ziplistGet should always
+             * succeed */
+            ziplistGet(b->ele[j], &vstr, &vlen, &vlong);
+            member = (vstr == NULL) ? sdsfromlonglong(vlong) :
+                                      sdsnewlen(vstr,vlen);
+        } else {
+            robj *o = b->ele[j];
+            member = (o->encoding == OBJ_ENCODING_INT) ?
+                        sdsfromlonglong((long)o->ptr) :
+                        sdsdup(o->ptr);
+        }
+
+        geoPoint *gp = geoArrayAppend(ga);
+        gp->longitude = b->lon[j];
+        gp->latitude = b->lat[j];
+        gp->dist = 2.0 * EARTH_RADIUS_IN_METERS * asin(sqrt(b->a[j]));
+        gp->member = member;
+        gp->score = b->score[j];
+    }
+    b->count = 0;
+    return limit && ga->used >= limit;
+}
+
+/* Add a candidate to the batch, flushing it when full. Returns 1 if the
+ * scan should stop because 'limit' elements were found. */
+static int geoBatchAdd(robj *zobj, geoBatch *b, geoShapeParams *p,
+                       geoArray *ga, unsigned long limit,
+                       double score, void *ele)
+{
+    b->bits[b->count] = (uint64_t)score;
+    b->score[b->count] = score;
+    b->ele[b->count] = ele;
+    if (++b->count < GEO_BATCH_SIZE) return 0;
+    return geoBatchFlush(zobj,b,p,ga,limit);
 }
 
 /* Query a Redis sorted set to extract all the elements between 'min' and
  * 'max', appending them into the array of geoPoint structures 'gparray'.
  * The command returns the number of elements added to the array.
  *
- * Elements which are farest than 'radius' from the specified 'x' and 'y'
- * coordinates are not included.
+ * Elements which are outside the search area 'shape' are not included.
+ * If 'limit' is not zero, the scan stops as soon as the array contains
+ * 'limit' elements (used to implement the ANY option).
  *
  * The ability of this function to append to an existing set of points is
  * important for good performances because querying by radius is performed
  * using multiple queries to the sorted set, that we later need to sort
  * via qsort. Similarly we need to be able to reject points outside the search
- * radius area ASAP in order to allocate and process more points than needed. */
-int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double lat, double radius, geoArray *ga) {
+ * area ASAP, so the member string is only created for the points that
+ * are going to be returned. */
+int geoGetPointsInRange(robj *zobj, double min, double max, GeoShape *shape, geoArray *ga, unsigned long limit) {
     /* minex 0 = include min in range; maxex 1 = exclude max in range */
     /* That's: min <= val < max */
     zrangespec range = { .min = min, .max = max, .minex = 0, .maxex = 1 };
     size_t origincount = ga->used;
-    sds member;
+    geoShapeParams params;
+    geoBatch batch;
+
+    geoShapeParamsInit(shape,&params);
+    batch.count = 0;
 
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
-        unsigned char *vstr = NULL;
-        unsigned int vlen = 0;
-        long long vlong = 0;
         double score = 0;
 
         if ((eptr = zzlFirstInRange(zl, &range)) == NULL) {
@@ -250,12 +534,7 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
             if (!zslValueLteMax(score, &range))
                 break;
 
-            /* We know the element exists. ziplistGet should always succeed */
-            ziplistGet(eptr, &vstr, &vlen, &vlong);
-            member = (vstr == NULL) ? sdsfromlonglong(vlong) :
-                                      sdsnewlen(vstr,vlen);
-            if (geoAppendIfWithinRadius(ga,lon,lat,radius,score,member)
-                == C_ERR) sdsfree(member);
+            if (geoBatchAdd(zobj,&batch,&params,ga,limit,score,eptr)) break;
             zzlNext(zl, &eptr, &sptr);
         }
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -269,19 +548,35 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
         }
 
         while (ln) {
-            robj *o = ln->obj;
             /* Abort when the node is no longer in range. */
             if (!zslValueLteMax(ln->score, &range))
                 break;
 
-            member = (o->encoding == OBJ_ENCODING_INT) ?
-                        sdsfromlonglong((long)o->ptr) :
-                        sdsdup(o->ptr);
-            if (geoAppendIfWithinRadius(ga,lon,lat,radius,ln->score,member)
-                == C_ERR) sdsfree(member);
+            if (geoBatchAdd(zobj,&batch,&params,ga,limit,ln->score,ln->obj))
+                break;
             ln = ln->level[0].forward;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeCursor cur;
+
+        if (!zbtFirstInRange(zs->zbt, &range, &cur)) {
+            /* Nothing exists starting at our min.  No results. */
+            return 0;
+        }
+
+        while (cur.leaf) {
+            double score = zbtCursorScore(&cur);
+            /* Abort when the element is no longer in range. */
+            if (!zslValueLteMax(score, &range))
+                break;
+
+            if (geoBatchAdd(zobj,&batch,&params,ga,limit,score,
+                            zbtCursorObj(&cur))) break;
+            zbtNext(&cur);
+        }
     }
+    geoBatchFlush(zobj,&batch,&params,ga,limit);
     return ga->used - origincount;
 }
 
@@ -317,15 +612,17 @@ void scoresOfGeoHashBox(GeoHashBits hash, GeoHashFix52Bits *min, GeoHashFix52Bit
 /* Obtain all members between the min/max of this geohash bounding box.
  * Populate a geoArray of GeoPoints by calling geoGetPointsInRange().
  * Return the number of points added to the array. */
-int membersOfGeoHashBox(robj *zobj, GeoHashBits hash, geoArray *ga, double lon, double lat, double radius) {
+int membersOfGeoHashBox(robj *zobj, GeoHashBits hash, geoArray *ga, GeoShape *shape, unsigned long limit) {
     GeoHashFix52Bits min, max;
 
     scoresOfGeoHashBox(hash,&min,&max);
-    return geoGetPointsInRange(zobj, min, max, lon, lat, radius, ga);
+    return geoGetPointsInRange(zobj, min, max, shape, ga, limit);
 }
 
-/* Search all eight neighbors + self geohash box */
-int membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double lon, double lat, double radius, geoArray *ga) {
+/* Search all eight neighbors + self geohash box. The neighbors that can't
+ * intersect the search area were already zeroed by
+ * geohashGetAreasByShapeWGS84(). */
+int membersOfAllNeighbors(robj *zobj, GeoHashRadius n, GeoShape *shape, geoArray *ga, unsigned long limit) {
     GeoHashBits neighbors[9];
     unsigned int i, count = 0, last_processed = 0;
     int debugmsg = 0;
@@ -376,7 +673,9 @@ int membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double lon, double lat, d
                 D("Skipping processing of %d, same as previous\n",i);
             continue;
         }
-        count += membersOfGeoHashBox(zobj, neighbors[i], ga, lon, lat, radius);
+        /* With ANY, stop as soon as enough matches were found. */
+        if (limit && ga->used >= limit) break;
+        count += membersOfGeoHashBox(zobj, neighbors[i], ga, shape, limit);
         last_processed = i;
     }
     return count;
@@ -457,52 +756,63 @@ void geoaddCommand(client *c) {
 #define RADIUS_COORDS (1<<0)    /* Search around coordinates. */
 #define RADIUS_MEMBER (1<<1)    /* Search around member. */
 #define RADIUS_NOSTORE (1<<2)   /* Do not acceot STORE/STOREDIST option. */
+#define GEOSEARCH (1<<3)        /* GEOSEARCH command variant (different arguments supported) */
+#define GEOSEARCHSTORE (1<<4)   /* GEOSEARCHSTORE just accept STOREDIST option */
 
 /* GEORADIUS key x y radius unit [WITHDIST] [WITHHASH] [WITHCOORD] [ASC|DESC]
- *                               [COUNT count] [STORE key] [STOREDIST key]
- * GEORADIUSBYMEMBER key member radius unit ... options ... */
-void georadiusGeneric(client *c, int flags) {
-    robj *key = c->argv[1];
+ *                               [COUNT count [ANY]] [STORE key] [STOREDIST key]
+ * GEORADIUSBYMEMBER key member radius unit ... options ...
+ * GEOSEARCH key [FROMMEMBER member] [FROMLONLAT long lat] [BYRADIUS radius unit]
+ *               [BYBOX width height unit] [WITHCOORD] [WITHDIST] [WITHASH]
+ *               [COUNT count [ANY]] [ASC|DESC]
+ * GEOSEARCHSTORE dest_key src_key [FROMMEMBER member] [FROMLONLAT long lat]
+ *               [BYRADIUS radius unit] [BYBOX width height unit]
+ *               [COUNT count [ANY]] [ASC|DESC] [STOREDIST]
+ *
+ * 'srcKeyIndex' is the index of the source sorted set in the arguments. */
+void georadiusGeneric(client *c, int srcKeyIndex, int flags) {
     robj *storekey = NULL;
     int storedist = 0; /* 0 for STORE, 1 for STOREDIST. */
 
     /* Look up the requested zset */
-    robj *zobj = NULL;
-    if ((zobj = lookupKeyReadOrReply(c, key, shared.emptymultibulk)) == NULL ||
-        checkType(c, zobj, OBJ_ZSET)) {
-        return;
-    }
+    robj *zobj = lookupKeyRead(c->db, c->argv[srcKeyIndex]);
+    if (zobj && checkType(c, zobj, OBJ_ZSET)) return;
 
-    /* Find long/lat to use for radius search based on inquiry type */
+    /* Find long/lat to use for radius or box search based on inquiry type */
     int base_args;
-    double xy[2] = { 0 };
+    GeoShape shape = {0};
+    robj *member = NULL;
     if (flags & RADIUS_COORDS) {
+        /* GEORADIUS or GEORADIUS_RO */
         base_args = 6;
-        if (extractLongLatOrReply(c, c->argv + 2, xy) == C_ERR)
+        shape.type = GEO_SHAPE_CIRCLE;
+        if (extractLongLatOrReply(c, c->argv + 2, shape.xy) == C_ERR) return;
+        if ((shape.radius = extractDistanceOrReply(c, c->argv + base_args - 2,
+                                                   &shape.conversion)) < 0)
             return;
     } else if (flags & RADIUS_MEMBER) {
+        /* GEORADIUSBYMEMBER or GEORADIUSBYMEMBER_RO */
         base_args = 5;
-        robj *member = c->argv[2];
-        if (longLatFromMember(zobj, member, xy) == C_ERR) {
-            addReplyError(c, "could not decode requested zset member");
+        shape.type = GEO_SHAPE_CIRCLE;
+        member = c->argv[2];
+        if ((shape.radius = extractDistanceOrReply(c, c->argv + base_args - 2,
+                                                   &shape.conversion)) < 0)
             return;
-        }
+    } else if (flags & GEOSEARCH) {
+        /* GEOSEARCH or GEOSEARCHSTORE */
+        base_args = srcKeyIndex + 1;
+        if (flags & GEOSEARCHSTORE) storekey = c->argv[1];
     } else {
         addReplyError(c, "Unknown georadius search type");
         return;
     }
 
-    /* Extract radius and units from arguments */
-    double radius_meters = 0, conversion = 1;
-    if ((radius_meters = extractDistanceOrReply(c, c->argv + base_args - 2,
-                                                &conversion)) < 0) {
-        return;
-    }
-
     /* Discover and populate all optional parameters. */
     int withdist = 0, withhash = 0, withcoords = 0;
+    int frommember = 0, fromloc = 0, byradius = 0, bybox = 0;
     int sort = SORT_NONE;
-    long long count = 0;
+    int any = 0; /* any=1 means a limited search, stop as soon as enough results were found. */
+    long long count = 0;  /* Max number of results to return. 0 means unlimited. */
     if (c->argc > base_args) {
         int remaining = c->argc - base_args;
         for (int i = 0; i < remaining; i++) {
@@ -513,6 +823,8 @@ void georadiusGeneric(client *c, int flags) {
                 withhash = 1;
             } else if (!strcasecmp(arg, "withcoord")) {
                 withcoords = 1;
+            } else if (!strcasecmp(arg, "any")) {
+                any = 1;
             } else if (!strcasecmp(arg, "asc")) {
                 sort = SORT_ASC;
             } else if (!strcasecmp(arg, "desc")) {
@@ -527,18 +839,64 @@ void georadiusGeneric(client *c, int flags) {
                 i++;
             } else if (!strcasecmp(arg, "store") &&
                        (i+1) < remaining &&
-                       !(flags & RADIUS_NOSTORE))
+                       !(flags & RADIUS_NOSTORE) &&
+                       !(flags & GEOSEARCH))
             {
                 storekey = c->argv[base_args+i+1];
                 storedist = 0;
                 i++;
             } else if (!strcasecmp(arg, "storedist") &&
                        (i+1) < remaining &&
-                       !(flags & RADIUS_NOSTORE))
+                       !(flags & RADIUS_NOSTORE) &&
+                       !(flags & GEOSEARCH))
             {
                 storekey = c->argv[base_args+i+1];
                 storedist = 1;
                 i++;
+            } else if (!strcasecmp(arg, "storedist") &&
+                       (flags & GEOSEARCH) &&
+                       (flags & GEOSEARCHSTORE))
+            {
+                storedist = 1;
+            } else if (!strcasecmp(arg, "frommember") &&
+                      (i+1) < remaining &&
+                      flags & GEOSEARCH &&
+                      !fromloc)
+            {
+                member = c->argv[base_args+i+1];
+                frommember = 1;
+                i++;
+            } else if (!strcasecmp(arg, "fromlonlat") &&
+                       (i+2) < remaining &&
+                       flags & GEOSEARCH &&
+                       !frommember)
+            {
+                if (extractLongLatOrReply(c, c->argv+base_args+i+1,
+                                          shape.xy) == C_ERR) return;
+                fromloc = 1;
+                i += 2;
+            } else if (!strcasecmp(arg, "byradius") &&
+                       (i+2) < remaining &&
+                       flags & GEOSEARCH &&
+                       !bybox)
+            {
+                if ((shape.radius = extractDistanceOrReply(c,
+                        c->argv+base_args+i+1, &shape.conversion)) < 0)
+                    return;
+                shape.type = GEO_SHAPE_CIRCLE;
+                byradius = 1;
+                i += 2;
+            } else if (!strcasecmp(arg, "bybox") &&
+                       (i+3) < remaining &&
+                       flags & GEOSEARCH &&
+                       !byradius)
+            {
+                if (extractBoxOrReply(c, c->argv+base_args+i+1,
+                        &shape.width, &shape.height,
+                        &shape.conversion) == C_ERR) return;
+                shape.type = GEO_SHAPE_RECTANGLE;
+                bybox = 1;
+                i += 3;
             } else {
                 addReply(c, shared.syntaxerr);
                 return;
@@ -548,23 +906,67 @@ void georadiusGeneric(client *c, int flags) {
 
     /* Trap options not compatible with STORE and STOREDIST. */
     if (storekey && (withdist || withhash || withcoords)) {
-        addReplyError(c,
-            "STORE option in GEORADIUS is not compatible with "
-            "WITHDIST, WITHHASH and WITHCOORDS options");
+        addReplyErrorFormat(c,
+            "%s is not compatible with WITHDIST, WITHHASH and WITHCOORD options",
+            flags & GEOSEARCHSTORE? "GEOSEARCHSTORE": "STORE option in GEORADIUS");
+        return;
+    }
+
+    if ((flags & GEOSEARCH) && !(frommember || fromloc)) {
+        addReplyErrorFormat(c,
+            "exactly one of FROMMEMBER or FROMLONLAT can be specified for %s",
+            (char *)c->argv[0]->ptr);
+        return;
+    }
+
+    if ((flags & GEOSEARCH) && !(byradius || bybox)) {
+        addReplyErrorFormat(c,
+            "exactly one of BYRADIUS and BYBOX can be specified for %s",
+            (char *)c->argv[0]->ptr);
         return;
     }
 
-    /* COUNT without ordering does not make much sense, force ASC
-     * ordering if COUNT was specified but no sorting was requested. */
-    if (count != 0 && sort == SORT_NONE) sort = SORT_ASC;
+    if (any && !count) {
+        addReplyErrorFormat(c, "the ANY argument requires COUNT argument");
+        return;
+    }
 
-    /* Get all neighbor geohash boxes for our radius search */
-    GeoHashRadius georadius =
-        geohashGetAreasByRadiusWGS84(xy[0], xy[1], radius_meters);
+    /* Return ASAP when src key does not exist. */
+    if (zobj == NULL) {
+        if (flags & GEOSEARCHSTORE) {
+            /* Like GEORADIUS STORE, the destination is deleted when the
+             * result is empty. */
+            if (dbDelete(c->db,storekey)) {
+                signalModifiedKey(c->db,storekey);
+                notifyKeyspaceEvent(NOTIFY_GENERIC,"del",storekey,c->db->id);
+                server.dirty++;
+            }
+            addReply(c,shared.czero);
+        } else {
+            addReply(c,shared.emptymultibulk);
+        }
+        return;
+    }
+
+    /* Resolve the center of the search when it is a member. */
+    if (member && longLatFromMember(zobj, member, shape.xy) == C_ERR) {
+        addReplyError(c, "could not decode requested zset member");
+        return;
+    }
+
+    /* COUNT without ordering does not make much sense (we need to
+     * sort in order to return the closest N entries),
+     * force ASC ordering if COUNT was specified but no sorting was
+     * requested. Note that this is not needed for ANY option. */
+    if (count != 0 && sort == SORT_NONE && !any) sort = SORT_ASC;
+
+    /* Get all neighbor geohash boxes for our search, dropping the ones
+     * that can't intersect the search area. */
+    GeoHashRadius georadius = geohashGetAreasByShapeWGS84(&shape);
 
     /* Search the zset for all matching points */
     geoArray *ga = geoArrayCreate();
-    membersOfAllNeighbors(zobj, georadius, xy[0], xy[1], radius_meters, ga);
+    membersOfAllNeighbors(zobj, georadius, &shape, ga, any ? count : 0);
 
     /* If no matching results, the user gets an empty reply. */
     if (ga->used == 0 && storekey == NULL) {
@@ -578,11 +980,20 @@ void georadiusGeneric(client *c, int flags) {
                           result_length : count;
     long option_length = 0;
 
-    /* Process [optional] requested sorting */
-    if (sort == SORT_ASC) {
-        qsort(ga->array, result_length, sizeof(geoPoint), sort_gp_asc);
-    } else if (sort == SORT_DESC) {
-        qsort(ga->array, result_length, sizeof(geoPoint), sort_gp_desc);
+    /* Process [optional] requested sorting. When only the first COUNT
+     * items are returned, just partially sort the array, since in the
+     * common "nearest N" query the matches are many more than N. */
+    if (sort != SORT_NONE) {
+        int (*sort_gp_callback)(const void *a, const void *b) =
+            (sort == SORT_ASC) ? sort_gp_asc : sort_gp_desc;
+
+        if (returned_items < result_length) {
+            pqsort(ga->array, result_length, sizeof(geoPoint),
+                   sort_gp_callback, 0, returned_items-1);
+        } else {
+            qsort(ga->array, result_length, sizeof(geoPoint),
+                  sort_gp_callback);
+        }
     }
 
     if (storekey == NULL) {
@@ -609,7 +1020,7 @@ void georadiusGeneric(client *c, int flags) {
         int i;
         for (i = 0; i < returned_items; i++) {
             geoPoint *gp = ga->array+i;
-            gp->dist /= conversion; /* Fix according to unit. */
+            gp->dist /= shape.conversion; /* Fix according to unit. */
 
             /* If we have options in option_length, return each sub-result
              * as a nested multi-bulk.  Add 1 to account for result value
@@ -634,29 +1045,24 @@ void georadiusGeneric(client *c, int flags) {
         }
     } else {
         /* Target key, create a sorted set with the results. */
-        robj *zobj;
-        zset *zs;
+        robj *zobj = NULL;
         int i;
         size_t maxelelen = 0;
 
         if (returned_items) {
             zobj = createZsetObject();
-            zs = zobj->ptr;
         }
 
         for (i = 0; i < returned_items; i++) {
-            zskiplistNode *znode;
             geoPoint *gp = ga->array+i;
-            gp->dist /= conversion; /* Fix according to unit. */
+            gp->dist /= shape.conversion; /* Fix according to unit. */
             double score = storedist ? gp->dist : gp->score;
             size_t elelen = sdslen(gp->member);
             robj *ele = createObject(OBJ_STRING,gp->member);
 
             if (maxelelen < elelen) maxelelen = elelen;
-            incrRefCount(ele); /* Set refcount to 2 since we reference the
-                                  object both in the skiplist and dict. */
-            znode = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+            zsetInsertNew(zobj,score,ele);
+            decrRefCount(ele);
             gp->member = NULL;
         }
 
@@ -664,8 +1070,10 @@ void georadiusGeneric(client *c, int flags) {
             zsetConvertToZiplistIfNeeded(zobj,maxelelen);
             setKey(c->db,storekey,zobj);
             decrRefCount(zobj);
-            notifyKeyspaceEvent(NOTIFY_LIST,"georadiusstore",storekey,
-                                c->db->id);
+            notifyKeyspaceEvent(NOTIFY_ZSET,
+                                flags & GEOSEARCH ? "geosearchstore" :
+                                                    "georadiusstore",
+                                storekey,c->db->id);
             server.dirty += returned_items;
         } else if (dbDelete(c->db,storekey)) {
             signalModifiedKey(c->db,storekey);
@@ -679,22 +1087,32 @@ void georadiusGeneric(client *c, int flags) {
 
 /* GEORADIUS wrapper function. */
 void georadiusCommand(client *c) {
-    georadiusGeneric(c, RADIUS_COORDS);
+    georadiusGeneric(c, 1, RADIUS_COORDS);
 }
 
 /* GEORADIUSBYMEMBER wrapper function. */
 void georadiusbymemberCommand(client *c) {
-    georadiusGeneric(c, RADIUS_MEMBER);
+    georadiusGeneric(c, 1, RADIUS_MEMBER);
 }
 
 /* GEORADIUS_RO wrapper function. */
 void georadiusroCommand(client *c) {
-    georadiusGeneric(c, RADIUS_COORDS|RADIUS_NOSTORE);
+    georadiusGeneric(c, 1, RADIUS_COORDS|RADIUS_NOSTORE);
 }
 
 /* GEORADIUSBYMEMBER_RO wrapper function. */
 void georadiusbymemberroCommand(client *c) {
-    georadiusGeneric(c, RADIUS_MEMBER|RADIUS_NOSTORE);
+    georadiusGeneric(c, 1, RADIUS_MEMBER|RADIUS_NOSTORE);
+}
+
+/* GEOSEARCH wrapper function. */
+void geosearchCommand(client *c) {
+    georadiusGeneric(c, 1, GEOSEARCH);
+}
+
+/* GEOSEARCHSTORE wrapper function. */
+void geosearchstoreCommand(client *c) {
+    georadiusGeneric(c, 2, GEOSEARCH|GEOSEARCHSTORE);
 }
 
 /* GEOHASH key ele1 ele2 ... eleN
@@ -823,3 +1241,197 @@ void geodistCommand(client *c) {
         addReplyDoubleDistance(c,
             geohashGetDistance(xyxy[0],xyxy[1],xyxy[2],xyxy[3]) / to_meter);
 }
+
+#ifdef REDIS_TEST
+static const char *geoKernelName[] = {"scalar","avx2"};
+
+static double geoTestRand(double min, double max) {
+    return min + (max-min)*((double)rand()/RAND_MAX);
+}
+
+/* Check the BMI2 geohash interleaving and every kernel level supported by
+ * this CPU against the portable code, then print a few throughput
+ * numbers. */
+int geoTest(int argc, char *argv[]) {
+    int level, maxlevel, bmi2, j, iter, err = 0;
+    int count = 1024*64;
+    uint64_t *bits = zmalloc(sizeof(uint64_t)*count);
+    double *lon = zmalloc(sizeof(double)*count);
+    double *lat = zmalloc(sizeof(double)*count);
+    double *a = zmalloc(sizeof(double)*count);
+    double *ref = zmalloc(sizeof(double)*count);
+    unsigned char *inside = zmalloc(count);
+    long long start;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(1234);
+
+    /* Encoding and decoding with and without BMI2. */
+    bmi2 = geohashSelectBMI2(cpuHasFeatures(CPU_FEATURE_BMI2));
+    printf("Testing geohash interleaving (bmi2 %s): ",
+        bmi2 ? "available" : "not available");
+    for (j = 0; j < count; j++) {
+        GeoHashBits h1, h2;
+        double xy1[2], xy2[2];
+        double x = geoTestRand(GEO_LONG_MIN,GEO_LONG_MAX);
+        double y = geoTestRand(GEO_LAT_MIN,GEO_LAT_MAX);
+
+        geohashSelectBMI2(0);
+        geohashEncodeWGS84(x,y,GEO_STEP_MAX,&h1);
+        geohashDecodeToLongLatWGS84(h1,xy1);
+        geohashSelectBMI2(bmi2);
+        geohashEncodeWGS84(x,y,GEO_STEP_MAX,&h2);
+        geohashDecodeToLongLatWGS84(h2,xy2);
+        if (h1.bits != h2.bits || xy1[0] != xy2[0] || xy1[1] != xy2[1]) err++;
+
+        bits[j] = h1.bits;
+        ref[j] = xy1[0];
+        a[j] = xy1[1];
+    }
+    geohashDecodeToLongLatBatchWGS84(bits,lon,lat,count);
+    for (j = 0; j < count; j++)
+        if (lon[j] != ref[j] || lat[j] != a[j]) err++;
+    printf("%s\n", err ? "ERR" : "OK");
+
+    /* Kernels: random shapes, compared with the libm based distance. The
+     * result may only differ for points on the border of the area. */
+    maxlevel = geoMaxKernelLevel();
+    for (level = GEO_KERNEL_SCALAR; level <= maxlevel; level++) {
+        geoSelectKernels(level);
+        printf("Testing %s kernel: ", geoKernelName[level]);
+        for (iter = 0; iter < 200; iter++) {
+            GeoShape shape = {0};
+            geoShapeParams p;
+            int n = 1 + rand() % 1000;
+
+            shape.type = (iter & 1) ? GEO_SHAPE_RECTANGLE : GEO_SHAPE_CIRCLE;
+            shape.xy[0] = geoTestRand(GEO_LONG_MIN,GEO_LONG_MAX);
+            shape.xy[1] = geoTestRand(GEO_LAT_MIN,GEO_LAT_MAX);
+            shape.radius = geoTestRand(0,(iter & 2) ? 2e7 : 2e5);
+            shape.width = geoTestRand(0,(iter & 2) ? 4e7 : 4e5);
+            shape.height = geoTestRand(0,(iter & 2) ? 2e7 : 2e5);
+            geoShapeParamsInit(&shape,&p);
+            for (j = 0; j < n; j++) {
+                /* Half of the points near the center. */
+                double spread = (j & 1) ? 180 : 3;
+                lon[j] = shape.xy[0] + geoTestRand(-spread,spread);
+                lat[j] = shape.xy[1] + geoTestRand(-spread/2,spread/2);
+                if (lon[j] > GEO_LONG_MAX) lon[j] -= 360;
+                if (lon[j] < GEO_LONG_MIN) lon[j] += 360;
+                if (lat[j] > GEO_LAT_MAX) lat[j] = GEO_LAT_MAX;
+                if (lat[j] < GEO_LAT_MIN) lat[j] = GEO_LAT_MIN;
+            }
+            geoKernels.within(&p,lon,lat,a,inside,n);
+            for (j = 0; j < n; j++) {
+                double dist, kdist = 2.0*EARTH_RADIUS_IN_METERS*asin(sqrt(a[j]));
+                double limit;
+                int in;
+
+                if (shape.type == GEO_SHAPE_CIRCLE) {
+                    in = geohashGetDistanceIfInRadiusWGS84(shape.xy[0],
+                        shape.xy[1],lon[j],lat[j],shape.radius,&dist);
+                    dist = geohashGetDistance(shape.xy[0],shape.xy[1],
+                                              lon[j],lat[j]);
+                    limit = shape.radius;
+                } else {
+                    in = geohashGetDistanceIfInRectangle(shape.width,
+                        shape.height,shape.xy[0],shape.xy[1],lon[j],lat[j],
+                        &dist);
+                    dist = geohashGetDistance(shape.xy[0],shape.xy[1],
+                                              lon[j],lat[j]);
+                    limit = 0; /* Only checked on the border below. */
+                }
+                if (fabs(kdist-dist) > 1e-6 + dist*1e-12) err++;
+                if (in != inside[j]) {
+                    /* Tolerate a mismatch on the border only. */
+                    double lat_d = geohashGetLatDistance(shape.xy[1],lat[j]);
+                    double lon_d = geohashGetDistance(shape.xy[0],lat[j],
+                                                      lon[j],lat[j]);
+                    if (shape.type == GEO_SHAPE_CIRCLE) {
+                        if (fabs(dist-limit) > 1e-6) err++;
+                    } else if (fabs(lat_d-shape.height/2) > 1e-6 &&
+                               fabs(lon_d-shape.width/2) > 1e-6) {
+                        err++;
+                    }
+                }
+            }
+        }
+        printf("%s\n", err ? "ERR" : "OK");
+    }
+
+    /* Benchmarks. */
+    for (bmi2 = 0; bmi2 <= 1; bmi2++) {
+        GeoHashBits h;
+        uint64_t sum = 0;
+
+        if (bmi2 && !geohashSelectBMI2(cpuHasFeatures(CPU_FEATURE_BMI2)))
+            break;
+        if (!bmi2) geohashSelectBMI2(0);
+        start = ustime();
+        for (iter = 0; iter < 100; iter++) {
+            for (j = 0; j < count; j++) {
+                geohashEncodeWGS84(j*0.001,j*0.0005,GEO_STEP_MAX,&h);
+                sum += h.bits;
+            }
+            geohashDecodeToLongLatBatchWGS84(bits,lon,lat,count);
+        }
+        printf("%-7s encode+decode: %.2f Mpoints/s (%llu)\n",
+            bmi2 ? "bmi2" : "generic",
+            (double)count*100/(ustime()-start),
+            (unsigned long long)sum);
+    }
+
+    {
+        GeoShape shape = {0};
+        geoShapeParams p;
+        double sum = 0;
+
+        shape.type = GEO_SHAPE_CIRCLE;
+        shape.xy[0] = 13.361389;
+        shape.xy[1] = 38.115556;
+        shape.radius = 10000;
+        geoShapeParamsInit(&shape,&p);
+        for (j = 0; j < count; j++) {
+            lon[j] = shape.xy[0] + geoTestRand(-0.2,0.2);
+            lat[j] = shape.xy[1] + geoTestRand(-0.2,0.2);
+        }
+
+        start = ustime();
+        for (iter = 0; iter < 100; iter++) {
+            for (j = 0; j < count; j++) {
+                double dist;
+                if (geohashGetDistanceIfInRadiusWGS84(shape.xy[0],shape.xy[1],
+                    lon[j],lat[j],shape.radius,&dist)) sum += dist;
+            }
+        }
+        printf("%-7s distance: %.2f Mpoints/s (%.0f)\n", "libm",
+            (double)count*100/(ustime()-start), sum);
+
+        for (level = GEO_KERNEL_SCALAR; level <= maxlevel; level++) {
+            geoSelectKernels(level);
+            sum = 0;
+            start = ustime();
+            for (iter = 0; iter < 100; iter++) {
+                for (j = 0; j < count; j += GEO_BATCH_SIZE)
+                    geoKernels.within(&p,lon+j,lat+j,a+j,inside+j,
+                                      GEO_BATCH_SIZE);
+                for (j = 0; j < count; j++) sum += inside[j];
+            }
+            printf("%-7s distance: %.2f Mpoints/s (%.0f)\n",
+                geoKernelName[level],
+                (double)count*100/(ustime()-start), sum);
+        }
+    }
+
+    geohashSelectBMI2(cpuHasFeatures(CPU_FEATURE_BMI2));
+    geoSelectKernels(GEO_KERNEL_AVX2);
+    zfree(bits);
+    zfree(lon);
+    zfree(lat);
+    zfree(a);
+    zfree(ref);
+    zfree(inside);
+    return err ? 1 : 0;
+}
+#endif
@@ -385,6 +385,247 @@ static char *invalid_hll_err = "-INVALIDOBJ Corrupted HLL object detected\r\n";
     *((p)+1) = (_l&0xff); \
 } while(0)
 
+/* ========================= Dense registers kernels ========================
+ * Accessing the dense registers one at a time with the macros above is the
+ * bottleneck of PFCOUNT with multiple keys and of PFMERGE, so the following
+ * functions convert all the registers from / to an array of HLL_REGISTERS
+ * bytes at once.
+ *
+ * With 6 bit registers every group of 3 bytes holds 4 registers, that are
+ * the 24 bits little endian number b0 | b1<<8 | b2<<16 split in chunks of
+ * 6 bits starting from the least significant one. On x86-64 the unpacking
+ * is also compiled for AVX2 and AVX-512 VBMI, and the best kernel the CPU
+ * supports is selected the first time it is needed, like it happens for
+ * the BITCOUNT kernels in bitops.c. */
+
+#define HLL_KERNEL_SCALAR 0
+#define HLL_KERNEL_AVX2 1
+#define HLL_KERNEL_AVX512 2
+
+static struct {
+    int level;  /* HLL_KERNEL_* in use, -1 if not selected yet. */
+    /* Store the HLL_REGISTERS dense registers at 'registers' into the
+     * bytes array 'regs'. */
+    void (*unpack)(uint8_t *regs, uint8_t *registers);
+    /* Set max[i] to MAX(max[i],register[i]) for every dense register. */
+    void (*merge)(uint8_t *max, uint8_t *registers);
+} hllKernels = {-1, NULL, NULL};
+
+/* Unpack 'count' registers, that must be a multiple of 4, starting at the
+ * dense registers byte 'r'. */
+static void hllDenseUnpackRange(uint8_t *regs, uint8_t *r, int count) {
+    int j;
+
+    for (j = 0; j < count; j += 4) {
+        uint32_t v = (uint32_t)r[0] | (uint32_t)r[1] << 8 |
+                     (uint32_t)r[2] << 16;
+        regs[j] = v & 63;
+        regs[j+1] = (v >> 6) & 63;
+        regs[j+2] = (v >> 12) & 63;
+        regs[j+3] = v >> 18;
+        r += 3;
+    }
+}
+
+static void hllDenseUnpackScalar(uint8_t *regs, uint8_t *registers) {
+    int j;
+
+    if (HLL_BITS == 6 && (HLL_REGISTERS & 3) == 0) {
+        hllDenseUnpackRange(regs,registers,HLL_REGISTERS);
+    } else {
+        for (j = 0; j < HLL_REGISTERS; j++)
+            HLL_DENSE_GET_REGISTER(regs[j],registers,j);
+    }
+}
+
+/* Unpack the registers first, so that the compiler is free to vectorize
+ * the MAX loop. */
+static void hllDenseMergeScalar(uint8_t *max, uint8_t *registers) {
+    uint8_t regs[HLL_REGISTERS];
+    int j;
+
+    hllDenseUnpackScalar(regs,registers);
+    for (j = 0; j < HLL_REGISTERS; j++)
+        max[j] = regs[j] > max[j] ? regs[j] : max[j];
+}
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+#include <immintrin.h>
+
+/* Unpack 32 registers from the 24 bytes at 'p': every 128 bit lane gets 12
+ * bytes, that are spread so that every 32 bit word holds 3 bytes, then the
+ * 4 registers of every word are moved to their own byte with shifts and
+ * masks. Note that 28 bytes are read. */
+__attribute__((target("avx2")))
+static inline __m256i hllUnpack32AVX2(uint8_t *p) {
+    const __m256i spread = _mm256_setr_epi8(0,1,2,-1,3,4,5,-1,
+                                            6,7,8,-1,9,10,11,-1,
+                                            0,1,2,-1,3,4,5,-1,
+                                            6,7,8,-1,9,10,11,-1);
+    __m256i v, r01, r23;
+
+    v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((__m128i*)p)),
+            _mm_loadu_si128((__m128i*)(p+12)),1);
+    v = _mm256_shuffle_epi8(v,spread);
+    r01 = _mm256_or_si256(
+            _mm256_and_si256(v,_mm256_set1_epi32(0x3f)),
+            _mm256_and_si256(_mm256_slli_epi32(v,2),
+                             _mm256_set1_epi32(0x3f00)));
+    r23 = _mm256_or_si256(
+            _mm256_and_si256(_mm256_slli_epi32(v,4),
+                             _mm256_set1_epi32(0x3f0000)),
+            _mm256_and_si256(_mm256_slli_epi32(v,6),
+                             _mm256_set1_epi32(0x3f000000)));
+    return _mm256_or_si256(r01,r23);
+}
+
+/* The last 32 registers are unpacked with the scalar code, so that we
+ * never read past the end of the registers. */
+__attribute__((target("avx2")))
+static void hllDenseUnpackAVX2(uint8_t *regs, uint8_t *registers) {
+    int j;
+
+    for (j = 0; j < HLL_REGISTERS-32; j += 32) {
+        _mm256_storeu_si256((__m256i*)(regs+j),
+                            hllUnpack32AVX2(registers+j/4*3));
+    }
+    hllDenseUnpackRange(regs+j,registers+j/4*3,HLL_REGISTERS-j);
+}
+
+__attribute__((target("avx2")))
+static void hllDenseMergeAVX2(uint8_t *max, uint8_t *registers) {
+    int j, k;
+
+    for (j = 0; j < HLL_REGISTERS-32; j += 32) {
+        __m256i m = _mm256_loadu_si256((__m256i*)(max+j));
+        m = _mm256_max_epu8(m,hllUnpack32AVX2(registers+j/4*3));
+        _mm256_storeu_si256((__m256i*)(max+j),m);
+    }
+    for (; j < HLL_REGISTERS; j += 4) {
+        uint8_t regs[4];
+
+        hllDenseUnpackRange(regs,registers+j/4*3,4);
+        for (k = 0; k < 4; k++)
+            if (regs[k] > max[j+k]) max[j+k] = regs[k];
+    }
+}
+
+/* Unpack 64 registers from the 48 bytes at 'p': every group of 6 bytes
+ * (8 registers) is moved to its own 64 bit lane with VPERMB, then a single
+ * VPMULTISHIFTQB extracts the 8 registers of every lane. The masked load
+ * does not access the bytes after the 48 we need. */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static inline __m512i hllUnpack64AVX512(uint8_t *p) {
+    static const uint8_t gather[64] = {
+        0,1,2,3,4,5,5,5, 6,7,8,9,10,11,11,11,
+        12,13,14,15,16,17,17,17, 18,19,20,21,22,23,23,23,
+        24,25,26,27,28,29,29,29, 30,31,32,33,34,35,35,35,
+        36,37,38,39,40,41,41,41, 42,43,44,45,46,47,47,47
+    };
+    __m512i v = _mm512_maskz_loadu_epi8(0xffffffffffffULL,p);
+
+    v = _mm512_permutexvar_epi8(_mm512_loadu_si512(gather),v);
+    v = _mm512_multishift_epi64_epi8(
+            _mm512_set1_epi64(0x2a241e18120c0600LL),v);
+    return _mm512_and_si512(v,_mm512_set1_epi8(0x3f));
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void hllDenseUnpackAVX512(uint8_t *regs, uint8_t *registers) {
+    int j;
+
+    for (j = 0; j < HLL_REGISTERS; j += 64) {
+        _mm512_storeu_si512(regs+j,hllUnpack64AVX512(registers+j/4*3));
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void hllDenseMergeAVX512(uint8_t *max, uint8_t *registers) {
+    int j;
+
+    for (j = 0; j < HLL_REGISTERS; j += 64) {
+        __m512i m = _mm512_loadu_si512(max+j);
+        m = _mm512_max_epu8(m,hllUnpack64AVX512(registers+j/4*3));
+        _mm512_storeu_si512(max+j,m);
+    }
+}
+#endif /* HAVE_X86_SIMD_DISPATCH */
+
+/* Return the best kernel level supported by this CPU. */
+static int hllMaxKernelLevel(void) {
+#ifdef HAVE_X86_SIMD_DISPATCH
+    /* The vectorized kernels only handle the default 6 bits registers. */
+    if (HLL_BITS != 6 || (HLL_REGISTERS % 64) != 0) return HLL_KERNEL_SCALAR;
+    if (cpuHasFeatures(CPU_FEATURE_AVX512F|CPU_FEATURE_AVX512BW|
+                       CPU_FEATURE_AVX512VBMI)) return HLL_KERNEL_AVX512;
+    if (cpuHasFeatures(CPU_FEATURE_AVX2)) return HLL_KERNEL_AVX2;
+#endif
+    return HLL_KERNEL_SCALAR;
+}
+
+/* Use the dense registers unpack and merge of 'level', or of the best level
+ * available if it is lower. Returns the level in use. */
+static int hllSelectKernels(int level) {
+    int max = hllMaxKernelLevel();
+
+    if (level > max) level = max;
+    hllKernels.level = level;
+    hllKernels.unpack = hllDenseUnpackScalar;
+    hllKernels.merge = hllDenseMergeScalar;
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (level == HLL_KERNEL_AVX2) {
+        hllKernels.unpack = hllDenseUnpackAVX2;
+        hllKernels.merge = hllDenseMergeAVX2;
+    } else if (level == HLL_KERNEL_AVX512) {
+        hllKernels.unpack = hllDenseUnpackAVX512;
+        hllKernels.merge = hllDenseMergeAVX512;
+    }
+#endif
+    return level;
+}
+
+#define hllInitKernels() do { \
+    if (hllKernels.level == -1) hllSelectKernels(HLL_KERNEL_AVX512); \
+} while(0)
+
+/* Store the dense registers at 'registers' into the array 'regs' of
+ * HLL_REGISTERS bytes. */
+void hllDenseUnpack(uint8_t *regs, uint8_t *registers) {
+    hllInitKernels();
+    hllKernels.unpack(regs,registers);
+}
+
+/* Set max[i] to MAX(max[i],register[i]) for every dense register at
+ * 'registers', where 'max' is an array of HLL_REGISTERS bytes. */
+void hllDenseMerge(uint8_t *max, uint8_t *registers) {
+    hllInitKernels();
+    hllKernels.merge(max,registers);
+}
+
+/* Store the array 'regs' of HLL_REGISTERS bytes, that must be in the range
+ * 0-HLL_REGISTER_MAX, into the dense registers at 'registers'. */
+void hllDensePack(uint8_t *registers, uint8_t *regs) {
+    int j;
+
+    if (HLL_BITS == 6 && (HLL_REGISTERS & 3) == 0) {
+        uint8_t *r = registers;
+
+        for (j = 0; j < HLL_REGISTERS; j += 4) {
+            uint32_t v = (uint32_t)regs[j] | (uint32_t)regs[j+1] << 6 |
+                         (uint32_t)regs[j+2] << 12 |
+                         (uint32_t)regs[j+3] << 18;
+            r[0] = v & 0xff;
+            r[1] = (v >> 8) & 0xff;
+            r[2] = v >> 16;
+            r += 3;
+        }
+    } else {
+        for (j = 0; j < HLL_REGISTERS; j++)
+            HLL_DENSE_SET_REGISTER(registers,j,regs[j]);
+    }
+}
+
 /* ========================= HyperLogLog algorithm  ========================= */
 
 /* Our hash function is MurmurHash2, 64 bit version.
@@ -497,64 +738,43 @@ int hllDenseAdd(uint8_t *registers, unsigned char *ele, size_t elesize) {
     }
 }
 
-/* Compute SUM(2^-reg) in the dense representation.
- * PE is an array with a pre-computer table of values 2^-reg indexed by reg.
- * As a side effect the integer pointed by 'ezp' is set to the number
- * of zero registers. */
-double hllDenseSum(uint8_t *registers, double *PE, int *ezp) {
-    double E = 0;
-    int j, ez = 0;
-
-    /* Redis default is to use 16384 registers 6 bits each. The code works
-     * with other values by modifying the defines, but for our target value
-     * we take a faster path with unrolled loops. */
-    if (HLL_REGISTERS == 16384 && HLL_BITS == 6) {
-        uint8_t *r = registers;
-        unsigned long r0, r1, r2, r3, r4, r5, r6, r7, r8, r9,
-                      r10, r11, r12, r13, r14, r15;
-        for (j = 0; j < 1024; j++) {
-            /* Handle 16 registers per iteration. */
-            r0 = r[0] & 63; if (r0 == 0) ez++;
-            r1 = (r[0] >> 6 | r[1] << 2) & 63; if (r1 == 0) ez++;
-            r2 = (r[1] >> 4 | r[2] << 4) & 63; if (r2 == 0) ez++;
-            r3 = (r[2] >> 2) & 63; if (r3 == 0) ez++;
-            r4 = r[3] & 63; if (r4 == 0) ez++;
-            r5 = (r[3] >> 6 | r[4] << 2) & 63; if (r5 == 0) ez++;
-            r6 = (r[4] >> 4 | r[5] << 4) & 63; if (r6 == 0) ez++;
-            r7 = (r[5] >> 2) & 63; if (r7 == 0) ez++;
-            r8 = r[6] & 63; if (r8 == 0) ez++;
-            r9 = (r[6] >> 6 | r[7] << 2) & 63; if (r9 == 0) ez++;
-            r10 = (r[7] >> 4 | r[8] << 4) & 63; if (r10 == 0) ez++;
-            r11 = (r[8] >> 2) & 63; if (r11 == 0) ez++;
-            r12 = r[9] & 63; if (r12 == 0) ez++;
-            r13 = (r[9] >> 6 | r[10] << 2) & 63; if (r13 == 0) ez++;
-            r14 = (r[10] >> 4 | r[11] << 4) & 63; if (r14 == 0) ez++;
-            r15 = (r[11] >> 2) & 63; if (r15 == 0) ez++;
-
-            /* Additional parens will allow the compiler to optimize the
-             * code more with a loss of precision that is not very relevant
-             * here (floating point math is not commutative!). */
-            E += (PE[r0] + PE[r1]) + (PE[r2] + PE[r3]) + (PE[r4] + PE[r5]) +
-                 (PE[r6] + PE[r7]) + (PE[r8] + PE[r9]) + (PE[r10] + PE[r11]) +
-                 (PE[r12] + PE[r13]) + (PE[r14] + PE[r15]);
-            r += 12;
-        }
-    } else {
-        for (j = 0; j < HLL_REGISTERS; j++) {
-            unsigned long reg;
+/* Compute the registers histogram of an array of 'count' bytes registers:
+ * reghisto[v] is incremented by the number of registers set to 'v'.
+ * Four partial histograms are used so that consecutive increments of the
+ * same counter don't wait for each other. */
+void hllBytesRegHisto(uint8_t *regs, int count, int *reghisto) {
+    int histo[4][HLL_REGISTER_MAX+1];
+    uint64_t word;
+    int j;
 
-            HLL_DENSE_GET_REGISTER(reg,registers,j);
-            if (reg == 0) {
-                ez++;
-                /* Increment E at the end of the loop. */
-            } else {
-                E += PE[reg]; /* Precomputed 2^(-reg[j]). */
-            }
+    memset(histo,0,sizeof(histo));
+    for (j = 0; j+8 <= count; j += 8) {
+        memcpy(&word,regs+j,sizeof(word));
+        if (word == 0) {
+            histo[0][0] += 8;
+        } else {
+            histo[0][regs[j] & HLL_REGISTER_MAX]++;
+            histo[1][regs[j+1] & HLL_REGISTER_MAX]++;
+            histo[2][regs[j+2] & HLL_REGISTER_MAX]++;
+            histo[3][regs[j+3] & HLL_REGISTER_MAX]++;
+            histo[0][regs[j+4] & HLL_REGISTER_MAX]++;
+            histo[1][regs[j+5] & HLL_REGISTER_MAX]++;
+            histo[2][regs[j+6] & HLL_REGISTER_MAX]++;
+            histo[3][regs[j+7] & HLL_REGISTER_MAX]++;
         }
-        E += ez; /* Add 2^0 'ez' times. */
     }
-    *ezp = ez;
-    return E;
+    for (; j < count; j++) histo[0][regs[j] & HLL_REGISTER_MAX]++;
+    for (j = 0; j <= HLL_REGISTER_MAX; j++)
+        reghisto[j] += histo[0][j]+histo[1][j]+histo[2][j]+histo[3][j];
+}
+
+/* Compute the registers histogram of the dense representation, that is,
+ * the number of registers set to every value. */
+void hllDenseRegHisto(uint8_t *registers, int *reghisto) {
+    uint8_t regs[HLL_REGISTERS];
+
+    hllDenseUnpack(regs,registers);
+    hllBytesRegHisto(regs,HLL_REGISTERS,reghisto);
 }
 
 /* ================== Sparse representation implementation  ================= */
@@ -570,21 +790,15 @@ int hllSparseToDense(robj *o) {
     struct hllhdr *hdr, *oldhdr = (struct hllhdr*)sparse;
     int idx = 0, runlen, regval;
     uint8_t *p = (uint8_t*)sparse, *end = p+sdslen(sparse);
+    uint8_t regs[HLL_REGISTERS];
 
     /* If the representation is already the right one return ASAP. */
     hdr = (struct hllhdr*) sparse;
     if (hdr->encoding == HLL_DENSE) return C_OK;
 
-    /* Create a string of the right size filled with zero bytes.
-     * Note that the cached cardinality is set to 0 as a side effect
-     * that is exactly the cardinality of an empty HLL. */
-    dense = sdsnewlen(NULL,HLL_DENSE_SIZE);
-    hdr = (struct hllhdr*) dense;
-    *hdr = *oldhdr; /* This will copy the magic and cached cardinality. */
-    hdr->encoding = HLL_DENSE;
-
-    /* Now read the sparse representation and set non-zero registers
-     * accordingly. */
+    /* Read the sparse representation into an array of byte registers,
+     * that is packed into the dense representation at once later. */
+    memset(regs,0,sizeof(regs));
     p += HLL_HDR_SIZE;
     while(p < end) {
         if (HLL_SPARSE_IS_ZERO(p)) {
@@ -598,20 +812,24 @@ int hllSparseToDense(robj *o) {
         } else {
             runlen = HLL_SPARSE_VAL_LEN(p);
             regval = HLL_SPARSE_VAL_VALUE(p);
-            while(runlen--) {
-                HLL_DENSE_SET_REGISTER(hdr->registers,idx,regval);
-                idx++;
-            }
+            if ((runlen + idx) > HLL_REGISTERS) break; /* Overflow. */
+            while(runlen--) regs[idx++] = regval;
             p++;
         }
     }
 
     /* If the sparse representation was valid, we expect to find idx
      * set to HLL_REGISTERS. */
-    if (idx != HLL_REGISTERS) {
-        sdsfree(dense);
-        return C_ERR;
-    }
+    if (idx != HLL_REGISTERS) return C_ERR;
+
+    /* Create a string of the right size and fill the registers.
+     * Note that the cached cardinality is set to 0 as a side effect
+     * that is exactly the cardinality of an empty HLL. */
+    dense = sdsnewlen(NULL,HLL_DENSE_SIZE);
+    hdr = (struct hllhdr*) dense;
+    *hdr = *oldhdr; /* This will copy the magic and cached cardinality. */
+    hdr->encoding = HLL_DENSE;
+    hllDensePack(hdr->registers,regs);
 
     /* Free the old representation and set the new one. */
     sdsfree(o->ptr);
@@ -881,77 +1099,43 @@ promote: /* Promote to dense representation. */
     return dense_retval;
 }
 
-/* Compute SUM(2^-reg) in the sparse representation.
- * PE is an array with a pre-computer table of values 2^-reg indexed by reg.
- * As a side effect the integer pointed by 'ezp' is set to the number
- * of zero registers. */
-double hllSparseSum(uint8_t *sparse, int sparselen, double *PE, int *ezp, int *invalid) {
-    double E = 0;
-    int ez = 0, idx = 0, runlen, regval;
+/* Compute the registers histogram of the sparse representation, that is,
+ * the number of registers set to every value. If the representation is
+ * not valid the integer pointed by 'invalid' is set to non-zero. */
+void hllSparseRegHisto(uint8_t *sparse, int sparselen, int *invalid, int *reghisto) {
+    int idx = 0, runlen, regval;
     uint8_t *end = sparse+sparselen, *p = sparse;
 
     while(p < end) {
         if (HLL_SPARSE_IS_ZERO(p)) {
             runlen = HLL_SPARSE_ZERO_LEN(p);
             idx += runlen;
-            ez += runlen;
-            /* Increment E at the end of the loop. */
+            reghisto[0] += runlen;
             p++;
         } else if (HLL_SPARSE_IS_XZERO(p)) {
             runlen = HLL_SPARSE_XZERO_LEN(p);
             idx += runlen;
-            ez += runlen;
-            /* Increment E at the end of the loop. */
+            reghisto[0] += runlen;
             p += 2;
         } else {
             runlen = HLL_SPARSE_VAL_LEN(p);
             regval = HLL_SPARSE_VAL_VALUE(p);
             idx += runlen;
-            E += PE[regval]*runlen;
+            reghisto[regval] += runlen;
             p++;
         }
     }
     if (idx != HLL_REGISTERS && invalid) *invalid = 1;
-    E += ez; /* Add 2^0 'ez' times. */
-    *ezp = ez;
-    return E;
 }
 
 /* ========================= HyperLogLog Count ==============================
  * This is the core of the algorithm where the approximated count is computed.
- * The function uses the lower level hllDenseSum() and hllSparseSum() functions
- * as helpers to compute the SUM(2^-reg) part of the computation, which is
- * representation-specific, while all the rest is common. */
-
-/* Implements the SUM operation for uint8_t data type which is only used
- * internally as speedup for PFCOUNT with multiple keys. */
-double hllRawSum(uint8_t *registers, double *PE, int *ezp) {
-    double E = 0;
-    int j, ez = 0;
-    uint64_t *word = (uint64_t*) registers;
-    uint8_t *bytes;
-
-    for (j = 0; j < HLL_REGISTERS/8; j++) {
-        if (*word == 0) {
-            ez += 8;
-        } else {
-            bytes = (uint8_t*) word;
-            if (bytes[0]) E += PE[bytes[0]]; else ez++;
-            if (bytes[1]) E += PE[bytes[1]]; else ez++;
-            if (bytes[2]) E += PE[bytes[2]]; else ez++;
-            if (bytes[3]) E += PE[bytes[3]]; else ez++;
-            if (bytes[4]) E += PE[bytes[4]]; else ez++;
-            if (bytes[5]) E += PE[bytes[5]]; else ez++;
-            if (bytes[6]) E += PE[bytes[6]]; else ez++;
-            if (bytes[7]) E += PE[bytes[7]]; else ez++;
-        }
-        word++;
-    }
-    E += ez; /* 2^(-reg[j]) is 1 when m is 0, add it 'ez' times for every
-                zero register in the HLL. */
-    *ezp = ez;
-    return E;
-}
+ * The function uses the lower level hllDenseRegHisto(), hllSparseRegHisto()
+ * and hllBytesRegHisto() functions as helpers to compute the number of
+ * registers set to every value, which is representation-specific, while all
+ * the rest is common. Working on the histogram makes the SUM(2^-reg) part
+ * of the computation cheap, and exactly the same for every representation
+ * of the same registers. */
 
 /* Return the approximated cardinality of the set based on the harmonic
  * mean of the registers values. 'hdr' points to the start of the SDS
@@ -968,6 +1152,7 @@ uint64_t hllCount(struct hllhdr *hdr, int *invalid) {
     double m = HLL_REGISTERS;
     double E, alpha = 0.7213/(1+1.079/m);
     int j, ez; /* Number of registers equal to 0. */
+    int reghisto[HLL_REGISTER_MAX+1] = {0};
 
     /* We precompute 2^(-reg[j]) in a small table in order to
      * speedup the computation of SUM(2^-register[0..i]). */
@@ -982,18 +1167,26 @@ uint64_t hllCount(struct hllhdr *hdr, int *invalid) {
         initialized = 1;
     }
 
-    /* Compute SUM(2^-register[0..i]). */
+    /* Compute the registers histogram. */
     if (hdr->encoding == HLL_DENSE) {
-        E = hllDenseSum(hdr->registers,PE,&ez);
+        hllDenseRegHisto(hdr->registers,reghisto);
     } else if (hdr->encoding == HLL_SPARSE) {
-        E = hllSparseSum(hdr->registers,
-                         sdslen((sds)hdr)-HLL_HDR_SIZE,PE,&ez,invalid);
+        hllSparseRegHisto(hdr->registers,
+                          sdslen((sds)hdr)-HLL_HDR_SIZE,invalid,reghisto);
     } else if (hdr->encoding == HLL_RAW) {
-        E = hllRawSum(hdr->registers,PE,&ez);
+        hllBytesRegHisto(hdr->registers,HLL_REGISTERS,reghisto);
     } else {
         serverPanic("Unknown HyperLogLog encoding in hllCount()");
     }
 
+    /* Compute SUM(2^-register[0..i]) from the histogram, starting from the
+     * smallest terms. 2^(-reg[j]) is 1 when reg[j] is 0, so the zero
+     * registers just add 'ez'. */
+    ez = reghisto[0];
+    E = 0;
+    for (j = HLL_REGISTER_MAX; j >= 1; j--) E += PE[j]*reghisto[j];
+    E += ez;
+
     /* Muliply the inverse of E for alpha_m * m^2 to have the raw estimate. */
     E = (1/E)*alpha*m*m;
 
@@ -1046,12 +1239,7 @@ int hllMerge(uint8_t *max, robj *hll) {
     int i;
 
     if (hdr->encoding == HLL_DENSE) {
-        uint8_t val;
-
-        for (i = 0; i < HLL_REGISTERS; i++) {
-            HLL_DENSE_GET_REGISTER(val,hdr->registers,i);
-            if (val > max[i]) max[i] = val;
-        }
+        hllDenseMerge(max,hdr->registers);
     } else {
         uint8_t *p = hll->ptr, *end = p + sdslen(hll->ptr);
         long runlen, regval;
@@ -1070,6 +1258,7 @@ int hllMerge(uint8_t *max, robj *hll) {
             } else {
                 runlen = HLL_SPARSE_VAL_LEN(p);
                 regval = HLL_SPARSE_VAL_VALUE(p);
+                if ((runlen + i) > HLL_REGISTERS) break; /* Overflow. */
                 while(runlen--) {
                     if (regval > max[i]) max[i] = regval;
                     i++;
@@ -1082,6 +1271,227 @@ int hllMerge(uint8_t *max, robj *hll) {
     return C_OK;
 }
 
+/* ======================== Multi-key PFCOUNT cache ==========================
+ * PFCOUNT with multiple keys must merge all the HLLs every time, and the
+ * result can't be cached inside any of the keys. So the results are kept
+ * in server.pfcount_cache, indexed by the database and the sorted set of
+ * input keys, up to server.pfcount_cache_max_memory bytes of memory.
+ *
+ * server.pfcount_cache_index maps every input key to the set of the cache
+ * entries using it, so that all the entries depending on a key can be
+ * dropped every time the key is added, overwritten, deleted or modified
+ * (see the hooks in db.c). Flushing a DB drops the whole cache. */
+
+typedef struct pfcountCacheEntry {
+    uint64_t card;      /* Cardinality of the union of the keys. */
+    size_t memory;      /* Approximated memory used by this entry. */
+    int numkeys;        /* Number of distinct input keys. */
+    sds *keys;          /* Index names of the input keys. */
+} pfcountCacheEntry;
+
+static void pfcountCacheEntryDestructor(void *privdata, void *val) {
+    pfcountCacheEntry *ce = val;
+    int j;
+
+    DICT_NOTUSED(privdata);
+    for (j = 0; j < ce->numkeys; j++) sdsfree(ce->keys[j]);
+    zfree(ce->keys);
+    zfree(ce);
+}
+
+static void pfcountCacheIndexDestructor(void *privdata, void *val) {
+    DICT_NOTUSED(privdata);
+    dictRelease(val);
+}
+
+/* Cache key -> pfcountCacheEntry. */
+static dictType pfcountCacheDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    pfcountCacheEntryDestructor /* val destructor */
+};
+
+/* Index name of an input key -> set of cache keys, that are owned by
+ * server.pfcount_cache (see keyptrDictType). */
+static dictType pfcountCacheIndexDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    pfcountCacheIndexDestructor /* val destructor */
+};
+
+void pfcountCacheInit(void) {
+    server.pfcount_cache = dictCreate(&pfcountCacheDictType,NULL);
+    server.pfcount_cache_index = dictCreate(&pfcountCacheIndexDictType,NULL);
+    server.pfcount_cache_memory = 0;
+}
+
+/* Return the name used in the index for the key 'key' of the DB 'dbid',
+ * that is the DB id followed by the key name. */
+static sds pfcountCacheIndexName(int dbid, sds key) {
+    sds name = sdsnewlen(&dbid,sizeof(dbid));
+    return sdscatsds(name,key);
+}
+
+static int pfcountCacheKeyCompare(const void *a, const void *b) {
+    return sdscmp((*(robj**)a)->ptr,(*(robj**)b)->ptr);
+}
+
+/* Return the cache key for PFCOUNT called against the 'numkeys' keys at
+ * 'keys' in the DB 'dbid': the DB id followed by every distinct key in
+ * lexicographic order, prefixed by its length. The 'keys' array is sorted
+ * as a side effect. The number of distinct keys is stored in '*distinct'. */
+static sds pfcountCacheKey(int dbid, robj **keys, int numkeys,
+                           int *distinct)
+{
+    sds ck = sdsnewlen(&dbid,sizeof(dbid));
+    int j;
+
+    *distinct = 0;
+    qsort(keys,numkeys,sizeof(robj*),pfcountCacheKeyCompare);
+    for (j = 0; j < numkeys; j++) {
+        uint32_t len = sdslen(keys[j]->ptr);
+
+        if (j && sdscmp(keys[j]->ptr,keys[j-1]->ptr) == 0) continue;
+        ck = sdscatlen(ck,&len,sizeof(len));
+        ck = sdscatsds(ck,keys[j]->ptr);
+        (*distinct)++;
+    }
+    return ck;
+}
+
+/* Remove the entry 'ck' from the cache and from the index. */
+static void pfcountCacheDelete(sds ck) {
+    dictEntry *de = dictFind(server.pfcount_cache,ck);
+    pfcountCacheEntry *ce;
+    int j;
+
+    if (de == NULL) return;
+    ce = dictGetVal(de);
+    ck = dictGetKey(de); /* Use the same pointer stored in the index. */
+    for (j = 0; j < ce->numkeys; j++) {
+        dict *users = dictFetchValue(server.pfcount_cache_index,ce->keys[j]);
+
+        if (users == NULL) continue;
+        dictDelete(users,ck);
+        if (dictSize(users) == 0)
+            dictDelete(server.pfcount_cache_index,ce->keys[j]);
+    }
+    server.pfcount_cache_memory -= ce->memory;
+    dictDelete(server.pfcount_cache,ck);
+}
+
+/* Evict random entries until the cache fits server.pfcount_cache_max_memory
+ * bytes of memory. */
+void pfcountCacheTrim(void) {
+    while (dictSize(server.pfcount_cache) &&
+           server.pfcount_cache_memory > server.pfcount_cache_max_memory)
+    {
+        dictEntry *de = dictGetRandomKey(server.pfcount_cache);
+        pfcountCacheDelete(dictGetKey(de));
+    }
+}
+
+/* Drop every cached result, called when a DB is flushed. */
+void pfcountCacheFlush(void) {
+    if (dictSize(server.pfcount_cache) == 0) return;
+    dictEmpty(server.pfcount_cache,NULL);
+    dictEmpty(server.pfcount_cache_index,NULL);
+    server.pfcount_cache_memory = 0;
+}
+
+/* Drop the cached results that depend on 'key', because the key was added,
+ * deleted, or its value was modified or replaced. This is called for every
+ * write, so the common case of an empty cache must be fast. */
+void pfcountCacheInvalidateKey(redisDb *db, robj *key) {
+    dict *users;
+    sds name;
+
+    if (dictSize(server.pfcount_cache_index) == 0) return;
+    name = pfcountCacheIndexName(db->id,key->ptr);
+    while ((users = dictFetchValue(server.pfcount_cache_index,name)) != NULL)
+    {
+        /* Deleting the entry removes it from 'users' as well, and
+         * 'users' itself is released with its last entry. */
+        dictEntry *de = dictGetRandomKey(users);
+        pfcountCacheDelete(dictGetKey(de));
+    }
+    sdsfree(name);
+}
+
+/* Lookup the cached cardinality of the union of the keys identified by
+ * the cache key 'ck'. Returns C_OK and sets '*card' on hit. */
+static int pfcountCacheLookup(sds ck, uint64_t *card) {
+    pfcountCacheEntry *ce;
+
+    if (server.pfcount_cache_max_memory == 0) return C_ERR;
+    ce = dictFetchValue(server.pfcount_cache,ck);
+    if (ce == NULL) {
+        server.stat_pfcount_cache_misses++;
+        return C_ERR;
+    }
+    server.stat_pfcount_cache_hits++;
+    *card = ce->card;
+    return C_OK;
+}
+
+/* Cache the cardinality 'card' of the union of the 'numkeys' keys at
+ * 'keys', sorted as returned by pfcountCacheKey(). The cache key 'ck' is
+ * owned by the cache after the call. */
+static void pfcountCacheAdd(sds ck, int dbid, robj **keys, int numkeys,
+                            int distinct, uint64_t card)
+{
+    pfcountCacheEntry *ce;
+    int j, k;
+
+    if (server.pfcount_cache_max_memory == 0 ||
+        dictFind(server.pfcount_cache,ck) != NULL)
+    {
+        sdsfree(ck);
+        return;
+    }
+
+    ce = zmalloc(sizeof(*ce));
+    ce->card = card;
+    ce->numkeys = distinct;
+    ce->keys = zmalloc(sizeof(sds)*distinct);
+    ce->memory = sizeof(*ce) + sizeof(sds)*distinct + sizeof(dictEntry) +
+                 sdsAllocSize(ck);
+    for (j = 0, k = 0; j < numkeys; j++) {
+        if (j && sdscmp(keys[j]->ptr,keys[j-1]->ptr) == 0) continue;
+        ce->keys[k] = pfcountCacheIndexName(dbid,keys[j]->ptr);
+        /* The index name is stored both in the entry and in the index,
+         * and the entry needs a dictEntry in the index set. */
+        ce->memory += sdsAllocSize(ce->keys[k])*2 + sizeof(dictEntry)*2;
+        k++;
+    }
+    if (ce->memory > server.pfcount_cache_max_memory) {
+        pfcountCacheEntryDestructor(NULL,ce);
+        sdsfree(ck);
+        return;
+    }
+
+    /* Make room for the new entry, then add it to the cache and to the
+     * index. */
+    server.pfcount_cache_memory += ce->memory;
+    pfcountCacheTrim();
+    dictAdd(server.pfcount_cache,ck,ce);
+    for (j = 0; j < distinct; j++) {
+        dict *users = dictFetchValue(server.pfcount_cache_index,ce->keys[j]);
+
+        if (users == NULL) {
+            users = dictCreate(&keyptrDictType,NULL);
+            dictAdd(server.pfcount_cache_index,sdsdup(ce->keys[j]),users);
+        }
+        dictAdd(users,ck,NULL);
+    }
+}
+
 /* ========================== HyperLogLog commands ========================== */
 
 /* Create an HLL object. We always create the HLL using sparse encoding.
@@ -1204,29 +1614,55 @@ void pfcountCommand(client *c) {
      * the cardinality of the merge of the N HLLs specified. */
     if (c->argc > 2) {
         uint8_t max[HLL_HDR_SIZE+HLL_REGISTERS], *registers;
-        int j;
+        int j, numkeys = c->argc-1, distinct;
+        robj **keys, **objs;
+        sds ck = NULL;
+
+        /* Check type and size of all the keys first: the lookups also
+         * expire the keys, dropping the cached results using them. */
+        keys = zmalloc(sizeof(robj*)*numkeys);
+        objs = zmalloc(sizeof(robj*)*numkeys);
+        for (j = 0; j < numkeys; j++) {
+            keys[j] = c->argv[j+1];
+            objs[j] = lookupKeyRead(c->db,keys[j]);
+            /* Assume empty HLL for non existing var. */
+            if (objs[j] && isHLLObjectOrReply(c,objs[j]) != C_OK)
+                goto cleanup;
+        }
+
+        /* Return the cached result if any. */
+        ck = pfcountCacheKey(c->db->id,keys,numkeys,&distinct);
+        if (pfcountCacheLookup(ck,&card) == C_OK) {
+            addReplyLongLong(c,card);
+            goto cleanup;
+        }
 
         /* Compute an HLL with M[i] = MAX(M[i]_j). */
         memset(max,0,sizeof(max));
         hdr = (struct hllhdr*) max;
         hdr->encoding = HLL_RAW; /* Special internal-only encoding. */
         registers = max + HLL_HDR_SIZE;
-        for (j = 1; j < c->argc; j++) {
-            /* Check type and size. */
-            robj *o = lookupKeyRead(c->db,c->argv[j]);
-            if (o == NULL) continue; /* Assume empty HLL for non existing var.*/
-            if (isHLLObjectOrReply(c,o) != C_OK) return;
+        for (j = 0; j < numkeys; j++) {
+            if (objs[j] == NULL) continue;
 
             /* Merge with this HLL with our 'max' HHL by setting max[i]
              * to MAX(max[i],hll[i]). */
-            if (hllMerge(registers,o) == C_ERR) {
+            if (hllMerge(registers,objs[j]) == C_ERR) {
                 addReplySds(c,sdsnew(invalid_hll_err));
-                return;
+                goto cleanup;
             }
         }
 
-        /* Compute cardinality of the resulting set. */
-        addReplyLongLong(c,hllCount(hdr,NULL));
+        /* Compute cardinality of the resulting set, and cache it. */
+        card = hllCount(hdr,NULL);
+        addReplyLongLong(c,card);
+        pfcountCacheAdd(ck,c->db->id,keys,numkeys,distinct,card);
+        ck = NULL;
+
+cleanup:
+        sdsfree(ck);
+        zfree(keys);
+        zfree(objs);
         return;
     }
 
@@ -1330,9 +1766,7 @@ void pfmergeCommand(client *c) {
     /* Write the resulting HLL to the destination HLL registers and
      * invalidate the cached value. */
     hdr = o->ptr;
-    for (j = 0; j < HLL_REGISTERS; j++) {
-        HLL_DENSE_SET_REGISTER(hdr->registers,j,max[j]);
-    }
+    hllDensePack(hdr->registers,max);
     HLL_INVALIDATE_CACHE(hdr);
 
     signalModifiedKey(c->db,c->argv[1]);
@@ -1354,7 +1788,8 @@ void pfselftestCommand(client *c) {
     sds bitcounters = sdsnewlen(NULL,HLL_DENSE_SIZE);
     struct hllhdr *hdr = (struct hllhdr*) bitcounters, *hdr2;
     robj *o = NULL;
-    uint8_t bytecounters[HLL_REGISTERS];
+    uint8_t bytecounters[HLL_REGISTERS], maxcounters[HLL_REGISTERS];
+    uint8_t regs[HLL_REGISTERS], packed[HLL_DENSE_SIZE-HLL_HDR_SIZE];
 
     /* Test 1: access registers.
      * The test is conceived to test that the different counters of our data
@@ -1381,6 +1816,29 @@ void pfselftestCommand(client *c) {
                 goto cleanup;
             }
         }
+
+        /* Check that unpacking, merging and packing all the registers at
+         * once agree with the single register macros. */
+        hllDenseUnpack(regs,hdr->registers);
+        if (memcmp(regs,bytecounters,HLL_REGISTERS) != 0) {
+            addReplyError(c,"TESTFAILED Registers unpacking");
+            goto cleanup;
+        }
+        for (i = 0; i < HLL_REGISTERS; i++) {
+            regs[i] = rand() & HLL_REGISTER_MAX;
+            maxcounters[i] = regs[i] > bytecounters[i] ? regs[i] :
+                                                         bytecounters[i];
+        }
+        hllDenseMerge(regs,hdr->registers);
+        if (memcmp(regs,maxcounters,HLL_REGISTERS) != 0) {
+            addReplyError(c,"TESTFAILED Registers merging");
+            goto cleanup;
+        }
+        hllDensePack(packed,bytecounters);
+        if (memcmp(packed,hdr->registers,HLL_DENSE_SIZE-HLL_HDR_SIZE) != 0) {
+            addReplyError(c,"TESTFAILED Registers packing");
+            goto cleanup;
+        }
     }
 
     /* Test 2: approximation error.
@@ -1420,6 +1878,23 @@ void pfselftestCommand(client *c) {
                 goto cleanup;
         }
 
+        /* Check that the sparse representation is converted to exactly
+         * the same dense registers. */
+        if (j == checkpoint &&
+            ((struct hllhdr*)o->ptr)->encoding == HLL_SPARSE)
+        {
+            robj *dense = dupStringObject(o);
+            int err = hllSparseToDense(dense) == C_ERR ||
+                      memcmp(((struct hllhdr*)dense->ptr)->registers,
+                             hdr->registers,
+                             HLL_DENSE_SIZE-HLL_HDR_SIZE) != 0;
+            decrRefCount(dense);
+            if (err) {
+                addReplyError(c, "TESTFAILED sparse to dense conversion");
+                goto cleanup;
+            }
+        }
+
         /* Check error. */
         if (j == checkpoint) {
             int64_t abserr = checkpoint - (int64_t)hllCount(hdr,NULL);
@@ -1480,14 +1955,12 @@ void pfdebugCommand(client *c) {
             server.dirty++; /* Force propagation on encoding change. */
         }
 
+        uint8_t regs[HLL_REGISTERS];
+
         hdr = o->ptr;
+        hllDenseUnpack(regs,hdr->registers);
         addReplyMultiBulkLen(c,HLL_REGISTERS);
-        for (j = 0; j < HLL_REGISTERS; j++) {
-            uint8_t val;
-
-            HLL_DENSE_GET_REGISTER(val,hdr->registers,j);
-            addReplyLongLong(c,val);
-        }
+        for (j = 0; j < HLL_REGISTERS; j++) addReplyLongLong(c,regs[j]);
     }
     /* PFDEBUG DECODE <key> */
     else if (!strcasecmp(cmd,"decode")) {
@@ -1555,3 +2028,124 @@ arityerr:
         "Wrong number of arguments for the '%s' subcommand",cmd);
 }
 
+
+#ifdef REDIS_TEST
+static const char *hllKernelName[] = {"scalar","avx2","avx512"};
+
+/* Check every kernel level supported by this CPU against the single
+ * register macros, then benchmark the operations performed by PFCOUNT
+ * and PFMERGE against many dense HLLs. */
+int hllTest(int argc, char *argv[]) {
+    int level, maxlevel, iter, j, k, err = 0;
+    int numkeys = 50, reghisto[HLL_REGISTER_MAX+1];
+    uint8_t regs[HLL_REGISTERS], max[HLL_REGISTERS], orig[HLL_REGISTERS];
+    uint8_t raw[HLL_HDR_SIZE+HLL_REGISTERS];
+    robj *hll[50];
+    sds scratch = sdsnewlen(NULL,HLL_DENSE_SIZE);
+    long long start;
+    uint64_t card = 0;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(1234);
+
+    /* Dense HLLs with a few hundred thousand elements each. */
+    for (k = 0; k < numkeys; k++) {
+        hll[k] = createHLLObject();
+        hllSparseToDense(hll[k]);
+        for (j = 0; j < 300000; j++) {
+            uint64_t ele = ((uint64_t)k << 32) | j;
+            hllAdd(hll[k],(unsigned char*)&ele,sizeof(ele));
+        }
+    }
+    maxlevel = hllMaxKernelLevel();
+
+    for (level = HLL_KERNEL_SCALAR; level <= maxlevel; level++) {
+        hllSelectKernels(level);
+        printf("Testing %s kernels: ", hllKernelName[level]);
+        for (iter = 0; iter < 100; iter++) {
+            struct hllhdr *hdr = (struct hllhdr*) scratch;
+
+            /* Use random registers half of the times, so that every value
+             * is tested, and real HLLs otherwise. */
+            if (iter & 1) {
+                for (j = 0; j < HLL_REGISTERS; j++)
+                    HLL_DENSE_SET_REGISTER(hdr->registers,j,
+                                           rand() & HLL_REGISTER_MAX);
+            } else {
+                memcpy(scratch,hll[iter % numkeys]->ptr,HLL_DENSE_SIZE);
+            }
+            for (j = 0; j < HLL_REGISTERS; j++)
+                orig[j] = max[j] = rand() & HLL_REGISTER_MAX;
+            hllDenseMerge(max,hdr->registers);
+            hllDenseUnpack(regs,hdr->registers);
+            for (j = 0; j < HLL_REGISTERS; j++) {
+                uint8_t val;
+
+                HLL_DENSE_GET_REGISTER(val,hdr->registers,j);
+                if (regs[j] != val) err++;
+                if (max[j] != (val > orig[j] ? val : orig[j])) err++;
+            }
+        }
+        printf("%s\n", err ? "ERR" : "OK");
+    }
+
+    /* Benchmarks. */
+    for (level = HLL_KERNEL_SCALAR; level <= maxlevel; level++) {
+        struct hllhdr *hdr, *rawhdr = (struct hllhdr*) raw;
+
+        hllSelectKernels(level);
+        start = ustime();
+        for (iter = 0; iter < 1000; iter++) {
+            memset(reghisto,0,sizeof(reghisto));
+            hdr = hll[iter % numkeys]->ptr;
+            hllDenseRegHisto(hdr->registers,reghisto);
+        }
+        printf("%-7s dense histogram: %.2f usec\n", hllKernelName[level],
+            (double)(ustime()-start)/1000);
+
+        /* PFCOUNT with 50 keys. */
+        start = ustime();
+        for (iter = 0; iter < 100; iter++) {
+            memset(raw,0,sizeof(raw));
+            rawhdr->encoding = HLL_RAW;
+            for (k = 0; k < numkeys; k++)
+                hllMerge(raw+HLL_HDR_SIZE,hll[k]);
+            card += hllCount(rawhdr,NULL);
+        }
+        printf("%-7s PFCOUNT %d keys: %.2f usec\n", hllKernelName[level],
+            numkeys, (double)(ustime()-start)/100);
+
+        /* PFMERGE of 30 keys, including writing the destination. */
+        start = ustime();
+        for (iter = 0; iter < 100; iter++) {
+            memset(max,0,sizeof(max));
+            for (k = 0; k < 30; k++) hllMerge(max,hll[k]);
+            hdr = hll[numkeys-1]->ptr;
+            hllDensePack(hdr->registers,max);
+        }
+        printf("%-7s PFMERGE 30 keys: %.2f usec\n", hllKernelName[level],
+            (double)(ustime()-start)/100);
+    }
+
+    /* Sparse to dense conversion of HLLs with a few thousand elements. */
+    start = ustime();
+    for (iter = 0; iter < 1000; iter++) {
+        robj *o = createHLLObject();
+        for (j = 0; j < 200; j++) {
+            uint64_t ele = ((uint64_t)iter << 32) | j;
+            hllAdd(o,(unsigned char*)&ele,sizeof(ele));
+        }
+        if (hllSparseToDense(o) == C_ERR) err++;
+        decrRefCount(o);
+    }
+    printf("Sparse to dense (200 elements, including PFADD): %.2f usec\n",
+        (double)(ustime()-start)/1000);
+
+    for (k = 0; k < numkeys; k++) decrRefCount(hll[k]);
+    sdsfree(scratch);
+    hllKernels.level = -1;
+    if (card == 0) err++;
+    return err ? 1 : 0;
+}
+#endif
@@ -261,6 +261,19 @@ sds createLatencyReport(void) {
         }
         analyzeLatencyForEvent(event,&ls);
 
+        /* The copy-on-write of the persistence children is sampled in
+         * megabytes, not milliseconds. */
+        if (!strcasecmp(event,"fork-cow")) {
+            report = sdscatprintf(report,
+                "%d. %s: %d samples of the memory used by persistence children because of copy-on-write (average %luMB, mean deviation %luMB). Worst all time sample %luMB. Make sure the system has enough free memory for the child while it is saving.\n",
+                eventnum, event,
+                ls.samples,
+                (unsigned long) ls.avg,
+                (unsigned long) ls.mad,
+                (unsigned long) ts->max);
+            continue;
+        }
+
         report = sdscatprintf(report,
             "%d. %s: %d latency spikes (average %lums, mean deviation %lums, period %.2f sec). Worst all time event %lums.",
             eventnum, event,
@@ -0,0 +1,442 @@
+/* LZ4 block format compression (see lz4.h).
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "lz4.h"
+#include "config.h"
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5     /* The last 5 bytes are always literals. */
+#define LZ4_MF_LIMIT 12         /* No match starts in the last 12 bytes. */
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_LOG 12         /* Max log2 of the lz4_compress() table. */
+#define LZ4_HC_HASH_LOG 15      /* Max log2 of the lz4_compress_hc() table. */
+#define LZ4_HC_DEPTH 64         /* Match candidates tried per position. */
+
+/* ----------------------------- Helpers ------------------------------------ */
+
+static inline uint32_t lz4Read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v,p,sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4Hash(uint32_t seq, int log) {
+    return (seq*2654435761U) >> (32-log);
+}
+
+/* The hash table is sized after the input, since clearing a large table
+ * would take longer than compressing a small string. */
+static int lz4HashLog(unsigned int len, int maxlog) {
+    int log = 8;
+
+    while (log < maxlog && (1U<<log) < len) log++;
+    return log;
+}
+
+/* Length of the match between 'ip' and 'ref', not going past 'limit'. */
+static inline unsigned int lz4MatchLength(const unsigned char *ip,
+    const unsigned char *ref, const unsigned char *limit)
+{
+    const unsigned char *start = ip;
+
+#if BYTE_ORDER == LITTLE_ENDIAN
+    while (ip+8 <= limit) {
+        uint64_t a, b;
+
+        memcpy(&a,ip,sizeof(a));
+        memcpy(&b,ref,sizeof(b));
+        if (a != b) return ip-start+(__builtin_ctzll(a^b) >> 3);
+        ip += 8;
+        ref += 8;
+    }
+#endif
+    while (ip < limit && *ip == *ref) {
+        ip++;
+        ref++;
+    }
+    return ip-start;
+}
+
+/* Copy 'len' bytes 16 at a time, writing up to 15 bytes past the end. If
+ * the areas overlap 'dst' must be at least 16 bytes after 'src'. */
+static inline void lz4WildCopy(unsigned char *dst, const unsigned char *src,
+                               size_t len)
+{
+    unsigned char *end = dst+len;
+
+    do {
+        memcpy(dst,src,16);
+        dst += 16;
+        src += 16;
+    } while (dst < end);
+}
+
+/* Number of bytes needed after the token to store 'len'. */
+static inline size_t lz4ExtraLenBytes(size_t len) {
+    return len >= 15 ? (len-15)/255+1 : 0;
+}
+
+static inline unsigned char *lz4WriteExtraLen(unsigned char *op, size_t len) {
+    len -= 15;
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+/* Append to 'op' a sequence made of 'litlen' literals at 'lit' followed by
+ * a match of 'mlen' bytes at distance 'offset'. The last sequence of a block
+ * has no match and is emitted with 'mlen' set to zero. The input ends at
+ * 'iend'. Returns the new output pointer, or NULL if the sequence does not
+ * fit before 'oend'. */
+static unsigned char *lz4EmitSequence(unsigned char *op, unsigned char *oend,
+    const unsigned char *lit, const unsigned char *iend, size_t litlen,
+    unsigned int offset, size_t mlen)
+{
+    unsigned char *token = op++;
+    size_t need = 1+lz4ExtraLenBytes(litlen)+litlen;
+
+    if (mlen) need += 2+lz4ExtraLenBytes(mlen-LZ4_MIN_MATCH);
+    if ((size_t)(oend-token) < need) return NULL;
+
+    if (litlen >= 15) {
+        *token = 15 << 4;
+        op = lz4WriteExtraLen(op,litlen);
+    } else {
+        *token = litlen << 4;
+    }
+    if (oend-op >= (ptrdiff_t)litlen+16 &&
+        iend-lit >= (ptrdiff_t)litlen+16)
+        lz4WildCopy(op,lit,litlen);
+    else
+        memcpy(op,lit,litlen);
+    op += litlen;
+    if (mlen == 0) return op;
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    mlen -= LZ4_MIN_MATCH;
+    if (mlen >= 15) {
+        *token |= 15;
+        op = lz4WriteExtraLen(op,mlen);
+    } else {
+        *token |= mlen;
+    }
+    return op;
+}
+
+/* --------------------------------- API ------------------------------------ */
+
+/* Greedy compression with a single candidate per hash bucket, skipping
+ * ahead faster and faster in data that does not compress. */
+unsigned int lz4_compress(const void *in_data, unsigned int in_len,
+                          void *out_data, unsigned int out_len)
+{
+    const unsigned char *in = in_data, *ip = in, *anchor = in;
+    const unsigned char *iend = in+in_len;
+    unsigned char *op = out_data, *oend = op+out_len;
+    uint32_t htab[1<<LZ4_HASH_LOG];
+
+    if (in_len > LZ4_MF_LIMIT) {
+        const unsigned char *mflimit = iend-LZ4_MF_LIMIT;
+        const unsigned char *mlimit = iend-LZ4_LAST_LITERALS;
+        int log = lz4HashLog(in_len,LZ4_HASH_LOG);
+        unsigned int misses = 1<<6; /* Skip faster after 64 misses. */
+
+        memset(htab,0,sizeof(htab[0])<<log);
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = lz4Read32(ip), h = lz4Hash(seq,log);
+            const unsigned char *ref = in+htab[h];
+            unsigned int mlen;
+
+            htab[h] = ip-in;
+            if (ref >= ip || ip-ref > LZ4_MAX_OFFSET ||
+                lz4Read32(ref) != seq)
+            {
+                ip += misses++ >> 6;
+                continue;
+            }
+            misses = 1<<6;
+
+            /* Extend the match backward, then forward. */
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            mlen = lz4MatchLength(ip,ref,mlimit);
+            op = lz4EmitSequence(op,oend,anchor,iend,ip-anchor,ip-ref,mlen);
+            if (op == NULL) return 0;
+            ip += mlen;
+            anchor = ip;
+
+            /* Index a position inside the match, so that a repetition of
+             * the data just matched is found again. */
+            if (ip < mflimit) htab[lz4Hash(lz4Read32(ip-2),log)] = ip-2-in;
+        }
+    }
+    op = lz4EmitSequence(op,oend,anchor,iend,iend-anchor,0,0);
+    if (op == NULL) return 0;
+    return op-(unsigned char*)out_data;
+}
+
+/* Greedy compression taking the longest match among the last positions
+ * with the same hash, that are linked by 'chain' in a 64k window. */
+unsigned int lz4_compress_hc(const void *in_data, unsigned int in_len,
+                             void *out_data, unsigned int out_len)
+{
+    const unsigned char *in = in_data, *ip = in, *anchor = in;
+    const unsigned char *iend = in+in_len;
+    unsigned char *op = out_data, *oend = op+out_len;
+    uint32_t head[1<<LZ4_HC_HASH_LOG];
+    uint16_t chain[LZ4_MAX_OFFSET+1];
+
+    if (in_len > LZ4_MF_LIMIT) {
+        const unsigned char *mflimit = iend-LZ4_MF_LIMIT;
+        const unsigned char *mlimit = iend-LZ4_LAST_LITERALS;
+        int log = lz4HashLog(in_len,LZ4_HC_HASH_LOG);
+        uint32_t next = 0; /* Next position to add to the chains. */
+
+        memset(head,0,sizeof(head[0])<<log);
+        while (ip < mflimit) {
+            uint32_t pos = ip-in, cand, best = 0;
+            unsigned int bestlen = 0, depth = LZ4_HC_DEPTH;
+
+            while (next < pos) {
+                uint32_t h = lz4Hash(lz4Read32(in+next),log);
+                uint32_t delta = next-head[h];
+
+                chain[next & LZ4_MAX_OFFSET] =
+                    delta > LZ4_MAX_OFFSET ? LZ4_MAX_OFFSET : delta;
+                head[h] = next++;
+            }
+
+            cand = head[lz4Hash(lz4Read32(ip),log)];
+            while (depth-- && cand < pos && pos-cand <= LZ4_MAX_OFFSET) {
+                const unsigned char *ref = in+cand;
+                uint16_t delta;
+
+                if (ref[bestlen] == ip[bestlen] &&
+                    lz4Read32(ref) == lz4Read32(ip))
+                {
+                    unsigned int mlen = lz4MatchLength(ip,ref,mlimit);
+                    if (mlen > bestlen) {
+                        bestlen = mlen;
+                        best = cand;
+                    }
+                }
+                delta = chain[cand & LZ4_MAX_OFFSET];
+                if (delta == 0 || delta > cand) break;
+                cand -= delta;
+            }
+
+            if (bestlen < LZ4_MIN_MATCH) {
+                ip++;
+                continue;
+            }
+            op = lz4EmitSequence(op,oend,anchor,iend,ip-anchor,pos-best,
+                                 bestlen);
+            if (op == NULL) return 0;
+            ip += bestlen;
+            anchor = ip;
+        }
+    }
+    op = lz4EmitSequence(op,oend,anchor,iend,iend-anchor,0,0);
+    if (op == NULL) return 0;
+    return op-(unsigned char*)out_data;
+}
+
+/* Read the bytes extending a length that does not fit in its nibble of the
+ * token. Returns 0 if the input is truncated. */
+static size_t lz4ReadExtraLen(const unsigned char **ip,
+                              const unsigned char *iend, size_t len)
+{
+    unsigned char b;
+
+    do {
+        if (*ip == iend) return 0;
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+unsigned int lz4_decompress(const void *in_data, unsigned int in_len,
+                            void *out_data, unsigned int out_len)
+{
+    const unsigned char *ip = in_data, *iend = ip+in_len;
+    unsigned char *out = out_data, *op = out, *oend = out+out_len;
+
+    while (ip < iend) {
+        unsigned int token = *ip++, offset;
+        const unsigned char *ref;
+        size_t len;
+
+        /* Literals. */
+        len = token >> 4;
+        if (len == 15 && (len = lz4ReadExtraLen(&ip,iend,len)) == 0)
+            return 0;
+        if (len > (size_t)(iend-ip) || len > (size_t)(oend-op)) return 0;
+        if (len+16 <= (size_t)(iend-ip) && len+16 <= (size_t)(oend-op))
+            lz4WildCopy(op,ip,len);
+        else
+            memcpy(op,ip,len);
+        ip += len;
+        op += len;
+        if (ip == iend) break; /* The last sequence has no match. */
+
+        /* Match. */
+        if (iend-ip < 2) return 0;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op-out)) return 0;
+        len = token & 15;
+        if (len == 15 && (len = lz4ReadExtraLen(&ip,iend,len)) == 0)
+            return 0;
+        len += LZ4_MIN_MATCH;
+        if (len > (size_t)(oend-op)) return 0;
+        ref = op-offset;
+        if (offset >= 16 && len+16 <= (size_t)(oend-op)) {
+            lz4WildCopy(op,ref,len);
+            op += len;
+        } else if (offset >= len) {
+            memcpy(op,ref,len);
+            op += len;
+        } else {
+            /* The match overlaps the output: it repeats the last 'offset'
+             * bytes, that can be copied a word at a time only if at least
+             * a word long. */
+            while (offset >= 8 && len >= 8) {
+                memcpy(op,ref,8);
+                op += 8;
+                ref += 8;
+                len -= 8;
+            }
+            while (len--) *op++ = *ref++;
+        }
+    }
+    return op-out;
+}
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include "zmalloc.h"
+#include "testhelp.h"
+
+/* Compress and decompress 'len' bytes with both the compressors. Returns
+ * 1 if the data survives the round trip, 0 otherwise. The compressed
+ * lengths are stored in 'fastlen' and 'hclen'. */
+static int lz4TestRoundTrip(unsigned char *data, unsigned int len,
+                            unsigned int *fastlen, unsigned int *hclen)
+{
+    unsigned int outlen = len+len/255+16, clen, dlen, j;
+    unsigned char *c = zmalloc(outlen), *d = zmalloc(len+1);
+    int ok = 1;
+
+    for (j = 0; j < 2; j++) {
+        clen = j == 0 ? lz4_compress(data,len,c,outlen) :
+                        lz4_compress_hc(data,len,c,outlen);
+        if (j == 0) *fastlen = clen; else *hclen = clen;
+        dlen = lz4_decompress(c,clen,d,len);
+        if (clen == 0 || dlen != len || memcmp(data,d,len)) ok = 0;
+    }
+    zfree(c);
+    zfree(d);
+    return ok;
+}
+
+int lz4Test(int argc, char *argv[]) {
+    unsigned int len = 1024*1024, fastlen, hclen, clen, j;
+    unsigned char *data = zmalloc(len), *c = zmalloc(len), *d = zmalloc(len);
+    const char *words[] = {"redis ","lz4 ","compression ","dump ","value "};
+    int ok;
+
+    (void)argc;
+    (void)argv;
+    srand(1234);
+
+    memset(data,0,len);
+    ok = lz4TestRoundTrip(data,len,&fastlen,&hclen);
+    test_cond("Long runs survive the round trip", ok && fastlen < len/200);
+
+    for (j = 0; j < len; j++) data[j] = rand();
+    ok = lz4TestRoundTrip(data,len,&fastlen,&hclen);
+    test_cond("Random data survives the round trip", ok);
+    test_cond("Random data is not compressed much",
+        fastlen >= len && lz4_compress(data,len,c,len-1) == 0);
+
+    for (j = 0; j < len; ) {
+        const char *w = words[rand() % 5];
+        size_t l = strlen(w);
+
+        if (l > len-j) l = len-j;
+        memcpy(data+j,w,l);
+        j += l;
+    }
+    ok = lz4TestRoundTrip(data,len,&fastlen,&hclen);
+    test_cond("Text survives the round trip", ok && fastlen < len/2);
+    test_cond("HC compresses text better", hclen < fastlen);
+    printf("Text: %u bytes, fast %u, hc %u\n", len, fastlen, hclen);
+
+    ok = 1;
+    for (j = 1; j <= 300; j++) {
+        unsigned int k;
+
+        for (k = 0; k < j; k++) data[k] = "abcab"[rand() % (1+j%5)];
+        if (!lz4TestRoundTrip(data,j,&fastlen,&hclen)) ok = 0;
+    }
+    test_cond("Short strings survive the round trip", ok);
+
+    clen = lz4_compress(data,1000,c,len);
+    test_cond("Decompressing into a short buffer fails",
+        lz4_decompress(c,clen,d,999) == 0);
+    ok = 1;
+    for (j = 0; j < clen; j++)
+        if (lz4_decompress(c,j,d,len) == 1000) ok = 0;
+    test_cond("Truncated data is detected", ok);
+    for (j = 0; j < 10000; j++) {
+        c[rand() % clen] = rand();
+        lz4_decompress(c,clen,d,len);
+    }
+    test_cond("Corrupted data is decompressed safely", 1);
+
+    zfree(data);
+    zfree(c);
+    zfree(d);
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+/* Compression in the LZ4 block format: a sequence of literals followed by
+ * a match, repeated, where every match is a 16 bit offset in the already
+ * decompressed data and a length. Decompression is just a loop of copies,
+ * much faster than LZF, and lz4_compress() is faster than lzf_compress().
+ * lz4_compress_hc() searches deeper for matches, being slower but
+ * compressing better, and the output is decompressed the same way.
+ *
+ * The compression functions return the compressed length, or 0 if the
+ * data does not fit in 'out_len' bytes. lz4_decompress() returns the length
+ * of the decompressed data, or 0 if the input is corrupted or the data does
+ * not fit in 'out_len' bytes. */
+unsigned int lz4_compress(const void *in_data, unsigned int in_len,
+                          void *out_data, unsigned int out_len);
+unsigned int lz4_compress_hc(const void *in_data, unsigned int in_len,
+                             void *out_data, unsigned int out_len);
+unsigned int lz4_decompress(const void *in_data, unsigned int in_len,
+                            void *out_data, unsigned int out_len);
+
+#ifdef REDIS_TEST
+int lz4Test(int argc, char *argv[]);
+#endif
+
+#endif
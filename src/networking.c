@@ -114,8 +114,12 @@ client *createClient(int fd) {
     listSetDupMethod(c->reply,dupClientReplyValue);
     c->btype = BLOCKED_NONE;
     c->bpop.timeout = 0;
-    c->bpop.keys = dictCreate(&setDictType,NULL);
+    c->bpop.keys = dictCreate(&objectKeyHeapPointerValueDictType,NULL);
     c->bpop.target = NULL;
+    c->bpop.xread_count = 0;
+    c->bpop.xread_group = NULL;
+    c->bpop.xread_consumer = NULL;
+    c->bpop.xread_group_noack = 0;
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
     c->woff = 0;
@@ -357,6 +361,15 @@ void addReply(client *c, robj *obj) {
         if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
             _addReplyObjectToList(c,obj);
         decrRefCount(obj);
+    } else if (obj->encoding == OBJ_ENCODING_LZF ||
+               obj->encoding == OBJ_ENCODING_ROARING)
+    {
+        /* Compressed strings are decompressed into a new object that is
+         * referenced by the reply list. */
+        obj = getDecodedObject(obj);
+        if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
+            _addReplyObjectToList(c,obj);
+        decrRefCount(obj);
     } else {
         serverPanic("Wrong obj->encoding in addReply()");
     }
@@ -535,6 +548,10 @@ void addReplyBulkLen(client *c, robj *obj) {
 
     if (sdsEncodedObject(obj)) {
         len = sdslen(obj->ptr);
+    } else if (obj->encoding == OBJ_ENCODING_LZF) {
+        len = ((lzfString*)obj->ptr)->len;
+    } else if (obj->encoding == OBJ_ENCODING_ROARING) {
+        len = ((roaring*)obj->ptr)->len;
     } else {
         long n = (long)obj->ptr;
 
@@ -50,6 +50,7 @@ int keyspaceEventsStringToFlags(char *classes) {
         case 's': flags |= NOTIFY_SET; break;
         case 'h': flags |= NOTIFY_HASH; break;
         case 'z': flags |= NOTIFY_ZSET; break;
+        case 't': flags |= NOTIFY_STREAM; break;
         case 'x': flags |= NOTIFY_EXPIRED; break;
         case 'e': flags |= NOTIFY_EVICTED; break;
         case 'K': flags |= NOTIFY_KEYSPACE; break;
@@ -77,6 +78,7 @@ sds keyspaceEventsFlagsToString(int flags) {
         if (flags & NOTIFY_SET) res = sdscatlen(res,"s",1);
         if (flags & NOTIFY_HASH) res = sdscatlen(res,"h",1);
         if (flags & NOTIFY_ZSET) res = sdscatlen(res,"z",1);
+        if (flags & NOTIFY_STREAM) res = sdscatlen(res,"t",1);
         if (flags & NOTIFY_EXPIRED) res = sdscatlen(res,"x",1);
         if (flags & NOTIFY_EVICTED) res = sdscatlen(res,"e",1);
     }
@@ -29,6 +29,7 @@
  */
 
 #include "server.h"
+#include "lzf.h"
 #include <math.h>
 #include <ctype.h>
 
@@ -175,12 +176,60 @@ robj *dupStringObject(robj *o) {
         d->encoding = OBJ_ENCODING_INT;
         d->ptr = o->ptr;
         return d;
+    case OBJ_ENCODING_LZF:
+        return createLzfStringObject(((lzfString*)o->ptr)->buf,
+            ((lzfString*)o->ptr)->clen,((lzfString*)o->ptr)->len);
+    case OBJ_ENCODING_ROARING:
+        return createRoaringStringObject(roaringDup(o->ptr));
     default:
         serverPanic("Wrong encoding.");
         break;
     }
 }
 
+/* LZF strings are also created by the RDB loading threads, so the stats
+ * are updated atomically. */
+#if defined(__ATOMIC_RELAXED)
+#define updateLzfStats(__n,__saved) do { \
+    __atomic_add_fetch(&server.lzf_strings,(__n),__ATOMIC_RELAXED); \
+    __atomic_add_fetch(&server.lzf_strings_saved,(__saved),__ATOMIC_RELAXED); \
+} while(0)
+#else
+#define updateLzfStats(__n,__saved) do { \
+    __sync_add_and_fetch(&server.lzf_strings,(__n)); \
+    __sync_add_and_fetch(&server.lzf_strings_saved,(__saved)); \
+} while(0)
+#endif
+
+/* Create an OBJ_ENCODING_LZF string object from an already populated
+ * lzfString structure, accounting for the memory saved. */
+static robj *createLzfObject(lzfString *lzs) {
+    robj *o = createObject(OBJ_STRING,lzs);
+
+    o->encoding = OBJ_ENCODING_LZF;
+    updateLzfStats(1,(long long)lzs->len - lzs->clen);
+    return o;
+}
+
+/* Create a string object holding 'clen' bytes of LZF compressed data,
+ * representing a string of 'len' bytes. */
+robj *createLzfStringObject(const void *cbuf, size_t clen, size_t len) {
+    lzfString *lzs = zmalloc(sizeof(*lzs)+clen);
+
+    lzs->len = len;
+    lzs->clen = clen;
+    memcpy(lzs->buf,cbuf,clen);
+    return createLzfObject(lzs);
+}
+
+/* Create a string object with the roaring bitmap 'r' as value. */
+robj *createRoaringStringObject(roaring *r) {
+    robj *o = createObject(OBJ_STRING,r);
+
+    o->encoding = OBJ_ENCODING_ROARING;
+    return o;
+}
+
 robj *createQuicklistObject(void) {
     quicklist *l = quicklistCreate();
     robj *o = createObject(OBJ_LIST,l);
@@ -216,17 +265,114 @@ robj *createHashObject(void) {
     return o;
 }
 
+robj *createStreamObject(void) {
+    stream *s = streamNew();
+    robj *o = createObject(OBJ_STREAM,s);
+    o->encoding = OBJ_ENCODING_STREAM;
+    return o;
+}
+
+robj *createBloomObject(bloom *b) {
+    robj *o = createObject(OBJ_BLOOM,b);
+    o->encoding = OBJ_ENCODING_BLOOM;
+    return o;
+}
+
+robj *createCuckooObject(cuckoo *cf) {
+    robj *o = createObject(OBJ_CUCKOO,cf);
+    o->encoding = OBJ_ENCODING_CUCKOO;
+    return o;
+}
+
+robj *createCmsObject(cms *s) {
+    robj *o = createObject(OBJ_CMS,s);
+    o->encoding = OBJ_ENCODING_CMS;
+    return o;
+}
+
+robj *createTopkObject(topk *t) {
+    robj *o = createObject(OBJ_TOPK,t);
+    o->encoding = OBJ_ENCODING_TOPK;
+    return o;
+}
+
+robj *createTimeseriesObject(timeseries *s) {
+    robj *o = createObject(OBJ_TIMESERIES,s);
+    o->encoding = OBJ_ENCODING_TSCHUNKS;
+    return o;
+}
+
+/* Filters and sketches are persisted, digested and propagated by the AOF
+ * rewrite in their serialized form. Return the serialized form of the
+ * object 'o', of one of the OBJ_TYPE_IS_BLOB() types, in a newly allocated
+ * buffer of 'len' bytes. */
+unsigned char *serializeBlobObject(robj *o, size_t *len) {
+    switch(o->type) {
+    case OBJ_BLOOM: return bloomSerialize(o->ptr,len);
+    case OBJ_CUCKOO: return cuckooSerialize(o->ptr,len);
+    case OBJ_CMS: return cmsSerialize(o->ptr,len);
+    case OBJ_TOPK: return topkSerialize(o->ptr,len);
+    case OBJ_TIMESERIES: return tsSerialize(o->ptr,len);
+    default: serverPanic("Unknown blob object type");
+    }
+}
+
+/* Create an object of the specified type from its serialized form. Returns
+ * NULL if the serialized form is not valid. */
+robj *createObjectFromBlob(int type, unsigned char *buf, size_t len) {
+    void *ptr;
+
+    switch(type) {
+    case OBJ_BLOOM:
+        if ((ptr = bloomDeserialize(buf,len)) == NULL) return NULL;
+        return createBloomObject(ptr);
+    case OBJ_CUCKOO:
+        if ((ptr = cuckooDeserialize(buf,len)) == NULL) return NULL;
+        return createCuckooObject(ptr);
+    case OBJ_CMS:
+        if ((ptr = cmsDeserialize(buf,len)) == NULL) return NULL;
+        return createCmsObject(ptr);
+    case OBJ_TOPK:
+        if ((ptr = topkDeserialize(buf,len)) == NULL) return NULL;
+        return createTopkObject(ptr);
+    case OBJ_TIMESERIES:
+        if ((ptr = tsDeserialize(buf,len)) == NULL) return NULL;
+        return createTimeseriesObject(ptr);
+    default:
+        serverPanic("Unknown blob object type");
+    }
+}
+
+/* Create a sorted set using the encoding for large sorted sets selected by
+ * the zset-large-encoding option: skiplist (the default) or btree. */
 robj *createZsetObject(void) {
-    zset *zs = zmalloc(sizeof(*zs));
+    zset *zs;
     robj *o;
 
+    if (server.zset_large_encoding == OBJ_ENCODING_BTREE)
+        return createZsetBtreeObject();
+
+    zs = zmalloc(sizeof(*zs));
     zs->dict = dictCreate(&zsetDictType,NULL);
     zs->zsl = zslCreate();
+    zs->zbt = NULL;
     o = createObject(OBJ_ZSET,zs);
     o->encoding = OBJ_ENCODING_SKIPLIST;
     return o;
 }
 
+robj *createZsetBtreeObject(void) {
+    zset *zs = zmalloc(sizeof(*zs));
+    robj *o;
+
+    zs->dict = dictCreate(&zsetDictType,NULL);
+    zs->zsl = NULL;
+    zs->zbt = zbtCreate();
+    o = createObject(OBJ_ZSET,zs);
+    o->encoding = OBJ_ENCODING_BTREE;
+    return o;
+}
+
 robj *createZsetZiplistObject(void) {
     unsigned char *zl = ziplistNew();
     robj *o = createObject(OBJ_ZSET,zl);
@@ -237,6 +383,13 @@ robj *createZsetZiplistObject(void) {
 void freeStringObject(robj *o) {
     if (o->encoding == OBJ_ENCODING_RAW) {
         sdsfree(o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_LZF) {
+        lzfString *lzs = o->ptr;
+
+        updateLzfStats(-1,(long long)lzs->clen - lzs->len);
+        zfree(lzs);
+    } else if (o->encoding == OBJ_ENCODING_ROARING) {
+        roaringFree(o->ptr);
     }
 }
 
@@ -270,6 +423,12 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
+    case OBJ_ENCODING_BTREE:
+        zs = o->ptr;
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+        zfree(zs);
+        break;
     case OBJ_ENCODING_ZIPLIST:
         zfree(o->ptr);
         break;
@@ -292,12 +451,46 @@ void freeHashObject(robj *o) {
     }
 }
 
+void freeStreamObject(robj *o) {
+    freeStream(o->ptr);
+}
+
+void freeBloomObject(robj *o) {
+    bloomFree(o->ptr);
+}
+
+void freeCuckooObject(robj *o) {
+    cuckooFree(o->ptr);
+}
+
+void freeCmsObject(robj *o) {
+    cmsFree(o->ptr);
+}
+
+void freeTopkObject(robj *o) {
+    topkFree(o->ptr);
+}
+
+void freeTimeseriesObject(robj *o) {
+    tsFree(o->ptr);
+}
+
+/* Make the object immortal: its reference count is never modified again,
+ * so it can be safely referenced by threads other than the main one, like
+ * the RDB loading threads. */
+robj *makeObjectShared(robj *o) {
+    serverAssert(o->refcount == 1);
+    o->refcount = OBJ_SHARED_REFCOUNT;
+    return o;
+}
+
 void incrRefCount(robj *o) {
-    o->refcount++;
+    if (o->refcount != OBJ_SHARED_REFCOUNT) o->refcount++;
 }
 
 void decrRefCount(robj *o) {
     if (o->refcount <= 0) serverPanic("decrRefCount against refcount <= 0");
+    if (o->refcount == OBJ_SHARED_REFCOUNT) return;
     if (o->refcount == 1) {
         switch(o->type) {
         case OBJ_STRING: freeStringObject(o); break;
@@ -305,6 +498,12 @@ void decrRefCount(robj *o) {
         case OBJ_SET: freeSetObject(o); break;
         case OBJ_ZSET: freeZsetObject(o); break;
         case OBJ_HASH: freeHashObject(o); break;
+        case OBJ_STREAM: freeStreamObject(o); break;
+        case OBJ_BLOOM: freeBloomObject(o); break;
+        case OBJ_CUCKOO: freeCuckooObject(o); break;
+        case OBJ_CMS: freeCmsObject(o); break;
+        case OBJ_TOPK: freeTopkObject(o); break;
+        case OBJ_TIMESERIES: freeTimeseriesObject(o); break;
         default: serverPanic("Unknown object type"); break;
         }
         zfree(o);
@@ -435,6 +634,41 @@ robj *tryObjectEncoding(robj *o) {
     return o;
 }
 
+/* Try to create an LZF compressed copy of a string value, in order to save
+ * memory for large values stored in the keyspace. The compressed object is
+ * returned (with refcount set to 1) if compression is enabled, the string
+ * is at least string-compress-threshold bytes and compressing it saves at
+ * least 1/8 of the space. Otherwise NULL is returned.
+ *
+ * Only values of string keys can be compressed: aggregate data types and
+ * command arguments expect strings to be accessible in place. */
+robj *tryObjectCompression(robj *o) {
+    lzfString *lzs;
+    size_t len, clen, maxlen;
+
+    serverAssertWithInfo(NULL,o,o->type == OBJ_STRING);
+    if (server.string_compress_threshold == 0 || !sdsEncodedObject(o))
+        return NULL;
+    len = sdslen(o->ptr);
+    if (len < server.string_compress_threshold || len > UINT32_MAX)
+        return NULL;
+
+    /* HyperLogLogs are accessed and modified in place by the PF commands. */
+    if (len >= 4 && !memcmp(o->ptr,"HYLL",4)) return NULL;
+
+    maxlen = len-len/8;
+    lzs = zmalloc(sizeof(*lzs)+maxlen);
+    clen = lzf_compress(o->ptr,len,lzs->buf,maxlen);
+    if (clen == 0) {
+        zfree(lzs);
+        return NULL;
+    }
+    lzs = zrealloc(lzs,sizeof(*lzs)+clen);
+    lzs->len = len;
+    lzs->clen = clen;
+    return createLzfObject(lzs);
+}
+
 /* Get a decoded version of an encoded object (returned as a new object).
  * If the object is already raw-encoded just increment the ref count. */
 robj *getDecodedObject(robj *o) {
@@ -450,6 +684,19 @@ robj *getDecodedObject(robj *o) {
         ll2string(buf,32,(long)o->ptr);
         dec = createStringObject(buf,strlen(buf));
         return dec;
+    } else if (o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_LZF) {
+        lzfString *lzs = o->ptr;
+
+        dec = createStringObject(NULL,lzs->len);
+        if (lzf_decompress(lzs->buf,lzs->clen,dec->ptr,lzs->len) != lzs->len)
+            serverPanic("Corrupted LZF compressed string");
+        return dec;
+    } else if (o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_ROARING) {
+        roaring *r = o->ptr;
+
+        dec = createStringObject(NULL,r->len);
+        roaringGetRange(r,0,dec->ptr,r->len);
+        return dec;
     } else {
         serverPanic("Unknown encoding type");
     }
@@ -472,6 +719,19 @@ int compareStringObjectsWithFlags(robj *a, robj *b, int flags) {
     size_t alen, blen, minlen;
 
     if (a == b) return 0;
+    if (a->encoding == OBJ_ENCODING_LZF || b->encoding == OBJ_ENCODING_LZF ||
+        a->encoding == OBJ_ENCODING_ROARING ||
+        b->encoding == OBJ_ENCODING_ROARING)
+    {
+        int cmp;
+
+        a = getDecodedObject(a);
+        b = getDecodedObject(b);
+        cmp = compareStringObjectsWithFlags(a,b,flags);
+        decrRefCount(a);
+        decrRefCount(b);
+        return cmp;
+    }
     if (sdsEncodedObject(a)) {
         astr = a->ptr;
         alen = sdslen(astr);
@@ -527,6 +787,10 @@ size_t stringObjectLen(robj *o) {
     serverAssertWithInfo(NULL,o,o->type == OBJ_STRING);
     if (sdsEncodedObject(o)) {
         return sdslen(o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_LZF) {
+        return ((lzfString*)o->ptr)->len;
+    } else if (o->encoding == OBJ_ENCODING_ROARING) {
+        return ((roaring*)o->ptr)->len;
     } else {
         return sdigits10((long)o->ptr);
     }
@@ -552,6 +816,15 @@ int getDoubleFromObject(robj *o, double *target) {
                 return C_ERR;
         } else if (o->encoding == OBJ_ENCODING_INT) {
             value = (long)o->ptr;
+        } else if (o->encoding == OBJ_ENCODING_LZF ||
+                   o->encoding == OBJ_ENCODING_ROARING)
+        {
+            int retval;
+
+            o = getDecodedObject(o);
+            retval = getDoubleFromObject(o,target);
+            decrRefCount(o);
+            return retval;
         } else {
             serverPanic("Unknown string encoding");
         }
@@ -590,6 +863,15 @@ int getLongDoubleFromObject(robj *o, long double *target) {
                 return C_ERR;
         } else if (o->encoding == OBJ_ENCODING_INT) {
             value = (long)o->ptr;
+        } else if (o->encoding == OBJ_ENCODING_LZF ||
+                   o->encoding == OBJ_ENCODING_ROARING)
+        {
+            int retval;
+
+            o = getDecodedObject(o);
+            retval = getLongDoubleFromObject(o,target);
+            decrRefCount(o);
+            return retval;
         } else {
             serverPanic("Unknown string encoding");
         }
@@ -623,6 +905,15 @@ int getLongLongFromObject(robj *o, long long *target) {
             if (string2ll(o->ptr,sdslen(o->ptr),&value) == 0) return C_ERR;
         } else if (o->encoding == OBJ_ENCODING_INT) {
             value = (long)o->ptr;
+        } else if (o->encoding == OBJ_ENCODING_LZF ||
+                   o->encoding == OBJ_ENCODING_ROARING)
+        {
+            int retval;
+
+            o = getDecodedObject(o);
+            retval = getLongLongFromObject(o,target);
+            decrRefCount(o);
+            return retval;
         } else {
             serverPanic("Unknown string encoding");
         }
@@ -670,7 +961,16 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_ZIPLIST: return "ziplist";
     case OBJ_ENCODING_INTSET: return "intset";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
+    case OBJ_ENCODING_BTREE: return "btree";
+    case OBJ_ENCODING_LZF: return "lzf";
+    case OBJ_ENCODING_ROARING: return "roaring";
     case OBJ_ENCODING_EMBSTR: return "embstr";
+    case OBJ_ENCODING_STREAM: return "stream";
+    case OBJ_ENCODING_BLOOM: return "blockedbloom";
+    case OBJ_ENCODING_CUCKOO: return "cuckoo";
+    case OBJ_ENCODING_CMS: return "countminsketch";
+    case OBJ_ENCODING_TOPK: return "topk";
+    case OBJ_ENCODING_TSCHUNKS: return "chunked";
     default: return "unknown";
     }
 }
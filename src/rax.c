@@ -0,0 +1,677 @@
+/* Radix tree implementation, used by the stream type (see t_stream.c) to
+ * index the entries blocks and the pending entries of consumer groups.
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rax.h"
+#include "zmalloc.h"
+
+static int raxNotFoundMarker;
+void *raxNotFound = &raxNotFoundMarker;
+
+/* ----------------------------- Nodes -------------------------------------- */
+
+static raxNode *raxNewNode(rax *rax, unsigned char *edge, size_t len) {
+    raxNode *n = zmalloc(sizeof(*n)+len);
+
+    n->data = NULL;
+    n->children = NULL;
+    n->edgelen = len;
+    n->numchildren = 0;
+    n->iskey = 0;
+    if (len) memcpy(n->edge,edge,len);
+    rax->numnodes++;
+    return n;
+}
+
+static void raxFreeNode(rax *rax, raxNode *n) {
+    zfree(n->children);
+    zfree(n);
+    rax->numnodes--;
+}
+
+/* Return the index of the child of 'n' whose edge starts with 'c', or -1
+ * if there is no such child. If 'pos' is not NULL it is set to the index
+ * the child has, or would have once added. */
+static int raxFindChild(raxNode *n, unsigned char c, int *pos) {
+    int lo = 0, hi = n->numchildren-1;
+
+    while (lo <= hi) {
+        int mid = (lo+hi)/2;
+        unsigned char mc = n->children[mid]->edge[0];
+
+        if (mc == c) {
+            if (pos) *pos = mid;
+            return mid;
+        }
+        if (mc < c) lo = mid+1;
+        else hi = mid-1;
+    }
+    if (pos) *pos = lo;
+    return -1;
+}
+
+static void raxAddChild(raxNode *n, int pos, raxNode *child) {
+    n->children = zrealloc(n->children,sizeof(raxNode*)*(n->numchildren+1));
+    memmove(n->children+pos+1,n->children+pos,
+            sizeof(raxNode*)*(n->numchildren-pos));
+    n->children[pos] = child;
+    n->numchildren++;
+}
+
+static void raxRemoveChild(raxNode *n, int pos) {
+    memmove(n->children+pos,n->children+pos+1,
+            sizeof(raxNode*)*(n->numchildren-pos-1));
+    n->numchildren--;
+    if (n->numchildren == 0) {
+        zfree(n->children);
+        n->children = NULL;
+    } else {
+        n->children = zrealloc(n->children,sizeof(raxNode*)*n->numchildren);
+    }
+}
+
+/* The child at index 'pos' of 'p' has no key and a single child: replace
+ * it with its child, prepending its edge to the one of the child. */
+static void raxMergeChild(rax *rax, raxNode *p, int pos) {
+    raxNode *n = p->children[pos], *c = n->children[0];
+
+    c = zrealloc(c,sizeof(*c)+n->edgelen+c->edgelen);
+    memmove(c->edge+n->edgelen,c->edge,c->edgelen);
+    memcpy(c->edge,n->edge,n->edgelen);
+    c->edgelen += n->edgelen;
+    p->children[pos] = c;
+    raxFreeNode(rax,n);
+}
+
+/* Return the node of the key 's', or NULL if the key is missing. */
+static raxNode *raxLookup(rax *rax, unsigned char *s, size_t len) {
+    raxNode *h = rax->head;
+    size_t i = 0;
+
+    while (i < len) {
+        int idx = raxFindChild(h,s[i],NULL);
+
+        if (idx == -1) return NULL;
+        h = h->children[idx];
+        if (h->edgelen > len-i || memcmp(h->edge,s+i,h->edgelen) != 0)
+            return NULL;
+        i += h->edgelen;
+    }
+    return h->iskey ? h : NULL;
+}
+
+/* ------------------------------ API --------------------------------------- */
+
+rax *raxNew(void) {
+    rax *rax = zmalloc(sizeof(*rax));
+
+    rax->numele = 0;
+    rax->numnodes = 0;
+    rax->head = raxNewNode(rax,NULL,0);
+    return rax;
+}
+
+/* Insert the key 's' with the value 'data', overwriting the value of an
+ * existing key. Returns 1 if the key was added, 0 if it already existed:
+ * in that case the old value is stored in 'old' if not NULL. */
+int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old) {
+    raxNode *h = rax->head;
+    size_t i = 0;
+
+    while (i < len) {
+        int pos, idx = raxFindChild(h,s[i],&pos);
+        raxNode *c;
+        size_t m = 0;
+
+        if (idx == -1) {
+            /* No child shares a prefix with the rest of the key: add it
+             * as a new leaf. */
+            c = raxNewNode(rax,s+i,len-i);
+            raxAddChild(h,pos,c);
+            h = c;
+            break;
+        }
+
+        c = h->children[idx];
+        while (m < c->edgelen && i+m < len && c->edge[m] == s[i+m]) m++;
+        if (m < c->edgelen) {
+            /* The key diverges, or ends, in the middle of the edge: split
+             * the child into a node with the common prefix, having as
+             * only child the node with the rest of the edge. */
+            raxNode *mid = raxNewNode(rax,c->edge,m);
+
+            memmove(c->edge,c->edge+m,c->edgelen-m);
+            c->edgelen -= m;
+            c = zrealloc(c,sizeof(*c)+c->edgelen);
+            mid->children = zmalloc(sizeof(raxNode*));
+            mid->children[0] = c;
+            mid->numchildren = 1;
+            h->children[idx] = mid;
+            c = mid;
+        }
+        h = c;
+        i += m;
+    }
+
+    if (h->iskey) {
+        if (old) *old = h->data;
+        h->data = data;
+        return 0;
+    }
+    h->iskey = 1;
+    h->data = data;
+    rax->numele++;
+    return 1;
+}
+
+/* Remove the key 's'. Returns 1 if the key was removed, storing its value
+ * in 'old' if not NULL, or 0 if the key was not found. */
+int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
+    raxNode *h = rax->head, *parent = NULL, *gparent = NULL;
+    int pidx = -1, gidx = -1;
+    size_t i = 0;
+
+    /* Track the parent and grand parent of the node, that are the only
+     * nodes that may need to be fixed after the removal. */
+    while (i < len) {
+        int idx = raxFindChild(h,s[i],NULL);
+        raxNode *c;
+
+        if (idx == -1) return 0;
+        c = h->children[idx];
+        if (c->edgelen > len-i || memcmp(c->edge,s+i,c->edgelen) != 0)
+            return 0;
+        gparent = parent;
+        gidx = pidx;
+        parent = h;
+        pidx = idx;
+        h = c;
+        i += c->edgelen;
+    }
+    if (!h->iskey) return 0;
+
+    if (old) *old = h->data;
+    h->iskey = 0;
+    h->data = NULL;
+    rax->numele--;
+    if (h == rax->head) return 1;
+
+    if (h->numchildren == 0) {
+        /* Remove the leaf. The parent may now be a node without key and
+         * with a single child, that must be merged with it. */
+        raxRemoveChild(parent,pidx);
+        raxFreeNode(rax,h);
+        if (parent != rax->head && !parent->iskey &&
+            parent->numchildren == 1)
+            raxMergeChild(rax,gparent,gidx);
+    } else if (h->numchildren == 1) {
+        raxMergeChild(rax,parent,pidx);
+    }
+    return 1;
+}
+
+/* Return the value of the key 's', or raxNotFound if the key is missing. */
+void *raxFind(rax *rax, unsigned char *s, size_t len) {
+    raxNode *h = raxLookup(rax,s,len);
+    return h ? h->data : raxNotFound;
+}
+
+static void raxRecursiveFree(rax *rax, raxNode *n,
+                             void (*free_callback)(void*))
+{
+    int j;
+
+    for (j = 0; j < n->numchildren; j++)
+        raxRecursiveFree(rax,n->children[j],free_callback);
+    if (free_callback && n->iskey) free_callback(n->data);
+    raxFreeNode(rax,n);
+}
+
+/* Free the tree, calling 'free_callback' on the value of every key. */
+void raxFreeWithCallback(rax *rax, void (*free_callback)(void*)) {
+    raxRecursiveFree(rax,rax->head,free_callback);
+    zfree(rax);
+}
+
+void raxFree(rax *rax) {
+    raxFreeWithCallback(rax,NULL);
+}
+
+uint64_t raxSize(rax *rax) {
+    return rax->numele;
+}
+
+/* ---------------------------- Iterators ----------------------------------- */
+
+/* Iterators are initialized with raxStart() and positioned with raxSeek(),
+ * after that raxNext() and raxPrev() return the elements in lexicographic
+ * order of the keys, starting from the seeked element. Modifying the tree
+ * invalidates the iterators, that must be seeked again. */
+void raxStart(raxIterator *it, rax *rt) {
+    it->rt = rt;
+    it->flags = RAX_ITER_EOF;
+    it->key = it->key_static;
+    it->key_len = 0;
+    it->key_max = RAX_ITER_STATIC_KEY;
+    it->data = NULL;
+    it->stack = it->stack_static;
+    it->depth = 0;
+    it->stack_max = RAX_ITER_STATIC_STACK;
+}
+
+/* Descend into 'n', appending its edge to the current key. */
+static void raxIterPush(raxIterator *it, raxNode *n) {
+    if (it->depth == it->stack_max) {
+        size_t max = it->stack_max*2;
+
+        if (it->stack == it->stack_static) {
+            it->stack = zmalloc(sizeof(raxFrame)*max);
+            memcpy(it->stack,it->stack_static,sizeof(raxFrame)*it->depth);
+        } else {
+            it->stack = zrealloc(it->stack,sizeof(raxFrame)*max);
+        }
+        it->stack_max = max;
+    }
+    if (it->key_len+n->edgelen > it->key_max) {
+        size_t max = it->key_max*2;
+
+        if (max < it->key_len+n->edgelen) max = it->key_len+n->edgelen;
+        if (it->key == it->key_static) {
+            it->key = zmalloc(max);
+            memcpy(it->key,it->key_static,it->key_len);
+        } else {
+            it->key = zrealloc(it->key,max);
+        }
+        it->key_max = max;
+    }
+    memcpy(it->key+it->key_len,n->edge,n->edgelen);
+    it->key_len += n->edgelen;
+    it->stack[it->depth].node = n;
+    it->stack[it->depth].child = -1;
+    it->depth++;
+}
+
+/* Go back to the parent of the current node. Returns 0 if the current
+ * node was the root. */
+static int raxIterPop(raxIterator *it) {
+    raxNode *n = it->stack[--it->depth].node;
+
+    it->key_len -= n->edgelen;
+    return it->depth != 0;
+}
+
+#define raxIterTop(it) (&(it)->stack[(it)->depth-1])
+
+/* Descend from the current node to the smallest key of its subtree. */
+static void raxIterFirst(raxIterator *it) {
+    raxNode *n = raxIterTop(it)->node;
+
+    while (!n->iskey) {
+        raxIterTop(it)->child = 0;
+        n = n->children[0];
+        raxIterPush(it,n);
+    }
+}
+
+/* Descend from the current node to the greatest key of its subtree. */
+static void raxIterLast(raxIterator *it) {
+    raxNode *n = raxIterTop(it)->node;
+
+    while (n->numchildren) {
+        raxIterTop(it)->child = n->numchildren-1;
+        n = n->children[n->numchildren-1];
+        raxIterPush(it,n);
+    }
+}
+
+/* Move to the smallest key greater than the ones in the subtree of the
+ * current child of the current node, or than the node itself if there is
+ * no current child. Returns 0 if there is no such key. */
+static int raxIterForward(raxIterator *it) {
+    while(1) {
+        raxFrame *f = raxIterTop(it);
+
+        if (f->child+1 < f->node->numchildren) {
+            f->child++;
+            raxIterPush(it,f->node->children[f->child]);
+            raxIterFirst(it);
+            return 1;
+        }
+        if (!raxIterPop(it)) return 0;
+    }
+}
+
+/* Move to the greatest key smaller than the ones in the subtree of the
+ * current child of the current node. Returns 0 if there is no such key. */
+static int raxIterBackward(raxIterator *it) {
+    while(1) {
+        raxFrame *f = raxIterTop(it);
+
+        if (f->child > 0) {
+            f->child--;
+            raxIterPush(it,f->node->children[f->child]);
+            raxIterLast(it);
+            return 1;
+        }
+        if (f->child == 0) {
+            /* The node itself precedes all its children. */
+            f->child = -1;
+            if (f->node->iskey) return 1;
+        }
+        if (!raxIterPop(it)) return 0;
+    }
+}
+
+/* Seek the iterator to the element selected by 'op' and 'ele', that is
+ * returned by the next call to raxNext() or raxPrev(). The operators are
+ * ">", ">=", "<", "<=", "=", "^" (first element) and "$" (last element).
+ * If there is no such element the iterator is at EOF. Returns 0 only if
+ * the operator is invalid. */
+int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
+    int gt = 0, lt = 0, eq = 0, found = 0;
+    raxNode *h = it->rt->head;
+    size_t i = 0;
+
+    if (op[0] == '>' || op[0] == '<') {
+        gt = op[0] == '>';
+        lt = op[0] == '<';
+        eq = op[1] == '=';
+    } else if (op[0] == '=') {
+        eq = 1;
+    } else if (op[0] != '^' && op[0] != '$') {
+        return 0;
+    }
+
+    it->depth = 0;
+    it->key_len = 0;
+    raxIterPush(it,h);
+    if (op[0] == '^') {
+        found = h->iskey || raxIterForward(it);
+    } else if (op[0] == '$') {
+        found = h->iskey || h->numchildren;
+        if (found) raxIterLast(it);
+    } else {
+        while(1) {
+            raxFrame *f = raxIterTop(it);
+            int pos, idx, greater;
+            raxNode *c;
+            size_t m = 0;
+
+            h = f->node;
+            if (i == len) {
+                /* The key is the path to this node. */
+                if (eq && h->iskey) found = 1;
+                else if (gt) found = raxIterForward(it);
+                else if (lt) found = raxIterPop(it) && raxIterBackward(it);
+                break;
+            }
+
+            idx = raxFindChild(h,ele[i],&pos);
+            if (idx == -1) {
+                /* The key would be in the subtree of a missing child at
+                 * index 'pos', between the existing ones. */
+                f->child = gt ? pos-1 : pos;
+                if (gt) found = raxIterForward(it);
+                else if (lt) found = raxIterBackward(it);
+                break;
+            }
+
+            c = h->children[idx];
+            while (m < c->edgelen && i+m < len && c->edge[m] == ele[i+m]) m++;
+            if (m == c->edgelen) {
+                f->child = idx;
+                raxIterPush(it,c);
+                i += m;
+                continue;
+            }
+
+            /* The edge diverges from the key: the whole subtree of the
+             * child is greater than the key if the key ended, or the edge
+             * has the greater byte, otherwise it is smaller. */
+            greater = i+m == len || c->edge[m] > ele[i+m];
+            if (gt) {
+                f->child = greater ? idx-1 : idx;
+                found = raxIterForward(it);
+            } else if (lt) {
+                f->child = greater ? idx : idx+1;
+                found = raxIterBackward(it);
+            }
+            break;
+        }
+    }
+
+    if (found) {
+        it->flags = RAX_ITER_JUST_SEEKED;
+        it->data = raxIterTop(it)->node->data;
+    } else {
+        it->flags = RAX_ITER_EOF;
+    }
+    return 1;
+}
+
+/* Move to the next element. Returns 0 when there are no more elements,
+ * otherwise the key and value are in it->key, it->key_len and it->data. */
+int raxNext(raxIterator *it) {
+    if (it->flags & RAX_ITER_EOF) return 0;
+    if (it->flags & RAX_ITER_JUST_SEEKED) {
+        it->flags &= ~RAX_ITER_JUST_SEEKED;
+        return 1;
+    }
+    raxIterTop(it)->child = -1;
+    if (!raxIterForward(it)) {
+        it->flags |= RAX_ITER_EOF;
+        return 0;
+    }
+    it->data = raxIterTop(it)->node->data;
+    return 1;
+}
+
+/* Like raxNext() but moving to the previous element. */
+int raxPrev(raxIterator *it) {
+    if (it->flags & RAX_ITER_EOF) return 0;
+    if (it->flags & RAX_ITER_JUST_SEEKED) {
+        it->flags &= ~RAX_ITER_JUST_SEEKED;
+        return 1;
+    }
+    if (!raxIterPop(it) || !raxIterBackward(it)) {
+        it->flags |= RAX_ITER_EOF;
+        return 0;
+    }
+    it->data = raxIterTop(it)->node->data;
+    return 1;
+}
+
+int raxEOF(raxIterator *it) {
+    return (it->flags & RAX_ITER_EOF) != 0;
+}
+
+void raxStop(raxIterator *it) {
+    if (it->key != it->key_static) zfree(it->key);
+    if (it->stack != it->stack_static) zfree(it->stack);
+}
+
+#ifdef REDIS_TEST
+#include "testhelp.h"
+#define UNUSED(x) (void)(x)
+
+#define RAX_TEST_KEYS 20000
+
+typedef struct raxTestKey {
+    unsigned char buf[8];
+    size_t len;
+} raxTestKey;
+
+static int raxTestCompare(const void *a, const void *b) {
+    const raxTestKey *ka = a, *kb = b;
+    size_t minlen = ka->len < kb->len ? ka->len : kb->len;
+    int cmp = memcmp(ka->buf,kb->buf,minlen);
+
+    if (cmp) return cmp;
+    return (ka->len > kb->len) - (ka->len < kb->len);
+}
+
+/* Random key from a small alphabet, so that many keys share prefixes and
+ * many keys are prefixes of other keys. */
+static void raxTestRandomKey(raxTestKey *k) {
+    size_t j;
+
+    memset(k,0,sizeof(*k));
+    k->len = rand() % 7;
+    for (j = 0; j < k->len; j++) k->buf[j] = "abcd\xff"[rand() % 5];
+}
+
+/* Brute force lookup of the index of the element 'op' selects in the
+ * sorted array 'keys', or -1. */
+static long raxTestSeekIndex(raxTestKey *keys, long count, const char *op,
+                             raxTestKey *ele)
+{
+    long j;
+
+    if (op[0] == '^') return count ? 0 : -1;
+    if (op[0] == '$') return count-1;
+    if (op[0] == '>') {
+        for (j = 0; j < count; j++) {
+            int cmp = raxTestCompare(&keys[j],ele);
+            if (cmp > 0 || (cmp == 0 && op[1] == '=')) return j;
+        }
+        return -1;
+    }
+    for (j = count-1; j >= 0; j--) {
+        int cmp = raxTestCompare(&keys[j],ele);
+        if (cmp < 0 || (cmp == 0 && op[1] == '=')) return j;
+    }
+    return -1;
+}
+
+static int raxTestCheck(rax *r, raxTestKey *keys, long count) {
+    static const char *ops[] = {">", ">=", "<", "<=", "^", "$"};
+    raxIterator it;
+    long j, iter;
+    int ok = raxSize(r) == (uint64_t)count;
+
+    /* Full scans in both the directions. */
+    raxStart(&it,r);
+    raxSeek(&it,"^",NULL,0);
+    for (j = 0; ok && raxNext(&it); j++) {
+        ok = j < count && it.key_len == keys[j].len &&
+             memcmp(it.key,keys[j].buf,it.key_len) == 0 &&
+             it.data == (void*)(long)keys[j].buf[0];
+    }
+    ok = ok && j == count;
+    raxSeek(&it,"$",NULL,0);
+    for (j = count-1; ok && raxPrev(&it); j--) {
+        ok = j >= 0 && it.key_len == keys[j].len &&
+             memcmp(it.key,keys[j].buf,it.key_len) == 0;
+    }
+    ok = ok && j == -1;
+
+    /* Seeks, followed by a few steps in both the directions. */
+    for (iter = 0; ok && iter < 2000; iter++) {
+        const char *op = ops[rand() % 6];
+        raxTestKey ele;
+        long idx, steps;
+        int forward = rand() & 1;
+
+        raxTestRandomKey(&ele);
+        idx = raxTestSeekIndex(keys,count,op,&ele);
+        raxSeek(&it,op,ele.buf,ele.len);
+        for (steps = 0; ok && steps < 5; steps++) {
+            int res = forward ? raxNext(&it) : raxPrev(&it);
+
+            if (idx < 0 || idx >= count) {
+                ok = !res;
+                break;
+            }
+            ok = res && it.key_len == keys[idx].len &&
+                 memcmp(it.key,keys[idx].buf,it.key_len) == 0;
+            idx += forward ? 1 : -1;
+        }
+    }
+    raxStop(&it);
+
+    for (j = 0; ok && j < count; j++)
+        ok = raxFind(r,keys[j].buf,keys[j].len) != raxNotFound;
+    return ok;
+}
+
+int raxTest(int argc, char *argv[]) {
+    raxTestKey *keys = zmalloc(sizeof(raxTestKey)*RAX_TEST_KEYS);
+    rax *r = raxNew();
+    long count = 0, j, kept;
+    int ok = 1;
+    void *old;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(1234);
+
+    for (j = 0; j < RAX_TEST_KEYS; j++) {
+        raxTestKey k;
+
+        raxTestRandomKey(&k);
+        if (raxInsert(r,k.buf,k.len,(void*)(long)k.buf[0],NULL))
+            keys[count++] = k;
+    }
+    qsort(keys,count,sizeof(raxTestKey),raxTestCompare);
+    test_cond("Insert and iterate keys sharing prefixes",
+        raxTestCheck(r,keys,count));
+
+    ok = raxInsert(r,keys[0].buf,keys[0].len,NULL,&old) == 0 &&
+         old == (void*)(long)keys[0].buf[0] &&
+         raxFind(r,keys[0].buf,keys[0].len) == NULL;
+    raxInsert(r,keys[0].buf,keys[0].len,(void*)(long)keys[0].buf[0],NULL);
+    test_cond("Insert overwrites existing keys", ok);
+
+    /* Remove about half the keys, checking that missing keys can't be
+     * removed, and that the tree stays compressed. */
+    for (j = 0, kept = 0; j < count; j++) {
+        if (rand() & 1) {
+            ok = ok && raxRemove(r,keys[j].buf,keys[j].len,NULL) &&
+                 !raxRemove(r,keys[j].buf,keys[j].len,NULL);
+        } else {
+            keys[kept++] = keys[j];
+        }
+    }
+    test_cond("Remove keys", ok && raxTestCheck(r,keys,kept));
+    test_cond("Nodes are compressed", r->numnodes <= (uint64_t)kept*2+1);
+
+    for (j = 0; j < kept; j++) raxRemove(r,keys[j].buf,keys[j].len,NULL);
+    test_cond("Remove all the keys",
+        raxSize(r) == 0 && r->numnodes == 1 && raxTestCheck(r,keys,0));
+
+    raxFree(r);
+    zfree(keys);
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RAX_H
+#define __RAX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A radix tree mapping binary keys to pointers, iterable in lexicographic
+ * order of the keys. Every node stores the bytes of the edge leading to it
+ * from its parent, so a chain of nodes with a single child and no key is
+ * always compressed into a single node. For instance the keys "foo",
+ * "foobar" and "footer" are stored as:
+ *
+ *            (root) ""
+ *                |
+ *             "foo" [key]
+ *              /     \
+ *          "bar"     "ter"
+ *          [key]     [key]
+ *
+ * The children of a node are kept sorted by the first byte of their edge,
+ * that is unique among siblings. */
+typedef struct raxNode {
+    void *data;                 /* Value of the key, if iskey is set. */
+    struct raxNode **children;  /* Children, sorted by first edge byte. */
+    uint32_t edgelen;           /* Length of the edge. Zero for the root. */
+    uint16_t numchildren;       /* Number of children, up to 256. */
+    uint8_t iskey;              /* The path to this node is a key. */
+    unsigned char edge[];       /* Bytes leading here from the parent. */
+} raxNode;
+
+typedef struct rax {
+    raxNode *head;
+    uint64_t numele;
+    uint64_t numnodes;
+} rax;
+
+/* Iterators keep the path from the root to the current node, so moving to
+ * the next or previous key does not need to seek from the root. */
+typedef struct raxFrame {
+    raxNode *node;
+    int child;      /* Child of 'node' in the next frame, -1 if none. */
+} raxFrame;
+
+#define RAX_ITER_STATIC_KEY 128
+#define RAX_ITER_STATIC_STACK 32
+
+#define RAX_ITER_JUST_SEEKED (1<<0) /* Next call returns the seeked key. */
+#define RAX_ITER_EOF (1<<1)         /* No more elements to return. */
+
+typedef struct raxIterator {
+    rax *rt;                /* Radix tree we are iterating. */
+    int flags;              /* RAX_ITER_* flags. */
+    unsigned char *key;     /* The current key. */
+    size_t key_len;         /* Length of the current key. */
+    size_t key_max;         /* Allocated length of 'key'. */
+    void *data;             /* Value of the current key. */
+    raxFrame *stack;        /* Path from the root to the current node. */
+    size_t depth;           /* Number of frames in the stack. */
+    size_t stack_max;       /* Allocated frames. */
+    unsigned char key_static[RAX_ITER_STATIC_KEY];
+    raxFrame stack_static[RAX_ITER_STATIC_STACK];
+} raxIterator;
+
+/* Returned by raxFind() when the key is missing, so that NULL values can be
+ * told apart from missing keys. */
+extern void *raxNotFound;
+
+rax *raxNew(void);
+int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old);
+int raxRemove(rax *rax, unsigned char *s, size_t len, void **old);
+void *raxFind(rax *rax, unsigned char *s, size_t len);
+void raxFree(rax *rax);
+void raxFreeWithCallback(rax *rax, void (*free_callback)(void*));
+uint64_t raxSize(rax *rax);
+void raxStart(raxIterator *it, rax *rt);
+int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len);
+int raxNext(raxIterator *it);
+int raxPrev(raxIterator *it);
+int raxEOF(raxIterator *it);
+void raxStop(raxIterator *it);
+
+#ifdef REDIS_TEST
+int raxTest(int argc, char *argv[]);
+#endif
+
+#endif
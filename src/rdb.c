@@ -29,6 +29,7 @@
 
 #include "server.h"
 #include "lzf.h"    /* LZF compression library */
+#include "lz4.h"    /* LZ4 compression */
 #include "zipmap.h"
 #include "endianconv.h"
 
@@ -44,6 +45,7 @@
 #define RDB_LOAD_NONE   0
 #define RDB_LOAD_ENC    (1<<0)
 #define RDB_LOAD_PLAIN  (1<<1)
+#define RDB_LOAD_LZF    (1<<2)
 
 #define rdbExitReportCorruptRDB(...) rdbCheckThenExit(__LINE__,__VA_ARGS__)
 
@@ -108,6 +110,34 @@ long long rdbLoadMillisecondTime(rio *rdb) {
     return (long long)t64;
 }
 
+/* Save and load 64 bit counters, that do not fit the 32 bit RDB lengths,
+ * as raw little endian integers. */
+static int rdbSaveRawUInt64(rio *rdb, uint64_t v) {
+    memrev64ifbe(&v);
+    return rdbWriteRaw(rdb,&v,8);
+}
+
+static int rdbLoadRawUInt64(rio *rdb, uint64_t *v) {
+    if (rioRead(rdb,v,8) == 0) return -1;
+    memrev64ifbe(v);
+    return 0;
+}
+
+/* Stream IDs are saved as the 128 bit big endian number also used as key
+ * of the stream radix trees. */
+static int rdbSaveStreamID(rio *rdb, streamID *id) {
+    unsigned char buf[sizeof(streamID)];
+    streamEncodeID(buf,id);
+    return rdbWriteRaw(rdb,buf,sizeof(buf));
+}
+
+static int rdbLoadStreamID(rio *rdb, streamID *id) {
+    unsigned char buf[sizeof(streamID)];
+    if (rioRead(rdb,buf,sizeof(buf)) == 0) return -1;
+    streamDecodeID(buf,id);
+    return 0;
+}
+
 /* Saves an encoded length. The first two bits in the first byte are used to
  * hold the encoding type. See the RDB_* definitions for more information
  * on the types of encoding. */
@@ -254,13 +284,16 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
-ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
-                       size_t original_len) {
+/* Save 'compress_len' bytes of data compressed with the RDB_ENC_LZF or
+ * RDB_ENC_LZ4 encoding 'enc', that decompress to 'original_len' bytes. */
+static ssize_t rdbSaveCompressedBlob(rio *rdb, int enc, void *data,
+                                     size_t compress_len, size_t original_len)
+{
     unsigned char byte;
     ssize_t n, nwritten = 0;
 
     /* Data compressed! Let's save it on disk */
-    byte = (RDB_ENCVAL<<6)|RDB_ENC_LZF;
+    byte = (RDB_ENCVAL<<6)|enc;
     if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
     nwritten += n;
 
@@ -279,6 +312,12 @@ writeerr:
     return -1;
 }
 
+ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
+                       size_t original_len) {
+    return rdbSaveCompressedBlob(rdb,RDB_ENC_LZF,data,compress_len,
+                                 original_len);
+}
+
 ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
     size_t comprlen, outlen;
     void *out;
@@ -297,10 +336,33 @@ ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
     return nwritten;
 }
 
-/* Load an LZF compressed string in RDB format. The returned value
- * changes according to 'flags'. For more info check the
- * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags) {
+/* Like rdbSaveLzfStringObject() but compress with LZ4, searching harder
+ * for matches if 'hc' is true. */
+ssize_t rdbSaveLz4StringObject(rio *rdb, unsigned char *s, size_t len,
+                               int hc) {
+    size_t comprlen, outlen;
+    void *out;
+
+    /* We require at least four bytes compression for this to be worth it */
+    if (len <= 4) return 0;
+    outlen = len-4;
+    if ((out = zmalloc(outlen+1)) == NULL) return 0;
+    comprlen = hc ? lz4_compress_hc(s, len, out, outlen) :
+                    lz4_compress(s, len, out, outlen);
+    if (comprlen == 0) {
+        zfree(out);
+        return 0;
+    }
+    ssize_t nwritten = rdbSaveCompressedBlob(rdb, RDB_ENC_LZ4, out,
+                                             comprlen, len);
+    zfree(out);
+    return nwritten;
+}
+
+/* Load a string compressed with the RDB_ENC_LZF or RDB_ENC_LZ4 encoding
+ * 'enc' in RDB format. The returned value changes according to 'flags'.
+ * For more info check the rdbGenericLoadStringObject() function. */
+void *rdbLoadCompressedStringObject(rio *rdb, int enc, int flags) {
     int plain = flags & RDB_LOAD_PLAIN;
     unsigned int len, clen;
     unsigned char *c = NULL;
@@ -319,9 +381,30 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags) {
 
     /* Load the compressed representation and uncompress it to target. */
     if (rioRead(rdb,c,clen) == 0) goto err;
-    if (lzf_decompress(c,clen,val,len) == 0) {
-        if (rdbCheckMode) rdbCheckSetError("Invalid LZF compressed string");
-        goto err;
+    if (enc == RDB_ENC_LZF) {
+        if (lzf_decompress(c,clen,val,len) == 0) {
+            if (rdbCheckMode) rdbCheckSetError("Invalid LZF compressed string");
+            goto err;
+        }
+    } else {
+        if (lz4_decompress(c,clen,val,len) != len) {
+            if (rdbCheckMode) rdbCheckSetError("Invalid LZ4 compressed string");
+            goto err;
+        }
+    }
+
+    /* Keep the LZF representation of string values when it is big
+     * enough, the data was decompressed above just to validate it. LZ4
+     * values are compressed again with LZF by rdbLoadObject(). */
+    if (enc == RDB_ENC_LZF && (flags & RDB_LOAD_LZF) && !plain &&
+        server.string_compress_threshold &&
+        len >= server.string_compress_threshold &&
+        !(len >= 4 && !memcmp(val,"HYLL",4)))
+    {
+        robj *o = createLzfStringObject(c,clen,len);
+        zfree(c);
+        sdsfree(val);
+        return o;
     }
     zfree(c);
 
@@ -353,10 +436,14 @@ ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
+    /* Try compression - under 20 bytes it's unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it */
     if (server.rdb_compression && len > 20) {
-        n = rdbSaveLzfStringObject(rdb,s,len);
+        if (server.rdb_compression_codec == RDB_CODEC_LZF)
+            n = rdbSaveLzfStringObject(rdb,s,len);
+        else
+            n = rdbSaveLz4StringObject(rdb,s,len,
+                server.rdb_compression_codec == RDB_CODEC_LZ4HC);
         if (n == -1) return -1;
         if (n > 0) return n;
         /* Return value of 0 means data can't be compressed, save the old way */
@@ -397,6 +484,10 @@ int rdbSaveStringObject(rio *rdb, robj *obj) {
      * object is already integer encoded. */
     if (obj->encoding == OBJ_ENCODING_INT) {
         return rdbSaveLongLongAsStringObject(rdb,(long)obj->ptr);
+    } else if (obj->encoding == OBJ_ENCODING_LZF) {
+        /* Already compressed: write the LZF data as it is. */
+        lzfString *lzs = obj->ptr;
+        return rdbSaveLzfBlob(rdb,lzs->buf,lzs->clen,lzs->len);
     } else {
         serverAssertWithInfo(NULL,obj,sdsEncodedObject(obj));
         return rdbSaveRawString(rdb,obj->ptr,sdslen(obj->ptr));
@@ -412,6 +503,8 @@ int rdbSaveStringObject(rio *rdb, robj *obj) {
  *               no longer guarantees that obj->ptr is an SDS string.
  * RDB_LOAD_PLAIN: Return a plain string allocated with zmalloc()
  *                 instead of a Redis object with an sds in it.
+ * RDB_LOAD_LZF: The string is the value of a string key: keep it LZF
+ *               compressed if string compression is enabled.
  * RDB_LOAD_SDS: Return an SDS string instead of a Redis object.
  */
 void *rdbGenericLoadStringObject(rio *rdb, int flags) {
@@ -428,7 +521,8 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags) {
         case RDB_ENC_INT32:
             return rdbLoadIntegerObject(rdb,len,flags);
         case RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb,flags);
+        case RDB_ENC_LZ4:
+            return rdbLoadCompressedStringObject(rdb,len,flags);
         default:
             rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
         }
@@ -525,7 +619,10 @@ int rdbLoadDoubleValue(rio *rdb, double *val) {
 int rdbSaveObjectType(rio *rdb, robj *o) {
     switch (o->type) {
     case OBJ_STRING:
-        return rdbSaveType(rdb,RDB_TYPE_STRING);
+        if (o->encoding == OBJ_ENCODING_ROARING)
+            return rdbSaveType(rdb,RDB_TYPE_STRING_ROARING);
+        else
+            return rdbSaveType(rdb,RDB_TYPE_STRING);
     case OBJ_LIST:
         if (o->encoding == OBJ_ENCODING_QUICKLIST)
             return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST);
@@ -541,7 +638,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
     case OBJ_ZSET:
         if (o->encoding == OBJ_ENCODING_ZIPLIST)
             return rdbSaveType(rdb,RDB_TYPE_ZSET_ZIPLIST);
-        else if (o->encoding == OBJ_ENCODING_SKIPLIST)
+        else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                 o->encoding == OBJ_ENCODING_BTREE)
             return rdbSaveType(rdb,RDB_TYPE_ZSET);
         else
             serverPanic("Unknown sorted set encoding");
@@ -552,6 +650,18 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
             return rdbSaveType(rdb,RDB_TYPE_HASH);
         else
             serverPanic("Unknown hash encoding");
+    case OBJ_STREAM:
+        return rdbSaveType(rdb,RDB_TYPE_STREAM_ZIPLISTS);
+    case OBJ_BLOOM:
+        return rdbSaveType(rdb,RDB_TYPE_BLOOM);
+    case OBJ_CUCKOO:
+        return rdbSaveType(rdb,RDB_TYPE_CUCKOO);
+    case OBJ_CMS:
+        return rdbSaveType(rdb,RDB_TYPE_CMS);
+    case OBJ_TOPK:
+        return rdbSaveType(rdb,RDB_TYPE_TOPK);
+    case OBJ_TIMESERIES:
+        return rdbSaveType(rdb,RDB_TYPE_TIMESERIES);
     default:
         serverPanic("Unknown object type");
     }
@@ -567,11 +677,81 @@ int rdbLoadObjectType(rio *rdb) {
     return type;
 }
 
+/* Save the consumer group 'cg' named 'name' of a stream. Returns -1 on
+ * error, number of bytes written on success. */
+static ssize_t rdbSaveStreamCG(rio *rdb, unsigned char *name, size_t namelen, streamCG *cg) {
+    ssize_t n, nwritten = 0;
+    raxIterator ri, ci;
+
+    if ((n = rdbSaveRawString(rdb,name,namelen)) == -1) return -1;
+    nwritten += n;
+    if ((n = rdbSaveStreamID(rdb,&cg->last_id)) == -1) return -1;
+    nwritten += n;
+
+    /* The group pending entries list. */
+    if ((n = rdbSaveLen(rdb,raxSize(cg->pel))) == -1) return -1;
+    nwritten += n;
+    raxStart(&ri,cg->pel);
+    raxSeek(&ri,"^",NULL,0);
+    while (raxNext(&ri)) {
+        streamNACK *nack = ri.data;
+        if (rdbWriteRaw(rdb,ri.key,ri.key_len) == -1 ||
+            rdbSaveMillisecondTime(rdb,nack->delivery_time) == -1 ||
+            rdbSaveRawUInt64(rdb,nack->delivery_count) == -1)
+        {
+            raxStop(&ri);
+            return -1;
+        }
+        nwritten += ri.key_len+16;
+    }
+    raxStop(&ri);
+
+    /* The consumers. */
+    if ((n = rdbSaveLen(rdb,raxSize(cg->consumers))) == -1) return -1;
+    nwritten += n;
+    raxStart(&ci,cg->consumers);
+    raxSeek(&ci,"^",NULL,0);
+    while (raxNext(&ci)) {
+        streamConsumer *consumer = ci.data;
+        if ((n = rdbSaveRawString(rdb,ci.key,ci.key_len)) == -1 ||
+            rdbSaveMillisecondTime(rdb,consumer->seen_time) == -1 ||
+            (nwritten += n+8,
+             n = rdbSaveLen(rdb,raxSize(consumer->pel))) == -1)
+        {
+            raxStop(&ci);
+            return -1;
+        }
+        nwritten += n;
+        raxStart(&ri,consumer->pel);
+        raxSeek(&ri,"^",NULL,0);
+        while (raxNext(&ri)) {
+            if (rdbWriteRaw(rdb,ri.key,ri.key_len) == -1) {
+                raxStop(&ri);
+                raxStop(&ci);
+                return -1;
+            }
+            nwritten += ri.key_len;
+        }
+        raxStop(&ri);
+    }
+    raxStop(&ci);
+    return nwritten;
+}
+
 /* Save a Redis object. Returns -1 on error, number of bytes written on success. */
 ssize_t rdbSaveObject(rio *rdb, robj *o) {
     ssize_t n = 0, nwritten = 0;
 
-    if (o->type == OBJ_STRING) {
+    if (o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_ROARING) {
+        /* Save a roaring bitmap as a serialized blob */
+        size_t len;
+        unsigned char *blob = roaringSerialize(o->ptr,&len);
+
+        n = rdbSaveRawString(rdb,blob,len);
+        zfree(blob);
+        if (n == -1) return -1;
+        nwritten += n;
+    } else if (o->type == OBJ_STRING) {
         /* Save a string value */
         if ((n = rdbSaveStringObject(rdb,o)) == -1) return -1;
         nwritten += n;
@@ -648,6 +828,25 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
                 nwritten += n;
             }
             dictReleaseIterator(di);
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = o->ptr;
+            zbtreeCursor cur;
+
+            if ((n = rdbSaveLen(rdb,zs->zbt->length)) == -1) return -1;
+            nwritten += n;
+
+            /* Elements are saved in order, so that loading them back only
+             * appends at the tail of the tree. */
+            zbtFirst(zs->zbt,&cur);
+            while(cur.leaf) {
+                if ((n = rdbSaveStringObject(rdb,zbtCursorObj(&cur))) == -1)
+                    return -1;
+                nwritten += n;
+                if ((n = rdbSaveDoubleValue(rdb,zbtCursorScore(&cur))) == -1)
+                    return -1;
+                nwritten += n;
+                zbtNext(&cur);
+            }
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -681,6 +880,63 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
             serverPanic("Unknown hash encoding");
         }
 
+    } else if (o->type == OBJ_STREAM) {
+        /* Save the radix tree nodes: the key is the ID of the master
+         * entry, the value the ziplist, saved as it is. */
+        stream *s = o->ptr;
+        raxIterator ri;
+
+        if ((n = rdbSaveLen(rdb,raxSize(s->rax))) == -1) return -1;
+        nwritten += n;
+        raxStart(&ri,s->rax);
+        raxSeek(&ri,"^",NULL,0);
+        while (raxNext(&ri)) {
+            unsigned char *zl = ri.data;
+            if ((n = rdbSaveRawString(rdb,ri.key,ri.key_len)) == -1 ||
+                (nwritten += n,
+                 n = rdbSaveRawString(rdb,zl,ziplistBlobLen(zl))) == -1)
+            {
+                raxStop(&ri);
+                return -1;
+            }
+            nwritten += n;
+        }
+        raxStop(&ri);
+
+        /* Save the number of entries and the last ID, that can't be
+         * derived from the entries since they may have been deleted. */
+        if ((n = rdbSaveRawUInt64(rdb,s->length)) == -1) return -1;
+        nwritten += n;
+        if ((n = rdbSaveStreamID(rdb,&s->last_id)) == -1) return -1;
+        nwritten += n;
+
+        /* Save the consumer groups, with their pending entries lists and
+         * consumers. The consumers only save the IDs of their pending
+         * entries: the NACKs are the ones of the group PEL. */
+        if ((n = rdbSaveLen(rdb,s->cgroups ? raxSize(s->cgroups) : 0)) == -1)
+            return -1;
+        nwritten += n;
+        if (s->cgroups) {
+            raxStart(&ri,s->cgroups);
+            raxSeek(&ri,"^",NULL,0);
+            while (raxNext(&ri)) {
+                if ((n = rdbSaveStreamCG(rdb,ri.key,ri.key_len,ri.data)) == -1) {
+                    raxStop(&ri);
+                    return -1;
+                }
+                nwritten += n;
+            }
+            raxStop(&ri);
+        }
+    } else if (OBJ_TYPE_IS_BLOB(o->type)) {
+        /* Save filters and sketches as a serialized blob */
+        size_t len;
+        unsigned char *blob = serializeBlobObject(o,&len);
+
+        n = rdbSaveRawString(rdb,blob,len);
+        zfree(blob);
+        if (n == -1) return -1;
+        nwritten += n;
     } else {
         serverPanic("Unknown object type");
     }
@@ -697,17 +953,73 @@ size_t rdbSavedObjectLen(robj *o) {
     return len;
 }
 
+/* Save the expire times of the volatile fields of a hash, as an opcode
+ * followed by the number of fields and a (field, unix time in ms) pair for
+ * every field. Fields already expired are saved as well, since the hash
+ * value still contains them. On error -1 is returned. */
+int rdbSaveFieldExpires(rio *rdb, hashFieldExpires *hfe) {
+    dictIterator *di;
+    dictEntry *de;
+
+    if (rdbSaveType(rdb,RDB_OPCODE_FIELD_EXPIRES) == -1) return -1;
+    if (rdbSaveLen(rdb,dictSize(hfe->fields)) == -1) return -1;
+    di = dictGetIterator(hfe->fields);
+    while((de = dictNext(di)) != NULL) {
+        sds field = dictGetKey(de);
+
+        if (rdbSaveRawString(rdb,(unsigned char*)field,sdslen(field)) == -1 ||
+            rdbSaveMillisecondTime(rdb,dictGetSignedIntegerVal(de)) == -1)
+        {
+            dictReleaseIterator(di);
+            return -1;
+        }
+    }
+    dictReleaseIterator(di);
+    return 1;
+}
+
+/* Load the payload of an RDB_OPCODE_FIELD_EXPIRES opcode. Returns NULL
+ * on short read. */
+hashFieldExpires *rdbLoadFieldExpires(rio *rdb) {
+    hashFieldExpires *hfe = hashFieldExpiresCreate();
+    uint32_t len;
+
+    if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) goto err;
+    while(len--) {
+        robj *field;
+        long long when;
+
+        if ((field = rdbLoadStringObject(rdb)) == NULL) goto err;
+        if ((when = rdbLoadMillisecondTime(rdb)) == -1) {
+            decrRefCount(field);
+            goto err;
+        }
+        hashFieldExpiresSet(hfe,field->ptr,when);
+        decrRefCount(field);
+    }
+    return hfe;
+
+err:
+    hashFieldExpiresRelease(hfe);
+    return NULL;
+}
+
 /* Save a key-value pair, with expire time, type, key, value.
+ * If 'hfe' is not NULL the expire times of the hash fields are saved too.
  * On error -1 is returned.
  * On success if the key was actually saved 1 is returned, otherwise 0
  * is returned (the key was already expired). */
-int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val,
-                        long long expiretime, long long now)
+int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime,
+                        hashFieldExpires *hfe, long long now)
 {
+    /* If this key is already expired skip it */
+    if (expiretime != -1 && expiretime < now) return 0;
+
+    /* Save the field expires */
+    if (hfe && rdbSaveFieldExpires(rdb,hfe) == -1) return -1;
+
     /* Save the expire time */
     if (expiretime != -1) {
-        /* If this key is already expired skip it */
-        if (expiretime < now) return 0;
         if (rdbSaveType(rdb,RDB_OPCODE_EXPIRETIME_MS) == -1) return -1;
         if (rdbSaveMillisecondTime(rdb,expiretime) == -1) return -1;
     }
@@ -740,8 +1052,10 @@ int rdbSaveAuxFieldStrInt(rio *rdb, char *key, long long val) {
     return rdbSaveAuxField(rdb,key,strlen(key),buf,vlen);
 }
 
-/* Save a few default AUX fields with information about the RDB generated. */
-int rdbSaveInfoAuxFields(rio *rdb) {
+/* Save a few default AUX fields with information about the RDB generated.
+ * The preamble of an AOF is not a snapshot the RDB deltas can be based on,
+ * so it has no snapshot-id. */
+int rdbSaveInfoAuxFields(rio *rdb, int flags) {
     int redis_bits = (sizeof(void*) == 8) ? 64 : 32;
 
     /* Add a few fields about the state when the RDB was created. */
@@ -749,6 +1063,9 @@ int rdbSaveInfoAuxFields(rio *rdb) {
     if (rdbSaveAuxFieldStrInt(rdb,"redis-bits",redis_bits) == -1) return -1;
     if (rdbSaveAuxFieldStrInt(rdb,"ctime",time(NULL)) == -1) return -1;
     if (rdbSaveAuxFieldStrInt(rdb,"used-mem",zmalloc_used_memory()) == -1) return -1;
+    if (!(flags & RDB_SAVE_AOF_PREAMBLE) &&
+        rdbSaveAuxFieldStrStr(rdb,"snapshot-id",server.rdb_save_snapshot_id) == -1)
+        return -1;
     return 1;
 }
 
@@ -760,19 +1077,20 @@ int rdbSaveInfoAuxFields(rio *rdb) {
  * When the function returns C_ERR and if 'error' is not NULL, the
  * integer pointed by 'error' is set to the value of errno just after the I/O
  * error. */
-int rdbSaveRio(rio *rdb, int *error) {
+int rdbSaveRio(rio *rdb, int *error, int flags) {
     dictIterator *di = NULL;
     dictEntry *de;
     char magic[10];
     int j;
     long long now = mstime();
+    long long keys = 0;
     uint64_t cksum;
 
     if (server.rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
     snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
     if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
-    if (rdbSaveInfoAuxFields(rdb) == -1) goto werr;
+    if (rdbSaveInfoAuxFields(rdb,flags) == -1) goto werr;
 
     for (j = 0; j < server.dbnum; j++) {
         redisDb *db = server.db+j;
@@ -808,11 +1126,16 @@ int rdbSaveRio(rio *rdb, int *error) {
 
             initStaticStringObject(key,keystr);
             expire = getExpire(db,&key);
-            if (rdbSaveKeyValuePair(rdb,&key,o,expire,now) == -1) goto werr;
+            if (rdbSaveKeyValuePair(rdb,&key,o,expire,
+                hashGetFieldExpires(db,&key),now) == -1) goto werr;
+            /* Report the progress to the parent if we are a child. */
+            if ((++keys & 1023) == 0)
+                childInfoUpdate(keys,rdb->processed_bytes);
         }
         dictReleaseIterator(di);
     }
     di = NULL; /* So that we don't release it again on error. */
+    childInfoUpdate(keys,rdb->processed_bytes);
 
     /* EOF opcode */
     if (rdbSaveType(rdb,RDB_OPCODE_EOF) == -1) goto werr;
@@ -846,7 +1169,7 @@ int rdbSaveRioWithEOFMark(rio *rdb, int *error) {
     if (rioWrite(rdb,"$EOF:",5) == 0) goto werr;
     if (rioWrite(rdb,eofmark,RDB_EOF_MARK_SIZE) == 0) goto werr;
     if (rioWrite(rdb,"\r\n",2) == 0) goto werr;
-    if (rdbSaveRio(rdb,error) == C_ERR) goto werr;
+    if (rdbSaveRio(rdb,error,RDB_SAVE_NONE) == C_ERR) goto werr;
     if (rioWrite(rdb,eofmark,RDB_EOF_MARK_SIZE) == 0) goto werr;
     return C_OK;
 
@@ -856,8 +1179,9 @@ werr: /* Write error. */
     return C_ERR;
 }
 
-/* Save the DB on disk. Return C_ERR on error, C_OK on success. */
-int rdbSave(char *filename) {
+/* Save the DB, or the delta of the changes tracked since the last save if
+ * 'delta' is true, on disk. Return C_ERR on error, C_OK on success. */
+static int rdbSaveToFile(char *filename, int delta) {
     char tmpfile[256];
     char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
     FILE *fp;
@@ -878,7 +1202,11 @@ int rdbSave(char *filename) {
     }
 
     rioInitWithFile(&rdb,fp);
-    if (rdbSaveRio(&rdb,&error) == C_ERR) {
+    if (server.in_fork_child && server.child_max_write_rate)
+        rioSetRateLimit(&rdb,server.child_max_write_rate);
+    if ((delta ? rdbSaveDeltaRio(&rdb,&error) :
+                 rdbSaveRio(&rdb,&error,RDB_SAVE_NONE)) == C_ERR)
+    {
         errno = error;
         goto werr;
     }
@@ -903,7 +1231,7 @@ int rdbSave(char *filename) {
         return C_ERR;
     }
 
-    serverLog(LL_NOTICE,"DB saved on disk");
+    serverLog(LL_NOTICE,delta ? "DB delta saved on disk" : "DB saved on disk");
     server.dirty = 0;
     server.lastsave = time(NULL);
     server.lastbgsave_status = C_OK;
@@ -916,25 +1244,47 @@ werr:
     return C_ERR;
 }
 
+/* Save the DB on disk. Return C_ERR on error, C_OK on success. */
+int rdbSave(char *filename) {
+    int retval;
+
+    /* The parent tracks the changes saved by its children. */
+    if (server.in_fork_child) return rdbSaveToFile(filename,0);
+    rdbDeltaSaveStart();
+    retval = rdbSaveToFile(filename,0);
+    rdbDeltaSaveDone(retval == C_OK,0);
+    return retval;
+}
+
+/* Save the delta of the changes tracked since the last save on disk, see
+ * delta.c. Only called by the delta saving child. */
+int rdbSaveDelta(char *filename) {
+    return rdbSaveToFile(filename,1);
+}
+
 int rdbSaveBackground(char *filename) {
     pid_t childpid;
     long long start;
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) return C_ERR;
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
+    rdbDeltaSaveStart();
 
+    openChildInfoPipe(CHILD_INFO_TYPE_RDB);
     start = ustime();
     if ((childpid = fork()) == 0) {
         int retval;
 
         /* Child */
+        server.in_fork_child = 1;
         closeListeningSockets(0);
         redisSetProcTitle("redis-rdb-bgsave");
+        setChildIOClass();
         retval = rdbSave(filename);
         if (retval == C_OK) {
-            size_t private_dirty = zmalloc_get_private_dirty();
+            size_t private_dirty = sendChildInfo(1);
 
             if (private_dirty) {
                 serverLog(LL_NOTICE,
@@ -949,6 +1299,8 @@ int rdbSaveBackground(char *filename) {
         server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
         latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
         if (childpid == -1) {
+            closeChildInfoPipe();
+            rdbDeltaSaveDone(0,0);
             server.lastbgsave_status = C_ERR;
             serverLog(LL_WARNING,"Can't save in background: fork: %s",
                 strerror(errno));
@@ -971,6 +1323,113 @@ void rdbRemoveTempFile(pid_t childpid) {
     unlink(tmpfile);
 }
 
+/* Load the radix tree nodes, the counters and the consumer groups of a
+ * stream saved by rdbSaveObject() into the empty stream 's'.
+ * Returns -1 on error (the stream may be partially populated). */
+static int rdbLoadStreamObject(rio *rdb, stream *s) {
+    uint32_t nodes, groups, len;
+
+    if ((nodes = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+    while (nodes--) {
+        robj *key = rdbLoadStringObject(rdb);
+        unsigned char *zl;
+
+        if (key == NULL) return -1;
+        if (sdslen(key->ptr) != sizeof(streamID))
+            rdbExitReportCorruptRDB("Stream node key entry is not the "
+                                    "size of a stream ID");
+        zl = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN);
+        if (zl == NULL) {
+            decrRefCount(key);
+            return -1;
+        }
+        if (ziplistLen(zl) == 0)
+            rdbExitReportCorruptRDB("Empty stream node found");
+        raxInsert(s->rax,key->ptr,sizeof(streamID),zl,NULL);
+        decrRefCount(key);
+    }
+    if (rdbLoadRawUInt64(rdb,&s->length) == -1) return -1;
+    if (rdbLoadStreamID(rdb,&s->last_id) == -1) return -1;
+
+    if ((groups = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+    while (groups--) {
+        robj *name = rdbLoadStringObject(rdb);
+        streamID id;
+        streamCG *cg;
+
+        if (name == NULL) return -1;
+        if (rdbLoadStreamID(rdb,&id) == -1) {
+            decrRefCount(name);
+            return -1;
+        }
+        cg = streamCreateCG(s,name->ptr,sdslen(name->ptr),&id);
+        if (cg == NULL)
+            rdbExitReportCorruptRDB("Duplicated consumer group name %s",
+                                    (char*)name->ptr);
+        decrRefCount(name);
+
+        /* The group pending entries list: the NACKs are created without
+         * consumer, that is set while loading the consumers PELs. */
+        if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+        while (len--) {
+            unsigned char rawid[sizeof(streamID)];
+            streamNACK *nack;
+
+            if (rioRead(rdb,rawid,sizeof(rawid)) == 0) return -1;
+            nack = streamCreateNACK(NULL);
+            if ((nack->delivery_time = rdbLoadMillisecondTime(rdb)) == -1 ||
+                rdbLoadRawUInt64(rdb,&nack->delivery_count) == -1)
+            {
+                streamFreeNACK(nack);
+                return -1;
+            }
+            if (!raxInsert(cg->pel,rawid,sizeof(rawid),nack,NULL))
+                rdbExitReportCorruptRDB("Duplicated global PEL entry "
+                                        "loading stream consumer group");
+        }
+
+        /* The consumers, referencing the NACKs of the group PEL. */
+        if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+        while (len--) {
+            robj *cname = rdbLoadStringObject(rdb);
+            streamConsumer *consumer;
+            uint32_t pelsize;
+
+            if (cname == NULL) return -1;
+            consumer = streamLookupConsumer(cg,cname->ptr,1);
+            decrRefCount(cname);
+            if ((consumer->seen_time = rdbLoadMillisecondTime(rdb)) == -1)
+                return -1;
+            if ((pelsize = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+            while (pelsize--) {
+                unsigned char rawid[sizeof(streamID)];
+                streamNACK *nack;
+
+                if (rioRead(rdb,rawid,sizeof(rawid)) == 0) return -1;
+                nack = raxFind(cg->pel,rawid,sizeof(rawid));
+                if (nack == raxNotFound || nack->consumer != NULL)
+                    rdbExitReportCorruptRDB("Consumer entry not found in "
+                                            "group global PEL");
+                nack->consumer = consumer;
+                raxInsert(consumer->pel,rawid,sizeof(rawid),nack,NULL);
+            }
+        }
+
+        /* Every pending entry must be owned by some consumer. */
+        raxIterator ri;
+        raxStart(&ri,cg->pel);
+        raxSeek(&ri,"^",NULL,0);
+        while (raxNext(&ri)) {
+            streamNACK *nack = ri.data;
+            if (nack->consumer == NULL)
+                rdbExitReportCorruptRDB("Stream CG PEL entry without "
+                                        "consumer");
+        }
+        raxStop(&ri);
+    }
+    return 0;
+}
+
 /* Load a Redis object of the specified type from the specified file.
  * On success a newly allocated object is returned, otherwise NULL. */
 robj *rdbLoadObject(int rdbtype, rio *rdb) {
@@ -979,9 +1438,16 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
     unsigned int i;
 
     if (rdbtype == RDB_TYPE_STRING) {
+        robj *compressed;
+
         /* Read string value */
-        if ((o = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
+        o = rdbGenericLoadStringObject(rdb,RDB_LOAD_ENC|RDB_LOAD_LZF);
+        if (o == NULL) return NULL;
         o = tryObjectEncoding(o);
+        if ((compressed = tryObjectCompression(o)) != NULL) {
+            decrRefCount(o);
+            o = compressed;
+        }
     } else if (rdbtype == RDB_TYPE_LIST) {
         /* Read list value */
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
@@ -1042,17 +1508,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* Read list/set value */
         size_t zsetlen;
         size_t maxelelen = 0;
-        zset *zs;
 
         if ((zsetlen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
         o = createZsetObject();
-        zs = o->ptr;
 
         /* Load every single element of the list/set */
         while(zsetlen--) {
             robj *ele;
             double score;
-            zskiplistNode *znode;
 
             if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
             ele = tryObjectEncoding(ele);
@@ -1062,9 +1525,8 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if (sdsEncodedObject(ele) && sdslen(ele->ptr) > maxelelen)
                 maxelelen = sdslen(ele->ptr);
 
-            znode = zslInsert(zs->zsl,score,ele);
-            dictAdd(zs->dict,ele,&znode->score);
-            incrRefCount(ele); /* added to skiplist */
+            zsetInsertNew(o,score,ele);
+            decrRefCount(ele);
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
@@ -1147,6 +1609,42 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if (zl == NULL) return NULL;
             quicklistAppendZiplist(o->ptr, zl);
         }
+    } else if (rdbtype == RDB_TYPE_STRING_ROARING) {
+        roaring *r;
+
+        /* The serialized bitmap is validated while it is loaded, since a
+         * corrupted bitmap could crash the server later: an invalid bitmap
+         * is reported as a loading error (or as a bad RESTORE payload). */
+        if ((o = rdbLoadStringObject(rdb)) == NULL) return NULL;
+        r = roaringDeserialize(o->ptr,sdslen(o->ptr));
+        decrRefCount(o);
+        if (r == NULL) return NULL;
+        o = createRoaringStringObject(r);
+    } else if (rdbtype == RDB_TYPE_BLOOM || rdbtype == RDB_TYPE_CUCKOO ||
+               rdbtype == RDB_TYPE_CMS || rdbtype == RDB_TYPE_TOPK ||
+               rdbtype == RDB_TYPE_TIMESERIES)
+    {
+        robj *blob;
+        int type;
+
+        switch(rdbtype) {
+        case RDB_TYPE_BLOOM: type = OBJ_BLOOM; break;
+        case RDB_TYPE_CUCKOO: type = OBJ_CUCKOO; break;
+        case RDB_TYPE_CMS: type = OBJ_CMS; break;
+        case RDB_TYPE_TOPK: type = OBJ_TOPK; break;
+        default: type = OBJ_TIMESERIES; break;
+        }
+        /* Blobs are validated like roaring bitmaps. */
+        if ((blob = rdbLoadStringObject(rdb)) == NULL) return NULL;
+        o = createObjectFromBlob(type,blob->ptr,sdslen(blob->ptr));
+        decrRefCount(blob);
+        if (o == NULL) return NULL;
+    } else if (rdbtype == RDB_TYPE_STREAM_ZIPLISTS) {
+        o = createStreamObject();
+        if (rdbLoadStreamObject(rdb,o->ptr) == -1) {
+            decrRefCount(o);
+            return NULL;
+        }
     } else if (rdbtype == RDB_TYPE_HASH_ZIPMAP  ||
                rdbtype == RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == RDB_TYPE_SET_INTSET   ||
@@ -1208,7 +1706,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 o->type = OBJ_ZSET;
                 o->encoding = OBJ_ENCODING_ZIPLIST;
                 if (zsetLength(o) > server.zset_max_ziplist_entries)
-                    zsetConvert(o,OBJ_ENCODING_SKIPLIST);
+                    zsetConvert(o,server.zset_large_encoding);
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
                 o->type = OBJ_HASH;
@@ -1231,15 +1729,20 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 void startLoading(FILE *fp) {
     struct stat sb;
 
+    if (fstat(fileno(fp), &sb) == -1)
+        startLoadingSize(0);
+    else
+        startLoadingSize(sb.st_size);
+}
+
+/* Like startLoading() when the data is not read from a file, 'size' is the
+ * number of bytes to load if known, otherwise zero. */
+void startLoadingSize(off_t size) {
     /* Load the DB */
     server.loading = 1;
     server.loading_start_time = time(NULL);
     server.loading_loaded_bytes = 0;
-    if (fstat(fileno(fp), &sb) == -1) {
-        server.loading_total_bytes = 0;
-    } else {
-        server.loading_total_bytes = sb.st_size;
-    }
+    server.loading_total_bytes = size;
 }
 
 /* Refresh the loading progress info */
@@ -1273,67 +1776,483 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     }
 }
 
-int rdbLoad(char *filename) {
+/* Attach the field expires loaded by rdbLoadFieldExpires() to the hash
+ * 'val' just added to the DB at 'key'. */
+static void rdbAttachFieldExpires(redisDb *db, robj *key, robj *val,
+                                  hashFieldExpires *hfe)
+{
+    dictIterator *di;
+    dictEntry *de;
+
+    di = dictGetIterator(hfe->fields);
+    while((de = dictNext(di)) != NULL) {
+        sds name = dictGetKey(de);
+        robj *field = createStringObject(name,sdslen(name));
+
+        if (hashTypeExists(val,field))
+            hashSetFieldExpire(db,key,field,dictGetSignedIntegerVal(de));
+        decrRefCount(field);
+    }
+    dictReleaseIterator(di);
+}
+
+/* Add a key read from an RDB file to 'db' with its expire and the expires
+ * of its fields, unless the key is already expired. The function takes
+ * ownership of 'val' and 'hfe', and releases the reference to 'key'. */
+static void rdbLoadStoreKey(redisDb *db, robj *key, robj *val,
+                            long long expiretime, hashFieldExpires *hfe,
+                            long long now)
+{
+    /* Check if the key already expired. This function is used when loading
+     * an RDB file from disk, either at startup, or when an RDB was
+     * received from the master. In the latter case, the master is
+     * responsible for key expiry. If we would expire keys here, the
+     * snapshot taken by the master may not be reflected on the slave. */
+    if (server.masterhost == NULL && expiretime != -1 && expiretime < now) {
+        decrRefCount(key);
+        decrRefCount(val);
+        if (hfe) hashFieldExpiresRelease(hfe);
+        return;
+    }
+    /* Add the new object in the hash table */
+    dbAdd(db,key,val);
+
+    /* Set the expire time if needed */
+    if (expiretime != -1) setExpire(db,key,expiretime);
+
+    /* Set the field expires, ignoring fields missing from the hash. */
+    if (hfe) {
+        if (val->type == OBJ_HASH) rdbAttachFieldExpires(db,key,val,hfe);
+        hashFieldExpiresRelease(hfe);
+    }
+
+    decrRefCount(key);
+}
+
+/* -----------------------------------------------------------------------------
+ * Multi threaded loading
+ *
+ * When rdb-load-threads is not zero, rdbLoad() still reads the file on the
+ * main thread, so that the checksum, the loading progress and the events
+ * processing work exactly as usual, but the value of every key is just
+ * copied verbatim into a payload buffer. A pool of loading threads decodes
+ * the payloads into objects, that is where most of the loading time goes
+ * (LZF decompression, dict and skiplist construction, ...).
+ *
+ * Keys are dispatched in batches: while the threads decode a batch the main
+ * thread reads the next one, then it adds the keys of the decoded batch to
+ * the keyspace in the same order they appear in the file.
+ * -------------------------------------------------------------------------- */
+
+#define RDB_LOAD_BATCH_KEYS 1024              /* Max keys per batch. */
+#define RDB_LOAD_BATCH_BYTES (1024*1024*4)    /* Max payload bytes per batch. */
+#define RDB_LOAD_JOBS_PER_GRAB 16 /* Jobs a thread takes at every access. */
+
+typedef struct rdbLoadJob {
+    redisDb *db;
+    robj *key;
+    int type;                   /* RDB type of the value. */
+    sds payload;                /* Serialized value, NULL once decoded. */
+    robj *val;                  /* Decoded value, NULL on error. */
+    long long expiretime;
+    hashFieldExpires *hfe;
+} rdbLoadJob;
+
+typedef struct rdbLoadBatch {
+    rdbLoadJob jobs[RDB_LOAD_BATCH_KEYS];
+    int count;                  /* Number of jobs in the batch. */
+    size_t bytes;               /* Payload bytes in the batch. */
+} rdbLoadBatch;
+
+static struct {
+    pthread_t threads[CONFIG_MAX_RDB_LOAD_THREADS];
+    int numthreads;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;   /* Signaled when a batch is submitted. */
+    pthread_cond_t done_cond;   /* Signaled when a batch is fully decoded. */
+    rdbLoadBatch *batch;        /* Batch being decoded, or NULL. */
+    int next;                   /* Index of the next job to decode. */
+    int pending;                /* Jobs of the batch not decoded yet. */
+    int shutdown;               /* Threads should exit ASAP. */
+} rdbLoaders = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work_cond = PTHREAD_COND_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER
+};
+
+/* Append 'len' bytes read from 'rdb' to the payload '*p'.
+ * Returns -1 on short read. */
+static int rdbCopyRaw(rio *rdb, sds *p, size_t len) {
+    size_t oldlen = sdslen(*p);
+
+    *p = sdsMakeRoomFor(*p,len);
+    if (len && rioRead(rdb,*p+oldlen,len) == 0) return -1;
+    sdsIncrLen(*p,len);
+    return 0;
+}
+
+/* Like rdbLoadLen(), but the length is also appended verbatim to '*p'. */
+static uint32_t rdbCopyLen(rio *rdb, sds *p, int *isencoded) {
+    size_t start = sdslen(*p);
+    unsigned char *buf;
+    uint32_t len;
+    int type;
+
+    if (isencoded) *isencoded = 0;
+    if (rdbCopyRaw(rdb,p,1) == -1) return RDB_LENERR;
+    buf = (unsigned char*)*p+start;
+    type = (buf[0]&0xC0)>>6;
+    if (type == RDB_ENCVAL) {
+        if (isencoded) *isencoded = 1;
+        return buf[0]&0x3F;
+    } else if (type == RDB_6BITLEN) {
+        return buf[0]&0x3F;
+    } else if (type == RDB_14BITLEN) {
+        if (rdbCopyRaw(rdb,p,1) == -1) return RDB_LENERR;
+        buf = (unsigned char*)*p+start;
+        return ((buf[0]&0x3F)<<8)|buf[1];
+    } else {
+        if (rdbCopyRaw(rdb,p,4) == -1) return RDB_LENERR;
+        memcpy(&len,*p+start+1,4);
+        return ntohl(len);
+    }
+}
+
+/* Copy a string saved by rdbSaveRawString() or rdbSaveStringObject(). */
+static int rdbCopyString(rio *rdb, sds *p) {
+    int isencoded;
+    uint32_t len, clen;
+
+    if ((len = rdbCopyLen(rdb,p,&isencoded)) == RDB_LENERR) return -1;
+    if (isencoded) {
+        switch(len) {
+        case RDB_ENC_INT8: return rdbCopyRaw(rdb,p,1);
+        case RDB_ENC_INT16: return rdbCopyRaw(rdb,p,2);
+        case RDB_ENC_INT32: return rdbCopyRaw(rdb,p,4);
+        case RDB_ENC_LZF:
+        case RDB_ENC_LZ4:
+            if ((clen = rdbCopyLen(rdb,p,NULL)) == RDB_LENERR) return -1;
+            if (rdbCopyLen(rdb,p,NULL) == RDB_LENERR) return -1;
+            return rdbCopyRaw(rdb,p,clen);
+        default:
+            rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
+        }
+    }
+    return rdbCopyRaw(rdb,p,len);
+}
+
+/* Copy a double saved by rdbSaveDoubleValue(). */
+static int rdbCopyDouble(rio *rdb, sds *p) {
+    unsigned char len;
+
+    if (rdbCopyRaw(rdb,p,1) == -1) return -1;
+    len = (*p)[sdslen(*p)-1];
+    if (len >= 253) return 0; /* Infinities and NaN have no payload. */
+    return rdbCopyRaw(rdb,p,len);
+}
+
+/* Return true if values of the specified type can be copied by
+ * rdbCopyObject() and decoded later by a loading thread. The others
+ * are decoded by the main thread while reading. */
+static int rdbTypeIsCopyable(int rdbtype) {
+    return rdbIsObjectType(rdbtype) && rdbtype != RDB_TYPE_STREAM_ZIPLISTS;
+}
+
+/* Append to '*p' the serialized value of type 'rdbtype' exactly as found
+ * in the file, so that rdbLoadObject() can decode it from the payload.
+ * Returns -1 on short read. */
+static int rdbCopyObject(int rdbtype, rio *rdb, sds *p) {
+    uint32_t len, j;
+
+    switch(rdbtype) {
+    case RDB_TYPE_LIST:
+    case RDB_TYPE_SET:
+    case RDB_TYPE_ZSET:
+    case RDB_TYPE_HASH:
+    case RDB_TYPE_LIST_QUICKLIST:
+        if ((len = rdbCopyLen(rdb,p,NULL)) == RDB_LENERR) return -1;
+        for (j = 0; j < len; j++) {
+            if (rdbCopyString(rdb,p) == -1) return -1;
+            if (rdbtype == RDB_TYPE_HASH && rdbCopyString(rdb,p) == -1)
+                return -1;
+            if (rdbtype == RDB_TYPE_ZSET && rdbCopyDouble(rdb,p) == -1)
+                return -1;
+        }
+        return 0;
+    default:
+        /* Every other type is serialized as a single string. */
+        return rdbCopyString(rdb,p);
+    }
+}
+
+/* Release a job whose key was not stored. */
+static void rdbLoadJobRelease(rdbLoadJob *job) {
+    decrRefCount(job->key);
+    if (job->payload) sdsfree(job->payload);
+    if (job->val) decrRefCount(job->val);
+    if (job->hfe) hashFieldExpiresRelease(job->hfe);
+}
+
+static void rdbLoadDecodeJob(rdbLoadJob *job) {
+    rio payload;
+
+    if (job->payload == NULL) return; /* Decoded by the main thread. */
+    rioInitWithBuffer(&payload,job->payload);
+    job->val = rdbLoadObject(job->type,&payload);
+    sdsfree(job->payload);
+    job->payload = NULL;
+}
+
+static void *rdbLoaderThreadMain(void *arg) {
+    sigset_t sigset;
+    UNUSED(arg);
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in RDB loading thread: %s",
+            strerror(errno));
+
+    pthread_mutex_lock(&rdbLoaders.mutex);
+    while(1) {
+        rdbLoadBatch *b = rdbLoaders.batch;
+        int first, last, j;
+
+        if (rdbLoaders.shutdown) break;
+        if (b == NULL || rdbLoaders.next == b->count) {
+            pthread_cond_wait(&rdbLoaders.work_cond,&rdbLoaders.mutex);
+            continue;
+        }
+        first = rdbLoaders.next;
+        last = first+RDB_LOAD_JOBS_PER_GRAB;
+        if (last > b->count) last = b->count;
+        rdbLoaders.next = last;
+        pthread_mutex_unlock(&rdbLoaders.mutex);
+
+        for (j = first; j < last; j++) rdbLoadDecodeJob(b->jobs+j);
+
+        pthread_mutex_lock(&rdbLoaders.mutex);
+        rdbLoaders.pending -= last-first;
+        if (rdbLoaders.pending == 0)
+            pthread_cond_signal(&rdbLoaders.done_cond);
+    }
+    pthread_mutex_unlock(&rdbLoaders.mutex);
+    return NULL;
+}
+
+/* Start up to 'count' loading threads. Returns the number of threads
+ * actually started. */
+static int rdbLoadersStart(int count) {
+    int j, rc;
+
+    rdbLoaders.batch = NULL;
+    rdbLoaders.shutdown = 0;
+    for (j = 0; j < count; j++) {
+        if ((rc = pthread_create(&rdbLoaders.threads[j],NULL,
+                                 rdbLoaderThreadMain,NULL)) != 0)
+        {
+            serverLog(LL_WARNING,
+                "Can't create RDB loading thread: %s", strerror(rc));
+            break;
+        }
+    }
+    rdbLoaders.numthreads = j;
+    return j;
+}
+
+static void rdbLoadersStop(void) {
+    int j;
+
+    pthread_mutex_lock(&rdbLoaders.mutex);
+    rdbLoaders.shutdown = 1;
+    pthread_cond_broadcast(&rdbLoaders.work_cond);
+    pthread_mutex_unlock(&rdbLoaders.mutex);
+    for (j = 0; j < rdbLoaders.numthreads; j++)
+        pthread_join(rdbLoaders.threads[j],NULL);
+    rdbLoaders.numthreads = 0;
+}
+
+/* Wait for the batch being decoded, if any, and store its keys.
+ * Returns C_ERR if some value could not be decoded. */
+static int rdbLoadersCollect(rdbLoadBatch *b, long long now) {
+    int j, retval = C_OK;
+
+    pthread_mutex_lock(&rdbLoaders.mutex);
+    while (rdbLoaders.pending)
+        pthread_cond_wait(&rdbLoaders.done_cond,&rdbLoaders.mutex);
+    rdbLoaders.batch = NULL;
+    pthread_mutex_unlock(&rdbLoaders.mutex);
+
+    for (j = 0; j < b->count; j++) {
+        rdbLoadJob *job = b->jobs+j;
+
+        if (job->val == NULL) {
+            retval = C_ERR;
+            break;
+        }
+        rdbLoadStoreKey(job->db,job->key,job->val,job->expiretime,
+                        job->hfe,now);
+    }
+    for (; j < b->count; j++) rdbLoadJobRelease(b->jobs+j);
+    b->count = 0;
+    b->bytes = 0;
+    return retval;
+}
+
+/* Drop the batches of a load interrupted by an error, after the threads
+ * are done with the batch being decoded, and stop the threads. */
+static void rdbLoadersDiscard(rdbLoadBatch *filling, rdbLoadBatch *decoding) {
+    int j;
+
+    pthread_mutex_lock(&rdbLoaders.mutex);
+    while (rdbLoaders.pending)
+        pthread_cond_wait(&rdbLoaders.done_cond,&rdbLoaders.mutex);
+    rdbLoaders.batch = NULL;
+    pthread_mutex_unlock(&rdbLoaders.mutex);
+    rdbLoadersStop();
+
+    for (j = 0; j < filling->count; j++) rdbLoadJobRelease(filling->jobs+j);
+    for (j = 0; j < decoding->count; j++) rdbLoadJobRelease(decoding->jobs+j);
+    zfree(filling);
+    zfree(decoding);
+}
+
+/* Store the keys of the batch being decoded, then submit the batch that
+ * was just filled to the loading threads: the two batches are swapped. */
+static int rdbLoadersCycle(rdbLoadBatch **filling, rdbLoadBatch **decoding,
+                           long long now)
+{
+    rdbLoadBatch *b = *decoding;
+
+    if (rdbLoadersCollect(b,now) == C_ERR) return C_ERR;
+    *decoding = *filling;
+    *filling = b;
+
+    pthread_mutex_lock(&rdbLoaders.mutex);
+    rdbLoaders.batch = *decoding;
+    rdbLoaders.next = 0;
+    rdbLoaders.pending = (*decoding)->count;
+    pthread_cond_broadcast(&rdbLoaders.work_cond);
+    pthread_mutex_unlock(&rdbLoaders.mutex);
+    return C_OK;
+}
+
+/* Read the value of the key 'key' and queue it in the batch being filled.
+ * The batches are cycled when the batch is full. */
+static int rdbLoadQueueKey(rio *rdb, rdbLoadBatch **filling,
+                           rdbLoadBatch **decoding, redisDb *db, robj *key,
+                           int type, long long expiretime,
+                           hashFieldExpires *hfe, long long now)
+{
+    rdbLoadJob *job = (*filling)->jobs+(*filling)->count++;
+
+    job->db = db;
+    job->key = key;
+    job->type = type;
+    job->expiretime = expiretime;
+    job->hfe = hfe;
+    job->payload = NULL;
+    job->val = NULL;
+    if (rdbTypeIsCopyable(type)) {
+        job->payload = sdsempty();
+        if (rdbCopyObject(type,rdb,&job->payload) == -1) return -1;
+        (*filling)->bytes += sdslen(job->payload);
+    } else {
+        if ((job->val = rdbLoadObject(type,rdb)) == NULL) return -1;
+    }
+
+    if ((*filling)->count == RDB_LOAD_BATCH_KEYS ||
+        (*filling)->bytes >= RDB_LOAD_BATCH_BYTES)
+    {
+        if (rdbLoadersCycle(filling,decoding,now) == C_ERR) return -1;
+    }
+    return 0;
+}
+
+/* Load the RDB payload read from 'rdb' into the DBs 'dbarray', that is
+ * server.db unless a replica loads the dataset of its master aside.
+ *
+ * With RDB_LOAD_DELTA in 'flags' the payload is a delta (see delta.c)
+ * applied on top of the current dataset: it must follow the last file
+ * loaded or saved, otherwise C_ERR is returned before changing anything.
+ * With RDB_LOAD_SOCKET the payload is read from the master: a short read
+ * or a checksum mismatch returns C_ERR, leaving in the DBs the keys loaded
+ * so far, instead of being fatal. */
+int rdbLoadRio(rio *rdb, redisDb *dbarray, int flags) {
     uint32_t dbid;
-    int type, rdbver;
-    redisDb *db = server.db+0;
+    int type, rdbver, chained = 0;
+    int isdelta = flags & RDB_LOAD_DELTA;
+    redisDb *db = dbarray+0;
     char buf[1024];
+    char snapshot_id[CONFIG_RUN_ID_SIZE+1] = "";
     long long expiretime, now = mstime();
-    FILE *fp;
-    rio rdb;
-
-    if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
+    hashFieldExpires *hfe = NULL; /* Field expires of the next key. */
+    rdbLoadBatch *filling = NULL, *decoding = NULL;
 
-    rioInitWithFile(&rdb,fp);
-    rdb.update_cksum = rdbLoadProgressCallback;
-    rdb.max_processing_chunk = server.loading_process_events_interval_bytes;
-    if (rioRead(&rdb,buf,9) == 0) goto eoferr;
+    rdb->update_cksum = rdbLoadProgressCallback;
+    rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
+    if (rioRead(rdb,buf,9) == 0) goto eoferr;
     buf[9] = '\0';
     if (memcmp(buf,"REDIS",5) != 0) {
-        fclose(fp);
         serverLog(LL_WARNING,"Wrong signature trying to load DB from file");
         errno = EINVAL;
         return C_ERR;
     }
     rdbver = atoi(buf+5);
     if (rdbver < 1 || rdbver > RDB_VERSION) {
-        fclose(fp);
         serverLog(LL_WARNING,"Can't handle RDB format version %d",rdbver);
         errno = EINVAL;
         return C_ERR;
     }
 
-    startLoading(fp);
+    if (!isdelta && server.rdb_load_threads &&
+        rdbLoadersStart(server.rdb_load_threads) > 0)
+    {
+        filling = zcalloc(sizeof(*filling));
+        decoding = zcalloc(sizeof(*decoding));
+    }
     while(1) {
         robj *key, *val;
         expiretime = -1;
 
         /* Read type. */
-        if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
 
         /* Handle special types. */
         if (type == RDB_OPCODE_EXPIRETIME) {
             /* EXPIRETIME: load an expire associated with the next key
              * to load. Note that after loading an expire we need to
              * load the actual type, and continue. */
-            if ((expiretime = rdbLoadTime(&rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadTime(rdb)) == -1) goto eoferr;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
             /* the EXPIRETIME opcode specifies time in seconds, so convert
              * into milliseconds. */
             expiretime *= 1000;
         } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
             /* EXPIRETIME_MS: milliseconds precision expire times introduced
              * with RDB v3. Like EXPIRETIME but no with more precision. */
-            if ((expiretime = rdbLoadMillisecondTime(&rdb)) == -1) goto eoferr;
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1) goto eoferr;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+            if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+        } else if (type == RDB_OPCODE_FIELD_EXPIRES) {
+            /* FIELD_EXPIRES: expire times of the fields of the hash that
+             * follows. It precedes the key expire, if any. */
+            if (hfe) hashFieldExpiresRelease(hfe);
+            if ((hfe = rdbLoadFieldExpires(rdb)) == NULL) goto eoferr;
+            continue; /* Read type again. */
         } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
             break;
+        } else if (isdelta && !chained && type != RDB_OPCODE_AUX) {
+            /* The data of a delta comes after its "delta-base" field. */
+            goto chainerr;
         } else if (type == RDB_OPCODE_SELECTDB) {
             /* SELECTDB: Select the specified database. */
-            if ((dbid = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+            if ((dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
             if (dbid >= (unsigned)server.dbnum) {
                 serverLog(LL_WARNING,
@@ -1342,15 +2261,15 @@ int rdbLoad(char *filename) {
                     "databases. Exiting\n", server.dbnum);
                 exit(1);
             }
-            db = server.db+dbid;
+            db = dbarray+dbid;
             continue; /* Read type again. */
         } else if (type == RDB_OPCODE_RESIZEDB) {
             /* RESIZEDB: Hint about the size of the keys in the currently
              * selected data base, in order to avoid useless rehashing. */
             uint32_t db_size, expires_size;
-            if ((db_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+            if ((db_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
-            if ((expires_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
+            if ((expires_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
             dictExpand(db->dict,db_size);
             dictExpand(db->expires,expires_size);
@@ -1362,10 +2281,22 @@ int rdbLoad(char *filename) {
              *
              * An AUX field is composed of two strings: key and value. */
             robj *auxkey, *auxval;
-            if ((auxkey = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-            if ((auxval = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
+            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            if ((auxval = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
 
-            if (((char*)auxkey->ptr)[0] == '%') {
+            if (!strcasecmp(auxkey->ptr,"snapshot-id")) {
+                snprintf(snapshot_id,sizeof(snapshot_id),"%s",
+                    (char*)auxval->ptr);
+            } else if (!strcasecmp(auxkey->ptr,"delta-base")) {
+                if (isdelta) {
+                    chained = !strcmp(auxval->ptr,server.rdb_snapshot_id);
+                    if (!chained) {
+                        decrRefCount(auxkey);
+                        decrRefCount(auxval);
+                        goto chainerr;
+                    }
+                }
+            } else if (((char*)auxkey->ptr)[0] == '%') {
                 /* All the fields with a name staring with '%' are considered
                  * information fields and are logged at startup with a log
                  * level of NOTICE. */
@@ -1382,54 +2313,124 @@ int rdbLoad(char *filename) {
             decrRefCount(auxkey);
             decrRefCount(auxval);
             continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_DELKEY) {
+            /* DELKEY: a delta removes the key that follows. */
+            if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            dbDelete(db,key);
+            decrRefCount(key);
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_FLUSHDB) {
+            /* FLUSHDB: a delta empties the selected DB. */
+            dictEmpty(db->hexpires,NULL);
+            dictEmpty(db->dict,NULL);
+            dictEmpty(db->expires,NULL);
+            continue; /* Read type again. */
         }
 
         /* Read key */
-        if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-        /* Read value */
-        if ((val = rdbLoadObject(type,&rdb)) == NULL) goto eoferr;
-        /* Check if the key already expired. This function is used when loading
-         * an RDB file from disk, either at startup, or when an RDB was
-         * received from the master. In the latter case, the master is
-         * responsible for key expiry. If we would expire keys here, the
-         * snapshot taken by the master may not be reflected on the slave. */
-        if (server.masterhost == NULL && expiretime != -1 && expiretime < now) {
-            decrRefCount(key);
-            decrRefCount(val);
+        if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+        /* A delta replaces the value of the keys already loaded. */
+        if (isdelta) dbDelete(db,key);
+
+        /* Leave the value to the loading threads if we have them. */
+        if (filling) {
+            if (rdbLoadQueueKey(rdb,&filling,&decoding,db,key,type,
+                                expiretime,hfe,now) == -1) goto eoferr;
+            hfe = NULL;
             continue;
         }
-        /* Add the new object in the hash table */
-        dbAdd(db,key,val);
 
-        /* Set the expire time if needed */
-        if (expiretime != -1) setExpire(db,key,expiretime);
+        /* Read value */
+        if ((val = rdbLoadObject(type,rdb)) == NULL) {
+            decrRefCount(key);
+            goto eoferr;
+        }
+        rdbLoadStoreKey(db,key,val,expiretime,hfe,now);
+        hfe = NULL;
+    }
 
-        decrRefCount(key);
+    /* Store the keys still in flight. */
+    if (filling) {
+        if (rdbLoadersCycle(&filling,&decoding,now) == C_ERR ||
+            rdbLoadersCollect(decoding,now) == C_ERR) goto eoferr;
+        rdbLoadersStop();
+        zfree(filling);
+        zfree(decoding);
+        filling = decoding = NULL;
     }
     /* Verify the checksum if RDB version is >= 5 */
-    if (rdbver >= 5 && server.rdb_checksum) {
-        uint64_t cksum, expected = rdb.cksum;
+    if (rdbver >= 5 &&
+        (server.rdb_checksum || (flags & (RDB_LOAD_SOCKET|RDB_LOAD_AOF))))
+    {
+        uint64_t cksum, expected = rdb->cksum;
 
-        if (rioRead(&rdb,&cksum,8) == 0) goto eoferr;
+        /* From a socket or an AOF the checksum is always consumed, so that
+         * the end of the payload can be verified, or the AOF tail read. */
+        if (rioRead(rdb,&cksum,8) == 0) goto eoferr;
         memrev64ifbe(&cksum);
-        if (cksum == 0) {
+        if (!server.rdb_checksum) {
+            /* Not checked. */
+        } else if (cksum == 0) {
             serverLog(LL_WARNING,"RDB file was saved with checksum disabled: no check performed.");
         } else if (cksum != expected) {
+            if (flags & RDB_LOAD_SOCKET) {
+                serverLog(LL_WARNING,"Wrong RDB checksum.");
+                return C_ERR;
+            }
             serverLog(LL_WARNING,"Wrong RDB checksum. Aborting now.");
             rdbExitReportCorruptRDB("RDB CRC error");
         }
     }
 
-    fclose(fp);
-    stopLoading();
+    /* The RDB preamble of an AOF is not the base of the RDB deltas. */
+    if (snapshot_id[0] != '\0' && !(flags & RDB_LOAD_AOF))
+        memcpy(server.rdb_snapshot_id,snapshot_id,sizeof(snapshot_id));
     return C_OK;
 
+chainerr: /* a delta not following the current dataset is not loaded */
+    if (hfe) hashFieldExpiresRelease(hfe);
+    errno = EINVAL;
+    return C_ERR;
+
 eoferr: /* unexpected end of file is handled here with a fatal exit */
+    if (flags & RDB_LOAD_SOCKET) {
+        /* The master link failed: the caller retries the sync. */
+        if (filling) rdbLoadersDiscard(filling,decoding);
+        if (hfe) hashFieldExpiresRelease(hfe);
+        serverLog(LL_WARNING,"Short read or corrupted payload loading the "
+                             "DB from the master: %s",strerror(errno));
+        return C_ERR;
+    }
     serverLog(LL_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
     rdbExitReportCorruptRDB("Unexpected EOF reading RDB file");
     return C_ERR; /* Just to avoid warning */
 }
 
+/* Load the RDB file 'filename' into memory. When 'isdelta' is true the
+ * file is a delta applied on top of the current dataset, see rdbLoadRio(). */
+static int rdbLoadFile(char *filename, int isdelta) {
+    FILE *fp;
+    rio rdb;
+    int retval;
+
+    if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
+    rioInitWithFile(&rdb,fp);
+    startLoading(fp);
+    retval = rdbLoadRio(&rdb,server.db,isdelta ? RDB_LOAD_DELTA : 0);
+    fclose(fp);
+    stopLoading();
+    return retval;
+}
+
+int rdbLoad(char *filename) {
+    return rdbLoadFile(filename,0);
+}
+
+/* Apply the RDB delta 'filename' on top of the current dataset. */
+int rdbLoadDelta(char *filename) {
+    return rdbLoadFile(filename,1);
+}
+
 /* A background saving child (BGSAVE) terminated its work. Handle this.
  * This function covers the case of actual BGSAVEs. */
 void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
@@ -1456,6 +2457,7 @@ void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
         if (bysignal != SIGUSR1)
             server.lastbgsave_status = C_ERR;
     }
+    rdbDeltaSaveDone(!bysignal && exitcode == 0,0);
     server.rdb_child_pid = -1;
     server.rdb_child_type = RDB_CHILD_TYPE_NONE;
     server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
@@ -1569,6 +2571,9 @@ void backgroundSaveDoneHandler(int exitcode, int bysignal) {
     case RDB_CHILD_TYPE_SOCKET:
         backgroundSaveDoneHandlerSocket(exitcode,bysignal);
         break;
+    case RDB_CHILD_TYPE_DELTA:
+        backgroundDeltaDoneHandler(exitcode,bysignal);
+        break;
     default:
         serverPanic("Unknown RDB child type.");
         break;
@@ -1587,7 +2592,7 @@ int rdbSaveToSlavesSockets(void) {
     long long start;
     int pipefds[2];
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) return C_ERR;
 
     /* Before to fork, create a pipe that will be used in order to
      * send back to the parent the IDs of the slaves that successfully
@@ -1622,12 +2627,14 @@ int rdbSaveToSlavesSockets(void) {
     }
 
     /* Create the child process. */
+    openChildInfoPipe(CHILD_INFO_TYPE_RDB);
     start = ustime();
     if ((childpid = fork()) == 0) {
         /* Child */
         int retval;
         rio slave_sockets;
 
+        server.in_fork_child = 1;
         rioInitWithFdset(&slave_sockets,fds,numfds);
         zfree(fds);
 
@@ -1639,7 +2646,7 @@ int rdbSaveToSlavesSockets(void) {
             retval = C_ERR;
 
         if (retval == C_OK) {
-            size_t private_dirty = zmalloc_get_private_dirty();
+            size_t private_dirty = sendChildInfo(1);
 
             if (private_dirty) {
                 serverLog(LL_NOTICE,
@@ -1712,6 +2719,7 @@ int rdbSaveToSlavesSockets(void) {
             }
             close(pipefds[0]);
             close(pipefds[1]);
+            closeChildInfoPipe();
         } else {
             server.stat_fork_time = ustime()-start;
             server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
@@ -1732,7 +2740,7 @@ int rdbSaveToSlavesSockets(void) {
 }
 
 void saveCommand(client *c) {
-    if (server.rdb_child_pid != -1) {
+    if (rdbBgsaveInProgress()) {
         addReplyError(c,"Background save already in progress");
         return;
     }
@@ -1743,22 +2751,31 @@ void saveCommand(client *c) {
     }
 }
 
-/* BGSAVE [SCHEDULE] */
+/* BGSAVE [SCHEDULE|FORKLESS] */
 void bgsaveCommand(client *c) {
-    int schedule = 0;
+    int schedule = 0, forkless = 0, delta = 0;
 
     /* The SCHEDULE option changes the behavior of BGSAVE when an AOF rewrite
-     * is in progress. Instead of returning an error a BGSAVE gets scheduled. */
+     * is in progress. Instead of returning an error a BGSAVE gets scheduled.
+     * The FORKLESS option saves from a thread instead of a child process,
+     * see snapshot.c. The DELTA option saves only the changes since the
+     * last save, see delta.c. */
     if (c->argc > 1) {
         if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"schedule")) {
             schedule = 1;
+        } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"forkless")) {
+            forkless = 1;
+        } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"delta")) {
+            delta = 1;
         } else {
             addReply(c,shared.syntaxerr);
             return;
         }
     }
 
-    if (server.rdb_child_pid != -1) {
+    if (delta && !server.rdb_delta) {
+        addReplyError(c,"Delta saving requires rdb-delta to be enabled");
+    } else if (rdbBgsaveInProgress()) {
         addReplyError(c,"Background save already in progress");
     } else if (server.aof_child_pid != -1) {
         if (schedule) {
@@ -1770,6 +2787,19 @@ void bgsaveCommand(client *c) {
                 "Use BGSAVE SCHEDULE in order to schedule a BGSAVE whenver "
                 "possible.");
         }
+    } else if (forkless) {
+        if (rdbSaveBackgroundForkless(server.rdb_filename) == C_OK)
+            addReplyStatus(c,"Background forkless saving started");
+        else
+            addReply(c,shared.err);
+    } else if (delta) {
+        int full = !rdbDeltaCanSave();
+
+        if (rdbSaveDeltaBackground() == C_OK)
+            addReplyStatus(c,full ? "Background saving started" :
+                                    "Background delta saving started");
+        else
+            addReply(c,shared.err);
     } else if (rdbSaveBackground(server.rdb_filename) == C_OK) {
         addReplyStatus(c,"Background saving started");
     } else {
@@ -37,8 +37,13 @@
 #include "server.h"
 
 /* The current RDB version. When the format changes in a way that is no longer
- * backward compatible this number gets incremented. */
-#define RDB_VERSION 7
+ * backward compatible this number gets incremented.
+ *
+ * Version 8 adds the roaring, stream, Bloom, cuckoo, count-min, top-k and
+ * time series types, the LZ4 string encoding, the field expires and the
+ * opcodes of the deltas. Older servers refuse these files upfront instead
+ * of failing in the middle of the load. */
+#define RDB_VERSION 8
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -66,6 +71,7 @@
 #define RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define RDB_ENC_LZ4 4         /* string compressed with LZ4 */
 
 /* Dup object types to RDB object types. Only reason is readability (are we
  * dealing with RDB types or with in-memory object types?). */
@@ -83,12 +89,35 @@
 #define RDB_TYPE_ZSET_ZIPLIST  12
 #define RDB_TYPE_HASH_ZIPLIST  13
 #define RDB_TYPE_LIST_QUICKLIST 14
+/* The types below are numbered from 64, so that they don't clash with the
+ * types added by the next versions of Redis. */
+#define RDB_TYPE_STRING_ROARING 64
+#define RDB_TYPE_STREAM_ZIPLISTS 65
+#define RDB_TYPE_BLOOM 66
+#define RDB_TYPE_CUCKOO 67
+#define RDB_TYPE_CMS 68
+#define RDB_TYPE_TOPK 69
+#define RDB_TYPE_TIMESERIES 70
 /* NOTE: WHEN ADDING NEW RDB TYPE, UPDATE rdbIsObjectType() BELOW */
 
 /* Test if a type is an object type. */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 14))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 14) || \
+                            (t >= 64 && t <= 70))
+
+/* Flags of rdbLoadRio(). */
+#define RDB_LOAD_DELTA (1<<0)   /* The payload is a delta, see delta.c. */
+#define RDB_LOAD_SOCKET (1<<1)  /* The payload is read from the master. */
+#define RDB_LOAD_AOF (1<<2)     /* The payload is the preamble of an AOF. */
+
+#define RDB_SAVE_NONE 0
+#define RDB_SAVE_AOF_PREAMBLE (1<<0) /* The payload is the preamble of an AOF. */
 
-/* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
+/* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType).
+ * FLUSHDB, DELKEY and FIELD_EXPIRES are numbered away from the opcodes the
+ * next versions of Redis allocate downwards from 249. */
+#define RDB_OPCODE_FLUSHDB    230
+#define RDB_OPCODE_DELKEY     231
+#define RDB_OPCODE_FIELD_EXPIRES 232
 #define RDB_OPCODE_AUX        250
 #define RDB_OPCODE_RESIZEDB   251
 #define RDB_OPCODE_EXPIRETIME_MS 252
@@ -105,15 +134,49 @@ uint32_t rdbLoadLen(rio *rdb, int *isencoded);
 int rdbSaveObjectType(rio *rdb, robj *o);
 int rdbLoadObjectType(rio *rdb);
 int rdbLoad(char *filename);
+int rdbLoadRio(rio *rdb, redisDb *dbarray, int flags);
 int rdbSaveBackground(char *filename);
 int rdbSaveToSlavesSockets(void);
 void rdbRemoveTempFile(pid_t childpid);
 int rdbSave(char *filename);
+int rdbSaveRio(rio *rdb, int *error, int flags);
 ssize_t rdbSaveObject(rio *rdb, robj *o);
 size_t rdbSavedObjectLen(robj *o);
 robj *rdbLoadObject(int type, rio *rdb);
 void backgroundSaveDoneHandler(int exitcode, int bysignal);
-int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime, long long now);
+int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime, hashFieldExpires *hfe, long long now);
+int rdbSaveFieldExpires(rio *rdb, hashFieldExpires *hfe);
+int rdbSaveInfoAuxFields(rio *rdb, int flags);
+int rdbSaveAuxFieldStrStr(rio *rdb, char *key, char *val);
+int rdbSaveAuxFieldStrInt(rio *rdb, char *key, long long val);
+ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len);
+int rdbSaveDelta(char *filename);
+int rdbLoadDelta(char *filename);
+hashFieldExpires *rdbLoadFieldExpires(rio *rdb);
 robj *rdbLoadStringObject(rio *rdb);
 
+/* Forkless BGSAVE (snapshot.c) */
+int rdbSaveBackgroundForkless(char *filename);
+int rdbBgsaveInProgress(void);
+void rdbSnapshotTouchKey(redisDb *db, robj *key, int write);
+void rdbSnapshotKeyAdded(redisDb *db, robj *key);
+int rdbSnapshotDetachDb(redisDb *db);
+void rdbSnapshotWait(void);
+void rdbSnapshotAbort(void);
+
+/* Incremental (delta) RDB snapshots (delta.c) */
+void rdbDeltaTrackKey(redisDb *db, robj *key);
+void rdbDeltaTrackFlush(int dbid);
+unsigned long long rdbDeltaTrackedKeys(void);
+void rdbDeltaReset(void);
+void rdbDeltaInvalidate(void);
+int rdbDeltaCanSave(void);
+void rdbDeltaSaveStart(void);
+void rdbDeltaSaveDone(int ok, int isdelta);
+void rdbDeltaFilename(char *buf, size_t len, char *filename, int seq);
+int rdbSaveDeltaRio(rio *rdb, int *error);
+int rdbSaveDeltaBackground(void);
+void backgroundDeltaDoneHandler(int exitcode, int bysignal);
+int rdbLoadDeltas(char *filename);
+
 #endif
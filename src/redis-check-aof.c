@@ -28,13 +28,8 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "fmacros.h"
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include <unistd.h>
+#include "server.h"
 #include <sys/stat.h>
-#include "config.h"
 
 #define ERROR(...) { \
     char __buf[1024]; \
@@ -45,7 +40,7 @@
 static char error[1024];
 static off_t epos;
 
-int consumeNewline(char *buf) {
+static int consumeNewline(char *buf) {
     if (strncmp(buf,"\r\n",2) != 0) {
         ERROR("Expected \\r\\n, got: %02x%02x",buf[0],buf[1]);
         return 0;
@@ -53,7 +48,7 @@ int consumeNewline(char *buf) {
     return 1;
 }
 
-int readLong(FILE *fp, char prefix, long *target) {
+static int readLong(FILE *fp, char prefix, long *target) {
     char buf[128], *eptr;
     epos = ftello(fp);
     if (fgets(buf,sizeof(buf),fp) == NULL) {
@@ -67,7 +62,7 @@ int readLong(FILE *fp, char prefix, long *target) {
     return consumeNewline(eptr);
 }
 
-int readBytes(FILE *fp, char *target, long length) {
+static int readBytes(FILE *fp, char *target, long length) {
     long real;
     epos = ftello(fp);
     real = fread(target,1,length,fp);
@@ -78,7 +73,7 @@ int readBytes(FILE *fp, char *target, long length) {
     return 1;
 }
 
-int readString(FILE *fp, char** target) {
+static int readString(FILE *fp, char** target) {
     long len;
     *target = NULL;
     if (!readLong(fp,'$',&len)) {
@@ -87,7 +82,7 @@ int readString(FILE *fp, char** target) {
 
     /* Increase length to also consume \r\n */
     len += 2;
-    *target = (char*)malloc(len);
+    *target = (char*)zmalloc(len);
     if (!readBytes(fp,*target,len)) {
         return 0;
     }
@@ -98,11 +93,11 @@ int readString(FILE *fp, char** target) {
     return 1;
 }
 
-int readArgc(FILE *fp, long *target) {
+static int readArgc(FILE *fp, long *target) {
     return readLong(fp,'*',target);
 }
 
-off_t process(FILE *fp) {
+static off_t process(FILE *fp) {
     long argc;
     off_t pos = 0;
     int i, multi = 0;
@@ -127,12 +122,12 @@ off_t process(FILE *fp) {
                     }
                 }
             }
-            free(str);
+            zfree(str);
         }
 
         /* Stop if the loop did not finish */
         if (i < argc) {
-            if (str) free(str);
+            if (str) zfree(str);
             break;
         }
     }
@@ -146,27 +141,11 @@ off_t process(FILE *fp) {
     return pos;
 }
 
-int main(int argc, char **argv) {
-    char *filename;
-    int fix = 0;
-
-    if (argc < 2) {
-        printf("Usage: %s [--fix] <file.aof>\n", argv[0]);
-        exit(1);
-    } else if (argc == 2) {
-        filename = argv[1];
-    } else if (argc == 3) {
-        if (strcmp(argv[1],"--fix") != 0) {
-            printf("Invalid argument: %s\n", argv[1]);
-            exit(1);
-        }
-        filename = argv[2];
-        fix = 1;
-    } else {
-        printf("Invalid arguments\n");
-        exit(1);
-    }
-
+/* Check the AOF file 'filename', and truncate it to its last valid command
+ * if 'fix' is true, asking for confirmation first. Returns 1 if the file is
+ * valid or was fixed, otherwise 0. The program exits if the file can't be
+ * read, or if it starts with a broken RDB preamble. */
+static int checkAofFile(char *filename, int fix) {
     FILE *fp = fopen(filename,"r+");
     if (fp == NULL) {
         printf("Cannot open file: %s\n", filename);
@@ -185,8 +164,28 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
+    /* The AOF may start with an RDB preamble: check it first, and then
+     * the commands of the AOF tail that follows it. */
+    if (size >= 9) {
+        char sig[5];
+        int has_preamble = fread(sig,sizeof(sig),1,fp) == 1 &&
+                           memcmp(sig,"REDIS",sizeof(sig)) == 0;
+
+        rewind(fp);
+        if (has_preamble) {
+            printf("The AOF appears to start with an RDB preamble.\n"
+                   "Checking the RDB preamble to start:\n");
+            if (redis_check_rdb_preamble(filename,fp) != 0) {
+                printf("RDB preamble of AOF file is not sane, aborting.\n");
+                exit(1);
+            }
+            printf("RDB preamble is OK, proceeding with AOF tail...\n");
+        }
+    }
+
     off_t pos = process(fp);
     off_t diff = size-pos;
+    int valid = 1;
     printf("AOF analyzed: size=%lld, ok_up_to=%lld, diff=%lld\n",
         (long long) size, (long long) pos, (long long) diff);
     if (diff > 0) {
@@ -207,12 +206,117 @@ int main(int argc, char **argv) {
             }
         } else {
             printf("AOF is not valid\n");
-            exit(1);
+            valid = 0;
         }
     } else {
         printf("AOF is valid\n");
     }
 
     fclose(fp);
-    return 0;
+    return valid;
+}
+
+/* Return true if 'filename' is the manifest of a multi part AOF, that
+ * starts with a "file" line, instead of a file of the AOF. */
+static int isAofManifest(char *filename) {
+    FILE *fp = fopen(filename,"r");
+    char buf[6];
+    int manifest;
+
+    if (fp == NULL) return 0;
+    manifest = fread(buf,sizeof(buf)-1,1,fp) == 1 &&
+               strncasecmp(buf,"file ",5) == 0;
+    fclose(fp);
+    return manifest;
+}
+
+/* Check every file listed by the AOF manifest 'filename', in the order
+ * they are loaded. The names are relative to the directory of the
+ * manifest. Only the last file may be fixed: truncating any other file
+ * would replay the following ones on top of a partial dataset. */
+static void checkAofManifest(char *filename, int fix) {
+    FILE *fp = fopen(filename,"r");
+    char buf[CONFIG_MAX_LINE+1], *slash = strrchr(filename,'/');
+    sds dir = sdsnewlen(filename,slash ? slash-filename+1 : 0);
+    list *files = listCreate();
+    int linenum = 0, valid = 1;
+    listNode *ln;
+
+    if (fp == NULL) {
+        printf("Cannot open file: %s\n", filename);
+        exit(1);
+    }
+    while(fgets(buf,sizeof(buf),fp) != NULL) {
+        sds *argv;
+        int argc;
+
+        linenum++;
+        argv = sdssplitargs(buf,&argc);
+        if (argv && argc == 0) {
+            sdsfreesplitres(argv,argc);
+            continue;
+        }
+        if (argv == NULL || argc < 2 || strcasecmp(argv[0],"file")) {
+            printf("Invalid AOF manifest %s at line %d\n", filename, linenum);
+            exit(1);
+        }
+        listAddNodeTail(files,sdscatsds(sdsdup(dir),argv[1]));
+        sdsfreesplitres(argv,argc);
+    }
+    fclose(fp);
+    printf("The file is an AOF manifest listing %lu files.\n",
+        listLength(files));
+
+    while((ln = listFirst(files)) != NULL) {
+        sds name = listNodeValue(ln);
+        int last = listLength(files) == 1;
+        struct redis_stat sb;
+
+        printf("Checking %s\n", name);
+        if (redis_stat(name,&sb) == 0 && sb.st_size == 0) {
+            printf("Empty file, skipped\n");
+        } else if (!checkAofFile(name,fix && last)) {
+            valid = 0;
+            if (fix && !last) {
+                printf("Only the last file of the AOF can be fixed: restore "
+                       "%s from a backup\n", name);
+            }
+        }
+        sdsfree(name);
+        listDelNode(files,ln);
+    }
+    listRelease(files);
+    sdsfree(dir);
+    if (!valid) exit(1);
+}
+
+/* AOF check main: called from server.c when Redis is executed with the
+ * redis-check-aof alias. */
+int redis_check_aof_main(int argc, char **argv) {
+    char *filename;
+    int fix = 0;
+
+    if (argc < 2) {
+        printf("Usage: %s [--fix] <file.aof|file.manifest>\n", argv[0]);
+        exit(1);
+    } else if (argc == 2) {
+        filename = argv[1];
+    } else if (argc == 3) {
+        if (strcmp(argv[1],"--fix") != 0) {
+            printf("Invalid argument: %s\n", argv[1]);
+            exit(1);
+        }
+        filename = argv[2];
+        fix = 1;
+    } else {
+        printf("Invalid arguments\n");
+        exit(1);
+    }
+
+    if (isAofManifest(filename)) {
+        checkAofManifest(filename,fix);
+    } else if (!checkAofFile(filename,fix)) {
+        exit(1);
+    }
+    exit(0);
 }
@@ -44,9 +44,12 @@ struct {
     unsigned long keys;             /* Number of keys processed. */
     unsigned long expires;          /* Number of keys with an expire. */
     unsigned long already_expired;  /* Number of keys already expired. */
+    unsigned long deleted;          /* Number of keys deleted by deltas. */
     int doing;                      /* The state while reading the RDB. */
     int error_set;                  /* True if error is populated. */
     char error[1024];
+    char snapshot_id[CONFIG_RUN_ID_SIZE+1]; /* "snapshot-id" AUX field. */
+    char delta_base[CONFIG_RUN_ID_SIZE+1];  /* "delta-base" AUX field. */
 } rdbstate;
 
 /* At every loading step try to remember what we were about to do, so that
@@ -85,7 +88,14 @@ char *rdb_type_string[] = {
     "set-intset",
     "zset-ziplist",
     "hash-ziplist",
-    "quicklist"
+    "quicklist",
+    [RDB_TYPE_STRING_ROARING] = "string-roaring",
+    [RDB_TYPE_STREAM_ZIPLISTS] = "stream-ziplists",
+    [RDB_TYPE_BLOOM] = "bloom",
+    [RDB_TYPE_CUCKOO] = "cuckoo",
+    [RDB_TYPE_CMS] = "cms",
+    [RDB_TYPE_TOPK] = "topk",
+    [RDB_TYPE_TIMESERIES] = "timeseries"
 };
 
 /* Show a few stats collected into 'rdbstate' */
@@ -93,6 +103,8 @@ void rdbShowGenericInfo(void) {
     printf("[info] %lu keys read\n", rdbstate.keys);
     printf("[info] %lu expires\n", rdbstate.expires);
     printf("[info] %lu already expired\n", rdbstate.already_expired);
+    if (rdbstate.deleted)
+        printf("[info] %lu deleted by deltas\n", rdbstate.deleted);
 }
 
 /* Called on RDB errors. Provides details about the RDB and the offset
@@ -118,7 +130,8 @@ void rdbCheckError(const char *fmt, ...) {
         printf("[additional info] Reading type %d (%s)\n",
             rdbstate.key_type,
             ((unsigned)rdbstate.key_type <
-             sizeof(rdb_type_string)/sizeof(char*)) ?
+             sizeof(rdb_type_string)/sizeof(char*) &&
+             rdb_type_string[rdbstate.key_type]) ?
                 rdb_type_string[rdbstate.key_type] : "unknown");
     rdbShowGenericInfo();
 }
@@ -172,16 +185,17 @@ void rdbCheckSetupSignals(void) {
     sigaction(SIGILL, &act, NULL);
 }
 
-/* Check the specified RDB file. */
-int redis_check_rdb(char *rdbfilename) {
+/* Check the specified RDB file. If 'fp' is not NULL the RDB is read from
+ * it, as the preamble of an AOF file, and on success it is left positioned
+ * just after the RDB payload. */
+int redis_check_rdb(char *rdbfilename, FILE *fp) {
     uint64_t dbid;
-    int type, rdbver;
+    int type, rdbver, closefile = (fp == NULL);
     char buf[1024];
     long long expiretime, now = mstime();
-    FILE *fp;
     rio rdb;
 
-    if ((fp = fopen(rdbfilename,"r")) == NULL) return C_ERR;
+    if (fp == NULL && (fp = fopen(rdbfilename,"r")) == NULL) return C_ERR;
 
     rioInitWithFile(&rdb,fp);
     rdbstate.rio = &rdb;
@@ -228,6 +242,14 @@ int redis_check_rdb(char *rdbfilename) {
             /* We read the time so we need to read the object type again. */
             rdbstate.doing = RDB_CHECK_DOING_READ_TYPE;
             if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+        } else if (type == RDB_OPCODE_FIELD_EXPIRES) {
+            /* FIELD_EXPIRES: expire times of the fields of the next hash. */
+            hashFieldExpires *hfe;
+
+            rdbstate.doing = RDB_CHECK_DOING_READ_EXPIRE;
+            if ((hfe = rdbLoadFieldExpires(&rdb)) == NULL) goto eoferr;
+            hashFieldExpiresRelease(hfe);
+            continue; /* Read type again. */
         } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
             break;
@@ -261,9 +283,26 @@ int redis_check_rdb(char *rdbfilename) {
 
             rdbCheckInfo("AUX FIELD %s = '%s'",
                 (char*)auxkey->ptr, (char*)auxval->ptr);
+            if (!strcasecmp(auxkey->ptr,"snapshot-id"))
+                snprintf(rdbstate.snapshot_id,sizeof(rdbstate.snapshot_id),
+                    "%s",(char*)auxval->ptr);
+            else if (!strcasecmp(auxkey->ptr,"delta-base"))
+                snprintf(rdbstate.delta_base,sizeof(rdbstate.delta_base),
+                    "%s",(char*)auxval->ptr);
             decrRefCount(auxkey);
             decrRefCount(auxval);
             continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_DELKEY) {
+            /* DELKEY: a delta removes the key that follows. */
+            rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
+            if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
+            rdbstate.deleted++;
+            decrRefCount(key);
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_FLUSHDB) {
+            /* FLUSHDB: a delta empties the selected DB. */
+            rdbCheckInfo("Flushing the selected DB");
+            continue; /* Read type again. */
         } else {
             if (!rdbIsObjectType(type)) {
                 rdbCheckError("Invalid object type: %d", type);
@@ -293,14 +332,17 @@ int redis_check_rdb(char *rdbfilename) {
         decrRefCount(val);
         rdbstate.key_type = -1;
     }
-    /* Verify the checksum if RDB version is >= 5 */
-    if (rdbver >= 5 && server.rdb_checksum) {
+    /* Verify the checksum if RDB version is >= 5. It is always there, and
+     * is read anyway so that the AOF tail after a preamble can follow. */
+    if (rdbver >= 5) {
         uint64_t cksum, expected = rdb.cksum;
 
         rdbstate.doing = RDB_CHECK_DOING_CHECK_SUM;
         if (rioRead(&rdb,&cksum,8) == 0) goto eoferr;
         memrev64ifbe(&cksum);
-        if (cksum == 0) {
+        if (!server.rdb_checksum) {
+            rdbCheckInfo("Checksum disabled: no check performed.");
+        } else if (cksum == 0) {
             rdbCheckInfo("RDB file was saved with checksum disabled: no check performed.");
         } else if (cksum != expected) {
             rdbCheckError("RDB CRC error");
@@ -309,7 +351,7 @@ int redis_check_rdb(char *rdbfilename) {
         }
     }
 
-    fclose(fp);
+    if (closefile) fclose(fp);
     return 0;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
@@ -321,6 +363,36 @@ eoferr: /* unexpected end of file is handled here with a fatal exit */
     return 1;
 }
 
+/* Check the deltas of the RDB file 'rdbfilename' (see delta.c), in the
+ * same order the server applies them. A delta that does not follow the
+ * previous file ends the chain, like it happens when loading. */
+int redis_check_rdb_deltas(char *rdbfilename) {
+    char filename[1024], previous[CONFIG_RUN_ID_SIZE+1];
+    int seq;
+
+    for (seq = 1; ; seq++) {
+        rdbDeltaFilename(filename,sizeof(filename),rdbfilename,seq);
+        if (access(filename,R_OK) == -1) break;
+
+        memcpy(previous,rdbstate.snapshot_id,sizeof(previous));
+        rdbstate.rio = NULL;
+        rdbstate.snapshot_id[0] = rdbstate.delta_base[0] = '\0';
+        rdbCheckInfo("Checking RDB delta %s", filename);
+        if (redis_check_rdb(filename,NULL) != 0) return 1;
+        rdbstate.rio = NULL;
+        if (rdbstate.delta_base[0] == '\0' ||
+            strcmp(rdbstate.delta_base,previous) != 0)
+        {
+            rdbCheckInfo("%s does not follow the previous file: the chain "
+                "ends here and the following deltas are ignored", filename);
+            break;
+        }
+    }
+    rdbstate.rio = NULL;
+    if (seq > 1) rdbCheckInfo("%d RDB deltas in the chain", seq-1);
+    return 0;
+}
+
 /* RDB check main: called form redis.c when Redis is executed with the
  * redis-check-rdb alias.
  *
@@ -336,10 +408,29 @@ int redis_check_rdb_main(int argc, char **argv) {
     rdbCheckMode = 1;
     rdbCheckInfo("Checking RDB file %s", argv[1]);
     rdbCheckSetupSignals();
-    int retval = redis_check_rdb(argv[1]);
+    int retval = redis_check_rdb(argv[1],NULL);
+    if (retval == 0) retval = redis_check_rdb_deltas(argv[1]);
     if (retval == 0) {
         rdbCheckInfo("\\o/ RDB looks OK! \\o/");
         rdbShowGenericInfo();
     }
     exit(retval);
 }
+
+/* Check the RDB preamble of the AOF file 'filename', open as 'fp': called
+ * by redis-check-aof. On success 'fp' is left positioned at the start of
+ * the AOF tail. */
+int redis_check_rdb_preamble(char *filename, FILE *fp) {
+    createSharedObjects(); /* Needed for loading. */
+    server.loading_process_events_interval_bytes = 0;
+    rdbCheckMode = 1;
+    rdbCheckInfo("Checking RDB preamble of %s", filename);
+    rdbCheckSetupSignals();
+    int retval = redis_check_rdb(filename,fp);
+    if (retval == 0) {
+        rdbCheckInfo("RDB preamble looks OK");
+        rdbShowGenericInfo();
+    }
+    rdbstate.rio = NULL;
+    return retval;
+}
@@ -0,0 +1,3 @@
+#define REDIS_GIT_SHA1 "31eb2253"
+#define REDIS_GIT_DIRTY "0"
+#define REDIS_BUILD_ID "vm-1792312484"
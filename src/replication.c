@@ -30,6 +30,7 @@
 
 
 #include "server.h"
+#include "cluster.h"
 
 #include <sys/time.h>
 #include <unistd.h>
@@ -517,6 +518,8 @@ int startBgsaveForReplication(int mincapa) {
 
     if (socket_target)
         retval = rdbSaveToSlavesSockets();
+    else if (server.repl_forkless_sync)
+        retval = rdbSaveBackgroundForkless(server.rdb_filename);
     else
         retval = rdbSaveBackground(server.rdb_filename);
 
@@ -626,7 +629,7 @@ void syncCommand(client *c) {
     listAddNodeTail(server.slaves,c);
 
     /* CASE 1: BGSAVE is in progress, with disk target. */
-    if (server.rdb_child_pid != -1 &&
+    if (rdbBgsaveInProgress() &&
         server.rdb_child_type == RDB_CHILD_TYPE_DISK)
     {
         /* Ok a background save is in progress. Let's check if it is a good
@@ -655,14 +658,16 @@ void syncCommand(client *c) {
             serverLog(LL_NOTICE,"Can't attach the slave to the current BGSAVE. Waiting for next BGSAVE for SYNC");
         }
 
-    /* CASE 2: BGSAVE is in progress, with socket target. */
+    /* CASE 2: BGSAVE is in progress, with socket target, or a delta
+     * (that is not a full RDB) is being saved. */
     } else if (server.rdb_child_pid != -1 &&
-               server.rdb_child_type == RDB_CHILD_TYPE_SOCKET)
+               server.rdb_child_type != RDB_CHILD_TYPE_DISK)
     {
         /* There is an RDB child process but it is writing directly to
-         * children sockets. We need to wait for the next BGSAVE
-         * in order to synchronize. */
-        serverLog(LL_NOTICE,"Current BGSAVE has socket target. Waiting for next BGSAVE for SYNC");
+         * children sockets, or only a delta. We need to wait for the next
+         * BGSAVE in order to synchronize. */
+        serverLog(LL_NOTICE,"Current BGSAVE has %s target. Waiting for next BGSAVE for SYNC",
+            server.rdb_child_type == RDB_CHILD_TYPE_SOCKET ? "socket" : "delta");
 
     /* CASE 3: There is no BGSAVE is progress. */
     } else {
@@ -979,6 +984,188 @@ void replicationCreateMasterClient(int fd) {
         server.master->flags |= CLIENT_PRE_PSYNC;
 }
 
+/* Final setup of the connected slave <- master link, once the dataset of
+ * the master was loaded. */
+static void replicationFinishSync(void) {
+    replicationCreateMasterClient(server.repl_transfer_s);
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
+    /* Restart the AOF subsystem now that we finished the sync. This
+     * will trigger an AOF rewrite, and when done will start appending
+     * to the new file. */
+    if (server.aof_state != AOF_OFF) {
+        int retry = 10;
+
+        stopAppendOnly();
+        while (retry-- && startAppendOnly() == C_ERR) {
+            serverLog(LL_WARNING,"Failed enabling the AOF after successful master synchronization! Trying it again in one second.");
+            sleep(1);
+        }
+        if (!retry) {
+            serverLog(LL_WARNING,"FATAL: this slave instance finished the synchronization with its master, but the AOF can't be turned on. Exiting now.");
+            exit(1);
+        }
+    }
+}
+
+/* Return true if the payload of the next full sync should be loaded
+ * straight from the master socket, without writing it on disk first
+ * (repl-diskless-load). */
+static int useDisklessLoad(void) {
+    int j;
+
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB) return 1;
+    if (server.repl_diskless_load != REPL_DISKLESS_LOAD_ON_EMPTY_DB) return 0;
+    for (j = 0; j < server.dbnum; j++)
+        if (dictSize(server.db[j].dict)) return 0;
+    return 1;
+}
+
+/* Create the temporary DBs the dataset of the master is loaded into with
+ * repl-diskless-load swapdb, while the old dataset still serves reads. */
+static redisDb *disklessLoadCreateDbs(void) {
+    redisDb *dbs = zcalloc(sizeof(redisDb)*server.dbnum);
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        dbs[j].dict = dictCreate(&dbDictType,NULL);
+        dbs[j].expires = dictCreate(&keyptrDictType,NULL);
+        dbs[j].hexpires = dictCreate(&hashFieldExpiresDictType,NULL);
+        dbs[j].blocking_keys = dictCreate(&keylistDictType,NULL);
+        dbs[j].ready_keys = dictCreate(&setDictType,NULL);
+        dbs[j].watched_keys = dictCreate(&keylistDictType,NULL);
+        dbs[j].id = j;
+    }
+    return dbs;
+}
+
+/* Release the temporary DBs. If 'swap' is true their keys replace the ones
+ * of server.db first, so that the old keys are released instead. */
+static void disklessLoadReleaseDbs(redisDb *dbs, int swap) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j, *tmp = dbs+j;
+
+        if (swap) {
+            dict *d;
+
+            /* A forkless BGSAVE may still need the old keys. */
+            if (server.rdb_snapshot_active) rdbSnapshotDetachDb(db);
+            d = db->dict; db->dict = tmp->dict; tmp->dict = d;
+            d = db->expires; db->expires = tmp->expires; tmp->expires = d;
+            d = db->hexpires; db->hexpires = tmp->hexpires; tmp->hexpires = d;
+        }
+        dictEmpty(tmp->hexpires,replicationEmptyDbCallback);
+        dictEmpty(tmp->dict,replicationEmptyDbCallback);
+        dictEmpty(tmp->expires,replicationEmptyDbCallback);
+        dictRelease(tmp->hexpires);
+        dictRelease(tmp->dict);
+        dictRelease(tmp->expires);
+        dictRelease(tmp->blocking_keys);
+        dictRelease(tmp->ready_keys);
+        dictRelease(tmp->watched_keys);
+    }
+    zfree(dbs);
+    if (swap) pfcountCacheFlush();
+}
+
+/* Load the RDB payload of a full sync straight from the master socket 'fd'.
+ * 'eofmark' is the mark terminating the payload, or NULL if its size,
+ * server.repl_transfer_size, was announced.
+ *
+ * With repl-diskless-load swapdb the payload is loaded into temporary DBs,
+ * while the old dataset still serves reads, and replaces the old dataset
+ * only once fully loaded: on errors the slave keeps its old dataset. */
+static int replicationLoadFromSocket(int fd, char *eofmark) {
+    int swapdb = server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB;
+    redisDb *dbarray = server.db;
+    zskiplist *slots_to_keys = NULL;
+    char mark[CONFIG_RUN_ID_SIZE];
+    int retval;
+    rio rdb;
+
+    /* The payload is read with blocking reads, failing if the master does
+     * not send anything for repl-timeout seconds. */
+    aeDeleteFileEvent(server.el,fd,AE_READABLE);
+    if (anetBlock(NULL,fd) == ANET_ERR ||
+        anetRecvTimeout(NULL,fd,server.repl_timeout*1000) == ANET_ERR)
+    {
+        serverLog(LL_WARNING,"Can't setup the socket to load the MASTER "
+                             "synchronization DB: %s", strerror(errno));
+        return C_ERR;
+    }
+
+    if (swapdb) {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Loading DB in memory "
+                             "from socket, old data still served");
+        dbarray = disklessLoadCreateDbs();
+        if (server.cluster_enabled) {
+            slots_to_keys = server.cluster->slots_to_keys;
+            server.cluster->slots_to_keys = zslCreate();
+        }
+        server.async_loading = 1;
+        server.loading_start_time = time(NULL);
+        server.loading_total_bytes = eofmark ? 0 : server.repl_transfer_size;
+    } else {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
+        signalFlushedDb(-1);
+        emptyDb(replicationEmptyDbCallback);
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Loading DB in memory "
+                             "from socket");
+        startLoadingSize(eofmark ? 0 : server.repl_transfer_size);
+    }
+
+    rioInitWithFd(&rdb,fd,eofmark ? 0 : server.repl_transfer_size);
+    retval = rdbLoadRio(&rdb,dbarray,RDB_LOAD_SOCKET);
+    if (retval == C_OK && eofmark) {
+        if (rioRead(&rdb,mark,CONFIG_RUN_ID_SIZE) == 0 ||
+            memcmp(mark,eofmark,CONFIG_RUN_ID_SIZE) != 0)
+        {
+            serverLog(LL_WARNING,"Bad EOF mark after the MASTER "
+                                 "synchronization DB");
+            retval = C_ERR;
+        }
+    } else if (retval == C_OK && rioTell(&rdb) != server.repl_transfer_size) {
+        serverLog(LL_WARNING,"The MASTER synchronization DB is shorter than "
+                             "announced");
+        retval = C_ERR;
+    }
+    server.stat_net_input_bytes += rdb.io.fd.read_so_far;
+    server.repl_transfer_read = rdb.io.fd.read_so_far;
+    server.repl_transfer_lastio = server.unixtime;
+    rioFreeFd(&rdb);
+    anetRecvTimeout(NULL,fd,0);
+    anetNonBlock(NULL,fd);
+
+    if (swapdb) {
+        server.async_loading = 0;
+        if (retval == C_OK) {
+            signalFlushedDb(-1);
+            disklessLoadReleaseDbs(dbarray,1);
+            if (slots_to_keys) zslFree(slots_to_keys);
+        } else {
+            serverLog(LL_WARNING,"Failed loading the MASTER synchronization "
+                                 "DB from socket, keeping the old data");
+            disklessLoadReleaseDbs(dbarray,0);
+            if (slots_to_keys) {
+                zslFree(server.cluster->slots_to_keys);
+                server.cluster->slots_to_keys = slots_to_keys;
+            }
+        }
+    } else {
+        stopLoading();
+        /* Don't leave the keys loaded so far around. */
+        if (retval == C_ERR) {
+            serverLog(LL_WARNING,"Failed loading the MASTER synchronization "
+                                 "DB from socket");
+            emptyDb(replicationEmptyDbCallback);
+        }
+    }
+    /* The RDB file and its deltas on disk are not the dataset anymore. */
+    rdbDeltaInvalidate();
+    return retval;
+}
+
 /* Asynchronously read the SYNC payload we receive from a master */
 #define REPL_MAX_WRITTEN_BEFORE_FSYNC (1024*1024*8) /* 8 MB */
 void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -1050,6 +1237,16 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         return;
     }
 
+    /* Load the payload straight from the socket if there is no temp file. */
+    if (server.repl_transfer_fd == -1) {
+        if (replicationLoadFromSocket(fd,usemark ? eofmark : NULL) == C_ERR) {
+            cancelReplicationHandshake();
+            return;
+        }
+        replicationFinishSync();
+        return;
+    }
+
     /* Read bulk data */
     if (usemark) {
         readlen = sizeof(buf);
@@ -1139,27 +1336,11 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
             cancelReplicationHandshake();
             return;
         }
-        /* Final setup of the connected slave <- master link */
+        /* The deltas on disk don't apply to the master's RDB. */
+        rdbDeltaInvalidate();
         zfree(server.repl_transfer_tmpfile);
         close(server.repl_transfer_fd);
-        replicationCreateMasterClient(server.repl_transfer_s);
-        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
-        /* Restart the AOF subsystem now that we finished the sync. This
-         * will trigger an AOF rewrite, and when done will start appending
-         * to the new file. */
-        if (server.aof_state != AOF_OFF) {
-            int retry = 10;
-
-            stopAppendOnly();
-            while (retry-- && startAppendOnly() == C_ERR) {
-                serverLog(LL_WARNING,"Failed enabling the AOF after successful master synchronization! Trying it again in one second.");
-                sleep(1);
-            }
-            if (!retry) {
-                serverLog(LL_WARNING,"FATAL: this slave instance finished the synchronization with its master, but the AOF can't be turned on. Exiting now.");
-                exit(1);
-            }
-        }
+        replicationFinishSync();
     }
 
     return;
@@ -1606,15 +1787,16 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
     }
 
-    /* Prepare a suitable temp file for bulk transfer */
-    while(maxtries--) {
+    /* Prepare a suitable temp file for bulk transfer, unless the payload
+     * is loaded straight from the socket. */
+    while(!useDisklessLoad() && maxtries--) {
         snprintf(tmpfile,256,
             "temp-%d.%ld.rdb",(int)server.unixtime,(long int)getpid());
         dfd = open(tmpfile,O_CREAT|O_WRONLY|O_EXCL,0644);
         if (dfd != -1) break;
         sleep(1);
     }
-    if (dfd == -1) {
+    if (dfd == -1 && !useDisklessLoad()) {
         serverLog(LL_WARNING,"Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
         goto error;
     }
@@ -1635,7 +1817,7 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     server.repl_transfer_last_fsync_off = 0;
     server.repl_transfer_fd = dfd;
     server.repl_transfer_lastio = server.unixtime;
-    server.repl_transfer_tmpfile = zstrdup(tmpfile);
+    server.repl_transfer_tmpfile = (dfd != -1) ? zstrdup(tmpfile) : NULL;
     return;
 
 error:
@@ -1695,9 +1877,11 @@ void undoConnectWithMaster(void) {
 void replicationAbortSyncTransfer(void) {
     serverAssert(server.repl_state == REPL_STATE_TRANSFER);
     undoConnectWithMaster();
-    close(server.repl_transfer_fd);
-    unlink(server.repl_transfer_tmpfile);
-    zfree(server.repl_transfer_tmpfile);
+    if (server.repl_transfer_fd != -1) {
+        close(server.repl_transfer_fd);
+        unlink(server.repl_transfer_tmpfile);
+        zfree(server.repl_transfer_tmpfile);
+    }
 }
 
 /* This function aborts a non blocking replication attempt if there is one
@@ -2367,7 +2551,7 @@ void replicationCron(void) {
      * In case of diskless replication, we make sure to wait the specified
      * number of seconds (according to configuration) so that other slaves
      * have the time to arrive before we start streaming. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+    if (!rdbBgsaveInProgress() && server.aof_child_pid == -1) {
         time_t idle, max_idle = 0;
         int slaves_waiting = 0;
         int mincapa = -1;
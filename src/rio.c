@@ -105,6 +105,33 @@ void rioInitWithBuffer(rio *r, sds s) {
 
 /* --------------------- Stdio file pointer implementation ------------------- */
 
+/* Sleep as needed so that the data is not written faster than the rate
+ * limit set with rioSetRateLimit(). The clock is only checked every
+ * RIO_RATE_CHECK_BYTES written. If the writer was slower than the limit
+ * for a while, at most one second worth of data can be written in a burst
+ * to catch up. */
+#define RIO_RATE_CHECK_BYTES (1024*64)
+static void rioFileThrottle(rio *r, size_t len) {
+    long long elapsed, expected;
+
+    r->io.file.unchecked += len;
+    if (r->io.file.unchecked < RIO_RATE_CHECK_BYTES) return;
+    r->io.file.written += r->io.file.unchecked;
+    r->io.file.unchecked = 0;
+
+    expected = (long long)
+        ((double)r->io.file.written*1000000/r->io.file.maxrate);
+    elapsed = ustime()-r->io.file.start;
+    if (elapsed > expected+1000000)
+        r->io.file.start += elapsed-expected-1000000;
+    while (elapsed < expected) {
+        long long us = expected-elapsed;
+
+        usleep(us > 100000 ? 100000 : us);
+        elapsed = ustime()-r->io.file.start;
+    }
+}
+
 /* Returns 1 or 0 for success/failure. */
 static size_t rioFileWrite(rio *r, const void *buf, size_t len) {
     size_t retval;
@@ -119,6 +146,7 @@ static size_t rioFileWrite(rio *r, const void *buf, size_t len) {
         aof_fsync(fileno(r->io.file.fp));
         r->io.file.buffered = 0;
     }
+    if (r->io.file.maxrate) rioFileThrottle(r,len);
     return retval;
 }
 
@@ -155,6 +183,10 @@ void rioInitWithFile(rio *r, FILE *fp) {
     r->io.file.fp = fp;
     r->io.file.buffered = 0;
     r->io.file.autosync = 0;
+    r->io.file.maxrate = 0;
+    r->io.file.written = 0;
+    r->io.file.unchecked = 0;
+    r->io.file.start = 0;
 }
 
 /* ------------------- File descriptors set implementation ------------------- */
@@ -283,6 +315,96 @@ void rioFreeFdset(rio *r) {
     sdsfree(r->io.fdset.buf);
 }
 
+/* ------------------ File descriptor source implementation ------------------
+ * Reads from a blocking file descriptor, such as the socket with the master
+ * while loading the RDB without writing it on disk: the bytes are read in
+ * big chunks, but never past 'read_limit' when the size of the payload is
+ * known, so that the data following it is left in the socket. */
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioFdRead(rio *r, void *buf, size_t len) {
+    size_t avail = sdslen(r->io.fd.buf)-r->io.fd.pos;
+
+    while (avail < len) {
+        size_t toread = len-avail;
+        ssize_t nread;
+
+        /* Drop the consumed bytes before reading more. */
+        if (r->io.fd.pos) {
+            sdsrange(r->io.fd.buf,r->io.fd.pos,-1);
+            r->io.fd.pos = 0;
+        }
+        if (toread < PROTO_IOBUF_LEN) toread = PROTO_IOBUF_LEN;
+        if (r->io.fd.read_limit &&
+            r->io.fd.read_so_far+toread > r->io.fd.read_limit)
+        {
+            toread = r->io.fd.read_limit-r->io.fd.read_so_far;
+            if (toread == 0) {
+                errno = EOVERFLOW;
+                return 0;
+            }
+        }
+        r->io.fd.buf = sdsMakeRoomFor(r->io.fd.buf,toread);
+        nread = read(r->io.fd.fd,r->io.fd.buf+sdslen(r->io.fd.buf),toread);
+        if (nread <= 0) {
+            if (nread == 0) errno = ECONNRESET;
+            else if (errno == EAGAIN) errno = ETIMEDOUT;
+            return 0;
+        }
+        sdsIncrLen(r->io.fd.buf,nread);
+        r->io.fd.read_so_far += nread;
+        avail += nread;
+    }
+    memcpy(buf,r->io.fd.buf+r->io.fd.pos,len);
+    r->io.fd.pos += len;
+    return 1;
+}
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioFdWrite(rio *r, const void *buf, size_t len) {
+    UNUSED(r);
+    UNUSED(buf);
+    UNUSED(len);
+    return 0; /* Error, this target does not support writing. */
+}
+
+/* Returns the position of the next byte to read. */
+static off_t rioFdTell(rio *r) {
+    return r->io.fd.read_so_far-(sdslen(r->io.fd.buf)-r->io.fd.pos);
+}
+
+/* Nothing to flush when reading. */
+static int rioFdFlush(rio *r) {
+    UNUSED(r);
+    return 1;
+}
+
+static const rio rioFdIO = {
+    rioFdRead,
+    rioFdWrite,
+    rioFdTell,
+    rioFdFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+void rioInitWithFd(rio *r, int fd, size_t read_limit) {
+    *r = rioFdIO;
+    r->io.fd.fd = fd;
+    r->io.fd.buf = sdsempty();
+    r->io.fd.pos = 0;
+    r->io.fd.read_limit = read_limit;
+    r->io.fd.read_so_far = 0;
+}
+
+/* release the rio stream. */
+void rioFreeFd(rio *r) {
+    sdsfree(r->io.fd.buf);
+}
+
 /* ---------------------------- Generic functions ---------------------------- */
 
 /* This function can be installed both in memory and file streams when checksum
@@ -304,6 +426,28 @@ void rioSetAutoSync(rio *r, off_t bytes) {
     r->io.file.autosync = bytes;
 }
 
+/* Set the file-based rio object to write at most 'bytes_per_sec' bytes per
+ * second, sleeping when the writer is faster than that. Zero, the default,
+ * means no limit.
+ *
+ * This is used by the persistence children, so that a BGSAVE or an AOF
+ * rewrite does not saturate the disk shared with the AOF of the parent.
+ * The limit is only effective on the disk if the written data does not
+ * pile up in the OS buffers, so auto fsync is also enabled, at least every
+ * second worth of data. */
+void rioSetRateLimit(rio *r, off_t bytes_per_sec) {
+    serverAssert(r->read == rioFileIO.read);
+    r->io.file.maxrate = bytes_per_sec;
+    if (bytes_per_sec &&
+        (r->io.file.autosync == 0 || r->io.file.autosync > bytes_per_sec))
+    {
+        r->io.file.autosync = bytes_per_sec;
+    }
+    r->io.file.written = 0;
+    r->io.file.unchecked = 0;
+    r->io.file.start = ustime();
+}
+
 /* --------------------------- Higher level interface --------------------------
  *
  * The following higher level functions use lower level rio.c functions to help
@@ -72,6 +72,10 @@ struct _rio {
             FILE *fp;
             off_t buffered; /* Bytes written since last fsync. */
             off_t autosync; /* fsync after 'autosync' bytes written. */
+            off_t maxrate;  /* Max bytes written per second, 0 = no limit. */
+            off_t written;  /* Bytes written since 'start'. */
+            off_t unchecked; /* Bytes written since the last rate check. */
+            long long start; /* Start of the rate limited write, in usec. */
         } file;
         /* Multiple FDs target (used to write to N sockets). */
         struct {
@@ -81,6 +85,14 @@ struct _rio {
             off_t pos;
             sds buf;
         } fdset;
+        /* File descriptor source (used to read from a socket). */
+        struct {
+            int fd;             /* File descriptor. */
+            sds buf;            /* Bytes read but not consumed yet. */
+            size_t pos;         /* Position of the next byte in 'buf'. */
+            size_t read_limit;  /* Don't read more than that, 0 = no limit. */
+            size_t read_so_far; /* Bytes read from the fd. */
+        } fd;
     } io;
 };
 
@@ -128,7 +140,10 @@ void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
 void rioInitWithFdset(rio *r, int *fds, int numfds);
 
+void rioInitWithFd(rio *r, int fd, size_t read_limit);
+
 void rioFreeFdset(rio *r);
+void rioFreeFd(rio *r);
 
 size_t rioWriteBulkCount(rio *r, char prefix, int count);
 size_t rioWriteBulkString(rio *r, const char *buf, size_t len);
@@ -137,5 +152,6 @@ size_t rioWriteBulkDouble(rio *r, double d);
 
 void rioGenericUpdateChecksum(rio *r, const void *buf, size_t len);
 void rioSetAutoSync(rio *r, off_t bytes);
+void rioSetRateLimit(rio *r, off_t bytes_per_sec);
 
 #endif
@@ -0,0 +1,806 @@
+/* Roaring bitmaps, used as a compressed encoding for sparse strings that
+ * are manipulated with the bit commands (see bitops.c).
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+/* Bitmap containers are turned back into arrays only when the cardinality
+ * drops well below ROARING_ARRAY_MAX, so that setting and clearing a bit
+ * around the limit does not convert the container every time. */
+#define ROARING_BITMAP_MIN (ROARING_ARRAY_MAX/2)
+
+/* Serialized format: 8 bytes length, 4 bytes number of containers, then
+ * for every container 2 bytes key, 2 bytes type, 4 bytes cardinality,
+ * followed by the array elements (2 bytes each) or by the bitmap. All the
+ * integers are little endian. */
+#define ROARING_HDR_LEN 12
+#define ROARING_CONTAINER_HDR_LEN 8
+
+/* Max length of the equivalent string: bit offsets must fit 32 bits. */
+#define ROARING_MAX_LEN (1ULL<<29)
+
+/* ----------------------------- Helpers ------------------------------------ */
+
+static uint64_t roaringPopcount(const unsigned char *p, size_t count) {
+    uint64_t bits = 0, w;
+
+    while (count >= 8) {
+        memcpy(&w,p,sizeof(w));
+        w = w - ((w >> 1) & 0x5555555555555555ULL);
+        w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+        w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        bits += (w * 0x0101010101010101ULL) >> 56;
+        p += 8;
+        count -= 8;
+    }
+    while (count--) {
+        unsigned char b = *p++;
+        while (b) {
+            bits += b & 1;
+            b >>= 1;
+        }
+    }
+    return bits;
+}
+
+static inline int bitmapGet(const unsigned char *bm, uint32_t low) {
+    return (bm[low>>3] >> (7-(low&7))) & 1;
+}
+
+static inline void bitmapSet(unsigned char *bm, uint32_t low) {
+    bm[low>>3] |= 1 << (7-(low&7));
+}
+
+static inline void bitmapClear(unsigned char *bm, uint32_t low) {
+    bm[low>>3] &= ~(1 << (7-(low&7)));
+}
+
+/* Return the index of the first element of the array >= 'v'. */
+static uint32_t arrayLowerBound(const uint16_t *a, uint32_t card, uint32_t v) {
+    uint32_t lo = 0, hi = card;
+
+    while (lo < hi) {
+        uint32_t mid = (lo+hi)/2;
+        if (a[mid] < v) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Search the container with the specified key. Returns 1 if found, 0
+ * otherwise. In both cases 'pos' is set to the index of the container, or
+ * to the index where it should be inserted. */
+static int containerFind(roaring *r, uint16_t key, uint32_t *pos) {
+    uint32_t lo = 0, hi = r->numc;
+
+    while (lo < hi) {
+        uint32_t mid = (lo+hi)/2;
+        if (r->c[mid].key < key) lo = mid+1;
+        else hi = mid;
+    }
+    *pos = lo;
+    return lo < r->numc && r->c[lo].key == key;
+}
+
+static size_t containerDataBytes(roaringContainer *c) {
+    return c->type == ROARING_ARRAY ? c->alloc*sizeof(uint16_t) :
+                                      ROARING_BITMAP_BYTES;
+}
+
+/* Insert a container at position 'pos', taking ownership of 'data'. */
+static void containerInsert(roaring *r, uint32_t pos, uint16_t key, int type,
+                            uint32_t card, uint32_t alloc, void *data)
+{
+    roaringContainer *c;
+
+    r->c = zrealloc(r->c,sizeof(roaringContainer)*(r->numc+1));
+    memmove(r->c+pos+1,r->c+pos,sizeof(roaringContainer)*(r->numc-pos));
+    r->numc++;
+    c = r->c+pos;
+    c->key = key;
+    c->type = type;
+    c->card = card;
+    c->alloc = alloc;
+    c->data = data;
+    r->bytes += containerDataBytes(c);
+    r->card += card;
+}
+
+static void containerRemove(roaring *r, uint32_t pos) {
+    roaringContainer *c = r->c+pos;
+
+    r->bytes -= containerDataBytes(c);
+    r->card -= c->card;
+    zfree(c->data);
+    memmove(r->c+pos,r->c+pos+1,sizeof(roaringContainer)*(r->numc-pos-1));
+    r->numc--;
+    if (r->numc == 0) {
+        zfree(r->c);
+        r->c = NULL;
+    } else {
+        r->c = zrealloc(r->c,sizeof(roaringContainer)*r->numc);
+    }
+}
+
+static void containerToBitmap(roaring *r, roaringContainer *c) {
+    unsigned char *bm = zcalloc(ROARING_BITMAP_BYTES);
+    uint16_t *a = c->data;
+    uint32_t j;
+
+    for (j = 0; j < c->card; j++) bitmapSet(bm,a[j]);
+    r->bytes -= containerDataBytes(c);
+    zfree(c->data);
+    c->type = ROARING_BITMAP;
+    c->alloc = 0;
+    c->data = bm;
+    r->bytes += containerDataBytes(c);
+}
+
+/* Store in 'a' the low bits of the bits set in the bitmap, in order. */
+static void bitmapToArray(const unsigned char *bm, uint16_t *a) {
+    uint32_t byte, j = 0;
+
+    for (byte = 0; byte < ROARING_BITMAP_BYTES; byte++) {
+        unsigned char b = bm[byte];
+        int bit;
+
+        if (b == 0) continue;
+        for (bit = 0; bit < 8; bit++)
+            if (b & (0x80 >> bit)) a[j++] = byte*8+bit;
+    }
+}
+
+static void containerToArray(roaring *r, roaringContainer *c) {
+    uint16_t *a = zmalloc(sizeof(uint16_t)*c->card);
+
+    bitmapToArray(c->data,a);
+    r->bytes -= containerDataBytes(c);
+    zfree(c->data);
+    c->type = ROARING_ARRAY;
+    c->alloc = c->card;
+    c->data = a;
+    r->bytes += containerDataBytes(c);
+}
+
+/* Append a container built from a full bitmap with 'card' bits set (not
+ * zero), choosing the right container type. The key must be greater than
+ * the key of any other container. */
+static void containerAppendBitmap(roaring *r, uint16_t key,
+                                  const unsigned char *bm, uint32_t card)
+{
+    if (card > ROARING_ARRAY_MAX) {
+        unsigned char *copy = zmalloc(ROARING_BITMAP_BYTES);
+        memcpy(copy,bm,ROARING_BITMAP_BYTES);
+        containerInsert(r,r->numc,key,ROARING_BITMAP,card,0,copy);
+    } else {
+        uint16_t *a = zmalloc(sizeof(uint16_t)*card);
+        bitmapToArray(bm,a);
+        containerInsert(r,r->numc,key,ROARING_ARRAY,card,card,a);
+    }
+}
+
+/* Count the bits set in the container between the low offsets 'lo' and
+ * 'hi' inclusive. */
+static uint32_t containerCount(roaringContainer *c, uint32_t lo, uint32_t hi) {
+    if (lo == 0 && hi == 0xffff) return c->card;
+    if (c->type == ROARING_ARRAY) {
+        uint16_t *a = c->data;
+        return arrayLowerBound(a,c->card,hi+1) - arrayLowerBound(a,c->card,lo);
+    } else {
+        unsigned char *bm = c->data;
+        uint32_t count = 0;
+
+        while (lo <= hi && (lo & 7)) count += bitmapGet(bm,lo++);
+        if (lo+7 <= hi) {
+            uint32_t bytes = (hi+1-lo)/8;
+            count += roaringPopcount(bm+lo/8,bytes);
+            lo += bytes*8;
+        }
+        while (lo <= hi) count += bitmapGet(bm,lo++);
+        return count;
+    }
+}
+
+/* Return the first low offset in 'lo'..'hi' where the container has a bit
+ * set to 'value', or -1 if there is none. */
+static int32_t containerFirst(roaringContainer *c, int value,
+                              uint32_t lo, uint32_t hi)
+{
+    if (c->type == ROARING_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t j = arrayLowerBound(a,c->card,lo);
+
+        if (value) return (j < c->card && a[j] <= hi) ? (int32_t)a[j] : -1;
+        /* Zeroes are the gaps between the elements. */
+        while (j < c->card && a[j] == lo && lo <= hi) {
+            j++;
+            lo++;
+        }
+        return lo <= hi ? (int32_t)lo : -1;
+    } else {
+        unsigned char *bm = c->data;
+        unsigned char skip = value ? 0 : 0xff;
+
+        while (lo <= hi && (lo & 7)) {
+            if (bitmapGet(bm,lo) == value) return lo;
+            lo++;
+        }
+        while (lo+7 <= hi && bm[lo/8] == skip) lo += 8;
+        while (lo <= hi) {
+            if (bitmapGet(bm,lo) == value) return lo;
+            lo++;
+        }
+        return -1;
+    }
+}
+
+/* Expand the container into a full bitmap. */
+static void containerToWords(roaringContainer *c, unsigned char *bm) {
+    if (c->type == ROARING_BITMAP) {
+        memcpy(bm,c->data,ROARING_BITMAP_BYTES);
+    } else {
+        uint16_t *a = c->data;
+        uint32_t j;
+
+        memset(bm,0,ROARING_BITMAP_BYTES);
+        for (j = 0; j < c->card; j++) bitmapSet(bm,a[j]);
+    }
+}
+
+/* ----------------------------- API ---------------------------------------- */
+
+/* Create an empty bitmap equivalent to a string of 'len' zero bytes. */
+roaring *roaringNew(uint64_t len) {
+    roaring *r = zmalloc(sizeof(*r));
+
+    r->len = len;
+    r->card = 0;
+    r->bytes = 0;
+    r->numc = 0;
+    r->c = NULL;
+    return r;
+}
+
+void roaringFree(roaring *r) {
+    uint32_t j;
+
+    for (j = 0; j < r->numc; j++) zfree(r->c[j].data);
+    zfree(r->c);
+    zfree(r);
+}
+
+roaring *roaringDup(roaring *r) {
+    roaring *d = roaringNew(r->len);
+    uint32_t j;
+
+    if (r->numc == 0) return d;
+    d->c = zmalloc(sizeof(roaringContainer)*r->numc);
+    for (j = 0; j < r->numc; j++) {
+        size_t bytes = containerDataBytes(r->c+j);
+        d->c[j] = r->c[j];
+        d->c[j].data = zmalloc(bytes);
+        memcpy(d->c[j].data,r->c[j].data,bytes);
+    }
+    d->numc = r->numc;
+    d->card = r->card;
+    d->bytes = r->bytes;
+    return d;
+}
+
+/* Set the bit at offset 'bit' to 'value', growing the length of the
+ * equivalent string if needed, like SETBIT does. Returns the old value. */
+int roaringSetBit(roaring *r, uint64_t bit, int value) {
+    uint16_t key = bit >> 16, low = bit & 0xffff;
+    roaringContainer *c;
+    uint16_t *a;
+    uint32_t pos, j;
+    int old;
+
+    if (bit/8 >= r->len) r->len = bit/8+1;
+    if (!containerFind(r,key,&pos)) {
+        if (!value) return 0;
+        a = zmalloc(sizeof(uint16_t));
+        a[0] = low;
+        containerInsert(r,pos,key,ROARING_ARRAY,1,1,a);
+        return 0;
+    }
+
+    c = r->c+pos;
+    if (c->type == ROARING_BITMAP) {
+        old = bitmapGet(c->data,low);
+        if (old == value) return old;
+        if (value) {
+            bitmapSet(c->data,low);
+            c->card++;
+            r->card++;
+        } else {
+            bitmapClear(c->data,low);
+            c->card--;
+            r->card--;
+            if (c->card < ROARING_BITMAP_MIN) containerToArray(r,c);
+        }
+        return old;
+    }
+
+    a = c->data;
+    j = arrayLowerBound(a,c->card,low);
+    old = j < c->card && a[j] == low;
+    if (old == value) return old;
+    if (value) {
+        if (c->card == ROARING_ARRAY_MAX) {
+            containerToBitmap(r,c);
+            bitmapSet(c->data,low);
+        } else {
+            if (c->card == c->alloc) {
+                uint32_t alloc = c->alloc*2;
+                if (alloc > ROARING_ARRAY_MAX) alloc = ROARING_ARRAY_MAX;
+                c->data = a = zrealloc(a,sizeof(uint16_t)*alloc);
+                r->bytes += (alloc-c->alloc)*sizeof(uint16_t);
+                c->alloc = alloc;
+            }
+            memmove(a+j+1,a+j,sizeof(uint16_t)*(c->card-j));
+            a[j] = low;
+        }
+        c->card++;
+        r->card++;
+    } else {
+        memmove(a+j,a+j+1,sizeof(uint16_t)*(c->card-j-1));
+        c->card--;
+        r->card--;
+        if (c->card == 0) {
+            containerRemove(r,pos);
+        } else if (c->card < c->alloc/4) {
+            uint32_t alloc = c->alloc/2;
+            c->data = zrealloc(a,sizeof(uint16_t)*alloc);
+            r->bytes -= (c->alloc-alloc)*sizeof(uint16_t);
+            c->alloc = alloc;
+        }
+    }
+    return old;
+}
+
+int roaringGetBit(roaring *r, uint64_t bit) {
+    uint16_t low = bit & 0xffff;
+    roaringContainer *c;
+    uint32_t pos;
+
+    if (bit >= r->len*8 || !containerFind(r,bit>>16,&pos)) return 0;
+    c = r->c+pos;
+    if (c->type == ROARING_BITMAP) return bitmapGet(c->data,low);
+    pos = arrayLowerBound(c->data,c->card,low);
+    return pos < c->card && ((uint16_t*)c->data)[pos] == low;
+}
+
+/* Count the bits set between the bit offsets 'start' and 'end' inclusive. */
+uint64_t roaringCount(roaring *r, uint64_t start, uint64_t end) {
+    uint64_t count = 0;
+    uint32_t pos;
+
+    if (start > end) return 0;
+    if (start == 0 && end >= r->len*8-1) return r->card;
+    containerFind(r,start>>16,&pos);
+    for (; pos < r->numc; pos++) {
+        roaringContainer *c = r->c+pos;
+        uint64_t base = (uint64_t)c->key << 16;
+        uint32_t lo, hi;
+
+        if (base > end) break;
+        lo = base < start ? start-base : 0;
+        hi = end-base > 0xffff ? 0xffff : end-base;
+        count += containerCount(c,lo,hi);
+    }
+    return count;
+}
+
+/* Return the offset of the first bit set to 'value' between the bit offsets
+ * 'start' and 'end' inclusive, or -1 if there is none. Note that the bits
+ * beyond the length of the bitmap are considered to be zero. */
+int64_t roaringFirst(roaring *r, int value, uint64_t start, uint64_t end) {
+    uint64_t bit = start;
+    uint32_t pos;
+
+    if (start > end) return -1;
+    containerFind(r,start>>16,&pos);
+    while (bit <= end) {
+        roaringContainer *c;
+        uint64_t base;
+        uint32_t hi;
+        int32_t first;
+
+        if (pos == r->numc) return value ? -1 : (int64_t)bit;
+        c = r->c+pos;
+        base = (uint64_t)c->key << 16;
+        if (base > end) return value ? -1 : (int64_t)bit;
+        if (base > bit) {
+            /* A missing container is a run of zeroes. */
+            if (!value) return bit;
+            bit = base;
+        }
+        hi = end-base > 0xffff ? 0xffff : end-base;
+        first = containerFirst(c,value,bit-base,hi);
+        if (first != -1) return base+first;
+        bit = base+0x10000;
+        pos++;
+    }
+    return -1;
+}
+
+/* Write to 'buf' the 'count' bytes of the equivalent string starting at the
+ * byte offset 'start'. */
+void roaringGetRange(roaring *r, uint64_t start, unsigned char *buf,
+                     uint64_t count)
+{
+    uint64_t end = start+count;
+    uint32_t pos;
+
+    memset(buf,0,count);
+    if (count == 0) return;
+    containerFind(r,start/ROARING_BITMAP_BYTES,&pos);
+    for (; pos < r->numc; pos++) {
+        roaringContainer *c = r->c+pos;
+        uint64_t cstart = (uint64_t)c->key*ROARING_BITMAP_BYTES;
+        uint64_t from, to;
+
+        if (cstart >= end) break;
+        from = cstart > start ? cstart : start;
+        to = cstart+ROARING_BITMAP_BYTES < end ?
+             cstart+ROARING_BITMAP_BYTES : end;
+        if (c->type == ROARING_BITMAP) {
+            memcpy(buf+(from-start),(unsigned char*)c->data+(from-cstart),
+                   to-from);
+        } else {
+            uint16_t *a = c->data;
+            uint32_t j = arrayLowerBound(a,c->card,(from-cstart)*8);
+
+            for (; j < c->card && cstart+a[j]/8 < to; j++)
+                bitmapSet(buf,(cstart-start)*8+a[j]);
+        }
+    }
+}
+
+/* Create a bitmap from the string 'buf' of 'len' bytes. */
+roaring *roaringFromBuffer(unsigned char *buf, uint64_t len) {
+    roaring *r = roaringNew(len);
+    unsigned char bm[ROARING_BITMAP_BYTES];
+    uint64_t off;
+
+    for (off = 0; off < len; off += ROARING_BITMAP_BYTES) {
+        uint64_t count = len-off;
+        uint32_t card;
+
+        if (count > ROARING_BITMAP_BYTES) count = ROARING_BITMAP_BYTES;
+        card = roaringPopcount(buf+off,count);
+        if (card == 0) continue;
+        memcpy(bm,buf+off,count);
+        memset(bm+count,0,ROARING_BITMAP_BYTES-count);
+        containerAppendBitmap(r,off/ROARING_BITMAP_BYTES,bm,card);
+    }
+    return r;
+}
+
+/* Compute the AND, OR or XOR of the 'numsrc' bitmaps in 'src', that may
+ * contain NULL entries to represent empty bitmaps, and return the result as
+ * a new bitmap of length 'len'. */
+roaring *roaringOp(int op, roaring **src, unsigned long numsrc, uint64_t len) {
+    roaring *r = roaringNew(len);
+    uint32_t *pos = zcalloc(sizeof(uint32_t)*numsrc);
+    uint64_t acc[ROARING_BITMAP_BYTES/8], tmp[ROARING_BITMAP_BYTES/8];
+    unsigned long j, w;
+
+    while(1) {
+        unsigned long present = 0;
+        uint32_t key = 0;
+        int found = 0;
+        uint64_t card;
+
+        /* The next key to process is the smallest one among the sources. */
+        for (j = 0; j < numsrc; j++) {
+            if (src[j] == NULL || pos[j] == src[j]->numc) continue;
+            if (!found || src[j]->c[pos[j]].key < key) {
+                key = src[j]->c[pos[j]].key;
+                found = 1;
+            }
+        }
+        if (!found) break;
+
+        for (j = 0; j < numsrc; j++) {
+            roaringContainer *c;
+
+            if (src[j] == NULL || pos[j] == src[j]->numc) continue;
+            c = src[j]->c+pos[j];
+            if (c->key != key) continue;
+            pos[j]++;
+            containerToWords(c,present ? (unsigned char*)tmp :
+                                         (unsigned char*)acc);
+            if (present++ == 0) continue;
+            for (w = 0; w < ROARING_BITMAP_BYTES/8; w++) {
+                switch(op) {
+                case ROARING_AND: acc[w] &= tmp[w]; break;
+                case ROARING_OR:  acc[w] |= tmp[w]; break;
+                case ROARING_XOR: acc[w] ^= tmp[w]; break;
+                }
+            }
+        }
+        if (op == ROARING_AND && present != numsrc) continue;
+        card = roaringPopcount((unsigned char*)acc,ROARING_BITMAP_BYTES);
+        if (card) containerAppendBitmap(r,key,(unsigned char*)acc,card);
+    }
+    zfree(pos);
+    return r;
+}
+
+/* Return the memory used by the bitmap, in bytes. */
+size_t roaringMemory(roaring *r) {
+    return sizeof(*r)+sizeof(roaringContainer)*r->numc+r->bytes;
+}
+
+/* Return a serialized version of the bitmap, setting 'len' to its length.
+ * The returned buffer must be freed with zfree(). */
+unsigned char *roaringSerialize(roaring *r, size_t *len) {
+    size_t bloblen = ROARING_HDR_LEN;
+    unsigned char *blob, *p;
+    uint64_t u64;
+    uint32_t u32, j, k;
+    uint16_t u16;
+
+    for (j = 0; j < r->numc; j++) {
+        roaringContainer *c = r->c+j;
+        bloblen += ROARING_CONTAINER_HDR_LEN;
+        bloblen += c->type == ROARING_ARRAY ? c->card*sizeof(uint16_t) :
+                                              ROARING_BITMAP_BYTES;
+    }
+    p = blob = zmalloc(bloblen);
+    u64 = intrev64ifbe(r->len);
+    memcpy(p,&u64,8); p += 8;
+    u32 = intrev32ifbe(r->numc);
+    memcpy(p,&u32,4); p += 4;
+    for (j = 0; j < r->numc; j++) {
+        roaringContainer *c = r->c+j;
+
+        u16 = intrev16ifbe(c->key);
+        memcpy(p,&u16,2); p += 2;
+        u16 = intrev16ifbe(c->type);
+        memcpy(p,&u16,2); p += 2;
+        u32 = intrev32ifbe(c->card);
+        memcpy(p,&u32,4); p += 4;
+        if (c->type == ROARING_ARRAY) {
+            uint16_t *a = c->data;
+            for (k = 0; k < c->card; k++) {
+                u16 = intrev16ifbe(a[k]);
+                memcpy(p,&u16,2); p += 2;
+            }
+        } else {
+            memcpy(p,c->data,ROARING_BITMAP_BYTES);
+            p += ROARING_BITMAP_BYTES;
+        }
+    }
+    *len = bloblen;
+    return blob;
+}
+
+/* Create a bitmap from its serialized version. The input is fully
+ * validated, so NULL is returned if it is not a valid serialized bitmap. */
+roaring *roaringDeserialize(unsigned char *buf, size_t len) {
+    unsigned char *p = buf, *end = buf+len;
+    roaring *r;
+    uint64_t u64, maxbit = 0;
+    uint32_t numc, u32, j, k;
+    uint16_t u16;
+
+    if (len < ROARING_HDR_LEN) return NULL;
+    memcpy(&u64,p,8); p += 8;
+    memcpy(&u32,p,4); p += 4;
+    u64 = intrev64ifbe(u64);
+    numc = intrev32ifbe(u32);
+    if (u64 > ROARING_MAX_LEN || numc > 0x10000) return NULL;
+
+    r = roaringNew(u64);
+    for (j = 0; j < numc; j++) {
+        uint16_t key, type, prev = 0;
+        uint32_t card;
+        void *data;
+
+        if (end-p < ROARING_CONTAINER_HDR_LEN) goto invalid;
+        memcpy(&key,p,2); p += 2;
+        memcpy(&type,p,2); p += 2;
+        memcpy(&card,p,4); p += 4;
+        key = intrev16ifbe(key);
+        type = intrev16ifbe(type);
+        card = intrev32ifbe(card);
+        if (j && key <= r->c[j-1].key) goto invalid;
+        if (card == 0 || card > 0x10000) goto invalid;
+
+        if (type == ROARING_ARRAY) {
+            uint16_t *a;
+
+            if (card > ROARING_ARRAY_MAX ||
+                (size_t)(end-p) < card*sizeof(uint16_t)) goto invalid;
+            a = zmalloc(sizeof(uint16_t)*card);
+            for (k = 0; k < card; k++) {
+                memcpy(&u16,p,2); p += 2;
+                a[k] = intrev16ifbe(u16);
+                if (k && a[k] <= prev) {
+                    zfree(a);
+                    goto invalid;
+                }
+                prev = a[k];
+            }
+            data = a;
+            maxbit = ((uint64_t)key << 16)+a[card-1];
+        } else if (type == ROARING_BITMAP) {
+            unsigned char *bm;
+            int32_t last = 0xffff;
+
+            if (end-p < ROARING_BITMAP_BYTES ||
+                roaringPopcount(p,ROARING_BITMAP_BYTES) != card) goto invalid;
+            bm = zmalloc(ROARING_BITMAP_BYTES);
+            memcpy(bm,p,ROARING_BITMAP_BYTES);
+            p += ROARING_BITMAP_BYTES;
+            while (!bitmapGet(bm,last)) last--;
+            data = bm;
+            maxbit = ((uint64_t)key << 16)+last;
+        } else {
+            goto invalid;
+        }
+        containerInsert(r,j,key,type,card,type == ROARING_ARRAY ? card : 0,
+                        data);
+    }
+    if (p != end || (r->numc && maxbit >= r->len*8)) goto invalid;
+    return r;
+
+invalid:
+    roaringFree(r);
+    return NULL;
+}
+
+#ifdef REDIS_TEST
+#include "testhelp.h"
+#define UNUSED(x) (void)(x)
+
+/* Check the bitmap against the equivalent string 'buf'. */
+static int roaringMatchesBuffer(roaring *r, unsigned char *buf, uint64_t len) {
+    unsigned char *out = zmalloc(len);
+    int ok;
+
+    roaringGetRange(r,0,out,len);
+    ok = r->len == len && memcmp(out,buf,len) == 0 &&
+         r->card == roaringPopcount(buf,len);
+    zfree(out);
+    return ok;
+}
+
+int roaringTest(int argc, char *argv[]) {
+    uint64_t len = 1024*1024, j;
+    unsigned char *buf = zcalloc(len);
+    roaring *r = roaringNew(0), *d, *src[3];
+    unsigned char *blob;
+    size_t bloblen;
+    int iter;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(1234);
+
+    /* Random SETBITs, with dense and sparse regions. */
+    for (iter = 0; iter < 200000; iter++) {
+        uint64_t bit = (iter & 1) ? (uint64_t)rand() % (len*8) :
+                                     (uint64_t)rand() % 200000;
+        int value = rand() % 3 != 0;
+        int old = (buf[bit/8] >> (7-(bit&7))) & 1;
+
+        if (value) buf[bit/8] |= 1 << (7-(bit&7));
+        else buf[bit/8] &= ~(1 << (7-(bit&7)));
+        if (roaringSetBit(r,bit,value) != old) break;
+    }
+    roaringSetBit(r,len*8-1,0);
+    test_cond("SETBIT matches the string", iter == 200000 &&
+              roaringMatchesBuffer(r,buf,len));
+
+    for (iter = 0; iter < 10000; iter++) {
+        uint64_t bit = rand() % (len*8);
+        if (roaringGetBit(r,bit) != ((buf[bit/8] >> (7-(bit&7))) & 1)) break;
+    }
+    test_cond("GETBIT matches the string", iter == 10000);
+
+    for (iter = 0; iter < 1000; iter++) {
+        uint64_t start = rand() % len, end = rand() % len;
+        if (start > end) { j = start; start = end; end = j; }
+        if (roaringCount(r,start*8,end*8+7) !=
+            roaringPopcount(buf+start,end-start+1)) break;
+    }
+    test_cond("Count matches the string", iter == 1000);
+
+    for (iter = 0; iter < 1000; iter++) {
+        uint64_t start = rand() % (len*8), end = rand() % (len*8);
+        int value = iter & 1;
+        int64_t expected = -1;
+
+        if (start > end) { j = start; start = end; end = j; }
+        for (j = start; j <= end; j++) {
+            if (((buf[j/8] >> (7-(j&7))) & 1) == value) {
+                expected = j;
+                break;
+            }
+        }
+        if (roaringFirst(r,value,start,end) != expected) break;
+    }
+    test_cond("First bit matches the string", iter == 1000);
+
+    d = roaringFromBuffer(buf,len);
+    test_cond("Create from string", roaringMatchesBuffer(d,buf,len));
+    roaringFree(d);
+
+    blob = roaringSerialize(r,&bloblen);
+    d = roaringDeserialize(blob,bloblen);
+    test_cond("Serialize and deserialize",
+              d && roaringMatchesBuffer(d,buf,len));
+    if (d) roaringFree(d);
+    test_cond("Deserialize rejects truncated input",
+              roaringDeserialize(blob,bloblen-1) == NULL);
+    zfree(blob);
+
+    {
+        unsigned char *other = zmalloc(len), *expected = zmalloc(len);
+        int op;
+
+        for (j = 0; j < len; j++) other[j] = (j % 3000 < 10) ? rand() : 0;
+        src[0] = r;
+        src[1] = roaringFromBuffer(other,len);
+        src[2] = roaringDup(r);
+        for (op = ROARING_AND; op <= ROARING_XOR; op++) {
+            for (j = 0; j < len; j++) {
+                switch(op) {
+                case ROARING_AND: expected[j] = buf[j] & other[j]; break;
+                case ROARING_OR:  expected[j] = buf[j] | other[j]; break;
+                case ROARING_XOR: expected[j] = buf[j] ^ other[j]; break;
+                }
+            }
+            d = roaringOp(op,src,2,len);
+            test_cond("AND/OR/XOR match the string",
+                      roaringMatchesBuffer(d,expected,len));
+            roaringFree(d);
+        }
+        roaringFree(src[1]);
+        roaringFree(src[2]);
+        zfree(other);
+        zfree(expected);
+    }
+
+    roaringFree(r);
+    zfree(buf);
+    test_report();
+    return 0;
+}
+#endif
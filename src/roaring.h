@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ROARING_H
+#define __ROARING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A roaring bitmap splits the bit offsets into chunks of 65536 bits sharing
+ * the same 16 high bits. Every chunk with at least one bit set is stored in
+ * a container, that is either a sorted array of the 16 low bits of the set
+ * bits (for sparse chunks), or a plain 8192 bytes bitmap. Bitmap containers
+ * use the same bit ordering as Redis strings, so the bitmap represents the
+ * string obtained concatenating the containers, padded with zero bytes. */
+#define ROARING_ARRAY 0
+#define ROARING_BITMAP 1
+
+#define ROARING_ARRAY_MAX 4096      /* Max elements of an array container. */
+#define ROARING_BITMAP_BYTES 8192   /* Size of a bitmap container. */
+
+#define ROARING_AND 0
+#define ROARING_OR 1
+#define ROARING_XOR 2
+
+typedef struct roaringContainer {
+    uint16_t key;       /* High 16 bits of the offsets in this container. */
+    uint16_t type;      /* ROARING_ARRAY or ROARING_BITMAP. */
+    uint32_t card;      /* Number of bits set, never zero. */
+    uint32_t alloc;     /* Allocated elements of array containers. */
+    void *data;         /* uint16_t array or ROARING_BITMAP_BYTES bytes. */
+} roaringContainer;
+
+typedef struct roaring {
+    uint64_t len;       /* Length in bytes of the equivalent string. */
+    uint64_t card;      /* Total number of bits set. */
+    size_t bytes;       /* Memory used by the containers data. */
+    uint32_t numc;      /* Number of containers. */
+    roaringContainer *c; /* Containers, sorted by key. */
+} roaring;
+
+roaring *roaringNew(uint64_t len);
+void roaringFree(roaring *r);
+roaring *roaringDup(roaring *r);
+int roaringSetBit(roaring *r, uint64_t bit, int value);
+int roaringGetBit(roaring *r, uint64_t bit);
+uint64_t roaringCount(roaring *r, uint64_t start, uint64_t end);
+int64_t roaringFirst(roaring *r, int value, uint64_t start, uint64_t end);
+void roaringGetRange(roaring *r, uint64_t start, unsigned char *buf,
+                     uint64_t count);
+roaring *roaringFromBuffer(unsigned char *buf, uint64_t len);
+roaring *roaringOp(int op, roaring **src, unsigned long numsrc, uint64_t len);
+size_t roaringMemory(roaring *r);
+unsigned char *roaringSerialize(roaring *r, size_t *len);
+roaring *roaringDeserialize(unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int roaringTest(int argc, char *argv[]);
+#endif
+
+#endif
@@ -32,6 +32,7 @@
 #include "slowlog.h"
 #include "bio.h"
 #include "latency.h"
+#include "geohash.h"
 
 #include <time.h>
 #include <signal.h>
@@ -54,6 +55,9 @@
 #include <sys/utsname.h>
 #include <locale.h>
 #include <sys/socket.h>
+#ifdef HAVE_IOPRIO
+#include <sys/syscall.h>
+#endif
 
 /* Our shared "common" objects */
 
@@ -209,6 +213,15 @@ struct redisCommand redisCommandTable[] = {
     {"hgetall",hgetallCommand,2,"r",0,NULL,1,1,1,0,0},
     {"hexists",hexistsCommand,3,"rF",0,NULL,1,1,1,0,0},
     {"hscan",hscanCommand,-3,"rR",0,NULL,1,1,1,0,0},
+    {"hexpire",hexpireCommand,-6,"wF",0,NULL,1,1,1,0,0},
+    {"hpexpire",hpexpireCommand,-6,"wF",0,NULL,1,1,1,0,0},
+    {"hexpireat",hexpireatCommand,-6,"wF",0,NULL,1,1,1,0,0},
+    {"hpexpireat",hpexpireatCommand,-6,"wF",0,NULL,1,1,1,0,0},
+    {"httl",httlCommand,-5,"rF",0,NULL,1,1,1,0,0},
+    {"hpttl",hpttlCommand,-5,"rF",0,NULL,1,1,1,0,0},
+    {"hexpiretime",hexpiretimeCommand,-5,"rF",0,NULL,1,1,1,0,0},
+    {"hpexpiretime",hpexpiretimeCommand,-5,"rF",0,NULL,1,1,1,0,0},
+    {"hpersist",hpersistCommand,-5,"wF",0,NULL,1,1,1,0,0},
     {"incrby",incrbyCommand,3,"wmF",0,NULL,1,1,1,0,0},
     {"decrby",decrbyCommand,3,"wmF",0,NULL,1,1,1,0,0},
     {"incrbyfloat",incrbyfloatCommand,3,"wmF",0,NULL,1,1,1,0,0},
@@ -288,9 +301,58 @@ struct redisCommand redisCommandTable[] = {
     {"georadius_ro",georadiusroCommand,-6,"r",0,georadiusGetKeys,1,1,1,0,0},
     {"georadiusbymember",georadiusbymemberCommand,-5,"w",0,georadiusGetKeys,1,1,1,0,0},
     {"georadiusbymember_ro",georadiusbymemberroCommand,-5,"r",0,georadiusGetKeys,1,1,1,0,0},
+    {"geosearch",geosearchCommand,-7,"r",0,NULL,1,1,1,0,0},
+    {"geosearchstore",geosearchstoreCommand,-8,"wm",0,NULL,1,2,1,0,0},
     {"geohash",geohashCommand,-2,"r",0,NULL,1,1,1,0,0},
     {"geopos",geoposCommand,-2,"r",0,NULL,1,1,1,0,0},
     {"geodist",geodistCommand,-4,"r",0,NULL,1,1,1,0,0},
+    {"xadd",xaddCommand,-5,"wmFR",0,NULL,1,1,1,0,0},
+    {"xrange",xrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
+    {"xrevrange",xrevrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
+    {"xlen",xlenCommand,2,"rF",0,NULL,1,1,1,0,0},
+    {"xread",xreadCommand,-4,"rs",0,xreadGetKeys,1,1,1,0,0},
+    {"xreadgroup",xreadCommand,-7,"ws",0,xreadGetKeys,1,1,1,0,0},
+    {"xgroup",xgroupCommand,-2,"wm",0,NULL,2,2,1,0,0},
+    {"xsetid",xsetidCommand,3,"wmF",0,NULL,1,1,1,0,0},
+    {"xack",xackCommand,-4,"wF",0,NULL,1,1,1,0,0},
+    {"xpending",xpendingCommand,-3,"rR",0,NULL,1,1,1,0,0},
+    {"xclaim",xclaimCommand,-6,"wRF",0,NULL,1,1,1,0,0},
+    {"xinfo",xinfoCommand,-2,"rR",0,NULL,2,2,1,0,0},
+    {"xdel",xdelCommand,-3,"wF",0,NULL,1,1,1,0,0},
+    {"xtrim",xtrimCommand,-2,"wFR",0,NULL,1,1,1,0,0},
+    {"bf.reserve",bfreserveCommand,-4,"wm",0,NULL,1,1,1,0,0},
+    {"bf.add",bfaddCommand,3,"wmF",0,NULL,1,1,1,0,0},
+    {"bf.madd",bfaddCommand,-3,"wmF",0,NULL,1,1,1,0,0},
+    {"bf.exists",bfexistsCommand,3,"rF",0,NULL,1,1,1,0,0},
+    {"bf.mexists",bfexistsCommand,-3,"rF",0,NULL,1,1,1,0,0},
+    {"bf.info",bfinfoCommand,2,"r",0,NULL,1,1,1,0,0},
+    {"cf.reserve",cfreserveCommand,-3,"wm",0,NULL,1,1,1,0,0},
+    {"cf.add",cfaddCommand,3,"wmF",0,NULL,1,1,1,0,0},
+    {"cf.addnx",cfaddCommand,3,"wmF",0,NULL,1,1,1,0,0},
+    {"cf.exists",cfexistsCommand,3,"rF",0,NULL,1,1,1,0,0},
+    {"cf.mexists",cfexistsCommand,-3,"rF",0,NULL,1,1,1,0,0},
+    {"cf.count",cfcountCommand,3,"rF",0,NULL,1,1,1,0,0},
+    {"cf.del",cfdelCommand,3,"wF",0,NULL,1,1,1,0,0},
+    {"cf.info",cfinfoCommand,2,"r",0,NULL,1,1,1,0,0},
+    {"cms.initbydim",cmsinitbydimCommand,4,"wm",0,NULL,1,1,1,0,0},
+    {"cms.initbyprob",cmsinitbyprobCommand,4,"wm",0,NULL,1,1,1,0,0},
+    {"cms.incrby",cmsincrbyCommand,-4,"wmF",0,NULL,1,1,1,0,0},
+    {"cms.query",cmsqueryCommand,-3,"rF",0,NULL,1,1,1,0,0},
+    {"cms.merge",cmsmergeCommand,-4,"wm",0,zunionInterGetKeys,1,1,1,0,0},
+    {"cms.info",cmsinfoCommand,2,"r",0,NULL,1,1,1,0,0},
+    {"topk.reserve",topkreserveCommand,-3,"wm",0,NULL,1,1,1,0,0},
+    {"topk.add",topkaddCommand,-3,"wm",0,NULL,1,1,1,0,0},
+    {"topk.incrby",topkincrbyCommand,-4,"wm",0,NULL,1,1,1,0,0},
+    {"topk.query",topkqueryCommand,-3,"r",0,NULL,1,1,1,0,0},
+    {"topk.count",topkcountCommand,-3,"r",0,NULL,1,1,1,0,0},
+    {"topk.list",topklistCommand,-2,"r",0,NULL,1,1,1,0,0},
+    {"topk.merge",topkmergeCommand,-4,"wm",0,zunionInterGetKeys,1,1,1,0,0},
+    {"topk.info",topkinfoCommand,2,"r",0,NULL,1,1,1,0,0},
+    {"ts.create",tscreateCommand,-2,"wm",0,NULL,1,1,1,0,0},
+    {"ts.add",tsaddCommand,-4,"wmF",0,NULL,1,1,1,0,0},
+    {"ts.get",tsgetCommand,2,"rF",0,NULL,1,1,1,0,0},
+    {"ts.range",tsrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
+    {"ts.info",tsinfoCommand,2,"r",0,NULL,1,1,1,0,0},
     {"pfselftest",pfselftestCommand,1,"a",0,NULL,0,0,0,0,0},
     {"pfadd",pfaddCommand,-2,"wmF",0,NULL,1,1,1,0,0},
     {"pfcount",pfcountCommand,-2,"r",0,NULL,1,-1,1,0,0},
@@ -420,6 +482,27 @@ void exitFromChild(int retcode) {
 #endif
 }
 
+/* Set the I/O scheduling class configured with child-io-class for the
+ * calling process. Called by the persistence children after fork(), so
+ * that they compete less with the parent for the disk. The class is only
+ * honored by the I/O schedulers that support priorities (CFQ, BFQ). */
+void setChildIOClass(void) {
+#ifdef HAVE_IOPRIO
+    int ioprio;
+
+    /* See include/linux/ioprio.h. */
+    switch(server.child_io_class) {
+    case CHILD_IO_CLASS_BEST_EFFORT: ioprio = (2 << 13) | 7; break;
+    case CHILD_IO_CLASS_IDLE: ioprio = 3 << 13; break;
+    default: return;
+    }
+    if (syscall(SYS_ioprio_set,1 /* IOPRIO_WHO_PROCESS */,0,ioprio) == -1) {
+        serverLog(LL_WARNING,"Can't set the I/O class of the child: %s",
+            strerror(errno));
+    }
+#endif
+}
+
 /*====================== Hash table type implementation  ==================== */
 
 /* This is a hash table type that uses the SDS dynamic strings library as
@@ -475,6 +558,14 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+void dictHashFieldExpiresDestructor(void *privdata, void *val)
+{
+    DICT_NOTUSED(privdata);
+
+    if (val == NULL) return; /* Detached by moveHashFieldExpires(). */
+    hashFieldExpiresRelease(val);
+}
+
 int dictObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -546,6 +637,17 @@ dictType setDictType = {
     NULL                       /* val destructor */
 };
 
+/* Dict of Redis objects mapped to heap allocated values that are freed
+ * with the dict, like the stream IDs clients blocked in XREAD wait for. */
+dictType objectKeyHeapPointerValueDictType = {
+    dictEncObjHash,            /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictEncObjKeyCompare,      /* key compare */
+    dictObjectDestructor,      /* key destructor */
+    dictVanillaFree            /* val destructor */
+};
+
 /* Sorted sets hash (note: a skiplist is used in addition to the hash table) */
 dictType zsetDictType = {
     dictEncObjHash,            /* hash function */
@@ -586,6 +688,37 @@ dictType keyptrDictType = {
     NULL                       /* val destructor */
 };
 
+/* Db->hexpires. The key is shared with the main dictionary, the value
+ * is the hashFieldExpires structure holding the volatile fields. */
+dictType hashFieldExpiresDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    NULL,                      /* key destructor */
+    dictHashFieldExpiresDestructor /* val destructor */
+};
+
+/* hashFieldExpires->fields. sds field -> unix time in milliseconds. */
+dictType fieldExpireDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
+/* Set of sds keys, like the keys a forkless BGSAVE must skip. */
+dictType sdsSetDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
 /* Command table. sds string -> command struct pointer. */
 dictType commandTableDictType = {
     dictSdsCaseHash,           /* hash function */
@@ -746,6 +879,26 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
     }
 }
 
+/* Helper function for the activeExpireCycle() function.
+ * Reclaims the expired fields of the hash referenced by the hexpires
+ * dictionary entry 'de', if its earliest field expire already elapsed.
+ *
+ * If at least one field was expired 1 is returned, otherwise 0. */
+int activeExpireCycleTryExpireFields(redisDb *db, dictEntry *de, long long now) {
+    hashFieldExpires *hfe = dictGetVal(de);
+    sds key;
+    robj *keyobj;
+    long expired;
+
+    if (hfe->next > now) return 0;
+    key = dictGetKey(de);
+    keyobj = createStringObject(key,sdslen(key));
+    /* Note that 'de' and 'hfe' may be released by the call below. */
+    expired = hashExpireFields(db,keyobj,hfe,now);
+    decrRefCount(keyobj);
+    return expired > 0;
+}
+
 /* Try to expire a few timed out keys. The algorithm used is adaptive and
  * will use few CPU cycles if there are few expiring keys, otherwise
  * it will get more aggressive to avoid that too much memory is used by
@@ -892,6 +1045,42 @@ void activeExpireCycle(int type) {
             /* We don't repeat the cycle if there are less than 25% of keys
              * found expired in the current DB. */
         } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4);
+
+        /* Now do the same for hashes having fields with an expire set.
+         * Every entry of db->hexpires caches a lower bound of the earliest
+         * field expire, so sampled hashes with nothing to reclaim cost a
+         * single comparison. */
+        do {
+            unsigned long num, slots;
+            long long now;
+
+            if ((num = dictSize(db->hexpires)) == 0) break;
+            slots = dictSlots(db->hexpires);
+            now = mstime();
+
+            if (num && slots > DICT_HT_INITIAL_SIZE &&
+                (num*100/slots < 1)) break;
+
+            expired = 0;
+            if (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
+                num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
+
+            while (num--) {
+                dictEntry *de;
+
+                if ((de = dictGetRandomKey(db->hexpires)) == NULL) break;
+                if (activeExpireCycleTryExpireFields(db,de,now)) expired++;
+            }
+
+            iteration++;
+            if ((iteration & 0xf) == 0) { /* check once every 16 iterations. */
+                long long elapsed = ustime()-start;
+
+                latencyAddSampleIfNeeded("expire-cycle",elapsed/1000);
+                if (elapsed > timelimit) timelimit_exit = 1;
+            }
+            if (timelimit_exit) return;
+        } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4);
     }
 }
 
@@ -1034,8 +1223,11 @@ void databasesCron(void) {
 
     /* Perform hash tables rehashing if needed, but only if there are no
      * other processes saving the DB on disk. Otherwise rehashing is bad
-     * as will cause a lot of copy-on-write of memory pages. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+     * as will cause a lot of copy-on-write of memory pages. A forkless
+     * BGSAVE instead needs the keys to stay where they are. */
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+        !server.rdb_snapshot_active)
+    {
         /* We use global counters so if we stop the computation at a given
          * DB we'll be able to start from the successive in the next
          * cron loop iteration. */
@@ -1182,7 +1374,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+    if (!rdbBgsaveInProgress() && server.aof_child_pid == -1 &&
         server.aof_rewrite_scheduled)
     {
         rewriteAppendOnlyFileBackground();
@@ -1195,6 +1387,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         int statloc;
         pid_t pid;
 
+        receiveChildInfo();
         if ((pid = wait3(&statloc,WNOHANG,NULL)) != 0) {
             int exitcode = WEXITSTATUS(statloc);
             int bysignal = 0;
@@ -1208,8 +1401,12 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                     (int) server.rdb_child_pid,
                     (int) server.aof_child_pid);
             } else if (pid == server.rdb_child_pid) {
+                receiveChildInfo();
+                closeChildInfoPipe();
                 backgroundSaveDoneHandler(exitcode,bysignal);
             } else if (pid == server.aof_child_pid) {
+                receiveChildInfo();
+                closeChildInfoPipe();
                 backgroundRewriteDoneHandler(exitcode,bysignal);
             } else {
                 if (!ldbRemoveChild(pid)) {
@@ -1220,7 +1417,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             }
             updateDictResizePolicy();
         }
-    } else {
+    } else if (!server.rdb_snapshot_active) {
         /* If there is not a background saving/rewrite in progress check if
          * we have to save/rewrite now */
          for (j = 0; j < server.saveparamslen; j++) {
@@ -1238,7 +1435,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             {
                 serverLog(LL_NOTICE,"%d changes in %d seconds. Saving...",
                     sp->changes, (int)sp->seconds);
-                rdbSaveBackground(server.rdb_filename);
+                if (server.rdb_delta)
+                    rdbSaveDeltaBackground();
+                else
+                    rdbSaveBackground(server.rdb_filename);
                 break;
             }
          }
@@ -1305,7 +1505,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
      * Note: this code must be after the replicationCron() call above so
      * make sure when refactoring this file to keep this order. This is useful
      * because we want to give priority to RDB savings for replication. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+    if (!rdbBgsaveInProgress() && server.aof_child_pid == -1 &&
         server.rdb_bgsave_scheduled &&
         (server.unixtime-server.lastbgsave_try > CONFIG_BGSAVE_RETRY_DELAY ||
          server.lastbgsave_status == C_OK))
@@ -1441,7 +1641,8 @@ void createSharedObjects(void) {
     shared.lpop = createStringObject("LPOP",4);
     shared.lpush = createStringObject("LPUSH",5);
     for (j = 0; j < OBJ_SHARED_INTEGERS; j++) {
-        shared.integers[j] = createObject(OBJ_STRING,(void*)(long)j);
+        shared.integers[j] =
+            makeObjectShared(createObject(OBJ_STRING,(void*)(long)j));
         shared.integers[j]->encoding = OBJ_ENCODING_INT;
     }
     for (j = 0; j < OBJ_SHARED_BULKHDR_LEN; j++) {
@@ -1483,6 +1684,7 @@ void initServerConfig(void) {
     server.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN;
     server.saveparams = NULL;
     server.loading = 0;
+    server.async_loading = 0;
     server.logfile = zstrdup(CONFIG_DEFAULT_LOGFILE);
     server.syslog_enabled = CONFIG_DEFAULT_SYSLOG_ENABLED;
     server.syslog_ident = zstrdup(CONFIG_DEFAULT_SYSLOG_IDENT);
@@ -1496,6 +1698,8 @@ void initServerConfig(void) {
     server.aof_rewrite_perc = AOF_REWRITE_PERC;
     server.aof_rewrite_min_size = AOF_REWRITE_MIN_SIZE;
     server.aof_rewrite_base_size = 0;
+    server.aof_last_incr_size = 0;
+    server.aof_rewrite_incr_seq = 0;
     server.aof_rewrite_scheduled = 0;
     server.aof_last_fsync = time(NULL);
     server.aof_rewrite_time_last = -1;
@@ -1506,13 +1710,20 @@ void initServerConfig(void) {
     server.aof_selected_db = -1; /* Make sure the first time will not match */
     server.aof_flush_postponed_start = 0;
     server.aof_rewrite_incremental_fsync = CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC;
+    server.child_max_write_rate = CONFIG_DEFAULT_CHILD_MAX_WRITE_RATE;
+    server.child_io_class = CONFIG_DEFAULT_CHILD_IO_CLASS;
     server.aof_load_truncated = CONFIG_DEFAULT_AOF_LOAD_TRUNCATED;
+    server.aof_use_rdb_preamble = CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE;
     server.pidfile = NULL;
     server.rdb_filename = zstrdup(CONFIG_DEFAULT_RDB_FILENAME);
     server.aof_filename = zstrdup(CONFIG_DEFAULT_AOF_FILENAME);
     server.requirepass = NULL;
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
+    server.rdb_compression_codec = CONFIG_DEFAULT_RDB_COMPRESSION_CODEC;
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
+    server.rdb_load_threads = CONFIG_DEFAULT_RDB_LOAD_THREADS;
+    server.rdb_delta = CONFIG_DEFAULT_RDB_DELTA;
+    server.rdb_delta_max_chain = CONFIG_DEFAULT_RDB_DELTA_MAX_CHAIN;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
     server.notify_keyspace_events = 0;
@@ -1528,7 +1739,13 @@ void initServerConfig(void) {
     server.set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
     server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
+    server.zset_large_encoding = OBJ_ZSET_LARGE_ENCODING;
+    server.stream_node_max_bytes = OBJ_STREAM_NODE_MAX_BYTES;
+    server.stream_node_max_entries = OBJ_STREAM_NODE_MAX_ENTRIES;
     server.hll_sparse_max_bytes = CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES;
+    server.pfcount_cache_max_memory = CONFIG_DEFAULT_PFCOUNT_CACHE_MAX_MEMORY;
+    server.string_compress_threshold = OBJ_STRING_COMPRESS_THRESHOLD;
+    server.bitmap_roaring_min_bytes = OBJ_BITMAP_ROARING_MIN_BYTES;
     server.shutdown_asap = 0;
     server.repl_ping_slave_period = CONFIG_DEFAULT_REPL_PING_SLAVE_PERIOD;
     server.repl_timeout = CONFIG_DEFAULT_REPL_TIMEOUT;
@@ -1566,6 +1783,8 @@ void initServerConfig(void) {
     server.repl_disable_tcp_nodelay = CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY;
     server.repl_diskless_sync = CONFIG_DEFAULT_REPL_DISKLESS_SYNC;
     server.repl_diskless_sync_delay = CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY;
+    server.repl_forkless_sync = CONFIG_DEFAULT_REPL_FORKLESS_SYNC;
+    server.repl_diskless_load = CONFIG_DEFAULT_REPL_DISKLESS_LOAD;
     server.slave_priority = CONFIG_DEFAULT_SLAVE_PRIORITY;
     server.slave_announce_ip = CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP;
     server.slave_announce_port = CONFIG_DEFAULT_SLAVE_ANNOUNCE_PORT;
@@ -1605,6 +1824,8 @@ void initServerConfig(void) {
     server.execCommand = lookupCommandByCString("exec");
     server.expireCommand = lookupCommandByCString("expire");
     server.pexpireCommand = lookupCommandByCString("pexpire");
+    server.xclaimCommand = lookupCommandByCString("xclaim");
+    server.hdelCommand = lookupCommandByCString("hdel");
 
     /* Slow log */
     server.slowlog_log_slower_than = CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN;
@@ -1851,9 +2072,12 @@ void resetServerStats(void) {
     server.stat_numcommands = 0;
     server.stat_numconnections = 0;
     server.stat_expiredkeys = 0;
+    server.stat_expiredfields = 0;
     server.stat_evictedkeys = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
+    server.stat_pfcount_cache_hits = 0;
+    server.stat_pfcount_cache_misses = 0;
     server.stat_fork_time = 0;
     server.stat_fork_rate = 0;
     server.stat_rejected_conn = 0;
@@ -1931,6 +2155,7 @@ void initServer(void) {
     for (j = 0; j < server.dbnum; j++) {
         server.db[j].dict = dictCreate(&dbDictType,NULL);
         server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        server.db[j].hexpires = dictCreate(&hashFieldExpiresDictType,NULL);
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&setDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
@@ -1942,12 +2167,31 @@ void initServer(void) {
     server.pubsub_patterns = listCreate();
     listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
     listSetMatchMethod(server.pubsub_patterns,listMatchPubsubPattern);
+    pfcountCacheInit();
     server.cronloops = 0;
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
     server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+    server.child_info_pipe[0] = server.child_info_pipe[1] = -1;
+    server.child_info_type = CHILD_INFO_TYPE_RDB;
+    server.in_fork_child = 0;
+    server.stat_current_cow_bytes = 0;
+    server.stat_current_cow_peak = 0;
+    server.stat_current_save_keys_processed = 0;
+    server.stat_current_save_keys_total = 0;
+    server.stat_current_save_bytes = 0;
+    server.stat_rdb_cow_bytes = 0;
+    server.stat_aof_cow_bytes = 0;
+    server.stat_current_save_write_rate = 0;
+    server.stat_rdb_write_rate = 0;
+    server.stat_aof_write_rate = 0;
+    server.rdb_snapshot_active = 0;
+    server.rdb_snapshot_cow_keys = 0;
+    server.rdb_snapshot_id[0] = '\0';
+    server.rdb_save_snapshot_id[0] = '\0';
+    rdbDeltaReset();
     server.rdb_bgsave_scheduled = 0;
-    aofRewriteBufferReset();
+    server.aof_manifest = aofManifestCreate();
     server.aof_buf = sdsempty();
     server.lastsave = time(NULL); /* At startup we consider the DB saved. */
     server.lastbgsave_try = 0;    /* At startup we never tried to BGSAVE. */
@@ -1958,6 +2202,8 @@ void initServer(void) {
     /* A few stats we don't want to reset: server startup time, and peak mem. */
     server.stat_starttime = time(NULL);
     server.stat_peak_memory = 0;
+    server.lzf_strings = 0;
+    server.lzf_strings_saved = 0;
     server.resident_set_size = 0;
     server.lastbgsave_status = C_OK;
     server.aof_last_write_status = C_OK;
@@ -1985,17 +2231,6 @@ void initServer(void) {
     if (server.sofd > 0 && aeCreateFileEvent(server.el,server.sofd,AE_READABLE,
         acceptUnixHandler,NULL) == AE_ERR) serverPanic("Unrecoverable error creating server.sofd file event.");
 
-    /* Open the AOF file if needed. */
-    if (server.aof_state == AOF_ON) {
-        server.aof_fd = open(server.aof_filename,
-                               O_WRONLY|O_APPEND|O_CREAT,0644);
-        if (server.aof_fd == -1) {
-            serverLog(LL_WARNING, "Can't open the append-only file: %s",
-                strerror(errno));
-            exit(1);
-        }
-    }
-
     /* 32 bit instances are limited to 4GB of address space, so if there is
      * no explicit limit in the user provided configuration we set a limit
      * at 3 GB using maxmemory with 'noeviction' policy'. This avoids
@@ -2517,6 +2752,14 @@ int processCommand(client *c) {
         return C_OK;
     }
 
+    /* Loading the master's dataset aside? The old one only serves reads. */
+    if (server.async_loading &&
+        !(c->cmd->flags & (CMD_READONLY|CMD_LOADING)))
+    {
+        addReply(c, shared.loadingerr);
+        return C_OK;
+    }
+
     /* Lua script too slow? Only allow a limited number of commands. */
     if (server.lua_timedout &&
           c->cmd->proc != authCommand &&
@@ -2544,7 +2787,7 @@ int processCommand(client *c) {
         call(c,CMD_CALL_FULL);
         c->woff = server.master_repl_offset;
         if (listLength(server.ready_keys))
-            handleClientsBlockedOnLists();
+            handleClientsBlockedOnKeys();
     }
     return C_OK;
 }
@@ -2583,6 +2826,7 @@ int prepareForShutdown(int flags) {
         kill(server.rdb_child_pid,SIGUSR1);
         rdbRemoveTempFile(server.rdb_child_pid);
     }
+    rdbSnapshotAbort();
 
     if (server.aof_state != AOF_OFF) {
         /* Kill the AOF saving child as the AOF we already have may be longer
@@ -2956,6 +3200,7 @@ sds genRedisInfoString(char *section) {
         char used_memory_lua_hmem[64];
         char used_memory_rss_hmem[64];
         char maxmemory_hmem[64];
+        char lzf_saved_hmem[64];
         size_t zmalloc_used = zmalloc_used_memory();
         size_t total_system_mem = server.system_memory_size;
         const char *evict_policy = evictPolicyToString();
@@ -2974,6 +3219,7 @@ sds genRedisInfoString(char *section) {
         bytesToHuman(used_memory_lua_hmem,memory_lua);
         bytesToHuman(used_memory_rss_hmem,server.resident_set_size);
         bytesToHuman(maxmemory_hmem,server.maxmemory);
+        bytesToHuman(lzf_saved_hmem,server.lzf_strings_saved);
 
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
@@ -2992,7 +3238,10 @@ sds genRedisInfoString(char *section) {
             "maxmemory_human:%s\r\n"
             "maxmemory_policy:%s\r\n"
             "mem_fragmentation_ratio:%.2f\r\n"
-            "mem_allocator:%s\r\n",
+            "mem_allocator:%s\r\n"
+            "lzf_strings:%llu\r\n"
+            "lzf_strings_saved:%lld\r\n"
+            "lzf_strings_saved_human:%s\r\n",
             zmalloc_used,
             hmem,
             server.resident_set_size,
@@ -3007,7 +3256,10 @@ sds genRedisInfoString(char *section) {
             maxmemory_hmem,
             evict_policy,
             zmalloc_get_fragmentation_ratio(server.resident_set_size),
-            ZMALLOC_LIB
+            ZMALLOC_LIB,
+            server.lzf_strings,
+            server.lzf_strings_saved,
+            lzf_saved_hmem
             );
     }
 
@@ -3017,27 +3269,45 @@ sds genRedisInfoString(char *section) {
         info = sdscatprintf(info,
             "# Persistence\r\n"
             "loading:%d\r\n"
+            "async_loading:%d\r\n"
             "rdb_changes_since_last_save:%lld\r\n"
             "rdb_bgsave_in_progress:%d\r\n"
             "rdb_last_save_time:%jd\r\n"
             "rdb_last_bgsave_status:%s\r\n"
             "rdb_last_bgsave_time_sec:%jd\r\n"
             "rdb_current_bgsave_time_sec:%jd\r\n"
+            "rdb_forkless_bgsave_in_progress:%d\r\n"
+            "rdb_forkless_cow_keys:%lld\r\n"
             "aof_enabled:%d\r\n"
             "aof_rewrite_in_progress:%d\r\n"
             "aof_rewrite_scheduled:%d\r\n"
             "aof_last_rewrite_time_sec:%jd\r\n"
             "aof_current_rewrite_time_sec:%jd\r\n"
             "aof_last_bgrewrite_status:%s\r\n"
-            "aof_last_write_status:%s\r\n",
+            "aof_last_write_status:%s\r\n"
+            "current_cow_size:%zu\r\n"
+            "current_cow_peak:%zu\r\n"
+            "current_save_keys_processed:%lld\r\n"
+            "current_save_keys_total:%lld\r\n"
+            "current_save_bytes_written:%zu\r\n"
+            "current_save_write_rate:%lld\r\n"
+            "rdb_last_cow_size:%zu\r\n"
+            "rdb_last_write_rate:%lld\r\n"
+            "aof_last_cow_size:%zu\r\n"
+            "aof_last_write_rate:%lld\r\n"
+            "rdb_delta_chain_length:%d\r\n"
+            "rdb_delta_tracked_keys:%llu\r\n",
             server.loading,
+            server.async_loading,
             server.dirty,
-            server.rdb_child_pid != -1,
+            rdbBgsaveInProgress(),
             (intmax_t)server.lastsave,
             (server.lastbgsave_status == C_OK) ? "ok" : "err",
             (intmax_t)server.rdb_save_time_last,
-            (intmax_t)((server.rdb_child_pid == -1) ?
+            (intmax_t)(!rdbBgsaveInProgress() ?
                 -1 : time(NULL)-server.rdb_save_time_start),
+            server.rdb_snapshot_active,
+            server.rdb_snapshot_cow_keys,
             server.aof_state != AOF_OFF,
             server.aof_child_pid != -1,
             server.aof_rewrite_scheduled,
@@ -3045,7 +3315,19 @@ sds genRedisInfoString(char *section) {
             (intmax_t)((server.aof_child_pid == -1) ?
                 -1 : time(NULL)-server.aof_rewrite_time_start),
             (server.aof_lastbgrewrite_status == C_OK) ? "ok" : "err",
-            (server.aof_last_write_status == C_OK) ? "ok" : "err");
+            (server.aof_last_write_status == C_OK) ? "ok" : "err",
+            server.stat_current_cow_bytes,
+            server.stat_current_cow_peak,
+            server.stat_current_save_keys_processed,
+            server.stat_current_save_keys_total,
+            server.stat_current_save_bytes,
+            server.stat_current_save_write_rate,
+            server.stat_rdb_cow_bytes,
+            server.stat_rdb_write_rate,
+            server.stat_aof_cow_bytes,
+            server.stat_aof_write_rate,
+            server.rdb_delta_seq,
+            rdbDeltaTrackedKeys());
 
         if (server.aof_state != AOF_OFF) {
             info = sdscatprintf(info,
@@ -3053,14 +3335,12 @@ sds genRedisInfoString(char *section) {
                 "aof_base_size:%lld\r\n"
                 "aof_pending_rewrite:%d\r\n"
                 "aof_buffer_length:%zu\r\n"
-                "aof_rewrite_buffer_length:%lu\r\n"
                 "aof_pending_bio_fsync:%llu\r\n"
                 "aof_delayed_fsync:%lu\r\n",
                 (long long) server.aof_current_size,
                 (long long) server.aof_rewrite_base_size,
                 server.aof_rewrite_scheduled,
                 sdslen(server.aof_buf),
-                aofRewriteBufferSize(),
                 bioPendingJobsOfType(BIO_AOF_FSYNC),
                 server.aof_delayed_fsync);
         }
@@ -3114,13 +3394,18 @@ sds genRedisInfoString(char *section) {
             "sync_partial_ok:%lld\r\n"
             "sync_partial_err:%lld\r\n"
             "expired_keys:%lld\r\n"
+            "expired_fields:%lld\r\n"
             "evicted_keys:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
             "latest_fork_usec:%lld\r\n"
-            "migrate_cached_sockets:%ld\r\n",
+            "migrate_cached_sockets:%ld\r\n"
+            "pfcount_cache_entries:%lu\r\n"
+            "pfcount_cache_memory:%zu\r\n"
+            "pfcount_cache_hits:%lld\r\n"
+            "pfcount_cache_misses:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -3133,13 +3418,18 @@ sds genRedisInfoString(char *section) {
             server.stat_sync_partial_ok,
             server.stat_sync_partial_err,
             server.stat_expiredkeys,
+            server.stat_expiredfields,
             server.stat_evictedkeys,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
             listLength(server.pubsub_patterns),
             server.stat_fork_time,
-            dictSize(server.migrate_cached_sockets));
+            dictSize(server.migrate_cached_sockets),
+            dictSize(server.pfcount_cache),
+            server.pfcount_cache_memory,
+            server.stat_pfcount_cache_hits,
+            server.stat_pfcount_cache_misses);
     }
 
     /* Replication */
@@ -3499,7 +3789,6 @@ int freeMemoryIfNeeded(void) {
     }
     if (server.aof_state != AOF_OFF) {
         mem_used -= sdslen(server.aof_buf);
-        mem_used -= aofRewriteBufferSize();
     }
 
     /* Check if we are over the memory limit. */
@@ -3828,10 +4117,11 @@ int checkForSentinelMode(int argc, char **argv) {
 void loadDataFromDisk(void) {
     long long start = ustime();
     if (server.aof_state == AOF_ON) {
-        if (loadAppendOnlyFile(server.aof_filename) == C_OK)
+        if (loadAppendOnlyFiles(server.aof_manifest) == C_OK)
             serverLog(LL_NOTICE,"DB loaded from append only file: %.3f seconds",(float)(ustime()-start)/1000000);
     } else {
         if (rdbLoad(server.rdb_filename) == C_OK) {
+            rdbLoadDeltas(server.rdb_filename);
             serverLog(LL_NOTICE,"DB loaded from disk: %.3f seconds",
                 (float)(ustime()-start)/1000000);
         } else if (errno != ENOENT) {
@@ -3983,6 +4273,30 @@ int main(int argc, char **argv) {
             return endianconvTest(argc, argv);
         } else if (!strcasecmp(argv[2], "crc64")) {
             return crc64Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "lz4")) {
+            return lz4Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "bitops")) {
+            return bitopsTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "roaring")) {
+            return roaringTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "hyperloglog")) {
+            return hllTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "geo")) {
+            return geoTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "rax")) {
+            return raxTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "stream")) {
+            return streamTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "bloom")) {
+            return bloomTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "cuckoo")) {
+            return cuckooTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "cms")) {
+            return cmsTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "topk")) {
+            return topkTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "timeseries")) {
+            return tsTest(argc, argv);
         }
 
         return -1; /* test not found */
@@ -3999,6 +4313,8 @@ int main(int argc, char **argv) {
     srand(time(NULL)^getpid());
     gettimeofday(&tv,NULL);
     dictSetHashFunctionSeed(tv.tv_sec^tv.tv_usec^getpid());
+    crc64_init();
+    geohashSelectBMI2(cpuHasFeatures(CPU_FEATURE_BMI2));
     server.sentinel_mode = checkForSentinelMode(argc,argv);
     initServerConfig();
 
@@ -4017,11 +4333,14 @@ int main(int argc, char **argv) {
         initSentinel();
     }
 
-    /* Check if we need to start in redis-check-rdb mode. We just execute
+    /* Check if we need to start in redis-check-rdb/aof mode. We just execute
      * the program main. However the program is part of the Redis executable
-     * so that we can easily execute an RDB check on loading errors. */
+     * so that we can easily execute an RDB check on loading errors, and the
+     * AOF check can verify the RDB preamble of AOF files. */
     if (strstr(argv[0],"redis-check-rdb") != NULL)
         redis_check_rdb_main(argc,argv);
+    else if (strstr(argv[0],"redis-check-aof") != NULL)
+        redis_check_aof_main(argc,argv);
 
     if (argc >= 2) {
         j = 1; /* First option to parse in argv[] */
@@ -4107,6 +4426,8 @@ int main(int argc, char **argv) {
     #ifdef __linux__
         linuxMemoryWarnings();
     #endif
+        aofLoadManifestFromDisk();
+        aofOpenIfNeededOnServerStart();
         loadDataFromDisk();
         if (server.cluster_enabled) {
             if (verifyClusterConfigWithData() == C_ERR) {
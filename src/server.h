@@ -58,17 +58,26 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
 #include "intset.h"  /* Compact integer set structure */
+#include "roaring.h" /* Compressed bitmaps */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
+#include "cpufeatures.h" /* CPU features for the SIMD code paths */
 #include "latency.h" /* Latency monitor API */
 #include "sparkline.h" /* ASCII graphs API */
 #include "quicklist.h"
+#include "rax.h"     /* Radix trees */
+#include "stream.h"  /* Stream data type */
+#include "bloom.h"   /* Blocked Bloom filters */
+#include "cuckoo.h"  /* Cuckoo filters */
+#include "topk.h"    /* Count-min sketch and top-k */
+#include "timeseries.h" /* Compressed time series */
 
 /* Following includes allow test functions to be called from Redis main() */
 #include "zipmap.h"
 #include "sha1.h"
 #include "endianconv.h"
 #include "crc64.h"
+#include "lz4.h"
 
 /* Error codes */
 #define C_OK                    0
@@ -116,10 +125,17 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_SYSLOG_ENABLED 0
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
+#define CONFIG_DEFAULT_RDB_COMPRESSION_CODEC RDB_CODEC_LZF
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 4
+#define CONFIG_MAX_RDB_LOAD_THREADS 64
+#define CONFIG_DEFAULT_RDB_DELTA 0
+#define CONFIG_DEFAULT_RDB_DELTA_MAX_CHAIN 16
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
+#define CONFIG_DEFAULT_REPL_FORKLESS_SYNC 0
+#define CONFIG_DEFAULT_REPL_DISKLESS_LOAD REPL_DISKLESS_LOAD_DISABLED
 #define CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA 1
 #define CONFIG_DEFAULT_SLAVE_READ_ONLY 1
 #define CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP NULL
@@ -130,8 +146,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
 #define CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
+#define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 0
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
+#define CONFIG_DEFAULT_CHILD_MAX_WRITE_RATE 0
+#define CONFIG_DEFAULT_CHILD_IO_CLASS CHILD_IO_CLASS_DEFAULT
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
 #define CONFIG_DEFAULT_MIN_SLAVES_MAX_LAG 10
 #define NET_IP_STR_LEN 46 /* INET6_ADDRSTRLEN is 46, but we need to be sure */
@@ -194,6 +213,15 @@ typedef long long mstime_t; /* millisecond time type. */
 #define OBJ_SET 2
 #define OBJ_ZSET 3
 #define OBJ_HASH 4
+#define OBJ_STREAM 5
+#define OBJ_BLOOM 6
+#define OBJ_CUCKOO 7
+#define OBJ_CMS 8
+#define OBJ_TOPK 9
+#define OBJ_TIMESERIES 10
+
+/* Types persisted as a serialized blob, see serializeBlobObject(). */
+#define OBJ_TYPE_IS_BLOB(t) ((t) >= OBJ_BLOOM && (t) <= OBJ_TIMESERIES)
 
 /* Objects encoding. Some kind of objects like Strings and Hashes can be
  * internally represented in multiple ways. The 'encoding' field of the object
@@ -208,6 +236,15 @@ typedef long long mstime_t; /* millisecond time type. */
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
 #define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_BTREE 10  /* Encoded as B+tree with rank counts */
+#define OBJ_ENCODING_LZF 11    /* LZF compressed string */
+#define OBJ_ENCODING_ROARING 12 /* Roaring bitmap string */
+#define OBJ_ENCODING_STREAM 13 /* Radix tree of ziplists */
+#define OBJ_ENCODING_BLOOM 14  /* Scalable blocked Bloom filter */
+#define OBJ_ENCODING_CUCKOO 15 /* Scalable cuckoo filter */
+#define OBJ_ENCODING_CMS 16    /* Count-min sketch */
+#define OBJ_ENCODING_TOPK 17   /* Count-min sketch and min-heap */
+#define OBJ_ENCODING_TSCHUNKS 18 /* Gorilla compressed chunks */
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -278,6 +315,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define BLOCKED_NONE 0    /* Not blocked, no CLIENT_BLOCKED flag set. */
 #define BLOCKED_LIST 1    /* BLPOP & co. */
 #define BLOCKED_WAIT 2    /* WAIT for synchronous replication. */
+#define BLOCKED_STREAM 3  /* XREAD. */
 
 /* Client request types */
 #define PROTO_REQ_INLINE 1
@@ -314,6 +352,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REPL_STATE_TRANSFER 14 /* Receiving .rdb from master */
 #define REPL_STATE_CONNECTED 15 /* Connected to master */
 
+/* How a slave loads the RDB received from the master (repl-diskless-load). */
+#define REPL_DISKLESS_LOAD_DISABLED 0   /* Write it on disk, then load it. */
+#define REPL_DISKLESS_LOAD_ON_EMPTY_DB 1 /* From the socket if no keys. */
+#define REPL_DISKLESS_LOAD_SWAPDB 2     /* From the socket, aside the old data. */
+
 /* State of slaves from the POV of the master. Used in client->replstate.
  * In SEND_BULK and ONLINE state the slave receives new updates
  * in its output queue. In the WAIT_BGSAVE states instead the server is waiting
@@ -357,18 +400,35 @@ typedef long long mstime_t; /* millisecond time type. */
 #define ZSKIPLIST_MAXLEVEL 32 /* Should be enough for 2^32 elements */
 #define ZSKIPLIST_P 0.25      /* Skiplist P = 1/4 */
 
+/* B+tree sizes are chosen so that a leaf fits a 1024 bytes allocation and
+ * an inner node a 2048 bytes allocation. */
+#define ZBTREE_LEAF_MAX 62    /* Max number of elements in a leaf. */
+#define ZBTREE_INNER_MAX 62   /* Max number of children of an inner node. */
+#define ZBTREE_LEAF_MIN (ZBTREE_LEAF_MAX/2)
+#define ZBTREE_INNER_MIN (ZBTREE_INNER_MAX/2)
+
 /* Append only defines */
 #define AOF_FSYNC_NO 0
 #define AOF_FSYNC_ALWAYS 1
 #define AOF_FSYNC_EVERYSEC 2
 #define CONFIG_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
 
+/* RDB string compression codecs */
+#define RDB_CODEC_LZF 0
+#define RDB_CODEC_LZ4 1
+#define RDB_CODEC_LZ4HC 2
+
 /* Zip structure related defaults */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
 #define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
+#define OBJ_ZSET_LARGE_ENCODING OBJ_ENCODING_SKIPLIST
+#define OBJ_STRING_COMPRESS_THRESHOLD 0 /* Compression disabled. */
+#define OBJ_BITMAP_ROARING_MIN_BYTES 0 /* Roaring bitmaps disabled. */
+#define OBJ_STREAM_NODE_MAX_BYTES 4096
+#define OBJ_STREAM_NODE_MAX_ENTRIES 100
 
 /* List defaults */
 #define OBJ_LIST_MAX_ZIPLIST_SIZE -2
@@ -376,6 +436,7 @@ typedef long long mstime_t; /* millisecond time type. */
 
 /* HyperLogLog defines */
 #define CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
+#define CONFIG_DEFAULT_PFCOUNT_CACHE_MAX_MEMORY (1024*1024)
 
 /* Sets operations codes */
 #define SET_OP_UNION 0
@@ -422,6 +483,19 @@ typedef long long mstime_t; /* millisecond time type. */
 #define RDB_CHILD_TYPE_NONE 0
 #define RDB_CHILD_TYPE_DISK 1     /* RDB is written to disk. */
 #define RDB_CHILD_TYPE_SOCKET 2   /* RDB is written to slave socket. */
+#define RDB_CHILD_TYPE_DELTA 3    /* RDB delta is written to disk. */
+
+/* Child info pipe: the persistence children report their progress and the
+ * memory used by copy-on-write to the parent using this pipe. */
+#define CHILD_INFO_MAGIC 0xC17DDA7A12345678LL
+#define CHILD_INFO_TYPE_RDB 0
+#define CHILD_INFO_TYPE_AOF 1
+#define CHILD_INFO_INTERVAL 1000  /* Milliseconds between two reports. */
+
+/* I/O scheduling class of the persistence children. */
+#define CHILD_IO_CLASS_DEFAULT 0      /* Same as the server. */
+#define CHILD_IO_CLASS_BEST_EFFORT 1  /* Lowest best-effort priority. */
+#define CHILD_IO_CLASS_IDLE 2         /* Only use the disk when idle. */
 
 /* Keyspace changes notification classes. Every class is associated with a
  * character for configuration purposes. */
@@ -435,7 +509,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define NOTIFY_ZSET (1<<7)        /* z */
 #define NOTIFY_EXPIRED (1<<8)     /* x */
 #define NOTIFY_EVICTED (1<<9)     /* e */
-#define NOTIFY_ALL (NOTIFY_GENERIC | NOTIFY_STRING | NOTIFY_LIST | NOTIFY_SET | NOTIFY_HASH | NOTIFY_ZSET | NOTIFY_EXPIRED | NOTIFY_EVICTED)      /* A */
+#define NOTIFY_STREAM (1<<10)     /* t */
+#define NOTIFY_ALL (NOTIFY_GENERIC | NOTIFY_STRING | NOTIFY_LIST | NOTIFY_SET | NOTIFY_HASH | NOTIFY_ZSET | NOTIFY_EXPIRED | NOTIFY_EVICTED | NOTIFY_STREAM)      /* A */
 
 /* Get the first bind addr or NULL */
 #define NET_FIRST_BIND_ADDR (server.bindaddr_count ? server.bindaddr[0] : NULL)
@@ -457,17 +532,25 @@ typedef long long mstime_t; /* millisecond time type. */
 /* A redis object, that is a type able to hold a string / list / set */
 
 /* The actual Redis Object */
-#define LRU_BITS 24
+#define LRU_BITS 23 /* Wraps every 97 days, leaving 5 bits to the encoding */
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
 #define LRU_CLOCK_RESOLUTION 1000 /* LRU clock resolution in ms */
+#define OBJ_SHARED_REFCOUNT INT_MAX /* Refcount of immortal shared objects */
 typedef struct redisObject {
     unsigned type:4;
-    unsigned encoding:4;
+    unsigned encoding:5;
     unsigned lru:LRU_BITS; /* lru time (relative to server.lruclock) */
     int refcount;
     void *ptr;
 } robj;
 
+/* The ptr of OBJ_ENCODING_LZF string objects points to this structure. */
+typedef struct lzfString {
+    uint32_t len;           /* Uncompressed length. */
+    uint32_t clen;          /* Compressed length. */
+    unsigned char buf[];    /* LZF compressed data. */
+} lzfString;
+
 /* Macro used to obtain the current LRU clock.
  * If the current resolution is lower than the frequency we refresh the
  * LRU clock (as it should be in production servers) we return the
@@ -504,6 +587,7 @@ struct evictionPoolEntry {
 typedef struct redisDb {
     dict *dict;                 /* The keyspace for this DB */
     dict *expires;              /* Timeout of keys with a timeout set */
+    dict *hexpires;             /* Hashes with volatile fields */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP) */
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
@@ -512,6 +596,14 @@ typedef struct redisDb {
     long long avg_ttl;          /* Average TTL, just for stats */
 } redisDb;
 
+/* Per-field expiration state of a hash, stored in db->hexpires. The
+ * hash value itself is left untouched so small hashes keep their
+ * ziplist encoding. */
+typedef struct hashFieldExpires {
+    dict *fields;               /* Field (sds) -> unix time in milliseconds */
+    long long next;             /* Never later than the earliest expire */
+} hashFieldExpires;
+
 /* Client MULTI/EXEC state */
 typedef struct multiCmd {
     robj **argv;
@@ -533,12 +625,19 @@ typedef struct blockingState {
     mstime_t timeout;       /* Blocking operation timeout. If UNIX current time
                              * is > timeout then the operation timed out. */
 
-    /* BLOCKED_LIST */
+    /* BLOCKED_LIST and BLOCKED_STREAM */
     dict *keys;             /* The keys we are waiting to terminate a blocking
-                             * operation such as BLPOP. Otherwise NULL. */
+                             * operation such as BLPOP or XREAD. For XREAD
+                             * the values are the IDs to read after. */
     robj *target;           /* The key that should receive the element,
                              * for BRPOPLPUSH. */
 
+    /* BLOCKED_STREAM */
+    size_t xread_count;     /* XREAD COUNT option. */
+    robj *xread_group;      /* XREADGROUP group name. */
+    robj *xread_consumer;   /* XREADGROUP consumer name. */
+    int xread_group_noack;  /* XREADGROUP NOACK option. */
+
     /* BLOCKED_WAIT */
     int numreplicas;        /* Number of replicas we are waiting for ACK. */
     long long reploffset;   /* Replication offset to reach. */
@@ -652,11 +751,74 @@ typedef struct zskiplist {
     int level;
 } zskiplist;
 
+/* Large ZSETs can alternatively use a B+tree. Elements are stored sorted by
+ * (score,member) in the leaves, that are linked together in order to
+ * traverse the tree in both directions. Inner nodes store, for every child,
+ * the number of elements inside the child subtree (in order to compute
+ * ranks), and for every child but the first a separator, that is a lower
+ * bound for all the elements of the child subtree. */
+typedef struct zbtreeNode {
+    unsigned int leaf:1;   /* True if this is a zbtreeLeaf. */
+    unsigned int count:31; /* Number of elements or children. */
+} zbtreeNode;
+
+typedef struct zbtreeLeaf {
+    zbtreeNode node;
+    struct zbtreeLeaf *prev, *next;
+    double score[ZBTREE_LEAF_MAX];
+    robj *obj[ZBTREE_LEAF_MAX];
+} zbtreeLeaf;
+
+typedef struct zbtreeInner {
+    zbtreeNode node;
+    double score[ZBTREE_INNER_MAX]; /* Separators, score[0] is unused. */
+    robj *obj[ZBTREE_INNER_MAX];    /* Separators, obj[0] is unused. */
+    unsigned long size[ZBTREE_INNER_MAX];
+    zbtreeNode *child[ZBTREE_INNER_MAX];
+} zbtreeInner;
+
+typedef struct zbtree {
+    zbtreeNode *root;
+    zbtreeLeaf *head, *tail;
+    unsigned long length;
+} zbtree;
+
+/* Position of an element inside a B+tree. 'leaf' is NULL when the cursor
+ * does not point to any element. */
+typedef struct zbtreeCursor {
+    zbtreeLeaf *leaf;
+    int idx;
+    unsigned long rank; /* 1-based rank of the element. */
+} zbtreeCursor;
+
+#define zbtCursorObj(cur) ((cur)->leaf->obj[(cur)->idx])
+#define zbtCursorScore(cur) ((cur)->leaf->score[(cur)->idx])
+
+/* The dictionary maps members to scores. With the skiplist encoding the
+ * value is a pointer to the score stored in the skiplist node, while with
+ * the B+tree encoding, where elements move between nodes, the score is
+ * stored inside the dictionary entry itself. */
 typedef struct zset {
     dict *dict;
-    zskiplist *zsl;
+    zskiplist *zsl; /* Only used by OBJ_ENCODING_SKIPLIST. */
+    zbtree *zbt;    /* Only used by OBJ_ENCODING_BTREE. */
 } zset;
 
+/* State used to build a sorted set appending elements in order, see
+ * zsetAppend() in t_zset.c. */
+typedef struct zsetAppender {
+    robj *zobj;
+    zskiplistNode *last[ZSKIPLIST_MAXLEVEL]; /* Last node for every level. */
+    unsigned long rank[ZSKIPLIST_MAXLEVEL];  /* Rank of the last nodes. */
+} zsetAppender;
+
+/* Element of the array used to bulk load a sorted set. */
+typedef struct zsetBulkItem {
+    double score;
+    robj *ele;
+    long idx; /* Position in the input, used to resolve duplicates. */
+} zsetBulkItem;
+
 typedef struct clientBufferLimitsConfig {
     unsigned long long hard_limit_bytes;
     unsigned long long soft_limit_bytes;
@@ -689,6 +851,23 @@ typedef struct redisOpArray {
     int numops;
 } redisOpArray;
 
+/* The AOF is made of multiple files: a base file, written by the last
+ * rewrite, followed by incremental (INCR) files that are only appended to.
+ * Every rewrite starts a new INCR file, so the writes performed while the
+ * child rewrites the dataset don't need to be buffered by the parent. The
+ * manifest lists the files in loading order. */
+typedef struct aofInfo {
+    sds name;                   /* File name, relative to the working dir. */
+    long long seq;              /* Sequence number of the file. */
+} aofInfo;
+
+typedef struct aofManifest {
+    aofInfo *base;              /* Base file, NULL if there is none. */
+    list *incr;                 /* INCR files (aofInfo), oldest first. */
+    long long base_seq;         /* Sequence number of the last base file. */
+    long long incr_seq;         /* Sequence number of the last INCR file. */
+} aofManifest;
+
 /*-----------------------------------------------------------------------------
  * Global server state
  *----------------------------------------------------------------------------*/
@@ -737,15 +916,21 @@ struct redisServer {
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
-    client *current_client; /* Current client, only used on crash report */
+    client *current_client; /* Current client, used on crash report and
+                               to detect commands run inside EXEC. */
     int clients_paused;         /* True if clients are currently paused */
     mstime_t clients_pause_end_time; /* Time when we undo clients_paused */
     char neterr[ANET_ERR_LEN];   /* Error buffer for anet.c */
     dict *migrate_cached_sockets;/* MIGRATE cached sockets */
+    dict *pfcount_cache;        /* Multi-key PFCOUNT results by key set. */
+    dict *pfcount_cache_index;  /* Input key -> PFCOUNT cache entries. */
+    size_t pfcount_cache_memory; /* Approximated PFCOUNT cache memory. */
     uint64_t next_client_id;    /* Next client unique ID. Incremental. */
     int protected_mode;         /* Don't accept external connections. */
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
+    int async_loading;          /* Loading the master's RDB aside, while the
+                                   old dataset still serves reads. */
     off_t loading_total_bytes;
     off_t loading_loaded_bytes;
     time_t loading_start_time;
@@ -753,16 +938,21 @@ struct redisServer {
     /* Fast pointers to often looked up command */
     struct redisCommand *delCommand, *multiCommand, *lpushCommand, *lpopCommand,
                         *rpopCommand, *sremCommand, *execCommand, *expireCommand,
-                        *pexpireCommand;
+                        *pexpireCommand, *xclaimCommand, *hdelCommand;
     /* Fields used only for stats */
     time_t stat_starttime;          /* Server start time */
     long long stat_numcommands;     /* Number of processed commands */
     long long stat_numconnections;  /* Number of connections received */
     long long stat_expiredkeys;     /* Number of expired keys */
+    long long stat_expiredfields;   /* Number of expired hash fields */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
+    long long stat_pfcount_cache_hits;   /* PFCOUNT results from the cache. */
+    long long stat_pfcount_cache_misses; /* PFCOUNT results not cached. */
     size_t stat_peak_memory;        /* Max used memory record */
+    unsigned long long lzf_strings; /* Number of LZF compressed strings. */
+    long long lzf_strings_saved;    /* Bytes saved by string compression. */
     long long stat_fork_time;       /* Time needed to perform latest fork() */
     double stat_fork_rate;          /* Fork rate in GB/sec. */
     long long stat_rejected_conn;   /* Clients rejected because of maxclients */
@@ -804,9 +994,12 @@ struct redisServer {
     off_t aof_rewrite_min_size;     /* the AOF file is at least N bytes. */
     off_t aof_rewrite_base_size;    /* AOF size on latest startup or rewrite. */
     off_t aof_current_size;         /* AOF current size. */
+    off_t aof_last_incr_size;       /* Size of the INCR file appended to. */
     int aof_rewrite_scheduled;      /* Rewrite once BGSAVE terminates. */
     pid_t aof_child_pid;            /* PID if rewriting process */
-    list *aof_rewrite_buf_blocks;   /* Hold changes during an AOF rewrite. */
+    aofManifest *aof_manifest;      /* Files of the multi part AOF. */
+    long long aof_rewrite_incr_seq; /* First INCR file not rewritten by the
+                                       child in progress. */
     sds aof_buf;      /* AOF buffer, written before entering the event loop */
     int aof_fd;       /* File descriptor of currently selected AOF file */
     int aof_selected_db; /* Currently selected DB in AOF */
@@ -820,16 +1013,24 @@ struct redisServer {
     int aof_last_write_status;      /* C_OK or C_ERR */
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
     int aof_load_truncated;         /* Don't stop on unexpected AOF EOF. */
-    /* AOF pipes used to communicate between parent and child during rewrite. */
-    int aof_pipe_write_data_to_child;
-    int aof_pipe_read_data_from_parent;
-    int aof_pipe_write_ack_to_parent;
-    int aof_pipe_read_ack_from_child;
-    int aof_pipe_write_ack_to_child;
-    int aof_pipe_read_ack_from_parent;
-    int aof_stop_sending_diff;     /* If true stop sending accumulated diffs
-                                      to child process. */
-    sds aof_child_diff;             /* AOF diff accumulator child side. */
+    int aof_use_rdb_preamble;       /* Rewrite the AOF base as RDB payload. */
+    /* Child info pipe, used by the RDB and AOF children to send reports. */
+    int child_info_pipe[2];         /* Pipe used to write the child info. */
+    int child_info_type;            /* CHILD_INFO_TYPE_* of the child. */
+    int in_fork_child;              /* True if we are a persistence child. */
+    long long child_info_start;     /* Fork time of the child, in usec. */
+    size_t stat_current_cow_bytes;  /* Copy-on-write of the current child. */
+    size_t stat_current_cow_peak;   /* Max copy-on-write of current child. */
+    long long stat_current_save_keys_processed; /* Keys saved by the child. */
+    long long stat_current_save_keys_total;     /* Keys when it was forked. */
+    size_t stat_current_save_bytes; /* Bytes written by the current child. */
+    size_t stat_rdb_cow_bytes;      /* Copy-on-write of the last RDB child. */
+    size_t stat_aof_cow_bytes;      /* Copy-on-write of the last AOF child. */
+    long long stat_current_save_write_rate; /* Bytes/sec of current child. */
+    long long stat_rdb_write_rate;  /* Bytes/sec of the last RDB child. */
+    long long stat_aof_write_rate;  /* Bytes/sec of the last AOF child. */
+    long long child_max_write_rate; /* Disk bytes/sec of children, 0 = any. */
+    int child_io_class;             /* CHILD_IO_CLASS_* of the children. */
     /* RDB persistence */
     long long dirty;                /* Changes to DB from the last save */
     long long dirty_before_bgsave;  /* Used to restore dirty on failed BGSAVE */
@@ -838,13 +1039,22 @@ struct redisServer {
     int saveparamslen;              /* Number of saving points */
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
+    int rdb_compression_codec;      /* RDB_CODEC_* used to compress strings */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_load_threads;           /* Threads decoding values in rdbLoad() */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
     time_t rdb_save_time_start;     /* Current RDB save start time. */
     int rdb_bgsave_scheduled;       /* BGSAVE when possible if true. */
     int rdb_child_type;             /* Type of save by active child. */
+    int rdb_snapshot_active;        /* A forkless BGSAVE is in progress. */
+    long long rdb_snapshot_cow_keys; /* Keys copied by the last forkless BGSAVE */
+    int rdb_delta;                  /* Track changes for delta saves? */
+    int rdb_delta_max_chain;        /* Max deltas before a full save. */
+    int rdb_delta_seq;              /* Deltas on disk, -1 if no base. */
+    char rdb_snapshot_id[CONFIG_RUN_ID_SIZE+1]; /* Id of the last RDB file. */
+    char rdb_save_snapshot_id[CONFIG_RUN_ID_SIZE+1]; /* Id of the one saving. */
     int lastbgsave_status;          /* C_OK or C_ERR */
     int stop_writes_on_bgsave_err;  /* Don't allow writes if can't BGSAVE */
     int rdb_pipe_write_result_to_parent; /* RDB pipes used to return the state */
@@ -875,7 +1085,9 @@ struct redisServer {
     int repl_good_slaves_count;     /* Number of slaves with lag <= max_lag. */
     int repl_diskless_sync;         /* Send RDB to slaves sockets directly. */
     int repl_diskless_sync_delay;   /* Delay to start a diskless repl BGSAVE. */
+    int repl_forkless_sync;         /* Full syncs use a forkless BGSAVE. */
     /* Replication (slave) */
+    int repl_diskless_load;         /* REPL_DISKLESS_LOAD_* */
     char *masterauth;               /* AUTH with this password with master */
     char *masterhost;               /* Hostname of master */
     int masterport;                 /* Port of master */
@@ -928,7 +1140,13 @@ struct redisServer {
     size_t set_max_intset_entries;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
+    int zset_large_encoding;
     size_t hll_sparse_max_bytes;
+    size_t pfcount_cache_max_memory;
+    size_t string_compress_threshold;
+    size_t bitmap_roaring_min_bytes;
+    size_t stream_node_max_bytes;
+    long long stream_node_max_entries;
     /* List parameters */
     int list_max_ziplist_size;
     int list_compress_depth;
@@ -1010,9 +1228,10 @@ struct redisFunctionSym {
 
 typedef struct _redisSortObject {
     robj *obj;
+    robj *byval;    /* BY value, kept only if a GET uses the BY pattern. */
     union {
         double score;
-        robj *cmpobj;
+        sds cmpkey; /* ALPHA collation key, see sortCollationKey(). */
     } u;
 } redisSortObject;
 
@@ -1075,6 +1294,15 @@ extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
+extern dictType keyptrDictType;
+extern dictType keylistDictType;
+extern dictType hashFieldExpiresDictType;
+extern dictType fieldExpireDictType;
+extern dictType sdsSetDictType;
+extern dictType objectKeyHeapPointerValueDictType;
+unsigned int dictSdsHash(const void *key);
+int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
+void dictSdsDestructor(void *privdata, void *val);
 
 /*-----------------------------------------------------------------------------
  * Functions prototypes
@@ -1086,7 +1314,14 @@ long long mstime(void);
 void getRandomHexChars(char *p, unsigned int len);
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
 void exitFromChild(int retcode);
+void setChildIOClass(void);
 size_t redisPopcount(void *s, long count);
+#ifdef REDIS_TEST
+int bitopsTest(int argc, char *argv[]);
+int hllTest(int argc, char *argv[]);
+int geoTest(int argc, char *argv[]);
+int streamTest(int argc, char *argv[]);
+#endif
 void redisSetProcTitle(char *title);
 
 /* networking.c -- Networking and Client related operations */
@@ -1166,10 +1401,8 @@ void listTypeInsert(listTypeEntry *entry, robj *value, int where);
 int listTypeEqual(listTypeEntry *entry, robj *o);
 void listTypeDelete(listTypeIterator *iter, listTypeEntry *entry);
 void listTypeConvert(robj *subject, int enc);
-void unblockClientWaitingData(client *c);
-void handleClientsBlockedOnLists(void);
+int serveClientBlockedOnList(client *receiver, robj *key, robj *dstkey, redisDb *db, robj *value, int where);
 void popGenericCommand(client *c, int where);
-void signalListAsReady(redisDb *db, robj *key);
 
 /* MULTI/EXEC/WATCH... */
 void unwatchAllKeys(client *c);
@@ -1186,12 +1419,19 @@ void execCommandPropagateMulti(client *c);
 void decrRefCount(robj *o);
 void decrRefCountVoid(void *o);
 void incrRefCount(robj *o);
+robj *makeObjectShared(robj *o);
 robj *resetRefCount(robj *obj);
 void freeStringObject(robj *o);
 void freeListObject(robj *o);
 void freeSetObject(robj *o);
 void freeZsetObject(robj *o);
 void freeHashObject(robj *o);
+void freeStreamObject(robj *o);
+void freeBloomObject(robj *o);
+void freeCuckooObject(robj *o);
+void freeCmsObject(robj *o);
+void freeTopkObject(robj *o);
+void freeTimeseriesObject(robj *o);
 robj *createObject(int type, void *ptr);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
@@ -1199,6 +1439,9 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len);
 robj *dupStringObject(robj *o);
 int isObjectRepresentableAsLongLong(robj *o, long long *llongval);
 robj *tryObjectEncoding(robj *o);
+robj *tryObjectCompression(robj *o);
+robj *createLzfStringObject(const void *cbuf, size_t clen, size_t len);
+robj *createRoaringStringObject(roaring *r);
 robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
@@ -1210,6 +1453,15 @@ robj *createIntsetObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
 robj *createZsetZiplistObject(void);
+robj *createZsetBtreeObject(void);
+robj *createStreamObject(void);
+robj *createBloomObject(bloom *b);
+robj *createCuckooObject(cuckoo *cf);
+robj *createCmsObject(cms *s);
+robj *createTopkObject(topk *t);
+robj *createTimeseriesObject(timeseries *s);
+unsigned char *serializeBlobObject(robj *o, size_t *len);
+robj *createObjectFromBlob(int type, unsigned char *buf, size_t len);
 int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
 int checkType(client *c, robj *o, int type);
 int getLongLongFromObjectOrReply(client *c, robj *o, long long *target, const char *msg);
@@ -1255,6 +1507,7 @@ int replicationSetupSlaveForFullResync(client *slave, long long offset);
 
 /* Generic persistence functions */
 void startLoading(FILE *fp);
+void startLoadingSize(off_t size);
 void loadingProgress(off_t pos);
 void stopLoading(void);
 
@@ -1266,12 +1519,20 @@ void flushAppendOnlyFile(int force);
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
-int loadAppendOnlyFile(char *filename);
+int loadAppendOnlyFiles(aofManifest *am);
 void stopAppendOnly(void);
 int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
-void aofRewriteBufferReset(void);
-unsigned long aofRewriteBufferSize(void);
+aofManifest *aofManifestCreate(void);
+void aofLoadManifestFromDisk(void);
+void aofOpenIfNeededOnServerStart(void);
+
+/* Child info */
+void openChildInfoPipe(int ptype);
+void closeChildInfoPipe(void);
+void childInfoUpdate(long long keys, size_t bytes);
+size_t sendChildInfo(int final);
+void receiveChildInfo(void);
 
 /* Sorted sets data type */
 
@@ -1290,6 +1551,7 @@ typedef struct {
 zskiplist *zslCreate(void);
 void zslFree(zskiplist *zsl);
 zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj);
+zskiplistNode *zslAppend(zskiplist *zsl, zskiplistNode **last, unsigned long *rank, double score, robj *obj);
 unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score);
 int zslDelete(zskiplist *zsl, double score, robj *obj);
 zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range);
@@ -1302,6 +1564,28 @@ void zsetConvert(robj *zobj, int encoding);
 void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
 int zsetScore(robj *zobj, robj *member, double *score);
 unsigned long zslGetRank(zskiplist *zsl, double score, robj *o);
+zbtree *zbtCreate(void);
+void zbtFree(zbtree *zbt);
+void zbtInsert(zbtree *zbt, double score, robj *obj);
+int zbtDelete(zbtree *zbt, double score, robj *obj);
+int zbtHeight(zbtree *zbt);
+unsigned long zbtGetRank(zbtree *zbt, double score, robj *o);
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreeCursor *cur);
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreeCursor *cur);
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreeCursor *cur);
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeCursor *cur);
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeCursor *cur);
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict);
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict);
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict);
+int zbtFirst(zbtree *zbt, zbtreeCursor *cur);
+int zbtLast(zbtree *zbt, zbtreeCursor *cur);
+void zbtNext(zbtreeCursor *cur);
+void zbtPrev(zbtreeCursor *cur);
+void zsetInsertNew(robj *zobj, double score, robj *ele);
+void zsetAppenderInit(zsetAppender *za, robj *zobj);
+void zsetAppend(zsetAppender *za, double score, robj *ele);
+robj *zsetCreateFromItems(zsetBulkItem *items, size_t count, size_t maxelelen);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
@@ -1376,6 +1660,44 @@ void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
 void hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what, robj **dst);
 robj *hashTypeCurrentObject(hashTypeIterator *hi, int what);
 robj *hashTypeLookupWriteOrCreate(client *c, robj *key);
+hashFieldExpires *hashFieldExpiresCreate(void);
+void hashFieldExpiresRelease(hashFieldExpires *hfe);
+void hashFieldExpiresSet(hashFieldExpires *hfe, sds field, long long when);
+hashFieldExpires *hashGetFieldExpires(redisDb *db, robj *key);
+void hashSetFieldExpire(redisDb *db, robj *key, robj *field, long long when);
+int hashRemoveFieldExpire(redisDb *db, robj *key, robj *field);
+long long hashGetFieldExpire(redisDb *db, robj *key, robj *field);
+long hashExpireFields(redisDb *db, robj *key, hashFieldExpires *hfe, long long now);
+
+/* Stream data type */
+#define STREAM_RWR_NOACK (1<<0)         /* Do not create entries in the PEL. */
+#define STREAM_RWR_RAWENTRIES (1<<1)    /* Do not emit protocol for array
+                                           boundaries, just the entries. */
+#define STREAM_RWR_HISTORY (1<<2)       /* Only serve consumer local PEL. */
+stream *streamNew(void);
+void freeStream(stream *s);
+int streamAppendItem(stream *s, robj **argv, int64_t numfields, streamID *added_id, streamID *use_id);
+int64_t streamTrimByLength(stream *s, size_t maxlen, int approx);
+size_t streamReplyWithRange(client *c, stream *s, streamID *start, streamID *end, size_t count, int rev, streamCG *group, streamConsumer *consumer, int flags, streamPropInfo *spi);
+void streamIteratorStart(streamIterator *si, stream *s, streamID *start, streamID *end, int rev);
+int streamIteratorGetID(streamIterator *si, streamID *id, int64_t *numfields);
+void streamIteratorGetField(streamIterator *si, unsigned char **fieldptr, unsigned char **valueptr, int64_t *fieldlen, int64_t *valuelen);
+void streamIteratorStop(streamIterator *si);
+void streamEncodeID(void *buf, streamID *id);
+void streamDecodeID(void *buf, streamID *id);
+int streamCompareID(streamID *a, streamID *b);
+void streamIncrID(streamID *id);
+streamCG *streamCreateCG(stream *s, char *name, size_t namelen, streamID *id);
+streamCG *streamLookupCG(stream *s, sds groupname);
+streamConsumer *streamLookupConsumer(streamCG *cg, sds name, int create);
+streamNACK *streamCreateNACK(streamConsumer *consumer);
+void streamFreeNACK(streamNACK *na);
+void addReplyStreamID(client *c, streamID *id);
+robj *createObjectFromStreamID(streamID *id);
+
+/* Bloom and cuckoo filters */
+uint64_t MurmurHash64A(const void *key, int len, unsigned int seed);
+uint64_t filterHashObject(robj *item);
 
 /* Pub / Sub */
 int pubsubUnsubscribeAllChannels(client *c, int notify);
@@ -1384,6 +1706,12 @@ void freePubsubPattern(void *p);
 int listMatchPubsubPattern(void *a, void *b);
 int pubsubPublishMessage(robj *channel, robj *message);
 
+/* HyperLogLog multi-key PFCOUNT cache */
+void pfcountCacheInit(void);
+void pfcountCacheInvalidateKey(redisDb *db, robj *key);
+void pfcountCacheFlush(void);
+void pfcountCacheTrim(void);
+
 /* Keyspace events notification */
 void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid);
 int keyspaceEventsStringToFlags(char *classes);
@@ -1401,6 +1729,9 @@ int rewriteConfig(char *path);
 int removeExpire(redisDb *db, robj *key);
 void propagateExpire(redisDb *db, robj *key);
 int expireIfNeeded(redisDb *db, robj *key);
+void expireHashFieldsIfNeeded(redisDb *db, robj *key);
+void propagateHashFieldExpire(redisDb *db, robj *key, robj *field);
+void moveHashFieldExpires(redisDb *src, robj *srckey, redisDb *dst, robj *dstkey);
 long long getExpire(redisDb *db, robj *key);
 void setExpire(redisDb *db, robj *key, long long when);
 robj *lookupKey(redisDb *db, robj *key, int flags);
@@ -1418,7 +1749,11 @@ int dbExists(redisDb *db, robj *key);
 robj *dbRandomKey(redisDb *db);
 int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
+robj *dbDecompressStringValue(redisDb *db, robj *key, robj *o);
 long long emptyDb(void(callback)(void*));
+/* True unless 'db' is one of the temporary DBs a slave loads the dataset of
+ * its master into with repl-diskless-load swapdb. */
+#define isMainDb(db) ((db) == server.db+(db)->id)
 int selectDb(client *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
@@ -1437,6 +1772,7 @@ int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *sortGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *migrateGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 
 /* Cluster */
 void clusterInit(void);
@@ -1446,6 +1782,7 @@ void clusterCron(void);
 void clusterPropagatePublish(robj *channel, robj *message);
 void migrateCloseTimedoutSockets(void);
 void clusterBeforeSleep(void);
+void createDumpPayload(rio *payload, robj *o);
 
 /* Sentinel */
 void initSentinelConfig(void);
@@ -1454,9 +1791,11 @@ void sentinelTimer(void);
 char *sentinelHandleConfiguration(char **argv, int argc);
 void sentinelIsRunning(void);
 
-/* redis-check-rdb */
-int redis_check_rdb(char *rdbfilename);
+/* redis-check-rdb & aof */
+int redis_check_rdb(char *rdbfilename, FILE *fp);
 int redis_check_rdb_main(int argc, char **argv);
+int redis_check_rdb_preamble(char *filename, FILE *fp);
+int redis_check_aof_main(int argc, char **argv);
 
 /* Scripting */
 void scriptingInit(int setup);
@@ -1471,6 +1810,10 @@ void unblockClient(client *c);
 void replyToBlockedClientTimedOut(client *c);
 int getTimeoutFromObjectOrReply(client *c, robj *object, mstime_t *timeout, int unit);
 void disconnectAllBlockedClients(void);
+void blockForKeys(client *c, int btype, robj **keys, int numkeys, mstime_t timeout, robj *target, streamID *ids);
+void unblockClientWaitingData(client *c);
+void handleClientsBlockedOnKeys(void);
+void signalKeyAsReady(redisDb *db, robj *key);
 
 /* Git SHA1 */
 char *redisGitSHA1(void);
@@ -1604,6 +1947,15 @@ void hvalsCommand(client *c);
 void hgetallCommand(client *c);
 void hexistsCommand(client *c);
 void hscanCommand(client *c);
+void hexpireCommand(client *c);
+void hpexpireCommand(client *c);
+void hexpireatCommand(client *c);
+void hpexpireatCommand(client *c);
+void httlCommand(client *c);
+void hpttlCommand(client *c);
+void hexpiretimeCommand(client *c);
+void hpexpiretimeCommand(client *c);
+void hpersistCommand(client *c);
 void configCommand(client *c);
 void hincrbyCommand(client *c);
 void hincrbyfloatCommand(client *c);
@@ -1639,10 +1991,54 @@ void georadiusbymemberCommand(client *c);
 void georadiusbymemberroCommand(client *c);
 void georadiusCommand(client *c);
 void georadiusroCommand(client *c);
+void geosearchCommand(client *c);
+void geosearchstoreCommand(client *c);
 void geoaddCommand(client *c);
 void geohashCommand(client *c);
 void geoposCommand(client *c);
 void geodistCommand(client *c);
+void xaddCommand(client *c);
+void xrangeCommand(client *c);
+void xrevrangeCommand(client *c);
+void xlenCommand(client *c);
+void xreadCommand(client *c);
+void xgroupCommand(client *c);
+void xsetidCommand(client *c);
+void xackCommand(client *c);
+void xpendingCommand(client *c);
+void xclaimCommand(client *c);
+void xinfoCommand(client *c);
+void xdelCommand(client *c);
+void xtrimCommand(client *c);
+void bfreserveCommand(client *c);
+void bfaddCommand(client *c);
+void bfexistsCommand(client *c);
+void bfinfoCommand(client *c);
+void cfreserveCommand(client *c);
+void cfaddCommand(client *c);
+void cfexistsCommand(client *c);
+void cfcountCommand(client *c);
+void cfdelCommand(client *c);
+void cfinfoCommand(client *c);
+void cmsinitbydimCommand(client *c);
+void cmsinitbyprobCommand(client *c);
+void cmsincrbyCommand(client *c);
+void cmsqueryCommand(client *c);
+void cmsmergeCommand(client *c);
+void cmsinfoCommand(client *c);
+void topkreserveCommand(client *c);
+void topkaddCommand(client *c);
+void topkincrbyCommand(client *c);
+void topkqueryCommand(client *c);
+void topkcountCommand(client *c);
+void topklistCommand(client *c);
+void topkmergeCommand(client *c);
+void topkinfoCommand(client *c);
+void tscreateCommand(client *c);
+void tsaddCommand(client *c);
+void tsgetCommand(client *c);
+void tsrangeCommand(client *c);
+void tsinfoCommand(client *c);
 void pfselftestCommand(client *c);
 void pfaddCommand(client *c);
 void pfcountCommand(client *c);
@@ -0,0 +1,604 @@
+/* Forkless BGSAVE: a point-in-time RDB snapshot written by a thread.
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* How it works
+ * ------------
+ *
+ * When the snapshot starts (time T0) rehashing of the keyspace dictionaries
+ * is paused, so that every key stays in the bucket it was found at T0. The
+ * main thread then walks the buckets in order and hands batches of values
+ * to the saving thread, that serializes them to the RDB file. The position
+ * of the next bucket to walk is the cursor: keys before the cursor are saved
+ * or being saved, keys after the cursor are not.
+ *
+ * Commands are served while the snapshot is in progress. The main thread
+ * calls rdbSnapshotTouchKey() before accessing a value:
+ *
+ * 1) If the value is part of the batch being written, the main thread waits
+ *    for the batch to be completed.
+ * 2) If the key is going to be modified and it was not reached by the cursor
+ *    yet, its T0 value is serialized right now into a buffer (the "copy on
+ *    write"), and the key is remembered so that the walk will skip it.
+ *
+ * Keys created after T0 are remembered as well, so the file contains only
+ * the dataset as it was at T0. FLUSHDB and FLUSHALL hand the flushed
+ * dictionaries to the snapshot, that releases them when done. */
+
+#include "server.h"
+
+#include <signal.h>
+
+/* Max number of keys and buckets walked for a single batch. */
+#define RDB_SNAPSHOT_BATCH_KEYS 1024
+#define RDB_SNAPSHOT_BATCH_BUCKETS (RDB_SNAPSHOT_BATCH_KEYS*16)
+
+/* Position of a bucket of the keyspace, in walk order. */
+typedef struct snapshotPos {
+    int db;
+    int table;
+    unsigned long idx;
+} snapshotPos;
+
+typedef struct snapshotJob {
+    sds key;
+    robj *val;
+    long long expire;
+    hashFieldExpires *hfe;
+} snapshotJob;
+
+typedef struct snapshotDb {
+    dict *dict, *expires, *hexpires; /* The keyspace saved. */
+    unsigned long size[2];      /* Buckets to walk in the two tables. */
+    unsigned long keys;         /* Keys at T0, for RDB_OPCODE_RESIZEDB. */
+    unsigned long volatile_keys;
+    dict *skip;                 /* Keys the walk must not save. */
+    sds cow;                    /* Values copied before being modified. */
+    int paused;                 /* Rehashing of 'dict' is paused. */
+    int detached;               /* The db was flushed, the dicts are ours. */
+} snapshotDb;
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;   /* Signaled when a batch is submitted. */
+    pthread_cond_t done_cond;   /* Signaled when a batch is written. */
+    int pipe[2];                /* Wakes up the main thread after a batch. */
+    FILE *fp;
+    rio rdb;
+    char tmpfile[256];
+    sds filename;
+    long long now;              /* T0, expired keys are not saved. */
+    snapshotDb *dbs;
+    snapshotPos cursor;         /* Next bucket to walk. */
+    snapshotPos start;          /* First bucket of the batch being written. */
+    /* The batch. Owned by the thread while 'busy' is true. */
+    sds prefix;                 /* Raw RDB bytes written before the keys. */
+    snapshotJob *jobs;
+    int count, size;
+    int last;                   /* Write the RDB trailer after the batch. */
+    int busy;
+    int inflight;               /* Like 'busy', for the main thread. */
+    int shutdown;
+    int error;                  /* errno of the first write error, or 0. */
+} snap = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work_cond = PTHREAD_COND_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER
+};
+
+/* Return true if a BGSAVE is in progress, either in a child process or as
+ * a forkless snapshot. */
+int rdbBgsaveInProgress(void) {
+    return server.rdb_child_pid != -1 || server.rdb_snapshot_active;
+}
+
+static int snapshotPosCompare(snapshotPos *a, snapshotPos *b) {
+    if (a->db != b->db) return a->db < b->db ? -1 : 1;
+    if (a->table != b->table) return a->table < b->table ? -1 : 1;
+    if (a->idx != b->idx) return a->idx < b->idx ? -1 : 1;
+    return 0;
+}
+
+/* Store in 'pos' the bucket of 'key'. Returns 0 if the key is not found. */
+static int snapshotLocateKey(redisDb *db, robj *key, snapshotPos *pos) {
+    pos->db = db->id;
+    return dictGetKeyPosition(snap.dbs[db->id].dict,key->ptr,
+                              &pos->table,&pos->idx) == DICT_OK;
+}
+
+/* Wait for the batch being written, if any. */
+void rdbSnapshotWait(void) {
+    pthread_mutex_lock(&snap.mutex);
+    while (snap.busy) pthread_cond_wait(&snap.done_cond,&snap.mutex);
+    pthread_mutex_unlock(&snap.mutex);
+    snap.inflight = 0;
+}
+
+/* Serialize the T0 value of 'key' into the copy on write buffer of its db,
+ * and make sure the walk will not save it again. */
+static void snapshotCopyKey(snapshotDb *sdb, robj *key) {
+    robj *val = dictFetchValue(sdb->dict,key->ptr);
+    long long expire = -1;
+    hashFieldExpires *hfe = NULL;
+    dictEntry *de;
+    rio buf;
+
+    if (dictSize(sdb->expires) &&
+        (de = dictFind(sdb->expires,key->ptr)) != NULL)
+        expire = dictGetSignedIntegerVal(de);
+    if (dictSize(sdb->hexpires) &&
+        (de = dictFind(sdb->hexpires,key->ptr)) != NULL)
+        hfe = dictGetVal(de);
+
+    rioInitWithBuffer(&buf,sdb->cow);
+    rdbSaveKeyValuePair(&buf,key,val,expire,hfe,snap.now);
+    sdb->cow = buf.io.buffer.ptr;
+    dictAdd(sdb->skip,sdsdup(key->ptr),NULL);
+    server.rdb_snapshot_cow_keys++;
+}
+
+/* Called before the value stored at 'key' is accessed, with 'write' set if
+ * the value, its expire, or the key itself are going to be modified. */
+void rdbSnapshotTouchKey(redisDb *db, robj *key, int write) {
+    snapshotDb *sdb = snap.dbs+db->id;
+    snapshotPos pos;
+
+    if (sdb->detached || sdb->keys == 0 || !isMainDb(db)) return;
+    /* Dbs before the batch being written are done, and their rehashing
+     * may be resumed already: don't try to locate the key. */
+    if (db->id < snap.cursor.db && (!snap.inflight || db->id < snap.start.db))
+        return;
+    if (!snapshotLocateKey(db,key,&pos)) return;
+    if (snapshotPosCompare(&pos,&snap.cursor) < 0) {
+        if (snap.inflight && snapshotPosCompare(&pos,&snap.start) >= 0)
+            rdbSnapshotWait();
+        return;
+    }
+    if (!write) return;
+    if (dictSize(sdb->skip) && dictFind(sdb->skip,key->ptr)) return;
+    snapshotCopyKey(sdb,key);
+}
+
+/* Called after 'key' is added to the db: it did not exist at T0. */
+void rdbSnapshotKeyAdded(redisDb *db, robj *key) {
+    snapshotDb *sdb = snap.dbs+db->id;
+    snapshotPos pos;
+
+    if (sdb->detached || sdb->keys == 0 || db->id < snap.cursor.db ||
+        !isMainDb(db)) return;
+    if (!snapshotLocateKey(db,key,&pos) ||
+        snapshotPosCompare(&pos,&snap.cursor) < 0) return;
+    dictAdd(sdb->skip,sdsdup(key->ptr),NULL);
+}
+
+/* Called before the db is emptied. If the snapshot still needs the dicts
+ * of the db they are detached: the snapshot keeps them, and the db gets
+ * new empty ones. Returns 1 if the dicts were detached. */
+int rdbSnapshotDetachDb(redisDb *db) {
+    snapshotDb *sdb = snap.dbs+db->id;
+    int first = snap.inflight ? snap.start.db : snap.cursor.db;
+
+    if (sdb->detached || db->id < first) return 0;
+    sdb->detached = 1;
+    db->dict = dictCreate(&dbDictType,NULL);
+    db->expires = dictCreate(&keyptrDictType,NULL);
+    db->hexpires = dictCreate(&hashFieldExpiresDictType,NULL);
+    return 1;
+}
+
+/* Move the cursor to the next db with keys to save. */
+static void snapshotNextDb(void) {
+    snap.cursor.db++;
+    snap.cursor.table = 0;
+    snap.cursor.idx = 0;
+    while (snap.cursor.db < server.dbnum && snap.dbs[snap.cursor.db].keys == 0)
+        snap.cursor.db++;
+}
+
+static void snapshotAddBucket(snapshotDb *sdb) {
+    dictEntry *de = sdb->dict->ht[snap.cursor.table].table[snap.cursor.idx];
+
+    while(de) {
+        sds key = dictGetKey(de);
+        snapshotJob *job;
+        dictEntry *ede;
+
+        if (dictSize(sdb->skip) == 0 || dictFind(sdb->skip,key) == NULL) {
+            if (snap.count == snap.size) {
+                snap.size *= 2;
+                snap.jobs = zrealloc(snap.jobs,sizeof(snapshotJob)*snap.size);
+            }
+            job = snap.jobs+snap.count++;
+            job->key = key;
+            job->val = dictGetVal(de);
+            job->expire = -1;
+            job->hfe = NULL;
+            if (dictSize(sdb->expires) &&
+                (ede = dictFind(sdb->expires,key)) != NULL)
+                job->expire = dictGetSignedIntegerVal(ede);
+            if (dictSize(sdb->hexpires) &&
+                (ede = dictFind(sdb->hexpires,key)) != NULL)
+                job->hfe = dictGetVal(ede);
+        }
+        de = de->next;
+    }
+}
+
+/* Walk the keyspace from the cursor to fill the next batch. A batch never
+ * spans two dbs, and carries the copy on write buffer of its db. */
+static void snapshotFillBatch(void) {
+    snapshotDb *sdb;
+    long buckets = 0;
+    rio buf;
+    int j;
+
+    /* The batches of the dbs before the cursor are written: their keys
+     * can be moved by rehashing again. */
+    for (j = 0; j < snap.cursor.db && j < server.dbnum; j++) {
+        if (snap.dbs[j].paused) {
+            dictResumeRehashing(snap.dbs[j].dict);
+            snap.dbs[j].paused = 0;
+        }
+    }
+
+    sdsclear(snap.prefix);
+    snap.count = 0;
+    snap.start = snap.cursor;
+    if (snap.cursor.db == server.dbnum) {
+        snap.last = 1;
+        return;
+    }
+
+    sdb = snap.dbs+snap.cursor.db;
+    rioInitWithBuffer(&buf,snap.prefix);
+    if (snap.cursor.table == 0 && snap.cursor.idx == 0) {
+        rdbSaveType(&buf,RDB_OPCODE_SELECTDB);
+        rdbSaveLen(&buf,snap.cursor.db);
+        rdbSaveType(&buf,RDB_OPCODE_RESIZEDB);
+        rdbSaveLen(&buf,sdb->keys <= UINT32_MAX ? sdb->keys : UINT32_MAX);
+        rdbSaveLen(&buf,sdb->volatile_keys <= UINT32_MAX ?
+                        sdb->volatile_keys : UINT32_MAX);
+    }
+
+    while (snap.count < RDB_SNAPSHOT_BATCH_KEYS &&
+           buckets < RDB_SNAPSHOT_BATCH_BUCKETS)
+    {
+        if (snap.cursor.idx == sdb->size[snap.cursor.table]) {
+            if (snap.cursor.table == 0) {
+                snap.cursor.table = 1;
+                snap.cursor.idx = 0;
+                continue;
+            }
+            snapshotNextDb();
+            break;
+        }
+        snapshotAddBucket(sdb);
+        snap.cursor.idx++;
+        buckets++;
+    }
+    snap.last = 0;
+
+    /* Keys copied after this batch are all in the buckets of the next
+     * batches of the db, so the buffer is always flushed before moving to
+     * the next db. */
+    buf.io.buffer.ptr = sdscatsds(buf.io.buffer.ptr,sdb->cow);
+    sdsclear(sdb->cow);
+    snap.prefix = buf.io.buffer.ptr;
+}
+
+static void snapshotSubmitBatch(void) {
+    pthread_mutex_lock(&snap.mutex);
+    snap.busy = 1;
+    pthread_cond_signal(&snap.work_cond);
+    pthread_mutex_unlock(&snap.mutex);
+    snap.inflight = 1;
+}
+
+/* Write the batch to the file. Returns 0 on success, otherwise errno. */
+static int snapshotWriteBatch(void) {
+    uint64_t cksum;
+    int j;
+
+    if (snap.error) return snap.error;
+    if (sdslen(snap.prefix) &&
+        rioWrite(&snap.rdb,snap.prefix,sdslen(snap.prefix)) == 0)
+        return errno ? errno : EIO;
+    for (j = 0; j < snap.count; j++) {
+        snapshotJob *job = snap.jobs+j;
+        robj key;
+
+        initStaticStringObject(key,job->key);
+        if (rdbSaveKeyValuePair(&snap.rdb,&key,job->val,job->expire,
+                                job->hfe,snap.now) == -1)
+            return errno ? errno : EIO;
+    }
+    if (!snap.last) return 0;
+
+    /* EOF opcode and CRC64 checksum, then make sure data will not remain
+     * on the OS's output buffers. */
+    if (rdbSaveType(&snap.rdb,RDB_OPCODE_EOF) == -1) return errno ? errno : EIO;
+    cksum = snap.rdb.cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(&snap.rdb,&cksum,8) == 0) return errno ? errno : EIO;
+    if (fflush(snap.fp) == EOF) return errno;
+    if (fsync(fileno(snap.fp)) == -1) return errno;
+    return 0;
+}
+
+static void *snapshotThreadMain(void *arg) {
+    sigset_t sigset;
+    int err, last;
+    UNUSED(arg);
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+    pthread_mutex_lock(&snap.mutex);
+    while(1) {
+        while (!snap.busy && !snap.shutdown)
+            pthread_cond_wait(&snap.work_cond,&snap.mutex);
+        if (snap.shutdown) break;
+        pthread_mutex_unlock(&snap.mutex);
+
+        errno = 0;
+        err = snapshotWriteBatch();
+        last = snap.last;
+
+        pthread_mutex_lock(&snap.mutex);
+        if (err && !snap.error) snap.error = err;
+        snap.busy = 0;
+        pthread_cond_broadcast(&snap.done_cond);
+        if (write(snap.pipe[1],"x",1) != 1) {
+            /* The pipe is full: a wake up is pending anyway. */
+        }
+        if (last) break;
+    }
+    pthread_mutex_unlock(&snap.mutex);
+    return NULL;
+}
+
+/* Release the resources of the snapshot. The thread must be stopped. */
+static void snapshotRelease(void) {
+    int j;
+
+    aeDeleteFileEvent(server.el,snap.pipe[0],AE_READABLE);
+    close(snap.pipe[0]);
+    close(snap.pipe[1]);
+    if (snap.fp) fclose(snap.fp);
+    snap.fp = NULL;
+    for (j = 0; j < server.dbnum; j++) {
+        snapshotDb *sdb = snap.dbs+j;
+
+        if (sdb->detached) {
+            dictRelease(sdb->hexpires);
+            dictRelease(sdb->dict);
+            dictRelease(sdb->expires);
+        } else if (sdb->paused) {
+            dictResumeRehashing(sdb->dict);
+        }
+        dictRelease(sdb->skip);
+        sdsfree(sdb->cow);
+    }
+    zfree(snap.dbs);
+    snap.dbs = NULL;
+    zfree(snap.jobs);
+    snap.jobs = NULL;
+    sdsfree(snap.prefix);
+    sdsfree(snap.filename);
+    server.rdb_snapshot_active = 0;
+    server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+    server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
+    server.rdb_save_time_start = -1;
+}
+
+/* The snapshot terminated: handle it like backgroundSaveDoneHandlerDisk()
+ * does for a saving child. */
+static void snapshotDone(void) {
+    int ok = (snap.error == 0);
+
+    pthread_join(snap.thread,NULL);
+    if (ok) {
+        if (fclose(snap.fp) == EOF) {
+            ok = 0;
+            snap.error = errno;
+        }
+        snap.fp = NULL;
+    }
+    if (ok && rename(snap.tmpfile,snap.filename) == -1) {
+        ok = 0;
+        snap.error = errno;
+    }
+    if (ok) {
+        serverLog(LL_NOTICE,
+            "Background forkless saving terminated with success");
+        server.dirty = server.dirty - server.dirty_before_bgsave;
+        server.lastsave = time(NULL);
+        server.lastbgsave_status = C_OK;
+    } else {
+        serverLog(LL_WARNING,"Background forkless saving error: %s",
+            strerror(snap.error));
+        unlink(snap.tmpfile);
+        server.lastbgsave_status = C_ERR;
+    }
+    snapshotRelease();
+    rdbDeltaSaveDone(ok,0);
+    /* Possibly there are slaves waiting for a BGSAVE in order to be served
+     * (the first stage of SYNC is a bulk transfer of dump.rdb) */
+    updateSlavesWaitingBgsave(ok ? C_OK : C_ERR, RDB_CHILD_TYPE_DISK);
+}
+
+/* Stop the snapshot without producing the file, like killing the saving
+ * child with SIGUSR1 does: this is not considered an error. */
+void rdbSnapshotAbort(void) {
+    if (!server.rdb_snapshot_active) return;
+    serverLog(LL_WARNING,"Background forkless saving aborted");
+    pthread_mutex_lock(&snap.mutex);
+    while (snap.busy) pthread_cond_wait(&snap.done_cond,&snap.mutex);
+    snap.shutdown = 1;
+    pthread_cond_signal(&snap.work_cond);
+    pthread_mutex_unlock(&snap.mutex);
+    pthread_join(snap.thread,NULL);
+    unlink(snap.tmpfile);
+    snapshotRelease();
+    rdbDeltaSaveDone(0,0);
+    updateSlavesWaitingBgsave(C_ERR, RDB_CHILD_TYPE_DISK);
+}
+
+/* A batch was written: submit the next one, or terminate the snapshot. */
+static void snapshotBatchDone(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[64];
+    int busy, last;
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    while (read(fd,buf,sizeof(buf)) > 0);
+    pthread_mutex_lock(&snap.mutex);
+    busy = snap.busy;
+    pthread_mutex_unlock(&snap.mutex);
+    if (busy) return;
+    snap.inflight = 0;
+
+    last = snap.last;
+    if (last || snap.error) {
+        if (!last) {
+            /* Stop the thread, the rest of the dataset is not saved. */
+            pthread_mutex_lock(&snap.mutex);
+            snap.shutdown = 1;
+            pthread_cond_signal(&snap.work_cond);
+            pthread_mutex_unlock(&snap.mutex);
+        }
+        snapshotDone();
+        return;
+    }
+    snapshotFillBatch();
+    snapshotSubmitBatch();
+}
+
+/* Start a forkless BGSAVE saving the dataset to 'filename'. */
+int rdbSaveBackgroundForkless(char *filename) {
+    rio buf;
+    sds header;
+    char magic[10];
+    int j, rc;
+
+    if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) return C_ERR;
+
+    server.dirty_before_bgsave = server.dirty;
+    server.lastbgsave_try = time(NULL);
+
+    snprintf(snap.tmpfile,sizeof(snap.tmpfile),"temp-forkless-%d.rdb",
+        (int) getpid());
+    if ((snap.fp = fopen(snap.tmpfile,"w")) == NULL) {
+        server.lastbgsave_status = C_ERR;
+        serverLog(LL_WARNING,"Failed opening the RDB file %s for saving: %s",
+            snap.tmpfile, strerror(errno));
+        return C_ERR;
+    }
+    if (pipe(snap.pipe) == -1) {
+        server.lastbgsave_status = C_ERR;
+        serverLog(LL_WARNING,"Can't save in background: pipe: %s",
+            strerror(errno));
+        fclose(snap.fp);
+        unlink(snap.tmpfile);
+        snap.fp = NULL;
+        return C_ERR;
+    }
+    anetNonBlock(NULL,snap.pipe[0]);
+    anetNonBlock(NULL,snap.pipe[1]);
+    aeCreateFileEvent(server.el,snap.pipe[0],AE_READABLE,snapshotBatchDone,
+        NULL);
+
+    rioInitWithFile(&snap.rdb,snap.fp);
+    if (server.rdb_checksum)
+        snap.rdb.update_cksum = rioGenericUpdateChecksum;
+    snap.filename = sdsnew(filename);
+    snap.now = mstime();
+    snap.error = 0;
+    snap.shutdown = 0;
+    snap.busy = 0;
+    snap.size = RDB_SNAPSHOT_BATCH_KEYS;
+    snap.jobs = zmalloc(sizeof(snapshotJob)*snap.size);
+    server.rdb_snapshot_cow_keys = 0;
+
+    /* From now on the keys stay in the buckets they are in. */
+    snap.dbs = zcalloc(sizeof(snapshotDb)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++) {
+        snapshotDb *sdb = snap.dbs+j;
+        redisDb *db = server.db+j;
+
+        sdb->dict = db->dict;
+        sdb->expires = db->expires;
+        sdb->hexpires = db->hexpires;
+        sdb->size[0] = sdb->dict->ht[0].size;
+        sdb->size[1] = dictIsRehashing(sdb->dict) ? sdb->dict->ht[1].size : 0;
+        sdb->keys = dictSize(db->dict);
+        sdb->volatile_keys = dictSize(db->expires);
+        sdb->skip = dictCreate(&sdsSetDictType,NULL);
+        sdb->cow = sdsempty();
+        if (sdb->keys) {
+            dictPauseRehashing(sdb->dict);
+            sdb->paused = 1;
+        }
+    }
+    snap.cursor.db = -1;
+    snapshotNextDb();
+
+    /* The RDB header is written with the first batch. */
+    rdbDeltaSaveStart();
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    rioInitWithBuffer(&buf,sdsnewlen(magic,9));
+    rdbSaveInfoAuxFields(&buf,RDB_SAVE_NONE);
+    header = buf.io.buffer.ptr;
+    snap.prefix = sdsempty();
+    snapshotFillBatch();
+    header = sdscatsds(header,snap.prefix);
+    sdsfree(snap.prefix);
+    snap.prefix = header;
+
+    server.rdb_snapshot_active = 1;
+    server.rdb_child_type = RDB_CHILD_TYPE_DISK;
+    server.rdb_save_time_start = time(NULL);
+    if ((rc = pthread_create(&snap.thread,NULL,snapshotThreadMain,NULL)) != 0) {
+        server.lastbgsave_status = C_ERR;
+        serverLog(LL_WARNING,"Can't save in background: thread: %s",
+            strerror(rc));
+        unlink(snap.tmpfile);
+        snapshotRelease();
+        rdbDeltaSaveDone(0,0);
+        return C_ERR;
+    }
+    serverLog(LL_NOTICE,"Background forkless saving started");
+    snapshotSubmitBatch();
+    return C_OK;
+}
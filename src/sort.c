@@ -42,7 +42,15 @@ redisSortOperation *createSortOperation(int type, robj *pattern) {
     return so;
 }
 
-/* Return the value associated to the key with a name obtained using
+/* Number of elements whose BY / GET patterns are resolved together, see
+ * lookupKeysByPattern(). */
+#define SORT_LOOKUP_BATCH 16
+
+/* With LIMIT selecting no more than this number of leading elements, the
+ * elements to return are extracted with a bounded heap, see sortTopK(). */
+#define SORT_TOPK_MAX 1024
+
+/* Return the values associated to the keys with names obtained using
  * the following rules:
  *
  * 1) The first occurrence of '*' in 'pattern' is substituted with 'subst'.
@@ -56,34 +64,40 @@ redisSortOperation *createSortOperation(int type, robj *pattern) {
  *    that the SORT command can be used like: SORT key GET # to retrieve
  *    the Set/List elements directly.
  *
- * The returned object will always have its refcount increased by 1
- * when it is non-NULL. */
-robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst) {
+ * The pattern is resolved for the 'count' (at most SORT_LOOKUP_BATCH)
+ * objects in 'subst', and the values stored in 'result', or NULL when there
+ * is no value. All the key names are built and their buckets prefetched
+ * before the first lookup, so that the cache misses of the batch overlap.
+ *
+ * The returned objects will always have their refcount increased by 1
+ * when non-NULL. */
+void lookupKeysByPattern(redisDb *db, robj *pattern, robj **subst,
+                         robj **result, int count)
+{
     char *p, *f, *k;
-    sds spat, ssub;
-    robj *keyobj, *fieldobj = NULL, *o;
-    int prefixlen, sublen, postfixlen, fieldlen;
+    sds spat;
+    robj *keyobj[SORT_LOOKUP_BATCH], *fieldobj = NULL, *o;
+    int prefixlen, sublen, postfixlen, fieldlen, j;
+
+    serverAssert(count <= SORT_LOOKUP_BATCH);
 
     /* If the pattern is "#" return the substitution object itself in order
      * to implement the "SORT ... GET #" feature. */
     spat = pattern->ptr;
     if (spat[0] == '#' && spat[1] == '\0') {
-        incrRefCount(subst);
-        return subst;
+        for (j = 0; j < count; j++) {
+            incrRefCount(subst[j]);
+            result[j] = subst[j];
+        }
+        return;
     }
 
-    /* The substitution object may be specially encoded. If so we create
-     * a decoded object on the fly. Otherwise getDecodedObject will just
-     * increment the ref count, that we'll decrement later. */
-    subst = getDecodedObject(subst);
-    ssub = subst->ptr;
-
     /* If we can't find '*' in the pattern we return NULL as to GET a
      * fixed key does not make sense. */
     p = strchr(spat,'*');
     if (!p) {
-        decrRefCount(subst);
-        return NULL;
+        for (j = 0; j < count; j++) result[j] = NULL;
+        return;
     }
 
     /* Find out if we're dealing with a hash dereference. */
@@ -94,42 +108,72 @@ robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst) {
         fieldlen = 0;
     }
 
-    /* Perform the '*' substitution. */
+    /* Perform the '*' substitutions, prefetching the buckets of the keys. */
     prefixlen = p-spat;
-    sublen = sdslen(ssub);
     postfixlen = sdslen(spat)-(prefixlen+1)-(fieldlen ? fieldlen+2 : 0);
-    keyobj = createStringObject(NULL,prefixlen+sublen+postfixlen);
-    k = keyobj->ptr;
-    memcpy(k,spat,prefixlen);
-    memcpy(k+prefixlen,ssub,sublen);
-    memcpy(k+prefixlen+sublen,p+1,postfixlen);
-    decrRefCount(subst); /* Incremented by decodeObject() */
-
-    /* Lookup substituted key */
-    o = lookupKeyRead(db,keyobj);
-    if (o == NULL) goto noobj;
-
-    if (fieldobj) {
-        if (o->type != OBJ_HASH) goto noobj;
-
-        /* Retrieve value from hash by the field name. This operation
-         * already increases the refcount of the returned object. */
-        o = hashTypeGetObject(o, fieldobj);
-    } else {
-        if (o->type != OBJ_STRING) goto noobj;
+    for (j = 0; j < count; j++) {
+        /* The substitution object may be specially encoded. If so we create
+         * a decoded object on the fly. Otherwise getDecodedObject will just
+         * increment the ref count, that we'll decrement later. */
+        robj *sub = getDecodedObject(subst[j]);
+
+        sublen = sdslen(sub->ptr);
+        keyobj[j] = createStringObject(NULL,prefixlen+sublen+postfixlen);
+        k = keyobj[j]->ptr;
+        memcpy(k,spat,prefixlen);
+        memcpy(k+prefixlen,sub->ptr,sublen);
+        memcpy(k+prefixlen+sublen,p+1,postfixlen);
+        decrRefCount(sub); /* Incremented by decodeObject() */
+        dictPrefetch(db->dict,keyobj[j]->ptr);
+    }
 
-        /* Every object that this function returns needs to have its refcount
-         * increased. sortCommand decreases it again. */
-        incrRefCount(o);
+    /* Lookup substituted keys */
+    for (j = 0; j < count; j++) {
+        o = lookupKeyRead(db,keyobj[j]);
+        decrRefCount(keyobj[j]);
+        if (o == NULL) {
+            result[j] = NULL;
+        } else if (fieldobj) {
+            /* Retrieve value from hash by the field name. This operation
+             * already increases the refcount of the returned object. */
+            result[j] = (o->type == OBJ_HASH) ?
+                        hashTypeGetObject(o, fieldobj) : NULL;
+        } else if (o->type != OBJ_STRING) {
+            result[j] = NULL;
+        } else {
+            /* Every object that this function returns needs to have its
+             * refcount increased. sortCommand decreases it again.
+             * Compressed strings are returned as a decoded copy. */
+            if (o->encoding == OBJ_ENCODING_LZF ||
+                o->encoding == OBJ_ENCODING_ROARING)
+                o = getDecodedObject(o);
+            else
+                incrRefCount(o);
+            result[j] = o;
+        }
     }
-    decrRefCount(keyobj);
     if (fieldobj) decrRefCount(fieldobj);
-    return o;
+}
 
-noobj:
-    decrRefCount(keyobj);
-    if (fieldlen) decrRefCount(fieldobj);
-    return NULL;
+/* Return the key used to compare 'o' when sorting with ALPHA: comparing two
+ * keys with sdscmp() gives the same result of strcoll() on the strings, but
+ * the transformation is performed once per element instead of inside every
+ * comparison. With STORE the comparison must not depend on the locale, so
+ * the key is just a copy of the string. */
+static sds sortCollationKey(robj *o, int binary) {
+    sds key;
+    size_t len;
+
+    o = getDecodedObject(o);
+    if (binary) {
+        key = sdsdup(o->ptr);
+    } else {
+        len = strxfrm(NULL,o->ptr,0);
+        key = sdsnewlen(NULL,len);
+        strxfrm(key,o->ptr,len+1);
+    }
+    decrRefCount(o);
+    return key;
 }
 
 /* sortCompare() is used by qsort in sortCommand(). Given that qsort_r with
@@ -146,44 +190,106 @@ int sortCompare(const void *s1, const void *s2) {
         } else if (so1->u.score < so2->u.score) {
             cmp = -1;
         } else {
-            /* Objects have the same score, but we don't want the comparison
-             * to be undefined, so we compare objects lexicographically.
-             * This way the result of SORT is deterministic. */
-            cmp = compareStringObjects(so1->obj,so2->obj);
+            cmp = 0;
         }
     } else {
-        /* Alphanumeric sorting */
-        if (server.sort_bypattern) {
-            if (!so1->u.cmpobj || !so2->u.cmpobj) {
-                /* At least one compare object is NULL */
-                if (so1->u.cmpobj == so2->u.cmpobj)
-                    cmp = 0;
-                else if (so1->u.cmpobj == NULL)
-                    cmp = -1;
-                else
-                    cmp = 1;
-            } else {
-                /* We have both the objects, compare them. */
-                if (server.sort_store) {
-                    cmp = compareStringObjects(so1->u.cmpobj,so2->u.cmpobj);
-                } else {
-                    /* Here we can use strcoll() directly as we are sure that
-                     * the objects are decoded string objects. */
-                    cmp = strcoll(so1->u.cmpobj->ptr,so2->u.cmpobj->ptr);
-                }
-            }
+        /* Alphanumeric sorting, using the precomputed collation keys. */
+        if (!so1->u.cmpkey || !so2->u.cmpkey) {
+            /* At least one compare key is NULL (missing BY value) */
+            if (so1->u.cmpkey == so2->u.cmpkey)
+                cmp = 0;
+            else if (so1->u.cmpkey == NULL)
+                cmp = -1;
+            else
+                cmp = 1;
         } else {
-            /* Compare elements directly. */
-            if (server.sort_store) {
-                cmp = compareStringObjects(so1->obj,so2->obj);
-            } else {
-                cmp = collateStringObjects(so1->obj,so2->obj);
-            }
+            cmp = sdscmp(so1->u.cmpkey,so2->u.cmpkey);
         }
     }
+
+    /* Objects compare the same, but we don't want the comparison to be
+     * undefined, so we compare objects lexicographically. This way the
+     * result of SORT is deterministic, and does not depend on the
+     * algorithm used to sort the vector. */
+    if (cmp == 0) cmp = compareStringObjects(so1->obj,so2->obj);
     return server.sort_desc ? -cmp : cmp;
 }
 
+/* Restore the heap property of the 'len' elements max-heap 'v' starting
+ * from the element at index 'i'. */
+static void sortHeapSiftDown(redisSortObject *v, long len, long i) {
+    redisSortObject tmp;
+
+    while(1) {
+        long child = 2*i+1, largest = i;
+
+        if (child < len && sortCompare(&v[child],&v[largest]) > 0)
+            largest = child;
+        if (child+1 < len && sortCompare(&v[child+1],&v[largest]) > 0)
+            largest = child+1;
+        if (largest == i) break;
+        tmp = v[i];
+        v[i] = v[largest];
+        v[largest] = tmp;
+        i = largest;
+    }
+}
+
+/* Move the 'k' first elements of the sorted 'v' vector of 'len' elements
+ * to the head of the vector, sorted. Elements are only swapped, so the
+ * vector keeps holding every element. The selection uses a max-heap of
+ * the best 'k' elements seen so far: most elements are discarded with a
+ * single comparison against the heap root, and the vector is scanned only
+ * once, so this takes O(len*log(k)) against the O(len*log(len)) of a full
+ * sort when LIMIT asks for a few elements of a big collection. */
+static void sortTopK(redisSortObject *v, long len, long k) {
+    redisSortObject tmp;
+    long j;
+
+    for (j = k/2-1; j >= 0; j--) sortHeapSiftDown(v,k,j);
+    for (j = k; j < len; j++) {
+        if (sortCompare(&v[j],&v[0]) < 0) {
+            tmp = v[0];
+            v[0] = v[j];
+            v[j] = tmp;
+            sortHeapSiftDown(v,k,0);
+        }
+    }
+    qsort(v,k,sizeof(redisSortObject),sortCompare);
+}
+
+/* Resolve the GET patterns in 'operations' for the 'count' elements of
+ * 'vector', storing in 'vals' the values of the first element followed by
+ * the ones of the next element, and so forth. When 'byvals' is true the
+ * elements hold the values of the BY pattern, that are reused for the GET
+ * operations using the same pattern instead of looking them up again. */
+static void sortLookupOperations(redisDb *db, list *operations, robj *sortby,
+                                 int byvals, redisSortObject *vector,
+                                 int count, robj **vals)
+{
+    robj *subst[SORT_LOOKUP_BATCH], *res[SORT_LOOKUP_BATCH];
+    int getop = listLength(operations), op = 0, j;
+    listNode *ln;
+    listIter li;
+
+    for (j = 0; j < count; j++) subst[j] = vector[j].obj;
+    listRewind(operations,&li);
+    while((ln = listNext(&li))) {
+        redisSortOperation *sop = ln->value;
+
+        if (byvals && sdscmp(sop->pattern->ptr,sortby->ptr) == 0) {
+            for (j = 0; j < count; j++) {
+                res[j] = vector[j].byval;
+                if (res[j]) incrRefCount(res[j]);
+            }
+        } else {
+            lookupKeysByPattern(db,sop->pattern,subst,res,count);
+        }
+        for (j = 0; j < count; j++) vals[j*getop+op] = res[j];
+        op++;
+    }
+}
+
 /* The SORT command is the most complex command in Redis. Warning: this code
  * is optimized for speed and a bit less for readability */
 void sortCommand(client *c) {
@@ -191,12 +297,14 @@ void sortCommand(client *c) {
     unsigned int outputlen = 0;
     int desc = 0, alpha = 0;
     long limit_start = 0, limit_count = -1, start, end;
-    int j, dontsort = 0, vectorlen;
+    int j, k, op, batch, dontsort = 0, vectorlen;
     int getop = 0; /* GET operation counter */
+    int keepbyval = 0; /* Keep BY values for GET operations */
     int int_convertion_error = 0;
     int syntax_error = 0;
     robj *sortval, *sortby = NULL, *storekey = NULL;
     redisSortObject *vector; /* Resulting vector to sort */
+    robj **vals = NULL; /* GET values of a batch of output elements */
 
     /* Lookup the key to sort. It must be of the right types */
     sortval = lookupKeyRead(c->db,c->argv[1]);
@@ -302,8 +410,9 @@ void sortCommand(client *c) {
     }
 
     /* Destructively convert encoded sorted sets for SORT. */
-    if (sortval->type == OBJ_ZSET)
-        zsetConvert(sortval, OBJ_ENCODING_SKIPLIST);
+    if (sortval->type == OBJ_ZSET &&
+        sortval->encoding == OBJ_ENCODING_ZIPLIST)
+        zsetConvert(sortval, server.zset_large_encoding);
 
     /* Objtain the length of the object to sort. */
     switch(sortval->type) {
@@ -359,8 +468,8 @@ void sortCommand(client *c) {
 
             while(j < vectorlen && listTypeNext(li,&entry)) {
                 vector[j].obj = listTypeGet(&entry);
-                vector[j].u.score = 0;
-                vector[j].u.cmpobj = NULL;
+                vector[j].byval = NULL;
+                vector[j].u.cmpkey = NULL;
                 j++;
             }
             listTypeReleaseIterator(li);
@@ -373,8 +482,8 @@ void sortCommand(client *c) {
         listTypeEntry entry;
         while(listTypeNext(li,&entry)) {
             vector[j].obj = listTypeGet(&entry);
-            vector[j].u.score = 0;
-            vector[j].u.cmpobj = NULL;
+            vector[j].byval = NULL;
+            vector[j].u.cmpkey = NULL;
             j++;
         }
         listTypeReleaseIterator(li);
@@ -383,11 +492,34 @@ void sortCommand(client *c) {
         robj *ele;
         while((ele = setTypeNextObject(si)) != NULL) {
             vector[j].obj = ele;
-            vector[j].u.score = 0;
-            vector[j].u.cmpobj = NULL;
+            vector[j].byval = NULL;
+            vector[j].u.cmpkey = NULL;
             j++;
         }
         setTypeReleaseIterator(si);
+    } else if (sortval->type == OBJ_ZSET && dontsort &&
+               sortval->encoding == OBJ_ENCODING_BTREE) {
+        /* Same as below, for B+tree encoded sorted sets. */
+        zset *zs = sortval->ptr;
+        zbtreeCursor cur;
+        int rangelen = vectorlen;
+
+        if (desc)
+            zbtGetElementByRank(zs->zbt,zs->zbt->length-start,&cur);
+        else
+            zbtGetElementByRank(zs->zbt,start+1,&cur);
+
+        while(rangelen--) {
+            serverAssertWithInfo(c,sortval,cur.leaf != NULL);
+            vector[j].obj = zbtCursorObj(&cur);
+            vector[j].byval = NULL;
+            vector[j].u.cmpkey = NULL;
+            j++;
+            if (desc) zbtPrev(&cur); else zbtNext(&cur);
+        }
+        /* Fix start/end: output code is not aware of this optimization. */
+        end -= start;
+        start = 0;
     } else if (sortval->type == OBJ_ZSET && dontsort) {
         /* Special handling for a sorted set, if 'dontsort' is true.
          * This makes sure we return elements in the sorted set original
@@ -419,8 +551,8 @@ void sortCommand(client *c) {
             serverAssertWithInfo(c,sortval,ln != NULL);
             ele = ln->obj;
             vector[j].obj = ele;
-            vector[j].u.score = 0;
-            vector[j].u.cmpobj = NULL;
+            vector[j].byval = NULL;
+            vector[j].u.cmpkey = NULL;
             j++;
             ln = desc ? ln->backward : ln->level[0].forward;
         }
@@ -434,8 +566,8 @@ void sortCommand(client *c) {
         di = dictGetIterator(set);
         while((setele = dictNext(di)) != NULL) {
             vector[j].obj = dictGetKey(setele);
-            vector[j].u.score = 0;
-            vector[j].u.cmpobj = NULL;
+            vector[j].byval = NULL;
+            vector[j].u.cmpkey = NULL;
             j++;
         }
         dictReleaseIterator(di);
@@ -444,28 +576,49 @@ void sortCommand(client *c) {
     }
     serverAssertWithInfo(c,sortval,j == vectorlen);
 
+    /* When a GET uses the BY pattern, keep the BY values in the vector so
+     * that the same keys are not looked up twice. */
+    if (sortby && !dontsort) {
+        listNode *ln;
+        listIter li;
+
+        listRewind(operations,&li);
+        while((ln = listNext(&li))) {
+            redisSortOperation *sop = ln->value;
+            if (sdscmp(sop->pattern->ptr,sortby->ptr) == 0) keepbyval = 1;
+        }
+    }
+
     /* Now it's time to load the right scores in the sorting vector */
     if (dontsort == 0) {
-        for (j = 0; j < vectorlen; j++) {
-            robj *byval;
+        robj *subst[SORT_LOOKUP_BATCH], *byvals[SORT_LOOKUP_BATCH];
+        int batch, k;
+
+        for (j = 0; j < vectorlen; j += batch) {
+            batch = vectorlen-j;
+            if (batch > SORT_LOOKUP_BATCH) batch = SORT_LOOKUP_BATCH;
+            for (k = 0; k < batch; k++) subst[k] = vector[j+k].obj;
             if (sortby) {
-                /* lookup value to sort by */
-                byval = lookupKeyByPattern(c->db,sortby,vector[j].obj);
-                if (!byval) continue;
+                /* lookup values to sort by */
+                lookupKeysByPattern(c->db,sortby,subst,byvals,batch);
             } else {
-                /* use object itself to sort by */
-                byval = vector[j].obj;
+                /* use objects themselves to sort by */
+                memcpy(byvals,subst,sizeof(robj*)*batch);
             }
 
-            if (alpha) {
-                if (sortby) vector[j].u.cmpobj = getDecodedObject(byval);
-            } else {
-                if (sdsEncodedObject(byval)) {
+            for (k = 0; k < batch; k++) {
+                redisSortObject *so = vector+j+k;
+                robj *byval = byvals[k];
+
+                if (!byval) continue;
+                if (alpha) {
+                    so->u.cmpkey = sortCollationKey(byval,storekey != NULL);
+                } else if (sdsEncodedObject(byval)) {
                     char *eptr;
 
-                    vector[j].u.score = strtod(byval->ptr,&eptr);
+                    so->u.score = strtod(byval->ptr,&eptr);
                     if (eptr[0] != '\0' || errno == ERANGE ||
-                        isnan(vector[j].u.score))
+                        isnan(so->u.score))
                     {
                         int_convertion_error = 1;
                     }
@@ -473,60 +626,64 @@ void sortCommand(client *c) {
                     /* Don't need to decode the object if it's
                      * integer-encoded (the only encoding supported) so
                      * far. We can just cast it */
-                    vector[j].u.score = (long)byval->ptr;
+                    so->u.score = (long)byval->ptr;
                 } else {
                     serverAssertWithInfo(c,sortval,1 != 1);
                 }
-            }
 
-            /* when the object was retrieved using lookupKeyByPattern,
-             * its refcount needs to be decreased. */
-            if (sortby) {
-                decrRefCount(byval);
+                /* when the object was retrieved using lookupKeysByPattern,
+                 * its refcount needs to be decreased, unless we keep it
+                 * for the GET operations. */
+                if (keepbyval)
+                    so->byval = byval;
+                else if (sortby)
+                    decrRefCount(byval);
             }
         }
     }
 
-    if (dontsort == 0) {
+    /* Sort the vector. When LIMIT selects just a few leading elements the
+     * top-k are extracted with a bounded heap, otherwise with a partial
+     * qsort if LIMIT selects a range, or we sort everything. */
+    if (dontsort == 0 && end >= start) {
         server.sort_desc = desc;
         server.sort_alpha = alpha;
         server.sort_bypattern = sortby ? 1 : 0;
         server.sort_store = storekey ? 1 : 0;
-        if (sortby && (start != 0 || end != vectorlen-1))
+        if (end < SORT_TOPK_MAX && end < vectorlen-1)
+            sortTopK(vector,vectorlen,end+1);
+        else if (start != 0 || end != vectorlen-1)
             pqsort(vector,vectorlen,sizeof(redisSortObject),sortCompare, start,end);
         else
             qsort(vector,vectorlen,sizeof(redisSortObject),sortCompare);
     }
 
     /* Send command output to the output buffer, performing the specified
-     * GET/DEL/INCR/DECR operations if any. */
+     * GET/DEL/INCR/DECR operations if any. GET patterns are resolved for
+     * SORT_LOOKUP_BATCH elements at a time. */
     outputlen = getop ? getop*(end-start+1) : end-start+1;
+    if (getop) vals = zmalloc(sizeof(robj*)*getop*SORT_LOOKUP_BATCH);
     if (int_convertion_error) {
         addReplyError(c,"One or more scores can't be converted into double");
     } else if (storekey == NULL) {
         /* STORE option not specified, sent the sorting result to client */
         addReplyMultiBulkLen(c,outputlen);
-        for (j = start; j <= end; j++) {
-            listNode *ln;
-            listIter li;
-
-            if (!getop) addReplyBulk(c,vector[j].obj);
-            listRewind(operations,&li);
-            while((ln = listNext(&li))) {
-                redisSortOperation *sop = ln->value;
-                robj *val = lookupKeyByPattern(c->db,sop->pattern,
-                    vector[j].obj);
-
-                if (sop->type == SORT_OP_GET) {
+        for (j = start; j <= end; j += batch) {
+            batch = end-j+1;
+            if (batch > SORT_LOOKUP_BATCH) batch = SORT_LOOKUP_BATCH;
+            if (getop) sortLookupOperations(c->db,operations,sortby,keepbyval,
+                                            vector+j,batch,vals);
+            for (k = 0; k < batch; k++) {
+                if (!getop) addReplyBulk(c,vector[j+k].obj);
+                for (op = 0; op < getop; op++) {
+                    robj *val = vals[k*getop+op];
+
                     if (!val) {
                         addReply(c,shared.nullbulk);
                     } else {
                         addReplyBulk(c,val);
                         decrRefCount(val);
                     }
-                } else {
-                    /* Always fails */
-                    serverAssertWithInfo(c,sortval,sop->type == SORT_OP_GET);
                 }
             }
         }
@@ -534,31 +691,23 @@ void sortCommand(client *c) {
         robj *sobj = createQuicklistObject();
 
         /* STORE option specified, set the sorting result as a List object */
-        for (j = start; j <= end; j++) {
-            listNode *ln;
-            listIter li;
-
-            if (!getop) {
-                listTypePush(sobj,vector[j].obj,LIST_TAIL);
-            } else {
-                listRewind(operations,&li);
-                while((ln = listNext(&li))) {
-                    redisSortOperation *sop = ln->value;
-                    robj *val = lookupKeyByPattern(c->db,sop->pattern,
-                        vector[j].obj);
-
-                    if (sop->type == SORT_OP_GET) {
-                        if (!val) val = createStringObject("",0);
-
-                        /* listTypePush does an incrRefCount, so we should take care
-                         * care of the incremented refcount caused by either
-                         * lookupKeyByPattern or createStringObject("",0) */
-                        listTypePush(sobj,val,LIST_TAIL);
-                        decrRefCount(val);
-                    } else {
-                        /* Always fails */
-                        serverAssertWithInfo(c,sortval,sop->type == SORT_OP_GET);
-                    }
+        for (j = start; j <= end; j += batch) {
+            batch = end-j+1;
+            if (batch > SORT_LOOKUP_BATCH) batch = SORT_LOOKUP_BATCH;
+            if (getop) sortLookupOperations(c->db,operations,sortby,keepbyval,
+                                            vector+j,batch,vals);
+            for (k = 0; k < batch; k++) {
+                if (!getop) listTypePush(sobj,vector[j+k].obj,LIST_TAIL);
+                for (op = 0; op < getop; op++) {
+                    robj *val = vals[k*getop+op];
+
+                    if (!val) val = createStringObject("",0);
+
+                    /* listTypePush does an incrRefCount, so we should take care
+                     * care of the incremented refcount caused by either
+                     * lookupKeysByPattern or createStringObject("",0) */
+                    listTypePush(sobj,val,LIST_TAIL);
+                    decrRefCount(val);
                 }
             }
         }
@@ -583,8 +732,9 @@ void sortCommand(client *c) {
     decrRefCount(sortval);
     listRelease(operations);
     for (j = 0; j < vectorlen; j++) {
-        if (alpha && vector[j].u.cmpobj)
-            decrRefCount(vector[j].u.cmpobj);
+        if (alpha && vector[j].u.cmpkey) sdsfree(vector[j].u.cmpkey);
+        if (vector[j].byval) decrRefCount(vector[j].byval);
     }
     zfree(vector);
+    zfree(vals);
 }
@@ -0,0 +1,92 @@
+#ifndef __STREAM_H
+#define __STREAM_H
+
+#include "rax.h"
+
+/* Stream item ID: a 128 bit number composed of a milliseconds time and
+ * a sequence counter. IDs generated in the same millisecond (or in a past
+ * millisecond if the clock jumped backward) will use the millisecond time
+ * of the latest generated ID and an incremented sequence. */
+typedef struct streamID {
+    uint64_t ms;        /* Unix time in milliseconds. */
+    uint64_t seq;       /* Sequence number. */
+} streamID;
+
+/* The entries of a stream are stored in ziplists, each one indexed in the
+ * radix tree by the big endian encoded ID of its first entry (the master
+ * entry, see t_stream.c for the details of the format). */
+typedef struct stream {
+    rax *rax;               /* Radix tree of the entries ziplists. */
+    uint64_t length;        /* Number of entries in the stream. */
+    streamID last_id;       /* Zero if there are yet no entries. */
+    rax *cgroups;           /* Consumer groups, name -> streamCG. NULL if
+                             * the stream never had consumer groups. */
+} stream;
+
+/* Iterate the entries of a stream in a range of IDs, see
+ * streamIteratorStart() and the other streamIterator* functions. */
+#define STREAM_INTBUF_SIZE 21 /* Room for integers converted to strings. */
+
+typedef struct streamIterator {
+    stream *stream;         /* The stream we are iterating. */
+    streamID master_id;     /* ID of the master entry of the ziplist. */
+    uint64_t master_fields_count;       /* Master entry number of fields. */
+    unsigned char *master_fields_start; /* Master entry first field. */
+    unsigned char *master_fields_ptr;   /* Master field to emit next. */
+    unsigned char *master_end;  /* Master entry zero terminator. */
+    int entry_flags;        /* Flags of the current entry. */
+    int rev;                /* True if iterating end to start (reverse). */
+    streamID start_id;      /* First ID of the range, inclusive. */
+    streamID end_id;        /* Last ID of the range, inclusive. */
+    raxIterator ri;         /* Radix tree iterator. */
+    unsigned char *zl;      /* Current ziplist, NULL between nodes. */
+    unsigned char *zl_ele;  /* Next field or value of the current entry. */
+    unsigned char *zl_flags;    /* Flags of the current entry. */
+    unsigned char *zl_next; /* Where the next entry is read from: its flags
+                               going forward, the lp-count of the previous
+                               entry going backward. */
+    /* Buffers used to hold the string of ziplist integer elements. */
+    unsigned char field_buf[STREAM_INTBUF_SIZE];
+    unsigned char value_buf[STREAM_INTBUF_SIZE];
+} streamIterator;
+
+/* Consumer group. */
+typedef struct streamCG {
+    streamID last_id;       /* Last delivered (not acknowledged) ID for
+                               this group. Consumers that will just ask
+                               for more messages will served with IDs
+                               > than this. */
+    rax *pel;               /* Pending entries list: the IDs delivered to
+                               the consumers of the group and not yet
+                               acknowledged with XACK, mapped to their
+                               streamNACK. */
+    rax *consumers;         /* Consumers by name, mapped to streamConsumer
+                               structures. */
+} streamCG;
+
+/* A specific consumer in a consumer group. */
+typedef struct streamConsumer {
+    mstime_t seen_time;     /* Last time this consumer was active. */
+    sds name;               /* Consumer name. */
+    rax *pel;               /* The pending entries delivered to this
+                               consumer: the same streamNACK structures of
+                               the group PEL are referenced here. */
+} streamConsumer;
+
+/* Pending (yet not acknowledged) message in a consumer group. */
+typedef struct streamNACK {
+    mstime_t delivery_time;     /* Last time this message was delivered. */
+    uint64_t delivery_count;    /* Number of times this message was
+                                   delivered. */
+    streamConsumer *consumer;   /* The consumer this message was delivered
+                                   to in the last delivery. */
+} streamNACK;
+
+/* Key and group names used to propagate XCLAIM commands to AOF and slaves
+ * when entries are delivered to consumer groups. */
+typedef struct streamPropInfo {
+    struct redisObject *keyname;
+    struct redisObject *groupname;
+} streamPropInfo;
+
+#endif
@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+/* Parameters of the filters created by BF.ADD / BF.MADD and CF.ADD /
+ * CF.ADDNX when the key does not exist. */
+#define BF_DEFAULT_ERROR 0.01
+#define BF_DEFAULT_CAPACITY 100
+#define BF_DEFAULT_EXPANSION 2
+#define CF_DEFAULT_CAPACITY 1024
+#define CF_DEFAULT_EXPANSION 1
+#define CF_DEFAULT_MAXITERATIONS 20
+
+/* Max EXPANSION and MAXITERATIONS accepted by BF.RESERVE / CF.RESERVE. */
+#define FILTER_MAX_EXPANSION 32768
+#define FILTER_MAX_ITERATIONS 65535
+
+/* Both filter types hash the items with the same function. */
+uint64_t filterHashObject(robj *item) {
+    if (sdsEncodedObject(item)) {
+        return MurmurHash64A(item->ptr,sdslen(item->ptr),0x9747b28c);
+    } else {
+        char buf[LONG_STR_SIZE];
+        int len = ll2string(buf,sizeof(buf),(long)item->ptr);
+        return MurmurHash64A(buf,len,0x9747b28c);
+    }
+}
+
+/* Parse the value of the option at c->argv[j], that must be in the range
+ * min..max. Returns C_ERR after replying to the client if the
+ * value is not valid. */
+static int filterParseOptionOrReply(client *c, int j, long long min,
+                                    long long max, long long *target)
+{
+    long long value;
+
+    if (getLongLongFromObjectOrReply(c,c->argv[j+1],&value,NULL) != C_OK)
+        return C_ERR;
+    if (value < min || value > max) {
+        addReplyErrorFormat(c,"%s must be between %lld and %lld",
+            (char*)c->argv[j]->ptr,min,max);
+        return C_ERR;
+    }
+    *target = value;
+    return C_OK;
+}
+
+/* Signal the modification of a filter, 'event' is the keyspace event. */
+static void filterSignalModified(client *c, char *event, long long dirty) {
+    signalModifiedKey(c->db,c->argv[1]);
+    notifyKeyspaceEvent(NOTIFY_GENERIC,event,c->argv[1],c->db->id);
+    server.dirty += dirty;
+}
+
+/*-----------------------------------------------------------------------------
+ * Bloom filter commands
+ *----------------------------------------------------------------------------*/
+
+/* BF.RESERVE key error_rate capacity [EXPANSION expansion] [NONSCALING] */
+void bfreserveCommand(client *c) {
+    long long capacity, expansion = BF_DEFAULT_EXPANSION;
+    int nonscaling = 0, j;
+    double error;
+    bloom *b;
+
+    if (getDoubleFromObjectOrReply(c,c->argv[2],&error,NULL) != C_OK ||
+        getLongLongFromObjectOrReply(c,c->argv[3],&capacity,NULL) != C_OK)
+        return;
+    if (!(error > 0 && error < 1)) {
+        addReplyError(c,"error rate must be between 0 and 1 (exclusive)");
+        return;
+    }
+    if (capacity <= 0) {
+        addReplyError(c,"capacity must be greater than 0");
+        return;
+    }
+    for (j = 4; j < c->argc; j++) {
+        char *opt = c->argv[j]->ptr;
+
+        if (!strcasecmp(opt,"expansion") && j+1 < c->argc) {
+            if (filterParseOptionOrReply(c,j,1,
+                FILTER_MAX_EXPANSION,&expansion) != C_OK) return;
+            j++;
+        } else if (!strcasecmp(opt,"nonscaling")) {
+            nonscaling = 1;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    if (lookupKeyWrite(c->db,c->argv[1]) != NULL) {
+        addReplyError(c,"item exists");
+        return;
+    }
+    if ((b = bloomNew(capacity,error,nonscaling ? 0 : expansion)) == NULL) {
+        addReplyError(c,"filter would be too large");
+        return;
+    }
+    dbAdd(c->db,c->argv[1],createBloomObject(b));
+    filterSignalModified(c,"bf.reserve",1);
+    addReply(c,shared.ok);
+}
+
+/* BF.ADD key item
+ * BF.MADD key item [item ...]
+ *
+ * Create the filter with the default parameters if the key does not exist.
+ * BF.ADD replies 1 if the item was added, 0 if it may have been already
+ * added. BF.MADD replies with an array of such integers. */
+void bfaddCommand(client *c) {
+    int multi = c->cmd->arity < 0, j;
+    long long added = 0;
+    robj *o;
+    bloom *b;
+
+    o = lookupKeyWrite(c->db,c->argv[1]);
+    if (o == NULL) {
+        b = bloomNew(BF_DEFAULT_CAPACITY,BF_DEFAULT_ERROR,
+                     BF_DEFAULT_EXPANSION);
+        o = createBloomObject(b);
+        dbAdd(c->db,c->argv[1],o);
+        added++;
+    } else {
+        if (checkType(c,o,OBJ_BLOOM)) return;
+        b = o->ptr;
+    }
+
+    if (multi) addReplyMultiBulkLen(c,c->argc-2);
+    for (j = 2; j < c->argc; j++) {
+        int retval = bloomAdd(b,filterHashObject(c->argv[j]));
+
+        if (retval == -1) {
+            addReplyError(c,"filter is full");
+        } else {
+            addReply(c,retval ? shared.cone : shared.czero);
+            added += retval;
+        }
+    }
+    if (added) filterSignalModified(c,multi ? "bf.madd" : "bf.add",added);
+}
+
+/* BF.EXISTS key item
+ * BF.MEXISTS key item [item ...]
+ *
+ * Reply 1 if the item may have been added, 0 if it was certainly not. */
+void bfexistsCommand(client *c) {
+    int multi = c->cmd->arity < 0, j;
+    robj *o;
+
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o != NULL && checkType(c,o,OBJ_BLOOM)) return;
+    if (multi) addReplyMultiBulkLen(c,c->argc-2);
+    for (j = 2; j < c->argc; j++) {
+        int exists = o && bloomExists(o->ptr,filterHashObject(c->argv[j]));
+        addReply(c,exists ? shared.cone : shared.czero);
+    }
+}
+
+/* BF.INFO key */
+void bfinfoCommand(client *c) {
+    robj *o;
+    bloom *b;
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_BLOOM)) return;
+    b = o->ptr;
+    addReplyMultiBulkLen(c,12);
+    addReplyBulkCString(c,"Capacity");
+    addReplyLongLong(c,bloomCapacity(b));
+    addReplyBulkCString(c,"Size");
+    addReplyLongLong(c,bloomMemory(b));
+    addReplyBulkCString(c,"Number of filters");
+    addReplyLongLong(c,b->numlayers);
+    addReplyBulkCString(c,"Number of items inserted");
+    addReplyLongLong(c,b->items);
+    addReplyBulkCString(c,"Expansion rate");
+    addReplyLongLong(c,b->expansion);
+    addReplyBulkCString(c,"Error rate");
+    addReplyDouble(c,b->error);
+}
+
+/*-----------------------------------------------------------------------------
+ * Cuckoo filter commands
+ *----------------------------------------------------------------------------*/
+
+/* CF.RESERVE key capacity [MAXITERATIONS iterations] [EXPANSION expansion]
+ *
+ * An expansion of 0 creates a filter that refuses new items once full. */
+void cfreserveCommand(client *c) {
+    long long capacity, expansion = CF_DEFAULT_EXPANSION;
+    long long maxiterations = CF_DEFAULT_MAXITERATIONS;
+    cuckoo *cf;
+    int j;
+
+    if (getLongLongFromObjectOrReply(c,c->argv[2],&capacity,NULL) != C_OK)
+        return;
+    if (capacity <= 0) {
+        addReplyError(c,"capacity must be greater than 0");
+        return;
+    }
+    for (j = 3; j < c->argc; j++) {
+        char *opt = c->argv[j]->ptr;
+
+        if (!strcasecmp(opt,"expansion") && j+1 < c->argc) {
+            if (filterParseOptionOrReply(c,j,0,
+                FILTER_MAX_EXPANSION,&expansion) != C_OK) return;
+            j++;
+        } else if (!strcasecmp(opt,"maxiterations") && j+1 < c->argc) {
+            if (filterParseOptionOrReply(c,j,1,
+                FILTER_MAX_ITERATIONS,&maxiterations) != C_OK) return;
+            j++;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    if (lookupKeyWrite(c->db,c->argv[1]) != NULL) {
+        addReplyError(c,"item exists");
+        return;
+    }
+    if ((cf = cuckooNew(capacity,expansion,maxiterations)) == NULL) {
+        addReplyError(c,"filter would be too large");
+        return;
+    }
+    dbAdd(c->db,c->argv[1],createCuckooObject(cf));
+    filterSignalModified(c,"cf.reserve",1);
+    addReply(c,shared.ok);
+}
+
+/* CF.ADD key item
+ * CF.ADDNX key item
+ *
+ * Create the filter with the default parameters if the key does not exist.
+ * CF.ADD always adds the item, so that it can be added multiple times,
+ * while CF.ADDNX only adds it if it is not already in the filter. Reply 1
+ * if the item was added, 0 if it was not (CF.ADDNX only). */
+void cfaddCommand(client *c) {
+    int nx = !strcasecmp(c->argv[0]->ptr,"cf.addnx");
+    uint64_t hash = filterHashObject(c->argv[2]);
+    cuckoo *cf;
+    robj *o;
+
+    o = lookupKeyWrite(c->db,c->argv[1]);
+    if (o == NULL) {
+        cf = cuckooNew(CF_DEFAULT_CAPACITY,CF_DEFAULT_EXPANSION,
+                       CF_DEFAULT_MAXITERATIONS);
+        o = createCuckooObject(cf);
+        dbAdd(c->db,c->argv[1],o);
+    } else {
+        if (checkType(c,o,OBJ_CUCKOO)) return;
+        cf = o->ptr;
+        if (nx && cuckooExists(cf,hash)) {
+            addReply(c,shared.czero);
+            return;
+        }
+    }
+
+    if (cuckooAdd(cf,hash) == -1) {
+        addReplyError(c,"filter is full");
+        return;
+    }
+    filterSignalModified(c,"cf.add",1);
+    addReply(c,shared.cone);
+}
+
+/* CF.EXISTS key item
+ * CF.MEXISTS key item [item ...]
+ *
+ * Reply 1 if the item may be in the filter, 0 if it is certainly not. */
+void cfexistsCommand(client *c) {
+    int multi = c->cmd->arity < 0, j;
+    robj *o;
+
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o != NULL && checkType(c,o,OBJ_CUCKOO)) return;
+    if (multi) addReplyMultiBulkLen(c,c->argc-2);
+    for (j = 2; j < c->argc; j++) {
+        int exists = o && cuckooExists(o->ptr,filterHashObject(c->argv[j]));
+        addReply(c,exists ? shared.cone : shared.czero);
+    }
+}
+
+/* CF.COUNT key item
+ *
+ * Reply with an upper bound of the number of times the item was added. */
+void cfcountCommand(client *c) {
+    robj *o;
+
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o != NULL && checkType(c,o,OBJ_CUCKOO)) return;
+    addReplyLongLong(c,o ? cuckooCount(o->ptr,filterHashObject(c->argv[2])) : 0);
+}
+
+/* CF.DEL key item
+ *
+ * Remove one copy of the item. Reply 1 if it was found, 0 otherwise. The
+ * filter is not removed when it becomes empty. */
+void cfdelCommand(client *c) {
+    robj *o;
+
+    if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_CUCKOO)) return;
+    if (cuckooDelete(o->ptr,filterHashObject(c->argv[2]))) {
+        filterSignalModified(c,"cf.del",1);
+        addReply(c,shared.cone);
+    } else {
+        addReply(c,shared.czero);
+    }
+}
+
+/* CF.INFO key */
+void cfinfoCommand(client *c) {
+    robj *o;
+    cuckoo *cf;
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_CUCKOO)) return;
+    cf = o->ptr;
+    addReplyMultiBulkLen(c,16);
+    addReplyBulkCString(c,"Size");
+    addReplyLongLong(c,cuckooMemory(cf));
+    addReplyBulkCString(c,"Number of buckets");
+    addReplyLongLong(c,cuckooBuckets(cf));
+    addReplyBulkCString(c,"Number of filters");
+    addReplyLongLong(c,cf->numlayers);
+    addReplyBulkCString(c,"Number of items inserted");
+    addReplyLongLong(c,cf->items);
+    addReplyBulkCString(c,"Number of items deleted");
+    addReplyLongLong(c,cf->deleted);
+    addReplyBulkCString(c,"Bucket size");
+    addReplyLongLong(c,CUCKOO_BUCKET_SLOTS);
+    addReplyBulkCString(c,"Expansion rate");
+    addReplyLongLong(c,cf->expansion);
+    addReplyBulkCString(c,"Max iterations");
+    addReplyLongLong(c,cf->maxiterations);
+}
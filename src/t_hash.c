@@ -479,6 +479,157 @@ void hashTypeConvert(robj *o, int enc) {
     }
 }
 
+/*-----------------------------------------------------------------------------
+ * Hash field expiration
+ *
+ * Volatile fields are tracked outside of the hash value, in db->hexpires,
+ * that maps the key name to a hashFieldExpires structure. This way the
+ * ziplist encoding of small hashes is not affected at all, and hashes
+ * without volatile fields pay nothing.
+ *----------------------------------------------------------------------------*/
+
+hashFieldExpires *hashFieldExpiresCreate(void) {
+    hashFieldExpires *hfe = zmalloc(sizeof(*hfe));
+
+    hfe->fields = dictCreate(&fieldExpireDictType,NULL);
+    hfe->next = LLONG_MAX;
+    return hfe;
+}
+
+void hashFieldExpiresRelease(hashFieldExpires *hfe) {
+    dictRelease(hfe->fields);
+    zfree(hfe);
+}
+
+/* Set the expire of 'field' inside 'hfe'. The field name is copied. */
+void hashFieldExpiresSet(hashFieldExpires *hfe, sds field, long long when) {
+    dictEntry *de;
+
+    if ((de = dictFind(hfe->fields,field)) == NULL)
+        de = dictAddRaw(hfe->fields,sdsdup(field));
+    dictSetSignedIntegerVal(de,when);
+    if (when < hfe->next) hfe->next = when;
+}
+
+/* Return the volatile fields of the hash stored at 'key', or NULL if
+ * the hash has no field with an expire set. */
+hashFieldExpires *hashGetFieldExpires(redisDb *db, robj *key) {
+    dictEntry *de;
+
+    if (dictSize(db->hexpires) == 0 ||
+        (de = dictFind(db->hexpires,key->ptr)) == NULL) return NULL;
+    return dictGetVal(de);
+}
+
+/* Set an expire to the specified field of the hash stored at 'key'.
+ * The key must exist. 'when' is an absolute unix time in milliseconds. */
+void hashSetFieldExpire(redisDb *db, robj *key, robj *field, long long when) {
+    dictEntry *kde, *de;
+    hashFieldExpires *hfe;
+    robj *decoded;
+
+    /* Reuse the sds from the main dict in the hexpires dict */
+    kde = dictFind(db->dict,key->ptr);
+    serverAssertWithInfo(NULL,key,kde != NULL);
+    if ((de = dictFind(db->hexpires,key->ptr)) == NULL) {
+        hfe = hashFieldExpiresCreate();
+        dictAdd(db->hexpires,dictGetKey(kde),hfe);
+    } else {
+        hfe = dictGetVal(de);
+    }
+
+    decoded = getDecodedObject(field);
+    hashFieldExpiresSet(hfe,decoded->ptr,when);
+    decrRefCount(decoded);
+}
+
+/* Remove the expire of the specified field, if any. Returns 1 if an
+ * expire was removed, otherwise 0. When the last volatile field of the
+ * hash is removed the hexpires entry is dropped as well. */
+int hashRemoveFieldExpire(redisDb *db, robj *key, robj *field) {
+    hashFieldExpires *hfe;
+    robj *decoded;
+    int retval;
+
+    if ((hfe = hashGetFieldExpires(db,key)) == NULL) return 0;
+    decoded = getDecodedObject(field);
+    retval = dictDelete(hfe->fields,decoded->ptr) == DICT_OK;
+    decrRefCount(decoded);
+    if (dictSize(hfe->fields) == 0) dictDelete(db->hexpires,key->ptr);
+    return retval;
+}
+
+/* Return the expire time of the specified field, or -1 if the field has
+ * no expire associated. */
+long long hashGetFieldExpire(redisDb *db, robj *key, robj *field) {
+    hashFieldExpires *hfe;
+    dictEntry *de;
+    robj *decoded;
+    long long when = -1;
+
+    if ((hfe = hashGetFieldExpires(db,key)) == NULL) return -1;
+    decoded = getDecodedObject(field);
+    if ((de = dictFind(hfe->fields,decoded->ptr)) != NULL)
+        when = dictGetSignedIntegerVal(de);
+    decrRefCount(decoded);
+    return when;
+}
+
+/* Delete every field of the hash stored at 'key' whose expire is not
+ * greater than 'now', propagating an HDEL for each of them. If the hash
+ * is left empty the key is deleted as well. 'hfe' must be the hexpires
+ * entry of the key, and may be released by this function.
+ *
+ * The number of expired fields is returned. */
+long hashExpireFields(redisDb *db, robj *key, hashFieldExpires *hfe, long long now) {
+    dictIterator *di;
+    dictEntry *de;
+    robj *o;
+    long expired = 0;
+    long long next = LLONG_MAX;
+
+    /* Don't use lookupKey*() here: we are called from the lookup path. */
+    de = dictFind(db->dict,key->ptr);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    o = dictGetVal(de);
+    if (server.rdb_snapshot_active) rdbSnapshotTouchKey(db,key,1);
+    if (server.rdb_delta) rdbDeltaTrackKey(db,key);
+
+    di = dictGetSafeIterator(hfe->fields);
+    while((de = dictNext(di)) != NULL) {
+        sds name = dictGetKey(de);
+        long long when = dictGetSignedIntegerVal(de);
+        robj *field;
+
+        if (when > now) {
+            if (when < next) next = when;
+            continue;
+        }
+        field = createStringObject(name,sdslen(name));
+        propagateHashFieldExpire(db,key,field);
+        hashTypeDelete(o,field);
+        decrRefCount(field);
+        dictDelete(hfe->fields,name);
+        expired++;
+    }
+    dictReleaseIterator(di);
+
+    hfe->next = next;
+    if (expired == 0) return 0;
+
+    server.stat_expiredfields += expired;
+    signalModifiedKey(db,key);
+    notifyKeyspaceEvent(NOTIFY_HASH,"hexpired",key,db->id);
+    if (hashTypeLength(o) == 0) {
+        /* This also releases the hexpires entry. */
+        dbDelete(db,key);
+        notifyKeyspaceEvent(NOTIFY_GENERIC,"del",key,db->id);
+    } else if (dictSize(hfe->fields) == 0) {
+        dictDelete(db->hexpires,key->ptr);
+    }
+    return expired;
+}
+
 /*-----------------------------------------------------------------------------
  * Hash type commands
  *----------------------------------------------------------------------------*/
@@ -491,6 +642,7 @@ void hsetCommand(client *c) {
     hashTypeTryConversion(o,c->argv,2,3);
     hashTypeTryObjectEncoding(o,&c->argv[2], &c->argv[3]);
     update = hashTypeSet(o,c->argv[2],c->argv[3]);
+    if (update) hashRemoveFieldExpire(c->db,c->argv[1],c->argv[2]);
     addReply(c, update ? shared.czero : shared.cone);
     signalModifiedKey(c->db,c->argv[1]);
     notifyKeyspaceEvent(NOTIFY_HASH,"hset",c->argv[1],c->db->id);
@@ -527,7 +679,8 @@ void hmsetCommand(client *c) {
     hashTypeTryConversion(o,c->argv,2,c->argc-1);
     for (i = 2; i < c->argc; i += 2) {
         hashTypeTryObjectEncoding(o,&c->argv[i], &c->argv[i+1]);
-        hashTypeSet(o,c->argv[i],c->argv[i+1]);
+        if (hashTypeSet(o,c->argv[i],c->argv[i+1]))
+            hashRemoveFieldExpire(c->db,c->argv[1],c->argv[i]);
     }
     addReply(c, shared.ok);
     signalModifiedKey(c->db,c->argv[1]);
@@ -680,6 +833,7 @@ void hdelCommand(client *c) {
 
     for (j = 2; j < c->argc; j++) {
         if (hashTypeDelete(o,c->argv[j])) {
+            hashRemoveFieldExpire(c->db,c->argv[1],c->argv[j]);
             deleted++;
             if (hashTypeLength(o) == 0) {
                 dbDelete(c->db,c->argv[1]);
@@ -800,3 +954,221 @@ void hscanCommand(client *c) {
         checkType(c,o,OBJ_HASH)) return;
     scanGenericCommand(c,o,cursor);
 }
+
+/*-----------------------------------------------------------------------------
+ * Hash field expiration commands
+ *----------------------------------------------------------------------------*/
+
+/* Parse the "FIELDS numfields field [field ...]" trailer starting at
+ * argv[pos]. Returns the index of the first field, or -1 after replying
+ * with an error. */
+static int hashParseFieldsOrReply(client *c, int pos) {
+    long long numfields;
+
+    if (strcasecmp(c->argv[pos]->ptr,"fields")) {
+        addReplyError(c,"Mandatory argument FIELDS is missing or not at the right position");
+        return -1;
+    }
+    if (getLongLongFromObjectOrReply(c,c->argv[pos+1],&numfields,NULL)
+        != C_OK) return -1;
+    if (numfields <= 0 || numfields != c->argc-pos-2) {
+        addReplyError(c,"Parameter `numFields` should be greater than 0 and match the number of fields");
+        return -1;
+    }
+    return pos+2;
+}
+
+/* Delete the listed fields of the hash 'o' right away, because they were
+ * given an expire in the past, replying 2 for every deleted field and -2
+ * for missing ones. The command is propagated as an HDEL of the fields
+ * that were actually deleted. */
+static void hexpireDeleteFields(client *c, robj *o, int first) {
+    robj *key = c->argv[1], **argv;
+    int j, argc = 2, keyremoved = 0;
+
+    argv = zmalloc(sizeof(robj*)*(c->argc-first+2));
+    argv[0] = createStringObject("HDEL",4);
+    argv[1] = key;
+    incrRefCount(key);
+    for (j = first; j < c->argc; j++) {
+        if (keyremoved || !hashTypeDelete(o,c->argv[j])) {
+            addReplyLongLong(c,-2);
+            continue;
+        }
+        hashRemoveFieldExpire(c->db,key,c->argv[j]);
+        argv[argc++] = c->argv[j];
+        incrRefCount(c->argv[j]);
+        addReplyLongLong(c,2);
+        if (hashTypeLength(o) == 0) {
+            dbDelete(c->db,key);
+            keyremoved = 1;
+        }
+    }
+
+    if (argc == 2) {
+        /* Nothing was deleted, so nothing to propagate. */
+        for (j = 0; j < argc; j++) decrRefCount(argv[j]);
+        zfree(argv);
+        return;
+    }
+    server.dirty += argc-2;
+    signalModifiedKey(c->db,key);
+    notifyKeyspaceEvent(NOTIFY_HASH,"hdel",key,c->db->id);
+    if (keyremoved)
+        notifyKeyspaceEvent(NOTIFY_GENERIC,"del",key,c->db->id);
+    replaceClientCommandVector(c,argc,argv);
+}
+
+/* This is the generic command implementation for HEXPIRE, HPEXPIRE,
+ * HEXPIREAT and HPEXPIREAT, see expireGenericCommand() for the meaning
+ * of 'basetime' and 'unit'. The reply is an array with one entry per
+ * field: -2 if the field does not exist, 1 if the expire was set, 2 if
+ * the field was deleted because the time is already in the past. */
+void hexpireGenericCommand(client *c, long long basetime, int unit) {
+    robj *key = c->argv[1], *o, *aux;
+    long long when; /* unix time in milliseconds when the fields expire. */
+    int first, j, set = 0;
+
+    if (getLongLongFromObjectOrReply(c,c->argv[2],&when,NULL) != C_OK)
+        return;
+    if ((first = hashParseFieldsOrReply(c,3)) == -1) return;
+    if (unit == UNIT_SECONDS) when *= 1000;
+    when += basetime;
+
+    o = lookupKeyWrite(c->db,key);
+    if (o != NULL && checkType(c,o,OBJ_HASH)) return;
+    addReplyMultiBulkLen(c,c->argc-first);
+    if (o == NULL) {
+        for (j = first; j < c->argc; j++) addReplyLongLong(c,-2);
+        return;
+    }
+
+    /* Like EXPIRE, an expire in the past is executed as a delete only when
+     * we are a master not loading the AOF: otherwise we wait for the
+     * explicit HDEL that the master will send us. */
+    if (when <= mstime() && !server.loading && !server.masterhost) {
+        hexpireDeleteFields(c,o,first);
+        return;
+    }
+
+    for (j = first; j < c->argc; j++) {
+        if (!hashTypeExists(o,c->argv[j])) {
+            addReplyLongLong(c,-2);
+            continue;
+        }
+        hashSetFieldExpire(c->db,key,c->argv[j],when);
+        addReplyLongLong(c,1);
+        set++;
+    }
+    if (set == 0) return;
+
+    /* Propagate the absolute time so that replicas and the AOF agree on
+     * the expire regardless of when the command is applied. */
+    aux = createStringObject("HPEXPIREAT",10);
+    rewriteClientCommandArgument(c,0,aux);
+    decrRefCount(aux);
+    aux = createStringObjectFromLongLong(when);
+    rewriteClientCommandArgument(c,2,aux);
+    decrRefCount(aux);
+    signalModifiedKey(c->db,key);
+    notifyKeyspaceEvent(NOTIFY_HASH,"hexpire",key,c->db->id);
+    server.dirty += set;
+}
+
+void hexpireCommand(client *c) {
+    hexpireGenericCommand(c,mstime(),UNIT_SECONDS);
+}
+
+void hpexpireCommand(client *c) {
+    hexpireGenericCommand(c,mstime(),UNIT_MILLISECONDS);
+}
+
+void hexpireatCommand(client *c) {
+    hexpireGenericCommand(c,0,UNIT_SECONDS);
+}
+
+void hpexpireatCommand(client *c) {
+    hexpireGenericCommand(c,0,UNIT_MILLISECONDS);
+}
+
+/* Implements HTTL, HPTTL, HEXPIRETIME and HPEXPIRETIME. Replies with an
+ * array with one entry per field: -2 if the field does not exist, -1 if
+ * it has no expire, otherwise the TTL or the absolute expire time. */
+void httlGenericCommand(client *c, int output_ms, int output_abs) {
+    robj *o;
+    int first, j;
+
+    if ((first = hashParseFieldsOrReply(c,2)) == -1) return;
+    o = lookupKeyReadWithFlags(c->db,c->argv[1],LOOKUP_NOTOUCH);
+    if (o != NULL && checkType(c,o,OBJ_HASH)) return;
+
+    addReplyMultiBulkLen(c,c->argc-first);
+    for (j = first; j < c->argc; j++) {
+        long long expire, ttl;
+
+        if (o == NULL || !hashTypeExists(o,c->argv[j])) {
+            addReplyLongLong(c,-2);
+            continue;
+        }
+        expire = hashGetFieldExpire(c->db,c->argv[1],c->argv[j]);
+        if (expire == -1) {
+            addReplyLongLong(c,-1);
+            continue;
+        }
+        if (output_abs) {
+            ttl = expire;
+        } else {
+            ttl = expire-mstime();
+            if (ttl < 0) ttl = 0;
+        }
+        if (output_ms)
+            addReplyLongLong(c,ttl);
+        else
+            addReplyLongLong(c,output_abs ? ttl/1000 : (ttl+500)/1000);
+    }
+}
+
+void httlCommand(client *c) {
+    httlGenericCommand(c,0,0);
+}
+
+void hpttlCommand(client *c) {
+    httlGenericCommand(c,1,0);
+}
+
+void hexpiretimeCommand(client *c) {
+    httlGenericCommand(c,0,1);
+}
+
+void hpexpiretimeCommand(client *c) {
+    httlGenericCommand(c,1,1);
+}
+
+/* HPERSIST key FIELDS numfields field [field ...]
+ * Replies -2 for missing fields, -1 for fields without an expire and 1
+ * for fields whose expire was removed. */
+void hpersistCommand(client *c) {
+    robj *o;
+    int first, j, removed = 0;
+
+    if ((first = hashParseFieldsOrReply(c,2)) == -1) return;
+    o = lookupKeyWrite(c->db,c->argv[1]);
+    if (o != NULL && checkType(c,o,OBJ_HASH)) return;
+
+    addReplyMultiBulkLen(c,c->argc-first);
+    for (j = first; j < c->argc; j++) {
+        if (o == NULL || !hashTypeExists(o,c->argv[j])) {
+            addReplyLongLong(c,-2);
+        } else if (hashRemoveFieldExpire(c->db,c->argv[1],c->argv[j])) {
+            addReplyLongLong(c,1);
+            removed++;
+        } else {
+            addReplyLongLong(c,-1);
+        }
+    }
+    if (removed) {
+        signalModifiedKey(c->db,c->argv[1]);
+        notifyKeyspaceEvent(NOTIFY_HASH,"hpersist",c->argv[1],c->db->id);
+        server.dirty += removed;
+    }
+}
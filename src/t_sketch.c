@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "server.h"
+#include <math.h>
+
+/* Dimensions of the sketch of TOPK.RESERVE when not specified: the width
+ * grows with k so that the estimates of the top-k items are accurate. */
+#define TOPK_DEFAULT_WIDTH_PER_ITEM 8
+#define TOPK_MIN_DEFAULT_WIDTH 256
+#define TOPK_DEFAULT_DEPTH 5
+
+/* Parse c->argv[j] as a 32 bit unsigned integer. Returns C_ERR after
+ * replying to the client if the value is not valid. */
+static int sketchParseUInt32OrReply(client *c, int j, uint32_t min,
+                                    uint32_t *target)
+{
+    long long value;
+
+    if (getLongLongFromObjectOrReply(c,c->argv[j],&value,NULL) != C_OK)
+        return C_ERR;
+    if (value < min || value > UINT32_MAX) {
+        addReplyErrorFormat(c,"value must be between %u and %u",
+            min,UINT32_MAX);
+        return C_ERR;
+    }
+    *target = value;
+    return C_OK;
+}
+
+/* Signal the modification of a sketch, 'event' is the keyspace event. */
+static void sketchSignalModified(client *c, char *event, long long dirty) {
+    signalModifiedKey(c->db,c->argv[1]);
+    notifyKeyspaceEvent(NOTIFY_GENERIC,event,c->argv[1],c->db->id);
+    server.dirty += dirty;
+}
+
+/* Parse the "numkeys key [key ...]" arguments of CMS.MERGE / TOPK.MERGE
+ * starting at c->argv[2], looking up the source keys, that must exist and
+ * be of the specified type. On success the objects are returned in a newly
+ * allocated array, and the number of keys in '*numkeys'. Otherwise NULL is
+ * returned after replying to the client. */
+static robj **sketchLookupMergeSourcesOrReply(client *c, int type,
+                                              long *numkeys)
+{
+    robj **src;
+    long j;
+
+    if (getLongFromObjectOrReply(c,c->argv[2],numkeys,NULL) != C_OK)
+        return NULL;
+    if (*numkeys < 1) {
+        addReplyError(c,"at least 1 input key is needed");
+        return NULL;
+    }
+    if (*numkeys > c->argc-3) {
+        addReply(c,shared.syntaxerr);
+        return NULL;
+    }
+
+    src = zmalloc(sizeof(robj*)*(*numkeys));
+    for (j = 0; j < *numkeys; j++) {
+        src[j] = lookupKeyRead(c->db,c->argv[3+j]);
+        if (src[j] == NULL) {
+            addReply(c,shared.nokeyerr);
+        } else if (src[j]->type != type) {
+            addReply(c,shared.wrongtypeerr);
+        } else {
+            continue;
+        }
+        zfree(src);
+        return NULL;
+    }
+    return src;
+}
+
+/*-----------------------------------------------------------------------------
+ * Count-min sketch commands
+ *----------------------------------------------------------------------------*/
+
+/* Create the sketch at c->argv[1] unless the key already exists. */
+static void cmsCreateKey(client *c, uint32_t width, uint32_t depth) {
+    cms *s;
+
+    if (lookupKeyWrite(c->db,c->argv[1]) != NULL) {
+        addReplyError(c,"item exists");
+        return;
+    }
+    if ((s = cmsNew(width,depth)) == NULL) {
+        addReplyError(c,"sketch would be too large");
+        return;
+    }
+    dbAdd(c->db,c->argv[1],createCmsObject(s));
+    sketchSignalModified(c,c->cmd->name,1);
+    addReply(c,shared.ok);
+}
+
+/* CMS.INITBYDIM key width depth */
+void cmsinitbydimCommand(client *c) {
+    uint32_t width, depth;
+
+    if (sketchParseUInt32OrReply(c,2,1,&width) != C_OK ||
+        sketchParseUInt32OrReply(c,3,1,&depth) != C_OK) return;
+    cmsCreateKey(c,width,depth);
+}
+
+/* CMS.INITBYPROB key error probability
+ *
+ * Size the sketch so that an estimate exceeds the real count by more than
+ * error * (sum of all the increments) with the specified probability at
+ * most. */
+void cmsinitbyprobCommand(client *c) {
+    double error, prob, width, depth;
+
+    if (getDoubleFromObjectOrReply(c,c->argv[2],&error,NULL) != C_OK ||
+        getDoubleFromObjectOrReply(c,c->argv[3],&prob,NULL) != C_OK)
+        return;
+    if (!(error > 0 && error < 1) || !(prob > 0 && prob < 1)) {
+        addReplyError(c,
+            "error and probability must be between 0 and 1 (exclusive)");
+        return;
+    }
+    width = ceil(2/error);
+    depth = ceil(log(prob)/log(0.5));
+    if (width > UINT32_MAX || depth > UINT32_MAX) {
+        addReplyError(c,"sketch would be too large");
+        return;
+    }
+    cmsCreateKey(c,width,depth);
+}
+
+/* CMS.INCRBY key item increment [item increment ...]
+ *
+ * Reply with the new estimates of the items. Increments that would
+ * overflow a counter are not performed, and reply with an error. */
+void cmsincrbyCommand(client *c) {
+    uint32_t *incr;
+    long long incremented = 0;
+    int j;
+    robj *o;
+    cms *s;
+
+    if ((c->argc % 2) != 0) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_CMS)) return;
+    s = o->ptr;
+
+    /* Parse all the increments before touching the sketch. */
+    incr = zmalloc(sizeof(uint32_t)*(c->argc/2));
+    for (j = 2; j < c->argc; j += 2) {
+        if (sketchParseUInt32OrReply(c,j+1,0,incr+j/2-1) != C_OK) {
+            zfree(incr);
+            return;
+        }
+    }
+
+    addReplyMultiBulkLen(c,(c->argc-2)/2);
+    for (j = 2; j < c->argc; j += 2) {
+        uint32_t count;
+
+        if (cmsIncrBy(s,filterHashObject(c->argv[j]),incr[j/2-1],&count)) {
+            addReplyLongLong(c,count);
+            incremented++;
+        } else {
+            addReplyError(c,"counter overflow");
+        }
+    }
+    zfree(incr);
+    if (incremented) sketchSignalModified(c,"cms.incrby",incremented);
+}
+
+/* CMS.QUERY key item [item ...] */
+void cmsqueryCommand(client *c) {
+    robj *o;
+    int j;
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_CMS)) return;
+    addReplyMultiBulkLen(c,c->argc-2);
+    for (j = 2; j < c->argc; j++)
+        addReplyLongLong(c,cmsQuery(o->ptr,filterHashObject(c->argv[j])));
+}
+
+/* CMS.MERGE destination numkeys key [key ...] [WEIGHTS weight [weight ...]]
+ *
+ * Set the destination sketch, that must exist, to the weighted sum of the
+ * source sketches. All the sketches must have the same dimensions, so that
+ * sketches maintained by different shards can be combined. */
+void cmsmergeCommand(client *c) {
+    robj *dst, **src;
+    uint32_t *weights = NULL;
+    cms **sketches;
+    long numkeys, j;
+    int merged;
+
+    if ((dst = lookupKeyWriteOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,dst,OBJ_CMS)) return;
+    if ((src = sketchLookupMergeSourcesOrReply(c,OBJ_CMS,&numkeys)) == NULL)
+        return;
+
+    if (3+numkeys < c->argc) {
+        if (c->argc != 3+numkeys*2+1 ||
+            strcasecmp(c->argv[3+numkeys]->ptr,"weights"))
+        {
+            zfree(src);
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        weights = zmalloc(sizeof(uint32_t)*numkeys);
+        for (j = 0; j < numkeys; j++) {
+            if (sketchParseUInt32OrReply(c,4+numkeys+j,0,weights+j) != C_OK) {
+                zfree(weights);
+                zfree(src);
+                return;
+            }
+        }
+    }
+
+    sketches = zmalloc(sizeof(cms*)*numkeys);
+    for (j = 0; j < numkeys; j++) {
+        cms *s = src[j]->ptr, *d = dst->ptr;
+
+        if (s->width != d->width || s->depth != d->depth) {
+            addReplyError(c,"sketches must have the same width and depth");
+            goto cleanup;
+        }
+        sketches[j] = s;
+    }
+    merged = cmsMerge(dst->ptr,sketches,weights,numkeys);
+    if (merged) {
+        sketchSignalModified(c,"cms.merge",1);
+        addReply(c,shared.ok);
+    } else {
+        addReplyError(c,"counter overflow");
+    }
+
+cleanup:
+    zfree(sketches);
+    zfree(weights);
+    zfree(src);
+}
+
+/* CMS.INFO key */
+void cmsinfoCommand(client *c) {
+    robj *o;
+    cms *s;
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_CMS)) return;
+    s = o->ptr;
+    addReplyMultiBulkLen(c,6);
+    addReplyBulkCString(c,"width");
+    addReplyLongLong(c,s->width);
+    addReplyBulkCString(c,"depth");
+    addReplyLongLong(c,s->depth);
+    addReplyBulkCString(c,"count");
+    addReplyLongLong(c,s->count);
+}
+
+/*-----------------------------------------------------------------------------
+ * Top-k commands
+ *----------------------------------------------------------------------------*/
+
+/* TOPK.RESERVE key k [width depth] */
+void topkreserveCommand(client *c) {
+    uint32_t k, width, depth = TOPK_DEFAULT_DEPTH;
+    topk *t;
+
+    if (c->argc != 3 && c->argc != 5) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (sketchParseUInt32OrReply(c,2,1,&k) != C_OK) return;
+    if (k > TOPK_MAX_K) {
+        addReplyErrorFormat(c,"k must be between 1 and %d",TOPK_MAX_K);
+        return;
+    }
+    width = k*TOPK_DEFAULT_WIDTH_PER_ITEM;
+    if (width < TOPK_MIN_DEFAULT_WIDTH) width = TOPK_MIN_DEFAULT_WIDTH;
+    if (c->argc == 5 &&
+        (sketchParseUInt32OrReply(c,3,1,&width) != C_OK ||
+         sketchParseUInt32OrReply(c,4,1,&depth) != C_OK)) return;
+
+    if (lookupKeyWrite(c->db,c->argv[1]) != NULL) {
+        addReplyError(c,"item exists");
+        return;
+    }
+    if ((t = topkNew(k,width,depth)) == NULL) {
+        addReplyError(c,"sketch would be too large");
+        return;
+    }
+    dbAdd(c->db,c->argv[1],createTopkObject(t));
+    sketchSignalModified(c,"topk.reserve",1);
+    addReply(c,shared.ok);
+}
+
+/* Implements TOPK.ADD and TOPK.INCRBY, the items and their increments start
+ * at c->argv[2] and are 'step' arguments apart. Reply for every item with
+ * the item it expelled from the top-k, or with a null bulk. */
+static void topkAddGenericCommand(client *c, int step) {
+    uint32_t *incr;
+    long long incremented = 0;
+    int j;
+    robj *o;
+    topk *t;
+
+    if (((c->argc-2) % step) != 0) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_TOPK)) return;
+    t = o->ptr;
+
+    /* Parse all the increments before touching the structure. */
+    incr = zmalloc(sizeof(uint32_t)*((c->argc-2)/step));
+    for (j = 2; j < c->argc; j += step) {
+        if (step == 1) {
+            incr[j-2] = 1;
+        } else if (sketchParseUInt32OrReply(c,j+1,0,incr+(j-2)/step) != C_OK) {
+            zfree(incr);
+            return;
+        }
+    }
+
+    addReplyMultiBulkLen(c,(c->argc-2)/step);
+    for (j = 2; j < c->argc; j += step) {
+        robj *item = getDecodedObject(c->argv[j]);
+        sds expelled;
+
+        if (topkIncrBy(t,item->ptr,sdslen(item->ptr),filterHashObject(item),
+                       incr[(j-2)/step],&expelled))
+        {
+            if (expelled) {
+                addReplyBulkSds(c,expelled);
+            } else {
+                addReply(c,shared.nullbulk);
+            }
+            incremented++;
+        } else {
+            addReplyError(c,"counter overflow");
+        }
+        decrRefCount(item);
+    }
+    zfree(incr);
+    if (incremented)
+        sketchSignalModified(c,step == 1 ? "topk.add" : "topk.incrby",
+                             incremented);
+}
+
+/* TOPK.ADD key item [item ...] */
+void topkaddCommand(client *c) {
+    topkAddGenericCommand(c,1);
+}
+
+/* TOPK.INCRBY key item increment [item increment ...] */
+void topkincrbyCommand(client *c) {
+    topkAddGenericCommand(c,2);
+}
+
+/* TOPK.QUERY key item [item ...]
+ * TOPK.COUNT key item [item ...]
+ *
+ * Reply whether the items are in the top-k, or with their estimated count
+ * if 'count' is true. */
+static void topkQueryGenericCommand(client *c, int count) {
+    robj *o;
+    topk *t;
+    int j;
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_TOPK)) return;
+    t = o->ptr;
+    addReplyMultiBulkLen(c,c->argc-2);
+    for (j = 2; j < c->argc; j++) {
+        robj *item = getDecodedObject(c->argv[j]);
+        uint64_t hash = filterHashObject(item);
+
+        if (count) {
+            addReplyLongLong(c,cmsQuery(t->sketch,hash));
+        } else {
+            int found = topkQuery(t,item->ptr,sdslen(item->ptr),hash);
+            addReply(c,found ? shared.cone : shared.czero);
+        }
+        decrRefCount(item);
+    }
+}
+
+void topkqueryCommand(client *c) {
+    topkQueryGenericCommand(c,0);
+}
+
+void topkcountCommand(client *c) {
+    topkQueryGenericCommand(c,1);
+}
+
+/* TOPK.LIST key [WITHCOUNT]
+ *
+ * Reply with the top-k items, highest count first. */
+void topklistCommand(client *c) {
+    int withcount = 0;
+    topkItem *items;
+    uint32_t j;
+    robj *o;
+    topk *t;
+
+    if (c->argc > 3 ||
+        (c->argc == 3 && strcasecmp(c->argv[2]->ptr,"withcount")))
+    {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    withcount = c->argc == 3;
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_TOPK)) return;
+    t = o->ptr;
+
+    items = topkList(t);
+    addReplyMultiBulkLen(c,t->numitems*(withcount ? 2 : 1));
+    for (j = 0; j < t->numitems; j++) {
+        addReplyBulkCBuffer(c,items[j].item,sdslen(items[j].item));
+        if (withcount) addReplyLongLong(c,items[j].count);
+    }
+    zfree(items);
+}
+
+/* TOPK.MERGE destination numkeys key [key ...]
+ *
+ * Set the destination, that must exist, to the top-k of the union of the
+ * sources. The sketches must have the same dimensions, while the number of
+ * items kept is the one of the destination. */
+void topkmergeCommand(client *c) {
+    robj *dst, **src;
+    topk **sources;
+    long numkeys, j;
+
+    if ((dst = lookupKeyWriteOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,dst,OBJ_TOPK)) return;
+    if ((src = sketchLookupMergeSourcesOrReply(c,OBJ_TOPK,&numkeys)) == NULL)
+        return;
+    if (3+numkeys != c->argc) {
+        zfree(src);
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
+    sources = zmalloc(sizeof(topk*)*numkeys);
+    for (j = 0; j < numkeys; j++) sources[j] = src[j]->ptr;
+    if (topkMerge(dst->ptr,sources,numkeys)) {
+        sketchSignalModified(c,"topk.merge",1);
+        addReply(c,shared.ok);
+    } else {
+        addReplyError(c,
+            "sketches must have the same width and depth, "
+            "and counters must not overflow");
+    }
+    zfree(sources);
+    zfree(src);
+}
+
+/* TOPK.INFO key */
+void topkinfoCommand(client *c) {
+    robj *o;
+    topk *t;
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_TOPK)) return;
+    t = o->ptr;
+    addReplyMultiBulkLen(c,8);
+    addReplyBulkCString(c,"k");
+    addReplyLongLong(c,t->k);
+    addReplyBulkCString(c,"width");
+    addReplyLongLong(c,t->sketch->width);
+    addReplyBulkCString(c,"depth");
+    addReplyLongLong(c,t->sketch->depth);
+    addReplyBulkCString(c,"memory");
+    addReplyLongLong(c,topkMemory(t));
+}
@@ -242,7 +242,7 @@ void setrangeCommand(client *c) {
 }
 
 void getrangeCommand(client *c) {
-    robj *o;
+    robj *o, *decoded = NULL;
     long long start, end;
     char *str, llbuf[32];
     size_t strlen;
@@ -257,7 +257,13 @@ void getrangeCommand(client *c) {
     if (o->encoding == OBJ_ENCODING_INT) {
         str = llbuf;
         strlen = ll2string(llbuf,sizeof(llbuf),(long)o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_ROARING) {
+        /* Bitmaps only materialize the requested range, see below. */
+        str = NULL;
+        strlen = ((roaring*)o->ptr)->len;
     } else {
+        /* Compressed strings are decompressed in a temporary object. */
+        if (o->encoding == OBJ_ENCODING_LZF) o = decoded = getDecodedObject(o);
         str = o->ptr;
         strlen = sdslen(str);
     }
@@ -265,6 +271,7 @@ void getrangeCommand(client *c) {
     /* Convert negative indexes */
     if (start < 0 && end < 0 && start > end) {
         addReply(c,shared.emptybulk);
+        if (decoded) decrRefCount(decoded);
         return;
     }
     if (start < 0) start = strlen+start;
@@ -277,9 +284,15 @@ void getrangeCommand(client *c) {
      * nothing can be returned is: start > end. */
     if (start > end || strlen == 0) {
         addReply(c,shared.emptybulk);
+    } else if (str == NULL) {
+        sds range = sdsnewlen(NULL,end-start+1);
+
+        roaringGetRange(o->ptr,start,(unsigned char*)range,end-start+1);
+        addReplyBulkSds(c,range);
     } else {
         addReplyBulkCBuffer(c,(char*)str+start,end-start+1);
     }
+    if (decoded) decrRefCount(decoded);
 }
 
 void mgetCommand(client *c) {
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "server.h"
+
+/* Aggregations of TS.RANGE. */
+#define TS_AGG_NONE 0
+#define TS_AGG_AVG 1
+#define TS_AGG_SUM 2
+#define TS_AGG_MIN 3
+#define TS_AGG_MAX 4
+#define TS_AGG_COUNT 5
+#define TS_AGG_FIRST 6
+#define TS_AGG_LAST 7
+#define TS_AGG_RANGE 8
+
+static char *tsAggregationNames[] = {
+    NULL, "avg", "sum", "min", "max", "count", "first", "last", "range"
+};
+#define TS_AGG_NUM (sizeof(tsAggregationNames)/sizeof(char*))
+
+/* State of the aggregation of a bucket. */
+typedef struct tsBucket {
+    int64_t start;
+    long long count;
+    double sum, min, max, first, last;
+} tsBucket;
+
+/* Parse a timestamp, that is a non negative number of milliseconds.
+ * Returns C_ERR after replying to the client if it is not valid. */
+static int tsParseTimestampOrReply(client *c, robj *o, int64_t *ts) {
+    long long value;
+
+    if (getLongLongFromObjectOrReply(c,o,&value,NULL) != C_OK) return C_ERR;
+    if (value < 0) {
+        addReplyError(c,"timestamp must be a non negative integer");
+        return C_ERR;
+    }
+    *ts = value;
+    return C_OK;
+}
+
+/* Parse the [RETENTION ms] [CHUNK_SIZE bytes] options starting at
+ * c->argv[j]. Returns C_ERR after replying to the client on error. */
+static int tsParseOptionsOrReply(client *c, int j, long long *retention,
+                                 long long *chunksize)
+{
+    for (; j < c->argc; j++) {
+        char *opt = c->argv[j]->ptr;
+        int moreargs = j+1 < c->argc;
+
+        if (!strcasecmp(opt,"retention") && moreargs) {
+            if (getLongLongFromObjectOrReply(c,c->argv[j+1],retention,NULL)
+                != C_OK) return C_ERR;
+            if (*retention < 0) {
+                addReplyError(c,"retention must be a non negative integer");
+                return C_ERR;
+            }
+            j++;
+        } else if (!strcasecmp(opt,"chunk_size") && moreargs) {
+            if (getLongLongFromObjectOrReply(c,c->argv[j+1],chunksize,NULL)
+                != C_OK) return C_ERR;
+            if (*chunksize < TS_MIN_CHUNK_SIZE ||
+                *chunksize > TS_MAX_CHUNK_SIZE)
+            {
+                addReplyErrorFormat(c,"chunk size must be between %d and %d",
+                    TS_MIN_CHUNK_SIZE,TS_MAX_CHUNK_SIZE);
+                return C_ERR;
+            }
+            j++;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return C_ERR;
+        }
+    }
+    return C_OK;
+}
+
+/* Signal the modification of a series, 'event' is the keyspace event. */
+static void tsSignalModified(client *c, char *event) {
+    signalModifiedKey(c->db,c->argv[1]);
+    notifyKeyspaceEvent(NOTIFY_GENERIC,event,c->argv[1],c->db->id);
+    server.dirty++;
+}
+
+static void tsAddReplySample(client *c, int64_t ts, double value) {
+    addReplyMultiBulkLen(c,2);
+    addReplyLongLong(c,ts);
+    addReplyDouble(c,value);
+}
+
+/*-----------------------------------------------------------------------------
+ * Time series commands
+ *----------------------------------------------------------------------------*/
+
+/* TS.CREATE key [RETENTION ms] [CHUNK_SIZE bytes] */
+void tscreateCommand(client *c) {
+    long long retention = 0, chunksize = TS_DEFAULT_CHUNK_SIZE;
+
+    if (tsParseOptionsOrReply(c,2,&retention,&chunksize) != C_OK) return;
+    if (lookupKeyWrite(c->db,c->argv[1]) != NULL) {
+        addReplyError(c,"key already exists");
+        return;
+    }
+    dbAdd(c->db,c->argv[1],
+          createTimeseriesObject(tsNew(retention,chunksize)));
+    tsSignalModified(c,"ts.create");
+    addReply(c,shared.ok);
+}
+
+/* TS.ADD key timestamp|* value [RETENTION ms] [CHUNK_SIZE bytes]
+ *
+ * Append a sample, creating the series with the specified options if the
+ * key does not exist. A timestamp of "*" is the current time, and is
+ * propagated as the actual timestamp. Reply with the timestamp. */
+void tsaddCommand(client *c) {
+    long long retention = 0, chunksize = TS_DEFAULT_CHUNK_SIZE;
+    double value;
+    int64_t ts;
+    robj *o;
+
+    if (!strcmp(c->argv[2]->ptr,"*")) {
+        ts = mstime();
+    } else if (tsParseTimestampOrReply(c,c->argv[2],&ts) != C_OK) {
+        return;
+    }
+    if (getDoubleFromObjectOrReply(c,c->argv[3],&value,NULL) != C_OK ||
+        tsParseOptionsOrReply(c,4,&retention,&chunksize) != C_OK) return;
+
+    o = lookupKeyWrite(c->db,c->argv[1]);
+    if (o != NULL && checkType(c,o,OBJ_TIMESERIES)) return;
+    if (o == NULL) {
+        o = createTimeseriesObject(tsNew(retention,chunksize));
+        dbAdd(c->db,c->argv[1],o);
+    }
+    if (!tsAdd(o->ptr,ts,value)) {
+        addReplyError(c,
+            "timestamp must be greater than the last sample timestamp");
+        return;
+    }
+
+    if (!strcmp(c->argv[2]->ptr,"*")) {
+        robj *tsarg = createStringObjectFromLongLong(ts);
+        rewriteClientCommandArgument(c,2,tsarg);
+        decrRefCount(tsarg);
+    }
+    tsSignalModified(c,"ts.add");
+    addReplyLongLong(c,ts);
+}
+
+/* TS.GET key
+ *
+ * Reply with the last sample, or an empty array if there is none. */
+void tsgetCommand(client *c) {
+    double value;
+    int64_t ts;
+    robj *o;
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_TIMESERIES)) return;
+    if (tsLast(o->ptr,&ts,&value))
+        tsAddReplySample(c,ts,value);
+    else
+        addReply(c,shared.emptymultibulk);
+}
+
+/* Emit the aggregation of a bucket. */
+static void tsAddReplyBucket(client *c, tsBucket *b, int agg) {
+    double value;
+
+    switch(agg) {
+    case TS_AGG_AVG: value = b->sum/b->count; break;
+    case TS_AGG_SUM: value = b->sum; break;
+    case TS_AGG_MIN: value = b->min; break;
+    case TS_AGG_MAX: value = b->max; break;
+    case TS_AGG_COUNT: value = b->count; break;
+    case TS_AGG_FIRST: value = b->first; break;
+    case TS_AGG_LAST: value = b->last; break;
+    default: value = b->max-b->min; break;
+    }
+    tsAddReplySample(c,b->start,value);
+}
+
+/* TS.RANGE key from to [COUNT count] [AGGREGATION type bucket]
+ *
+ * Reply with the samples with timestamps between 'from' and 'to', that can
+ * be "-" and "+" for the oldest and newest, or with the aggregation of the
+ * samples in buckets of 'bucket' milliseconds aligned to the epoch, where
+ * 'type' is one of avg, sum, min, max, count, first, last and range. The
+ * aggregation is performed while decoding the chunks, so only the buckets
+ * are buffered in the reply. COUNT limits the number of samples or buckets
+ * in the reply. */
+void tsrangeCommand(client *c) {
+    int64_t from, to, ts, bucketlen = 0;
+    long long count = -1, emitted = 0;
+    int agg = TS_AGG_NONE, j;
+    tsIterator it;
+    tsBucket b;
+    double value;
+    void *replylen;
+    robj *o;
+
+    if (!strcmp(c->argv[2]->ptr,"-"))
+        from = 0;
+    else if (tsParseTimestampOrReply(c,c->argv[2],&from) != C_OK)
+        return;
+    if (!strcmp(c->argv[3]->ptr,"+"))
+        to = INT64_MAX;
+    else if (tsParseTimestampOrReply(c,c->argv[3],&to) != C_OK)
+        return;
+
+    for (j = 4; j < c->argc; j++) {
+        char *opt = c->argv[j]->ptr;
+
+        if (!strcasecmp(opt,"count") && j+1 < c->argc) {
+            if (getLongLongFromObjectOrReply(c,c->argv[j+1],&count,NULL)
+                != C_OK) return;
+            if (count < 0) count = -1;
+            j++;
+        } else if (!strcasecmp(opt,"aggregation") && j+2 < c->argc) {
+            long long len;
+
+            for (agg = 1; agg < (int)TS_AGG_NUM; agg++)
+                if (!strcasecmp(c->argv[j+1]->ptr,tsAggregationNames[agg]))
+                    break;
+            if (agg == TS_AGG_NUM) {
+                addReplyError(c,"unknown aggregation type");
+                return;
+            }
+            if (getLongLongFromObjectOrReply(c,c->argv[j+2],&len,NULL)
+                != C_OK) return;
+            if (len <= 0) {
+                addReplyError(c,"bucket duration must be greater than 0");
+                return;
+            }
+            bucketlen = len;
+            j += 2;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk))
+        == NULL || checkType(c,o,OBJ_TIMESERIES)) return;
+
+    replylen = addDeferredMultiBulkLength(c);
+    tsIterInit(&it,o->ptr,from,to);
+    b.count = 0;
+    while (count != emitted && tsIterNext(&it,&ts,&value)) {
+        if (agg == TS_AGG_NONE) {
+            tsAddReplySample(c,ts,value);
+            emitted++;
+            continue;
+        }
+        if (b.count && ts-b.start >= bucketlen) {
+            tsAddReplyBucket(c,&b,agg);
+            emitted++;
+            b.count = 0;
+            if (count == emitted) break;
+        }
+        if (b.count == 0) {
+            b.start = ts-ts%bucketlen;
+            b.sum = 0;
+            b.min = b.max = b.first = value;
+        }
+        b.count++;
+        b.sum += value;
+        if (value < b.min) b.min = value;
+        if (value > b.max) b.max = value;
+        b.last = value;
+    }
+    if (b.count && count != emitted) {
+        tsAddReplyBucket(c,&b,agg);
+        emitted++;
+    }
+    setDeferredMultiBulkLength(c,replylen,emitted);
+}
+
+/* TS.INFO key */
+void tsinfoCommand(client *c) {
+    int64_t first = -1, last = -1, ts;
+    timeseries *s;
+    tsIterator it;
+    double value;
+    robj *o;
+
+    if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nokeyerr)) == NULL ||
+        checkType(c,o,OBJ_TIMESERIES)) return;
+    s = o->ptr;
+    tsIterInit(&it,s,0,INT64_MAX);
+    if (tsIterNext(&it,&ts,&value)) first = ts;
+    tsLast(s,&last,&value);
+
+    addReplyMultiBulkLen(c,14);
+    addReplyBulkCString(c,"totalSamples");
+    addReplyLongLong(c,s->numsamples);
+    addReplyBulkCString(c,"memoryUsage");
+    addReplyLongLong(c,tsMemory(s));
+    addReplyBulkCString(c,"firstTimestamp");
+    addReplyLongLong(c,first);
+    addReplyBulkCString(c,"lastTimestamp");
+    addReplyLongLong(c,last);
+    addReplyBulkCString(c,"retentionTime");
+    addReplyLongLong(c,s->retention);
+    addReplyBulkCString(c,"chunkCount");
+    addReplyLongLong(c,s->numchunks);
+    addReplyBulkCString(c,"chunkSize");
+    addReplyLongLong(c,s->chunksize);
+}
@@ -163,6 +163,46 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
     return x;
 }
 
+/* Append a new node at the tail of the skiplist. The caller must guarantee
+ * that the element is greater than every element already in the skiplist.
+ *
+ * No search is performed: 'last' and 'rank' hold, for every level, the last
+ * node and its rank, so that the append is O(1). Before the first call they
+ * must be set to the header and zero for every level, which requires the
+ * skiplist to be empty. They are updated by this function. */
+zskiplistNode *zslAppend(zskiplist *zsl, zskiplistNode **last,
+                         unsigned long *rank, double score, robj *obj)
+{
+    zskiplistNode *x;
+    int i, level;
+
+    serverAssert(!isnan(score));
+    level = zslRandomLevel();
+    if (level > zsl->level) {
+        for (i = zsl->level; i < level; i++)
+            zsl->header->level[i].span = zsl->length;
+        zsl->level = level;
+    }
+    x = zslCreateNode(level,score,obj);
+    x->backward = (last[0] == zsl->header) ? NULL : last[0];
+    zsl->length++;
+    for (i = 0; i < level; i++) {
+        x->level[i].forward = NULL;
+        x->level[i].span = 0;
+        last[i]->level[i].forward = x;
+        last[i]->level[i].span = zsl->length - rank[i];
+        last[i] = x;
+        rank[i] = zsl->length;
+    }
+
+    /* increment span for untouched levels */
+    for (i = level; i < zsl->level; i++) {
+        last[i]->level[i].span++;
+    }
+    zsl->tail = x;
+    return x;
+}
+
 /* Internal function used by zslDelete, zslDeleteByScore and zslDeleteByRank */
 void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
     int i;
@@ -628,6 +668,795 @@ zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
     return x;
 }
 
+/*-----------------------------------------------------------------------------
+ * B+tree-backed sorted set API
+ *----------------------------------------------------------------------------*/
+
+/* The B+tree is an alternative to the skiplist for large sorted sets. Every
+ * element only costs a score and an object pointer inside the arrays of a
+ * leaf, instead of a separately allocated node with its own level array,
+ * and range scans access contiguous memory instead of following a pointer
+ * for every element.
+ *
+ * Inner nodes store the number of elements inside every child subtree, so
+ * that ranks are computed while descending the tree, like the skiplist does
+ * with spans. Separators are never updated when an element is deleted,
+ * since the old value is still a valid lower bound for the elements of the
+ * child subtree: this is why every separator holds a reference to its
+ * object, that is released only when the separator is removed. */
+
+/* Compare two elements using the same order of the skiplist: by score,
+ * and lexicographically by member for elements with the same score. */
+static int zbtCompare(double s1, robj *o1, double s2, robj *o2) {
+    if (s1 < s2) return -1;
+    if (s1 > s2) return 1;
+    return compareStringObjects(o1,o2);
+}
+
+static zbtreeLeaf *zbtCreateLeaf(void) {
+    zbtreeLeaf *l = zmalloc(sizeof(*l));
+    l->node.leaf = 1;
+    l->node.count = 0;
+    l->prev = l->next = NULL;
+    return l;
+}
+
+static zbtreeInner *zbtCreateInner(void) {
+    zbtreeInner *in = zmalloc(sizeof(*in));
+    in->node.leaf = 0;
+    in->node.count = 0;
+    in->obj[0] = NULL;
+    return in;
+}
+
+zbtree *zbtCreate(void) {
+    zbtree *zbt = zmalloc(sizeof(*zbt));
+    zbtreeLeaf *l = zbtCreateLeaf();
+
+    zbt->root = (zbtreeNode*)l;
+    zbt->head = zbt->tail = l;
+    zbt->length = 0;
+    return zbt;
+}
+
+static void zbtFreeNode(zbtreeNode *n) {
+    int j;
+
+    if (n->leaf) {
+        zbtreeLeaf *l = (zbtreeLeaf*)n;
+        for (j = 0; j < n->count; j++) decrRefCount(l->obj[j]);
+    } else {
+        zbtreeInner *in = (zbtreeInner*)n;
+        for (j = 0; j < n->count; j++) {
+            if (j > 0) decrRefCount(in->obj[j]);
+            zbtFreeNode(in->child[j]);
+        }
+    }
+    zfree(n);
+}
+
+void zbtFree(zbtree *zbt) {
+    zbtFreeNode(zbt->root);
+    zfree(zbt);
+}
+
+/* Return the number of elements inside the subtree rooted at 'n'. */
+static unsigned long zbtNodeSize(zbtreeNode *n) {
+    unsigned long size = 0;
+    int j;
+
+    if (n->leaf) return n->count;
+    for (j = 0; j < n->count; j++) size += ((zbtreeInner*)n)->size[j];
+    return size;
+}
+
+/* Return the position of the first element of the leaf that is greater or
+ * equal to the specified one, or the number of elements if there is none. */
+static int zbtLeafSearch(zbtreeLeaf *l, double score, robj *obj) {
+    int lo = 0, hi = l->node.count;
+
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (zbtCompare(l->score[mid],l->obj[mid],score,obj) < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Return the position of the child that may contain the specified element,
+ * that is, the last child with a separator less or equal to the element. */
+static int zbtInnerSearch(zbtreeInner *in, double score, robj *obj) {
+    int lo = 1, hi = in->node.count;
+
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (zbtCompare(in->score[mid],in->obj[mid],score,obj) <= 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo-1;
+}
+
+static void zbtLeafInsertAt(zbtreeLeaf *l, int pos, double score, robj *obj) {
+    int tomove = l->node.count-pos;
+
+    memmove(l->score+pos+1,l->score+pos,sizeof(double)*tomove);
+    memmove(l->obj+pos+1,l->obj+pos,sizeof(robj*)*tomove);
+    l->score[pos] = score;
+    l->obj[pos] = obj;
+    l->node.count++;
+}
+
+/* Remove 'num' elements starting at 'pos'. References are not released. */
+static void zbtLeafDeleteAt(zbtreeLeaf *l, int pos, int num) {
+    int tomove = l->node.count-pos-num;
+
+    memmove(l->score+pos,l->score+pos+num,sizeof(double)*tomove);
+    memmove(l->obj+pos,l->obj+pos+num,sizeof(robj*)*tomove);
+    l->node.count -= num;
+}
+
+/* Insert the child 'n' holding 'size' elements at position 'pos', using
+ * score/obj as separator. When 'pos' is zero the separator of the old first
+ * child should be populated by the caller after the call. */
+static void zbtInnerInsertAt(zbtreeInner *in, int pos, zbtreeNode *n,
+                             unsigned long size, double score, robj *obj)
+{
+    int tomove = in->node.count-pos;
+
+    memmove(in->score+pos+1,in->score+pos,sizeof(double)*tomove);
+    memmove(in->obj+pos+1,in->obj+pos,sizeof(robj*)*tomove);
+    memmove(in->size+pos+1,in->size+pos,sizeof(unsigned long)*tomove);
+    memmove(in->child+pos+1,in->child+pos,sizeof(zbtreeNode*)*tomove);
+    in->score[pos] = score;
+    in->obj[pos] = obj;
+    in->size[pos] = size;
+    in->child[pos] = n;
+    in->node.count++;
+}
+
+/* Remove the child at position 'pos' together with its separator. The
+ * reference held by the separator is not released: it's up to the caller
+ * to release it or to move it somewhere else. */
+static void zbtInnerDeleteAt(zbtreeInner *in, int pos) {
+    int tomove = in->node.count-pos-1;
+
+    memmove(in->score+pos,in->score+pos+1,sizeof(double)*tomove);
+    memmove(in->obj+pos,in->obj+pos+1,sizeof(robj*)*tomove);
+    memmove(in->size+pos,in->size+pos+1,sizeof(unsigned long)*tomove);
+    memmove(in->child+pos,in->child+pos+1,sizeof(zbtreeNode*)*tomove);
+    in->node.count--;
+    in->obj[0] = NULL;
+}
+
+/* Replace the separator at position 'pos' with a new one. */
+static void zbtSetSeparator(zbtreeInner *in, int pos, double score, robj *obj) {
+    incrRefCount(obj);
+    decrRefCount(in->obj[pos]);
+    in->score[pos] = score;
+    in->obj[pos] = obj;
+}
+
+static void zbtUnlinkLeaf(zbtree *zbt, zbtreeLeaf *l) {
+    if (l->prev) l->prev->next = l->next; else zbt->head = l->next;
+    if (l->next) l->next->prev = l->prev; else zbt->tail = l->prev;
+}
+
+/* Insert the element inside the subtree rooted at 'n'. If the node had to
+ * be split, the new node holding the upper part of the elements is
+ * returned, and its separator is stored by reference into *sepscore and
+ * *sepobj. Otherwise NULL is returned. */
+static zbtreeNode *zbtInsertNode(zbtree *zbt, zbtreeNode *n, double score,
+                                 robj *obj, double *sepscore, robj **sepobj)
+{
+    if (n->leaf) {
+        zbtreeLeaf *l = (zbtreeLeaf*)n, *r;
+        int pos = zbtLeafSearch(l,score,obj), split;
+
+        if (n->count < ZBTREE_LEAF_MAX) {
+            zbtLeafInsertAt(l,pos,score,obj);
+            return NULL;
+        }
+
+        /* The leaf is full. When appending at the tail of the tree, as it
+         * happens with monotonically increasing scores, just start a new
+         * leaf instead of leaving two half empty leaves behind. */
+        split = (pos == ZBTREE_LEAF_MAX && l->next == NULL) ?
+                ZBTREE_LEAF_MAX : ZBTREE_LEAF_MAX/2;
+        r = zbtCreateLeaf();
+        memcpy(r->score,l->score+split,sizeof(double)*(ZBTREE_LEAF_MAX-split));
+        memcpy(r->obj,l->obj+split,sizeof(robj*)*(ZBTREE_LEAF_MAX-split));
+        r->node.count = ZBTREE_LEAF_MAX-split;
+        l->node.count = split;
+        r->prev = l;
+        r->next = l->next;
+        if (l->next) l->next->prev = r; else zbt->tail = r;
+        l->next = r;
+
+        if (pos < split || (pos == split && split < ZBTREE_LEAF_MAX))
+            zbtLeafInsertAt(l,pos,score,obj);
+        else
+            zbtLeafInsertAt(r,pos-split,score,obj);
+
+        *sepscore = r->score[0];
+        *sepobj = r->obj[0];
+        incrRefCount(*sepobj); /* Referenced by the separator. */
+        return (zbtreeNode*)r;
+    } else {
+        zbtreeInner *in = (zbtreeInner*)n, *r;
+        zbtreeNode *child;
+        double cscore;
+        robj *cobj;
+        unsigned long csize;
+        int pos = zbtInnerSearch(in,score,obj), split;
+
+        in->size[pos]++;
+        child = zbtInsertNode(zbt,in->child[pos],score,obj,&cscore,&cobj);
+        if (child == NULL) return NULL;
+
+        /* The child was split: the new node goes right after it. */
+        csize = zbtNodeSize(child);
+        in->size[pos] -= csize;
+        pos++;
+        if (n->count < ZBTREE_INNER_MAX) {
+            zbtInnerInsertAt(in,pos,child,csize,cscore,cobj);
+            return NULL;
+        }
+
+        /* This node is full as well: move the upper half of the children
+         * into a new node. The separator of the first moved child becomes
+         * the separator of the new node in the parent. */
+        split = ZBTREE_INNER_MAX/2;
+        r = zbtCreateInner();
+        memcpy(r->score,in->score+split,sizeof(double)*(ZBTREE_INNER_MAX-split));
+        memcpy(r->obj,in->obj+split,sizeof(robj*)*(ZBTREE_INNER_MAX-split));
+        memcpy(r->size,in->size+split,
+               sizeof(unsigned long)*(ZBTREE_INNER_MAX-split));
+        memcpy(r->child,in->child+split,
+               sizeof(zbtreeNode*)*(ZBTREE_INNER_MAX-split));
+        r->node.count = ZBTREE_INNER_MAX-split;
+        in->node.count = split;
+        *sepscore = r->score[0];
+        *sepobj = r->obj[0];
+        r->obj[0] = NULL;
+
+        if (pos <= split)
+            zbtInnerInsertAt(in,pos,child,csize,cscore,cobj);
+        else
+            zbtInnerInsertAt(r,pos-split,child,csize,cscore,cobj);
+        return (zbtreeNode*)r;
+    }
+}
+
+/* Insert a new element in the B+tree. Like for zslInsert(), the caller must
+ * make sure the element is not already inside, and the reference to 'obj'
+ * is owned by the tree after the call. */
+void zbtInsert(zbtree *zbt, double score, robj *obj) {
+    zbtreeNode *r;
+    double sepscore;
+    robj *sepobj;
+
+    serverAssert(!isnan(score));
+    r = zbtInsertNode(zbt,zbt->root,score,obj,&sepscore,&sepobj);
+    zbt->length++;
+    if (r != NULL) {
+        /* The root was split: the tree grows by one level. */
+        zbtreeInner *root = zbtCreateInner();
+        unsigned long rsize = zbtNodeSize(r);
+
+        root->child[0] = zbt->root;
+        root->size[0] = zbt->length-rsize;
+        root->node.count = 1;
+        zbtInnerInsertAt(root,1,r,rsize,sepscore,sepobj);
+        zbt->root = (zbtreeNode*)root;
+    }
+}
+
+static int zbtNodeIsUnderflow(zbtreeNode *n) {
+    return n->count < (n->leaf ? ZBTREE_LEAF_MIN : ZBTREE_INNER_MIN);
+}
+
+/* Fix the child at position 'pos' of 'in', that has too few elements or
+ * children, merging it with a sibling or moving an item from the sibling
+ * into it. */
+static void zbtFixChild(zbtree *zbt, zbtreeInner *in, int pos) {
+    int lpos, rpos;
+
+    if (in->node.count < 2) return; /* No siblings. */
+    if (pos+1 < in->node.count) {
+        lpos = pos;
+        rpos = pos+1;
+    } else {
+        lpos = pos-1;
+        rpos = pos;
+    }
+
+    if (in->child[lpos]->leaf) {
+        zbtreeLeaf *l = (zbtreeLeaf*)in->child[lpos];
+        zbtreeLeaf *r = (zbtreeLeaf*)in->child[rpos];
+        int lcount = l->node.count, rcount = r->node.count;
+
+        if (lcount+rcount <= ZBTREE_LEAF_MAX) {
+            /* Merge the right leaf into the left one. */
+            memcpy(l->score+lcount,r->score,sizeof(double)*rcount);
+            memcpy(l->obj+lcount,r->obj,sizeof(robj*)*rcount);
+            l->node.count += rcount;
+            zbtUnlinkLeaf(zbt,r);
+            in->size[lpos] += in->size[rpos];
+            decrRefCount(in->obj[rpos]);
+            zbtInnerDeleteAt(in,rpos);
+            zfree(r);
+        } else if (pos == lpos) {
+            /* Move the first element of the right leaf to the left one. */
+            zbtLeafInsertAt(l,lcount,r->score[0],r->obj[0]);
+            zbtLeafDeleteAt(r,0,1);
+            zbtSetSeparator(in,rpos,r->score[0],r->obj[0]);
+            in->size[lpos]++;
+            in->size[rpos]--;
+        } else {
+            /* Move the last element of the left leaf to the right one. */
+            zbtLeafInsertAt(r,0,l->score[lcount-1],l->obj[lcount-1]);
+            zbtLeafDeleteAt(l,lcount-1,1);
+            zbtSetSeparator(in,rpos,r->score[0],r->obj[0]);
+            in->size[lpos]--;
+            in->size[rpos]++;
+        }
+    } else {
+        zbtreeInner *l = (zbtreeInner*)in->child[lpos];
+        zbtreeInner *r = (zbtreeInner*)in->child[rpos];
+        int lcount = l->node.count, rcount = r->node.count;
+
+        if (lcount+rcount <= ZBTREE_INNER_MAX) {
+            /* Merge the right node into the left one. The separator in the
+             * parent becomes the separator of the first moved child. */
+            r->score[0] = in->score[rpos];
+            r->obj[0] = in->obj[rpos];
+            memcpy(l->score+lcount,r->score,sizeof(double)*rcount);
+            memcpy(l->obj+lcount,r->obj,sizeof(robj*)*rcount);
+            memcpy(l->size+lcount,r->size,sizeof(unsigned long)*rcount);
+            memcpy(l->child+lcount,r->child,sizeof(zbtreeNode*)*rcount);
+            l->node.count += rcount;
+            in->size[lpos] += in->size[rpos];
+            zbtInnerDeleteAt(in,rpos);
+            zfree(r);
+        } else if (pos == lpos) {
+            /* Move the first child of the right node to the left one,
+             * rotating the separators through the parent. */
+            zbtInnerInsertAt(l,lcount,r->child[0],r->size[0],
+                             in->score[rpos],in->obj[rpos]);
+            in->size[lpos] += r->size[0];
+            in->size[rpos] -= r->size[0];
+            in->score[rpos] = r->score[1];
+            in->obj[rpos] = r->obj[1];
+            zbtInnerDeleteAt(r,0);
+        } else {
+            /* Move the last child of the left node to the right one,
+             * rotating the separators through the parent. */
+            r->score[0] = in->score[rpos];
+            r->obj[0] = in->obj[rpos];
+            zbtInnerInsertAt(r,0,l->child[lcount-1],l->size[lcount-1],0,NULL);
+            in->score[rpos] = l->score[lcount-1];
+            in->obj[rpos] = l->obj[lcount-1];
+            in->size[lpos] -= l->size[lcount-1];
+            in->size[rpos] += l->size[lcount-1];
+            l->node.count--;
+        }
+    }
+}
+
+/* Remove one level from the tree as long as the root has a single child. */
+static void zbtShrink(zbtree *zbt) {
+    while (!zbt->root->leaf && zbt->root->count == 1) {
+        zbtreeNode *root = zbt->root;
+        zbt->root = ((zbtreeInner*)root)->child[0];
+        zfree(root);
+    }
+}
+
+static int zbtDeleteNode(zbtree *zbt, zbtreeNode *n, double score, robj *obj) {
+    if (n->leaf) {
+        zbtreeLeaf *l = (zbtreeLeaf*)n;
+        int pos = zbtLeafSearch(l,score,obj);
+
+        if (pos == n->count || l->score[pos] != score ||
+            !equalStringObjects(l->obj[pos],obj)) return 0;
+        decrRefCount(l->obj[pos]);
+        zbtLeafDeleteAt(l,pos,1);
+        return 1;
+    } else {
+        zbtreeInner *in = (zbtreeInner*)n;
+        int pos = zbtInnerSearch(in,score,obj);
+
+        if (!zbtDeleteNode(zbt,in->child[pos],score,obj)) return 0;
+        in->size[pos]--;
+        if (zbtNodeIsUnderflow(in->child[pos])) zbtFixChild(zbt,in,pos);
+        return 1;
+    }
+}
+
+/* Delete an element with matching score/object from the B+tree. */
+int zbtDelete(zbtree *zbt, double score, robj *obj) {
+    if (!zbtDeleteNode(zbt,zbt->root,score,obj)) return 0;
+    zbt->length--;
+    zbtShrink(zbt);
+    return 1;
+}
+
+/* Delete the elements with rank between start and end (1-based, relative
+ * to the subtree, inclusive) from the subtree rooted at 'n', removing them
+ * from the dictionary as well. Children left empty are released, and
+ * children left with too few items are fixed, so that every non root node
+ * of the tree is never empty. Returns the number of deleted elements. */
+static unsigned long zbtDeleteRangeNode(zbtree *zbt, zbtreeNode *n,
+    unsigned long start, unsigned long end, dict *dict)
+{
+    unsigned long removed = 0;
+    int j;
+
+    if (n->leaf) {
+        zbtreeLeaf *l = (zbtreeLeaf*)n;
+        int first = start-1, last = end-1;
+
+        if (last >= n->count) last = n->count-1;
+        for (j = first; j <= last; j++) {
+            dictDelete(dict,l->obj[j]);
+            decrRefCount(l->obj[j]);
+        }
+        zbtLeafDeleteAt(l,first,last-first+1);
+        return last-first+1;
+    } else {
+        zbtreeInner *in = (zbtreeInner*)n;
+        unsigned long base = 0;
+
+        j = 0;
+        while (j < n->count && base < end) {
+            unsigned long size = in->size[j], deleted;
+            zbtreeNode *child = in->child[j];
+
+            if (base+size < start) {
+                base += size;
+                j++;
+                continue;
+            }
+            deleted = zbtDeleteRangeNode(zbt,child,
+                start > base ? start-base : 1,
+                end-base < size ? end-base : size,dict);
+            removed += deleted;
+            base += size;
+            in->size[j] -= deleted;
+            if (in->size[j] == 0) {
+                /* Empty child: release it together with its separator, or
+                 * with the separator of the next child that takes its
+                 * place if this is the first child. */
+                serverAssert(child->count == 0);
+                if (child->leaf) zbtUnlinkLeaf(zbt,(zbtreeLeaf*)child);
+                zfree(child);
+                if (j > 0)
+                    decrRefCount(in->obj[j]);
+                else if (n->count > 1)
+                    decrRefCount(in->obj[1]);
+                zbtInnerDeleteAt(in,j);
+            } else {
+                j++;
+            }
+        }
+
+        /* Fix the children left with too few items. */
+        j = 0;
+        while (j < n->count && n->count > 1) {
+            if (zbtNodeIsUnderflow(in->child[j])) {
+                zbtFixChild(zbt,in,j);
+                if (j > 0) j--;
+            } else {
+                j++;
+            }
+        }
+        return removed;
+    }
+}
+
+/* Delete all the elements with rank between start and end from the B+tree,
+ * and from the dictionary 'dict' as well. Start and end are inclusive and
+ * 1-based like in zslDeleteRangeByRank(). */
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict) {
+    unsigned long removed;
+
+    if (start < 1) start = 1;
+    if (end > zbt->length) end = zbt->length;
+    if (start > end) return 0;
+
+    removed = zbtDeleteRangeNode(zbt,zbt->root,start,end,dict);
+    zbt->length -= removed;
+    if (!zbt->root->leaf && zbt->root->count == 0) {
+        /* Everything was deleted: start again with an empty leaf. */
+        zbtreeLeaf *l = zbtCreateLeaf();
+        zfree(zbt->root);
+        zbt->root = (zbtreeNode*)l;
+        zbt->head = zbt->tail = l;
+    }
+    zbtShrink(zbt);
+    return removed;
+}
+
+/* Return the number of levels of the tree, leaves included. */
+int zbtHeight(zbtree *zbt) {
+    zbtreeNode *n = zbt->root;
+    int height = 1;
+
+    while (!n->leaf) {
+        n = ((zbtreeInner*)n)->child[0];
+        height++;
+    }
+    return height;
+}
+
+/* Find the rank for an element by both score and key.
+ * Returns 0 when the element cannot be found, the 1-based rank otherwise. */
+unsigned long zbtGetRank(zbtree *zbt, double score, robj *o) {
+    zbtreeNode *n = zbt->root;
+    zbtreeLeaf *l;
+    unsigned long rank = 0;
+    int pos, j;
+
+    while (!n->leaf) {
+        zbtreeInner *in = (zbtreeInner*)n;
+        pos = zbtInnerSearch(in,score,o);
+        for (j = 0; j < pos; j++) rank += in->size[j];
+        n = in->child[pos];
+    }
+    l = (zbtreeLeaf*)n;
+    pos = zbtLeafSearch(l,score,o);
+    if (pos < n->count && l->score[pos] == score &&
+        equalStringObjects(l->obj[pos],o)) return rank+pos+1;
+    return 0;
+}
+
+/* Point the cursor to the element with the specified 1-based rank.
+ * Returns 0 if the rank is out of range. */
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreeCursor *cur) {
+    zbtreeNode *n = zbt->root;
+    unsigned long left = rank;
+    int j;
+
+    cur->leaf = NULL;
+    if (rank == 0 || rank > zbt->length) return 0;
+    while (!n->leaf) {
+        zbtreeInner *in = (zbtreeInner*)n;
+        for (j = 0; left > in->size[j]; j++) left -= in->size[j];
+        n = in->child[j];
+    }
+    cur->leaf = (zbtreeLeaf*)n;
+    cur->idx = left-1;
+    cur->rank = rank;
+    return 1;
+}
+
+/* Point the cursor to the first element. Returns 0 if the tree is empty. */
+int zbtFirst(zbtree *zbt, zbtreeCursor *cur) {
+    cur->leaf = zbt->length ? zbt->head : NULL;
+    cur->idx = 0;
+    cur->rank = 1;
+    return cur->leaf != NULL;
+}
+
+/* Point the cursor to the last element. Returns 0 if the tree is empty. */
+int zbtLast(zbtree *zbt, zbtreeCursor *cur) {
+    cur->leaf = zbt->length ? zbt->tail : NULL;
+    if (cur->leaf) cur->idx = cur->leaf->node.count-1;
+    cur->rank = zbt->length;
+    return cur->leaf != NULL;
+}
+
+/* Move the cursor to the next element. The cursor leaf is set to NULL when
+ * the end of the tree is reached. */
+void zbtNext(zbtreeCursor *cur) {
+    cur->rank++;
+    if (++cur->idx == cur->leaf->node.count) {
+        cur->leaf = cur->leaf->next;
+        cur->idx = 0;
+    }
+}
+
+/* Move the cursor to the previous element. The cursor leaf is set to NULL
+ * when the start of the tree is reached. */
+void zbtPrev(zbtreeCursor *cur) {
+    cur->rank--;
+    if (cur->idx-- == 0) {
+        cur->leaf = cur->leaf->prev;
+        if (cur->leaf) cur->idx = cur->leaf->node.count-1;
+    }
+}
+
+/* Predicates used in order to find the boundaries of ranges. A predicate
+ * must be monotone along the elements order: false and then true for
+ * zbtFirstWhere(), true and then false for zbtLastWhere(). */
+typedef int (*zbtPredicate)(double score, robj *obj, void *range);
+
+/* Point the cursor to the first element for which 'pred' is true.
+ * Returns 0 if there is no such element. */
+static int zbtFirstWhere(zbtree *zbt, zbtPredicate pred, void *range,
+                         zbtreeCursor *cur)
+{
+    zbtreeNode *n = zbt->root;
+    zbtreeLeaf *l;
+    unsigned long rank = 0;
+    int lo, hi, j;
+
+    while (!n->leaf) {
+        zbtreeInner *in = (zbtreeInner*)n;
+
+        /* Descend into the last child with a separator that is still out
+         * of the range: the first matching element can't be on its left. */
+        lo = 1; hi = n->count;
+        while (lo < hi) {
+            int mid = (lo+hi)/2;
+            if (!pred(in->score[mid],in->obj[mid],range))
+                lo = mid+1;
+            else
+                hi = mid;
+        }
+        for (j = 0; j < lo-1; j++) rank += in->size[j];
+        n = in->child[lo-1];
+    }
+
+    l = (zbtreeLeaf*)n;
+    lo = 0; hi = n->count;
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (!pred(l->score[mid],l->obj[mid],range))
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+
+    /* If no element of the leaf matches, the first element of the next
+     * leaf does, since its separator matches. */
+    cur->leaf = l;
+    cur->idx = lo;
+    cur->rank = rank+lo+1;
+    if (lo == n->count) {
+        cur->leaf = l->next;
+        cur->idx = 0;
+    }
+    return cur->leaf != NULL;
+}
+
+/* Point the cursor to the last element for which 'pred' is true.
+ * Returns 0 if there is no such element. */
+static int zbtLastWhere(zbtree *zbt, zbtPredicate pred, void *range,
+                        zbtreeCursor *cur)
+{
+    zbtreeNode *n = zbt->root;
+    zbtreeLeaf *l;
+    unsigned long rank = 0;
+    int lo, hi, j;
+
+    while (!n->leaf) {
+        zbtreeInner *in = (zbtreeInner*)n;
+
+        /* Descend into the last child with a separator still in range. */
+        lo = 1; hi = n->count;
+        while (lo < hi) {
+            int mid = (lo+hi)/2;
+            if (pred(in->score[mid],in->obj[mid],range))
+                lo = mid+1;
+            else
+                hi = mid;
+        }
+        for (j = 0; j < lo-1; j++) rank += in->size[j];
+        n = in->child[lo-1];
+    }
+
+    l = (zbtreeLeaf*)n;
+    lo = 0; hi = n->count;
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (pred(l->score[mid],l->obj[mid],range))
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+
+    /* If no element of the leaf matches, the last element of the previous
+     * leaf does, since it is smaller than the separator of this leaf. */
+    cur->rank = rank+lo;
+    if (lo == 0) {
+        cur->leaf = l->prev;
+        if (cur->leaf) cur->idx = cur->leaf->node.count-1;
+    } else {
+        cur->leaf = l;
+        cur->idx = lo-1;
+    }
+    return cur->leaf != NULL;
+}
+
+static int zbtScoreGteMin(double score, robj *obj, void *range) {
+    UNUSED(obj);
+    return zslValueGteMin(score,range);
+}
+
+static int zbtScoreLteMax(double score, robj *obj, void *range) {
+    UNUSED(obj);
+    return zslValueLteMax(score,range);
+}
+
+static int zbtLexGteMin(double score, robj *obj, void *range) {
+    UNUSED(score);
+    return zslLexValueGteMin(obj,range);
+}
+
+static int zbtLexLteMax(double score, robj *obj, void *range) {
+    UNUSED(score);
+    return zslLexValueLteMax(obj,range);
+}
+
+/* Point the cursor to the first element in the specified range.
+ * Returns 0 when no element is contained in the range. */
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreeCursor *cur) {
+    if (!zbtFirstWhere(zbt,zbtScoreGteMin,range,cur)) return 0;
+    if (!zslValueLteMax(zbtCursorScore(cur),range)) {
+        cur->leaf = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Point the cursor to the last element in the specified range.
+ * Returns 0 when no element is contained in the range. */
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreeCursor *cur) {
+    if (!zbtLastWhere(zbt,zbtScoreLteMax,range,cur)) return 0;
+    if (!zslValueGteMin(zbtCursorScore(cur),range)) {
+        cur->leaf = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Point the cursor to the first element in the specified lex range.
+ * Returns 0 when no element is contained in the range. */
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeCursor *cur) {
+    if (!zbtFirstWhere(zbt,zbtLexGteMin,range,cur)) return 0;
+    if (!zslLexValueLteMax(zbtCursorObj(cur),range)) {
+        cur->leaf = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Point the cursor to the last element in the specified lex range.
+ * Returns 0 when no element is contained in the range. */
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeCursor *cur) {
+    if (!zbtLastWhere(zbt,zbtLexLteMax,range,cur)) return 0;
+    if (!zslLexValueGteMin(zbtCursorObj(cur),range)) {
+        cur->leaf = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Delete all the elements with score in the specified range from the
+ * B+tree and from the dictionary. */
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict) {
+    zbtreeCursor first, last;
+
+    if (!zbtFirstInRange(zbt,range,&first) ||
+        !zbtLastInRange(zbt,range,&last)) return 0;
+    return zbtDeleteRangeByRank(zbt,first.rank,last.rank,dict);
+}
+
+/* Delete all the elements in the specified lex range from the B+tree and
+ * from the dictionary. */
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict) {
+    zbtreeCursor first, last;
+
+    if (!zbtFirstInLexRange(zbt,range,&first) ||
+        !zbtLastInLexRange(zbt,range,&last)) return 0;
+    return zbtDeleteRangeByRank(zbt,first.rank,last.rank,dict);
+}
+
 /*-----------------------------------------------------------------------------
  * Ziplist-backed sorted set API
  *----------------------------------------------------------------------------*/
@@ -1084,6 +1913,8 @@ unsigned int zsetLength(robj *zobj) {
         length = zzlLength(zobj->ptr);
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
         length = ((zset*)zobj->ptr)->zsl->length;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        length = ((zset*)zobj->ptr)->zbt->length;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1103,13 +1934,22 @@ void zsetConvert(robj *zobj, int encoding) {
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
+        zsetAppender za;
 
-        if (encoding != OBJ_ENCODING_SKIPLIST)
+        if (encoding != OBJ_ENCODING_SKIPLIST &&
+            encoding != OBJ_ENCODING_BTREE)
             serverPanic("Unknown target encoding");
 
         zs = zmalloc(sizeof(*zs));
         zs->dict = dictCreate(&zsetDictType,NULL);
-        zs->zsl = zslCreate();
+        zs->zsl = (encoding == OBJ_ENCODING_SKIPLIST) ? zslCreate() : NULL;
+        zs->zbt = (encoding == OBJ_ENCODING_BTREE) ? zbtCreate() : NULL;
+        zobj->ptr = zs;
+        zobj->encoding = encoding;
+
+        /* The ziplist is already sorted: build the new representation
+         * appending every element at the tail. */
+        zsetAppenderInit(&za,zobj);
 
         eptr = ziplistIndex(zl,0);
         serverAssertWithInfo(NULL,zobj,eptr != NULL);
@@ -1124,16 +1964,12 @@ void zsetConvert(robj *zobj, int encoding) {
             else
                 ele = createStringObject((char*)vstr,vlen);
 
-            /* Has incremented refcount since it was just created. */
-            node = zslInsert(zs->zsl,score,ele);
-            serverAssertWithInfo(NULL,zobj,dictAdd(zs->dict,ele,&node->score) == DICT_OK);
-            incrRefCount(ele); /* Added to dictionary. */
+            zsetAppend(&za,score,ele);
+            decrRefCount(ele);
             zzlNext(zl,&eptr,&sptr);
         }
 
-        zfree(zobj->ptr);
-        zobj->ptr = zs;
-        zobj->encoding = OBJ_ENCODING_SKIPLIST;
+        zfree(zl);
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
         unsigned char *zl = ziplistNew();
 
@@ -1158,6 +1994,27 @@ void zsetConvert(robj *zobj, int encoding) {
             node = next;
         }
 
+        zfree(zs);
+        zobj->ptr = zl;
+        zobj->encoding = OBJ_ENCODING_ZIPLIST;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        unsigned char *zl = ziplistNew();
+        zbtreeCursor cur;
+
+        if (encoding != OBJ_ENCODING_ZIPLIST)
+            serverPanic("Unknown target encoding");
+
+        zs = zobj->ptr;
+        dictRelease(zs->dict);
+        zbtFirst(zs->zbt,&cur);
+        while (cur.leaf) {
+            ele = getDecodedObject(zbtCursorObj(&cur));
+            zl = zzlInsertAt(zl,NULL,ele,zbtCursorScore(&cur));
+            decrRefCount(ele);
+            zbtNext(&cur);
+        }
+        zbtFree(zs->zbt);
+
         zfree(zs);
         zobj->ptr = zl;
         zobj->encoding = OBJ_ENCODING_ZIPLIST;
@@ -1171,9 +2028,8 @@ void zsetConvert(robj *zobj, int encoding) {
  * expected ranges. */
 void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) return;
-    zset *zset = zobj->ptr;
 
-    if (zset->zsl->length <= server.zset_max_ziplist_entries &&
+    if (zsetLength(zobj) <= server.zset_max_ziplist_entries &&
         maxelelen <= server.zset_max_ziplist_value)
             zsetConvert(zobj,OBJ_ENCODING_ZIPLIST);
 }
@@ -1192,12 +2048,134 @@ int zsetScore(robj *zobj, robj *member, double *score) {
         dictEntry *de = dictFind(zs->dict, member);
         if (de == NULL) return C_ERR;
         *score = *(double*)dictGetVal(de);
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        dictEntry *de = dictFind(zs->dict, member);
+        if (de == NULL) return C_ERR;
+        *score = dictGetDoubleVal(de);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
     return C_OK;
 }
 
+/* Add a new element to a sorted set encoded as a skiplist or as a B+tree,
+ * updating both the ordered view and the dictionary. The caller must make
+ * sure that the element is not already a member of the sorted set.
+ * The reference count of 'ele' is incremented for every reference taken. */
+void zsetInsertNew(robj *zobj, double score, robj *ele) {
+    zset *zs = zobj->ptr;
+
+    if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+        zskiplistNode *znode = zslInsert(zs->zsl,score,ele);
+        incrRefCount(ele); /* Inserted in skiplist. */
+        serverAssertWithInfo(NULL,ele,
+            dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+        incrRefCount(ele); /* Added to dictionary. */
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        dictEntry *de;
+
+        zbtInsert(zs->zbt,score,ele);
+        incrRefCount(ele); /* Inserted in B+tree. */
+        de = dictAddRaw(zs->dict,ele);
+        serverAssertWithInfo(NULL,ele,de != NULL);
+        dictSetDoubleVal(de,score);
+        incrRefCount(ele); /* Added to dictionary. */
+    } else {
+        serverPanic("Unknown sorted set encoding");
+    }
+}
+
+/* Build an empty sorted set appending elements in order: every element must
+ * be greater than the previously appended one, and must not be already a
+ * member of the sorted set. */
+void zsetAppenderInit(zsetAppender *za, robj *zobj) {
+    int i;
+
+    za->zobj = zobj;
+    if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+        zskiplist *zsl = ((zset*)zobj->ptr)->zsl;
+
+        serverAssertWithInfo(NULL,zobj,zsl->length == 0);
+        for (i = 0; i < ZSKIPLIST_MAXLEVEL; i++) {
+            za->last[i] = zsl->header;
+            za->rank[i] = 0;
+        }
+    }
+}
+
+/* Append an element using the appender. The reference count of 'ele' is
+ * incremented as zsetInsertNew() does. */
+void zsetAppend(zsetAppender *za, double score, robj *ele) {
+    robj *zobj = za->zobj;
+
+    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+        ele = getDecodedObject(ele);
+        zobj->ptr = zzlInsertAt(zobj->ptr,NULL,ele,score);
+        decrRefCount(ele);
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+        zset *zs = zobj->ptr;
+        zskiplistNode *znode;
+
+        znode = zslAppend(zs->zsl,za->last,za->rank,score,ele);
+        incrRefCount(ele); /* Inserted in skiplist. */
+        serverAssertWithInfo(NULL,ele,
+            dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+        incrRefCount(ele); /* Added to dictionary. */
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        /* Inserting at the tail of the B+tree never splits a leaf in half,
+         * so the tree is built with full nodes. */
+        zsetInsertNew(zobj,score,ele);
+    } else {
+        serverPanic("Unknown sorted set encoding");
+    }
+}
+
+/* qsort() comparator ordering bulk items by score, then by member. */
+static int zsetBulkCompareByScore(const void *a, const void *b) {
+    const zsetBulkItem *ia = a, *ib = b;
+
+    if (ia->score < ib->score) return -1;
+    if (ia->score > ib->score) return 1;
+    return compareStringObjects(ia->ele,ib->ele);
+}
+
+/* qsort() comparator ordering bulk items by member, then by position. */
+static int zsetBulkCompareByMember(const void *a, const void *b) {
+    const zsetBulkItem *ia = a, *ib = b;
+    int cmp = compareStringObjects(ia->ele,ib->ele);
+
+    if (cmp) return cmp;
+    return (ia->idx > ib->idx) - (ia->idx < ib->idx);
+}
+
+/* Create a sorted set from an array of 'count' elements with unique members,
+ * in any order. The array is sorted once and the sorted set is then built
+ * bottom-up, appending every element at the tail, instead of performing a
+ * search for every insertion. 'maxelelen' is the length of the longest
+ * member, used to select the encoding of the new sorted set.
+ * The references to the members are not consumed. */
+robj *zsetCreateFromItems(zsetBulkItem *items, size_t count, size_t maxelelen) {
+    zsetAppender za;
+    robj *zobj;
+    size_t j;
+
+    if (count <= server.zset_max_ziplist_entries &&
+        maxelelen <= server.zset_max_ziplist_value)
+    {
+        zobj = createZsetZiplistObject();
+    } else {
+        zobj = createZsetObject();
+        dictExpand(((zset*)zobj->ptr)->dict,count);
+    }
+
+    qsort(items,count,sizeof(zsetBulkItem),zsetBulkCompareByScore);
+    zsetAppenderInit(&za,zobj);
+    for (j = 0; j < count; j++)
+        zsetAppend(&za,items[j].score,items[j].ele);
+    return zobj;
+}
+
 /*-----------------------------------------------------------------------------
  * Sorted set commands
  *----------------------------------------------------------------------------*/
@@ -1208,6 +2186,53 @@ int zsetScore(robj *zobj, robj *member, double *score) {
 #define ZADD_NX (1<<1)      /* Don't touch elements not already existing. */
 #define ZADD_XX (1<<2)      /* Only touch elements already exisitng. */
 #define ZADD_CH (1<<3)      /* Return num of elements added or updated. */
+
+/* Create the sorted set for a ZADD call targeting a key that does not exist,
+ * using the bulk loading API instead of inserting the pairs one by one.
+ * Duplicated members are resolved as if the pairs were added one after the
+ * other: the last score wins, or the first one with NX.
+ * The number of added and updated elements is returned by reference. */
+static robj *zaddBulkCreate(client *c, int scoreidx, double *scores,
+                            int elements, int nx, int *added, int *updated)
+{
+    zsetBulkItem *items = zmalloc(sizeof(zsetBulkItem)*elements);
+    size_t maxelelen = 0;
+    int j, idx, unique = 0;
+    robj *zobj;
+
+    for (j = 0; j < elements; j++) {
+        items[j].score = scores[j];
+        items[j].ele = c->argv[scoreidx+1+j*2];
+        items[j].idx = j;
+    }
+
+    /* Sort by member, and by position for the same member, so that
+     * duplicates are adjacent and in the order they were specified. */
+    qsort(items,elements,sizeof(zsetBulkItem),zsetBulkCompareByMember);
+    for (j = 0; j < elements; j++) {
+        if (unique && equalStringObjects(items[unique-1].ele,items[j].ele)) {
+            if (nx) continue;
+            if (items[j].score != items[unique-1].score) {
+                items[unique-1].score = items[j].score;
+                (*updated)++;
+            }
+        } else {
+            if (sdslen(items[j].ele->ptr) > maxelelen)
+                maxelelen = sdslen(items[j].ele->ptr);
+            items[unique++] = items[j];
+        }
+    }
+
+    for (j = 0; j < unique; j++) {
+        idx = scoreidx+1+items[j].idx*2;
+        items[j].ele = c->argv[idx] = tryObjectEncoding(c->argv[idx]);
+    }
+    zobj = zsetCreateFromItems(items,unique,maxelelen);
+    zfree(items);
+    *added = unique;
+    return zobj;
+}
+
 void zaddGenericCommand(client *c, int flags) {
     static char *nanerr = "resulting score is not a number (NaN)";
     robj *key = c->argv[1];
@@ -1279,6 +2304,15 @@ void zaddGenericCommand(client *c, int flags) {
     zobj = lookupKeyWrite(c->db,key);
     if (zobj == NULL) {
         if (xx) goto reply_to_client; /* No key + XX option: nothing to do. */
+        if (elements > 1) {
+            /* Many pairs for a new key: sort them once and build the
+             * sorted set bottom-up. */
+            zobj = zaddBulkCreate(c,scoreidx,scores,elements,nx,
+                                  &added,&updated);
+            dbAdd(c->db,key,zobj);
+            server.dirty += added+updated;
+            goto reply_to_client;
+        }
         if (server.zset_max_ziplist_entries == 0 ||
             server.zset_max_ziplist_value < sdslen(c->argv[scoreidx+1]->ptr))
         {
@@ -1325,9 +2359,9 @@ void zaddGenericCommand(client *c, int flags) {
                  * becomes too long *before* executing zzlInsert. */
                 zobj->ptr = zzlInsert(zobj->ptr,ele,score);
                 if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries)
-                    zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+                    zsetConvert(zobj,server.zset_large_encoding);
                 if (sdslen(ele->ptr) > server.zset_max_ziplist_value)
-                    zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+                    zsetConvert(zobj,server.zset_large_encoding);
                 server.dirty++;
                 added++;
                 processed++;
@@ -1376,6 +2410,43 @@ void zaddGenericCommand(client *c, int flags) {
                 added++;
                 processed++;
             }
+        } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = zobj->ptr;
+            dictEntry *de;
+
+            ele = c->argv[scoreidx+1+j*2] =
+                tryObjectEncoding(c->argv[scoreidx+1+j*2]);
+            de = dictFind(zs->dict,ele);
+            if (de != NULL) {
+                if (nx) continue;
+                curobj = dictGetKey(de);
+                curscore = dictGetDoubleVal(de);
+
+                if (incr) {
+                    score += curscore;
+                    if (isnan(score)) {
+                        addReplyError(c,nanerr);
+                        goto cleanup;
+                    }
+                }
+
+                /* Remove and re-insert when score changed. The dictionary
+                 * still has a reference to the object. */
+                if (score != curscore) {
+                    serverAssertWithInfo(c,curobj,zbtDelete(zs->zbt,curscore,curobj));
+                    zbtInsert(zs->zbt,score,curobj);
+                    incrRefCount(curobj); /* Re-inserted in B+tree. */
+                    dictSetDoubleVal(de,score);
+                    server.dirty++;
+                    updated++;
+                }
+                processed++;
+            } else if (!xx) {
+                zsetInsertNew(zobj,score,ele);
+                server.dirty++;
+                added++;
+                processed++;
+            }
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1444,6 +2515,30 @@ void zremCommand(client *c) {
                 score = *(double*)dictGetVal(de);
                 serverAssertWithInfo(c,c->argv[j],zslDelete(zs->zsl,score,c->argv[j]));
 
+                /* Delete from the hash table */
+                dictDelete(zs->dict,c->argv[j]);
+                if (htNeedsResize(zs->dict)) dictResize(zs->dict);
+                if (dictSize(zs->dict) == 0) {
+                    dbDelete(c->db,key);
+                    keyremoved = 1;
+                    break;
+                }
+            }
+        }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        dictEntry *de;
+        double score;
+
+        for (j = 2; j < c->argc; j++) {
+            de = dictFind(zs->dict,c->argv[j]);
+            if (de != NULL) {
+                deleted++;
+
+                /* Delete from the B+tree */
+                score = dictGetDoubleVal(de);
+                serverAssertWithInfo(c,c->argv[j],zbtDelete(zs->zbt,score,c->argv[j]));
+
                 /* Delete from the hash table */
                 dictDelete(zs->dict,c->argv[j]);
                 if (htNeedsResize(zs->dict)) dictResize(zs->dict);
@@ -1553,6 +2648,24 @@ void zremrangeGenericCommand(client *c, int rangetype) {
             dbDelete(c->db,key);
             keyremoved = 1;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        switch(rangetype) {
+        case ZRANGE_RANK:
+            deleted = zbtDeleteRangeByRank(zs->zbt,start+1,end+1,zs->dict);
+            break;
+        case ZRANGE_SCORE:
+            deleted = zbtDeleteRangeByScore(zs->zbt,&range,zs->dict);
+            break;
+        case ZRANGE_LEX:
+            deleted = zbtDeleteRangeByLex(zs->zbt,&lexrange,zs->dict);
+            break;
+        }
+        if (htNeedsResize(zs->dict)) dictResize(zs->dict);
+        if (dictSize(zs->dict) == 0) {
+            dbDelete(c->db,key);
+            keyremoved = 1;
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1614,6 +2727,10 @@ typedef struct {
                 zset *zs;
                 zskiplistNode *node;
             } sl;
+            struct {
+                zset *zs;
+                zbtreeCursor cur;
+            } bt;
         } zset;
     } iter;
 } zsetopsrc;
@@ -1671,6 +2788,9 @@ void zuiInitIterator(zsetopsrc *op) {
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             it->sl.zs = op->subject->ptr;
             it->sl.node = it->sl.zs->zsl->header->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            it->bt.zs = op->subject->ptr;
+            zbtFirst(it->bt.zs->zbt,&it->bt.cur);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1696,7 +2816,8 @@ void zuiClearIterator(zsetopsrc *op) {
         iterzset *it = &op->iter.zset;
         if (op->encoding == OBJ_ENCODING_ZIPLIST) {
             UNUSED(it); /* skip */
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_SKIPLIST ||
+                   op->encoding == OBJ_ENCODING_BTREE) {
             UNUSED(it); /* skip */
         } else {
             serverPanic("Unknown sorted set encoding");
@@ -1725,6 +2846,9 @@ int zuiLength(zsetopsrc *op) {
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             zset *zs = op->subject->ptr;
             return zs->zsl->length;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            return zs->zbt->length;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1787,6 +2911,14 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->sl.node = it->sl.node->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            if (it->bt.cur.leaf == NULL)
+                return 0;
+            val->ele = zbtCursorObj(&it->bt.cur);
+            val->score = zbtCursorScore(&it->bt.cur);
+
+            /* Move to next element. */
+            zbtNext(&it->bt.cur);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1900,6 +3032,15 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             } else {
                 return 0;
             }
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            dictEntry *de;
+            if ((de = dictFind(zs->dict,val->ele)) != NULL) {
+                *score = dictGetDoubleVal(de);
+                return 1;
+            } else {
+                return 0;
+            }
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1943,8 +3084,8 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     robj *tmp;
     unsigned int maxelelen = 0;
     robj *dstobj;
-    zset *dstzset;
-    zskiplistNode *znode;
+    zsetBulkItem *items = NULL;
+    size_t count = 0;
     int touched = 0;
 
     /* expect setnum input keys to be given */
@@ -2026,8 +3167,6 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
      * algorithm's performance */
     qsort(src,setnum,sizeof(zsetopsrc),zuiCompareByCardinality);
 
-    dstobj = createZsetObject();
-    dstzset = dstobj->ptr;
     memset(&zval, 0, sizeof(zval));
 
     if (op == SET_OP_INTER) {
@@ -2035,6 +3174,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         if (zuiLength(&src[0]) > 0) {
             /* Precondition: as src[0] is non-empty and the inputs are ordered
              * by size, all src[i > 0] are non-empty too. */
+            items = zmalloc(sizeof(zsetBulkItem)*zuiLength(&src[0]));
             zuiInitIterator(&src[0]);
             while (zuiNext(&src[0],&zval)) {
                 double score, value;
@@ -2059,10 +3199,10 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 /* Only continue when present in every input. */
                 if (j == setnum) {
                     tmp = zuiObjectFromValue(&zval);
-                    znode = zslInsert(dstzset->zsl,score,tmp);
-                    incrRefCount(tmp); /* added to skiplist */
-                    dictAdd(dstzset->dict,tmp,&znode->score);
-                    incrRefCount(tmp); /* added to dictionary */
+                    items[count].score = score;
+                    items[count].ele = tmp;
+                    incrRefCount(tmp);
+                    count++;
 
                     if (sdsEncodedObject(tmp)) {
                         if (sdslen(tmp->ptr) > maxelelen)
@@ -2124,21 +3264,15 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
             zuiClearIterator(&src[i]);
         }
 
-        /* Step 2: convert the dictionary into the final sorted set. */
+        /* Step 2: collect the dictionary elements, the final sorted set is
+         * then built in a single pass. */
+        items = zmalloc(sizeof(zsetBulkItem)*dictSize(accumulator));
         di = dictGetIterator(accumulator);
-
-        /* We now are aware of the final size of the resulting sorted set,
-         * let's resize the dictionary embedded inside the sorted set to the
-         * right size, in order to save rehashing time. */
-        dictExpand(dstzset->dict,dictSize(accumulator));
-
         while((de = dictNext(di)) != NULL) {
-            robj *ele = dictGetKey(de);
-            score = dictGetDoubleVal(de);
-            znode = zslInsert(dstzset->zsl,score,ele);
-            incrRefCount(ele); /* added to skiplist */
-            dictAdd(dstzset->dict,ele,&znode->score);
-            incrRefCount(ele); /* added to dictionary */
+            items[count].score = dictGetDoubleVal(de);
+            items[count].ele = dictGetKey(de);
+            incrRefCount(items[count].ele);
+            count++;
         }
         dictReleaseIterator(di);
 
@@ -2150,8 +3284,9 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
 
     if (dbDelete(c->db,dstkey))
         touched = 1;
-    if (dstzset->zsl->length) {
-        zsetConvertToZiplistIfNeeded(dstobj,maxelelen);
+    if (count) {
+        dstobj = zsetCreateFromItems(items,count,maxelelen);
+        while (count--) decrRefCount(items[count].ele);
         dbAdd(c->db,dstkey,dstobj);
         addReplyLongLong(c,zsetLength(dstobj));
         signalModifiedKey(c->db,dstkey);
@@ -2160,7 +3295,6 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
             dstkey,c->db->id);
         server.dirty++;
     } else {
-        decrRefCount(dstobj);
         addReply(c,shared.czero);
         if (touched) {
             signalModifiedKey(c->db,dstkey);
@@ -2168,6 +3302,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
             server.dirty++;
         }
     }
+    zfree(items);
     zfree(src);
 }
 
@@ -2276,6 +3411,23 @@ void zrangeGenericCommand(client *c, int reverse) {
                 addReplyDouble(c,ln->score);
             ln = reverse ? ln->backward : ln->level[0].forward;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeCursor cur;
+
+        /* Ranks are resolved in log(N) using the subtree counts. */
+        if (reverse)
+            zbtGetElementByRank(zs->zbt,llen-start,&cur);
+        else
+            zbtGetElementByRank(zs->zbt,start+1,&cur);
+
+        while(rangelen--) {
+            serverAssertWithInfo(c,zobj,cur.leaf != NULL);
+            addReplyBulk(c,zbtCursorObj(&cur));
+            if (withscores)
+                addReplyDouble(c,zbtCursorScore(&cur));
+            if (reverse) zbtPrev(&cur); else zbtNext(&cur);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2465,6 +3617,66 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeCursor cur;
+        int found;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            found = zbtLastInRange(zs->zbt,&range,&cur);
+        } else {
+            found = zbtFirstInRange(zs->zbt,&range,&cur);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!found) {
+            addReply(c, shared.emptymultibulk);
+            return;
+        }
+
+        /* We don't know in advance how many matching elements there are in the
+         * list, so we push this object that will represent the multi-bulk
+         * length in the output buffer, and will "fix" it later */
+        replylen = addDeferredMultiBulkLength(c);
+
+        /* The offset is skipped with a single rank lookup instead of
+         * traversing the elements one by one. */
+        if (offset < 0) {
+            cur.leaf = NULL; /* Like skipping past the end of the range. */
+        } else if (offset > 0) {
+            if (reverse) {
+                if ((unsigned long)offset >= cur.rank)
+                    cur.leaf = NULL;
+                else
+                    zbtGetElementByRank(zs->zbt,cur.rank-offset,&cur);
+            } else {
+                zbtGetElementByRank(zs->zbt,cur.rank+offset,&cur);
+            }
+        }
+
+        while (cur.leaf && limit--) {
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslValueGteMin(zbtCursorScore(&cur),&range)) break;
+            } else {
+                if (!zslValueLteMax(zbtCursorScore(&cur),&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulk(c,zbtCursorObj(&cur));
+
+            if (withscores) {
+                addReplyDouble(c,zbtCursorScore(&cur));
+            }
+
+            /* Move to next element */
+            if (reverse) {
+                zbtPrev(&cur);
+            } else {
+                zbtNext(&cur);
+            }
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2554,6 +3766,14 @@ void zcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeCursor first, last;
+
+        /* The range boundaries lookups also return the ranks. */
+        if (zbtFirstInRange(zs->zbt,&range,&first) &&
+            zbtLastInRange(zs->zbt,&range,&last))
+            count = last.rank - first.rank + 1;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2632,6 +3852,13 @@ void zlexcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeCursor first, last;
+
+        if (zbtFirstInLexRange(zs->zbt,&range,&first) &&
+            zbtLastInLexRange(zs->zbt,&range,&last))
+            count = last.rank - first.rank + 1;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2809,6 +4036,62 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeCursor cur;
+        int found;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            found = zbtLastInLexRange(zs->zbt,&range,&cur);
+        } else {
+            found = zbtFirstInLexRange(zs->zbt,&range,&cur);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!found) {
+            addReply(c, shared.emptymultibulk);
+            zslFreeLexRange(&range);
+            return;
+        }
+
+        /* We don't know in advance how many matching elements there are in the
+         * list, so we push this object that will represent the multi-bulk
+         * length in the output buffer, and will "fix" it later */
+        replylen = addDeferredMultiBulkLength(c);
+
+        /* Skip the offset with a single rank lookup. */
+        if (offset < 0) {
+            cur.leaf = NULL; /* Like skipping past the end of the range. */
+        } else if (offset > 0) {
+            if (reverse) {
+                if ((unsigned long)offset >= cur.rank)
+                    cur.leaf = NULL;
+                else
+                    zbtGetElementByRank(zs->zbt,cur.rank-offset,&cur);
+            } else {
+                zbtGetElementByRank(zs->zbt,cur.rank+offset,&cur);
+            }
+        }
+
+        while (cur.leaf && limit--) {
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslLexValueGteMin(zbtCursorObj(&cur),&range)) break;
+            } else {
+                if (!zslLexValueLteMax(zbtCursorObj(&cur),&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulk(c,zbtCursorObj(&cur));
+
+            /* Move to next element */
+            if (reverse) {
+                zbtPrev(&cur);
+            } else {
+                zbtNext(&cur);
+            }
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2907,6 +4190,21 @@ void zrankGenericCommand(client *c, int reverse) {
         } else {
             addReply(c,shared.nullbulk);
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        dictEntry *de;
+
+        de = dictFind(zs->dict,ele);
+        if (de != NULL) {
+            rank = zbtGetRank(zs->zbt,dictGetDoubleVal(de),ele);
+            serverAssertWithInfo(c,ele,rank); /* Existing elements always have a rank. */
+            if (reverse)
+                addReplyLongLong(c,llen-rank);
+            else
+                addReplyLongLong(c,rank-1);
+        } else {
+            addReply(c,shared.nullbulk);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -39,8 +39,10 @@
 #ifndef __TESTHELP_H
 #define __TESTHELP_H
 
-int __failed_tests = 0;
-int __test_num = 0;
+#include <stdint.h>
+
+static int __failed_tests = 0;
+static int __test_num = 0;
 #define test_cond(descr,_c) do { \
     __test_num++; printf("%d - %s: ", __test_num, descr); \
     if(_c) printf("PASSED\n"); else {printf("FAILED\n"); __failed_tests++;} \
@@ -54,4 +56,13 @@ int __test_num = 0;
     } \
 } while(0);
 
+/* Well distributed 64 bit value for the integer 'j' (the splitmix64
+ * finalizer), to derive the hashes of the test items from a counter. */
+static inline uint64_t test_hash(uint64_t j) {
+    uint64_t h = j*0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
 #endif
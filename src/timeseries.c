@@ -0,0 +1,642 @@
+/* Compressed time series made of Gorilla encoded chunks, the implementation
+ * of the time series type (see t_timeseries.c).
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "timeseries.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+/* Encoding of a sample after the first of a chunk. The delta of delta of
+ * the timestamp is stored as a two's complement integer in the smallest
+ * bucket it fits, after the bucket prefix:
+ *
+ *   0                  dod is 0
+ *   10    + 7 bits     -64 <= dod < 64
+ *   110   + 9 bits     -256 <= dod < 256
+ *   1110  + 12 bits    -2048 <= dod < 2048
+ *   11110 + 32 bits
+ *   11111 + 64 bits
+ *
+ * The value is XORed with the previous one:
+ *
+ *   0                  same value
+ *   10    + N bits     the meaningful bits of the XOR fit the window of
+ *                      the previous XOR, N bits wide
+ *   11    + 5 bits leading zeros + 6 bits length-1 + length bits, that
+ *                      become the new window
+ *
+ * The first sample of a chunk has its timestamp in the chunk header, and
+ * the 64 bits of its value in the data. */
+static const int tsDodBits[] = {0,7,9,12,32,64};
+#define TS_DOD_BUCKETS 6
+#define TS_NO_WINDOW 64
+
+/* Max bits of an encoded sample: 5+64 for the timestamp, 2+5+6+64 for the
+ * value. */
+#define TS_MAX_SAMPLE_BITS 146
+
+/* Bytes allocated for the data of a new chunk, that then doubles up to the
+ * chunk size of the series. */
+#define TS_CHUNK_INITIAL_SIZE 64
+
+/* Serialized format, all the integers are little endian:
+ *
+ * 8 bytes retention, 4 bytes chunk size, 4 bytes number of chunks, then
+ * for every chunk 8 bytes first timestamp, 4 bytes count, 4 bytes number
+ * of bits, and the data rounded up to whole bytes. */
+#define TS_HDR_LEN 16
+#define TS_CHUNK_HDR_LEN 16
+
+/* ----------------------------- Bit streams -------------------------------- */
+
+/* Append the 'n' low bits of 'v' to the chunk data, most significant
+ * first. The data must have room for them, and be zeroed after c->bits. */
+static void tsWriteBits(tsChunk *c, uint64_t v, int n) {
+    while (n > 0) {
+        int avail = 8-(c->bits & 7);
+        int take = n < avail ? n : avail;
+        uint64_t part = (v >> (n-take)) & ((1U << take)-1);
+
+        c->data[c->bits >> 3] |= part << (avail-take);
+        c->bits += take;
+        n -= take;
+    }
+}
+
+/* Read 'n' bits at 'd->pos' into 'v'. Returns 0 if the chunk has less
+ * bits. */
+static int tsReadBits(tsChunk *c, tsDecoder *d, int n, uint64_t *v) {
+    uint64_t r = 0;
+
+    if (c->bits-d->pos < (uint32_t)n) return 0;
+    while (n > 0) {
+        int avail = 8-(d->pos & 7);
+        int take = n < avail ? n : avail;
+
+        r = (r << take) |
+            ((c->data[d->pos >> 3] >> (avail-take)) & ((1U << take)-1));
+        d->pos += take;
+        n -= take;
+    }
+    *v = r;
+    return 1;
+}
+
+/* ------------------------------- Chunks ----------------------------------- */
+
+static tsChunk *tsChunkNew(int64_t ts, uint32_t size) {
+    tsChunk *c = zmalloc(sizeof(*c));
+
+    c->first_ts = c->last_ts = ts;
+    c->last_delta = 0;
+    c->last_value = 0;
+    c->count = 0;
+    c->bits = 0;
+    c->size = size;
+    c->leading = TS_NO_WINDOW;
+    c->trailing = 0;
+    c->data = zcalloc(size);
+    return c;
+}
+
+static void tsChunkFree(tsChunk *c) {
+    zfree(c->data);
+    zfree(c);
+}
+
+/* Shrink the data of a chunk that will not be appended to anymore. */
+static void tsChunkShrink(tsChunk *c) {
+    uint32_t size = (c->bits+7)/8;
+
+    if (size < c->size) {
+        c->data = zrealloc(c->data,size ? size : 1);
+        c->size = size;
+    }
+}
+
+/* Append a sample to the chunk, that must be newer than the last one.
+ * Returns 0 if the chunk can't grow past 'maxsize' bytes to hold it. */
+static int tsChunkAppend(tsChunk *c, int64_t ts, uint64_t value,
+                         uint32_t maxsize)
+{
+    uint32_t needed = (c->bits+TS_MAX_SAMPLE_BITS+7)/8;
+
+    if (needed > c->size) {
+        uint32_t size = c->size*2;
+
+        if (c->count && needed > maxsize) return 0;
+        if (size < needed) size = needed;
+        if (c->count && size > maxsize) size = maxsize;
+        c->data = zrealloc(c->data,size);
+        memset(c->data+c->size,0,size-c->size);
+        c->size = size;
+    }
+
+    if (c->count == 0) {
+        c->first_ts = ts;
+        tsWriteBits(c,value,64);
+    } else {
+        int64_t delta = ts-c->last_ts, dod = delta-c->last_delta;
+        uint64_t xor = value ^ c->last_value;
+        int j;
+
+        /* Timestamp. */
+        for (j = 0; j < TS_DOD_BUCKETS-1; j++) {
+            int64_t half = j ? (int64_t)1 << (tsDodBits[j]-1) : 0;
+            if (j == 0 ? dod == 0 : (dod >= -half && dod < half)) break;
+        }
+        /* Prefix of j ones, and a zero unless it is the last bucket. */
+        if (j < TS_DOD_BUCKETS-1)
+            tsWriteBits(c,((1U << j)-1) << 1,j+1);
+        else
+            tsWriteBits(c,(1U << j)-1,j);
+        if (tsDodBits[j]) tsWriteBits(c,(uint64_t)dod,tsDodBits[j]);
+        c->last_delta = delta;
+
+        /* Value. */
+        if (xor == 0) {
+            tsWriteBits(c,0,1);
+        } else {
+            int leading = __builtin_clzll(xor);
+            int trailing = __builtin_ctzll(xor);
+
+            if (leading > 31) leading = 31;
+            if (c->leading != TS_NO_WINDOW && leading >= c->leading &&
+                trailing >= c->trailing)
+            {
+                tsWriteBits(c,2,2);
+                tsWriteBits(c,xor >> c->trailing,64-c->leading-c->trailing);
+            } else {
+                int len = 64-leading-trailing;
+
+                tsWriteBits(c,3,2);
+                tsWriteBits(c,leading,5);
+                tsWriteBits(c,len-1,6);
+                tsWriteBits(c,xor >> trailing,len);
+                c->leading = leading;
+                c->trailing = trailing;
+            }
+        }
+    }
+    c->last_ts = ts;
+    c->last_value = value;
+    c->count++;
+    return 1;
+}
+
+static void tsDecoderInit(tsDecoder *d) {
+    memset(d,0,sizeof(*d));
+    d->leading = TS_NO_WINDOW;
+}
+
+/* Decode the next sample of the chunk into the decoder state. Returns 0 if
+ * the data is not valid, so it is also used to validate loaded chunks. */
+static int tsDecodeNext(tsChunk *c, tsDecoder *d) {
+    uint64_t v, bit;
+    int j;
+
+    if (d->idx == 0) {
+        if (!tsReadBits(c,d,64,&v)) return 0;
+        d->ts = c->first_ts;
+        d->value = v;
+        d->idx++;
+        return 1;
+    }
+
+    /* Timestamp: count the ones of the bucket prefix. */
+    for (j = 0; j < TS_DOD_BUCKETS-1; j++) {
+        if (!tsReadBits(c,d,1,&bit)) return 0;
+        if (!bit) break;
+    }
+    if (tsDodBits[j]) {
+        int n = tsDodBits[j];
+        int64_t dod;
+
+        if (!tsReadBits(c,d,n,&v)) return 0;
+        /* Sign extension. */
+        if (n < 64 && (v >> (n-1))) v |= ~(uint64_t)0 << n;
+        dod = (int64_t)v;
+        if (dod > 0 ? d->delta > INT64_MAX-dod : d->delta+dod <= 0)
+            return 0;
+        d->delta += dod;
+    }
+    if (d->delta <= 0 || d->ts > INT64_MAX-d->delta) return 0;
+    d->ts += d->delta;
+
+    /* Value. */
+    if (!tsReadBits(c,d,1,&bit)) return 0;
+    if (bit) {
+        if (!tsReadBits(c,d,1,&bit)) return 0;
+        if (bit) {
+            uint64_t leading, len;
+
+            if (!tsReadBits(c,d,5,&leading) ||
+                !tsReadBits(c,d,6,&len)) return 0;
+            len++;
+            if (leading+len > 64) return 0;
+            d->leading = leading;
+            d->trailing = 64-leading-len;
+        } else if (d->leading == TS_NO_WINDOW) {
+            return 0;
+        }
+        if (!tsReadBits(c,d,64-d->leading-d->trailing,&v)) return 0;
+        if (v == 0) return 0;
+        d->value ^= v << d->trailing;
+    }
+    d->idx++;
+    return 1;
+}
+
+/* --------------------------------- API ------------------------------------ */
+
+/* Create an empty time series. Returns NULL if the parameters are not
+ * valid. */
+timeseries *tsNew(int64_t retention, uint32_t chunksize) {
+    timeseries *s;
+
+    if (retention < 0 || chunksize < TS_MIN_CHUNK_SIZE ||
+        chunksize > TS_MAX_CHUNK_SIZE) return NULL;
+    s = zmalloc(sizeof(*s));
+    s->chunks = NULL;
+    s->numchunks = 0;
+    s->chunksize = chunksize;
+    s->numsamples = 0;
+    s->retention = retention;
+    return s;
+}
+
+void tsFree(timeseries *s) {
+    uint32_t j;
+
+    for (j = 0; j < s->numchunks; j++) tsChunkFree(s->chunks[j]);
+    zfree(s->chunks);
+    zfree(s);
+}
+
+timeseries *tsDup(timeseries *s) {
+    timeseries *d = zmalloc(sizeof(*d));
+    uint32_t j;
+
+    *d = *s;
+    d->chunks = zmalloc(sizeof(tsChunk*)*(s->numchunks ? s->numchunks : 1));
+    for (j = 0; j < s->numchunks; j++) {
+        tsChunk *c = zmalloc(sizeof(*c));
+
+        *c = *s->chunks[j];
+        c->data = zmalloc(c->size ? c->size : 1);
+        memcpy(c->data,s->chunks[j]->data,c->size);
+        d->chunks[j] = c;
+    }
+    return d;
+}
+
+/* Return the oldest timestamp that is visible according to the
+ * retention. */
+int64_t tsMinVisible(timeseries *s) {
+    int64_t last;
+
+    if (s->retention == 0 || s->numchunks == 0) return 0;
+    last = s->chunks[s->numchunks-1]->last_ts;
+    return last > s->retention ? last-s->retention : 0;
+}
+
+/* Free the chunks with no visible sample. The last chunk always has the
+ * last sample, that is visible. */
+static void tsTrim(timeseries *s) {
+    int64_t min = tsMinVisible(s);
+    uint32_t j = 0;
+
+    while (j < s->numchunks-1 && s->chunks[j]->last_ts < min) {
+        s->numsamples -= s->chunks[j]->count;
+        tsChunkFree(s->chunks[j]);
+        j++;
+    }
+    if (j) {
+        memmove(s->chunks,s->chunks+j,sizeof(tsChunk*)*(s->numchunks-j));
+        s->numchunks -= j;
+    }
+}
+
+/* Append a sample. Returns 0 if the timestamp is negative or not greater
+ * than the last one. */
+int tsAdd(timeseries *s, int64_t ts, double value) {
+    tsChunk *c = s->numchunks ? s->chunks[s->numchunks-1] : NULL;
+    uint64_t bits;
+
+    if (ts < 0 || (c && ts <= c->last_ts)) return 0;
+    memcpy(&bits,&value,sizeof(bits));
+    if (c == NULL || !tsChunkAppend(c,ts,bits,s->chunksize)) {
+        if (c) tsChunkShrink(c);
+        c = tsChunkNew(ts,TS_CHUNK_INITIAL_SIZE);
+        s->chunks = zrealloc(s->chunks,sizeof(tsChunk*)*(s->numchunks+1));
+        s->chunks[s->numchunks++] = c;
+        tsChunkAppend(c,ts,bits,s->chunksize);
+    }
+    s->numsamples++;
+    if (s->retention) tsTrim(s);
+    return 1;
+}
+
+/* Set the last sample. Returns 0 if the series is empty. */
+int tsLast(timeseries *s, int64_t *ts, double *value) {
+    tsChunk *c;
+
+    if (s->numchunks == 0) return 0;
+    c = s->chunks[s->numchunks-1];
+    *ts = c->last_ts;
+    memcpy(value,&c->last_value,sizeof(*value));
+    return 1;
+}
+
+/* Initialize an iterator over the visible samples with timestamps from
+ * 'from' to 'to', inclusive. */
+void tsIterInit(tsIterator *it, timeseries *s, int64_t from, int64_t to) {
+    int64_t min = tsMinVisible(s);
+    uint32_t lo = 0, hi = s->numchunks;
+
+    if (from < min) from = min;
+    /* Seek the first chunk with samples not older than 'from'. */
+    while (lo < hi) {
+        uint32_t mid = lo+(hi-lo)/2;
+        if (s->chunks[mid]->last_ts < from) lo = mid+1; else hi = mid;
+    }
+    it->s = s;
+    it->chunk = lo;
+    it->from = from;
+    it->to = to;
+    tsDecoderInit(&it->dec);
+}
+
+/* Set the next sample of the iterator. Returns 0 when there are no more
+ * samples in the range. */
+int tsIterNext(tsIterator *it, int64_t *ts, double *value) {
+    while (it->chunk < it->s->numchunks) {
+        tsChunk *c = it->s->chunks[it->chunk];
+
+        if (c->first_ts > it->to) break;
+        while (it->dec.idx < c->count) {
+            tsDecodeNext(c,&it->dec);
+            if (it->dec.ts < it->from) continue;
+            if (it->dec.ts > it->to) goto done;
+            *ts = it->dec.ts;
+            memcpy(value,&it->dec.value,sizeof(*value));
+            return 1;
+        }
+        it->chunk++;
+        tsDecoderInit(&it->dec);
+    }
+done:
+    it->chunk = it->s->numchunks;
+    return 0;
+}
+
+size_t tsMemory(timeseries *s) {
+    size_t bytes = sizeof(*s)+sizeof(tsChunk*)*s->numchunks;
+    uint32_t j;
+
+    for (j = 0; j < s->numchunks; j++)
+        bytes += sizeof(tsChunk)+s->chunks[j]->size;
+    return bytes;
+}
+
+/* ---------------------------- Serialization ------------------------------- */
+
+/* Serialize the series into a newly allocated buffer, setting 'len' to its
+ * length. */
+unsigned char *tsSerialize(timeseries *s, size_t *len) {
+    unsigned char *blob, *p;
+    uint64_t u64;
+    uint32_t u32, j;
+
+    *len = TS_HDR_LEN;
+    for (j = 0; j < s->numchunks; j++)
+        *len += TS_CHUNK_HDR_LEN+(s->chunks[j]->bits+7)/8;
+    p = blob = zmalloc(*len);
+
+    u64 = intrev64ifbe((uint64_t)s->retention);
+    memcpy(p,&u64,8); p += 8;
+    u32 = intrev32ifbe(s->chunksize);
+    memcpy(p,&u32,4); p += 4;
+    u32 = intrev32ifbe(s->numchunks);
+    memcpy(p,&u32,4); p += 4;
+    for (j = 0; j < s->numchunks; j++) {
+        tsChunk *c = s->chunks[j];
+        uint32_t bytes = (c->bits+7)/8;
+
+        u64 = intrev64ifbe((uint64_t)c->first_ts);
+        memcpy(p,&u64,8); p += 8;
+        u32 = intrev32ifbe(c->count);
+        memcpy(p,&u32,4); p += 4;
+        u32 = intrev32ifbe(c->bits);
+        memcpy(p,&u32,4); p += 4;
+        memcpy(p,c->data,bytes); p += bytes;
+    }
+    return blob;
+}
+
+/* Load a serialized series. The input is validated decoding all the
+ * chunks, that also restores their encoder state: NULL is returned if it
+ * is not a valid serialized series. */
+timeseries *tsDeserialize(unsigned char *buf, size_t len) {
+    unsigned char *p = buf, *end = buf+len;
+    uint64_t retention, first_ts;
+    uint32_t chunksize, numchunks, j;
+    int64_t last_ts = -1;
+    timeseries *s;
+
+    if (len < TS_HDR_LEN) return NULL;
+    memcpy(&retention,p,8); p += 8;
+    memcpy(&chunksize,p,4); p += 4;
+    memcpy(&numchunks,p,4); p += 4;
+    retention = intrev64ifbe(retention);
+    chunksize = intrev32ifbe(chunksize);
+    numchunks = intrev32ifbe(numchunks);
+    if (retention > INT64_MAX) return NULL;
+    if ((s = tsNew(retention,chunksize)) == NULL) return NULL;
+    if (numchunks > (size_t)(end-p)/TS_CHUNK_HDR_LEN) goto invalid;
+    s->chunks = zmalloc(sizeof(tsChunk*)*(numchunks ? numchunks : 1));
+
+    for (j = 0; j < numchunks; j++) {
+        uint32_t count, bits, bytes;
+        tsDecoder d;
+        tsChunk *c;
+
+        if (end-p < TS_CHUNK_HDR_LEN) goto invalid;
+        memcpy(&first_ts,p,8); p += 8;
+        memcpy(&count,p,4); p += 4;
+        memcpy(&bits,p,4); p += 4;
+        first_ts = intrev64ifbe(first_ts);
+        count = intrev32ifbe(count);
+        bits = intrev32ifbe(bits);
+        bytes = (bits+7)/8;
+        if (first_ts > INT64_MAX || (int64_t)first_ts <= last_ts ||
+            count == 0 || bits > (uint64_t)chunksize*8 ||
+            (size_t)(end-p) < bytes) goto invalid;
+        /* The padding bits must be zero, they are ORed by appends. */
+        if ((bits & 7) && (p[bytes-1] & (0xff >> (bits & 7)))) goto invalid;
+
+        c = tsChunkNew(first_ts,bytes ? bytes : 1);
+        memcpy(c->data,p,bytes);
+        p += bytes;
+        c->bits = bits;
+        s->chunks[s->numchunks++] = c;
+
+        tsDecoderInit(&d);
+        while (d.idx < count)
+            if (!tsDecodeNext(c,&d)) goto invalid;
+        if (d.pos != bits) goto invalid;
+        c->count = count;
+        c->last_ts = last_ts = d.ts;
+        c->last_delta = d.delta;
+        c->last_value = d.value;
+        c->leading = d.leading;
+        c->trailing = d.trailing;
+        s->numsamples += count;
+    }
+    if (p != end) goto invalid;
+    return s;
+
+invalid:
+    tsFree(s);
+    return NULL;
+}
+
+/* -------------------------------- Tests ----------------------------------- */
+
+#ifdef REDIS_TEST
+#include "testhelp.h"
+
+/* Timestamp and value of the sample 'j' of a test series: samples every
+ * 10 seconds with some jitter, of a slowly changing metric, with a few
+ * large gaps and arbitrary values. */
+static int64_t tsTestTimestamp(uint64_t j) {
+    int64_t ts = 1500000000000LL+j*10000+(j*7919 % 13);
+    if (j >= 5000) ts += 86400000LL*365*50;
+    return ts;
+}
+
+static double tsTestValue(uint64_t j) {
+    if (j % 1000 == 999) return -(double)j*1e300;
+    return 20+(j/100)*0.5;
+}
+
+int tsTest(int argc, char *argv[]) {
+    int ok;
+    uint64_t j, n = 10000;
+    unsigned char *blob;
+    size_t bloblen;
+    timeseries *s, *d;
+    tsIterator it;
+    int64_t ts;
+    double value;
+
+    (void)argc;
+    (void)argv;
+
+    s = tsNew(0,TS_DEFAULT_CHUNK_SIZE);
+    ok = 1;
+    for (j = 0; j < n; j++)
+        if (!tsAdd(s,tsTestTimestamp(j),tsTestValue(j))) ok = 0;
+    test_cond("Add samples in order", ok && s->numsamples == n);
+    ok = !tsAdd(s,tsTestTimestamp(n-1),1) && !tsAdd(s,0,1);
+    test_cond("Reject samples not newer than the last one",
+        ok && s->numsamples == n);
+    printf("Bytes per sample: %.2f\n", (double)tsMemory(s)/n);
+    test_cond("Samples are compressed", tsMemory(s) < n*3);
+
+    tsIterInit(&it,s,0,INT64_MAX);
+    ok = 1;
+    for (j = 0; j < n; j++) {
+        if (!tsIterNext(&it,&ts,&value) || ts != tsTestTimestamp(j) ||
+            value != tsTestValue(j)) ok = 0;
+    }
+    if (tsIterNext(&it,&ts,&value)) ok = 0;
+    test_cond("Iterate all the samples", ok);
+
+    tsIterInit(&it,s,tsTestTimestamp(1234),tsTestTimestamp(5678));
+    ok = 1;
+    for (j = 1234; j <= 5678; j++) {
+        if (!tsIterNext(&it,&ts,&value) || ts != tsTestTimestamp(j) ||
+            value != tsTestValue(j)) ok = 0;
+    }
+    if (tsIterNext(&it,&ts,&value)) ok = 0;
+    test_cond("Iterate a range", ok);
+
+    tsIterInit(&it,s,tsTestTimestamp(10)+1,tsTestTimestamp(11)-1);
+    ok = !tsIterNext(&it,&ts,&value);
+    test_cond("Iterate an empty range", ok);
+
+    blob = tsSerialize(s,&bloblen);
+    d = tsDeserialize(blob,bloblen);
+    ok = d && d->numsamples == n && d->numchunks == s->numchunks;
+    /* The loaded series must continue the encoding. */
+    if (d) {
+        ok = ok && tsAdd(d,tsTestTimestamp(n),tsTestValue(n));
+        tsIterInit(&it,d,tsTestTimestamp(n-1),INT64_MAX);
+        ok = ok && tsIterNext(&it,&ts,&value) && ts == tsTestTimestamp(n-1);
+        ok = ok && tsIterNext(&it,&ts,&value) && ts == tsTestTimestamp(n) &&
+             value == tsTestValue(n);
+        tsFree(d);
+    }
+    test_cond("Serialize, deserialize and append", ok);
+    test_cond("Deserialize rejects truncated input",
+        tsDeserialize(blob,bloblen-1) == NULL);
+    /* Corrupted chunks must be rejected or decode without crashing. */
+    for (j = TS_HDR_LEN; j < bloblen; j += 7) {
+        blob[j] ^= 0x10;
+        d = tsDeserialize(blob,bloblen);
+        if (d) {
+            /* A valid mutation must still be iterable. */
+            tsIterInit(&it,d,0,INT64_MAX);
+            while (tsIterNext(&it,&ts,&value));
+            tsFree(d);
+        }
+        blob[j] ^= 0x10;
+    }
+    zfree(blob);
+    tsFree(s);
+
+    s = tsNew(100000,TS_MIN_CHUNK_SIZE);
+    for (j = 0; j < 100000; j++) tsAdd(s,j*10,j);
+    test_cond("Retention frees the old chunks",
+        s->numsamples < 10000+TS_MIN_CHUNK_SIZE*8 && s->numchunks > 1);
+    tsIterInit(&it,s,0,INT64_MAX);
+    ok = tsIterNext(&it,&ts,&value) && ts == 999990-100000;
+    test_cond("Retention hides the old samples", ok);
+    tsFree(s);
+
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __TIMESERIES_H
+#define __TIMESERIES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Time series of (timestamp, value) samples, with non negative timestamps
+ * in milliseconds and double values, appended in timestamp order.
+ *
+ * Samples are stored in chunks compressed like in Facebook's Gorilla: the
+ * timestamps are encoded as the delta of their delta with the previous
+ * sample, and the values as the XOR with the previous value, so that
+ * samples taken at regular intervals of slowly changing metrics take a
+ * couple of bytes. A chunk is full when its compressed data reaches the
+ * chunk size of the series, and the chunks are ordered by time so that a
+ * range query only decodes the chunks overlapping the range.
+ *
+ * With a retention set, samples older than the last timestamp minus the
+ * retention are not visible anymore, and the chunks with only such samples
+ * are freed. */
+#define TS_DEFAULT_CHUNK_SIZE 4096
+#define TS_MIN_CHUNK_SIZE 128
+#define TS_MAX_CHUNK_SIZE (1024*1024)
+
+typedef struct tsChunk {
+    int64_t first_ts;       /* Timestamp of the first sample. */
+    int64_t last_ts;        /* Timestamp of the last sample. */
+    int64_t last_delta;     /* Delta between the last two timestamps. */
+    uint64_t last_value;    /* Bits of the last value. */
+    uint32_t count;         /* Number of samples. */
+    uint32_t bits;          /* Bits of compressed data. */
+    uint32_t size;          /* Bytes allocated for the data. */
+    uint8_t leading;        /* Window of the meaningful bits of the last */
+    uint8_t trailing;       /* XOR, leading is 64 before the first XOR. */
+    unsigned char *data;
+} tsChunk;
+
+typedef struct timeseries {
+    tsChunk **chunks;       /* Chunks ordered by time. */
+    uint32_t numchunks;
+    uint32_t chunksize;     /* Max bytes of compressed data per chunk. */
+    uint64_t numsamples;    /* Samples in the chunks, visible or not. */
+    int64_t retention;      /* Max age of the samples in ms, 0 to keep all. */
+} timeseries;
+
+/* Decoding state of a chunk. */
+typedef struct tsDecoder {
+    uint32_t idx;           /* Samples decoded so far. */
+    uint32_t pos;           /* Bit position in the chunk data. */
+    int64_t ts, delta;
+    uint64_t value;
+    uint8_t leading, trailing;
+} tsDecoder;
+
+/* Iterator over the samples of a time range. */
+typedef struct tsIterator {
+    timeseries *s;
+    uint32_t chunk;         /* Index of the current chunk. */
+    tsDecoder dec;
+    int64_t from, to;
+} tsIterator;
+
+timeseries *tsNew(int64_t retention, uint32_t chunksize);
+void tsFree(timeseries *s);
+timeseries *tsDup(timeseries *s);
+int tsAdd(timeseries *s, int64_t ts, double value);
+int tsLast(timeseries *s, int64_t *ts, double *value);
+int64_t tsMinVisible(timeseries *s);
+void tsIterInit(tsIterator *it, timeseries *s, int64_t from, int64_t to);
+int tsIterNext(tsIterator *it, int64_t *ts, double *value);
+size_t tsMemory(timeseries *s);
+unsigned char *tsSerialize(timeseries *s, size_t *len);
+timeseries *tsDeserialize(unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int tsTest(int argc, char *argv[]);
+#endif
+
+#endif
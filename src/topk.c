@@ -0,0 +1,435 @@
+/* Top-k tracking with a count-min sketch and a min-heap of the heavy
+ * hitters, the implementation of the top-k type (see t_sketch.c).
+ *
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topk.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+/* Serialized format: 4 bytes k, 4 bytes number of items, the serialized
+ * sketch (see cms.c), then for every item of the heap 8 bytes hash, 4 bytes
+ * count, 4 bytes length and the item itself. All the integers are little
+ * endian. */
+#define TOPK_HDR_LEN 8
+#define TOPK_ITEM_HDR_LEN 16
+
+/* ------------------------------ Min-heap ---------------------------------- */
+
+static void topkSiftDown(topk *t, uint32_t j) {
+    topkItem tmp = t->heap[j];
+
+    while (1) {
+        uint32_t child = j*2+1;
+
+        if (child >= t->numitems) break;
+        if (child+1 < t->numitems &&
+            t->heap[child+1].count < t->heap[child].count) child++;
+        if (tmp.count <= t->heap[child].count) break;
+        t->heap[j] = t->heap[child];
+        j = child;
+    }
+    t->heap[j] = tmp;
+}
+
+static void topkSiftUp(topk *t, uint32_t j) {
+    topkItem tmp = t->heap[j];
+
+    while (j > 0) {
+        uint32_t parent = (j-1)/2;
+
+        if (t->heap[parent].count <= tmp.count) break;
+        t->heap[j] = t->heap[parent];
+        j = parent;
+    }
+    t->heap[j] = tmp;
+}
+
+/* Return the heap index of the item, or -1 if it is not in the heap. */
+static long topkFind(topk *t, const char *item, size_t len, uint64_t hash) {
+    uint32_t j;
+
+    for (j = 0; j < t->numitems; j++) {
+        if (t->heap[j].hash == hash && sdslen(t->heap[j].item) == len &&
+            memcmp(t->heap[j].item,item,len) == 0) return j;
+    }
+    return -1;
+}
+
+/* Update the heap after the estimate of the item became 'count'. If an
+ * item is expelled from the heap it is returned, otherwise NULL. */
+static sds topkUpdate(topk *t, const char *item, size_t len, uint64_t hash,
+                      uint32_t count)
+{
+    sds expelled;
+    long j;
+
+    /* Items in the heap have an estimate not lower than the minimum. */
+    if (t->numitems == t->k && count < t->heap[0].count) return NULL;
+    if ((j = topkFind(t,item,len,hash)) != -1) {
+        t->heap[j].count = count;
+        topkSiftDown(t,j);
+        return NULL;
+    }
+    if (t->numitems < t->k) {
+        j = t->numitems++;
+        t->heap[j].hash = hash;
+        t->heap[j].count = count;
+        t->heap[j].item = sdsnewlen(item,len);
+        topkSiftUp(t,j);
+        return NULL;
+    }
+    /* On ties the item already in the heap stays there. */
+    if (count == t->heap[0].count) return NULL;
+    expelled = t->heap[0].item;
+    t->heap[0].hash = hash;
+    t->heap[0].count = count;
+    t->heap[0].item = sdsnewlen(item,len);
+    topkSiftDown(t,0);
+    return expelled;
+}
+
+/* --------------------------------- API ------------------------------------ */
+
+/* Create a top-k structure with a sketch of the specified dimensions.
+ * Returns NULL if the parameters are not valid. */
+topk *topkNew(uint32_t k, uint32_t width, uint32_t depth) {
+    topk *t;
+    cms *s;
+
+    if (k == 0 || k > TOPK_MAX_K) return NULL;
+    if ((s = cmsNew(width,depth)) == NULL) return NULL;
+    t = zmalloc(sizeof(*t));
+    t->k = k;
+    t->numitems = 0;
+    t->sketch = s;
+    t->heap = zmalloc(sizeof(topkItem)*k);
+    return t;
+}
+
+void topkFree(topk *t) {
+    uint32_t j;
+
+    for (j = 0; j < t->numitems; j++) sdsfree(t->heap[j].item);
+    cmsFree(t->sketch);
+    zfree(t->heap);
+    zfree(t);
+}
+
+topk *topkDup(topk *t) {
+    topk *d = zmalloc(sizeof(*d));
+    uint32_t j;
+
+    *d = *t;
+    d->sketch = cmsDup(t->sketch);
+    d->heap = zmalloc(sizeof(topkItem)*t->k);
+    for (j = 0; j < t->numitems; j++) {
+        d->heap[j] = t->heap[j];
+        d->heap[j].item = sdsdup(t->heap[j].item);
+    }
+    return d;
+}
+
+/* Increment the count of the item by 'incr'. If the item enters the top-k
+ * expelling another item, '*expelled' is set to the expelled item, that the
+ * caller should free, otherwise to NULL. Returns 0 without changing
+ * anything if the count would overflow. */
+int topkIncrBy(topk *t, const char *item, size_t len, uint64_t hash,
+               uint32_t incr, sds *expelled)
+{
+    uint32_t count;
+
+    *expelled = NULL;
+    if (!cmsIncrBy(t->sketch,hash,incr,&count)) return 0;
+    *expelled = topkUpdate(t,item,len,hash,count);
+    return 1;
+}
+
+/* Return 1 if the item is one of the top-k items. */
+int topkQuery(topk *t, const char *item, size_t len, uint64_t hash) {
+    return topkFind(t,item,len,hash) != -1;
+}
+
+static int topkCompareCountDesc(const void *a, const void *b) {
+    const topkItem *ia = a, *ib = b;
+
+    if (ia->count != ib->count) return ia->count < ib->count ? 1 : -1;
+    return sdscmp(ia->item,ib->item);
+}
+
+/* Return a newly allocated array with the t->numitems items of the heap,
+ * sorted by count, highest first. The items are not copied, so the array
+ * is only valid until the structure is modified. */
+topkItem *topkList(topk *t) {
+    topkItem *items = zmalloc(sizeof(topkItem)*(t->numitems ? t->numitems : 1));
+
+    memcpy(items,t->heap,sizeof(topkItem)*t->numitems);
+    qsort(items,t->numitems,sizeof(topkItem),topkCompareCountDesc);
+    return items;
+}
+
+/* Merge the 'numsrc' structures in 'src' into 'dst' ('dst' itself may be
+ * one of them): the sketch of 'dst' becomes the sum of the sketches, and
+ * its heap the dst->k items of all the heaps with the highest estimates in
+ * the merged sketch. Returns 0 without changing 'dst' if the sketches
+ * can't be merged. */
+int topkMerge(topk *dst, topk **src, int numsrc) {
+    cms **sketches = zmalloc(sizeof(cms*)*numsrc), *merged;
+    topkItem *candidates;
+    uint32_t numcandidates = 0, j;
+    int k;
+
+    for (k = 0; k < numsrc; k++) sketches[k] = src[k]->sketch;
+    merged = cmsDup(dst->sketch);
+    if (!cmsMerge(merged,sketches,NULL,numsrc)) {
+        cmsFree(merged);
+        zfree(sketches);
+        return 0;
+    }
+    zfree(sketches);
+
+    /* Collect the items of all the heaps before touching 'dst'. */
+    for (k = 0; k < numsrc; k++) numcandidates += src[k]->numitems;
+    candidates = zmalloc(sizeof(topkItem)*(numcandidates ? numcandidates : 1));
+    numcandidates = 0;
+    for (k = 0; k < numsrc; k++) {
+        for (j = 0; j < src[k]->numitems; j++) {
+            candidates[numcandidates] = src[k]->heap[j];
+            candidates[numcandidates].item = sdsdup(src[k]->heap[j].item);
+            numcandidates++;
+        }
+    }
+
+    for (j = 0; j < dst->numitems; j++) sdsfree(dst->heap[j].item);
+    dst->numitems = 0;
+    cmsFree(dst->sketch);
+    dst->sketch = merged;
+    for (j = 0; j < numcandidates; j++) {
+        topkItem *c = candidates+j;
+        sds expelled = NULL;
+
+        /* Items in multiple heaps are only added once. */
+        if (topkFind(dst,c->item,sdslen(c->item),c->hash) == -1)
+            expelled = topkUpdate(dst,c->item,sdslen(c->item),c->hash,
+                                  cmsQuery(merged,c->hash));
+        sdsfree(expelled);
+        sdsfree(c->item);
+    }
+    zfree(candidates);
+    return 1;
+}
+
+size_t topkMemory(topk *t) {
+    size_t bytes = sizeof(*t)+sizeof(topkItem)*t->k+cmsMemory(t->sketch);
+    uint32_t j;
+
+    for (j = 0; j < t->numitems; j++) bytes += sdsAllocSize(t->heap[j].item);
+    return bytes;
+}
+
+/* ---------------------------- Serialization ------------------------------- */
+
+/* Serialize the structure into a newly allocated buffer, setting 'len' to
+ * its length. See TOPK_HDR_LEN for the format. */
+unsigned char *topkSerialize(topk *t, size_t *len) {
+    size_t bloblen = TOPK_HDR_LEN+cmsSerializedLen(t->sketch);
+    unsigned char *blob, *p;
+    uint64_t u64;
+    uint32_t u32, j;
+
+    for (j = 0; j < t->numitems; j++)
+        bloblen += TOPK_ITEM_HDR_LEN+sdslen(t->heap[j].item);
+    p = blob = zmalloc(bloblen);
+    u32 = intrev32ifbe(t->k);
+    memcpy(p,&u32,4); p += 4;
+    u32 = intrev32ifbe(t->numitems);
+    memcpy(p,&u32,4); p += 4;
+    p = cmsSerializeTo(t->sketch,p);
+    for (j = 0; j < t->numitems; j++) {
+        topkItem *i = t->heap+j;
+
+        u64 = intrev64ifbe(i->hash);
+        memcpy(p,&u64,8); p += 8;
+        u32 = intrev32ifbe(i->count);
+        memcpy(p,&u32,4); p += 4;
+        u32 = intrev32ifbe(sdslen(i->item));
+        memcpy(p,&u32,4); p += 4;
+        memcpy(p,i->item,sdslen(i->item));
+        p += sdslen(i->item);
+    }
+    *len = bloblen;
+    return blob;
+}
+
+/* Create a top-k structure from its serialized version. The input is
+ * validated, so NULL is returned if it is not a valid serialized top-k. */
+topk *topkDeserialize(unsigned char *buf, size_t len) {
+    unsigned char *p = buf, *end = buf+len;
+    uint32_t k, numitems, j;
+    cms *s;
+    topk *t;
+
+    if (len < TOPK_HDR_LEN) return NULL;
+    memcpy(&k,p,4); p += 4;
+    memcpy(&numitems,p,4); p += 4;
+    k = intrev32ifbe(k);
+    numitems = intrev32ifbe(numitems);
+    if (k == 0 || k > TOPK_MAX_K || numitems > k) return NULL;
+    if ((s = cmsDeserializeFrom(&p,end)) == NULL) return NULL;
+
+    t = zmalloc(sizeof(*t));
+    t->k = k;
+    t->numitems = 0;
+    t->sketch = s;
+    t->heap = zmalloc(sizeof(topkItem)*k);
+    for (j = 0; j < numitems; j++) {
+        topkItem *i = t->heap+j;
+        uint32_t itemlen;
+
+        if (end-p < TOPK_ITEM_HDR_LEN) goto invalid;
+        memcpy(&i->hash,p,8); p += 8;
+        memcpy(&i->count,p,4); p += 4;
+        memcpy(&itemlen,p,4); p += 4;
+        i->hash = intrev64ifbe(i->hash);
+        i->count = intrev32ifbe(i->count);
+        itemlen = intrev32ifbe(itemlen);
+        if ((size_t)(end-p) < itemlen) goto invalid;
+        i->item = sdsnewlen(p,itemlen);
+        p += itemlen;
+        t->numitems++;
+    }
+    if (p != end) goto invalid;
+    /* Restore the heap property rather than trusting the input. */
+    for (j = t->numitems/2; j > 0; j--) topkSiftDown(t,j-1);
+    return t;
+
+invalid:
+    topkFree(t);
+    return NULL;
+}
+
+/* -------------------------------- Tests ----------------------------------- */
+
+#ifdef REDIS_TEST
+#include "testhelp.h"
+
+static uint64_t topkTestHash(const char *s, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (len--) h = (h ^ (unsigned char)*s++) * 0x100000001b3ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 33);
+}
+
+/* Add 'times' times the item "item:<j>". */
+static void topkTestAdd(topk *t, int j, int times) {
+    char buf[32];
+    int len = snprintf(buf,sizeof(buf),"item:%d",j);
+    sds expelled;
+
+    while (times--) {
+        topkIncrBy(t,buf,len,topkTestHash(buf,len),1,&expelled);
+        sdsfree(expelled);
+    }
+}
+
+/* Return 1 if the top-k items are "item:0" ... "item:<k-1>". */
+static int topkTestIsTop(topk *t) {
+    topkItem *items = topkList(t);
+    uint32_t j;
+    int ok = t->numitems == t->k;
+
+    for (j = 0; ok && j < t->numitems; j++) {
+        char buf[32];
+        snprintf(buf,sizeof(buf),"item:%u",j);
+        if (strcmp(items[j].item,buf)) ok = 0;
+    }
+    zfree(items);
+    return ok;
+}
+
+int topkTest(int argc, char *argv[]) {
+    int j;
+    unsigned char *blob;
+    size_t bloblen;
+    topk *t, *d, *src[2];
+
+    (void)argc;
+    (void)argv;
+
+    /* Item j appears 2000-j*100 times for the first 10 items, and a few
+     * times for a thousand of other items, interleaved. */
+    t = topkNew(10,1000,5);
+    for (j = 0; j < 1000; j++) {
+        if (j < 10) topkTestAdd(t,j,1000-j*50);
+        topkTestAdd(t,10+j,3);
+    }
+    test_cond("Heavy hitters are found, sorted by count", topkTestIsTop(t));
+
+    blob = topkSerialize(t,&bloblen);
+    d = topkDeserialize(blob,bloblen);
+    test_cond("Serialize and deserialize", d && topkTestIsTop(d));
+    if (d) topkFree(d);
+    test_cond("Deserialize rejects truncated input",
+        topkDeserialize(blob,bloblen-1) == NULL);
+    zfree(blob);
+
+    /* Split the same stream in two shards and merge them. */
+    src[0] = topkNew(10,1000,5);
+    src[1] = topkNew(10,1000,5);
+    for (j = 0; j < 1000; j++) {
+        if (j < 10) {
+            topkTestAdd(src[0],j,(1000-j*50)/2);
+            topkTestAdd(src[1],j,(1000-j*50)/2);
+        }
+        topkTestAdd(src[j%2],10+j,3);
+    }
+    d = topkNew(10,1000,5);
+    test_cond("Merged shards find the heavy hitters",
+        topkMerge(d,src,2) && topkTestIsTop(d) &&
+        d->sketch->count == t->sketch->count);
+    test_cond("Merge into one of the sources",
+        topkMerge(src[0],src,2) && topkTestIsTop(src[0]));
+    topkFree(d);
+    d = topkNew(10,500,5);
+    test_cond("Merging different sketch sizes fails",
+        topkMerge(d,src,2) == 0 && d->numitems == 0);
+    topkFree(d);
+    topkFree(src[0]);
+    topkFree(src[1]);
+    topkFree(t);
+
+    test_report();
+    return 0;
+}
+#endif
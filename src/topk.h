@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016, Redis contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __TOPK_H
+#define __TOPK_H
+
+#include "cms.h"
+#include "sds.h"
+
+/* Top-k heavy hitters: a count-min sketch estimates the count of every
+ * item, and a min-heap keyed by the estimates holds the k items with the
+ * highest counts seen so far. An item enters the heap when its estimate
+ * gets higher than the one of the heap minimum, that is expelled.
+ *
+ * Since an item in the heap has an estimate not lower than the heap
+ * minimum, the heap is only searched for items that estimate at least as
+ * much, so most increments only update the sketch. Top-k structures with
+ * the same sketch dimensions are merged summing the sketches and keeping
+ * the k items of all the heaps with the highest merged estimates. */
+#define TOPK_MAX_K 100000
+
+typedef struct topkItem {
+    uint64_t hash;      /* Hash of the item, compared before the item. */
+    uint32_t count;     /* Estimated count when last incremented. */
+    sds item;
+} topkItem;
+
+typedef struct topk {
+    uint32_t k;         /* Max number of items in the heap. */
+    uint32_t numitems;  /* Items in the heap. */
+    cms *sketch;
+    topkItem *heap;     /* Min-heap of the items by count. */
+} topk;
+
+topk *topkNew(uint32_t k, uint32_t width, uint32_t depth);
+void topkFree(topk *t);
+topk *topkDup(topk *t);
+int topkIncrBy(topk *t, const char *item, size_t len, uint64_t hash,
+               uint32_t incr, sds *expelled);
+int topkQuery(topk *t, const char *item, size_t len, uint64_t hash);
+topkItem *topkList(topk *t);
+int topkMerge(topk *dst, topk **src, int numsrc);
+size_t topkMemory(topk *t);
+unsigned char *topkSerialize(topk *t, size_t *len);
+topk *topkDeserialize(unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int topkTest(int argc, char *argv[]);
+#endif
+
+#endif
@@ -411,6 +411,29 @@ int string2l(const char *s, size_t slen, long *lval) {
     return 1;
 }
 
+/* Helper function to convert a string to an unsigned long long value.
+ * The function attempts to use the faster string2ll() function inside
+ * Redis: if it fails, strtoull() is used instead. The function returns
+ * 1 if the conversion happened successfully or 0 if the number is
+ * invalid or out of range. */
+int string2ull(const char *s, unsigned long long *value) {
+    long long ll;
+    char *endptr = NULL;
+
+    if (string2ll(s,strlen(s),&ll)) {
+        if (ll < 0) return 0; /* Negative values are out of range. */
+        *value = ll;
+        return 1;
+    }
+    /* strtoull() would accept leading spaces and a sign. */
+    if (*s < '0' || *s > '9') return 0;
+    errno = 0;
+    *value = strtoull(s,&endptr,10);
+    if (errno == EINVAL || errno == ERANGE || *endptr != '\0')
+        return 0; /* strtoull() failed. */
+    return 1; /* Conversion done! */
+}
+
 /* Convert a double to a string representation. Returns the number of bytes
  * required. The representation should always be parsable by strtod(3). */
 int d2string(char *buf, size_t len, double value) {
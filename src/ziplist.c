@@ -966,6 +966,37 @@ unsigned char *ziplistDelete(unsigned char *zl, unsigned char **p) {
     return zl;
 }
 
+/* Replace the entry pointed by *p with the integer 'value'. When the new
+ * value has an integer encoding of the same size of the old one the entry
+ * is overwritten in place, so that 'zl' and '*p' are left untouched: this
+ * is the common case for counters and flags stored in a ziplist. Otherwise
+ * the entry is deleted and the new one inserted at the same offset. On
+ * return *p points to the replaced entry. */
+// 将p指向的entry替换为整数value，编码长度相同时原地覆盖，否则先删除再插入
+unsigned char *ziplistReplaceInteger(unsigned char *zl, unsigned char **p, long long value) {
+    zlentry entry;
+    unsigned char encoding;
+    long long v;
+    char buf[32];
+    int len = ll2string(buf,sizeof(buf),value);
+    size_t offset;
+
+    zipEntry(*p, &entry);
+    if (!ZIP_IS_STR(entry.encoding) &&
+        zipTryEncoding((unsigned char*)buf,len,&v,&encoding) &&
+        zipIntSize(encoding) == zipIntSize(entry.encoding))
+    {
+        (*p)[entry.prevrawlensize] = encoding;
+        zipSaveInteger(*p+entry.headersize,v,encoding);
+        return zl;
+    }
+    offset = *p-zl;
+    zl = ziplistDelete(zl,p);
+    zl = __ziplistInsert(zl,*p,(unsigned char*)buf,len);
+    *p = zl+offset;
+    return zl;
+}
+
 /* Delete a range of entries from the ziplist. */
 // 从ziplist的index下标开始，删除num个数量的entry
 unsigned char *ziplistDeleteRange(unsigned char *zl, int index, unsigned int num) {
@@ -93,6 +93,9 @@ unsigned char *ziplistInsert(unsigned char *zl, unsigned char *p, unsigned char
 // 因为删除操作会造成ziplist内存重新分配，为了循环方便，p将重新指向ziplist中原p指向的内存，即原p的下一个entry的地址
 unsigned char *ziplistDelete(unsigned char *zl, unsigned char **p);
 
+// 将p指向的entry替换为整数value，编码长度相同时原地覆盖
+unsigned char *ziplistReplaceInteger(unsigned char *zl, unsigned char **p, long long value);
+
 // 从ziplist的index下标开始，删除num个数量的entry
 unsigned char *ziplistDeleteRange(unsigned char *zl, int index, unsigned int num);
 
@@ -9,6 +9,9 @@ proc append_to_aof {str} {
 
 proc create_aof {code} {
     upvar fp fp aof_path aof_path
+    # Drop the manifest and the other files of the previous AOF, so that
+    # the file created here is loaded as the only file of the AOF.
+    foreach f [glob -nocomplain "$aof_path.*"] {file delete $f}
     set fp [open $aof_path w+]
     uplevel 1 $code
     close $fp
@@ -258,3 +261,235 @@ tags {"aof"} {
         }
     }
 }
+
+proc wait_aof_rewrite {client} {
+    wait_for_condition 100 100 {
+        [status $client aof_rewrite_in_progress] eq 0 &&
+        [status $client aof_rewrite_scheduled] eq 0
+    } else {
+        fail "AOF rewrite still in progress after too long time"
+    }
+}
+
+proc read_manifest {path} {
+    set fp [open $path r]
+    set lines [split [string trim [read $fp]] "\n"]
+    close $fp
+    return $lines
+}
+
+tags {"aof"} {
+    ## An AOF of older versions becomes the base file of a new manifest.
+    create_aof {
+        append_to_aof [formatCommand set foo hello]
+    }
+
+    start_server_aof [list dir $server_path] {
+        test "Multi part AOF: an old AOF is used as base file" {
+            assert_equal [list \
+                {file appendonly.aof seq 0 type b} \
+                {file appendonly.aof.1.incr.aof seq 1 type i}] \
+                [read_manifest $aof_path.manifest]
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            assert_equal hello [$client get foo]
+            $client set bar world
+        }
+    }
+
+    start_server_aof [list dir $server_path] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+
+        test "Multi part AOF: the base and INCR files are loaded in order" {
+            assert_equal hello [$client get foo]
+            assert_equal world [$client get bar]
+        }
+
+        test "Multi part AOF: BGREWRITEAOF writes new base and INCR files" {
+            $client set foo hello2
+            $client bgrewriteaof
+            $client set counter 1
+            wait_aof_rewrite $client
+            $client incr counter
+            assert_equal [list \
+                {file appendonly.aof.1.base.aof seq 1 type b} \
+                {file appendonly.aof.2.incr.aof seq 2 type i}] \
+                [read_manifest $aof_path.manifest]
+            wait_for_condition 50 100 {
+                ![file exists $aof_path] &&
+                ![file exists $aof_path.1.incr.aof]
+            } else {
+                fail "The old AOF files were not deleted"
+            }
+            set digest [$client debug digest]
+            $client debug loadaof
+            assert_equal $digest [$client debug digest]
+            assert_equal 2 [$client get counter]
+        }
+
+        test "Multi part AOF: a rewrite with the AOF disabled writes a base only" {
+            $client config set appendonly no
+            $client bgrewriteaof
+            wait_aof_rewrite $client
+            assert_equal [list {file appendonly.aof.2.base.aof seq 2 type b}] \
+                [read_manifest $aof_path.manifest]
+            $client config set appendonly yes
+            wait_aof_rewrite $client
+            $client incr counter
+            assert_equal [list \
+                {file appendonly.aof.3.base.aof seq 3 type b} \
+                {file appendonly.aof.3.incr.aof seq 3 type i}] \
+                [read_manifest $aof_path.manifest]
+        }
+    }
+
+    start_server_aof [list dir $server_path] {
+        test "Multi part AOF: the dataset survives the rewrites" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            assert_equal hello2 [$client get foo]
+            assert_equal world [$client get bar]
+            assert_equal 3 [$client get counter]
+        }
+    }
+
+    start_server_aof [list dir $server_path child-max-write-rate 100kb] {
+        test "Multi part AOF: BGREWRITEAOF inside MULTI/EXEC is scheduled" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            $client debug populate 20000
+            $client multi
+            $client set a 1
+            $client bgrewriteaof
+            $client set b 2
+            assert_equal {OK {Background append only file rewriting scheduled} OK} \
+                [$client exec]
+            # Crash while the rewrite is in progress, so that the INCR
+            # files written around the EXEC must be loaded on restart.
+            wait_for_condition 50 100 {
+                [status $client aof_rewrite_in_progress] eq 1
+            } else {
+                fail "The scheduled AOF rewrite was not started"
+            }
+            exec kill -9 [dict get $srv pid]
+        }
+    }
+
+    start_server_aof [list dir $server_path] {
+        test "Multi part AOF: a transaction is never split across INCR files" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            assert_equal {1 2} [list [$client get a] [$client get b]]
+        }
+    }
+
+    test "Multi part AOF: redis-check-aof checks the files of the manifest" {
+        set result [exec src/redis-check-aof $aof_path.manifest]
+        assert_match "*AOF manifest listing*" $result
+        assert_match "*AOF is valid*" $result
+        assert {![string match "*not valid*" $result]}
+    }
+
+    test "Multi part AOF: redis-check-aof only fixes the last file" {
+        set base [lindex [lindex [read_manifest $aof_path.manifest] 0] 1]
+        set fp [open $server_path/$base a]
+        puts -nonewline $fp [string range [formatCommand set c 3] 0 end-3]
+        close $fp
+        catch {exec src/redis-check-aof --fix $aof_path.manifest} result
+        assert_match "*AOF is not valid*" $result
+        assert_match "*Only the last file of the AOF can be fixed*" $result
+    }
+}
+
+proc file_head {path len} {
+    set fp [open $path r]
+    fconfigure $fp -translation binary
+    set head [read $fp $len]
+    close $fp
+    return $head
+}
+
+tags {"aof"} {
+    create_aof {
+        append_to_aof [formatCommand set foo hello]
+    }
+
+    start_server_aof [list dir $server_path aof-use-rdb-preamble yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+
+        test "RDB preamble: BGREWRITEAOF writes the base in the RDB format" {
+            $client rpush list a b c
+            $client hmset hash f1 v1 f2 v2
+            $client sadd set x y z
+            $client zadd zset 1 a 2 b
+            $client setex volatile 1000 value
+            $client bgrewriteaof
+            wait_aof_rewrite $client
+            set base [lindex [lindex [read_manifest $aof_path.manifest] 0] 1]
+            assert_equal REDIS [file_head $server_path/$base 5]
+        }
+
+        test "RDB preamble: the AOF is reloaded with the commands of the tail" {
+            $client set foo hello2
+            $client incr counter
+            set digest [$client debug digest]
+            $client debug loadaof
+            assert_equal $digest [$client debug digest]
+            assert_equal hello2 [$client get foo]
+        }
+
+        test "RDB preamble: redis-check-aof validates the preamble" {
+            set base [lindex [lindex [read_manifest $aof_path.manifest] 0] 1]
+            set result [exec src/redis-check-aof $server_path/$base]
+            assert_match "*RDB preamble is OK*" $result
+            assert_match "*AOF is valid*" $result
+        }
+    }
+
+    start_server_aof [list dir $server_path aof-use-rdb-preamble yes] {
+        test "RDB preamble: the dataset survives a restart" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            assert_equal $digest [$client debug digest]
+            assert_equal {a b c} [$client lrange list 0 -1]
+            assert {[$client ttl volatile] > 0}
+        }
+    }
+
+    ## A single file AOF made of an RDB preamble and a tail of commands.
+    set base [lindex [lindex [read_manifest $aof_path.manifest] 0] 1]
+    set preamble [file_head $server_path/$base [file size $server_path/$base]]
+    create_aof {
+        fconfigure $fp -translation binary
+        append_to_aof $preamble
+        append_to_aof [formatCommand set tail yes]
+    }
+
+    test "RDB preamble: redis-check-aof checks the tail after the preamble" {
+        set result [exec src/redis-check-aof $aof_path]
+        assert_match "*RDB preamble is OK*" $result
+        assert_match "*AOF is valid*" $result
+    }
+
+    start_server_aof [list dir $server_path] {
+        test "RDB preamble: a preamble and a tail are loaded from one file" {
+            set client [redis [dict get $srv host] [dict get $srv port]]
+            assert_equal {hello yes} [list [$client get foo] [$client get tail]]
+        }
+    }
+
+    start_server_aof [list dir $server_path aof-use-rdb-preamble yes] {
+        set client [redis [dict get $srv host] [dict get $srv port]]
+
+        test "RDB preamble: the preamble has no snapshot-id" {
+            # A previous save leaves the id of its snapshot behind.
+            $client bgsave
+            wait_for_condition 100 100 {
+                [status $client rdb_bgsave_in_progress] eq 0
+            } else {
+                fail "BGSAVE still in progress after too long time"
+            }
+            $client bgrewriteaof
+            wait_aof_rewrite $client
+            set base [lindex [lindex [read_manifest $aof_path.manifest] 0] 1]
+            set preamble [file_head $server_path/$base [file size $server_path/$base]]
+            assert {[string first snapshot-id $preamble] == -1}
+            assert {[string first redis-ver $preamble] != -1}
+        }
+    }
+}
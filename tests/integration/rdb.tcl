@@ -96,3 +96,269 @@ start_server_and_kill_it [list "dir" $server_path] {
         }
     }
 }
+
+start_server {} {
+    test {Same dataset digest loading with and without loading threads} {
+        r config set rdb-load-threads 0
+        createComplexDataset r 10000
+        r debug populate 5000
+        r config set hash-max-ziplist-entries 16
+        for {set j 0} {$j < 100} {incr j} {
+            r hset bighash field$j [string repeat x $j]
+            r rpush biglist [string repeat y [expr {$j*20}]]
+            r zadd bigzset [expr {$j/3.0}] member$j
+            r sadd bigset $j member$j
+        }
+        r zadd bigzset inf plusinf -inf minusinf
+        r hexpire bighash 1000 FIELDS 2 field1 field2
+        r set compressible [string repeat z 10000]
+        r xadd mystream * a 1
+        r bf.add mybloom foo
+        r ts.add myts 1000 1.5
+        set digest [r debug digest]
+        foreach threads {0 1 3 8} {
+            r config set rdb-load-threads $threads
+            r debug reload
+            assert_equal $digest [r debug digest]
+        }
+        assert {[lindex [r httl bighash FIELDS 1 field1] 0] > 0}
+    }
+
+    test {Loading threads keep big strings compressed} {
+        r flushall
+        r config set string-compress-threshold 1024
+        for {set j 0} {$j < 200} {incr j} {
+            r set compressed$j [string repeat "$j " 1000]
+        }
+        set digest [r debug digest]
+        r config set rdb-load-threads 4
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal 200 [s lzf_strings]
+        r config set string-compress-threshold 0
+    } {OK}
+
+    test {Same dataset digest saving with every compression codec} {
+        r flushall
+        createComplexDataset r 10000
+        for {set j 0} {$j < 100} {incr j} {
+            r set text$j [string repeat "value $j of many " [expr {$j*10}]]
+            r rpush textlist [string repeat "element $j " $j]
+        }
+        set digest [r debug digest]
+        set rdb [file join [lindex [r config get dir] 1] \
+                           [lindex [r config get dbfilename] 1]]
+        r config set rdbcompression no
+        r save
+        set plainsize [file size $rdb]
+        r config set rdbcompression yes
+        foreach codec {lz4 lz4hc lzf lz4} {
+            r config set rdbcompression-codec $codec
+            r debug reload
+            assert_equal $digest [r debug digest]
+            assert {[file size $rdb] < $plainsize}
+        }
+        r config set rdbcompression-codec lzf
+    } {OK}
+}
+
+set server_path [tmpdir "server.rdb-forkless-test"]
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {BGSAVE FORKLESS copies the keys modified while saving} {
+        r debug populate 30000
+        createComplexDataset r 1000
+        for {set j 0} {$j < 100} {incr j} {
+            r expire key:[expr {$j+25000}] 1000
+            r hmset hash$j a 1 b 2
+            r hexpire hash$j 1000 FIELDS 1 a
+            r xadd stream$j 1-1 a 1
+            r xadd stream$j 1-2 b 2
+            r xgroup create stream$j g 0
+            r xreadgroup group g c count 1 streams stream$j >
+        }
+        r select 10
+        r debug populate 1000 other
+        r select 9
+        set forkless_digest [r debug digest]
+
+        # Send the writes right after the BGSAVE, so that they are served
+        # while the keyspace is being saved.
+        set rd [redis_deferring_client]
+        $rd bgsave forkless
+        for {set j 0} {$j < 1000} {incr j} {
+            $rd del key:$j
+            $rd set new:$j $j
+            $rd append key:[expr {$j+10000}] x
+            $rd expire key:[expr {$j+20000}] 100
+        }
+        for {set j 0} {$j < 100} {incr j} {
+            $rd persist key:[expr {$j+25000}]
+            $rd hpersist hash$j FIELDS 1 a
+            $rd xack stream$j g 1-1
+            $rd xreadgroup group g c count 1 streams stream$j >
+        }
+        $rd select 10
+        $rd flushdb
+        for {set j 0} {$j < 4403} {incr j} {$rd read}
+        $rd close
+        waitForBgsave r
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert {[s rdb_forkless_cow_keys] > 0}
+        assert {[r debug digest] ne $forkless_digest}
+        file copy -force [file join $server_path dump.rdb] \
+                         [file join $server_path forkless.rdb]
+    }
+}
+
+start_server [list overrides [list "dir" $server_path "dbfilename" "forkless.rdb"]] {
+    test {BGSAVE FORKLESS saves the dataset as of the start of the save} {
+        r debug digest
+    } $forkless_digest
+}
+
+set server_path [tmpdir "server.child-info-test"]
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {Persistence children report their progress and copy-on-write} {
+        r debug populate 100000
+        r config set latency-monitor-threshold 1
+        r bgsave
+        assert_equal 100000 [s current_save_keys_total]
+        waitForBgsave r
+        assert_equal ok [s rdb_last_bgsave_status]
+        # Stats of the current child are reset when it exits.
+        assert_equal 0 [s current_save_keys_total]
+        assert_equal 0 [s current_cow_peak]
+        assert {[s rdb_last_cow_size] >= 0}
+
+        r bgrewriteaof
+        assert_equal 100000 [s current_save_keys_total]
+        waitForBgrewriteaof r
+        assert_equal 0 [s current_save_keys_total]
+        assert {[s aof_last_cow_size] >= 0}
+        r config set latency-monitor-threshold 0
+    } {OK}
+
+    test {Persistence children honor child-max-write-rate} {
+        r config set child-max-write-rate 1mb
+        r config set child-io-class idle
+        set start [clock milliseconds]
+        r bgsave
+        waitForBgsave r
+        set elapsed [expr {[clock milliseconds]-$start}]
+        set size [file size [file join $server_path dump.rdb]]
+        r config set child-max-write-rate 0
+        r config set child-io-class default
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert {$elapsed >= $size*1000/(1024*1024)-500}
+        assert {[s rdb_last_write_rate] > 0}
+        assert {[s rdb_last_write_rate] <= 1024*1024*1.1}
+    }
+}
+
+set server_path [tmpdir "server.rdb-delta-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-delta" "yes" "save" ""]] {
+    test {BGSAVE DELTA saves only the changes since the last save} {
+        r debug populate 1000
+        r select 1
+        r set other 1
+        r select 9
+        # The first save is a full one, there is no base yet.
+        assert_equal {Background saving started} [r bgsave delta]
+        waitForBgsave r
+        assert_equal 0 [s rdb_delta_chain_length]
+
+        r set key:1 changed
+        r del key:2
+        r hset newhash f v
+        r expire key:3 1000
+        r select 1
+        r flushdb
+        r set another 2
+        r select 9
+        assert_equal 5 [s rdb_delta_tracked_keys]
+        assert_equal {Background delta saving started} [r bgsave delta]
+        waitForBgsave r
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert_equal 1 [s rdb_delta_chain_length]
+
+        r incr counter
+        r del newhash
+        r bgsave delta
+        waitForBgsave r
+        assert_equal 2 [s rdb_delta_chain_length]
+        assert {[file size [file join $server_path dump.rdb.delta.2]] <
+                [file size [file join $server_path dump.rdb]]}
+        set delta_digest [r debug digest]
+    }
+}
+
+start_server [list overrides [list "dir" $server_path "rdb-delta" "yes" "save" ""]] {
+    test {Server applies the RDB deltas at startup} {
+        assert_equal $delta_digest [r debug digest]
+        assert_equal 2 [s rdb_delta_chain_length]
+        assert {[r ttl key:3] > 0}
+        r select 1
+        r keys *
+    } {another}
+
+    test {redis-check-rdb checks the RDB deltas chain} {
+        set out [exec src/redis-check-rdb [file join $server_path dump.rdb]]
+        assert_match {*2 RDB deltas in the chain*RDB looks OK*} $out
+    }
+
+    test {A full save removes the deltas of the previous RDB} {
+        r select 9
+        r set key:1 again
+        r bgsave
+        waitForBgsave r
+        assert_equal 0 [s rdb_delta_chain_length]
+        file exists [file join $server_path dump.rdb.delta.1]
+    } {0}
+}
+
+set server_path [tmpdir "server.rdb-delta-stream-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-delta" "yes" "save" ""]] {
+    test {BGSAVE DELTA saves the changes of stream consumer groups} {
+        r xadd mystream 1-1 a 1
+        r xadd mystream 1-2 b 2
+        r xadd mystream 1-3 c 3
+        r bgsave delta
+        waitForBgsave r
+
+        r xgroup create mystream g1 0
+        r xgroup create mystream g2 $
+        r xreadgroup group g1 alice count 2 streams mystream >
+        assert_equal 1 [s rdb_delta_tracked_keys]
+        r bgsave delta
+        waitForBgsave r
+        assert_equal 1 [s rdb_delta_chain_length]
+
+        # Commands that change nothing don't track the key.
+        r xack mystream g1 9-9
+        r xgroup delconsumer mystream g1 nobody
+        assert_equal 0 [s rdb_delta_tracked_keys]
+
+        r xack mystream g1 1-1
+        r xclaim mystream g1 bob 0 1-2
+        r xgroup delconsumer mystream g1 alice
+        r xgroup setid mystream g2 0
+        r xreadgroup group g2 carol count 1 streams mystream >
+        r bgsave delta
+        waitForBgsave r
+        assert_equal 2 [s rdb_delta_chain_length]
+        set delta_digest [r debug digest]
+    }
+}
+
+start_server [list overrides [list "dir" $server_path "rdb-delta" "yes" "save" ""]] {
+    test {Server applies the consumer groups of the RDB deltas at startup} {
+        assert_equal $delta_digest [r debug digest]
+        assert_equal 2 [llength [r xinfo groups mystream]]
+        assert_equal {1 1-2 1-2 {{bob 1}}} [r xpending mystream g1]
+        r xpending mystream g2
+    } {1 1-1 1-1 {{carol 1}}}
+}
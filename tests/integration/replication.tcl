@@ -266,3 +266,84 @@ foreach dl {no yes} {
         }
     }
 }
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    $master config set repl-forkless-sync yes
+    $master debug populate 50000
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    set load_handle0 [start_write_load $master_host $master_port 3]
+    set load_handle1 [start_write_load $master_host $master_port 5]
+    start_server {} {
+        set slave [srv 0 client]
+
+        test "Slave syncs from a forkless BGSAVE under write load" {
+            $slave slaveof $master_host $master_port
+            wait_for_condition 500 100 {
+                [lindex [$slave role] 3] eq {connected}
+            } else {
+                fail "Slave still not connected after some time"
+            }
+
+            stop_write_load $load_handle0
+            stop_write_load $load_handle1
+            wait_for_condition 500 100 {
+                [$master dbsize] == [$slave dbsize] &&
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave datasets differ after too long time"
+            }
+        }
+    }
+}
+
+foreach {dl load} {no on-empty-db yes on-empty-db no swapdb yes swapdb} {
+    start_server {tags {"repl"}} {
+        set master [srv 0 client]
+        $master config set repl-diskless-sync $dl
+        $master config set repl-diskless-sync-delay 0
+        $master debug populate 20000
+        $master hmset myhash f1 v1 f2 v2
+        $master rpush mylist a b c
+        set master_host [srv 0 host]
+        set master_port [srv 0 port]
+        start_server {} {
+            set slave [srv 0 client]
+            $slave config set repl-diskless-load $load
+            $slave set oldkey oldval
+            $slave select 5
+            $slave set oldkey5 oldval
+
+            test "Slave loads the dataset, diskless=$dl, load=$load" {
+                $slave slaveof $master_host $master_port
+                wait_for_condition 500 100 {
+                    [lindex [$slave role] 3] eq {connected}
+                } else {
+                    fail "Slave still not connected after some time"
+                }
+                $slave select 9
+                assert_equal [$master debug digest] [$slave debug digest]
+                assert_equal 0 [$slave exists oldkey]
+                $slave select 5
+                assert_equal 0 [$slave exists oldkey5]
+                $slave select 9
+                assert_match {*async_loading:0*} [$slave info persistence]
+            }
+
+            test "Slave loads the dataset again on full resync, diskless=$dl, load=$load" {
+                $master set newkey newval
+                $slave slaveof no one
+                $slave set slavekey 1
+                $slave slaveof $master_host $master_port
+                wait_for_condition 500 100 {
+                    [lindex [$slave role] 3] eq {connected} &&
+                    [$slave exists slavekey] == 0
+                } else {
+                    fail "Slave did not resync after some time"
+                }
+                assert_equal [$master debug digest] [$slave debug digest]
+            }
+        }
+    }
+}
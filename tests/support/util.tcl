@@ -91,6 +91,18 @@ proc wait_for_sync r {
     }
 }
 
+# Return a random permutation of the list.
+proc lshuffle {list} {
+    set n [llength $list]
+    while {$n>0} {
+        set j [expr {int(rand()*$n)}]
+        lappend slist [lindex $list $j]
+        set list [lreplace $list $j $j]
+        incr n -1
+    }
+    return $slist
+}
+
 # Random integer between 0 and max (excluded).
 proc randomInt {max} {
     expr {int(rand()*$max)}
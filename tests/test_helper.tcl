@@ -26,6 +26,14 @@ set ::all_tests {
     unit/type/set
     unit/type/zset
     unit/type/hash
+    unit/type/hash-field-expire
+    unit/type/stream
+    unit/type/stream-cgroups
+    unit/type/bloom
+    unit/type/cuckoo
+    unit/type/cms
+    unit/type/topk
+    unit/type/timeseries
     unit/sort
     unit/expire
     unit/other
@@ -65,15 +65,19 @@ start_server {tags {"aofrw"}} {
     test {Turning off AOF kills the background writing child if any} {
         r config set appendonly yes
         waitForBgrewriteaof r
-        r multi
+        # A BGREWRITEAOF inside MULTI is only scheduled: start a slow
+        # rewrite instead, and turn off AOF while it is running.
+        r debug populate 20000
+        r config set child-max-write-rate 100kb
         r bgrewriteaof
         r config set appendonly no
-        r exec
         wait_for_condition 50 100 {
             [string match {*Killing*AOF*child*} [exec tail -n5 < [srv 0 stdout]]]
         } else {
             fail "Can't find 'Killing AOF child' into recent logs"
         }
+        r config set child-max-write-rate 0
+        r flushall
     }
 
     foreach d {string int} {
@@ -182,6 +186,26 @@ start_server {tags {"aofrw"}} {
         }
     }
 
+    test "AOF rewrite of string with roaring encoding" {
+        r flushall
+        r config set bitmap-roaring-min-bytes 1024
+        for {set j 0} {$j < 1000} {incr j} {
+            r setbit key [randomInt 100000000] 1
+        }
+        r setbit key 200000000 0
+        assert_encoding roaring key
+        set d1 [r debug digest]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        set d2 [r debug digest]
+        assert_encoding roaring key
+        r config set bitmap-roaring-min-bytes 0
+        if {$d1 ne $d2} {
+            error "assertion:$d1 is not equal to $d2"
+        }
+    }
+
     test {BGREWRITEAOF is delayed if BGSAVE is in progress} {
         r multi
         r bgsave
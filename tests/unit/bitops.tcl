@@ -182,6 +182,25 @@ start_server {tags {"bitops"}} {
         }
     }
 
+    foreach op {and or xor} {
+        test "BITOP $op fuzzing with many long keys" {
+            for {set i 0} {$i < 3} {incr i} {
+                r flushall
+                set vec {}
+                set veckeys {}
+                set numvec [expr {[randomInt 10]+12}]
+                for {set j 0} {$j < $numvec} {incr j} {
+                    set str [randstring 1000 1500]
+                    lappend vec $str
+                    lappend veckeys vector_$j
+                    r set vector_$j $str
+                }
+                r bitop $op target {*}$veckeys
+                assert_equal [r get target] [simulate_bit_op $op {*}$vec]
+            }
+        }
+    }
+
     test {BITOP NOT fuzzing} {
         for {set i 0} {$i < 10} {incr i} {
             r flushall
@@ -284,6 +303,19 @@ start_server {tags {"bitops"}} {
         assert {[r bitpos str 1 8] == 216}
     }
 
+    test {BITPOS against long runs of 0 and 1 bits} {
+        for {set j 0} {$j < 50} {incr j} {
+            set len [expr {[randomInt 5000]+1}]
+            set pos [randomInt [expr {$len*8}]]
+            r set str [string repeat "\x00" $len]
+            r setbit str $pos 1
+            assert {[r bitpos str 1] == $pos}
+            r set str [string repeat "\xff" $len]
+            r setbit str $pos 0
+            assert {[r bitpos str 0] == $pos}
+        }
+    }
+
     test {BITPOS bit=1 returns -1 if string is all 0 bits} {
         r set str ""
         for {set j 0} {$j < 20} {incr j} {
@@ -349,3 +381,147 @@ start_server {tags {"bitops"}} {
         }
     }
 }
+
+start_server {tags {"bitops"}} {
+    r config set bitmap-roaring-min-bytes 1024
+
+    test {SETBIT at a large offset creates a roaring bitmap} {
+        r del bitmap
+        r setbit bitmap 4000000000 1
+        r setbit bitmap 100 1
+        assert_encoding roaring bitmap
+        assert_equal 500000001 [r strlen bitmap]
+        list [r getbit bitmap 100] [r getbit bitmap 4000000000] \
+             [r getbit bitmap 101] [r bitcount bitmap] [r bitpos bitmap 1] \
+             [r bitpos bitmap 0] [r getrange bitmap 12 12]
+    } [list 1 1 0 2 100 0 "\x08"]
+
+    test {Small bitmaps are not stored as roaring bitmaps} {
+        r del bitmap
+        r setbit bitmap 100 1
+        assert_encoding raw bitmap
+    }
+
+    test {Sparse strings grown by SETBIT are converted to roaring bitmaps} {
+        r del bitmap
+        r set bitmap "\xff"
+        r setbit bitmap 1000000 1
+        assert_encoding roaring bitmap
+        list [r bitcount bitmap] [r getrange bitmap 0 0]
+    } [list 9 "\xff"]
+
+    test {Roaring bitmaps and plain strings give the same results} {
+        for {set i 0} {$i < 5} {incr i} {
+            r del roaring plain
+            r config set bitmap-roaring-min-bytes 0
+            r setbit plain 300000 0
+            r config set bitmap-roaring-min-bytes 1024
+            r setbit roaring 300000 0
+            # Sparse bits everywhere and a dense region.
+            for {set j 0} {$j < 500} {incr j} {
+                set bit [randomInt 300000]
+                r setbit plain $bit 1
+                r setbit roaring $bit 1
+            }
+            for {set j 0} {$j < 5000} {incr j} {
+                set bit [expr {131072+[randomInt 10000]}]
+                r setbit plain $bit 1
+                r setbit roaring $bit 1
+            }
+            assert_encoding raw plain
+            assert_encoding roaring roaring
+            assert_equal [r get plain] [r get roaring]
+            assert_equal [r bitcount plain] [r bitcount roaring]
+            for {set j 0} {$j < 100} {incr j} {
+                set start [expr {[randomInt 40000]-1000}]
+                set end [expr {[randomInt 40000]-1000}]
+                assert_equal [r bitcount plain $start $end] \
+                             [r bitcount roaring $start $end]
+                foreach bit {0 1} {
+                    assert_equal [r bitpos plain $bit $start] \
+                                 [r bitpos roaring $bit $start]
+                    assert_equal [r bitpos plain $bit $start $end] \
+                                 [r bitpos roaring $bit $start $end]
+                }
+                assert_equal [r getrange plain $start $end] \
+                             [r getrange roaring $start $end]
+            }
+        }
+    }
+
+    test {BITOP against roaring bitmaps} {
+        r del a b c ra rb rc
+        r config set bitmap-roaring-min-bytes 0
+        r setbit a 400000 0
+        r setbit b 200000 0
+        r config set bitmap-roaring-min-bytes 1024
+        r setbit ra 400000 0
+        r setbit rb 200000 0
+        for {set j 0} {$j < 2000} {incr j} {
+            set bit [randomInt 200000]
+            r setbit a $bit 1
+            r setbit ra $bit 1
+            set bit [randomInt 200000]
+            r setbit b $bit 1
+            r setbit rb $bit 1
+        }
+        foreach op {and or xor} {
+            r bitop $op dest a b missing
+            r bitop $op rdest ra rb missing
+            assert_encoding roaring rdest
+            assert_equal [r get dest] [r get rdest]
+        }
+        r bitop not dest a
+        r bitop not rdest ra
+        assert_equal [r get dest] [r get rdest]
+        r bitop and dest a rb
+        r bitop and rdest ra rb
+        assert_equal [r get dest] [r get rdest]
+    }
+
+    test {Dense roaring bitmaps are converted to plain strings} {
+        r del bitmap
+        r setbit bitmap 20000 1
+        assert_encoding roaring bitmap
+        for {set j 0} {$j < 20000} {incr j 3} {
+            r setbit bitmap $j 1
+        }
+        assert_encoding raw bitmap
+        r bitcount bitmap
+    } {6668}
+
+    test {Byte level commands convert roaring bitmaps to plain strings} {
+        r del bitmap
+        r setbit bitmap 100000 1
+        r append bitmap "x"
+        assert_encoding raw bitmap
+        list [r strlen bitmap] [r getbit bitmap 100000] [r getrange bitmap -1 -1]
+    } {12502 1 x}
+
+    test {BITFIELD GET does not convert roaring bitmaps} {
+        r del bitmap
+        r setbit bitmap 100000 1
+        r setbit bitmap 7 1
+        set res [r bitfield bitmap get u8 0 get u8 100000]
+        assert_encoding roaring bitmap
+        set res
+    } {1 128}
+
+    test {Roaring bitmaps survive DEBUG RELOAD and DUMP/RESTORE} {
+        r del bitmap
+        for {set j 0} {$j < 1000} {incr j} {
+            r setbit bitmap [randomInt 10000000] 1
+        }
+        set digest [r debug digest]
+        r debug reload
+        assert_encoding roaring bitmap
+        assert_equal $digest [r debug digest]
+        set dump [r dump bitmap]
+        r del bitmap
+        r restore bitmap 0 $dump
+        assert_encoding roaring bitmap
+        assert_equal $digest [r debug digest]
+    }
+
+    r config set bitmap-roaring-min-bytes 0
+}
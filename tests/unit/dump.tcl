@@ -53,6 +53,15 @@ start_server {tags {"dump"}} {
         r dump nonexisting_key
     } {}
 
+    test {DUMP of a stream uses RDB version 8} {
+        r del mystream
+        r xadd mystream * field value
+        set encoded [r dump mystream]
+        binary scan [string range $encoded end-9 end-8] s rdbver
+        scan [string index $encoded 0] %c rdbtype
+        list $rdbtype $rdbver
+    } {65 8}
+
     test {MIGRATE is caching connections} {
         # Note, we run this as first test so that the connection cache
         # is empty.
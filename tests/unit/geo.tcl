@@ -220,6 +220,89 @@ start_server {tags {"geo"}} {
         assert {[lindex $res 0] eq "Catania"}
     }
 
+    test {GEOSEARCH FROMLONLAT and FROMMEMBER BYRADIUS match GEORADIUS} {
+        r del points
+        r geoadd points 13.361389 38.115556 "Palermo" \
+                        15.087269 37.502669 "Catania" \
+                        12.758489 38.788135 "edge1" \
+                        17.241510 38.788135 "edge2"
+        assert_equal [r georadius points 15 37 200 km asc] \
+                     [r geosearch points fromlonlat 15 37 byradius 200 km asc]
+        assert_equal [r georadiusbymember points Palermo 200 km withdist asc] \
+                     [r geosearch points frommember Palermo byradius 200 km withdist asc]
+    }
+
+    test {GEOSEARCH BYBOX} {
+        r del points
+        r geoadd points 13.361389 38.115556 "Palermo" \
+                        15.087269 37.502669 "Catania" \
+                        12.758489 38.788135 "edge1" \
+                        17.241510 38.788135 "edge2"
+        assert_equal [lsort [r geosearch points fromlonlat 15 37 bybox 400 400 km]] \
+                     {Catania Palermo edge1 edge2}
+        assert_equal [r geosearch points fromlonlat 15 37 bybox 200 200 km asc] \
+                     {Catania}
+        assert_equal [r geosearch points frommember Catania bybox 100 100 km] \
+                     {Catania}
+    }
+
+    test {GEOSEARCH with COUNT returns the nearest elements} {
+        r del points
+        for {set j 0} {$j < 100} {incr j} {
+            r geoadd points [expr {13+$j*0.01}] 38 "p:$j"
+        }
+        assert_equal [r geosearch points fromlonlat 13 38 byradius 500 km count 3] \
+                     {p:0 p:1 p:2}
+        assert_equal [r geosearch points fromlonlat 13 38 byradius 500 km count 3 desc] \
+                     {p:99 p:98 p:97}
+        assert_equal [r geosearch points fromlonlat 13.5 38 bybox 500 500 km count 1] \
+                     {p:50}
+    }
+
+    test {GEOSEARCH and GEORADIUS with COUNT ANY stop at COUNT matches} {
+        set res [r geosearch points fromlonlat 13 38 byradius 500 km count 5 any]
+        assert_equal 5 [llength $res]
+        set res [r georadius points 13 38 500 km count 5 any asc]
+        assert_equal 5 [llength $res]
+        foreach p $res {
+            assert {[lsearch -exact [r georadius points 13 38 500 km] $p] != -1}
+        }
+        catch {r geosearch points fromlonlat 13 38 byradius 500 km any} e
+        set e
+    } {*ANY*requires COUNT*}
+
+    test {GEOSEARCH invalid arguments} {
+        catch {r geosearch points byradius 500 km asc withdist} e
+        assert_match {*FROMMEMBER or FROMLONLAT*} $e
+        catch {r geosearch points fromlonlat 13 38 count 1} e
+        assert_match {*BYRADIUS and BYBOX*} $e
+        catch {r geosearch points fromlonlat 13 38 frommember p:1 byradius 5 km} e
+        assert_match {*syntax*} $e
+        catch {r geosearch points fromlonlat 13 38 byradius 5 km bybox 1 1 km} e
+        assert_match {*syntax*} $e
+        catch {r geosearch points fromlonlat 13 38 byradius 5 km store dst} e
+        assert_match {*syntax*} $e
+        catch {r geosearch points fromlonlat 13 38 bybox -1 1 km} e
+        assert_match {*negative*} $e
+        r geosearch nokey fromlonlat 13 38 byradius 5 km
+    } {}
+
+    test {GEOSEARCHSTORE and STOREDIST} {
+        r del points dst
+        r geoadd points 13.361389 38.115556 "Palermo" \
+                        15.087269 37.502669 "Catania"
+        assert_equal 2 [r geosearchstore dst points fromlonlat 13.361389 38.115556 byradius 500 km]
+        assert_equal [r zrange points 0 -1 withscores] [r zrange dst 0 -1 withscores]
+        assert_equal 1 [r geosearchstore dst points frommember Palermo bybox 500 500 km desc count 1 storedist]
+        set res [r zrange dst 0 -1 withscores]
+        assert_equal Catania [lindex $res 0]
+        assert {[lindex $res 1] > 166 && [lindex $res 1] < 167}
+        catch {r geosearchstore dst points frommember Palermo byradius 5 km withdist} e
+        assert_match {*not compatible*} $e
+        assert_equal 0 [r geosearchstore dst nokey frommember Palermo byradius 5 km]
+        r exists dst
+    } {0}
+
     test {GEOADD + GEORANGE randomized test} {
         set attempt 30
         while {[incr attempt -1]} {
@@ -304,4 +387,59 @@ start_server {tags {"geo"}} {
         }
         set test_result
     } {OK}
+
+    test {GEOADD + GEOSEARCH BYBOX randomized test} {
+        set attempt 20
+        while {[incr attempt -1]} {
+            unset -nocomplain debuginfo
+            set srand_seed [clock milliseconds]
+            lappend debuginfo "srand_seed is $srand_seed"
+            expr {srand($srand_seed)} ; # If you need a reproducible run
+            r del mypoints
+
+            if {[randomInt 10] == 0} {
+                # From time to time use very big boxes
+                set width_km [expr {[randomInt 30000]+10}]
+                set height_km [expr {[randomInt 10000]+10}]
+            } else {
+                set width_km [expr {[randomInt 400]+10}]
+                set height_km [expr {[randomInt 400]+10}]
+            }
+            geo_random_point search_lon search_lat
+            lappend debuginfo "Search area: $search_lon,$search_lat $width_km x $height_km km"
+            set tcl_result {}
+            set argv {}
+            for {set j 0} {$j < 20000} {incr j} {
+                geo_random_point lon lat
+                lappend argv $lon $lat "place:$j"
+                set dx [geo_distance $search_lon $lat $lon $lat]
+                set dy [geo_distance $search_lon $search_lat $search_lon $lat]
+                if {$dx <= $width_km*500 && $dy <= $height_km*500} {
+                    lappend tcl_result "place:$j"
+                }
+            }
+            r geoadd mypoints {*}$argv
+            set res [lsort [r geosearch mypoints fromlonlat $search_lon $search_lat bybox $width_km $height_km km]]
+            set res2 [lsort $tcl_result]
+            set test_result OK
+
+            # Ignore the differences due to rounding, that is, the points
+            # that are almost on the border of the box.
+            foreach place [compare_lists $res $res2] {
+                lassign [lindex [r geopos mypoints $place] 0] lon lat
+                set dx [geo_distance $search_lon $lat $lon $lat]
+                set dy [geo_distance $search_lon $search_lat $search_lon $lat]
+                if {abs($dx/($width_km*500)-1) > 0.001 &&
+                    abs($dy/($height_km*500)-1) > 0.001} {
+                    puts "*** Possible problem in GEO box query ***"
+                    puts "$place -> $lon $lat"
+                    puts [join $debuginfo "\n"]
+                    set test_result FAIL
+                }
+            }
+            unset -nocomplain debuginfo
+            if {$test_result ne {OK}} break
+        }
+        set test_result
+    } {OK}
 }
@@ -172,6 +172,25 @@ start_server {tags {"hll"}} {
         llength [r pfdebug getreg hll]
     } {16384}
 
+    test {PFMERGE registers are the max of the sparse and dense sources} {
+        r del hll hll1 hll2 hll3
+        for {set x 0} {$x < 100} {incr x} {r pfadd hll1 "a-$x"}
+        for {set x 0} {$x < 5000} {incr x} {r pfadd hll2 "b-$x"}
+        for {set x 0} {$x < 5000} {incr x} {r pfadd hll3 "c-$x"}
+        r pfdebug todense hll3
+        assert {[r pfdebug encoding hll1] eq {sparse}}
+        r pfmerge hll hll1 hll2 hll3
+        set card [r pfcount hll1 hll2 hll3]
+        # PFDEBUG GETREG converts the sources to dense, so call it last.
+        set expected {}
+        foreach a [r pfdebug getreg hll1] b [r pfdebug getreg hll2] \
+                c [r pfdebug getreg hll3] {
+            lappend expected [expr {max($a,$b,$c)}]
+        }
+        assert_equal $expected [r pfdebug getreg hll]
+        assert_equal $card [r pfcount hll]
+    }
+
     test {PFADD / PFCOUNT cache invalidation works} {
         r del hll
         r pfadd hll a b c
@@ -182,4 +201,74 @@ start_server {tags {"hll"}} {
         r pfadd hll 1 2 3
         assert {[r getrange hll 15 15] eq "\x80"}
     }
+
+    test {PFCOUNT multiple-keys results are cached} {
+        r flushdb
+        r config resetstat
+        r pfadd hll1 a b c
+        r pfadd hll2 c d e
+        assert_equal 5 [r pfcount hll1 hll2]
+        assert_equal 5 [r pfcount hll2 hll1 hll2]
+        assert_equal 5 [r pfcount hll1 hll2]
+        assert_equal 1 [s pfcount_cache_entries]
+        assert_equal 1 [s pfcount_cache_misses]
+        assert_equal 2 [s pfcount_cache_hits]
+    }
+
+    test {PFCOUNT cache is invalidated when an input key changes} {
+        r pfadd hll1 f
+        assert_equal 6 [r pfcount hll1 hll2]
+        r pfmerge hll2 hll2 hll1
+        r pfadd hll2 g
+        assert_equal 7 [r pfcount hll1 hll2]
+        r del hll2
+        assert_equal 4 [r pfcount hll1 hll2]
+        # A missing key is an empty HLL, until it is created.
+        r pfadd hll2 x y
+        assert_equal 6 [r pfcount hll1 hll2]
+        r rename hll1 hll3
+        assert_equal 2 [r pfcount hll1 hll2]
+        r set hll1 foo
+        catch {r pfcount hll1 hll2} e
+        set e
+    } {*WRONGTYPE*}
+
+    test {PFCOUNT cache is invalidated by expires and flushes} {
+        r flushdb
+        r pfadd hll1 a b c
+        r pfadd hll2 c d e
+        r pexpire hll2 100
+        assert_equal 5 [r pfcount hll1 hll2]
+        after 150
+        assert_equal 3 [r pfcount hll1 hll2]
+        r select 10
+        r flushall
+        r select 9
+        assert_equal 0 [s pfcount_cache_entries]
+        assert_equal 0 [r pfcount hll1 hll2]
+        # The cache is per DB.
+        r pfadd hll1 a
+        assert_equal 1 [r pfcount hll1 hll2]
+        r select 10
+        assert_equal 0 [r pfcount hll1 hll2]
+        r select 9
+        set _ [r pfcount hll1 hll2]
+    } {1}
+
+    test {PFCOUNT cache memory is bounded} {
+        r flushdb
+        r config set pfcount-cache-max-memory 4000
+        for {set j 0} {$j < 100} {incr j} {
+            r pfadd hll$j $j
+            r pfcount hll$j hll[expr {$j+1}] hll[expr {$j+2}]
+            assert {[s pfcount_cache_memory] <= 4000}
+        }
+        assert {[s pfcount_cache_entries] > 0}
+        assert {[s pfcount_cache_entries] < 100}
+        r config set pfcount-cache-max-memory 0
+        assert_equal 0 [s pfcount_cache_entries]
+        assert_equal 2 [r pfcount hll0 hll1]
+        assert_equal 0 [s pfcount_cache_entries]
+        r config set pfcount-cache-max-memory 1mb
+    } {OK}
 }
@@ -263,6 +263,34 @@ start_server {
         r lrange testb 0 -1
     } {5 3 4}
 
+    test "SORT LIMIT returns the same elements of a full SORT" {
+        r del tosort
+        for {set i 0} {$i < 2000} {incr i} {
+            r rpush tosort [expr {int(rand()*500)}]
+            r set w_$i [expr {int(rand()*100)}]
+        }
+        foreach opts {{} {desc} {alpha} {alpha desc}
+                      {by w_*} {by w_* desc} {by w_* alpha}} {
+            set full [r sort tosort {*}$opts]
+            foreach {start count} {0 1 0 20 0 1999 5 10 1990 20} {
+                set res [r sort tosort {*}$opts limit $start $count]
+                assert_equal [lrange $full $start [expr {$start+$count-1}]] $res
+            }
+        }
+    }
+
+    test "SORT BY key with GET of the same pattern" {
+        r del tosort
+        r rpush tosort 1 2 3 4
+        r mset wkey_1 40 wkey_2 10 wkey_3 30
+        assert_equal {4 {} 2 10 3 30 1 40} \
+            [r sort tosort by wkey_* get # get wkey_*]
+        assert_equal {2 10 3 30} \
+            [r sort tosort by wkey_* get # get wkey_* limit 1 2]
+        r sort tosort by wkey_* alpha get wkey_* store sort-res
+        r lrange sort-res 0 -1
+    } {{} 10 30 40}
+
     tags {"slow"} {
         set num 100
         set res [create_random_dataset $num lpush]
@@ -0,0 +1,115 @@
+start_server {tags {"bloom"}} {
+    test {BF.ADD creates a filter and reports new items} {
+        r del bf
+        assert_equal 1 [r bf.add bf foo]
+        assert_equal 0 [r bf.add bf foo]
+        assert_equal 1 [r bf.exists bf foo]
+        assert_equal 0 [r bf.exists bf bar]
+        assert_equal {bloom blockedbloom} [list [r type bf] [r object encoding bf]]
+    }
+
+    test {BF.EXISTS against a missing key} {
+        r del bf
+        assert_equal 0 [r bf.exists bf foo]
+        assert_equal {0 0} [r bf.mexists bf foo bar]
+    }
+
+    test {BF.MADD and BF.MEXISTS} {
+        r del bf
+        assert_equal {1 1 0 1} [r bf.madd bf a b a c]
+        assert_equal {1 0 1 1} [r bf.mexists bf a d b c]
+        assert_equal 3 [dict get [r bf.info bf] {Number of items inserted}]
+    }
+
+    test {BF.RESERVE argument validation} {
+        r del bf
+        assert_error {*error rate*} {r bf.reserve bf 0 100}
+        assert_error {*error rate*} {r bf.reserve bf 1 100}
+        assert_error {*capacity*} {r bf.reserve bf 0.01 0}
+        assert_error {*EXPANSION*} {r bf.reserve bf 0.01 100 EXPANSION 0}
+        assert_error {*syntax*} {r bf.reserve bf 0.01 100 FOO}
+        r bf.reserve bf 0.01 100
+        assert_error {*item exists*} {r bf.reserve bf 0.01 100}
+    }
+
+    test {BF commands against the wrong type} {
+        r del bf
+        r set bf foo
+        assert_error {WRONGTYPE*} {r bf.add bf foo}
+        assert_error {WRONGTYPE*} {r bf.exists bf foo}
+        assert_error {WRONGTYPE*} {r bf.info bf}
+    }
+
+    test {BF.INFO reports the reserved parameters} {
+        r del bf
+        assert_error {*no such key*} {r bf.info bf}
+        r bf.reserve bf 0.001 1000 EXPANSION 4
+        set info [r bf.info bf]
+        assert_equal 1000 [dict get $info Capacity]
+        assert_equal 1 [dict get $info {Number of filters}]
+        assert_equal 4 [dict get $info {Expansion rate}]
+        assert {[dict get $info Size] > 1000}
+    }
+
+    test {Scalable filter has no false negatives and a bounded error} {
+        r del bf
+        r bf.reserve bf 0.01 100
+        for {set j 0} {$j < 5000} {incr j} {
+            r bf.add bf item:$j
+        }
+        set info [r bf.info bf]
+        assert {[dict get $info {Number of filters}] > 1}
+        assert {[dict get $info Capacity] >= 5000}
+        for {set j 0} {$j < 5000} {incr j} {
+            assert_equal 1 [r bf.exists bf item:$j]
+        }
+        set fp 0
+        for {set j 0} {$j < 5000} {incr j} {
+            incr fp [r bf.exists bf other:$j]
+        }
+        assert {$fp < 5000*0.03}
+    }
+
+    test {NONSCALING filter refuses new items once full} {
+        r del bf
+        r bf.reserve bf 0.01 100 NONSCALING
+        set err {}
+        for {set j 0} {$j < 1000} {incr j} {
+            if {[catch {r bf.add bf item:$j} err]} break
+        }
+        assert_match {*filter is full*} $err
+        assert_equal 1 [dict get [r bf.info bf] {Number of filters}]
+    }
+
+    test {Bloom filters survive DEBUG RELOAD and DUMP / RESTORE} {
+        r del bf
+        r bf.reserve bf 0.01 50 EXPANSION 3
+        for {set j 0} {$j < 500} {incr j} {
+            r bf.add bf item:$j
+        }
+        set digest [r debug digest]
+        set info [r bf.info bf]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $info [r bf.info bf]
+        set dump [r dump bf]
+        r del bf
+        r restore bf 0 $dump
+        assert_equal $digest [r debug digest]
+    }
+}
+
+start_server {tags {"bloom"} overrides {appendonly yes}} {
+    test {Bloom filters are rebuilt by the AOF rewrite} {
+        r bf.reserve bf 0.01 100
+        for {set j 0} {$j < 300} {incr j} {
+            r bf.add bf item:$j
+        }
+        set digest [r debug digest]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+        assert_equal 1 [r bf.exists bf item:299]
+    }
+}
@@ -0,0 +1,132 @@
+start_server {tags {"cms"}} {
+    test {CMS.INITBYDIM creates an empty sketch} {
+        r del cms
+        r cms.initbydim cms 1000 5
+        assert_equal {cms countminsketch} [list [r type cms] [r object encoding cms]]
+        assert_equal {width 1000 depth 5 count 0} [r cms.info cms]
+        assert_equal {0 0} [r cms.query cms foo bar]
+    }
+
+    test {CMS.INITBYPROB sizes the sketch from the error bounds} {
+        r del cms
+        r cms.initbyprob cms 0.001 0.01
+        assert_equal {width 2000 depth 7 count 0} [r cms.info cms]
+    }
+
+    test {CMS.INITBYDIM / CMS.INITBYPROB argument validation} {
+        r del cms
+        assert_error {*value must be*} {r cms.initbydim cms 0 5}
+        assert_error {*value must be*} {r cms.initbydim cms 10 -1}
+        assert_error {*too large*} {r cms.initbydim cms 4294967295 4294967295}
+        assert_error {*between 0 and 1*} {r cms.initbyprob cms 0 0.1}
+        assert_error {*between 0 and 1*} {r cms.initbyprob cms 0.1 1}
+        r cms.initbydim cms 10 2
+        assert_error {*item exists*} {r cms.initbydim cms 10 2}
+    }
+
+    test {CMS.INCRBY and CMS.QUERY} {
+        r del cms
+        assert_error {*no such key*} {r cms.incrby cms foo 1}
+        r cms.initbydim cms 1000 5
+        assert_equal {3 1} [r cms.incrby cms foo 3 bar 1]
+        assert_equal {5} [r cms.incrby cms foo 2]
+        assert_equal {5 1 0} [r cms.query cms foo bar baz]
+        assert_equal 6 [dict get [r cms.info cms] count]
+        assert_error {*syntax*} {r cms.incrby cms foo 1 bar}
+        assert_error {*value must be*} {r cms.incrby cms foo -1}
+        assert_equal {5} [r cms.query cms foo]
+    }
+
+    test {CMS estimates never undercount} {
+        r del cms
+        r cms.initbydim cms 200 4
+        for {set j 0} {$j < 1000} {incr j} {
+            r cms.incrby cms item:[expr {$j % 100}] 1
+        }
+        set excess 0
+        for {set j 0} {$j < 100} {incr j} {
+            set est [r cms.query cms item:$j]
+            assert {$est >= 10}
+            incr excess [expr {$est - 10}]
+        }
+        assert {$excess < 100*10}
+    }
+
+    test {CMS.MERGE sums the sketches with optional weights} {
+        r del a b c cms
+        r cms.initbydim a 1000 5
+        r cms.initbydim b 1000 5
+        r cms.initbydim c 1000 5
+        r cms.incrby a foo 3 bar 1
+        r cms.incrby b foo 2 baz 7
+        r cms.merge c 2 a b
+        assert_equal {5 1 7} [r cms.query c foo bar baz]
+        assert_equal 13 [dict get [r cms.info c] count]
+        r cms.merge c 2 a b WEIGHTS 2 3
+        assert_equal {12 2 21} [r cms.query c foo bar baz]
+        r cms.merge a 2 a b
+        assert_equal {5 1 7} [r cms.query a foo bar baz]
+    }
+
+    test {CMS.MERGE errors} {
+        r del a b c
+        r cms.initbydim a 1000 5
+        r cms.initbydim b 100 5
+        assert_error {*no such key*} {r cms.merge c 1 a}
+        r cms.initbydim c 1000 5
+        assert_error {*no such key*} {r cms.merge c 2 a d}
+        assert_error {*same width and depth*} {r cms.merge c 2 a b}
+        assert_error {*at least 1*} {r cms.merge c 0 a}
+        assert_error {*syntax*} {r cms.merge c 3 a b}
+        assert_error {*syntax*} {r cms.merge c 1 a WEIGHTS 1 2}
+        r set s foo
+        assert_error {WRONGTYPE*} {r cms.merge c 1 s}
+    }
+
+    test {CMS.MERGE refuses to overflow the counters} {
+        r del a c
+        r cms.initbydim a 10 2
+        r cms.initbydim c 10 2
+        r cms.incrby a foo 4294967295
+        assert_error {*overflow*} {r cms.merge c 2 a a}
+        assert_equal 0 [r cms.query c foo]
+    }
+
+    test {CMS commands against the wrong type} {
+        r del cms
+        r set cms foo
+        assert_error {WRONGTYPE*} {r cms.incrby cms foo 1}
+        assert_error {WRONGTYPE*} {r cms.query cms foo}
+        assert_error {WRONGTYPE*} {r cms.info cms}
+    }
+
+    test {Sketches survive DEBUG RELOAD and DUMP / RESTORE} {
+        r del cms
+        r cms.initbydim cms 500 4
+        for {set j 0} {$j < 300} {incr j} {
+            r cms.incrby cms item:[expr {$j % 37}] $j
+        }
+        set digest [r debug digest]
+        set info [r cms.info cms]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $info [r cms.info cms]
+        set dump [r dump cms]
+        r del cms
+        r restore cms 0 $dump
+        assert_equal $digest [r debug digest]
+    }
+}
+
+start_server {tags {"cms"} overrides {appendonly yes}} {
+    test {Sketches are rebuilt by the AOF rewrite} {
+        r cms.initbydim cms 100 3
+        r cms.incrby cms foo 10 bar 20
+        set digest [r debug digest]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+        assert_equal {10 20} [r cms.query cms foo bar]
+    }
+}
@@ -0,0 +1,139 @@
+start_server {tags {"cuckoo"}} {
+    test {CF.ADD creates a filter and CF.EXISTS finds the items} {
+        r del cf
+        assert_equal 1 [r cf.add cf foo]
+        assert_equal 1 [r cf.exists cf foo]
+        assert_equal 0 [r cf.exists cf bar]
+        assert_equal {1 0} [r cf.mexists cf foo bar]
+        assert_equal {cuckoo cuckoo} [list [r type cf] [r object encoding cf]]
+    }
+
+    test {CF.ADDNX only adds missing items} {
+        r del cf
+        assert_equal 1 [r cf.addnx cf foo]
+        assert_equal 0 [r cf.addnx cf foo]
+        assert_equal 1 [r cf.count cf foo]
+    }
+
+    test {CF.COUNT and CF.DEL with items added multiple times} {
+        r del cf
+        r cf.add cf foo
+        r cf.add cf foo
+        r cf.add cf foo
+        assert_equal 3 [r cf.count cf foo]
+        assert_equal 1 [r cf.del cf foo]
+        assert_equal 2 [r cf.count cf foo]
+        r cf.del cf foo
+        r cf.del cf foo
+        assert_equal 0 [r cf.del cf foo]
+        assert_equal 0 [r cf.exists cf foo]
+        set info [r cf.info cf]
+        assert_equal 0 [dict get $info {Number of items inserted}]
+        assert_equal 3 [dict get $info {Number of items deleted}]
+    }
+
+    test {CF commands against missing keys and the wrong type} {
+        r del cf
+        assert_equal 0 [r cf.exists cf foo]
+        assert_equal 0 [r cf.count cf foo]
+        assert_error {*no such key*} {r cf.del cf foo}
+        assert_error {*no such key*} {r cf.info cf}
+        r set cf foo
+        assert_error {WRONGTYPE*} {r cf.add cf foo}
+        assert_error {WRONGTYPE*} {r cf.exists cf foo}
+        r del cf
+        r bf.add cf foo
+        assert_error {WRONGTYPE*} {r cf.count cf foo}
+    }
+
+    test {CF.RESERVE argument validation} {
+        r del cf
+        assert_error {*capacity*} {r cf.reserve cf 0}
+        assert_error {*MAXITERATIONS*} {r cf.reserve cf 100 MAXITERATIONS 0}
+        assert_error {*syntax*} {r cf.reserve cf 100 BUCKETSIZE}
+        r cf.reserve cf 1000 MAXITERATIONS 50 EXPANSION 2
+        set info [r cf.info cf]
+        assert_equal 256 [dict get $info {Number of buckets}]
+        assert_equal 50 [dict get $info {Max iterations}]
+        assert_equal 2 [dict get $info {Expansion rate}]
+        assert_error {*item exists*} {r cf.reserve cf 100}
+    }
+
+    test {Scalable cuckoo filter grows without false negatives} {
+        r del cf
+        r cf.reserve cf 100 EXPANSION 2
+        for {set j 0} {$j < 2000} {incr j} {
+            assert_equal 1 [r cf.add cf item:$j]
+        }
+        assert {[dict get [r cf.info cf] {Number of filters}] > 1}
+        for {set j 0} {$j < 2000} {incr j} {
+            assert_equal 1 [r cf.exists cf item:$j]
+        }
+        for {set j 0} {$j < 2000} {incr j 2} {
+            assert_equal 1 [r cf.del cf item:$j]
+        }
+        for {set j 1} {$j < 2000} {incr j 2} {
+            assert_equal 1 [r cf.exists cf item:$j]
+        }
+        assert_equal 1000 [dict get [r cf.info cf] {Number of items inserted}]
+    }
+
+    test {Non scaling cuckoo filter refuses new items once full} {
+        r del cf
+        r cf.reserve cf 64 EXPANSION 0
+        set err {}
+        for {set j 0} {$j < 1000} {incr j} {
+            if {[catch {r cf.add cf item:$j} err]} break
+        }
+        assert_match {*filter is full*} $err
+        # Items added before the failure are all still there.
+        for {set k 0} {$k < $j} {incr k} {
+            assert_equal 1 [r cf.exists cf item:$k]
+        }
+        assert_equal $j [dict get [r cf.info cf] {Number of items inserted}]
+    }
+
+    test {Cuckoo filters survive DEBUG RELOAD and DUMP / RESTORE} {
+        r del cf
+        r cf.reserve cf 200
+        for {set j 0} {$j < 1000} {incr j} {
+            r cf.add cf item:$j
+        }
+        r cf.del cf item:10
+        set digest [r debug digest]
+        set info [r cf.info cf]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $info [r cf.info cf]
+        set dump [r dump cf]
+        r del cf
+        r restore cf 0 $dump
+        assert_equal $digest [r debug digest]
+    }
+}
+
+start_server {tags {"cuckoo"} overrides {appendonly yes}} {
+    test {Cuckoo filters are rebuilt by the AOF rewrite} {
+        r cf.reserve cf 100
+        for {set j 0} {$j < 300} {incr j} {
+            r cf.add cf item:$j
+        }
+        set digest [r debug digest]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+    }
+
+    test {Cuckoo filter insertions are replayed identically from the AOF} {
+        r del cf
+        r cf.reserve cf 64 MAXITERATIONS 100
+        for {set j 0} {$j < 500} {incr j} {
+            r cf.add cf item:$j
+            if {$j % 5 == 0} {r cf.del cf item:[expr {$j/2}]}
+        }
+        set digest [r debug digest]
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+    }
+}
@@ -0,0 +1,214 @@
+start_server {tags {"hash-field-expire"}} {
+    test {HEXPIRE sets a TTL on existing fields only} {
+        r del myhash
+        r hset myhash f1 v1
+        r hset myhash f2 v2
+        assert_equal {1 1 -2} [r hexpire myhash 100 FIELDS 3 f1 f2 nofield]
+        set ttl [r httl myhash FIELDS 2 f1 f2]
+        assert {[lindex $ttl 0] > 90 && [lindex $ttl 0] <= 100}
+        assert {[lindex $ttl 1] > 90 && [lindex $ttl 1] <= 100}
+        set pttl [lindex [r hpttl myhash FIELDS 1 f1] 0]
+        assert {$pttl > 90000 && $pttl <= 100000}
+    }
+
+    test {HTTL replies -2 for missing keys and -1 for persistent fields} {
+        r del myhash
+        assert_equal {-2 -2} [r httl myhash FIELDS 2 a b]
+        r hset myhash a 1
+        assert_equal {-1 -2} [r httl myhash FIELDS 2 a b]
+        assert_equal {-2} [r hexpire nokey 100 FIELDS 1 a]
+    }
+
+    test {HEXPIRE argument validation} {
+        r del myhash
+        r hset myhash a 1
+        assert_error {*FIELDS*} {r hexpire myhash 100 FOO 1 a}
+        assert_error {*numFields*} {r hexpire myhash 100 FIELDS 2 a}
+        assert_error {*numFields*} {r hexpire myhash 100 FIELDS 0 a}
+        assert_error {*not an integer*} {r hexpire myhash abc FIELDS 1 a}
+        r set mystring foo
+        assert_error {WRONGTYPE*} {r hexpire mystring 100 FIELDS 1 a}
+    }
+
+    test {HEXPIREAT and HPEXPIRETIME agree on the absolute time} {
+        r del myhash
+        r hset myhash a 1
+        set when [expr {[clock seconds]+1000}]
+        assert_equal {1} [r hexpireat myhash $when FIELDS 1 a]
+        assert_equal $when [lindex [r hexpiretime myhash FIELDS 1 a] 0]
+        assert_equal [expr {$when*1000}] \
+            [lindex [r hpexpiretime myhash FIELDS 1 a] 0]
+    }
+
+    test {HEXPIRE with a past time deletes the fields} {
+        r del myhash
+        r hset myhash a 1
+        r hset myhash b 2
+        r hset myhash c 3
+        assert_equal {2 -2} [r hexpire myhash 0 FIELDS 2 a nofield]
+        assert_equal {b c} [lsort [r hkeys myhash]]
+        assert_equal {2 2} [r hpexpireat myhash 1 FIELDS 2 b c]
+        assert_equal 0 [r exists myhash]
+    }
+
+    test {HPERSIST removes the field TTL} {
+        r del myhash
+        r hset myhash a 1
+        r hset myhash b 2
+        r hexpire myhash 100 FIELDS 1 a
+        assert_equal {1 -1 -2} [r hpersist myhash FIELDS 3 a b c]
+        assert_equal {-1 -1} [r httl myhash FIELDS 2 a b]
+    }
+
+    test {HSET and HDEL clear the field TTL, HINCRBY keeps it} {
+        r del myhash
+        r hset myhash a 1
+        r hset myhash b 2
+        r hset myhash c 3
+        r hexpire myhash 100 FIELDS 3 a b c
+        r hset myhash a 10
+        r hmset myhash b 20
+        r hincrby myhash c 1
+        assert_equal {-1 -1} [r httl myhash FIELDS 2 a b]
+        assert {[lindex [r httl myhash FIELDS 1 c] 0] > 0}
+        r hdel myhash c
+        r hset myhash c 1
+        assert_equal {-1} [r httl myhash FIELDS 1 c]
+    }
+
+    test {Expired fields are lazily removed on access} {
+        r debug set-active-expire 0
+        r del myhash
+        r hset myhash a 1
+        r hset myhash b 2
+        r hpexpire myhash 50 FIELDS 1 a
+        after 100
+        assert_equal {b} [r hkeys myhash]
+        assert_equal 1 [r hlen myhash]
+        r debug set-active-expire 1
+    } {OK}
+
+    test {A hash whose fields all expire is deleted} {
+        r debug set-active-expire 0
+        r del myhash
+        r hset myhash a 1
+        r hpexpire myhash 50 FIELDS 1 a
+        after 100
+        assert_equal 0 [r exists myhash]
+        r debug set-active-expire 1
+    } {OK}
+
+    test {Expired fields are actively reclaimed} {
+        r flushdb
+        r config resetstat
+        for {set j 0} {$j < 100} {incr j} {
+            r hset hash$j a 1
+            r hset hash$j b 2
+            r hpexpire hash$j 50 FIELDS 1 a
+        }
+        wait_for_condition 50 100 {
+            [s expired_fields] == 100
+        } else {
+            fail "Fields were not actively expired"
+        }
+        assert_equal 100 [r dbsize]
+        assert_equal {b} [r hkeys hash0]
+    }
+
+    test {Small hashes with volatile fields keep the ziplist encoding} {
+        r del myhash
+        r hset myhash a 1
+        r hset myhash b 2
+        r hexpire myhash 100 FIELDS 2 a b
+        assert_encoding ziplist myhash
+    }
+
+    test {RENAME and MOVE carry the field TTLs} {
+        r flushdb
+        r hset myhash a 1
+        r hset myhash b 2
+        r hexpire myhash 100 FIELDS 1 a
+        r rename myhash newhash
+        assert_equal {-2} [r httl myhash FIELDS 1 a]
+        assert {[lindex [r httl newhash FIELDS 1 a] 0] > 0}
+        assert_equal {-1} [r httl newhash FIELDS 1 b]
+        r select 10
+        r del newhash
+        r select 9
+        assert_equal 1 [r move newhash 10]
+        r select 10
+        assert {[lindex [r httl newhash FIELDS 1 a] 0] > 0}
+        r del newhash
+        r select 9
+        assert_equal {-2} [r httl newhash FIELDS 1 a]
+    }
+
+    test {Overwriting or deleting the hash drops the field TTLs} {
+        r del myhash
+        r hset myhash a 1
+        r hexpire myhash 100 FIELDS 1 a
+        r del myhash
+        r hset myhash a 1
+        assert_equal {-1} [r httl myhash FIELDS 1 a]
+        r hexpire myhash 100 FIELDS 1 a
+        r set myhash foo
+        r del myhash
+        r hset myhash a 1
+        assert_equal {-1} [r httl myhash FIELDS 1 a]
+    }
+
+    test {Field TTLs survive DEBUG RELOAD} {
+        r flushdb
+        r hset myhash a 1
+        r hset myhash b 2
+        r hset bighash a 1
+        for {set j 0} {$j < 200} {incr j} {r hset bighash field$j $j}
+        r hexpire myhash 100 FIELDS 1 a
+        r hexpire bighash 200 FIELDS 2 a field10
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert {[lindex [r httl myhash FIELDS 1 a] 0] > 0}
+        assert_equal {-1} [r httl myhash FIELDS 1 b]
+        set ttl [r httl bighash FIELDS 3 a field10 field11]
+        assert {[lindex $ttl 0] > 100 && [lindex $ttl 1] > 100}
+        assert_equal -1 [lindex $ttl 2]
+    }
+
+    test {Field TTLs survive an AOF rewrite} {
+        r flushdb
+        r hset myhash a 1
+        r hset myhash b 2
+        r hexpire myhash 100 FIELDS 1 a
+        set digest [r debug digest]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+        assert {[lindex [r httl myhash FIELDS 1 a] 0] > 0}
+    }
+
+    test {Field expiration is propagated as HDEL} {
+        r flushdb
+        r debug set-active-expire 0
+        set repl [attach_to_replication_stream]
+        r hset myhash a 1
+        r hset myhash b 2
+        r hexpire myhash 100 FIELDS 1 a
+        r hpexpire myhash 1 FIELDS 1 b
+        after 10
+        r hget myhash b
+        r hexpire myhash 0 FIELDS 1 a
+        assert_replication_stream $repl {
+            {select *}
+            {hset myhash a 1}
+            {hset myhash b 2}
+            {hpexpireat myhash * FIELDS 1 a}
+            {hpexpireat myhash * FIELDS 1 b}
+            {hdel myhash b}
+            {hdel myhash a}
+        }
+        close_replication_stream $repl
+        r debug set-active-expire 1
+    } {OK}
+}
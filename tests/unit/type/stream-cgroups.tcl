@@ -0,0 +1,424 @@
+start_server {
+    tags {"stream"}
+} {
+    test {XGROUP CREATE: creation and duplicate group name detection} {
+        r DEL mystream
+        r XADD mystream * foo bar
+        set err ""
+        catch {r XGROUP CREATE mystream mygroup $} err
+        assert_equal OK $err
+        catch {r XGROUP CREATE mystream mygroup $} err
+        set err
+    } {BUSYGROUP*}
+
+    test {XGROUP CREATE: automatic stream creation fails without MKSTREAM} {
+        r DEL mystream
+        catch {r XGROUP CREATE mystream mygroup $} err
+        set err
+    } {ERR*}
+
+    test {XGROUP CREATE: automatic stream creation works with MKSTREAM} {
+        r DEL mystream
+        r XGROUP CREATE mystream mygroup $ MKSTREAM
+    } {OK}
+
+    test {XREADGROUP will return only new elements} {
+        r XADD mystream * a 1
+        r XADD mystream * b 2
+        # XREADGROUP should return only the new elements "a 1" "b 1"
+        # and not the element "foo bar" which was pre existing in the
+        # stream (see previous test)
+        set reply [
+            r XREADGROUP GROUP mygroup consumer-1 STREAMS mystream ">"
+        ]
+        assert {[llength [lindex $reply 0 1]] == 2}
+        lindex $reply 0 1 0 1
+    } {a 1}
+
+    test {XREADGROUP can read the history of the elements we own} {
+        # Add a few more elements
+        r XADD mystream * c 3
+        r XADD mystream * d 4
+        # Read a few elements using a different consumer name
+        set reply [
+            r XREADGROUP GROUP mygroup consumer-2 STREAMS mystream ">"
+        ]
+        assert {[llength [lindex $reply 0 1]] == 2}
+        assert {[lindex $reply 0 1 0 1] eq {c 3}}
+
+        set r1 [r XREADGROUP GROUP mygroup consumer-1 COUNT 10 STREAMS mystream 0]
+        set r2 [r XREADGROUP GROUP mygroup consumer-2 COUNT 10 STREAMS mystream 0]
+        assert {[lindex $r1 0 1 0 1] eq {a 1}}
+        assert {[lindex $r2 0 1 0 1] eq {c 3}}
+    }
+
+    test {XPENDING is able to return pending items} {
+        set pending [r XPENDING mystream mygroup - + 10]
+        assert {[llength $pending] == 4}
+        for {set j 0} {$j < 4} {incr j} {
+            set item [lindex $pending $j]
+            if {$j < 2} {
+                set owner consumer-1
+            } else {
+                set owner consumer-2
+            }
+            assert {[lindex $item 1] eq $owner}
+            assert {[lindex $item 1] eq $owner}
+        }
+    }
+
+    test {XPENDING can return single consumer items} {
+        set pending [r XPENDING mystream mygroup - + 10 consumer-1]
+        assert {[llength $pending] == 2}
+    }
+
+    test {XPENDING only group} {
+        set pending [r XPENDING mystream mygroup]
+        assert {[llength $pending] == 4}
+        assert {[lindex $pending 0] == 4}
+        assert {[lindex $pending 3] eq {{consumer-1 2} {consumer-2 2}}}
+    }
+
+    test {XACK is able to remove messages from the PEL} {
+        set pending [r XPENDING mystream mygroup - + 10 consumer-1]
+        set id1 [lindex $pending 0 0]
+        set id2 [lindex $pending 1 0]
+        assert {[r XACK mystream mygroup $id1] eq 1}
+        set pending [r XPENDING mystream mygroup - + 10 consumer-1]
+        assert {[llength $pending] == 1}
+        set id [lindex $pending 0 0]
+        assert {$id eq $id2}
+        set global_pel [r XPENDING mystream mygroup - + 10]
+        assert {[llength $global_pel] == 3}
+    }
+
+    test {XACK can't remove the same item multiple times} {
+        assert {[r XACK mystream mygroup $id1] eq 0}
+    }
+
+    test {XACK is able to accept multiple arguments} {
+        # One of the IDs was already removed, so it should ack
+        # just the remaining two.
+        set pending [r XPENDING mystream mygroup - + 10 consumer-2]
+        set id3 [lindex $pending 0 0]
+        set id4 [lindex $pending 1 0]
+        assert {[r XACK mystream mygroup $id1 $id3 $id4] eq 2}
+        set global_pel [r XPENDING mystream mygroup - + 10]
+        assert {[llength $global_pel] == 1}
+    }
+
+    test {XACK should fail if got at least one invalid ID} {
+        r del mystream
+        r xgroup create s mygroup $ MKSTREAM
+        r xadd s * f1 v1
+        set c [llength [lindex [r xreadgroup group mygroup myconsumer streams s >] 0 1]]
+        assert {$c == 1}
+        set pending [r xpending s mygroup - + 10 myconsumer]
+        set id1 [lindex $pending 0 0]
+        assert_error "*Invalid stream ID specified*" {r xack s mygroup $id1 invalid-id}
+        assert {[r xack s mygroup $id1] eq 1}
+    }
+
+    test {PEL NACK reassignment after XGROUP SETID event} {
+        r del events
+        r xadd events * f1 v1
+        r xadd events * f1 v1
+        r xadd events * f1 v1
+        r xadd events * f1 v1
+        r xgroup create events g1 $
+        r xadd events * f1 v1
+        set c [llength [lindex [r xreadgroup group g1 c1 streams events >] 0 1]]
+        assert {$c == 1}
+        r xgroup setid events g1 -
+        set c [llength [lindex [r xreadgroup group g1 c2 streams events >] 0 1]]
+        assert {$c == 5}
+    }
+
+    test {XREADGROUP will not report data on empty history. Bug #5577} {
+        r del events
+        r xadd events * a 1
+        r xadd events * b 2
+        r xadd events * c 3
+        r xgroup create events mygroup 0
+
+        # Current semantics is that if we are reading the history and there
+        # is no data in the PEL, we return an empty array: all the elements
+        # were already read and acknowledged.
+        set res [r xreadgroup group mygroup myconsumer count 3 streams events 0]
+        assert {[lindex $res 0 1] == {}}
+
+        # We should fetch all the elements in the stream asking for >
+        set res [r xreadgroup group mygroup myconsumer count 3 streams events >]
+        assert {[llength [lindex $res 0 1]] == 3}
+
+        # Now the history is populated with three not acked entries
+        set res [r xreadgroup group mygroup myconsumer count 3 streams events 0]
+        assert {[llength [lindex $res 0 1]] == 3}
+    }
+
+    test {XREADGROUP history reporting of deleted entries} {
+        r del mystream
+        r xadd mystream 1 field1 A
+        r xgroup create mystream mygroup 0
+        r xreadgroup group mygroup myconsumer streams mystream >
+        r xdel mystream 1
+        set res [r xreadgroup group mygroup myconsumer streams mystream 0]
+        assert {[lindex $res 0 1 0] == {1-0 {}}}
+    }
+
+    test {Blocking XREADGROUP will not reply with an empty array} {
+        r del mystream
+        r XGROUP CREATE mystream mygroup $ MKSTREAM
+        r XADD mystream 666 f v
+        set res [r XREADGROUP GROUP mygroup Alice BLOCK 10 STREAMS mystream ">"]
+        assert {[lindex $res 0 1 0] == {666-0 {f v}}}
+        r XADD mystream 667 f2 v2
+        r XDEL mystream 667
+        set rd [redis_deferring_client]
+        $rd XREADGROUP GROUP mygroup Alice BLOCK 10 STREAMS mystream ">"
+        after 20
+        assert {[$rd read] == {}}
+    }
+
+    test {Blocking XREADGROUP: key deleted} {
+        r DEL mystream
+        r XADD mystream 666 f v
+        r XGROUP CREATE mystream mygroup $
+        set rd [redis_deferring_client]
+        $rd XREADGROUP GROUP mygroup Alice BLOCK 0 STREAMS mystream ">"
+        r DEL mystream
+        r XGROUP CREATE mystream mygroup $ MKSTREAM
+        r XADD mystream 667 f v
+        set res [$rd read]
+        assert {[lindex $res 0 1 0] == {667-0 {f v}}}
+    }
+
+    test {Blocking XREADGROUP: group destroyed} {
+        r DEL mystream
+        r XADD mystream 666 f v
+        r XGROUP CREATE mystream mygroup $
+        set rd [redis_deferring_client]
+        $rd XREADGROUP GROUP mygroup Alice BLOCK 0 STREAMS mystream ">"
+        r XGROUP DESTROY mystream mygroup
+        assert_error "*NOGROUP*" {$rd read}
+    }
+
+    test {XREADGROUP with NOACK creates no pending entries} {
+        r DEL mystream
+        r XGROUP CREATE mystream mygroup $ MKSTREAM
+        r XADD mystream 1 f v
+        r XADD mystream 2 f v
+        set res [r XREADGROUP GROUP mygroup Alice NOACK STREAMS mystream ">"]
+        assert {[llength [lindex $res 0 1]] == 2}
+        assert {[lindex [r XPENDING mystream mygroup] 0] == 0}
+        assert_equal {2-0} [dict get [lindex [r XINFO GROUPS mystream] 0] last-delivered-id]
+    }
+
+    test {XCLAIM can claim PEL items from another consumer} {
+        # Add 3 items into the stream, and create a consumer group
+        r del mystream
+        set id1 [r XADD mystream * a 1]
+        set id2 [r XADD mystream * b 2]
+        set id3 [r XADD mystream * c 3]
+        r XGROUP CREATE mystream mygroup 0
+
+        # Consumer 1 reads item 1 from the stream without acknowledgements.
+        # Consumer 2 then claims pending item 1 from the PEL of consumer 1
+        set reply [
+            r XREADGROUP GROUP mygroup consumer1 count 1 STREAMS mystream >
+        ]
+        assert {[llength [lindex $reply 0 1 0 1]] == 2}
+        assert {[lindex $reply 0 1 0 1] eq {a 1}}
+
+        # make sure the entry is present in both the group, and the right consumer
+        assert {[llength [r XPENDING mystream mygroup - + 10]] == 1}
+        assert {[llength [r XPENDING mystream mygroup - + 10 consumer1]] == 1}
+        assert {[llength [r XPENDING mystream mygroup - + 10 consumer2]] == 0}
+
+        after 200
+        set reply [
+            r XCLAIM mystream mygroup consumer2 10 $id1
+        ]
+        assert {[llength [lindex $reply 0 1]] == 2}
+        assert {[lindex $reply 0 1] eq {a 1}}
+
+        # make sure the entry is present in both the group, and the right consumer
+        assert {[llength [r XPENDING mystream mygroup - + 10]] == 1}
+        assert {[llength [r XPENDING mystream mygroup - + 10 consumer1]] == 0}
+        assert {[llength [r XPENDING mystream mygroup - + 10 consumer2]] == 1}
+
+        # Consumer 1 reads another 2 items from stream
+        r XREADGROUP GROUP mygroup consumer1 count 2 STREAMS mystream >
+        after 200
+
+        # Delete item 2 from the stream. Now consumer 1 has PEL that contains
+        # only item 3. Try to use consumer 2 to claim the deleted item 2
+        # from the PEL of consumer 1, this should return nil
+        r XDEL mystream $id2
+        set reply [
+            r XCLAIM mystream mygroup consumer2 10 $id2
+        ]
+        assert {[llength $reply] == 1}
+        assert_equal "" [lindex $reply 0]
+
+        # Delete item 3 from the stream. Now consumer 1 has PEL that is empty.
+        # Try to use consumer 2 to claim the deleted item 3 from the PEL
+        # of consumer 1, this should return nil
+        after 200
+        r XDEL mystream $id3
+        set reply [
+            r XCLAIM mystream mygroup consumer2 10 $id3
+        ]
+        assert {[llength $reply] == 1}
+        assert_equal "" [lindex $reply 0]
+    }
+
+    test {XCLAIM without JUSTID increments delivery count} {
+        # Add 3 items into the stream, and create a consumer group
+        r del mystream
+        set id1 [r XADD mystream * a 1]
+        set id2 [r XADD mystream * b 2]
+        set id3 [r XADD mystream * c 3]
+        r XGROUP CREATE mystream mygroup 0
+
+        # Consumer 1 reads item 1 from the stream without acknowledgements.
+        # Consumer 2 then claims pending item 1 from the PEL of consumer 1
+        set reply [
+            r XREADGROUP GROUP mygroup consumer1 count 1 STREAMS mystream >
+        ]
+        assert {[llength [lindex $reply 0 1 0 1]] == 2}
+        assert {[lindex $reply 0 1 0 1] eq {a 1}}
+        after 200
+        set reply [
+            r XCLAIM mystream mygroup consumer2 10 $id1
+        ]
+        assert {[llength [lindex $reply 0 1]] == 2}
+        assert {[lindex $reply 0 1] eq {a 1}}
+
+        set reply [
+            r XPENDING mystream mygroup - + 10
+        ]
+        assert {[llength [lindex $reply 0]] == 4}
+        assert {[lindex $reply 0 3] == 2}
+
+        # Consumer 3 then claims pending item 1 from the PEL of consumer 2 using JUSTID
+        after 200
+        set reply [
+            r XCLAIM mystream mygroup consumer3 10 $id1 JUSTID
+        ]
+        assert {[llength $reply] == 1}
+        assert {[lindex $reply 0] eq $id1}
+
+        set reply [
+            r XPENDING mystream mygroup - + 10
+        ]
+        assert {[llength [lindex $reply 0]] == 4}
+        assert {[lindex $reply 0 3] == 2}
+    }
+
+    test {XINFO FULL-like output of GROUPS and CONSUMERS} {
+        r del mystream
+        r XADD mystream 1-0 a 1
+        r XADD mystream 2-0 b 2
+        r XGROUP CREATE mystream mygroup 0
+        r XREADGROUP GROUP mygroup Alice COUNT 1 STREAMS mystream >
+        r XREADGROUP GROUP mygroup Bob COUNT 1 STREAMS mystream >
+        set group [lindex [r XINFO GROUPS mystream] 0]
+        assert_equal mygroup [dict get $group name]
+        assert_equal 2 [dict get $group consumers]
+        assert_equal 2 [dict get $group pending]
+        assert_equal 2-0 [dict get $group last-delivered-id]
+        set consumers [r XINFO CONSUMERS mystream mygroup]
+        assert_equal {Alice Bob} [list [dict get [lindex $consumers 0] name] \
+                                       [dict get [lindex $consumers 1] name]]
+        assert_equal 1 [dict get [lindex $consumers 1] pending]
+        set info [r XINFO STREAM mystream]
+        assert_equal 1 [dict get $info groups]
+        assert_equal {2-0 {b 2}} [dict get $info last-entry]
+    }
+
+    test {XGROUP DELCONSUMER removes the consumer and its pending entries} {
+        assert_equal 1 [r XGROUP DELCONSUMER mystream mygroup Alice]
+        assert_equal 1 [lindex [r XPENDING mystream mygroup] 0]
+        assert_equal 1 [llength [r XINFO CONSUMERS mystream mygroup]]
+    }
+
+    test {Consumer groups survive DEBUG RELOAD and AOF rewrite} {
+        r del mystream
+        for {set j 0} {$j < 50} {incr j} {r XADD mystream * item $j}
+        r XGROUP CREATE mystream g1 0
+        r XGROUP CREATE mystream g2 $
+        r XREADGROUP GROUP g1 Alice COUNT 10 STREAMS mystream >
+        r XREADGROUP GROUP g1 Bob COUNT 10 STREAMS mystream >
+        set pending [r XPENDING mystream g1]
+        set groups [r XINFO GROUPS mystream]
+        set digest [r debug digest]
+
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $pending [r XPENDING mystream g1]
+        assert_equal $groups [r XINFO GROUPS mystream]
+
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+        assert_equal $pending [r XPENDING mystream g1]
+        assert_equal $groups [r XINFO GROUPS mystream]
+    }
+
+    start_server {} {
+        set master [srv -1 client]
+        set master_host [srv -1 host]
+        set master_port [srv -1 port]
+        set slave [srv 0 client]
+
+        foreach noack {0 1} {
+            test "Consumer group last ID propagation to slave (NOACK=$noack)" {
+                $slave slaveof $master_host $master_port
+                wait_for_condition 50 100 {
+                    [s 0 master_link_status] eq {up}
+                } else {
+                    fail "Replication not started."
+                }
+
+                $master del stream
+                $master xadd stream * a 1
+                $master xadd stream * a 2
+                set id3 [$master xadd stream * a 3]
+                $master xgroup create stream mygroup 0
+
+                # Consume the first two items on the master
+                for {set j 0} {$j < 2} {incr j} {
+                    if {$noack} {
+                        set item [$master xreadgroup group mygroup \
+                                  myconsumer COUNT 1 NOACK STREAMS stream >]
+                    } else {
+                        set item [$master xreadgroup group mygroup \
+                                  myconsumer COUNT 1 STREAMS stream >]
+                    }
+                    set id [lindex $item 0 1 0 0]
+                    if {$noack == 0} {
+                        assert {[$master xack stream mygroup $id] eq "1"}
+                    }
+                }
+
+                wait_for_condition 50 100 {
+                    [$master debug digest] eq [$slave debug digest]
+                } else {
+                    fail "Master and slave are not consistent"
+                }
+
+                # Turn slave into master
+                $slave slaveof no one
+
+                set item [$slave xreadgroup group mygroup myconsumer \
+                          COUNT 1 STREAMS stream >]
+
+                # The consumed entry should be the third
+                set myid [lindex $item 0 1 0 0]
+                assert {$myid eq $id3}
+            }
+        }
+    }
+}
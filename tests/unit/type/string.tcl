@@ -420,3 +420,84 @@ start_server {tags {"string"}} {
         r getrange foo 0 4294967297
     } {bar}
 }
+
+start_server {tags {"string"}} {
+    r config set string-compress-threshold 1024
+
+    test {Large compressible values are stored with LZF encoding} {
+        r set foo [string repeat "abcdefgh" 1000]
+        assert_encoding lzf foo
+        assert_equal [string repeat "abcdefgh" 1000] [r get foo]
+        assert_equal 8000 [r strlen foo]
+        assert_equal "defgh" [r getrange foo 3 7]
+        assert {[s lzf_strings] >= 1}
+        assert {[s lzf_strings_saved] > 0}
+    }
+
+    test {Small or incompressible values are not compressed} {
+        r set small [string repeat "x" 10]
+        assert_encoding embstr small
+        set rnd [randstring 2000 2000 binary]
+        r set rnd $rnd
+        assert_encoding raw rnd
+        assert_equal $rnd [r get rnd]
+    }
+
+    test {HyperLogLog-like values are not compressed} {
+        r set hll "HYLL[string repeat "a" 2000]"
+        assert_encoding raw hll
+    }
+
+    test {APPEND and SETRANGE against an LZF encoded value} {
+        r set foo [string repeat "a" 2000]
+        assert_encoding lzf foo
+        r append foo "bcd"
+        assert_encoding raw foo
+        assert_equal "[string repeat "a" 2000]bcd" [r get foo]
+        r set foo [string repeat "a" 2000]
+        r setrange foo 1998 "xyz"
+        assert_equal "[string repeat "a" 1998]xyz" [r get foo]
+    }
+
+    test {Bit commands against an LZF encoded value} {
+        r set foo [string repeat "\xff" 2000]
+        assert_encoding lzf foo
+        assert_equal 16000 [r bitcount foo]
+        assert_equal 8 [r bitcount foo 10 10]
+        assert_equal 1 [r getbit foo 100]
+        assert_equal 0 [r bitpos foo 1]
+        assert_equal 8 [r bitpos foo 1 1]
+        assert_equal 255 [r bitfield foo get u8 0]
+        # Reads don't replace the stored value with its plain version.
+        assert_encoding lzf foo
+        r set foo [string repeat "\xff" 2000]
+        r setbit foo 0 0
+        assert_encoding raw foo
+        assert_equal 15999 [r bitcount foo]
+        r set foo [string repeat "\xff" 2000]
+        r bitfield foo set u8 0 0
+        assert_encoding raw foo
+        assert_equal 15992 [r bitcount foo]
+    }
+
+    test {LZF encoded values survive DEBUG RELOAD and DUMP/RESTORE} {
+        set val [string repeat "hello world " 500]
+        r set foo $val
+        r debug reload
+        assert_encoding lzf foo
+        assert_equal $val [r get foo]
+        set dump [r dump foo]
+        r del foo
+        r restore foo 0 $dump
+        assert_encoding lzf foo
+        assert_equal $val [r get foo]
+    }
+
+    test {Disabling compression leaves existing values readable} {
+        r set foo [string repeat "abcdefgh" 1000]
+        r config set string-compress-threshold 0
+        assert_equal [string repeat "abcdefgh" 1000] [r get foo]
+        r set bar [string repeat "abcdefgh" 1000]
+        assert_encoding raw bar
+    }
+}
@@ -0,0 +1,149 @@
+start_server {tags {"timeseries"}} {
+    test {TS.ADD creates a series and TS.GET returns the last sample} {
+        r del ts
+        assert_equal 1000 [r ts.add ts 1000 1.5]
+        assert_equal 2000 [r ts.add ts 2000 2.5]
+        assert_equal {timeseries chunked} [list [r type ts] [r object encoding ts]]
+        assert_equal {2000 2.5} [r ts.get ts]
+        assert_error {*greater than the last*} {r ts.add ts 2000 1}
+        assert_error {*greater than the last*} {r ts.add ts 1500 1}
+        assert_error {*non negative*} {r ts.add ts -1 1}
+        assert_error {*not a valid float*} {r ts.add ts 3000 foo}
+    }
+
+    test {TS.ADD with * uses the server time} {
+        r del ts
+        set now [clock milliseconds]
+        set ts [r ts.add ts * 10]
+        assert {$ts >= $now && $ts < $now+10000}
+    }
+
+    test {TS.CREATE and TS.INFO} {
+        r del ts
+        r ts.create ts RETENTION 60000 CHUNK_SIZE 256
+        assert_error {*already exists*} {r ts.create ts}
+        assert_equal {} [r ts.get ts]
+        assert_equal {} [r ts.range ts - +]
+        set info [r ts.info ts]
+        assert_equal 0 [dict get $info totalSamples]
+        assert_equal 60000 [dict get $info retentionTime]
+        assert_equal 256 [dict get $info chunkSize]
+        assert_equal -1 [dict get $info firstTimestamp]
+        assert_error {*chunk size*} {r ts.create ts2 CHUNK_SIZE 1}
+        assert_error {*retention*} {r ts.create ts2 RETENTION -1}
+        assert_error {*syntax*} {r ts.create ts2 FOO}
+    }
+
+    test {TS.RANGE returns the samples in the range} {
+        r del ts
+        for {set j 0} {$j < 1000} {incr j} {
+            r ts.add ts [expr {$j*1000}] [expr {$j*0.25}]
+        }
+        assert_equal {{10000 2.5} {11000 2.75}} [r ts.range ts 10000 11500]
+        assert_equal {{0 0} {1000 0.25}} [r ts.range ts - + COUNT 2]
+        assert_equal {{999000 249.75}} [r ts.range ts 998500 +]
+        assert_equal {} [r ts.range ts 500 999]
+        assert_equal 1000 [llength [r ts.range ts - +]]
+        assert_equal {} [r ts.range nokey - +]
+    }
+
+    test {TS.RANGE aggregations} {
+        r del ts
+        foreach {t v} {0 1 1000 5 2000 3 10000 7 12000 2 25000 4} {
+            r ts.add ts $t $v
+        }
+        assert_equal {{0 3} {10000 4.5} {20000 4}} [r ts.range ts - + AGGREGATION avg 10000]
+        assert_equal {{0 9} {10000 9} {20000 4}} [r ts.range ts - + AGGREGATION sum 10000]
+        assert_equal {{0 1} {10000 2} {20000 4}} [r ts.range ts - + AGGREGATION min 10000]
+        assert_equal {{0 5} {10000 7} {20000 4}} [r ts.range ts - + AGGREGATION max 10000]
+        assert_equal {{0 3} {10000 2} {20000 1}} [r ts.range ts - + AGGREGATION count 10000]
+        assert_equal {{0 1} {10000 7} {20000 4}} [r ts.range ts - + AGGREGATION first 10000]
+        assert_equal {{0 3} {10000 2} {20000 4}} [r ts.range ts - + AGGREGATION last 10000]
+        assert_equal {{0 4} {10000 5} {20000 0}} [r ts.range ts - + AGGREGATION range 10000]
+        assert_equal {{0 9} {10000 9}} [r ts.range ts - + COUNT 2 AGGREGATION sum 10000]
+        assert_equal {{10000 9}} [r ts.range ts 5000 15000 AGGREGATION sum 10000]
+        assert_error {*unknown aggregation*} {r ts.range ts - + AGGREGATION foo 10}
+        assert_error {*bucket duration*} {r ts.range ts - + AGGREGATION avg 0}
+    }
+
+    test {Regular samples take a couple of bytes each} {
+        r del ts
+        for {set j 0} {$j < 20000} {incr j} {
+            r ts.add ts [expr {1500000000000+$j*10000}] [expr {20+($j/100)*0.5}]
+        }
+        set info [r ts.info ts]
+        assert_equal 20000 [dict get $info totalSamples]
+        assert {[dict get $info memoryUsage] < 20000*3}
+        assert {[dict get $info chunkCount] > 1}
+    }
+
+    test {Retention trims the old samples} {
+        r del ts
+        r ts.create ts RETENTION 10000 CHUNK_SIZE 128
+        for {set j 0} {$j < 10000} {incr j} {
+            r ts.add ts [expr {$j*10}] $j
+        }
+        set info [r ts.info ts]
+        assert_equal 89990 [dict get $info firstTimestamp]
+        assert {[dict get $info totalSamples] < 2000}
+        assert_equal {89990 8999} [lindex [r ts.range ts - +] 0]
+        assert_equal 1001 [llength [r ts.range ts - +]]
+    }
+
+    test {TS commands against the wrong type} {
+        r del ts
+        r set ts foo
+        assert_error {WRONGTYPE*} {r ts.add ts 1 1}
+        assert_error {WRONGTYPE*} {r ts.get ts}
+        assert_error {WRONGTYPE*} {r ts.range ts - +}
+    }
+
+    test {Time series survive DEBUG RELOAD and DUMP / RESTORE} {
+        r del ts
+        r ts.create ts RETENTION 1000000 CHUNK_SIZE 128
+        for {set j 0} {$j < 500} {incr j} {
+            r ts.add ts [expr {$j*1000+$j%7}] [expr {sin($j)}]
+        }
+        set digest [r debug digest]
+        set range [r ts.range ts - +]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $range [r ts.range ts - +]
+        r ts.add ts 1000000 42
+        assert_equal {1000000 42} [r ts.get ts]
+        set dump [r dump ts]
+        r del ts
+        r restore ts 0 $dump
+        assert_equal {1000000 42} [r ts.get ts]
+        assert_equal 1000000 [dict get [r ts.info ts] retentionTime]
+    }
+
+    test {Time series keys can expire} {
+        r del ts
+        r ts.add ts 1 1
+        r pexpire ts 100
+        after 200
+        assert_equal 0 [r exists ts]
+    }
+}
+
+start_server {tags {"timeseries"} overrides {appendonly yes}} {
+    test {Time series are rebuilt by the AOF rewrite} {
+        for {set j 0} {$j < 100} {incr j} {
+            r ts.add ts [expr {$j*1000}] $j
+        }
+        set digest [r debug digest]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+        assert_equal {99000 99} [r ts.get ts]
+    }
+
+    test {TS.ADD * is propagated with the actual timestamp} {
+        r del ts
+        set ts [r ts.add ts * 1]
+        r debug loadaof
+        assert_equal [list $ts 1] [r ts.get ts]
+    }
+}
@@ -0,0 +1,114 @@
+start_server {tags {"topk"}} {
+    test {TOPK.RESERVE creates an empty top-k} {
+        r del tk
+        r topk.reserve tk 10
+        assert_equal {topk topk} [list [r type tk] [r object encoding tk]]
+        set info [r topk.info tk]
+        assert_equal {10 256 5} [list [dict get $info k] [dict get $info width] [dict get $info depth]]
+        assert_equal {} [r topk.list tk]
+        r del tk
+        r topk.reserve tk 3 50 4
+        set info [r topk.info tk]
+        assert_equal {3 50 4} [list [dict get $info k] [dict get $info width] [dict get $info depth]]
+    }
+
+    test {TOPK.RESERVE argument validation} {
+        r del tk
+        assert_error {*value must be*} {r topk.reserve tk 0}
+        assert_error {*k must be*} {r topk.reserve tk 1000000}
+        assert_error {*syntax*} {r topk.reserve tk 10 50}
+        assert_error {*value must be*} {r topk.reserve tk 10 0 5}
+        r topk.reserve tk 10
+        assert_error {*item exists*} {r topk.reserve tk 10}
+    }
+
+    test {TOPK.ADD reports the expelled items} {
+        r del tk
+        assert_error {*no such key*} {r topk.add tk foo}
+        r topk.reserve tk 2 100 4
+        assert_equal {{} {} {}} [r topk.add tk a b a]
+        # Ties keep the items already in the top-k.
+        assert_equal {{}} [r topk.add tk c]
+        assert_equal {b} [r topk.add tk c]
+        assert_equal {a 2 c 2} [lsort -stride 2 [r topk.list tk WITHCOUNT]]
+        assert_equal {1 1 0} [r topk.query tk c a b]
+    }
+
+    test {TOPK.INCRBY and TOPK.COUNT} {
+        r del tk
+        r topk.reserve tk 3 100 4
+        assert_equal {{} {} {}} [r topk.incrby tk foo 10 bar 5 baz 1]
+        assert_equal {baz} [r topk.incrby tk qux 2]
+        assert_equal {foo bar qux} [r topk.list tk]
+        assert_equal {10 5 1 2 0} [r topk.count tk foo bar baz qux none]
+        assert_error {*syntax*} {r topk.incrby tk foo 1 bar}
+        assert_error {*value must be*} {r topk.incrby tk foo -1}
+        assert_error {*syntax*} {r topk.list tk FOO}
+    }
+
+    test {TOPK finds the heavy hitters of a skewed stream} {
+        r del tk
+        r topk.reserve tk 5
+        for {set j 0} {$j < 2000} {incr j} {
+            r topk.add tk noise:$j
+            if {$j % 4 == 0} {r topk.add tk hot:[expr {$j % 5}]}
+        }
+        assert_equal {hot:0 hot:1 hot:2 hot:3 hot:4} [lsort [r topk.list tk]]
+    }
+
+    test {TOPK.MERGE combines per-shard top-k} {
+        r del a b tk
+        r topk.reserve a 2 100 4
+        r topk.reserve b 2 100 4
+        r topk.reserve tk 2 100 4
+        r topk.incrby a x 5 y 4
+        r topk.incrby b z 7 y 3
+        r topk.merge tk 2 a b
+        assert_equal {y 7 z 7} [lsort -stride 2 [r topk.list tk WITHCOUNT]]
+        assert_equal {5 7 7} [r topk.count tk x y z]
+        r del c
+        r topk.reserve c 2 50 4
+        assert_error {*same width and depth*} {r topk.merge tk 2 a c}
+        assert_error {*no such key*} {r topk.merge tk 1 missing}
+        assert_error {*syntax*} {r topk.merge tk 1 a b}
+    }
+
+    test {TOPK commands against the wrong type} {
+        r del tk
+        r set tk foo
+        assert_error {WRONGTYPE*} {r topk.add tk foo}
+        assert_error {WRONGTYPE*} {r topk.query tk foo}
+        assert_error {WRONGTYPE*} {r topk.list tk}
+    }
+
+    test {Top-k survives DEBUG RELOAD and DUMP / RESTORE} {
+        r del tk
+        r topk.reserve tk 10
+        for {set j 0} {$j < 500} {incr j} {
+            r topk.add tk item:[expr {$j % 23}]
+        }
+        r topk.add tk 12345
+        set digest [r debug digest]
+        set list [r topk.list tk WITHCOUNT]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $list [r topk.list tk WITHCOUNT]
+        set dump [r dump tk]
+        r del tk
+        r restore tk 0 $dump
+        assert_equal $digest [r debug digest]
+    }
+}
+
+start_server {tags {"topk"} overrides {appendonly yes}} {
+    test {Top-k is rebuilt by the AOF rewrite} {
+        r topk.reserve tk 3
+        r topk.incrby tk foo 10 bar 20 baz 5
+        set digest [r debug digest]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+        assert_equal {bar foo baz} [r topk.list tk]
+    }
+}
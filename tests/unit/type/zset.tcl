@@ -13,6 +13,11 @@ start_server {tags {"zset"}} {
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding skiplist
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding btree
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -62,6 +67,18 @@ start_server {tags {"zset"}} {
             assert {[r zcard ztmp] == 1}
         }
 
+        test "ZADD many pairs against a new key - $encoding" {
+            r del ztmp
+            assert_equal 3 [r zadd ztmp 3 c 1 a 2 b 5 a]
+            assert_encoding $encoding ztmp
+            assert_equal {b 2 c 3 a 5} [r zrange ztmp 0 -1 withscores]
+            r del ztmp
+            assert_equal 4 [r zadd ztmp ch 3 c 1 a 2 b 5 a 2 b]
+            r del ztmp
+            assert_equal 2 [r zadd ztmp nx 3 c 1 a 5 a]
+            assert_equal {a 1 c 3} [r zrange ztmp 0 -1 withscores]
+        }
+
         test "ZADD XX returns the number of elements actually added" {
             r del ztmp
             r zadd ztmp 10 x
@@ -652,6 +669,8 @@ start_server {tags {"zset"}} {
 
     basics ziplist
     basics skiplist
+    basics btree
+    r config set zset-large-encoding skiplist
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
         r del seta setb setc
@@ -705,12 +724,39 @@ start_server {tags {"zset"}} {
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding skiplist
             if {$::accurate} {set elements 1000} else {set elements 100}
+        } elseif {$encoding == "btree"} {
+            # Enough elements to have a tree with inner nodes.
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding btree
+            if {$::accurate} {set elements 5000} else {set elements 1000}
         } else {
             puts "Unknown sorted set encoding"
             exit
         }
 
+        test "ZADD bulk load matches single insertions - $encoding" {
+            r del zbulk zsingle
+            set cmd [list r zadd zbulk]
+            for {set i 0} {$i < $elements} {incr i} {
+                set score [randomInt 100]
+                set ele [randomInt [expr {$elements/2+1}]]
+                lappend cmd $score $ele
+                r zadd zsingle $score $ele
+            }
+            {*}$cmd
+            assert_equal [r zcard zsingle] [r zcard zbulk]
+            assert_encoding [r object encoding zsingle] zbulk
+            assert_equal [r zrange zsingle 0 -1 withscores] \
+                         [r zrange zbulk 0 -1 withscores]
+            for {set i 0} {$i < 20} {incr i} {
+                set ele [randomInt [expr {$elements/2+1}]]
+                assert_equal [r zrank zsingle $ele] [r zrank zbulk $ele]
+            }
+        }
+
         test "ZSCORE - $encoding" {
             r del zscoretest
             set aux {}
@@ -1026,5 +1072,65 @@ start_server {tags {"zset"}} {
     tags {"slow"} {
         stressers ziplist
         stressers skiplist
+        stressers btree
+        r config set zset-large-encoding skiplist
+    }
+
+    test {ZSET btree encoding fuzzing against skiplist} {
+        r config set zset-max-ziplist-entries 0
+        r config set zset-max-ziplist-value 0
+        r del zsl zbt
+        r config set zset-large-encoding skiplist
+        r zadd zsl 0 placeholder
+        r config set zset-large-encoding btree
+        r zadd zbt 0 placeholder
+        assert_encoding skiplist zsl
+        assert_encoding btree zbt
+
+        set err {}
+        for {set j 0} {$j < 20000} {incr j} {
+            set ele [randomInt 3000]
+            set score [randomInt 100]
+            set op [randomInt 20]
+            if {$op < 12} {
+                set cmd [list zadd $score $ele]
+            } elseif {$op < 15} {
+                set cmd [list zrem $ele]
+            } elseif {$op < 18} {
+                set cmd [list zincrby $score $ele]
+            } elseif {$op == 18} {
+                set start [randomInt 500]
+                set cmd [list zremrangebyrank $start [expr {$start+[randomInt 200]}]]
+            } else {
+                set cmd [list zremrangebyscore $score [expr {$score+[randomInt 3]}]]
+            }
+            set a [r {*}[linsert $cmd 1 zsl]]
+            set b [r {*}[linsert $cmd 1 zbt]]
+            if {$a ne $b} {
+                set err "$cmd: $a != $b"
+                break
+            }
+            if {[r exists zbt] == 0} {
+                r zadd zbt 0 placeholder
+                r zadd zsl 0 placeholder
+            }
+        }
+        assert_equal {} $err
+        assert_encoding btree zbt
+        assert_equal [r zrange zsl 0 -1 withscores] [r zrange zbt 0 -1 withscores]
+        for {set j 0} {$j < 100} {incr j} {
+            set min [randomInt 100]
+            set max [expr {$min+[randomInt 20]}]
+            set off [randomInt 50]
+            foreach cmd {zrangebyscore zrevrangebyscore} {
+                assert_equal [r $cmd zsl $min $max withscores limit $off 20] \
+                             [r $cmd zbt $min $max withscores limit $off 20]
+            }
+            assert_equal [r zcount zsl $min $max] [r zcount zbt $min $max]
+            set rank [randomInt [r zcard zsl]]
+            assert_equal [r zrevrange zsl $rank [expr {$rank+10}]] \
+                         [r zrevrange zbt $rank [expr {$rank+10}]]
+        }
+        r config set zset-large-encoding skiplist
     }
 }